@@ -0,0 +1,348 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * Per datagram cost of building the reassembled packet from its
+ * fragments in Defrag4Reassemble (src/defrag.c), for datagrams of 2, 8
+ * and 44 fragments (44 full size fragments is the largest IPv4 datagram).
+ *
+ * The fragments of an ethernet/IPv4/UDP datagram are generated like they
+ * would be on the wire, each in its own allocation. The old way copies each fragment
+ * with PacketCopyDataOffset semantics: the check per fragment and, when
+ * the datagram outgrows the packet, a 64k buffer plus a copy of the data
+ * already in the packet. The new way sizes the packet once and copies
+ * the fragments straight into it.
+ *
+ * Both ways are copies of the copy loops of Defrag4Reassemble, before
+ * and after, with PacketCopyDataOffset and PacketReserveData reduced to
+ * the data part of the packet. Tracker lookup, the packet pool and the
+ * decoding of the result are left out, so this times the model and not
+ * src/defrag.c; use the pcaps below for the engine.
+ *
+ * Old and new alternate for a number of passes and the fastest pass of
+ * each is reported, as single passes vary a lot between runs. The
+ * saving is largest for datagrams that fit the packet (2 fragments) and
+ * shrinks as the datagram grows, since the copy of the data itself takes
+ * over; at 44 fragments it is a few percent at most. Both the figures
+ * and the ratios depend on the box, so don't carry them over.
+ *
+ * With -w the generated datagrams are also written to <prefix>-<n>.pcap,
+ * so the full engine can be timed on the same traffic:
+ *
+ *   suricata -r <prefix>-44.pcap -k none --runmode single
+ *
+ * and compare defrag.ipv4.reassembled against the run time.
+ *
+ * Build & run:
+ *
+ *   gcc -O2 -o defrag defrag.c
+ *   ./defrag [datagrams] [-w prefix]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define DEFAULT_PACKET_SIZE 1514
+#define MAX_PAYLOAD_SIZE    (65535 + 14)
+#define ETH_LEN             14
+#define IPV4_LEN            20
+#define FRAG_DATA_LEN       1480
+/* times each set of datagrams is reassembled per pass */
+#define ROUNDS              20
+/* passes per variant, old and new alternate; the fastest pass counts */
+#define PASSES              7
+
+/* mirrors the data part of a Packet: direct space plus optional
+ * extended buffer */
+typedef struct Pkt_ {
+    uint8_t *ext_pkt;
+    uint32_t len;
+    uint8_t direct[DEFAULT_PACKET_SIZE];
+} Pkt;
+
+#define PKT_DATA(p) ((p)->ext_pkt ? (p)->ext_pkt : (p)->direct)
+
+typedef struct Frag_ {
+    uint16_t offset;
+    uint16_t data_len;
+    uint16_t len;
+    uint8_t more_frags;
+    uint8_t *pkt;
+} Frag;
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static inline uint32_t Rand(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return (uint32_t)rnd_state;
+}
+
+static double Now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static uint16_t Csum(const uint8_t *b, int len)
+{
+    uint32_t sum = 0;
+    int i;
+    for (i = 0; i + 1 < len; i += 2)
+        sum += (b[i] << 8) | b[i + 1];
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/* build fragment i of n of datagram id as an ethernet frame */
+static uint8_t *BuildFrag(uint16_t id, int i, int n, uint16_t *len)
+{
+    int data_len = FRAG_DATA_LEN;
+    if (i == n - 1)
+        data_len = 1000;
+    *len = ETH_LEN + IPV4_LEN + data_len;
+
+    uint8_t *f = calloc(1, *len);
+    if (f == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(f, 0x02, 12);
+    f[12] = 0x08;
+    uint8_t *ip = f + ETH_LEN;
+    ip[0] = 0x45;
+    ip[2] = (IPV4_LEN + data_len) >> 8;
+    ip[3] = (IPV4_LEN + data_len) & 0xff;
+    ip[4] = id >> 8;
+    ip[5] = id & 0xff;
+    uint16_t off = (i * FRAG_DATA_LEN / 8) | (i < n - 1 ? 0x2000 : 0);
+    ip[6] = off >> 8;
+    ip[7] = off & 0xff;
+    ip[8] = 64;
+    ip[9] = 17;
+    ip[12] = 10; ip[15] = 1;
+    ip[16] = 10; ip[19] = 2;
+    uint16_t csum = Csum(ip, IPV4_LEN);
+    ip[10] = csum >> 8;
+    ip[11] = csum & 0xff;
+    memset(ip + IPV4_LEN, 'a' + i % 26, data_len);
+    return f;
+}
+
+/* PacketCopyDataOffset */
+static int CopyDataOffset(Pkt *p, int offset, const uint8_t *data, int datalen)
+{
+    if (offset + datalen > MAX_PAYLOAD_SIZE)
+        return -1;
+    if (p->ext_pkt == NULL) {
+        if (offset + datalen <= DEFAULT_PACKET_SIZE) {
+            memcpy(p->direct + offset, data, datalen);
+        } else {
+            p->ext_pkt = malloc(MAX_PAYLOAD_SIZE);
+            if (p->ext_pkt == NULL)
+                return -1;
+            memcpy(p->ext_pkt, p->direct, DEFAULT_PACKET_SIZE);
+            memcpy(p->ext_pkt + offset, data, datalen);
+        }
+    } else {
+        memcpy(p->ext_pkt + offset, data, datalen);
+    }
+    return 0;
+}
+
+static int ReassembleOld(Pkt *p, Frag *frags, int n)
+{
+    int fragmentable_offset = ETH_LEN + IPV4_LEN;
+    int i;
+    for (i = 0; i < n; i++) {
+        Frag *frag = &frags[i];
+        if (frag->offset == 0) {
+            p->len = frag->len;
+            if (CopyDataOffset(p, 0, frag->pkt, frag->len) == -1)
+                return -1;
+        } else if (CopyDataOffset(p, fragmentable_offset + frag->offset,
+                    frag->pkt + fragmentable_offset, frag->data_len) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int ReassembleNew(Pkt *p, Frag *frags, int n)
+{
+    int fragmentable_offset = ETH_LEN + IPV4_LEN;
+    int size = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        int end = frags[i].offset == 0 ? frags[i].len :
+            fragmentable_offset + frags[i].offset + frags[i].data_len;
+        if (end > size)
+            size = end;
+    }
+    if (size > MAX_PAYLOAD_SIZE)
+        return -1;
+    if (size > DEFAULT_PACKET_SIZE) {
+        p->ext_pkt = malloc(MAX_PAYLOAD_SIZE);
+        if (p->ext_pkt == NULL)
+            return -1;
+    }
+
+    uint8_t *data = PKT_DATA(p);
+    for (i = 0; i < n; i++) {
+        Frag *frag = &frags[i];
+        if (frag->offset == 0) {
+            memcpy(data, frag->pkt, frag->len);
+        } else {
+            memcpy(data + fragmentable_offset + frag->offset,
+                    frag->pkt + fragmentable_offset, frag->data_len);
+        }
+    }
+    p->len = size;
+    return 0;
+}
+
+static void WritePcap(const char *prefix, int n, Frag **dgrams, int cnt)
+{
+    char fname[256];
+    snprintf(fname, sizeof(fname), "%s-%d.pcap", prefix, n);
+    FILE *fp = fopen(fname, "wb");
+    if (fp == NULL) {
+        perror(fname);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t ghdr[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1 };
+    fwrite(ghdr, sizeof(ghdr), 1, fp);
+    int d, i;
+    uint32_t usec = 0;
+    for (d = 0; d < cnt; d++) {
+        for (i = 0; i < n; i++) {
+            Frag *frag = &dgrams[d][i];
+            uint32_t rhdr[4] = { 1470000000 + usec / 1000000, usec % 1000000,
+                                 frag->len, frag->len };
+            usec += 10;
+            fwrite(rhdr, sizeof(rhdr), 1, fp);
+            fwrite(frag->pkt, frag->len, 1, fp);
+        }
+    }
+    fclose(fp);
+    printf("  wrote %s\n", fname);
+}
+
+static void Bench(int n, int cnt, const char *prefix)
+{
+    Frag **dgrams = malloc(cnt * sizeof(Frag *));
+    Pkt *p = malloc(sizeof(Pkt));
+    if (dgrams == NULL || p == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* fragments sorted by offset as in the tracker, but allocated
+     * starting at a random one so they are spread over memory like on
+     * arrival */
+    int d, i;
+    for (d = 0; d < cnt; d++) {
+        dgrams[d] = calloc(n, sizeof(Frag));
+        if (dgrams[d] == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (d = 0; d < cnt; d++) {
+        int start = Rand() % n;
+        for (i = 0; i < n; i++) {
+            int f = (start + i) % n;
+            Frag *frag = &dgrams[d][f];
+            frag->pkt = BuildFrag((uint16_t)d, f, n, &frag->len);
+            frag->offset = f * FRAG_DATA_LEN;
+            frag->data_len = frag->len - ETH_LEN - IPV4_LEN;
+            frag->more_frags = f < n - 1;
+        }
+    }
+
+    double t[2] = { 0, 0 };
+    uint64_t check[2] = { 0, 0 };
+    int pass, run;
+    for (pass = 0; pass < PASSES; pass++) {
+        for (run = 0; run < 2; run++) {
+            double start = Now();
+            int round;
+            for (round = 0; round < ROUNDS; round++) {
+                for (d = 0; d < cnt; d++) {
+                    memset(p, 0, offsetof(Pkt, direct));
+                    int r = run == 0 ? ReassembleOld(p, dgrams[d], n) :
+                                       ReassembleNew(p, dgrams[d], n);
+                    if (r == 0)
+                        check[run] += PKT_DATA(p)[ETH_LEN + IPV4_LEN + (n - 1) * FRAG_DATA_LEN];
+                    free(p->ext_pkt);
+                }
+            }
+            double elapsed = Now() - start;
+            if (pass == 0 || elapsed < t[run])
+                t[run] = elapsed;
+        }
+    }
+
+    printf("%2d frags: old %8.1f ns/dgram  new %8.1f ns/dgram  x%.2f %s\n", n,
+            t[0] * 1e9 / (cnt * ROUNDS), t[1] * 1e9 / (cnt * ROUNDS), t[0] / t[1],
+            check[0] == check[1] ? "" : "MISMATCH");
+
+    if (prefix != NULL)
+        WritePcap(prefix, n, dgrams, cnt);
+
+    for (d = 0; d < cnt; d++) {
+        for (i = 0; i < n; i++)
+            free(dgrams[d][i].pkt);
+        free(dgrams[d]);
+    }
+    free(dgrams);
+    free(p);
+}
+
+int main(int argc, char *argv[])
+{
+    int cnt = 1000;
+    const char *prefix = NULL;
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            prefix = argv[++i];
+        } else {
+            cnt = atoi(argv[i]);
+        }
+    }
+    if (cnt <= 0) {
+        fprintf(stderr, "usage: %s [datagrams] [-w prefix]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("(model of the Defrag4Reassemble copy, not the src objects)\n");
+    int sizes[] = { 2, 8, 44 };
+    for (i = 0; i < 3; i++)
+        Bench(sizes[i], cnt, prefix);
+    exit(EXIT_SUCCESS);
+}
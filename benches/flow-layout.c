@@ -0,0 +1,257 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * Flow lookup and update cost with the old and the cache line aware
+ * layout of the Flow struct (src/flow.h).
+ *
+ * The two structs below mirror the member order and sizes of Flow before
+ * and after the hot/cold split. A chained hash with a few flows per row
+ * is filled with a large number of flows, then random flows are looked
+ * up (walk the row comparing the flow "header") and updated like
+ * FlowHandlePacketUpdate does (lock, lastts, flags, counters, protoctx).
+ *
+ * The structs are kept in step with src/flow.h by hand and the hash is
+ * not FlowGetFlowFromHash, so this models the layout change only. Check
+ * the offsets against pahole output of a real build before trusting a
+ * result.
+ *
+ * Build & run:
+ *
+ *   gcc -O2 -o flow-layout flow-layout.c -lpthread
+ *   ./flow-layout [flows] [lookups]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define CLS 64
+
+/* Flow before the split: 288 bytes, header line, then the rest mixed */
+typedef struct FlowOld_ {
+    uint32_t src[4], dst[4];
+    uint16_t sp, dp;
+    uint8_t proto, recursion_level;
+    uint16_t vlan_id[2];
+    uint32_t flow_hash;
+    struct timeval lastts;
+    uint16_t flow_state, use_cnt;
+    uint32_t tenant_id;
+    uint32_t pp_masks[2];
+    uint32_t flags;
+    pthread_mutex_t m;
+    void *protoctx;
+    uint8_t protomap, flow_end_flags;
+    uint16_t alproto, alproto_ts, alproto_tc;
+    uint32_t data_al_so_far[2];
+    uint32_t de_ctx_id;
+    uint16_t thread_id;
+    uint8_t detect_alversion[2];
+    void *alparser, *alstate, *de_state, *sgh_toclient, *sgh_toserver;
+    void *flowvar;
+    struct FlowOld_ *hnext, *hprev;
+    void *fb;
+    void *lnext, *lprev;
+    struct timeval startts;
+    uint32_t todstpktcnt, tosrcpktcnt;
+    uint64_t todstbytecnt, tosrcbytecnt;
+} FlowOld;
+
+/* Flow after the split: cache line aligned, hot members first */
+typedef struct FlowNew_ {
+    uint32_t src[4], dst[4];
+    uint16_t sp, dp;
+    uint8_t proto, recursion_level;
+    uint16_t vlan_id[2];
+    uint32_t flow_hash;
+    struct FlowNew_ *hnext, *hprev;
+
+    pthread_mutex_t m;
+    struct timeval lastts;
+    uint32_t flags;
+    uint16_t flow_state, use_cnt;
+
+    void *protoctx, *alparser, *alstate, *de_state, *sgh_toclient, *sgh_toserver;
+    void *fb;
+    uint8_t protomap;
+    uint16_t alproto;
+    uint16_t thread_id;
+    uint8_t detect_alversion[2];
+
+    uint32_t todstpktcnt, tosrcpktcnt;
+    uint64_t todstbytecnt, tosrcbytecnt;
+    uint32_t de_ctx_id;
+
+    uint16_t alproto_ts, alproto_tc;
+    uint32_t data_al_so_far[2];
+    uint32_t pp_masks[2];
+    uint32_t tenant_id;
+    uint8_t flow_end_flags;
+    struct timeval startts;
+    void *flowvar;
+    void *lnext, *lprev;
+} __attribute__((aligned(CLS))) FlowNew;
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static inline uint32_t Rand(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return (uint32_t)rnd_state;
+}
+
+static double Now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+typedef struct BenchKey_ {
+    uint32_t src, dst;
+    uint16_t sp, dp;
+    uint32_t hash;
+} BenchKey;
+
+/* same code for both layouts, only the type and allocation differ */
+#define BENCH(type, name, align)                                            \
+static void Bench##name(uint32_t nflows, uint32_t nlookups)                 \
+{                                                                           \
+    uint32_t hsize = nflows / 4;                                            \
+    type **hash = calloc(hsize, sizeof(type *));                            \
+    type **flows = malloc(nflows * sizeof(type *));                         \
+    if (hash == NULL || flows == NULL)                                      \
+        exit(EXIT_FAILURE);                                                 \
+                                                                            \
+    uint32_t i;                                                             \
+    for (i = 0; i < nflows; i++) {                                          \
+        type *f = NULL;                                                     \
+        if (align) {                                                        \
+            if (posix_memalign((void **)&f, CLS, sizeof(type)) != 0)        \
+                exit(EXIT_FAILURE);                                         \
+        } else if ((f = malloc(sizeof(type))) == NULL) {                    \
+            exit(EXIT_FAILURE);                                             \
+        }                                                                   \
+        memset(f, 0, sizeof(type));                                         \
+        pthread_mutex_init(&f->m, NULL);                                    \
+        f->src[0] = Rand();                                                 \
+        f->dst[0] = Rand();                                                 \
+        f->sp = (uint16_t)i;                                                \
+        f->dp = 80;                                                         \
+        f->proto = 6;                                                       \
+        f->flow_hash = Rand();                                              \
+        uint32_t row = f->flow_hash % hsize;                                \
+        f->hnext = hash[row];                                               \
+        hash[row] = f;                                                      \
+        flows[i] = f;                                                       \
+    }                                                                       \
+                                                                            \
+    /* random lookup order and keys, like the packets, resolved before   \
+     * timing so the lookups don't touch the flows through the key */      \
+    uint32_t *order = malloc(nlookups * sizeof(uint32_t));                  \
+    BenchKey *keys = malloc(nflows * sizeof(BenchKey));                     \
+    if (order == NULL || keys == NULL)                                      \
+        exit(EXIT_FAILURE);                                                 \
+    for (i = 0; i < nlookups; i++)                                          \
+        order[i] = Rand() % nflows;                                         \
+    for (i = 0; i < nflows; i++) {                                          \
+        keys[i].src = flows[i]->src[0];                                     \
+        keys[i].dst = flows[i]->dst[0];                                     \
+        keys[i].sp = flows[i]->sp;                                          \
+        keys[i].dp = flows[i]->dp;                                          \
+        keys[i].hash = flows[i]->flow_hash;                                 \
+    }                                                                       \
+                                                                            \
+    uint64_t found = 0;                                                     \
+    double start = Now();                                                   \
+    for (i = 0; i < nlookups; i++) {                                        \
+        const BenchKey *k = &keys[order[i]];                                \
+        uint32_t src = k->src, dst = k->dst;                                \
+        uint16_t sp = k->sp, dp = k->dp;                                    \
+        type *f = hash[k->hash % hsize];                                    \
+        while (f != NULL) {                                                 \
+            if (f->src[0] == src && f->dst[0] == dst && f->sp == sp &&      \
+                    f->dp == dp && f->proto == 6 &&                         \
+                    f->recursion_level == 0 && f->vlan_id[0] == 0)          \
+                break;                                                      \
+            f = f->hnext;                                                   \
+        }                                                                   \
+        if (f != NULL)                                                      \
+            found++;                                                        \
+    }                                                                       \
+    double lookup = Now() - start;                                          \
+                                                                            \
+    start = Now();                                                          \
+    for (i = 0; i < nlookups; i++) {                                        \
+        type *f = flows[order[i]];                                          \
+        pthread_mutex_lock(&f->m);                                          \
+        f->lastts.tv_sec = i;                                               \
+        f->flags |= 1;                                                      \
+        __sync_fetch_and_add(&f->use_cnt, 1);                               \
+        f->todstpktcnt++;                                                   \
+        f->todstbytecnt += 1500;                                            \
+        if (f->protoctx != NULL || f->alstate != NULL)                      \
+            found++;                                                        \
+        __sync_fetch_and_sub(&f->use_cnt, 1);                               \
+        pthread_mutex_unlock(&f->m);                                        \
+    }                                                                       \
+    double update = Now() - start;                                          \
+                                                                            \
+    printf("%-4s sizeof %3zu: lookup %6.1f ns, update %6.1f ns (%lu)\n",    \
+            #name, sizeof(type), lookup * 1e9 / nlookups,                   \
+            update * 1e9 / nlookups, (unsigned long)found);                 \
+                                                                            \
+    for (i = 0; i < nflows; i++) {                                          \
+        pthread_mutex_destroy(&flows[i]->m);                                \
+        free(flows[i]);                                                     \
+    }                                                                       \
+    free(order);                                                            \
+    free(keys);                                                             \
+    free(flows);                                                            \
+    free(hash);                                                             \
+}
+
+/* old flows were allocated with plain SCMalloc */
+BENCH(FlowOld, old, 0)
+BENCH(FlowNew, new, 1)
+
+int main(int argc, char *argv[])
+{
+    uint32_t nflows = 4000000;
+    uint32_t nlookups = 10000000;
+
+    if (argc > 1)
+        nflows = (uint32_t)strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        nlookups = (uint32_t)strtoul(argv[2], NULL, 10);
+    if (nflows < 4 || nlookups == 0) {
+        fprintf(stderr, "usage: %s [flows] [lookups]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%u flows, %u lookups\n", nflows, nlookups);
+    printf("(model of the Flow layout in src/flow.h, not the src objects)\n");
+    Benchold(nflows, nlookups);
+    Benchnew(nflows, nlookups);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,352 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * Cost of intersecting the src and dst SigNumArrays in IPOnlyMatchPacket
+ * (src/detect-engine-iponly.c): the old byte at a time AND with an 8 step
+ * bit loop, the block AND with ctz over 64 bit words, and the walk of the
+ * sorted sig num list of a sparse array.
+ *
+ * The arrays are modelled on IP reputation rule sets (compromised hosts,
+ * tor exit nodes, dshield and ciarmy lists): rules alerting on traffic
+ * from a list of hosts to the home net, rules for the other direction,
+ * and a few rules with any on both sides. The ip-only rules are spread
+ * over the sig nums of the whole rule set, so the arrays are sized to the
+ * full signature count. In the radix trees every node inherits the rules
+ * of its parents, so for a flow the src array holds the outbound and any
+ * rules and the dst array the inbound and any rules. Listed hosts add one
+ * rule. Trees of rule sets without broad rules also have arrays with only
+ * a few sigs, those get the sorted list.
+ *
+ * All variants must report the same sigs, this is checked before timing.
+ *
+ * SigNumArray and the three intersections are local copies of the code
+ * in IPOnlyMatchPacket, without the radix lookups, the rule checks that
+ * follow a hit or the alerting. The figures are for this model; the
+ * share of ip-only matching in a real run has to be profiled in the
+ * engine.
+ *
+ * Build & run:
+ *
+ *   gcc -O2 -o iponly iponly.c      (or -mavx2, or -march=native)
+ *   ./iponly [signatures] [ip-only signatures] [iterations]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define DEFAULT_SIGS        30000
+#define DEFAULT_IPONLY      4000
+#define DEFAULT_ITERATIONS  200000
+
+#define BLOCK_SIZE          32
+
+typedef struct SigNumArray_ {
+    uint8_t *array;
+    uint32_t size;
+    uint32_t sigs_cnt;
+    uint32_t *sigs;
+} SigNumArray;
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static inline uint32_t Rand(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return (uint32_t)rnd_state;
+}
+
+static double Now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* stands in for the per signature checks, keeps the loops honest */
+static uint64_t matched;
+
+static inline void Match(uint32_t signum)
+{
+    matched += signum + 1;
+}
+
+static SigNumArray *SigNumArrayNew(uint32_t max_idx)
+{
+    SigNumArray *sna = calloc(1, sizeof(*sna));
+    if (sna == NULL)
+        exit(EXIT_FAILURE);
+    sna->size = ((max_idx / 8 + 1) + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+    sna->array = calloc(1, sna->size);
+    if (sna->array == NULL)
+        exit(EXIT_FAILURE);
+    return sna;
+}
+
+static void SigNumArraySet(SigNumArray *sna, uint32_t signum)
+{
+    sna->array[signum / 8] |= 1 << (signum % 8);
+}
+
+static void SigNumArrayBuildList(SigNumArray *sna)
+{
+    uint32_t u;
+    sna->sigs = malloc((sna->size * 8) * sizeof(uint32_t));
+    if (sna->sigs == NULL)
+        exit(EXIT_FAILURE);
+    sna->sigs_cnt = 0;
+    for (u = 0; u < sna->size * 8; u++) {
+        if (sna->array[u / 8] & (1 << (u % 8)))
+            sna->sigs[sna->sigs_cnt++] = u;
+    }
+}
+
+/* the loop IPOnlyMatchPacket had before */
+static void MatchBytes(const SigNumArray *src, const SigNumArray *dst,
+                       uint8_t *match)
+{
+    uint32_t u;
+    for (u = 0; u < src->size; u++) {
+        match[u] = dst->array[u] & src->array[u];
+        if (match[u] != 0) {
+            uint8_t bitarray = match[u];
+            uint8_t i = 0;
+            for (; i < 8; i++, bitarray = bitarray >> 1) {
+                if (bitarray & 0x01)
+                    Match(u * 8 + i);
+            }
+        }
+    }
+}
+
+static inline int AndBlock(uint8_t *r, const uint8_t *a, const uint8_t *b)
+{
+#if defined(__AVX2__)
+    __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)a),
+                                 _mm256_loadu_si256((const __m256i *)b));
+    _mm256_storeu_si256((__m256i *)r, v);
+    return !_mm256_testz_si256(v, v);
+#elif defined(__SSE2__)
+    __m128i v0 = _mm_and_si128(_mm_loadu_si128((const __m128i *)a),
+                               _mm_loadu_si128((const __m128i *)b));
+    __m128i v1 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(a + 16)),
+                               _mm_loadu_si128((const __m128i *)(b + 16)));
+    _mm_storeu_si128((__m128i *)r, v0);
+    _mm_storeu_si128((__m128i *)(r + 16), v1);
+    __m128i v = _mm_or_si128(v0, v1);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff;
+#else
+    uint64_t wa[BLOCK_SIZE / 8], wb[BLOCK_SIZE / 8];
+    uint64_t any = 0;
+    int i;
+    memcpy(wa, a, sizeof(wa));
+    memcpy(wb, b, sizeof(wb));
+    for (i = 0; i < BLOCK_SIZE / 8; i++) {
+        wa[i] &= wb[i];
+        any |= wa[i];
+    }
+    memcpy(r, wa, sizeof(wa));
+    return any != 0;
+#endif
+}
+
+/* block AND and ctz over the words, little endian only here */
+static void MatchBlocks(const SigNumArray *src, const SigNumArray *dst,
+                        uint8_t *match)
+{
+    uint32_t u, w;
+    for (u = 0; u < src->size; u += BLOCK_SIZE) {
+        if (!AndBlock(match + u, src->array + u, dst->array + u))
+            continue;
+        for (w = u; w < u + BLOCK_SIZE; w += sizeof(uint64_t)) {
+            uint64_t bits;
+            memcpy(&bits, match + w, sizeof(bits));
+            while (bits != 0) {
+                Match(w * 8 + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+        }
+    }
+}
+
+static void MatchList(const SigNumArray *list, const SigNumArray *other)
+{
+    uint32_t i;
+    for (i = 0; i < list->sigs_cnt; i++) {
+        uint32_t signum = list->sigs[i];
+        if (other->array[signum / 8] & (1 << (signum % 8)))
+            Match(signum);
+    }
+}
+
+enum { BYTES, BLOCKS, LIST };
+
+static double Run(int variant, const SigNumArray *src, const SigNumArray *dst,
+                  uint8_t *match, uint32_t iterations, uint64_t *result)
+{
+    uint32_t i;
+    matched = 0;
+    double start = Now();
+    for (i = 0; i < iterations; i++) {
+        switch (variant) {
+            case BYTES:
+                MatchBytes(src, dst, match);
+                break;
+            case BLOCKS:
+                MatchBlocks(src, dst, match);
+                break;
+            case LIST:
+                MatchList(src, dst);
+                break;
+        }
+        /* don't let the compiler hoist the loop body */
+        __asm__ __volatile__("" : : "r"(match) : "memory");
+    }
+    double elapsed = Now() - start;
+    *result = matched;
+    return elapsed * 1e9 / iterations;
+}
+
+static void Report(const char *name, const SigNumArray *src,
+                   const SigNumArray *dst, uint8_t *match,
+                   uint32_t iterations, int with_list)
+{
+    uint64_t r_bytes, r_blocks, r_list = 0;
+
+    /* all have to agree before anything is timed */
+    Run(BYTES, src, dst, match, 1, &r_bytes);
+    Run(BLOCKS, src, dst, match, 1, &r_blocks);
+    if (with_list)
+        Run(LIST, src, dst, match, 1, &r_list);
+    if (r_bytes != r_blocks || (with_list && r_list != r_bytes)) {
+        fprintf(stderr, "%s: results differ\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    double ns_bytes = Run(BYTES, src, dst, match, iterations, &r_bytes);
+    double ns_blocks = Run(BLOCKS, src, dst, match, iterations, &r_blocks);
+    printf("%-28s bytes %8.1f ns   blocks %8.1f ns (%5.1fx)", name,
+            ns_bytes, ns_blocks, ns_bytes / ns_blocks);
+    if (with_list) {
+        double ns_list = Run(LIST, src, dst, match, iterations, &r_list);
+        printf("   list %8.1f ns (%5.1fx)", ns_list, ns_bytes / ns_list);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t nsigs = argc > 1 ? (uint32_t)atoi(argv[1]) : DEFAULT_SIGS;
+    uint32_t niponly = argc > 2 ? (uint32_t)atoi(argv[2]) : DEFAULT_IPONLY;
+    uint32_t iterations = argc > 3 ? (uint32_t)atoi(argv[3]) : DEFAULT_ITERATIONS;
+    uint32_t i;
+
+    if (nsigs == 0 || niponly == 0 || niponly > nsigs || iterations == 0) {
+        fprintf(stderr, "usage: %s [signatures] [ip-only signatures] "
+                "[iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* pick the sig nums of the ip-only rules */
+    uint8_t *taken = calloc(nsigs, 1);
+    uint32_t *iponly = malloc(niponly * sizeof(uint32_t));
+    if (taken == NULL || iponly == NULL)
+        return EXIT_FAILURE;
+    uint32_t max_idx = 0;
+    for (i = 0; i < niponly; i++) {
+        uint32_t num;
+        do {
+            num = Rand() % nsigs;
+        } while (taken[num]);
+        taken[num] = 1;
+        iponly[i] = num;
+        if (num > max_idx)
+            max_idx = num;
+    }
+
+    /* 48% inbound (list -> home), 48% outbound (home -> list), rest any
+     * on both sides */
+    SigNumArray *src_home = SigNumArrayNew(max_idx);
+    SigNumArray *dst_ext = SigNumArrayNew(max_idx);
+    SigNumArray *src_listed = SigNumArrayNew(max_idx);
+    uint32_t inbound = 0;
+    for (i = 0; i < niponly; i++) {
+        uint32_t kind = Rand() % 100;
+        if (kind < 48) {
+            /* inbound: src is the list, dst the home net */
+            inbound = iponly[i];
+        } else if (kind < 96) {
+            /* outbound: src home net, dst the list */
+            SigNumArraySet(src_home, iponly[i]);
+        } else {
+            SigNumArraySet(src_home, iponly[i]);
+            SigNumArraySet(dst_ext, iponly[i]);
+            SigNumArraySet(src_listed, iponly[i]);
+        }
+        if (kind < 48 || kind >= 96) {
+            /* dst any matches both */
+            SigNumArraySet(dst_ext, iponly[i]);
+        }
+    }
+    /* a listed external host as src: the any rules plus its own rule */
+    SigNumArraySet(src_listed, inbound);
+
+    uint8_t *match = calloc(1, src_home->size);
+    if (match == NULL)
+        return EXIT_FAILURE;
+
+    printf("%u signatures, %u ip-only, arrays of %u bytes\n", nsigs,
+            niponly, src_home->size);
+    printf("(model of the IPOnlyMatchPacket intersection, not the src "
+            "objects)\n\n");
+
+    Report("flow, no listed host", src_home, dst_ext, match, iterations, 0);
+    Report("flow, listed src host", src_listed, dst_ext, match, iterations, 0);
+
+    /* sparse arrays: src with few sigs, dst dense. The list is used for
+     * arrays with at most one sig per 16 bytes. */
+    uint32_t sparse_cnt[] = { 1, 4, 16, 64, src_home->size / 16,
+                              src_home->size / 4 };
+    for (i = 0; i < sizeof(sparse_cnt) / sizeof(sparse_cnt[0]); i++) {
+        SigNumArray *sparse = SigNumArrayNew(max_idx);
+        uint32_t k;
+        for (k = 0; k < sparse_cnt[i]; k++)
+            SigNumArraySet(sparse, iponly[Rand() % niponly]);
+        SigNumArrayBuildList(sparse);
+
+        char name[64];
+        snprintf(name, sizeof(name), "sparse src, %u sigs", sparse->sigs_cnt);
+        Report(name, sparse, dst_ext, match, iterations, 1);
+
+        free(sparse->sigs);
+        free(sparse->array);
+        free(sparse);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,486 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * Records per second on one core for an eve alert record with http
+ * metadata, encoded the old way (json_t tree with a strdup per protocol
+ * field, then json_dump_callback into the output buffer, like
+ * OutputJSONBuffer in src/output-json.c) and the new way (escaping
+ * straight into the output buffer, like src/util-json-builder.c).
+ *
+ * Both encoders have to produce the same bytes, this is checked before
+ * timing. Half of the records get a user agent with non-ASCII
+ * characters, which both have to write as \uXXXX escapes.
+ *
+ * The builder here is a trimmed copy of the JsonBuilder escape and
+ * append code, and the record is put together by hand instead of by
+ * AlertJson and JsonHttpLogJSON, so neither src/util-json-builder.c nor
+ * the loggers are measured. Treat the result as a model of the two
+ * encoding strategies.
+ *
+ * Build & run:
+ *
+ *   gcc -O2 -o json-builder json-builder.c -ljansson
+ *   ./json-builder [records]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <jansson.h>
+
+#define DEFAULT_RECORDS 1000000
+#define BUFFER_SIZE     65536
+
+#define JSON_FLAGS (JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|JSON_ESCAPE_SLASH)
+
+/* mirrors MemBuffer, fixed size is plenty for these records */
+typedef struct Buf_ {
+    char data[BUFFER_SIZE];
+    uint32_t offset;
+} Buf;
+
+typedef struct Record_ {
+    char timestamp[64];
+    int64_t flow_id;
+    const char *src_ip;
+    const char *dst_ip;
+    uint16_t sp;
+    uint16_t dp;
+    uint64_t tx_id;
+    uint32_t sid;
+    /* http fields are not nul terminated, like bstr */
+    const uint8_t *hostname;
+    uint32_t hostname_len;
+    const uint8_t *url;
+    uint32_t url_len;
+    const uint8_t *ua;
+    uint32_t ua_len;
+    uint32_t status;
+    int64_t length;
+} Record;
+
+static uint32_t rand_state = 1;
+
+static inline uint32_t Rand(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+static double Now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+ * old way
+ */
+
+static char *StrdupToC(const uint8_t *b, uint32_t len)
+{
+    char *c = malloc(len + 1);
+    if (c == NULL)
+        return NULL;
+    memcpy(c, b, len);
+    c[len] = '\0';
+    return c;
+}
+
+static int DumpCallback(const char *str, size_t size, void *data)
+{
+    Buf *b = data;
+    memcpy(b->data + b->offset, str, size);
+    b->offset += size;
+    return 0;
+}
+
+static void SetStrdup(json_t *js, const char *key, const uint8_t *b, uint32_t len)
+{
+    char *c = StrdupToC(b, len);
+    if (c != NULL) {
+        json_object_set_new(js, key, json_string(c));
+        free(c);
+    }
+}
+
+static void EncodeJansson(const Record *r, Buf *b)
+{
+    b->offset = 0;
+
+    json_t *js = json_object();
+    json_object_set_new(js, "timestamp", json_string(r->timestamp));
+    json_object_set_new(js, "flow_id", json_integer(r->flow_id));
+    json_object_set_new(js, "in_iface", json_string("eth0"));
+    json_object_set_new(js, "event_type", json_string("alert"));
+    json_object_set_new(js, "src_ip", json_string(r->src_ip));
+    json_object_set_new(js, "src_port", json_integer(r->sp));
+    json_object_set_new(js, "dest_ip", json_string(r->dst_ip));
+    json_object_set_new(js, "dest_port", json_integer(r->dp));
+    json_object_set_new(js, "proto", json_string("TCP"));
+    json_object_set_new(js, "tx_id", json_integer(r->tx_id));
+
+    json_t *ajs = json_object();
+    json_object_set_new(ajs, "action", json_string("allowed"));
+    json_object_set_new(ajs, "gid", json_integer(1));
+    json_object_set_new(ajs, "signature_id", json_integer(r->sid));
+    json_object_set_new(ajs, "rev", json_integer(3));
+    json_object_set_new(ajs, "signature",
+            json_string("ET POLICY Outdated Flash Version M1"));
+    json_object_set_new(ajs, "category",
+            json_string("Potential Corporate Privacy Violation"));
+    json_object_set_new(ajs, "severity", json_integer(1));
+    json_object_set_new(js, "alert", ajs);
+
+    json_t *hjs = json_object();
+    SetStrdup(hjs, "hostname", r->hostname, r->hostname_len);
+    SetStrdup(hjs, "url", r->url, r->url_len);
+    SetStrdup(hjs, "http_user_agent", r->ua, r->ua_len);
+    SetStrdup(hjs, "http_content_type", (const uint8_t *)"text/html", 9);
+    SetStrdup(hjs, "http_method", (const uint8_t *)"GET", 3);
+    SetStrdup(hjs, "protocol", (const uint8_t *)"HTTP/1.1", 8);
+    json_object_set_new(hjs, "status", json_integer(r->status));
+    json_object_set_new(hjs, "length", json_integer(r->length));
+    json_object_set_new(js, "http", hjs);
+
+    json_object_set_new(js, "host", json_string("sensor1"));
+
+    json_dump_callback(js, DumpCallback, b, JSON_FLAGS);
+    json_decref(js);
+}
+
+/*
+ * new way, a trimmed copy of src/util-json-builder.c without the buffer
+ * expansion and the error handling
+ */
+
+typedef struct JsonBuilder_ {
+    Buf *b;
+    uint32_t depth;
+    uint32_t first;
+} JsonBuilder;
+
+static const char json_hex[] = "0123456789ABCDEF";
+static uint8_t json_escape[256];
+
+static void JsonEscapeInit(void)
+{
+    int c;
+    for (c = 0; c < 256; c++)
+        json_escape[c] = (c < 0x20 || c >= 0x80 || c == '"' || c == '\\' || c == '/');
+}
+
+static int JsonUtf8Decode(const uint8_t *s, uint32_t len, uint32_t *cp)
+{
+    uint32_t n, i, v;
+    uint8_t c = s[0];
+
+    if (c <= 0xC1) {
+        return -1;
+    } else if (c <= 0xDF) {
+        n = 2;
+        v = c & 0x1F;
+    } else if (c <= 0xEF) {
+        n = 3;
+        v = c & 0x0F;
+    } else if (c <= 0xF4) {
+        n = 4;
+        v = c & 0x07;
+    } else {
+        return -1;
+    }
+    if (n > len)
+        return -1;
+    for (i = 1; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80)
+            return -1;
+        v = (v << 6) | (s[i] & 0x3F);
+    }
+    if (v > 0x10FFFF || (v >= 0xD800 && v <= 0xDFFF) ||
+        (n == 3 && v < 0x800) || (n == 4 && v < 0x10000))
+        return -1;
+    *cp = v;
+    return (int)n;
+}
+
+static inline void PutU16(Buf *b, uint32_t v)
+{
+    char *out = b->data + b->offset;
+    out[0] = '\\';
+    out[1] = 'u';
+    out[2] = json_hex[(v >> 12) & 0xF];
+    out[3] = json_hex[(v >> 8) & 0xF];
+    out[4] = json_hex[(v >> 4) & 0xF];
+    out[5] = json_hex[v & 0xF];
+    b->offset += 6;
+}
+
+static int PutString(Buf *b, const uint8_t *s, uint32_t len)
+{
+    uint32_t i = 0;
+
+    b->data[b->offset++] = '"';
+    while (i < len) {
+        uint32_t start = i;
+        while (i < len && json_escape[s[i]] == 0)
+            i++;
+        memcpy(b->data + b->offset, s + start, i - start);
+        b->offset += i - start;
+        if (i == len)
+            break;
+
+        uint8_t c = s[i];
+        if (c < 0x80) {
+            char e = 0;
+            switch (c) {
+                case '"':  e = '"'; break;
+                case '\\': e = '\\'; break;
+                case '/':  e = '/'; break;
+                case '\b': e = 'b'; break;
+                case '\f': e = 'f'; break;
+                case '\n': e = 'n'; break;
+                case '\r': e = 'r'; break;
+                case '\t': e = 't'; break;
+            }
+            if (e) {
+                b->data[b->offset++] = '\\';
+                b->data[b->offset++] = e;
+            } else {
+                PutU16(b, c);
+            }
+            i++;
+        } else {
+            uint32_t cp;
+            int n = JsonUtf8Decode(s + i, len - i, &cp);
+            if (n < 0)
+                return -1;
+            i += n;
+            if (cp < 0x10000) {
+                PutU16(b, cp);
+            } else {
+                cp -= 0x10000;
+                PutU16(b, 0xD800 | (cp >> 10));
+                PutU16(b, 0xDC00 | (cp & 0x3FF));
+            }
+        }
+    }
+    b->data[b->offset++] = '"';
+    return 0;
+}
+
+static void Key(JsonBuilder *jb, const char *key)
+{
+    uint32_t bit = 1U << jb->depth;
+    if (jb->first & bit)
+        jb->first &= ~bit;
+    else
+        jb->b->data[jb->b->offset++] = ',';
+    PutString(jb->b, (const uint8_t *)key, strlen(key));
+    jb->b->data[jb->b->offset++] = ':';
+}
+
+static void SetStringLen(JsonBuilder *jb, const char *key, const uint8_t *s, uint32_t len)
+{
+    uint32_t offset = jb->b->offset;
+    uint32_t first = jb->first;
+
+    Key(jb, key);
+    if (PutString(jb->b, s, len) < 0) {
+        jb->b->offset = offset;
+        jb->first = first;
+    }
+}
+
+static void SetString(JsonBuilder *jb, const char *key, const char *s)
+{
+    SetStringLen(jb, key, (const uint8_t *)s, strlen(s));
+}
+
+static void SetInt(JsonBuilder *jb, const char *key, int64_t val)
+{
+    char tmp[24];
+    uint32_t i = sizeof(tmp);
+    uint64_t v = val < 0 ? (uint64_t)0 - (uint64_t)val : (uint64_t)val;
+
+    Key(jb, key);
+    do {
+        tmp[--i] = '0' + (v % 10);
+        v /= 10;
+    } while (v != 0);
+    if (val < 0)
+        tmp[--i] = '-';
+    memcpy(jb->b->data + jb->b->offset, tmp + i, sizeof(tmp) - i);
+    jb->b->offset += sizeof(tmp) - i;
+}
+
+static void Open(JsonBuilder *jb, const char *key)
+{
+    Key(jb, key);
+    jb->b->data[jb->b->offset++] = '{';
+    jb->depth++;
+    jb->first |= 1U << jb->depth;
+}
+
+static void Close(JsonBuilder *jb)
+{
+    jb->b->data[jb->b->offset++] = '}';
+    jb->depth--;
+}
+
+static void EncodeBuilder(const Record *r, Buf *b)
+{
+    JsonBuilder jb = { b, 1, 1U << 1 };
+
+    b->offset = 0;
+    b->data[b->offset++] = '{';
+
+    SetString(&jb, "timestamp", r->timestamp);
+    SetInt(&jb, "flow_id", r->flow_id);
+    SetString(&jb, "in_iface", "eth0");
+    SetString(&jb, "event_type", "alert");
+    SetString(&jb, "src_ip", r->src_ip);
+    SetInt(&jb, "src_port", r->sp);
+    SetString(&jb, "dest_ip", r->dst_ip);
+    SetInt(&jb, "dest_port", r->dp);
+    SetString(&jb, "proto", "TCP");
+    SetInt(&jb, "tx_id", r->tx_id);
+
+    Open(&jb, "alert");
+    SetString(&jb, "action", "allowed");
+    SetInt(&jb, "gid", 1);
+    SetInt(&jb, "signature_id", r->sid);
+    SetInt(&jb, "rev", 3);
+    SetString(&jb, "signature", "ET POLICY Outdated Flash Version M1");
+    SetString(&jb, "category", "Potential Corporate Privacy Violation");
+    SetInt(&jb, "severity", 1);
+    Close(&jb);
+
+    Open(&jb, "http");
+    SetStringLen(&jb, "hostname", r->hostname, r->hostname_len);
+    SetStringLen(&jb, "url", r->url, r->url_len);
+    SetStringLen(&jb, "http_user_agent", r->ua, r->ua_len);
+    SetStringLen(&jb, "http_content_type", (const uint8_t *)"text/html", 9);
+    SetStringLen(&jb, "http_method", (const uint8_t *)"GET", 3);
+    SetStringLen(&jb, "protocol", (const uint8_t *)"HTTP/1.1", 8);
+    SetInt(&jb, "status", r->status);
+    SetInt(&jb, "length", r->length);
+    Close(&jb);
+
+    SetString(&jb, "host", "sensor1");
+    Close(&jb);
+}
+
+static const char *uas[] = {
+    "Mozilla/5.0 (Windows NT 6.1; WOW64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/52.0.2743.116 Safari/537.36",
+    "Mozilla/5.0 (X11; Linux x86_64; rv:48.0) Gecko/20100101 Firefox/48.0 \xc3\xa9t\xc3\xa9 \xe2\x82\xac",
+};
+
+static const char *urls[] = {
+    "/",
+    "/index.html",
+    "/wp-content/plugins/revslider/temp/update_extract/revslider/shell.php?cmd=id",
+    "/search?q=%22quoted%22&lang=en&client=firefox-b-ab",
+};
+
+static void MakeRecord(Record *r, uint32_t i)
+{
+    const char *host = "www.example.com";
+    const char *url = urls[Rand() % 4];
+    const char *ua = uas[i & 1];
+
+    snprintf(r->timestamp, sizeof(r->timestamp),
+            "2016-08-%02uT12:%02u:%02u.%06u+0000",
+            1 + i % 28, (i / 60) % 60, i % 60, Rand() % 1000000);
+    r->flow_id = ((int64_t)Rand() << 20 ^ Rand()) & 0x7ffffffffffffLL;
+    r->src_ip = "192.168.1.100";
+    r->dst_ip = "2001:db8:85a3::8a2e:370:7334";
+    r->sp = 1024 + Rand() % 60000;
+    r->dp = 80;
+    r->tx_id = Rand() % 16;
+    r->sid = 2000000 + Rand() % 100000;
+    r->hostname = (const uint8_t *)host;
+    r->hostname_len = strlen(host);
+    r->url = (const uint8_t *)url;
+    r->url_len = strlen(url);
+    r->ua = (const uint8_t *)ua;
+    r->ua_len = strlen(ua);
+    r->status = 200;
+    r->length = Rand() % 100000;
+}
+
+#define NRECORDS 1024
+
+int main(int argc, char *argv[])
+{
+    uint32_t records = DEFAULT_RECORDS;
+    static Record recs[NRECORDS];
+    static Buf b1, b2;
+    uint32_t i;
+
+    if (argc > 1) {
+        records = strtoul(argv[1], NULL, 10);
+        if (records == 0) {
+            fprintf(stderr, "usage: %s [records]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    JsonEscapeInit();
+    for (i = 0; i < NRECORDS; i++)
+        MakeRecord(&recs[i], i);
+
+    for (i = 0; i < NRECORDS; i++) {
+        EncodeJansson(&recs[i], &b1);
+        EncodeBuilder(&recs[i], &b2);
+        if (b1.offset != b2.offset || memcmp(b1.data, b2.data, b1.offset) != 0) {
+            fprintf(stderr, "output differs:\n%.*s\n%.*s\n",
+                    (int)b1.offset, b1.data, (int)b2.offset, b2.data);
+            return 1;
+        }
+    }
+    printf("record: %.*s (%u bytes)\n", (int)b2.offset, b2.data, b2.offset);
+    printf("(model of util-json-builder.c, not the src objects)\n");
+
+    uint64_t bytes = 0;
+    double start = Now();
+    for (i = 0; i < records; i++) {
+        EncodeJansson(&recs[i % NRECORDS], &b1);
+        bytes += b1.offset;
+    }
+    double t_jansson = Now() - start;
+
+    start = Now();
+    for (i = 0; i < records; i++) {
+        EncodeBuilder(&recs[i % NRECORDS], &b2);
+        bytes += b2.offset;
+    }
+    double t_builder = Now() - start;
+
+    printf("jansson: %10.0f records/s (%6.1f ns/record)\n",
+            records / t_jansson, t_jansson * 1e9 / records);
+    printf("builder: %10.0f records/s (%6.1f ns/record)  %.1fx\n",
+            records / t_builder, t_builder * 1e9 / records,
+            t_jansson / t_builder);
+    /* keep the compiler from dropping the encoders */
+    return bytes == 0;
+}
@@ -0,0 +1,276 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * TCP segment insertion in random order: the linear list walk that
+ * StreamTcpReassembleInsertSegment used to do against the rb tree lookup
+ * it does now (src/stream-tcp-reassemble.c).
+ *
+ * A stream of N fixed size segments is inserted in shuffled order, with
+ * 1 in 8 segments sent twice to mimic retransmissions. Duplicates are
+ * detected (like the overlap handlers do for a segment that is entirely
+ * covered) and dropped. After each run the list is checked to be sorted
+ * and complete. Sequence numbers start close to the wrap around.
+ *
+ * Only the rb tree macros (src/tree.h) are the real thing. The segment
+ * struct, the list walk and the tree compare are reduced copies of the
+ * StreamTcpReassembleInsertSegment paths. Overlap handling is cut down
+ * to dropping duplicates and there is no stream buffer or memcap, so
+ * the timings are for that model and not for the insert path in
+ * src/stream-tcp-reassemble.c.
+ *
+ * Build & run:
+ *
+ *   gcc -O2 -I../src -o segment-insert segment-insert.c
+ *   ./segment-insert [max segments]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "tree.h"
+
+#define SEQ_EQ(a,b)  ((int32_t)((a) - (b)) == 0)
+#define SEQ_LT(a,b)  ((int32_t)((a) - (b)) <  0)
+#define SEQ_LEQ(a,b) ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a,b)  ((int32_t)((a) - (b)) >  0)
+
+#define SEGSIZE     1448
+#define ISN         (0xffffffffU - 100000U)
+
+typedef struct Seg_ {
+    uint32_t seq;
+    uint32_t len;
+    struct Seg_ *next;
+    struct Seg_ *prev;
+    RB_ENTRY(Seg_) rb;
+} Seg;
+
+static int SegCompare(struct Seg_ *a, struct Seg_ *b)
+{
+    if (SEQ_LT(a->seq, b->seq))
+        return -1;
+    else if (SEQ_GT(a->seq, b->seq))
+        return 1;
+    return 0;
+}
+
+RB_HEAD(SEGTREE, Seg_);
+RB_GENERATE_STATIC(SEGTREE, Seg_, rb, SegCompare);
+
+typedef struct Stream_ {
+    Seg *head;
+    Seg *tail;
+    struct SEGTREE tree;
+    uint64_t steps;
+} Stream;
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static inline uint32_t Rand(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return (uint32_t)rnd_state;
+}
+
+static double Now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void LinkBefore(Stream *s, Seg *list_seg, Seg *seg)
+{
+    seg->next = list_seg;
+    seg->prev = list_seg->prev;
+    if (list_seg->prev != NULL)
+        list_seg->prev->next = seg;
+    else
+        s->head = seg;
+    list_seg->prev = seg;
+}
+
+static void LinkAfter(Stream *s, Seg *list_seg, Seg *seg)
+{
+    seg->prev = list_seg;
+    seg->next = list_seg->next;
+    if (list_seg->next != NULL)
+        list_seg->next->prev = seg;
+    else
+        s->tail = seg;
+    list_seg->next = seg;
+}
+
+/* the old way: tail fast path, then walk from the head */
+static int InsertLinear(Stream *s, Seg *seg)
+{
+    if (s->head == NULL) {
+        s->head = s->tail = seg;
+        return 0;
+    }
+    if (SEQ_GT(seg->seq, s->tail->seq)) {
+        LinkAfter(s, s->tail, seg);
+        return 0;
+    }
+
+    Seg *list_seg;
+    for (list_seg = s->head; list_seg != NULL; list_seg = list_seg->next) {
+        s->steps++;
+        if (SEQ_EQ(seg->seq, list_seg->seq))
+            return -1;
+        if (SEQ_LT(seg->seq, list_seg->seq)) {
+            LinkBefore(s, list_seg, seg);
+            return 0;
+        }
+    }
+    LinkAfter(s, s->tail, seg);
+    return 0;
+}
+
+/* the new way: tail fast path, then find the floor in the tree */
+static int InsertTree(Stream *s, Seg *seg)
+{
+    if (s->head == NULL) {
+        s->head = s->tail = seg;
+        RB_INSERT(SEGTREE, &s->tree, seg);
+        return 0;
+    }
+    if (SEQ_GT(seg->seq, s->tail->seq)) {
+        LinkAfter(s, s->tail, seg);
+        RB_INSERT(SEGTREE, &s->tree, seg);
+        return 0;
+    }
+
+    Seg *floor = NULL;
+    Seg *tseg = RB_ROOT(&s->tree);
+    while (tseg != NULL) {
+        s->steps++;
+        if (SEQ_LEQ(tseg->seq, seg->seq)) {
+            floor = tseg;
+            tseg = RB_RIGHT(tseg, rb);
+        } else {
+            tseg = RB_LEFT(tseg, rb);
+        }
+    }
+
+    if (floor == NULL) {
+        LinkBefore(s, s->head, seg);
+    } else if (SEQ_EQ(floor->seq, seg->seq)) {
+        return -1;
+    } else {
+        LinkAfter(s, floor, seg);
+    }
+    RB_INSERT(SEGTREE, &s->tree, seg);
+    return 0;
+}
+
+static int Verify(Stream *s, uint32_t nsegs)
+{
+    uint32_t expect = ISN;
+    uint32_t cnt = 0;
+    Seg *seg;
+    for (seg = s->head; seg != NULL; seg = seg->next) {
+        if (seg->seq != expect)
+            return -1;
+        expect += seg->len;
+        cnt++;
+    }
+    return cnt == nsegs ? 0 : -1;
+}
+
+static void Bench(uint32_t nsegs)
+{
+    /* one entry per segment plus the retransmissions */
+    uint32_t norder = nsegs + nsegs / 8;
+    uint32_t *order = malloc(norder * sizeof(uint32_t));
+    Seg *segs = malloc(norder * sizeof(Seg));
+    if (order == NULL || segs == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t i;
+    for (i = 0; i < nsegs; i++)
+        order[i] = i;
+    for ( ; i < norder; i++)
+        order[i] = Rand() % nsegs;
+    for (i = norder - 1; i > 0; i--) {
+        uint32_t j = Rand() % (i + 1);
+        uint32_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    double t[2];
+    uint64_t steps[2];
+    int ok[2];
+    int run;
+    for (run = 0; run < 2; run++) {
+        Stream s;
+        memset(&s, 0, sizeof(s));
+        RB_INIT(&s.tree);
+        memset(segs, 0, norder * sizeof(Seg));
+
+        double start = Now();
+        for (i = 0; i < norder; i++) {
+            Seg *seg = &segs[i];
+            seg->seq = ISN + order[i] * SEGSIZE;
+            seg->len = SEGSIZE;
+            if (run == 0)
+                (void)InsertLinear(&s, seg);
+            else
+                (void)InsertTree(&s, seg);
+        }
+        t[run] = Now() - start;
+        steps[run] = s.steps;
+        ok[run] = Verify(&s, nsegs) == 0;
+    }
+
+    printf("%7u segs: list %9.3f ms (%6.1f steps/ins)  tree %7.3f ms "
+            "(%4.1f steps/ins)  x%.1f %s\n", nsegs,
+            t[0] * 1000, (double)steps[0] / norder,
+            t[1] * 1000, (double)steps[1] / norder,
+            t[0] / t[1], ok[0] && ok[1] ? "" : "VERIFY FAILED");
+
+    free(order);
+    free(segs);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t max_segs = 16384;
+
+    if (argc > 1)
+        max_segs = (uint32_t)strtoul(argv[1], NULL, 10);
+    if (max_segs < 16) {
+        fprintf(stderr, "usage: %s [max segments]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("(model of the StreamTcpReassembleInsertSegment lookup, "
+            "not the src objects)\n");
+    uint32_t n;
+    for (n = 16; n <= max_segs; n *= 4)
+        Bench(n);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,415 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * Search cost of the teddy mpm (src/util-mpm-teddy.c) compared to the
+ * AC state table walk of SCACSearch (src/util-mpm-ac.c) for small
+ * pattern sets.
+ *
+ * Both are cut down copies of the search loops: AC with the u16 state
+ * table, lowercased input and the output table flag in the top bit,
+ * teddy with the same buckets and nibble masks as the mpm. Patterns are
+ * random case insensitive strings, the buffers are random text with a
+ * pattern planted every few hundred bytes. The match counts of both are
+ * compared, so this doubles as a sanity check of the teddy search.
+ *
+ * This is a model. Neither util-mpm-teddy.c nor util-mpm-ac.c is built
+ * in; the loops here were copied from SCTeddySearch and SCACSearch and
+ * lose the MpmThreadCtx, PrefilterRuleStore and match bookkeeping. The
+ * numbers say how the two search loops compare, not what the mpm costs
+ * in the engine. Keep the copies in sync when the src loops change.
+ *
+ * Build & run:
+ *
+ *   gcc -O2 -mssse3 -o teddy teddy.c      (or -mavx2, or -march=native)
+ *   ./teddy [buffer size] [iterations]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/time.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#define MAX_PATTERNS    64
+#define BUCKETS         8
+#define MAX_MASK_LEN    3
+
+typedef struct Pattern_ {
+    uint8_t pat[32];
+    uint16_t len;
+} Pattern;
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static inline uint32_t Rand(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return (uint32_t)rnd_state;
+}
+
+static double Now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* AC */
+
+typedef struct AC_ {
+    uint16_t (*state_table)[256];
+    uint32_t *out_cnt;          /* per state: patterns ending here */
+    uint32_t state_count;
+} AC;
+
+static void ACBuild(AC *ac, const Pattern *patterns, uint32_t cnt)
+{
+    uint32_t max_states = 1;
+    uint32_t i, c;
+    for (i = 0; i < cnt; i++)
+        max_states += patterns[i].len;
+
+    int32_t (*go)[256] = malloc(max_states * sizeof(*go));
+    int32_t *fail = calloc(max_states, sizeof(int32_t));
+    int32_t *queue = malloc(max_states * sizeof(int32_t));
+    ac->out_cnt = calloc(max_states, sizeof(uint32_t));
+    ac->state_table = malloc(max_states * sizeof(*ac->state_table));
+    if (go == NULL || fail == NULL || queue == NULL || ac->out_cnt == NULL ||
+        ac->state_table == NULL)
+        exit(EXIT_FAILURE);
+    memset(go, 0xff, max_states * sizeof(*go));
+    ac->state_count = 1;
+
+    /* goto table on the lowercase patterns */
+    for (i = 0; i < cnt; i++) {
+        int32_t state = 0;
+        uint16_t k;
+        for (k = 0; k < patterns[i].len; k++) {
+            uint8_t b = patterns[i].pat[k];
+            if (go[state][b] == -1)
+                go[state][b] = ac->state_count++;
+            state = go[state][b];
+        }
+        ac->out_cnt[state]++;
+    }
+
+    /* failure links and the delta table, breadth first */
+    int top = 0, bot = 0;
+    for (c = 0; c < 256; c++) {
+        if (go[0][c] == -1) {
+            go[0][c] = 0;
+        } else {
+            fail[go[0][c]] = 0;
+            queue[top++] = go[0][c];
+        }
+    }
+    while (bot < top) {
+        int32_t r = queue[bot++];
+        for (c = 0; c < 256; c++) {
+            int32_t s = go[r][c];
+            if (s == -1) {
+                go[r][c] = go[fail[r]][c];
+            } else {
+                fail[s] = go[fail[r]][c];
+                ac->out_cnt[s] += ac->out_cnt[fail[s]];
+                queue[top++] = s;
+            }
+        }
+    }
+
+    for (i = 0; i < ac->state_count; i++) {
+        for (c = 0; c < 256; c++) {
+            uint16_t s = (uint16_t)go[i][c];
+            ac->state_table[i][c] = s | (ac->out_cnt[s] ? 0x8000 : 0);
+        }
+    }
+    free(go);
+    free(fail);
+    free(queue);
+}
+
+static uint32_t ACSearch(const AC *ac, const uint8_t *buf, uint32_t buflen)
+{
+    uint16_t (*state_table)[256] = ac->state_table;
+    uint16_t state = 0;
+    uint32_t matches = 0;
+    uint32_t i;
+
+    for (i = 0; i < buflen; i++) {
+        state = state_table[state & 0x7FFF][tolower(buf[i])];
+        if (state & 0x8000)
+            matches += ac->out_cnt[state & 0x7FFF];
+    }
+    return matches;
+}
+
+/* Teddy */
+
+typedef struct Teddy_ {
+    uint8_t lo[MAX_MASK_LEN][16];
+    uint8_t hi[MAX_MASK_LEN][16];
+    uint32_t mask_len;
+    const Pattern *patterns;
+    uint32_t bucket_start[BUCKETS + 1];
+} Teddy;
+
+static int PatternCompare(const void *a, const void *b)
+{
+    const Pattern *p1 = a, *p2 = b;
+    return memcmp(p1->pat, p2->pat, MAX_MASK_LEN);
+}
+
+/* sorts the patterns in place */
+static void TeddyBuild(Teddy *t, Pattern *patterns, uint32_t cnt)
+{
+    uint32_t i, b, k;
+    uint16_t minlen = patterns[0].len;
+
+    memset(t, 0, sizeof(*t));
+    qsort(patterns, cnt, sizeof(Pattern), PatternCompare);
+    for (i = 0; i < cnt; i++) {
+        if (patterns[i].len < minlen)
+            minlen = patterns[i].len;
+    }
+    t->mask_len = minlen < MAX_MASK_LEN ? minlen : MAX_MASK_LEN;
+    t->patterns = patterns;
+
+    for (b = 0; b < BUCKETS; b++)
+        t->bucket_start[b] = (b * cnt) / BUCKETS;
+    t->bucket_start[BUCKETS] = cnt;
+
+    for (b = 0; b < BUCKETS; b++) {
+        for (i = t->bucket_start[b]; i < t->bucket_start[b + 1]; i++) {
+            for (k = 0; k < t->mask_len; k++) {
+                uint8_t c = patterns[i].pat[k];
+                t->lo[k][c & 0x0f] |= (1 << b);
+                t->hi[k][c >> 4] |= (1 << b);
+                c = toupper(c);
+                t->lo[k][c & 0x0f] |= (1 << b);
+                t->hi[k][c >> 4] |= (1 << b);
+            }
+        }
+    }
+}
+
+static inline int MemcmpLowercase(const uint8_t *pat, const uint8_t *buf,
+                                  uint16_t len)
+{
+    uint16_t i;
+    for (i = 0; i < len; i++) {
+        if (pat[i] != tolower(buf[i]))
+            return 1;
+    }
+    return 0;
+}
+
+static inline uint32_t TeddyVerify(const Teddy *t, const uint8_t *buf,
+        uint32_t buflen, uint32_t pos, uint32_t buckets)
+{
+    uint32_t matches = 0;
+    while (buckets != 0) {
+        int b = __builtin_ctz(buckets);
+        buckets &= buckets - 1;
+
+        uint32_t x;
+        for (x = t->bucket_start[b]; x < t->bucket_start[b + 1]; x++) {
+            const Pattern *p = &t->patterns[x];
+            if (p->len <= buflen - pos &&
+                MemcmpLowercase(p->pat, buf + pos, p->len) == 0)
+                matches++;
+        }
+    }
+    return matches;
+}
+
+static uint32_t TeddySearch(const Teddy *t, const uint8_t *buf, uint32_t buflen)
+{
+    const uint32_t mask_len = t->mask_len;
+    uint32_t matches = 0;
+    uint32_t i = 0, k;
+
+    if (buflen < mask_len)
+        return 0;
+
+#if defined(__AVX2__)
+    __m256i lo[MAX_MASK_LEN], hi[MAX_MASK_LEN];
+    for (k = 0; k < mask_len; k++) {
+        lo[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)t->lo[k]));
+        hi[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)t->hi[k]));
+    }
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    for ( ; i + 32 + mask_len - 1 <= buflen; i += 32) {
+        __m256i r = _mm256_set1_epi8((char)0xff);
+        for (k = 0; k < mask_len; k++) {
+            __m256i d = _mm256_loadu_si256((const __m256i *)(buf + i + k));
+            __m256i l = _mm256_shuffle_epi8(lo[k], _mm256_and_si256(d, nibble));
+            __m256i h = _mm256_shuffle_epi8(hi[k],
+                    _mm256_and_si256(_mm256_srli_epi16(d, 4), nibble));
+            r = _mm256_and_si256(r, _mm256_and_si256(l, h));
+        }
+        uint32_t cand = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(r, zero));
+        if (cand == 0)
+            continue;
+        uint8_t res[32];
+        _mm256_storeu_si256((__m256i *)res, r);
+        while (cand != 0) {
+            uint32_t j = __builtin_ctz(cand);
+            cand &= cand - 1;
+            matches += TeddyVerify(t, buf, buflen, i + j, res[j]);
+        }
+    }
+#elif defined(__SSSE3__)
+    __m128i lo[MAX_MASK_LEN], hi[MAX_MASK_LEN];
+    for (k = 0; k < mask_len; k++) {
+        lo[k] = _mm_loadu_si128((const __m128i *)t->lo[k]);
+        hi[k] = _mm_loadu_si128((const __m128i *)t->hi[k]);
+    }
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    for ( ; i + 16 + mask_len - 1 <= buflen; i += 16) {
+        __m128i r = _mm_set1_epi8((char)0xff);
+        for (k = 0; k < mask_len; k++) {
+            __m128i d = _mm_loadu_si128((const __m128i *)(buf + i + k));
+            __m128i l = _mm_shuffle_epi8(lo[k], _mm_and_si128(d, nibble));
+            __m128i h = _mm_shuffle_epi8(hi[k],
+                    _mm_and_si128(_mm_srli_epi16(d, 4), nibble));
+            r = _mm_and_si128(r, _mm_and_si128(l, h));
+        }
+        uint32_t cand = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(r, zero)) & 0xffff;
+        if (cand == 0)
+            continue;
+        uint8_t res[16];
+        _mm_storeu_si128((__m128i *)res, r);
+        while (cand != 0) {
+            uint32_t j = __builtin_ctz(cand);
+            cand &= cand - 1;
+            matches += TeddyVerify(t, buf, buflen, i + j, res[j]);
+        }
+    }
+#endif
+
+    for ( ; i + mask_len <= buflen; i++) {
+        uint8_t r = 0xff;
+        for (k = 0; k < mask_len; k++) {
+            uint8_t c = buf[i + k];
+            r &= t->lo[k][c & 0x0f] & t->hi[k][c >> 4];
+        }
+        if (r != 0)
+            matches += TeddyVerify(t, buf, buflen, i, r);
+    }
+    return matches;
+}
+
+static void Bench(uint32_t npatterns, uint32_t buflen, uint32_t iterations)
+{
+    Pattern patterns[MAX_PATTERNS];
+    uint32_t i, j;
+
+    for (i = 0; i < npatterns; i++) {
+        patterns[i].len = 4 + Rand() % 12;
+        for (j = 0; j < patterns[i].len; j++)
+            patterns[i].pat[j] = 'a' + Rand() % 26;
+    }
+
+    /* text like input: letters, spaces and some punctuation, with a
+     * pattern (in random case) every ~500 bytes */
+    uint8_t *buf = malloc(buflen);
+    if (buf == NULL)
+        exit(EXIT_FAILURE);
+    for (i = 0; i < buflen; i++) {
+        uint32_t r = Rand() % 32;
+        buf[i] = r < 26 ? (uint8_t)('a' + r) :
+                          (uint8_t)(r < 30 ? ' ' : "/=:\n"[r - 30]);
+        if ((Rand() & 1) == 0)
+            buf[i] = toupper(buf[i]);
+    }
+    for (i = 0; i + 32 < buflen; i += 256 + Rand() % 512) {
+        const Pattern *p = &patterns[Rand() % npatterns];
+        for (j = 0; j < p->len; j++)
+            buf[i + j] = (Rand() & 1) ? toupper(p->pat[j]) : p->pat[j];
+    }
+
+    AC ac;
+    ACBuild(&ac, patterns, npatterns);
+    Teddy t;
+    TeddyBuild(&t, patterns, npatterns);
+
+    uint64_t ac_matches = 0, teddy_matches = 0;
+    double start = Now();
+    for (i = 0; i < iterations; i++)
+        ac_matches += ACSearch(&ac, buf, buflen);
+    double ac_time = Now() - start;
+
+    start = Now();
+    for (i = 0; i < iterations; i++)
+        teddy_matches += TeddySearch(&t, buf, buflen);
+    double teddy_time = Now() - start;
+
+    double mb = (double)buflen * iterations / (1024 * 1024);
+    printf("%2u patterns: ac %7.1f MiB/s, teddy %7.1f MiB/s (x%.1f) %s\n",
+            npatterns, mb / ac_time, mb / teddy_time, ac_time / teddy_time,
+            ac_matches == teddy_matches ? "" : "MISMATCH");
+    if (ac_matches != teddy_matches) {
+        printf("  ac %lu matches, teddy %lu\n", (unsigned long)ac_matches,
+                (unsigned long)teddy_matches);
+    }
+
+    free(ac.state_table);
+    free(ac.out_cnt);
+    free(buf);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t buflen = 1500;
+    uint32_t iterations = 200000;
+
+    if (argc > 1)
+        buflen = (uint32_t)strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        iterations = (uint32_t)strtoul(argv[2], NULL, 10);
+    if (buflen == 0 || iterations == 0) {
+        fprintf(stderr, "usage: %s [buffer size] [iterations]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+#if defined(__AVX2__)
+    printf("teddy: avx2, ");
+#elif defined(__SSSE3__)
+    printf("teddy: ssse3, ");
+#else
+    printf("teddy: scalar, ");
+#endif
+    printf("%u byte buffers, %u iterations\n", buflen, iterations);
+    printf("(model of SCTeddySearch/SCACSearch, not the src objects)\n");
+
+    uint32_t n;
+    for (n = 8; n <= MAX_PATTERNS; n *= 2)
+        Bench(n, buflen, iterations);
+    exit(EXIT_SUCCESS);
+}
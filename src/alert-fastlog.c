@@ -55,6 +55,7 @@
 #include "util-proto-name.h"
 #include "util-optimize.h"
 #include "util-logopenfile.h"
+#include "util-logopenfile-async.h"
 #include "util-time.h"
 
 #define DEFAULT_LOG_FILENAME "fast.log"
@@ -98,6 +99,12 @@ int AlertFastLogCondition(ThreadVars *tv, const Packet *p)
 static inline void AlertFastLogOutputAlert(AlertFastLogThread *aft, char *buffer,
                                            int alert_size)
 {
+    if (aft->file_ctx->async != NULL) {
+        (void)SCAtomicFetchAndAdd(&aft->file_ctx->alerts, 1);
+        aft->file_ctx->Write(buffer, alert_size, aft->file_ctx);
+        return;
+    }
+
     SCMutex *file_lock = &aft->file_ctx->fp_mutex;
     /* Output the alert string and count alerts. Only need to lock here. */
     SCMutexLock(file_lock);
@@ -248,6 +255,10 @@ OutputCtx *AlertFastLogInitCtx(ConfNode *conf)
         LogFileFreeCtx(logfile_ctx);
         return NULL;
     }
+    if (LogFileAsyncSetup(conf, logfile_ctx) < 0) {
+        LogFileFreeCtx(logfile_ctx);
+        return NULL;
+    }
 
     OutputCtx *output_ctx = SCCalloc(1, sizeof(OutputCtx));
     if (unlikely(output_ctx == NULL))
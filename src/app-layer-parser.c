@@ -34,6 +34,7 @@
 
 #include "flow-util.h"
 #include "flow-private.h"
+#include "flow-storage.h"
 
 #include "detect-engine-state.h"
 #include "detect-engine-port.h"
@@ -1254,6 +1255,27 @@ void AppLayerParserStatePrintDetails(AppLayerParserState *pstate)
 #endif
 
 #ifdef AFLFUZZ_APPLAYER
+/** \internal
+ *  \brief get a flow for the fuzz harnesses
+ *
+ *  The flow is released with FlowFree, so it has to come from the same
+ *  aligned allocator as FlowAlloc. FlowAlloc itself can't be used as the
+ *  flow memcap is not set up when fuzzing.
+ */
+static Flow *AppLayerParserFuzzFlowAlloc(void)
+{
+    size_t size = sizeof(Flow) + FlowStorageSize();
+
+    Flow *f = SCMallocAligned(size, CLS);
+    if (unlikely(f == NULL))
+        return NULL;
+    memset(f, 0, size);
+    (void)SC_ATOMIC_ADD(flow_memuse, size);
+
+    FLOW_INITIALIZE(f);
+    return f;
+}
+
 int AppLayerParserRequestFromFile(AppProto alproto, char *filename)
 {
     int result = 1;
@@ -1263,10 +1285,9 @@ int AppLayerParserRequestFromFile(AppProto alproto, char *filename)
 
     memset(&ssn, 0, sizeof(ssn));
 
-    f = SCCalloc(1, sizeof(Flow));
+    f = AppLayerParserFuzzFlowAlloc();
     if (f == NULL)
         goto end;
-    FLOW_INITIALIZE(f);
 
     f->flags |= FLOW_IPV4;
     f->src.addr_data32[0] = 0x01020304;
@@ -1338,10 +1359,9 @@ int AppLayerParserFromFile(AppProto alproto, char *filename)
 
     memset(&ssn, 0, sizeof(ssn));
 
-    f = SCCalloc(1, sizeof(Flow));
+    f = AppLayerParserFuzzFlowAlloc();
     if (f == NULL)
         goto end;
-    FLOW_INITIALIZE(f);
 
     f->flags |= FLOW_IPV4;
     f->src.addr_data32[0] = 0x01020304;
@@ -40,6 +40,7 @@
 #include "util-print.h"
 #include "util-profiling.h"
 #include "util-validate.h"
+#include "util-file.h"
 #include "decode-events.h"
 
 #include "app-layer-htp-mem.h"
@@ -646,6 +647,7 @@ void AppLayerRegisterGlobalCounters(void)
     StatsRegisterGlobalCounter("dns.memcap_global", DNSMemcapGetMemcapGlobalCounter);
     StatsRegisterGlobalCounter("http.memuse", HTPMemuseGlobalCounter);
     StatsRegisterGlobalCounter("http.memcap", HTPMemcapGlobalCounter);
+    FileHashRegisterCounters();
 }
 
 /***** Unittests *****/
@@ -239,6 +239,7 @@ const struct DecodeEvents_ DEvents[] = {
     { "stream.reassembly_no_segment", STREAM_REASSEMBLY_NO_SEGMENT, },
     { "stream.reassembly_seq_gap", STREAM_REASSEMBLY_SEQ_GAP, },
     { "stream.reassembly_overlap_different_data", STREAM_REASSEMBLY_OVERLAP_DIFFERENT_DATA, },
+    { "stream.reassembly_segment_gap_too_big", STREAM_REASSEMBLY_SEGMENT_GAP_TOO_BIG, },
     { "stream.pkt_bad_window_update", STREAM_PKT_BAD_WINDOW_UPDATE, },
 
     { NULL, 0 },
@@ -254,6 +254,7 @@ enum {
     STREAM_REASSEMBLY_SEQ_GAP,
 
     STREAM_REASSEMBLY_OVERLAP_DIFFERENT_DATA,
+    STREAM_REASSEMBLY_SEGMENT_GAP_TOO_BIG,
 
     /* should always be last! */
     DECODE_EVENT_MAX,
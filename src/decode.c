@@ -59,6 +59,7 @@
 #include "util-error.h"
 #include "util-print.h"
 #include "tmqh-packetpool.h"
+#include "defrag.h"
 #include "util-profiling.h"
 #include "pkt-var.h"
 #include "util-mpm-ac.h"
@@ -181,6 +182,37 @@ Packet *PacketGetFromQueueOrAlloc(void)
     return p;
 }
 
+/**
+ *  \brief Get a burst of packets from the packet pool, allocating the
+ *         ones the pool can't provide.
+ *
+ *  \param n number of packets wanted
+ *  \param out array of at least 'n' packet pointers
+ *
+ *  \retval cnt number of packets in 'out'. Only less than 'n' if an
+ *              allocation failed.
+ */
+uint32_t PacketGetFromQueueOrAllocBatch(uint32_t n, Packet **out)
+{
+    /* try the pool first */
+    uint32_t cnt = PacketPoolGetPackets(n, out);
+    uint32_t i;
+
+    for (i = 0; i < cnt; i++) {
+        PACKET_PROFILING_START(out[i]);
+    }
+
+    for ( ; cnt < n; cnt++) {
+        /* non fatal, we're just not processing these packets then */
+        Packet *p = PacketGetFromAlloc();
+        if (p == NULL)
+            break;
+        out[cnt] = p;
+    }
+
+    return cnt;
+}
+
 inline int PacketCallocExtPkt(Packet *p, int datalen)
 {
     if (! p->ext_pkt) {
@@ -237,6 +269,38 @@ inline int PacketCopyDataOffset(Packet *p, int offset, uint8_t *data, int datale
     return 0;
 }
 
+/**
+ *  \brief Make sure a Packet can hold datalen bytes of data
+ *
+ *  After this the data can be written directly to GET_PKT_DATA(p),
+ *  without going through PacketCopyDataOffset for every chunk. If the
+ *  data doesn't fit in the space allocated with the packet the extended
+ *  buffer is set up, data already in the packet is not carried over.
+ *
+ *  \param p Packet to prepare
+ *  \param datalen number of bytes that will be written
+ *
+ *  \retval 0 ok, -1 datalen too big or allocation failure
+ */
+int PacketReserveData(Packet *p, int datalen)
+{
+    if (unlikely(datalen > MAX_PAYLOAD_SIZE)) {
+        return -1;
+    }
+    if (datalen <= (int)default_packet_size || p->ext_pkt != NULL) {
+        return 0;
+    }
+
+    /* same size as PacketCopyDataOffset uses, as the buffer may be
+     * written to again later */
+    p->ext_pkt = SCMalloc(MAX_PAYLOAD_SIZE);
+    if (unlikely(p->ext_pkt == NULL)) {
+        SET_PKT_LEN(p, 0);
+        return -1;
+    }
+    return 0;
+}
+
 /**
  *  \brief Copy data to Packet payload and set packet length
  *
@@ -427,6 +491,10 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
         StatsRegisterCounter("defrag.ipv6.timeouts", tv);
     dtv->counter_defrag_max_hit =
         StatsRegisterCounter("defrag.max_frag_hits", tv);
+    dtv->counter_defrag_pool_batches =
+        StatsRegisterCounter("defrag.frag_pool.batches", tv);
+    dtv->counter_defrag_pool_lock_ticks =
+        StatsRegisterCounter("defrag.frag_pool.lock_wait_ticks", tv);
     
     int i = 0;
     for (i = 0; i < DECODE_EVENT_PACKET_MAX; i++) {
@@ -499,6 +567,9 @@ DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv)
 
 void DecodeThreadVarsFree(ThreadVars *tv, DecodeThreadVars *dtv)
 {
+    /* give the frags cached by this thread back to the defrag pool */
+    DefragFragCacheFlush();
+
     if (dtv != NULL) {
         if (dtv->app_tctx != NULL)
             AppLayerDestroyCtxThread(dtv->app_tctx);
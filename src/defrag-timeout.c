@@ -148,6 +148,8 @@ uint32_t DefragTimeoutHash(struct timeval *ts)
         DRLOCK_UNLOCK(hb);
     }
 
+    /* this thread only returns frags, so don't hold on to them */
+    DefragFragCacheFlush();
     return cnt;
 }
 
@@ -46,6 +46,7 @@
 #include "util-debug.h"
 #include "util-fix_checksum.h"
 #include "util-random.h"
+#include "util-cpu.h"
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
 #include "util-host-os-info.h"
@@ -120,15 +121,40 @@ DumpFrags(DefragTracker *tracker)
 #endif /* UNITTESTS */
 #endif
 
+/** Number of frags moved between a thread's frag cache and the shared
+ *  frag pool per lock of the pool. */
+#define DEFRAG_FRAG_CACHE_BATCH 32
+
+/**
+ * Per thread cache of free frags. Frags are taken from and returned to
+ * the cache without locking. The shared pool is only locked to refill or
+ * drain the cache, a batch of frags at a time.
+ */
+typedef struct DefragFragCache_ {
+    uint32_t cnt;
+    Frag *frags[DEFRAG_FRAG_CACHE_BATCH * 2];
+
+    /* refills and drains of the cache and the ticks spent waiting for
+     * the pool lock, added to the decoder counters and reset by
+     * DefragFragCacheStats() */
+    uint32_t batches;
+    uint64_t lock_ticks;
+} DefragFragCache;
+
+#ifdef TLS
+static __thread DefragFragCache defrag_frag_cache;
+#endif
+
 /**
  * \brief Reset a frag for reuse in a pool.
  */
 static void
 DefragFragReset(Frag *frag)
 {
-    if (frag->pkt != NULL)
+    if (frag->pkt != NULL && frag->pkt != frag->pkt_inline)
         SCFree(frag->pkt);
-    memset(frag, 0, sizeof(*frag));
+    /* the inline buffer is overwritten by the next user */
+    memset(frag, 0, offsetof(Frag, pkt_inline));
 }
 
 /**
@@ -143,6 +169,120 @@ DefragFragInit(void *data, void *initdata)
     return 1;
 }
 
+#ifdef TLS
+static void
+DefragFragCacheLock(DefragFragCache *cache)
+{
+    uint64_t ticks = UtilCpuGetTicks();
+    SCMutexLock(&defrag_context->frag_pool_lock);
+    cache->lock_ticks += UtilCpuGetTicks() - ticks;
+    cache->batches++;
+}
+
+/**
+ * \brief Take up to a batch of frags from the shared pool.
+ */
+static void
+DefragFragCacheRefill(DefragFragCache *cache)
+{
+    DefragFragCacheLock(cache);
+    while (cache->cnt < DEFRAG_FRAG_CACHE_BATCH) {
+        Frag *frag = PoolGet(defrag_context->frag_pool);
+        if (frag == NULL)
+            break;
+        cache->frags[cache->cnt++] = frag;
+    }
+    SCMutexUnlock(&defrag_context->frag_pool_lock);
+}
+
+/**
+ * \brief Return frags to the shared pool until keep are left.
+ */
+static void
+DefragFragCacheDrain(DefragFragCache *cache, uint32_t keep)
+{
+    DefragFragCacheLock(cache);
+    while (cache->cnt > keep) {
+        PoolReturn(defrag_context->frag_pool, cache->frags[--cache->cnt]);
+    }
+    SCMutexUnlock(&defrag_context->frag_pool_lock);
+}
+#endif /* TLS */
+
+/**
+ * \brief Get a clean frag, from the thread's cache if we have TLS.
+ *
+ * \retval frag or NULL if the pool is exhausted
+ */
+static Frag *
+DefragFragGet(void)
+{
+#ifdef TLS
+    DefragFragCache *cache = &defrag_frag_cache;
+    if (cache->cnt == 0) {
+        DefragFragCacheRefill(cache);
+        if (cache->cnt == 0)
+            return NULL;
+    }
+    return cache->frags[--cache->cnt];
+#else
+    SCMutexLock(&defrag_context->frag_pool_lock);
+    Frag *frag = PoolGet(defrag_context->frag_pool);
+    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    return frag;
+#endif
+}
+
+/**
+ * \brief Return a frag that was reset with DefragFragReset().
+ */
+static void
+DefragFragPut(Frag *frag)
+{
+#ifdef TLS
+    DefragFragCache *cache = &defrag_frag_cache;
+    cache->frags[cache->cnt++] = frag;
+    if (cache->cnt == DEFRAG_FRAG_CACHE_BATCH * 2)
+        DefragFragCacheDrain(cache, DEFRAG_FRAG_CACHE_BATCH);
+#else
+    SCMutexLock(&defrag_context->frag_pool_lock);
+    PoolReturn(defrag_context->frag_pool, frag);
+    SCMutexUnlock(&defrag_context->frag_pool_lock);
+#endif
+}
+
+/**
+ * \brief Return all frags cached by the calling thread to the shared
+ *        pool. Used when a thread exits or is done with defrag for a
+ *        while.
+ */
+void
+DefragFragCacheFlush(void)
+{
+#ifdef TLS
+    if (defrag_context != NULL && defrag_frag_cache.cnt > 0)
+        DefragFragCacheDrain(&defrag_frag_cache, 0);
+#endif
+}
+
+/**
+ * \brief Add the frag cache stats of this thread to its counters.
+ */
+static void
+DefragFragCacheStats(ThreadVars *tv, DecodeThreadVars *dtv)
+{
+#ifdef TLS
+    DefragFragCache *cache = &defrag_frag_cache;
+    if (tv == NULL || dtv == NULL || cache->batches == 0)
+        return;
+
+    StatsAddUI64(tv, dtv->counter_defrag_pool_batches, cache->batches);
+    StatsAddUI64(tv, dtv->counter_defrag_pool_lock_ticks, cache->lock_ticks);
+    cache->batches = 0;
+    cache->lock_ticks = 0;
+#endif
+}
+
 /**
  * \brief Free all frags associated with a tracker.
  */
@@ -151,18 +291,13 @@ DefragTrackerFreeFrags(DefragTracker *tracker)
 {
     Frag *frag;
 
-    /* Lock the frag pool as we'll be return items to it. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-
     while ((frag = TAILQ_FIRST(&tracker->frags)) != NULL) {
         TAILQ_REMOVE(&tracker->frags, frag, next);
 
         /* Don't SCFree the frag, just give it back to its pool. */
         DefragFragReset(frag);
-        PoolReturn(defrag_context->frag_pool, frag);
+        DefragFragPut(frag);
     }
-
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
 }
 
 /**
@@ -260,9 +395,15 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
         return NULL;
 
     /* Check that we have all the data. Relies on the fact that
-     * fragments are inserted if frag_offset order. */
+     * fragments are inserted if frag_offset order.
+     *
+     * Also find out how much space the reassembled packet needs, so
+     * we can copy the fragments straight into it. */
     Frag *frag;
     int len = 0;
+    int size = 0;
+    int fragmentable_offset = 0;
+    int seen_end = 0;
     TAILQ_FOREACH(frag, &tracker->frags, next) {
         if (frag->skip)
             continue;
@@ -283,6 +424,24 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
                 len += frag->data_len;
             }
         }
+
+        /* same selection of fragments as the copy loop below */
+        if (seen_end || frag->data_len - frag->ltrim <= 0)
+            continue;
+        if (frag->offset == 0) {
+            fragmentable_offset = frag->ip_hdr_offset + frag->hlen;
+            size = MAX(size, frag->len);
+        } else {
+            size = MAX(size, fragmentable_offset + frag->offset + frag->data_len);
+        }
+        if (!frag->more_frags)
+            seen_end = 1;
+    }
+
+    if (size > (int)MAX_PAYLOAD_SIZE) {
+        SCLogWarning(SC_ERR_REASSEMBLY, "Failed re-assemble "
+                "fragmented packet, exceeds size of packet buffer.");
+        goto error_remove_tracker;
     }
 
     /* Allocate a Packet for the reassembled packet.  On failure we
@@ -296,7 +455,10 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
     rp->recursion_level = p->recursion_level;
 
-    int fragmentable_offset = 0;
+    if (PacketReserveData(rp, size) == -1)
+        goto error_remove_tracker;
+    uint8_t *pkt_data = GET_PKT_DATA(rp);
+
     int fragmentable_len = 0;
     int hlen = 0;
     int ip_hdr_offset = 0;
@@ -310,8 +472,7 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
             continue;
         if (frag->offset == 0) {
 
-            if (PacketCopyData(rp, frag->pkt, frag->len) == -1)
-                goto error_remove_tracker;
+            memcpy(pkt_data, frag->pkt, frag->len);
 
             hlen = frag->hlen;
             ip_hdr_offset = frag->ip_hdr_offset;
@@ -323,17 +484,9 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
             fragmentable_len = frag->data_len;
         }
         else {
-            int pkt_end = fragmentable_offset + frag->offset + frag->data_len;
-            if (pkt_end > (int)MAX_PAYLOAD_SIZE) {
-                SCLogWarning(SC_ERR_REASSEMBLY, "Failed re-assemble "
-                        "fragmented packet, exceeds size of packet buffer.");
-                goto error_remove_tracker;
-            }
-            if (PacketCopyDataOffset(rp, fragmentable_offset + frag->offset + frag->ltrim,
+            memcpy(pkt_data + fragmentable_offset + frag->offset + frag->ltrim,
                 frag->pkt + frag->data_offset + frag->ltrim,
-                frag->data_len - frag->ltrim) == -1) {
-                goto error_remove_tracker;
-            }
+                frag->data_len - frag->ltrim);
             if (frag->offset + frag->data_len > fragmentable_len)
                 fragmentable_len = frag->offset + frag->data_len;
         }
@@ -382,9 +535,15 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
         return NULL;
 
     /* Check that we have all the data. Relies on the fact that
-     * fragments are inserted if frag_offset order. */
+     * fragments are inserted if frag_offset order.
+     *
+     * Also find out how much space the reassembled packet needs, so
+     * we can copy the fragments straight into it. */
     Frag *frag;
     int len = 0;
+    int size = 0;
+    int fragmentable_offset = 0;
+    int seen_end = 0;
     TAILQ_FOREACH(frag, &tracker->frags, next) {
         if (frag->skip)
             continue;
@@ -405,12 +564,24 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
                 len += frag->data_len;
             }
         }
+
+        /* same selection of fragments as the copy loop below */
+        if (seen_end || frag->data_len - frag->ltrim <= 0)
+            continue;
+        if (frag->offset == 0) {
+            fragmentable_offset = frag->frag_hdr_offset;
+            size = MAX(size, fragmentable_offset + frag->data_len);
+        } else {
+            size = MAX(size, fragmentable_offset + frag->offset + frag->data_len);
+        }
+        if (!frag->more_frags)
+            seen_end = 1;
     }
 
     /* Allocate a Packet for the reassembled packet.  On failure we
-     * SCFree all the resources held by this tracker. */
-    rp = PacketDefragPktSetup(p, (uint8_t *)p->ip6h,
-            IPV6_GET_PLEN(p) + sizeof(IPV6Hdr), 0);
+     * SCFree all the resources held by this tracker. The first fragment
+     * provides the headers, so nothing is copied from p. */
+    rp = PacketDefragPktSetup(p, NULL, 0, 0);
     if (rp == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate packet for "
                 "fragmentation re-assembly, dumping fragments.");
@@ -418,8 +589,11 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     }
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
 
+    if (PacketReserveData(rp, size) == -1)
+        goto error_remove_tracker;
+    uint8_t *pkt_data = GET_PKT_DATA(rp);
+
     int unfragmentable_len = 0;
-    int fragmentable_offset = 0;
     int fragmentable_len = 0;
     int ip_hdr_offset = 0;
     uint8_t next_hdr = 0;
@@ -436,12 +610,10 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
             /* This is the first packet, we use this packets link and
              * IPv6 headers. We also copy in its data, but remove the
              * fragmentation header. */
-            if (PacketCopyData(rp, frag->pkt, frag->frag_hdr_offset) == -1)
-                goto error_remove_tracker;
-            if (PacketCopyDataOffset(rp, frag->frag_hdr_offset,
+            memcpy(pkt_data, frag->pkt, frag->frag_hdr_offset);
+            memcpy(pkt_data + frag->frag_hdr_offset,
                 frag->pkt + frag->frag_hdr_offset + sizeof(IPV6FragHdr),
-                frag->data_len) == -1)
-                goto error_remove_tracker;
+                frag->data_len);
             ip_hdr_offset = frag->ip_hdr_offset;
 
             /* This is the start of the fragmentable portion of the
@@ -457,10 +629,9 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
                 goto error_remove_tracker;
         }
         else {
-            if (PacketCopyDataOffset(rp, fragmentable_offset + frag->offset + frag->ltrim,
+            memcpy(pkt_data + fragmentable_offset + frag->offset + frag->ltrim,
                 frag->pkt + frag->data_offset + frag->ltrim,
-                frag->data_len - frag->ltrim) == -1)
-                goto error_remove_tracker;
+                frag->data_len - frag->ltrim);
             if (frag->offset + frag->data_len > fragmentable_len)
                 fragmentable_len = frag->offset + frag->data_len;
         }
@@ -714,9 +885,7 @@ insert:
     }
 
     /* Allocate fragment and insert. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-    Frag *new = PoolGet(defrag_context->frag_pool);
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    Frag *new = DefragFragGet();
     if (new == NULL) {
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
@@ -725,11 +894,13 @@ insert:
         }
         goto done;
     }
-    new->pkt = SCMalloc(GET_PKT_LEN(p));
+    if (GET_PKT_LEN(p) - ltrim <= DEFRAG_FRAG_INLINE_LEN) {
+        new->pkt = new->pkt_inline;
+    } else {
+        new->pkt = SCMalloc(GET_PKT_LEN(p) - ltrim);
+    }
     if (new->pkt == NULL) {
-        SCMutexLock(&defrag_context->frag_pool_lock);
-        PoolReturn(defrag_context->frag_pool, new);
-        SCMutexUnlock(&defrag_context->frag_pool_lock);
+        DefragFragPut(new);
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
         } else {
@@ -956,6 +1127,8 @@ Defrag(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, PacketQueue *pq)
     Packet *rp = DefragInsertFrag(tv, dtv, tracker, p, pq);
     DefragTrackerRelease(tracker);
 
+    DefragFragCacheStats(tv, dtv);
+
     return rp;
 }
 
@@ -985,6 +1158,7 @@ DefragInit(void)
 void DefragDestroy(void)
 {
     DefragHashShutdown();
+    DefragFragCacheFlush();
     DefragContextDestroy(defrag_context);
     defrag_context = NULL;
     DefragTreeDestroy();
@@ -1555,6 +1729,7 @@ DefragDoSturgesNovakTest(int policy, u_char *expected, size_t expected_len)
     SCFree(reassembled);
 
     /* Make sure all frags were returned back to the pool. */
+    DefragFragCacheFlush();
     if (defrag_context->frag_pool->outstanding != 0) {
         goto end;
     }
@@ -1683,6 +1858,7 @@ IPV6DefragDoSturgesNovakTest(int policy, u_char *expected, size_t expected_len)
     SCFree(reassembled);
 
     /* Make sure all frags were returned to the pool. */
+    DefragFragCacheFlush();
     if (defrag_context->frag_pool->outstanding != 0) {
         printf("defrag_context->frag_pool->outstanding %u: ", defrag_context->frag_pool->outstanding);
         goto end;
@@ -2544,6 +2720,107 @@ end:
     return retval;
 }
 
+/**
+ * \test Small fragments are stored in the Frag, large ones in a buffer
+ *       of their own. All frags go back to the pool after reassembly.
+ */
+static int DefragFragInlineTest(void)
+{
+    DefragInit();
+
+    Packet *p1 = BuildTestPacket(10, 0, 1, 'A', 8);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = BuildTestPacket(10, 1, 1, 'B', 512);
+    FAIL_IF_NULL(p2);
+    Packet *p3 = BuildTestPacket(10, 65, 0, 'C', 8);
+    FAIL_IF_NULL(p3);
+
+    FAIL_IF(Defrag(NULL, NULL, p1, NULL) != NULL);
+    FAIL_IF(Defrag(NULL, NULL, p2, NULL) != NULL);
+
+    DefragTracker *tracker = DefragGetTracker(NULL, NULL, p1);
+    FAIL_IF_NULL(tracker);
+    Frag *frag = TAILQ_FIRST(&tracker->frags);
+    FAIL_IF_NULL(frag);
+    FAIL_IF(frag->pkt != frag->pkt_inline);
+    FAIL_IF(frag->pkt[frag->data_offset] != 'A');
+    frag = TAILQ_NEXT(frag, next);
+    FAIL_IF_NULL(frag);
+    FAIL_IF(frag->pkt == frag->pkt_inline);
+    FAIL_IF(frag->pkt[frag->data_offset] != 'B');
+    DefragTrackerRelease(tracker);
+
+    Packet *r = Defrag(NULL, NULL, p3, NULL);
+    FAIL_IF_NULL(r);
+    FAIL_IF(IPV4_GET_IPLEN(r) != 20 + 8 + 512 + 8);
+    FAIL_IF(GET_PKT_DATA(r)[20] != 'A');
+    FAIL_IF(GET_PKT_DATA(r)[20 + 8] != 'B');
+    FAIL_IF(GET_PKT_DATA(r)[20 + 8 + 512] != 'C');
+
+    DefragFragCacheFlush();
+    FAIL_IF(defrag_context->frag_pool->outstanding != 0);
+
+    SCFree(p1);
+    SCFree(p2);
+    SCFree(p3);
+    SCFree(r);
+    DefragDestroy();
+    PASS;
+}
+
+/**
+ * \test Reassemble datagrams larger than the space allocated with a
+ *       packet, so the reassembled packet uses an extended buffer.
+ */
+static int DefragLargeDatagramTest(void)
+{
+    DefragInit();
+
+    Packet *p1 = BuildTestPacket(11, 0, 1, 'A', 1000);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = BuildTestPacket(11, 125, 1, 'B', 1000);
+    FAIL_IF_NULL(p2);
+    Packet *p3 = BuildTestPacket(11, 250, 0, 'C', 1000);
+    FAIL_IF_NULL(p3);
+
+    FAIL_IF(Defrag(NULL, NULL, p3, NULL) != NULL);
+    FAIL_IF(Defrag(NULL, NULL, p1, NULL) != NULL);
+    Packet *r = Defrag(NULL, NULL, p2, NULL);
+    FAIL_IF_NULL(r);
+    FAIL_IF(r->ext_pkt == NULL);
+    FAIL_IF(GET_PKT_LEN(r) != 20 + 3000);
+    FAIL_IF(IPV4_GET_IPLEN(r) != 20 + 3000);
+    int i;
+    for (i = 0; i < 3000; i++) {
+        FAIL_IF(GET_PKT_DATA(r)[20 + i] != "ABC"[i / 1000]);
+    }
+    PacketFree(r);
+
+    Packet *p4 = IPV6BuildTestPacket(12, 0, 1, 'D', 1000);
+    FAIL_IF_NULL(p4);
+    Packet *p5 = IPV6BuildTestPacket(12, 125, 0, 'E', 1000);
+    FAIL_IF_NULL(p5);
+
+    FAIL_IF(Defrag(NULL, NULL, p5, NULL) != NULL);
+    r = Defrag(NULL, NULL, p4, NULL);
+    FAIL_IF_NULL(r);
+    FAIL_IF(r->ext_pkt == NULL);
+    FAIL_IF(GET_PKT_LEN(r) != 40 + 2000);
+    FAIL_IF(IPV6_GET_PLEN(r) != 2000);
+    for (i = 0; i < 2000; i++) {
+        FAIL_IF(GET_PKT_DATA(r)[40 + i] != "DE"[i / 1000]);
+    }
+    PacketFree(r);
+
+    SCFree(p1);
+    SCFree(p2);
+    SCFree(p3);
+    SCFree(p4);
+    SCFree(p5);
+    DefragDestroy();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void
@@ -2585,6 +2862,8 @@ DefragRegisterTests(void)
     UtRegisterTest("DefragTimeoutTest", DefragTimeoutTest);
     UtRegisterTest("DefragMfIpv4Test", DefragMfIpv4Test);
     UtRegisterTest("DefragMfIpv6Test", DefragMfIpv6Test);
+    UtRegisterTest("DefragFragInlineTest", DefragFragInlineTest);
+    UtRegisterTest("DefragLargeDatagramTest", DefragLargeDatagramTest);
 #endif /* UNITTESTS */
 }
 
@@ -37,6 +37,10 @@ typedef struct DefragContext_ {
     time_t timeout; /**< Default timeout. */
 } DefragContext;
 
+/** Fragments up to this size are stored in the Frag itself instead of
+ *  in a separately allocated buffer. */
+#define DEFRAG_FRAG_INLINE_LEN 128
+
 /**
  * Storage for an individual fragment.
  */
@@ -69,6 +73,9 @@ typedef struct Frag_ {
 #endif
 
     TAILQ_ENTRY(Frag_) next;    /**< Pointer to next fragment for tailq. */
+
+    uint8_t pkt_inline[DEFRAG_FRAG_INLINE_LEN]; /**< Storage for pkt if the
+                                                 *   fragment is small. */
 } Frag;
 
 /**
@@ -119,6 +126,7 @@ void DefragReload(void); /**< use only in unittests */
 
 uint8_t DefragGetOsPolicy(Packet *);
 void DefragTrackerFreeFrags(DefragTracker *);
+void DefragFragCacheFlush(void);
 Packet *Defrag(ThreadVars *, DecodeThreadVars *, Packet *, PacketQueue *);
 void DefragRegisterTests(void);
 
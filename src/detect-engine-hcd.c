@@ -96,14 +96,18 @@ static inline uint32_t HttpCookiePatternSearch(DetectEngineThreadCtx *det_ctx,
     SCReturnUInt(ret);
 }
 
-int DetectEngineRunHttpCookieMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
-                                 HtpState *htp_state, uint8_t flags,
-                                 void *txv, uint64_t idx)
+/**
+ * \brief Get the http_cookie buffer the mpm runs on.
+ *
+ * \retval buffer or NULL if not available, length in buffer_len
+ */
+const uint8_t *DetectEngineGetHttpCookieMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len)
 {
-    uint32_t cnt = 0;
     htp_tx_t *tx = (htp_tx_t *)txv;
     if (tx->request_headers == NULL)
-        goto end;
+        return NULL;
 
     htp_header_t *h = NULL;
     if (flags & STREAM_TOSERVER) {
@@ -111,20 +115,33 @@ int DetectEngineRunHttpCookieMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                             "Cookie");
         if (h == NULL) {
             SCLogDebug("HTTP cookie header not present in this request");
-            goto end;
+            return NULL;
         }
     } else {
         h = (htp_header_t *)htp_table_get_c(tx->response_headers,
                                             "Set-Cookie");
         if (h == NULL) {
             SCLogDebug("HTTP Set-Cookie header not present in this request");
-            goto end;
+            return NULL;
         }
     }
 
-    cnt = HttpCookiePatternSearch(det_ctx,
-                                  (uint8_t *)bstr_ptr(h->value),
-                                  bstr_len(h->value), flags);
+    *buffer_len = bstr_len(h->value);
+    return (const uint8_t *)bstr_ptr(h->value);
+}
+
+int DetectEngineRunHttpCookieMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
+                                 HtpState *htp_state, uint8_t flags,
+                                 void *txv, uint64_t idx)
+{
+    uint32_t cnt = 0;
+    uint32_t buffer_len = 0;
+    const uint8_t *buffer = DetectEngineGetHttpCookieMpmBuffer(det_ctx, f,
+            htp_state, flags, txv, idx, &buffer_len);
+    if (buffer == NULL)
+        goto end;
+
+    cnt = HttpCookiePatternSearch(det_ctx, buffer, buffer_len, flags);
  end:
     return cnt;
 }
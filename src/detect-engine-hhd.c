@@ -252,6 +252,19 @@ static inline uint32_t HttpHeaderPatternSearch(DetectEngineThreadCtx *det_ctx,
     SCReturnUInt(ret);
 }
 
+/**
+ * \brief Get the http_header buffer the mpm runs on.
+ *
+ * \retval buffer or NULL if not available, length in buffer_len
+ */
+const uint8_t *DetectEngineGetHttpHeaderMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len)
+{
+    return DetectEngineHHDGetBufferForTX(txv, idx, NULL, det_ctx, f,
+                                         htp_state, flags, buffer_len);
+}
+
 int DetectEngineRunHttpHeaderMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                  HtpState *htp_state, uint8_t flags,
                                  void *tx, uint64_t idx)
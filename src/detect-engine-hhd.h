@@ -31,6 +31,9 @@ int DetectEngineInspectHttpHeader(ThreadVars *tv,
                                   Signature *s, Flow *f, uint8_t flags,
                                   void *alstate,
                                   void *tx, uint64_t tx_id);
+const uint8_t *DetectEngineGetHttpHeaderMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len);
 int DetectEngineRunHttpHeaderMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                  HtpState *htp_state, uint8_t flags,
                                  void *tx, uint64_t idx);
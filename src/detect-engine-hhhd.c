@@ -90,18 +90,36 @@ static inline uint32_t HttpHHPatternSearch(DetectEngineThreadCtx *det_ctx,
     SCReturnUInt(ret);
 }
 
+/**
+ * \brief Get the http_host buffer the mpm runs on.
+ *
+ * \retval buffer or NULL if not available, length in buffer_len
+ */
+const uint8_t *DetectEngineGetHttpHHMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len)
+{
+    htp_tx_t *tx = (htp_tx_t *)txv;
+    if (tx->request_hostname == NULL)
+        return NULL;
+    const uint8_t *hname = (const uint8_t *)bstr_ptr(tx->request_hostname);
+    if (hname == NULL)
+        return NULL;
+
+    *buffer_len = bstr_len(tx->request_hostname);
+    return hname;
+}
+
 int DetectEngineRunHttpHHMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                              HtpState *htp_state, uint8_t flags,
                              void *txv, uint64_t idx)
 {
     uint32_t cnt = 0;
-    htp_tx_t *tx = (htp_tx_t *)txv;
-    if (tx->request_hostname == NULL)
-        goto end;
-    const uint8_t *hname = (const uint8_t *)bstr_ptr(tx->request_hostname);
+    uint32_t hname_len = 0;
+    const uint8_t *hname = DetectEngineGetHttpHHMpmBuffer(det_ctx, f,
+            htp_state, flags, txv, idx, &hname_len);
     if (hname == NULL)
         goto end;
-    const uint32_t hname_len = bstr_len(tx->request_hostname);
 
     cnt = HttpHHPatternSearch(det_ctx, hname, hname_len, flags);
 
@@ -31,6 +31,9 @@ int DetectEngineInspectHttpHH(ThreadVars *tv,
                               Signature *s, Flow *f, uint8_t flags,
                               void *alstate,
                               void *tx, uint64_t tx_id);
+const uint8_t *DetectEngineGetHttpHHMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len);
 int DetectEngineRunHttpHHMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                              HtpState *htp_state, uint8_t flags,
                              void *tx, uint64_t idx);
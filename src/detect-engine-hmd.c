@@ -87,19 +87,35 @@ static inline uint32_t HttpMethodPatternSearch(DetectEngineThreadCtx *det_ctx,
     SCReturnUInt(ret);
 }
 
+/**
+ * \brief Get the http_method buffer the mpm runs on.
+ *
+ * \retval buffer or NULL if not available, length in buffer_len
+ */
+const uint8_t *DetectEngineGetHttpMethodMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len)
+{
+    htp_tx_t *tx = (htp_tx_t *)txv;
+    if (tx->request_method == NULL)
+        return NULL;
+
+    *buffer_len = bstr_len(tx->request_method);
+    return (const uint8_t *)bstr_ptr(tx->request_method);
+}
+
 int DetectEngineRunHttpMethodMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                  HtpState *htp_state, uint8_t flags,
                                  void *txv, uint64_t idx)
 {
     uint32_t cnt = 0;
-    htp_tx_t *tx = (htp_tx_t *)txv;
-    if (tx->request_method == NULL)
+    uint32_t buffer_len = 0;
+    const uint8_t *buffer = DetectEngineGetHttpMethodMpmBuffer(det_ctx, f,
+            htp_state, flags, txv, idx, &buffer_len);
+    if (buffer == NULL)
         goto end;
 
-    cnt = HttpMethodPatternSearch(det_ctx,
-                                  (const uint8_t *)bstr_ptr(tx->request_method),
-                                  bstr_len(tx->request_method),
-                                  flags);
+    cnt = HttpMethodPatternSearch(det_ctx, buffer, buffer_len, flags);
  end:
     return cnt;
 }
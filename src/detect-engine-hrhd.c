@@ -97,6 +97,29 @@ static inline uint32_t HttpRawHeaderPatternSearch(DetectEngineThreadCtx *det_ctx
     SCReturnUInt(ret);
 }
 
+/**
+ * \brief Get the http_raw_header buffer the mpm runs on.
+ *
+ * \retval buffer or NULL if not available, length in buffer_len
+ */
+const uint8_t *DetectEngineGetHttpRawHeaderMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len)
+{
+    htp_tx_t *tx = (htp_tx_t *)txv;
+    HtpTxUserData *tx_ud = htp_tx_get_user_data(tx);
+    if (tx_ud == NULL)
+        return NULL;
+
+    if (flags & STREAM_TOSERVER) {
+        *buffer_len = tx_ud->request_headers_raw_len;
+        return tx_ud->request_headers_raw;
+    } else {
+        *buffer_len = tx_ud->response_headers_raw_len;
+        return tx_ud->response_headers_raw;
+    }
+}
+
 int DetectEngineRunHttpRawHeaderMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                     HtpState *htp_state, uint8_t flags,
                                     void *txv, uint64_t idx)
@@ -104,27 +127,11 @@ int DetectEngineRunHttpRawHeaderMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
     SCEnter();
 
     uint32_t cnt = 0;
-
-    htp_tx_t *tx = (htp_tx_t *)txv;
-    HtpTxUserData *tx_ud = htp_tx_get_user_data(tx);
-    if (tx_ud == NULL) {
-        SCReturnInt(0);
-    }
-
-    if (flags & STREAM_TOSERVER) {
-        if (tx_ud->request_headers_raw != NULL) {
-            cnt = HttpRawHeaderPatternSearch(det_ctx,
-                                             tx_ud->request_headers_raw,
-                                             tx_ud->request_headers_raw_len,
-                                             flags);
-        }
-    } else {
-        if (tx_ud->response_headers_raw != NULL) {
-            cnt = HttpRawHeaderPatternSearch(det_ctx,
-                                              tx_ud->response_headers_raw,
-                                              tx_ud->response_headers_raw_len,
-                                              flags);
-        }
+    uint32_t buffer_len = 0;
+    const uint8_t *buffer = DetectEngineGetHttpRawHeaderMpmBuffer(det_ctx, f,
+            htp_state, flags, txv, idx, &buffer_len);
+    if (buffer != NULL) {
+        cnt = HttpRawHeaderPatternSearch(det_ctx, buffer, buffer_len, flags);
     }
 
     SCReturnInt(cnt);
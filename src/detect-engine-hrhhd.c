@@ -90,39 +90,53 @@ static inline uint32_t HttpHRHPatternSearch(DetectEngineThreadCtx *det_ctx,
     SCReturnUInt(ret);
 }
 
-int DetectEngineRunHttpHRHMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
-                              HtpState *htp_state, uint8_t flags,
-                              void *txv, uint64_t idx)
+/**
+ * \brief Get the http_raw_host buffer the mpm runs on.
+ *
+ * \retval buffer or NULL if not available, length in buffer_len
+ */
+const uint8_t *DetectEngineGetHttpHRHMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len)
 {
-    uint32_t cnt = 0;
     htp_tx_t *tx = (htp_tx_t *)txv;
     const uint8_t *hname = NULL;
-    uint32_t hname_len = 0;
 
     if (tx->parsed_uri == NULL || tx->parsed_uri->hostname == NULL) {
         if (tx->request_headers == NULL)
-            goto end;
+            return NULL;
         htp_header_t *h = NULL;
         h = (htp_header_t *)htp_table_get_c(tx->request_headers, "Host");
         if (h != NULL) {
             hname = (const uint8_t *)bstr_ptr(h->value);
             if (hname != NULL)
-                hname_len = bstr_len(h->value);
+                *buffer_len = bstr_len(h->value);
         } else {
             SCLogDebug("HTTP host header not present in this request");
-            goto end;
+            return NULL;
         }
     } else {
         hname = (uint8_t *)bstr_ptr(tx->parsed_uri->hostname);
         if (hname != NULL)
-            hname_len = bstr_len(tx->parsed_uri->hostname);
+            *buffer_len = bstr_len(tx->parsed_uri->hostname);
     }
 
+    return hname;
+}
+
+int DetectEngineRunHttpHRHMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
+                              HtpState *htp_state, uint8_t flags,
+                              void *txv, uint64_t idx)
+{
+    uint32_t cnt = 0;
+    uint32_t hname_len = 0;
+    const uint8_t *hname = DetectEngineGetHttpHRHMpmBuffer(det_ctx, f,
+            htp_state, flags, txv, idx, &hname_len);
+
     if (hname != NULL) {
         cnt = HttpHRHPatternSearch(det_ctx, hname, hname_len, flags);
     }
 
- end:
     return cnt;
 }
 
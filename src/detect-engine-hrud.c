@@ -92,20 +92,37 @@ static inline uint32_t HttpRawUriPatternSearch(DetectEngineThreadCtx *det_ctx,
  *
  * \retval cnt Number of matches reported by the mpm algo.
  */
+/**
+ * \brief Get the http_raw_uri buffer the mpm runs on.
+ *
+ * \retval buffer or NULL if not available, length in buffer_len
+ */
+const uint8_t *DetectEngineGetHttpRawUriMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len)
+{
+    htp_tx_t *tx = (htp_tx_t *)txv;
+    if (tx->request_uri == NULL)
+        return NULL;
+
+    *buffer_len = bstr_len(tx->request_uri);
+    return (const uint8_t *)bstr_ptr(tx->request_uri);
+}
+
 int DetectEngineRunHttpRawUriMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                  HtpState *htp_state, uint8_t flags,
                                  void *txv, uint64_t idx)
 {
     SCEnter();
 
-    htp_tx_t *tx = (htp_tx_t *)txv;
     uint32_t cnt = 0;
-    if (tx->request_uri == NULL)
+    uint32_t buffer_len = 0;
+    const uint8_t *buffer = DetectEngineGetHttpRawUriMpmBuffer(det_ctx, f,
+            htp_state, flags, txv, idx, &buffer_len);
+    if (buffer == NULL)
         goto end;
 
-    cnt = HttpRawUriPatternSearch(det_ctx,
-                                  (const uint8_t *)bstr_ptr(tx->request_uri),
-                                  bstr_len(tx->request_uri), flags);
+    cnt = HttpRawUriPatternSearch(det_ctx, buffer, buffer_len, flags);
 end:
     SCReturnInt(cnt);
 }
@@ -89,6 +89,23 @@ static inline uint32_t HttpStatCodePatternSearch(DetectEngineThreadCtx *det_ctx,
  *
  * \retval cnt Number of matches reported by the mpm algo.
  */
+/**
+ * \brief Get the http_stat_code buffer the mpm runs on.
+ *
+ * \retval buffer or NULL if not available, length in buffer_len
+ */
+const uint8_t *DetectEngineGetHttpStatCodeMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len)
+{
+    htp_tx_t *tx = (htp_tx_t *)txv;
+    if (tx->response_status == NULL)
+        return NULL;
+
+    *buffer_len = bstr_len(tx->response_status);
+    return (const uint8_t *)bstr_ptr(tx->response_status);
+}
+
 int DetectEngineRunHttpStatCodeMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                    HtpState *htp_state, uint8_t flags,
                                    void *txv, uint64_t idx)
@@ -96,13 +113,13 @@ int DetectEngineRunHttpStatCodeMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
     SCEnter();
 
     uint32_t cnt = 0;
-    htp_tx_t *tx = (htp_tx_t *)txv;
-    if (tx->response_status == NULL)
+    uint32_t buffer_len = 0;
+    const uint8_t *buffer = DetectEngineGetHttpStatCodeMpmBuffer(det_ctx, f,
+            htp_state, flags, txv, idx, &buffer_len);
+    if (buffer == NULL)
         goto end;
 
-    cnt = HttpStatCodePatternSearch(det_ctx,
-                                    (const uint8_t *)bstr_ptr(tx->response_status),
-                                    bstr_len(tx->response_status), flags);
+    cnt = HttpStatCodePatternSearch(det_ctx, buffer, buffer_len, flags);
 end:
     SCReturnInt(cnt);
 }
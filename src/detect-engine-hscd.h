@@ -25,6 +25,9 @@
 
 #include "app-layer-htp.h"
 
+const uint8_t *DetectEngineGetHttpStatCodeMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len);
 int DetectEngineRunHttpStatCodeMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                    HtpState *htp_state, uint8_t flags,
                                    void *tx, uint64_t idx);
@@ -89,6 +89,23 @@ static inline uint32_t HttpStatMsgPatternSearch(DetectEngineThreadCtx *det_ctx,
  *
  * \retval cnt Number of matches reported by the mpm algo.
  */
+/**
+ * \brief Get the http_stat_msg buffer the mpm runs on.
+ *
+ * \retval buffer or NULL if not available, length in buffer_len
+ */
+const uint8_t *DetectEngineGetHttpStatMsgMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len)
+{
+    htp_tx_t *tx = (htp_tx_t *)txv;
+    if (tx->response_message == NULL)
+        return NULL;
+
+    *buffer_len = bstr_len(tx->response_message);
+    return (const uint8_t *)bstr_ptr(tx->response_message);
+}
+
 int DetectEngineRunHttpStatMsgMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                   HtpState *htp_state, uint8_t flags,
                                   void *txv, uint64_t idx)
@@ -96,13 +113,13 @@ int DetectEngineRunHttpStatMsgMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
     SCEnter();
 
     uint32_t cnt = 0;
-    htp_tx_t *tx = (htp_tx_t *)txv;
-    if (tx->response_message == NULL)
+    uint32_t buffer_len = 0;
+    const uint8_t *buffer = DetectEngineGetHttpStatMsgMpmBuffer(det_ctx, f,
+            htp_state, flags, txv, idx, &buffer_len);
+    if (buffer == NULL)
         goto end;
 
-    cnt = HttpStatMsgPatternSearch(det_ctx,
-                                   (const uint8_t *)bstr_ptr(tx->response_message),
-                                   bstr_len(tx->response_message), flags);
+    cnt = HttpStatMsgPatternSearch(det_ctx, buffer, buffer_len, flags);
 end:
     SCReturnInt(cnt);
 }
@@ -54,6 +54,7 @@
 #include "util-unittest-helper.h"
 #include "util-print.h"
 #include "util-profiling.h"
+#include "util-byte.h"
 
 #ifdef OS_WIN32
 #include <winsock.h>
@@ -61,6 +62,30 @@
 #include <netinet/in.h>
 #endif /* OS_WIN32 */
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/** SigNumArrays are padded to a multiple of this many bytes, so the match
+ *  loop works on whole blocks */
+#define SIGNUMARRAY_BLOCK_SIZE  32
+
+/** a sorted list of the sig nums is built for arrays with at most one sig
+ *  set per this many bytes. Checking the few sigs of such an array against
+ *  the other array is cheaper than ANDing both arrays. */
+#define SIGNUMARRAY_SPARSE_DIV  16
+
+/**
+ * \brief Size in bytes of the SigNumArrays, rounded up to whole blocks
+ */
+static inline uint32_t SigNumArraySize(uint32_t max_idx)
+{
+    uint32_t size = max_idx / 8 + 1;
+    return (size + SIGNUMARRAY_BLOCK_SIZE - 1) & ~(SIGNUMARRAY_BLOCK_SIZE - 1);
+}
+
 /**
  * \brief This function creates a new IPOnlyCIDRItem
  *
@@ -512,13 +537,13 @@ static SigNumArray *SigNumArrayNew(DetectEngineCtx *de_ctx,
     }
     memset(new, 0, sizeof(SigNumArray));
 
-    new->array = SCMalloc(io_ctx->max_idx / 8 + 1);
+    new->size = SigNumArraySize(io_ctx->max_idx);
+    new->array = SCMalloc(new->size);
     if (new->array == NULL) {
        exit(EXIT_FAILURE);
     }
 
-    memset(new->array, 0, io_ctx->max_idx / 8 + 1);
-    new->size = io_ctx->max_idx / 8 + 1;
+    memset(new->array, 0, new->size);
 
     SCLogDebug("max idx= %u", io_ctx->max_idx);
 
@@ -568,9 +593,45 @@ static void SigNumArrayFree(void *tmp)
     if (sna->array != NULL)
         SCFree(sna->array);
 
+    if (sna->sigs != NULL)
+        SCFree(sna->sigs);
+
     SCFree(sna);
 }
 
+/**
+ * \brief Build the sorted list of sig nums of a SigNumArray with few sigs
+ *        set. Called for all SigNumArrays once the radix trees are complete.
+ *
+ * \param tmp Pointer to the SigNumArray
+ * \param data Not used
+ */
+static void SigNumArrayBuildSparse(void *tmp, void *data)
+{
+    SigNumArray *sna = (SigNumArray *)tmp;
+    uint32_t cnt = 0;
+    uint32_t u;
+
+    if (sna == NULL || sna->sigs != NULL)
+        return;
+
+    for (u = 0; u < sna->size; u++)
+        cnt += __builtin_popcount(sna->array[u]);
+    if (cnt > sna->size / SIGNUMARRAY_SPARSE_DIV)
+        return;
+
+    /* also for cnt 0, so nothing is ANDed for a sig-less array */
+    sna->sigs = SCMalloc(MAX(cnt, 1) * sizeof(uint32_t));
+    if (sna->sigs == NULL)
+        return;
+
+    sna->sigs_cnt = 0;
+    for (u = 0; u < sna->size * 8; u++) {
+        if (sna->array[u / 8] & (1 << (u % 8)))
+            sna->sigs[sna->sigs_cnt++] = u;
+    }
+}
+
 /**
  * \brief This function parses and return a list of IPOnlyCIDRItem
  *
@@ -871,7 +932,7 @@ void DetectEngineIPOnlyThreadInit(DetectEngineCtx *de_ctx,
                                   DetectEngineIPOnlyThreadCtx *io_tctx)
 {
     /* initialize the signature bitarray */
-    io_tctx->sig_match_size = de_ctx->io_ctx.max_idx / 8 + 1;
+    io_tctx->sig_match_size = SigNumArraySize(de_ctx->io_ctx.max_idx);
     io_tctx->sig_match_array = SCMalloc(io_tctx->sig_match_size);
     if (io_tctx->sig_match_array == NULL) {
         exit(EXIT_FAILURE);
@@ -958,6 +1019,140 @@ int IPOnlyMatchCompatSMs(ThreadVars *tv,
     return 1;
 }
 
+/**
+ * \brief Match a single IP Only signature against a packet whose addresses
+ *        matched the signature, and append the alert
+ *
+ * \param de_ctx Pointer to the current detection engine
+ * \param det_ctx Pointer to the current thread detection engine
+ * \param p Pointer to the Packet to match against
+ * \param signum Internal num of the signature
+ */
+static inline void IPOnlyMatchSignature(ThreadVars *tv,
+                                        DetectEngineCtx *de_ctx,
+                                        DetectEngineThreadCtx *det_ctx,
+                                        Packet *p, uint32_t signum)
+{
+    Signature *s = de_ctx->sig_array[signum];
+
+    if ((s->proto.flags & DETECT_PROTO_IPV4) && !PKT_IS_IPV4(p)) {
+        SCLogDebug("ip version didn't match");
+        return;
+    }
+    if ((s->proto.flags & DETECT_PROTO_IPV6) && !PKT_IS_IPV6(p)) {
+        SCLogDebug("ip version didn't match");
+        return;
+    }
+
+    if (DetectProtoContainsProto(&s->proto, IP_GET_IPPROTO(p)) == 0) {
+        SCLogDebug("proto didn't match");
+        return;
+    }
+
+    /* check the source & dst port in the sig */
+    if (p->proto == IPPROTO_TCP || p->proto == IPPROTO_UDP || p->proto == IPPROTO_SCTP) {
+        if (!(s->flags & SIG_FLAG_DP_ANY)) {
+            if (p->flags & PKT_IS_FRAGMENT)
+                return;
+
+            DetectPort *dport = DetectPortLookupGroup(s->dp,p->dp);
+            if (dport == NULL) {
+                SCLogDebug("dport didn't match.");
+                return;
+            }
+        }
+        if (!(s->flags & SIG_FLAG_SP_ANY)) {
+            if (p->flags & PKT_IS_FRAGMENT)
+                return;
+
+            DetectPort *sport = DetectPortLookupGroup(s->sp,p->sp);
+            if (sport == NULL) {
+                SCLogDebug("sport didn't match.");
+                return;
+            }
+        }
+    } else if ((s->flags & (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) != (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) {
+        SCLogDebug("port-less protocol and sig needs ports");
+        return;
+    }
+
+    if (!IPOnlyMatchCompatSMs(tv, det_ctx, s, p)) {
+        return;
+    }
+
+    SCLogDebug("Signum %"PRIu32" match (sid: %"PRIu32", msg: %s)",
+               signum, s->id, s->msg);
+
+    if (s->sm_arrays[DETECT_SM_LIST_POSTMATCH] != NULL) {
+        KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_POSTMATCH);
+        SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_POSTMATCH];
+
+        SCLogDebug("running match functions, sm %p", smd);
+
+        if (smd != NULL) {
+            while (1) {
+                KEYWORD_PROFILING_START;
+                (void)sigmatch_table[smd->type].Match(tv, det_ctx, p, s, smd->ctx);
+                KEYWORD_PROFILING_END(det_ctx, smd->type, 1);
+                if (smd->is_last)
+                    break;
+                smd++;
+            }
+        }
+    }
+    if (!(s->flags & SIG_FLAG_NOALERT)) {
+        if (s->action & ACTION_DROP)
+            PacketAlertAppend(det_ctx, s, p, 0, PACKET_ALERT_FLAG_DROP_FLOW);
+        else
+            PacketAlertAppend(det_ctx, s, p, 0, 0);
+    } else {
+        /* apply actions for noalert/rule suppressed as well */
+        DetectSignatureApplyActions(p, s);
+    }
+}
+
+/**
+ * \brief AND a block of two SigNumArrays
+ *
+ * \param r Pointer to the block of the result
+ * \param a Pointer to the block of the first array
+ * \param b Pointer to the block of the second array
+ *
+ * \retval 1 if any bit is set in the result, 0 otherwise
+ */
+static inline int SigNumArrayAndBlock(uint8_t *r, const uint8_t *a,
+                                      const uint8_t *b)
+{
+#if defined(__AVX2__)
+    __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)a),
+                                 _mm256_loadu_si256((const __m256i *)b));
+    _mm256_storeu_si256((__m256i *)r, v);
+    return !_mm256_testz_si256(v, v);
+#elif defined(__SSE2__)
+    __m128i v0 = _mm_and_si128(_mm_loadu_si128((const __m128i *)a),
+                               _mm_loadu_si128((const __m128i *)b));
+    __m128i v1 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(a + 16)),
+                               _mm_loadu_si128((const __m128i *)(b + 16)));
+    _mm_storeu_si128((__m128i *)r, v0);
+    _mm_storeu_si128((__m128i *)(r + 16), v1);
+    __m128i v = _mm_or_si128(v0, v1);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff;
+#else
+    uint64_t wa[SIGNUMARRAY_BLOCK_SIZE / 8], wb[SIGNUMARRAY_BLOCK_SIZE / 8];
+    uint64_t any = 0;
+    int i;
+
+    memcpy(wa, a, sizeof(wa));
+    memcpy(wb, b, sizeof(wb));
+    for (i = 0; i < SIGNUMARRAY_BLOCK_SIZE / 8; i++) {
+        wa[i] &= wb[i];
+        any |= wa[i];
+    }
+    memcpy(r, wa, sizeof(wa));
+    return any != 0;
+#endif
+}
+
 /**
  * \brief Match a packet against the IP Only detection engine contexts
  *
@@ -998,100 +1193,47 @@ void IPOnlyMatchPacket(ThreadVars *tv,
     if (src == NULL || dst == NULL)
         return;
 
-    uint32_t u;
-    for (u = 0; u < src->size; u++) {
-        SCLogDebug("And %"PRIu8" & %"PRIu8, src->array[u], dst->array[u]);
-
-        /* The final results will be at io_tctx */
-        io_tctx->sig_match_array[u] = dst->array[u] & src->array[u];
-
-        /* We have to move the logic of the signature checking
-         * to the main detect loop, in order to apply the
-         * priority of actions (pass, drop, reject, alert) */
-        if (io_tctx->sig_match_array[u] != 0) {
-            /* We have a match :) Let's see from which signum's */
-            uint8_t bitarray = io_tctx->sig_match_array[u];
-            uint8_t i = 0;
-
-            for (; i < 8; i++, bitarray = bitarray >> 1) {
-                if (bitarray & 0x01) {
-                    Signature *s = de_ctx->sig_array[u * 8 + i];
-
-                    if ((s->proto.flags & DETECT_PROTO_IPV4) && !PKT_IS_IPV4(p)) {
-                        SCLogDebug("ip version didn't match");
-                        continue;
-                    }
-                    if ((s->proto.flags & DETECT_PROTO_IPV6) && !PKT_IS_IPV6(p)) {
-                        SCLogDebug("ip version didn't match");
-                        continue;
-                    }
-
-                    if (DetectProtoContainsProto(&s->proto, IP_GET_IPPROTO(p)) == 0) {
-                        SCLogDebug("proto didn't match");
-                        continue;
-                    }
+    /* We have to move the logic of the signature checking
+     * to the main detect loop, in order to apply the
+     * priority of actions (pass, drop, reject, alert) */
+
+    if (src->sigs != NULL || dst->sigs != NULL) {
+        /* walk the shortest list, checking its sigs in the other array */
+        const SigNumArray *list = src, *other = dst;
+        if (dst->sigs != NULL &&
+            (src->sigs == NULL || dst->sigs_cnt < src->sigs_cnt)) {
+            list = dst;
+            other = src;
+        }
 
-                    /* check the source & dst port in the sig */
-                    if (p->proto == IPPROTO_TCP || p->proto == IPPROTO_UDP || p->proto == IPPROTO_SCTP) {
-                        if (!(s->flags & SIG_FLAG_DP_ANY)) {
-                            if (p->flags & PKT_IS_FRAGMENT)
-                                continue;
-
-                            DetectPort *dport = DetectPortLookupGroup(s->dp,p->dp);
-                            if (dport == NULL) {
-                                SCLogDebug("dport didn't match.");
-                                continue;
-                            }
-                        }
-                        if (!(s->flags & SIG_FLAG_SP_ANY)) {
-                            if (p->flags & PKT_IS_FRAGMENT)
-                                continue;
-
-                            DetectPort *sport = DetectPortLookupGroup(s->sp,p->sp);
-                            if (sport == NULL) {
-                                SCLogDebug("sport didn't match.");
-                                continue;
-                            }
-                        }
-                    } else if ((s->flags & (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) != (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) {
-                        SCLogDebug("port-less protocol and sig needs ports");
-                        continue;
-                    }
+        uint32_t i;
+        for (i = 0; i < list->sigs_cnt; i++) {
+            uint32_t signum = list->sigs[i];
+            if (other->array[signum / 8] & (1 << (signum % 8)))
+                IPOnlyMatchSignature(tv, de_ctx, det_ctx, p, signum);
+        }
+        return;
+    }
 
-                    if (!IPOnlyMatchCompatSMs(tv, det_ctx, s, p)) {
-                        continue;
-                    }
+    uint8_t *match = io_tctx->sig_match_array;
+    uint32_t u;
+    for (u = 0; u < src->size; u += SIGNUMARRAY_BLOCK_SIZE) {
+        /* The final results will be at io_tctx */
+        if (!SigNumArrayAndBlock(match + u, src->array + u, dst->array + u))
+            continue;
 
-                    SCLogDebug("Signum %"PRIu16" match (sid: %"PRIu16", msg: %s)",
-                               u * 8 + i, s->id, s->msg);
-
-                    if (s->sm_arrays[DETECT_SM_LIST_POSTMATCH] != NULL) {
-                        KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_POSTMATCH);
-                        SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_POSTMATCH];
-
-                        SCLogDebug("running match functions, sm %p", smd);
-
-                        if (smd != NULL) {
-                            while (1) {
-                                KEYWORD_PROFILING_START;
-                                (void)sigmatch_table[smd->type].Match(tv, det_ctx, p, s, smd->ctx);
-                                KEYWORD_PROFILING_END(det_ctx, smd->type, 1);
-                                if (smd->is_last)
-                                    break;
-                                smd++;
-                            }
-                        }
-                    }
-                    if (!(s->flags & SIG_FLAG_NOALERT)) {
-                        if (s->action & ACTION_DROP)
-                            PacketAlertAppend(det_ctx, s, p, 0, PACKET_ALERT_FLAG_DROP_FLOW);
-                        else
-                            PacketAlertAppend(det_ctx, s, p, 0, 0);
-                    } else {
-                        /* apply actions for noalert/rule suppressed as well */
-                        DetectSignatureApplyActions(p, s);
-                    }
-                }
+        /* We have a match :) Let's see from which signum's */
+        uint32_t w;
+        for (w = u; w < u + SIGNUMARRAY_BLOCK_SIZE; w += sizeof(uint64_t)) {
+            uint64_t bits;
+            memcpy(&bits, match + w, sizeof(bits));
+#if __BYTE_ORDER == __BIG_ENDIAN
+            bits = SCByteSwap64(bits);
+#endif
+            while (bits != 0) {
+                uint32_t signum = w * 8 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                IPOnlyMatchSignature(tv, de_ctx, det_ctx, p, signum);
             }
         }
     }
@@ -1501,6 +1643,17 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
         SCFree(tmpaux);
     }
 
+    /* the trees are complete, add the sig num lists to the arrays with
+     * few sigs */
+    SCRadixForEachUserData((de_ctx->io_ctx).tree_ipv4src,
+                           SigNumArrayBuildSparse, NULL);
+    SCRadixForEachUserData((de_ctx->io_ctx).tree_ipv4dst,
+                           SigNumArrayBuildSparse, NULL);
+    SCRadixForEachUserData((de_ctx->io_ctx).tree_ipv6src,
+                           SigNumArrayBuildSparse, NULL);
+    SCRadixForEachUserData((de_ctx->io_ctx).tree_ipv6dst,
+                           SigNumArrayBuildSparse, NULL);
+
     /* print all the trees: for debuggin it might print too much info
     SCLogDebug("Radix tree src ipv4:");
     SCRadixPrintTree((de_ctx->io_ctx).tree_ipv4src);
@@ -2279,6 +2432,58 @@ int IPOnlyTestSig17(void)
     return result;
 }
 
+/**
+ * \test Signatures spread over several blocks of the SigNumArrays, matched
+ *       with the block AND and with the sig num list of a sparse array.
+ */
+static int IPOnlyTestSig18(void)
+{
+#define IPONLY_TEST18_SIGS  600
+    static char sigbuf[IPONLY_TEST18_SIGS][128];
+    char *sigs[IPONLY_TEST18_SIGS];
+    uint32_t sid[IPONLY_TEST18_SIGS];
+    uint32_t results[2 * IPONLY_TEST18_SIGS];
+    uint8_t *buf = (uint8_t *)"Hi all!";
+    uint16_t buflen = strlen((char *)buf);
+    Packet *p[2];
+    int i;
+
+    p[0] = UTHBuildPacketSrcDst(buf, buflen, IPPROTO_TCP, "192.168.1.5",
+                                "192.168.1.1");
+    p[1] = UTHBuildPacketSrcDst(buf, buflen, IPPROTO_TCP, "10.0.1.44",
+                                "8.8.8.8");
+    FAIL_IF_NULL(p[0]);
+    FAIL_IF_NULL(p[1]);
+
+    memset(results, 0, sizeof(results));
+    for (i = 0; i < IPONLY_TEST18_SIGS; i++) {
+        /* the first and last sigs of words and blocks match the first
+         * packet, the others each have a host of their own as src */
+        if (i == 0 || i == 63 || i == 64 || i == 127 || i == 128 ||
+            i == 255 || i == 256 || i == 511 || i == 512 ||
+            i == IPONLY_TEST18_SIGS - 1) {
+            snprintf(sigbuf[i], sizeof(sigbuf[i]), "alert tcp 192.168.1.0/24 "
+                     "any -> 192.168.1.1 any (msg:\"sid %d\"; sid:%d;)",
+                     i + 1, i + 1);
+            results[i] = 1;
+        } else {
+            snprintf(sigbuf[i], sizeof(sigbuf[i]), "alert tcp 10.0.%d.%d "
+                     "any -> any any (msg:\"sid %d\"; sid:%d;)",
+                     i / 256, i % 256, i + 1, i + 1);
+        }
+        sigs[i] = sigbuf[i];
+        sid[i] = i + 1;
+    }
+    /* the src of the second packet has a single sig */
+    results[IPONLY_TEST18_SIGS + 300] = 1;
+
+    FAIL_IF_NOT(UTHGenericTest(p, 2, sigs, sid, results, IPONLY_TEST18_SIGS));
+
+    UTHFreePackets(p, 2);
+    PASS;
+#undef IPONLY_TEST18_SIGS
+}
+
 #endif /* UNITTESTS */
 
 void IPOnlyRegisterTests(void)
@@ -2314,6 +2519,7 @@ void IPOnlyRegisterTests(void)
     UtRegisterTest("IPOnlyTestSig16", IPOnlyTestSig16);
 
     UtRegisterTest("IPOnlyTestSig17", IPOnlyTestSig17);
+    UtRegisterTest("IPOnlyTestSig18", IPOnlyTestSig18);
 #endif
 
     return;
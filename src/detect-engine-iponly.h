@@ -33,6 +33,9 @@
 typedef struct SigNumArray_ {
     uint8_t *array; /* bit array of sig nums */
     uint32_t size;  /* size in bytes of the array */
+    uint32_t sigs_cnt;  /* number of sig nums in sigs */
+    uint32_t *sigs; /* sorted sig nums set in array, only for arrays with
+                     * few bits set, NULL otherwise */
 } SigNumArray;
 
 void IPOnlyCIDRListFree(IPOnlyCIDRItem *tmphead);
@@ -37,6 +37,9 @@
 #include "detect-engine-iponly.h"
 #include "detect-parse.h"
 #include "util-mpm.h"
+#include "util-mpm-hs.h"
+#include "util-mpm-teddy.h"
+#include "util-mpm-cache.h"
 #include "util-memcmp.h"
 #include "util-memcpy.h"
 #include "conf.h"
@@ -48,6 +51,18 @@
 
 #include "detect-content.h"
 #include "detect-uricontent.h"
+#include "detect-engine-hcd.h"
+#include "detect-engine-hhd.h"
+#include "detect-engine-hhhd.h"
+#include "detect-engine-hmd.h"
+#include "detect-engine-hrhd.h"
+#include "detect-engine-hrhhd.h"
+#include "detect-engine-hrud.h"
+#include "detect-engine-hscd.h"
+#include "detect-engine-hsmd.h"
+#include "detect-engine-hua.h"
+
+#include "app-layer-htp.h"
 
 #include "stream.h"
 
@@ -144,6 +159,157 @@ void DetectMpmInitializeAppMpms(DetectEngineCtx *de_ctx)
     }
 }
 
+/** \internal
+ *  \brief queue a mpm ctx to be prepared by DetectMpmPrepareQueued
+ *
+ *  If the queue can't grow the ctx is prepared right away.
+ */
+static void MpmPrepareQueueAdd(DetectEngineCtx *de_ctx, MpmCtx *mpm_ctx,
+                               uint16_t matcher)
+{
+    if (mpm_table[matcher].Prepare == NULL)
+        return;
+
+    if (de_ctx->mpm_prepare_cnt == de_ctx->mpm_prepare_size) {
+        uint32_t size = de_ctx->mpm_prepare_size ?
+            de_ctx->mpm_prepare_size * 2 : 256;
+        void *ptmp = SCRealloc(de_ctx->mpm_prepare_queue,
+                               size * sizeof(MpmPrepareJob));
+        if (ptmp == NULL) {
+            mpm_table[matcher].Prepare(mpm_ctx);
+            return;
+        }
+        de_ctx->mpm_prepare_queue = ptmp;
+        de_ctx->mpm_prepare_size = size;
+    }
+
+    MpmPrepareJob *job = &de_ctx->mpm_prepare_queue[de_ctx->mpm_prepare_cnt++];
+    job->mpm_ctx = mpm_ctx;
+    job->matcher = matcher;
+}
+
+static int MpmPrepareJobCompareCtx(const void *a, const void *b)
+{
+    const MpmPrepareJob *ja = a, *jb = b;
+    if (ja->mpm_ctx == jb->mpm_ctx)
+        return 0;
+    return (ja->mpm_ctx < jb->mpm_ctx) ? -1 : 1;
+}
+
+/* largest first, so a big ctx isn't started last */
+static int MpmPrepareJobCompareSize(const void *a, const void *b)
+{
+    const MpmPrepareJob *ja = a, *jb = b;
+    if (ja->mpm_ctx->pattern_cnt == jb->mpm_ctx->pattern_cnt)
+        return 0;
+    return (ja->mpm_ctx->pattern_cnt > jb->mpm_ctx->pattern_cnt) ? -1 : 1;
+}
+
+typedef struct MpmPrepareWorker_ {
+    DetectEngineCtx *de_ctx;
+    SCMutex lock;
+    uint32_t next;  /**< next job to hand out, protected by lock */
+} MpmPrepareWorker;
+
+static void *MpmPrepareThread(void *arg)
+{
+    MpmPrepareWorker *w = (MpmPrepareWorker *)arg;
+    DetectEngineCtx *de_ctx = w->de_ctx;
+
+    while (1) {
+        SCMutexLock(&w->lock);
+        uint32_t idx = w->next++;
+        SCMutexUnlock(&w->lock);
+        if (idx >= de_ctx->mpm_prepare_cnt)
+            break;
+
+        MpmPrepareJob *job = &de_ctx->mpm_prepare_queue[idx];
+        mpm_table[job->matcher].Prepare(job->mpm_ctx);
+    }
+    return NULL;
+}
+
+/**
+ *  \brief prepare the queued mpm ctxs
+ *
+ *  Building the mpm state tables (or compiling the Hyperscan databases)
+ *  is the bulk of the engine build time. The ctxs don't depend on each
+ *  other, so they are prepared by detect.mpm.build-threads threads, the
+ *  calling thread being one of them.
+ */
+void DetectMpmPrepareQueued(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->mpm_prepare_cnt == 0)
+        return;
+
+    /* a shared ctx can be queued more than once */
+    qsort(de_ctx->mpm_prepare_queue, de_ctx->mpm_prepare_cnt,
+            sizeof(MpmPrepareJob), MpmPrepareJobCompareCtx);
+    uint32_t i, cnt = 1;
+    for (i = 1; i < de_ctx->mpm_prepare_cnt; i++) {
+        if (de_ctx->mpm_prepare_queue[i].mpm_ctx !=
+                de_ctx->mpm_prepare_queue[cnt - 1].mpm_ctx)
+            de_ctx->mpm_prepare_queue[cnt++] = de_ctx->mpm_prepare_queue[i];
+    }
+    de_ctx->mpm_prepare_cnt = cnt;
+    qsort(de_ctx->mpm_prepare_queue, de_ctx->mpm_prepare_cnt,
+            sizeof(MpmPrepareJob), MpmPrepareJobCompareSize);
+
+    MpmPrepareWorker w;
+    memset(&w, 0, sizeof(w));
+    w.de_ctx = de_ctx;
+    SCMutexInit(&w.lock, NULL);
+
+    uint32_t nthreads = de_ctx->mpm_build_threads;
+    if (nthreads > de_ctx->mpm_prepare_cnt)
+        nthreads = de_ctx->mpm_prepare_cnt;
+#ifdef __SC_CUDA_SUPPORT__
+    /* the cuda ctx is bound to this thread */
+    if (de_ctx->mpm_matcher == MPM_AC_CUDA)
+        nthreads = 1;
+#endif
+
+    pthread_t threads[MPM_BUILD_THREADS_MAX];
+    uint32_t started = 0;
+    for ( ; started + 1 < nthreads; started++) {
+        if (pthread_create(&threads[started], NULL, MpmPrepareThread, &w) != 0) {
+            SCLogWarning(SC_ERR_THREAD_CREATE, "failed to start mpm build "
+                    "thread: %s", strerror(errno));
+            break;
+        }
+    }
+
+    uint64_t hits = 0, misses = 0;
+    MpmCacheGetStats(&hits, &misses);
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    (void)MpmPrepareThread(&w);
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    gettimeofday(&end, NULL);
+
+    if (!(de_ctx->flags & DE_QUIET)) {
+        SCLogPerf("prepared %u mpm ctxs using %u threads in %"PRIu64" ms",
+                de_ctx->mpm_prepare_cnt, started + 1,
+                ((uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+                 end.tv_usec - start.tv_usec) / 1000);
+        if (MpmCacheEnabled()) {
+            uint64_t hits2 = 0, misses2 = 0;
+            MpmCacheGetStats(&hits2, &misses2);
+            SCLogPerf("mpm cache: %"PRIu64" hits, %"PRIu64" misses",
+                    hits2 - hits, misses2 - misses);
+        }
+    }
+
+    SCMutexDestroy(&w.lock);
+    SCFree(de_ctx->mpm_prepare_queue);
+    de_ctx->mpm_prepare_queue = NULL;
+    de_ctx->mpm_prepare_cnt = 0;
+    de_ctx->mpm_prepare_size = 0;
+}
+
 /**
  *  \brief initialize mpm contexts for applayer buffers that are in
  *         "single or "shared" mode.
@@ -160,9 +326,7 @@ void DetectMpmPrepareAppMpms(DetectEngineCtx *de_ctx)
         {
             MpmCtx *mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, am->sgh_mpm_context, dir);
             if (mpm_ctx != NULL) {
-                if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-                    mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-                }
+                MpmPrepareQueueAdd(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
             }
         }
     }
@@ -211,42 +375,28 @@ void DetectMpmPrepareBuiltinMpms(DetectEngineCtx *de_ctx)
 
     if (de_ctx->sgh_mpm_context_proto_tcp_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepareQueueAdd(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepareQueueAdd(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
     }
 
     if (de_ctx->sgh_mpm_context_proto_udp_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepareQueueAdd(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepareQueueAdd(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
     }
 
     if (de_ctx->sgh_mpm_context_proto_other_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_other_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepareQueueAdd(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
     }
 
     if (de_ctx->sgh_mpm_context_stream != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepareQueueAdd(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepareQueueAdd(de_ctx, mpm_ctx, de_ctx->mpm_matcher);
     }
 }
 
@@ -729,16 +879,95 @@ static char MpmStoreCompareFunc(void *data1, uint16_t len1, void *data2,
     return 1;
 }
 
+/** \internal
+ *  \brief sig num map of the mpm ctxs a reload takes over from a detect
+ *         engine in which the sigs have other nums
+ *
+ *  Translates the sig nums of the ctx that was prepared, the owner, to
+ *  ours. The ctxs of one num space share the map. Refcounted by the ctxs
+ *  and the reuse setup, under mpm_store_reuse_lock.
+ */
+typedef struct MpmStoreSidMap_ {
+    uint32_t refcnt;
+    uint32_t size;
+    /* sid_map of the old ctxs that is translated further, or NULL for
+     * the ctxs the old detect engine prepared itself */
+    const SigIntId *src;
+    struct MpmStoreSidMap_ *next;
+    SigIntId nums[];
+} MpmStoreSidMap;
+
+/* sig of the old detect engine that is not in ours */
+#define MPM_STORE_NO_NUM ((SigIntId)~0)
+
+static inline MpmStoreSidMap *MpmStoreSidMapGet(const SigIntId *sid_map)
+{
+    return (MpmStoreSidMap *)((uint8_t *)sid_map -
+                              offsetof(MpmStoreSidMap, nums));
+}
+
+/* protects MpmCtx::refcnt of ctxs shared between detect engines and
+ * MpmStoreSidMap::refcnt. Reloads and frees of (tenant) detect engines
+ * can run in different threads. */
+static SCMutex mpm_store_reuse_lock = SCMUTEX_INITIALIZER;
+
+static void MpmStoreSidMapRelease(MpmStoreSidMap *map)
+{
+    uint32_t refcnt;
+    SCMutexLock(&mpm_store_reuse_lock);
+    refcnt = --map->refcnt;
+    SCMutexUnlock(&mpm_store_reuse_lock);
+    if (refcnt == 0)
+        SCFree(map);
+}
+
+/** \internal
+ *  \brief drop a store's reference to its mpm ctx
+ *
+ *  \retval 1 ctx is still in use by another detect engine
+ *  \retval 0 last reference, ctx should be destroyed
+ */
+static int MpmStoreReleaseCtx(MpmCtx *mpm_ctx)
+{
+    int r = 0;
+    SCMutexLock(&mpm_store_reuse_lock);
+    if (mpm_ctx->refcnt > 1) {
+        mpm_ctx->refcnt--;
+        r = 1;
+    }
+    SCMutexUnlock(&mpm_store_reuse_lock);
+    return r;
+}
+
+/** \internal
+ *  \brief drop a reference to a prepared mpm ctx, destroy it if it was
+ *         the last one
+ *
+ *  A ctx with an owner only shares the owner's matcher ctx, so it drops
+ *  its reference to the owner and its sid map instead.
+ */
+static void MpmStoreDestroyCtx(MpmCtx *mpm_ctx)
+{
+    if (MpmStoreReleaseCtx(mpm_ctx) == 1)
+        return;
+
+    if (mpm_ctx->owner != NULL) {
+        SCLogDebug("releasing mpm_ctx %p of owner %p", mpm_ctx, mpm_ctx->owner);
+        MpmStoreDestroyCtx(mpm_ctx->owner);
+        MpmStoreSidMapRelease(MpmStoreSidMapGet(mpm_ctx->sid_map));
+    } else {
+        SCLogDebug("destroying mpm_ctx %p", mpm_ctx);
+        mpm_table[mpm_ctx->mpm_type].DestroyCtx(mpm_ctx);
+    }
+    SCFree(mpm_ctx);
+}
+
 static void MpmStoreFreeFunc(void *ptr)
 {
     MpmStore *ms = ptr;
     if (ms != NULL) {
         if (ms->mpm_ctx != NULL && !ms->mpm_ctx->global)
-        {
-            SCLogDebug("destroying mpm_ctx %p", ms->mpm_ctx);
-            mpm_table[ms->mpm_ctx->mpm_type].DestroyCtx(ms->mpm_ctx);
-            SCFree(ms->mpm_ctx);
-        }
+            MpmStoreDestroyCtx(ms->mpm_ctx);
         ms->mpm_ctx = NULL;
 
         SCFree(ms->sid_array);
@@ -867,13 +1096,479 @@ void MpmStoreFree(DetectEngineCtx *de_ctx)
     return;
 }
 
-void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
+/** \internal
+ *  \brief get the content a sig adds to the mpm of a store
+ *
+ *  \retval cd the mpm content or NULL if the sig adds no pattern
+ */
+static const DetectContentData *MpmStoreGetSigContent(const MpmStore *ms,
+                                                      const Signature *s)
+{
+    if (s == NULL)
+        return NULL;
+    if (s->mpm_sm == NULL)
+        return NULL;
+    int list = SigMatchListSMBelongsTo(s, s->mpm_sm);
+    if (list < 0)
+        return NULL;
+    if (list != ms->sm_list)
+        return NULL;
+    if ((s->flags & ms->direction) == 0)
+        return NULL;
+
+    const DetectContentData *cd = (DetectContentData *)s->mpm_sm->ctx;
+
+    /* negated logic: if mpm match can't be used to be sure about this
+     * pattern, we have to inspect the rule fully regardless of mpm
+     * match. So in this case there is no point of adding it at all.
+     * The non-mpm list entry for the sig will make sure the sig is
+     * inspected. */
+    if ((cd->flags & DETECT_CONTENT_NEGATED) &&
+        !(DETECT_CONTENT_MPM_IS_CONCLUSIVE(cd)))
+    {
+        SCLogDebug("not adding negated mpm as it's not 'single'");
+        return NULL;
+    }
+    return cd;
+}
+
+/** \internal
+ *  \brief pick the matcher for the mpm ctx of a store
+ *
+ *  A rule group with its own ctx and only a few patterns gets teddy
+ *  if the configured matcher is one of the AC variants: the AC state
+ *  table walk costs the same for a handful of patterns as for thousands.
+ *  Shared ctxs are prepared with the configured matcher, so they keep it.
+ */
+static uint16_t MpmStoreGetMatcher(const DetectEngineCtx *de_ctx,
+                                   const MpmStore *ms)
+{
+    if (!de_ctx->mpm_teddy)
+        return de_ctx->mpm_matcher;
+    if (ms->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT)
+        return de_ctx->mpm_matcher;
+    if (de_ctx->mpm_matcher != MPM_AC && de_ctx->mpm_matcher != MPM_AC_BS &&
+        de_ctx->mpm_matcher != MPM_AC_TILE &&
+        de_ctx->mpm_matcher != MPM_AC_COMPACT)
+        return de_ctx->mpm_matcher;
+
+    /* sigs, not unique patterns, so this may overestimate */
+    uint32_t cnt = 0;
+    uint16_t minlen = 0;
+    uint32_t sig;
+    for (sig = 0; sig < (ms->sid_array_size * 8); sig++) {
+        if (ms->sid_array[sig / 8] & (1 << (sig % 8))) {
+            const DetectContentData *cd =
+                MpmStoreGetSigContent(ms, de_ctx->sig_array[sig]);
+            if (cd == NULL)
+                continue;
+
+            uint16_t len = (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP) ?
+                cd->fp_chop_len : cd->content_len;
+            if (minlen == 0 || len < minlen)
+                minlen = len;
+            if (++cnt > TEDDY_MAX_PATTERNS)
+                return de_ctx->mpm_matcher;
+        }
+    }
+
+    if (cnt == 0 || minlen < TEDDY_MIN_PATTERN_LEN)
+        return de_ctx->mpm_matcher;
+
+    SCLogDebug("using teddy for %u patterns, minlen %u", cnt, minlen);
+    return MPM_TEDDY;
+}
+
+/** \internal
+ *  \brief get the next sig of a store that adds a pattern to its mpm
+ *
+ *  \param sig in: first sig num to look at, out: num of the sig found
+ *
+ *  \retval cd the mpm content of sig or NULL if there are no more
+ */
+static const DetectContentData *MpmStoreNextSigContent(const DetectEngineCtx *de_ctx,
+                                                       const MpmStore *ms,
+                                                       uint32_t *sig)
+{
+    for ( ; *sig < (ms->sid_array_size * 8); (*sig)++) {
+        if (ms->sid_array[*sig / 8] & (1 << (*sig % 8))) {
+            const DetectContentData *cd =
+                MpmStoreGetSigContent(ms, de_ctx->sig_array[*sig]);
+            if (cd != NULL)
+                return cd;
+        }
+    }
+    return NULL;
+}
+
+static inline uint32_t MpmStoreHashBytes(uint32_t hash, const uint8_t *buf,
+                                         uint32_t len)
+{
+    uint32_t u;
+    for (u = 0; u < len; u++) {
+        hash ^= buf[u];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+#define MPM_STORE_HASH_VAL(hash, v) \
+    (hash) = MpmStoreHashBytes((hash), (const uint8_t *)&(v), sizeof((v)))
+
+/** \internal
+ *  \brief fingerprint of the pattern set of a store's mpm ctx
+ *
+ *  Covers the sigs by gid/sid/rev, in sig num order, and the pattern each
+ *  adds. Not the sig nums themselves: a rule added or removed elsewhere in
+ *  the ruleset renumbers all sigs after it. So a store from another detect
+ *  engine with the same fingerprint is likely, but not certainly, to have
+ *  an identical ctx. MpmStoreIdentical checks.
+ */
+static uint32_t MpmStoreFingerprint(const DetectEngineCtx *de_ctx,
+                                    const MpmStore *ms, uint16_t matcher)
+{
+    uint32_t hash = 2166136261U;
+    MPM_STORE_HASH_VAL(hash, matcher);
+    MPM_STORE_HASH_VAL(hash, ms->buffer);
+    MPM_STORE_HASH_VAL(hash, ms->direction);
+    MPM_STORE_HASH_VAL(hash, ms->sm_list);
+
+    const DetectContentData *cd;
+    uint32_t sig = 0;
+    while ((cd = MpmStoreNextSigContent(de_ctx, ms, &sig)) != NULL) {
+        const Signature *s = de_ctx->sig_array[sig];
+        MPM_STORE_HASH_VAL(hash, s->gid);
+        MPM_STORE_HASH_VAL(hash, s->id);
+        MPM_STORE_HASH_VAL(hash, s->rev);
+        hash = MpmStoreHashBytes(hash, cd->content, cd->content_len);
+        sig++;
+    }
+    return hash;
+}
+
+#undef MPM_STORE_HASH_VAL
+
+#define MPM_STORE_CONTENT_FLAGS \
+    (DETECT_CONTENT_NOCASE|DETECT_CONTENT_FAST_PATTERN_CHOP)
+
+/** \internal
+ *  \brief check if two stores of different detect engines add the exact
+ *         same patterns for the same sigs to their mpm ctxs
+ *
+ *  \param same_nums out: 1 if the sigs have the same nums in both engines
+ */
+static int MpmStoreIdentical(const DetectEngineCtx *de_ctx, const MpmStore *ms,
+                             const DetectEngineCtx *old_de_ctx, const MpmStore *old,
+                             int *same_nums)
+{
+    if (ms->buffer != old->buffer || ms->direction != old->direction ||
+        ms->sm_list != old->sm_list)
+        return 0;
+
+    *same_nums = 1;
+
+    uint32_t sig = 0, old_sig = 0;
+    while (1) {
+        const DetectContentData *cd = MpmStoreNextSigContent(de_ctx, ms, &sig);
+        const DetectContentData *old_cd =
+            MpmStoreNextSigContent(old_de_ctx, old, &old_sig);
+        if (cd == NULL || old_cd == NULL)
+            return (cd == old_cd);
+
+        const Signature *s = de_ctx->sig_array[sig];
+        const Signature *old_s = old_de_ctx->sig_array[old_sig];
+        if (s->gid != old_s->gid || s->id != old_s->id || s->rev != old_s->rev)
+            return 0;
+        if (cd->content_len != old_cd->content_len ||
+            cd->offset != old_cd->offset || cd->depth != old_cd->depth ||
+            (cd->flags & MPM_STORE_CONTENT_FLAGS) !=
+                (old_cd->flags & MPM_STORE_CONTENT_FLAGS))
+            return 0;
+        if ((cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP) &&
+            (cd->fp_chop_offset != old_cd->fp_chop_offset ||
+             cd->fp_chop_len != old_cd->fp_chop_len))
+            return 0;
+        if (memcmp(cd->content, old_cd->content, cd->content_len) != 0)
+            return 0;
+
+        if (sig != old_sig)
+            *same_nums = 0;
+        sig++;
+        old_sig++;
+    }
+}
+
+#undef MPM_STORE_CONTENT_FLAGS
+
+static int MpmStoreSigCompare(const void *a, const void *b)
+{
+    const Signature *s1 = *(const Signature **)a;
+    const Signature *s2 = *(const Signature **)b;
+
+    if (s1->gid != s2->gid)
+        return (s1->gid < s2->gid) ? -1 : 1;
+    if (s1->id != s2->id)
+        return (s1->id < s2->id) ? -1 : 1;
+    if (s1->rev != s2->rev)
+        return (s1->rev < s2->rev) ? -1 : 1;
+    /* the two sigs of a bidirectional rule */
+    if (s1->num != s2->num)
+        return (s1->num < s2->num) ? -1 : 1;
+    return 0;
+}
+
+static uint32_t MpmStoreSortedSigs(const DetectEngineCtx *de_ctx,
+                                   const Signature **sigs)
+{
+    uint32_t cnt = 0;
+    uint32_t u;
+    for (u = 0; u < de_ctx->sig_array_len; u++) {
+        if (de_ctx->sig_array[u] != NULL)
+            sigs[cnt++] = de_ctx->sig_array[u];
+    }
+    qsort(sigs, cnt, sizeof(Signature *), MpmStoreSigCompare);
+    return cnt;
+}
+
+/** \internal
+ *  \brief get the map of the sig nums of the detect engine we're
+ *         replacing to ours, matching the sigs by gid/sid/rev
+ */
+static const SigIntId *MpmStoreReuseNums(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->mpm_reuse_nums != NULL)
+        return de_ctx->mpm_reuse_nums;
+
+    const DetectEngineCtx *old_de_ctx = de_ctx->reload_de_ctx;
+    const Signature **sigs = SCMalloc(de_ctx->sig_array_len * sizeof(Signature *));
+    const Signature **old_sigs = SCMalloc(old_de_ctx->sig_array_len * sizeof(Signature *));
+    SigIntId *nums = SCMalloc(old_de_ctx->sig_array_len * sizeof(SigIntId));
+    if (sigs == NULL || old_sigs == NULL || nums == NULL) {
+        SCFree(sigs);
+        SCFree(old_sigs);
+        SCFree(nums);
+        return NULL;
+    }
+
+    uint32_t u;
+    for (u = 0; u < old_de_ctx->sig_array_len; u++)
+        nums[u] = MPM_STORE_NO_NUM;
+
+    uint32_t cnt = MpmStoreSortedSigs(de_ctx, sigs);
+    uint32_t old_cnt = MpmStoreSortedSigs(old_de_ctx, old_sigs);
+    uint32_t i = 0, j = 0;
+    while (i < cnt && j < old_cnt) {
+        const Signature *s = sigs[i];
+        const Signature *old_s = old_sigs[j];
+        if (s->gid == old_s->gid && s->id == old_s->id && s->rev == old_s->rev) {
+            nums[old_s->num] = s->num;
+            i++;
+            j++;
+        } else if (MpmStoreSigCompare(&s, &old_s) < 0) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+
+    SCFree(sigs);
+    SCFree(old_sigs);
+    de_ctx->mpm_reuse_nums = nums;
+    return nums;
+}
+
+/** \internal
+ *  \brief get the map to our sig nums for the old ctxs with sid_map src
+ */
+static MpmStoreSidMap *MpmStoreReuseGetSidMap(DetectEngineCtx *de_ctx,
+                                              const SigIntId *src)
+{
+    MpmStoreSidMap *map;
+    for (map = de_ctx->mpm_reuse_maps; map != NULL; map = map->next) {
+        if (map->src == src)
+            return map;
+    }
+
+    const SigIntId *nums = MpmStoreReuseNums(de_ctx);
+    if (nums == NULL)
+        return NULL;
+
+    const uint32_t old_len = de_ctx->reload_de_ctx->sig_array_len;
+    const uint32_t size = (src != NULL) ? MpmStoreSidMapGet(src)->size : old_len;
+    map = SCMalloc(sizeof(MpmStoreSidMap) + size * sizeof(SigIntId));
+    if (unlikely(map == NULL))
+        return NULL;
+
+    uint32_t u;
+    for (u = 0; u < size; u++) {
+        const SigIntId old_num = (src != NULL) ? src[u] : u;
+        map->nums[u] = (old_num < old_len) ? nums[old_num] : MPM_STORE_NO_NUM;
+    }
+    /* the reference of the reuse setup, dropped in MpmStoreReuseFree */
+    map->refcnt = 1;
+    map->size = size;
+    map->src = src;
+    map->next = de_ctx->mpm_reuse_maps;
+    de_ctx->mpm_reuse_maps = map;
+    return map;
+}
+
+/** \internal
+ *  \brief take over the mpm ctx of an identical store of the detect
+ *         engine we're replacing
+ *
+ *  If the sigs of the store have other nums in our detect engine, we get
+ *  a ctx of our own that shares the prepared matcher ctx and translates
+ *  its sig nums.
+ *
+ *  \retval 1 ctx reused
+ *  \retval 0 no identical store, ctx needs to be prepared
+ */
+static int MpmStoreReuse(DetectEngineCtx *de_ctx, MpmStore *ms, uint16_t matcher)
+{
+    if (de_ctx->mpm_reuse_table == NULL)
+        return 0;
+
+    MpmStore *old = HashListTableLookup(de_ctx->mpm_reuse_table, ms, 0);
+    if (old == NULL || old->mpm_ctx == NULL)
+        return 0;
+    if (old->mpm_ctx->mpm_type != matcher)
+        return 0;
+    int same_nums = 0;
+    if (!MpmStoreIdentical(de_ctx, ms, de_ctx->reload_de_ctx, old, &same_nums))
+        return 0;
+
+    if (same_nums) {
+        SCMutexLock(&mpm_store_reuse_lock);
+        old->mpm_ctx->refcnt++;
+        SCMutexUnlock(&mpm_store_reuse_lock);
+
+        ms->mpm_ctx = old->mpm_ctx;
+    } else {
+        MpmStoreSidMap *map = MpmStoreReuseGetSidMap(de_ctx, old->mpm_ctx->sid_map);
+        if (map == NULL)
+            return 0;
+        MpmCtx *mpm_ctx = SCMalloc(sizeof(MpmCtx));
+        if (unlikely(mpm_ctx == NULL))
+            return 0;
+
+        MpmCtx *owner = (old->mpm_ctx->owner != NULL) ?
+            old->mpm_ctx->owner : old->mpm_ctx;
+        SCMutexLock(&mpm_store_reuse_lock);
+        *mpm_ctx = *owner;
+        owner->refcnt++;
+        map->refcnt++;
+        SCMutexUnlock(&mpm_store_reuse_lock);
+
+        mpm_ctx->owner = owner;
+        mpm_ctx->sid_map = map->nums;
+        mpm_ctx->refcnt = 1;
+        mpm_ctx->init_hash = NULL;
+        ms->mpm_ctx = mpm_ctx;
+    }
+
+    SCLogDebug("reusing mpm_ctx %p with %u patterns, sig nums %s", ms->mpm_ctx,
+            ms->mpm_ctx->pattern_cnt, same_nums ? "unchanged" : "remapped");
+    de_ctx->mpm_reused++;
+    return 1;
+}
+
+static uint32_t MpmStoreReuseHashFunc(HashListTable *ht, void *data, uint16_t datalen)
+{
+    const MpmStore *ms = (MpmStore *)data;
+    return ms->fingerprint % ht->array_size;
+}
+
+static char MpmStoreReuseCompareFunc(void *data1, uint16_t len1, void *data2,
+                                     uint16_t len2)
+{
+    const MpmStore *ms1 = (MpmStore *)data1;
+    const MpmStore *ms2 = (MpmStore *)data2;
+    return (ms1->fingerprint == ms2->fingerprint);
+}
+
+/**
+ * \brief Setup reuse of the unchanged mpm ctxs of the detect engine a
+ *        reload replaces
+ *
+ * The stores with a unique (prepared) mpm ctx of old_de_ctx are indexed
+ * by fingerprint. MpmStoreSetup then takes over the ctx of an identical
+ * store instead of building it again, also if rules added or removed
+ * elsewhere gave its sigs other nums. Shared ctxs ("single" profile) are
+ * always rebuilt. old_de_ctx needs to be kept alive until
+ * MpmStoreReuseFree is called.
+ *
+ * \param de_ctx the new detection engine context, before SigGroupBuild
+ * \param old_de_ctx the detection engine context that is replaced
+ */
+void MpmStoreReuseSetup(DetectEngineCtx *de_ctx, DetectEngineCtx *old_de_ctx)
+{
+    if (old_de_ctx == NULL || old_de_ctx->minimal ||
+        old_de_ctx->mpm_hash_table == NULL)
+        return;
+    if (old_de_ctx->mpm_matcher != de_ctx->mpm_matcher ||
+        old_de_ctx->mpm_teddy != de_ctx->mpm_teddy)
+        return;
+
+    de_ctx->mpm_reuse_table = HashListTableInit(4096,
+            MpmStoreReuseHashFunc, MpmStoreReuseCompareFunc, NULL);
+    if (de_ctx->mpm_reuse_table == NULL)
+        return;
+
+    HashListTableBucket *htb = NULL;
+    for (htb = HashListTableGetListHead(old_de_ctx->mpm_hash_table);
+            htb != NULL;
+            htb = HashListTableGetListNext(htb))
+    {
+        MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms == NULL || ms->mpm_ctx == NULL)
+            continue;
+        if (ms->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT)
+            continue;
+        if (HashListTableAdd(de_ctx->mpm_reuse_table, ms, 0) != 0) {
+            MpmStoreReuseFree(de_ctx);
+            return;
+        }
+    }
+    de_ctx->reload_de_ctx = old_de_ctx;
+}
+
+/**
+ * \brief Cleanup after MpmStoreReuseSetup, once the new detect engine
+ *        is built
+ */
+void MpmStoreReuseFree(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->mpm_reuse_table != NULL) {
+        HashListTableFree(de_ctx->mpm_reuse_table);
+        de_ctx->mpm_reuse_table = NULL;
+    }
+    while (de_ctx->mpm_reuse_maps != NULL) {
+        MpmStoreSidMap *map = de_ctx->mpm_reuse_maps;
+        de_ctx->mpm_reuse_maps = map->next;
+        MpmStoreSidMapRelease(map);
+    }
+    if (de_ctx->mpm_reuse_nums != NULL) {
+        SCFree(de_ctx->mpm_reuse_nums);
+        de_ctx->mpm_reuse_nums = NULL;
+    }
+    de_ctx->reload_de_ctx = NULL;
+}
+
+void MpmStoreSetup(DetectEngineCtx *de_ctx, MpmStore *ms)
 {
     const Signature *s = NULL;
     uint32_t sig;
 
     int dir = 0;
 
+    uint16_t matcher = MpmStoreGetMatcher(de_ctx, ms);
+    if (ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
+        ms->fingerprint = MpmStoreFingerprint(de_ctx, ms, matcher);
+        if (MpmStoreReuse(de_ctx, ms, matcher) == 1)
+            return;
+    }
+
     if (ms->buffer != MPMB_MAX) {
         BUG_ON(ms->sm_list != DETECT_SM_LIST_PMATCH);
 
@@ -909,45 +1604,20 @@ void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
     if (ms->mpm_ctx == NULL)
         return;
 
-    MpmInitCtx(ms->mpm_ctx, de_ctx->mpm_matcher);
+    MpmInitCtx(ms->mpm_ctx, matcher);
 
     /* add the patterns */
     for (sig = 0; sig < (ms->sid_array_size * 8); sig++) {
         if (ms->sid_array[sig / 8] & (1 << (sig % 8))) {
             s = de_ctx->sig_array[sig];
-            if (s == NULL)
-                continue;
-            if (s->mpm_sm == NULL)
-                continue;
-            int list = SigMatchListSMBelongsTo(s, s->mpm_sm);
-            if (list < 0)
-                continue;
-            if (list != ms->sm_list)
-                continue;
-            if ((s->flags & ms->direction) == 0)
+            const DetectContentData *cd = MpmStoreGetSigContent(ms, s);
+            if (cd == NULL)
                 continue;
 
             SCLogDebug("adding %u", s->id);
 
-            const DetectContentData *cd = (DetectContentData *)s->mpm_sm->ctx;
-
-            int skip = 0;
-            /* negated logic: if mpm match can't be used to be sure about this
-             * pattern, we have to inspect the rule fully regardless of mpm
-             * match. So in this case there is no point of adding it at all.
-             * The non-mpm list entry for the sig will make sure the sig is
-             * inspected. */
-            if ((cd->flags & DETECT_CONTENT_NEGATED) &&
-                !(DETECT_CONTENT_MPM_IS_CONCLUSIVE(cd)))
-            {
-                skip = 1;
-                SCLogDebug("not adding negated mpm as it's not 'single'");
-            }
-
-            if (!skip) {
-                PopulateMpmHelperAddPatternToPktCtx(ms->mpm_ctx,
-                        cd, s, 0, (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP));
-            }
+            PopulateMpmHelperAddPatternToPktCtx(ms->mpm_ctx,
+                    cd, s, 0, (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP));
         }
     }
 
@@ -956,9 +1626,9 @@ void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
         ms->mpm_ctx = NULL;
     } else {
         if (ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
-            if (mpm_table[ms->mpm_ctx->mpm_type].Prepare != NULL) {
-                mpm_table[ms->mpm_ctx->mpm_type].Prepare(ms->mpm_ctx);
-            }
+            MpmPrepareQueueAdd(de_ctx, ms->mpm_ctx, ms->mpm_ctx->mpm_type);
+            ms->mpm_ctx->refcnt = 1;
+            de_ctx->mpm_built++;
         }
     }
 }
@@ -1070,7 +1740,7 @@ MpmStore *MpmStorePrepareBuffer(DetectEngineCtx *de_ctx, SigGroupHead *sgh,
     if (cnt == 0)
         return NULL;
 
-    MpmStore lookup = { sids_array, max_sid, direction, buf, DETECT_SM_LIST_PMATCH, 0, NULL};
+    MpmStore lookup = { sids_array, max_sid, direction, buf, DETECT_SM_LIST_PMATCH, 0, 0, NULL};
 
     MpmStore *result = MpmStoreLookup(de_ctx, &lookup);
     if (result == NULL) {
@@ -1136,7 +1806,7 @@ MpmStore *MpmStorePrepareBuffer2(DetectEngineCtx *de_ctx, SigGroupHead *sgh, App
     if (cnt == 0)
         return NULL;
 
-    MpmStore lookup = { sids_array, max_sid, am->direction, MPMB_MAX, am->sm_list, 0, NULL};
+    MpmStore lookup = { sids_array, max_sid, am->direction, MPMB_MAX, am->sm_list, 0, 0, NULL};
 
     MpmStore *result = MpmStoreLookup(de_ctx, &lookup);
     if (result == NULL) {
@@ -1317,6 +1987,189 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
     return 0;
 }
 
+/** \brief http buffer that can be part of the multi buffer prefilter
+ *
+ *  Body buffers are not included: they are inspected in chunks as they
+ *  come in and have their own progress tracking.
+ */
+typedef struct HttpMultiBuffer_ {
+    int direction;              /**< SIG_FLAG_TOSERVER or SIG_FLAG_TOCLIENT */
+    uint32_t flags;             /**< SIG_GROUP_HEAD_MPM_* flag of the buffer */
+    int app_mpm_id;             /**< id of the buffer in app_mpms */
+    /** buffer is scanned if tx progress is past this, like in
+     *  DetectMpmPrefilter() */
+    int progress;
+    const uint8_t *(*GetBuffer)(DetectEngineThreadCtx *det_ctx, Flow *f,
+            HtpState *htp_state, uint8_t flags, void *txv, uint64_t idx,
+            uint32_t *buffer_len);
+} HttpMultiBuffer;
+
+/* the index in this array is the slot in the multi buffer db */
+static const HttpMultiBuffer http_multi_buffers[] = {
+    { SIG_FLAG_TOSERVER, SIG_GROUP_HEAD_MPM_URI, 0, HTP_REQUEST_LINE,
+        DetectUricontentGetMpmBuffer },
+    { SIG_FLAG_TOSERVER, SIG_GROUP_HEAD_MPM_HRUD, 1, HTP_REQUEST_LINE,
+        DetectEngineGetHttpRawUriMpmBuffer },
+    { SIG_FLAG_TOSERVER, SIG_GROUP_HEAD_MPM_HMD, 7, HTP_REQUEST_LINE,
+        DetectEngineGetHttpMethodMpmBuffer },
+    { SIG_FLAG_TOSERVER, SIG_GROUP_HEAD_MPM_HHHD, 13, HTP_REQUEST_LINE,
+        DetectEngineGetHttpHHMpmBuffer },
+    { SIG_FLAG_TOSERVER, SIG_GROUP_HEAD_MPM_HRHHD, 14, HTP_REQUEST_LINE,
+        DetectEngineGetHttpHRHMpmBuffer },
+    { SIG_FLAG_TOSERVER, SIG_GROUP_HEAD_MPM_HCD, 15, HTP_REQUEST_LINE,
+        DetectEngineGetHttpCookieMpmBuffer },
+    { SIG_FLAG_TOSERVER, SIG_GROUP_HEAD_MPM_HUAD, 4, HTP_REQUEST_LINE,
+        DetectEngineGetHttpUAMpmBuffer },
+    { SIG_FLAG_TOSERVER, SIG_GROUP_HEAD_MPM_HHD, 2, HTP_REQUEST_LINE,
+        DetectEngineGetHttpHeaderMpmBuffer },
+    { SIG_FLAG_TOSERVER, SIG_GROUP_HEAD_MPM_HRHD, 5, HTP_REQUEST_HEADERS,
+        DetectEngineGetHttpRawHeaderMpmBuffer },
+
+    { SIG_FLAG_TOCLIENT, SIG_GROUP_HEAD_MPM_HSMD, 10, HTP_RESPONSE_LINE,
+        DetectEngineGetHttpStatMsgMpmBuffer },
+    { SIG_FLAG_TOCLIENT, SIG_GROUP_HEAD_MPM_HSCD, 11, HTP_RESPONSE_LINE,
+        DetectEngineGetHttpStatCodeMpmBuffer },
+    { SIG_FLAG_TOCLIENT, SIG_GROUP_HEAD_MPM_HHD, 3, HTP_RESPONSE_LINE,
+        DetectEngineGetHttpHeaderMpmBuffer },
+    { SIG_FLAG_TOCLIENT, SIG_GROUP_HEAD_MPM_HCD, 16, HTP_RESPONSE_LINE,
+        DetectEngineGetHttpCookieMpmBuffer },
+    { SIG_FLAG_TOCLIENT, SIG_GROUP_HEAD_MPM_HRHD, 6, HTP_RESPONSE_HEADERS,
+        DetectEngineGetHttpRawHeaderMpmBuffer },
+};
+
+#define HTTP_MULTI_BUFFERS \
+    (sizeof(http_multi_buffers) / sizeof(http_multi_buffers[0]))
+
+/** \brief Build the multi buffer http prefilter for each sgh
+ *
+ *  Combines the http buffer mpm ctxs of each sgh into one Hyperscan db
+ *  that scans all of a tx's buffers in one pass. Needs to run after all
+ *  mpm ctxs are prepared. Sgh's with less than two http buffers are left
+ *  alone.
+ */
+void DetectMpmPrepareHttpMultiBuffer(DetectEngineCtx *de_ctx)
+{
+    if (!de_ctx->mpm_http_multi_buffer)
+        return;
+
+#ifdef BUILD_HYPERSCAN
+    if (de_ctx->mpm_matcher != MPM_HS) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "detect.mpm.http-multi-buffer "
+                "is only supported with mpm-algo hs, ignoring");
+        return;
+    }
+
+    BUG_ON(HTTP_MULTI_BUFFERS > SCHS_MULTI_MAX_SLOTS);
+
+    uint32_t cnt = 0;
+    uint32_t idx;
+    for (idx = 0; idx < de_ctx->sgh_array_cnt; idx++) {
+        SigGroupHead *sgh = de_ctx->sgh_array[idx];
+        if (sgh == NULL || sgh->init == NULL)
+            continue;
+        if (!(SGH_PROTO(sgh, IPPROTO_TCP)))
+            continue;
+
+        const MpmCtx *mpm_ctxs[HTTP_MULTI_BUFFERS];
+        uint32_t flags = 0;
+        uint32_t i;
+        for (i = 0; i < HTTP_MULTI_BUFFERS; i++) {
+            const HttpMultiBuffer *hb = &http_multi_buffers[i];
+
+            mpm_ctxs[i] = NULL;
+            if (!(sgh->init->direction & hb->direction))
+                continue;
+            if (!(sgh->flags & hb->flags))
+                continue;
+
+            mpm_ctxs[i] = sgh->init->app_mpms[hb->app_mpm_id];
+            if (mpm_ctxs[i] != NULL)
+                flags |= hb->flags;
+        }
+
+        sgh->mpm_http_multi_db = SCHSMultiBuild(mpm_ctxs, HTTP_MULTI_BUFFERS);
+        if (sgh->mpm_http_multi_db == NULL)
+            continue;
+
+        sgh->mpm_http_multi_flags = flags;
+        sgh->flags &= ~flags;
+        sgh->flags |= SIG_GROUP_HEAD_MPM_HTTP_MULTI;
+        cnt++;
+    }
+
+    if (!(de_ctx->flags & DE_QUIET)) {
+        SCLogPerf("http multi buffer prefilter for %u rule groups", cnt);
+    }
+#else
+    SCLogWarning(SC_ERR_INVALID_VALUE, "detect.mpm.http-multi-buffer "
+            "needs Hyperscan support, ignoring");
+#endif
+}
+
+void DetectMpmHttpMultiBufferFree(SigGroupHead *sgh)
+{
+#ifdef BUILD_HYPERSCAN
+    if (sgh->mpm_http_multi_db != NULL) {
+        SCHSMultiFree(sgh->mpm_http_multi_db);
+        sgh->mpm_http_multi_db = NULL;
+    }
+#endif
+}
+
+/** \brief run the multi buffer prefilter on all available http buffers
+ *         of a tx
+ *
+ *  \param tx_progress progress of the tx in the direction of flags
+ *
+ *  \retval cnt number of pattern matches
+ */
+uint32_t DetectEngineRunHttpMultiBufferMpm(DetectEngineThreadCtx *det_ctx,
+        Flow *f, HtpState *htp_state, uint8_t flags, void *tx, uint64_t idx,
+        int tx_progress)
+{
+#ifdef BUILD_HYPERSCAN
+    const SigGroupHead *sgh = det_ctx->sgh;
+    const int direction = (flags & STREAM_TOSERVER) ?
+        SIG_FLAG_TOSERVER : SIG_FLAG_TOCLIENT;
+
+    DEBUG_VALIDATE_BUG_ON(sgh->mpm_http_multi_db == NULL);
+
+    const uint8_t *bufs[HTTP_MULTI_BUFFERS];
+    uint32_t buflens[HTTP_MULTI_BUFFERS];
+    uint8_t slots[HTTP_MULTI_BUFFERS];
+    uint32_t cnt = 0;
+
+    uint32_t i;
+    for (i = 0; i < HTTP_MULTI_BUFFERS; i++) {
+        const HttpMultiBuffer *hb = &http_multi_buffers[i];
+        if (hb->direction != direction ||
+            !(sgh->mpm_http_multi_flags & hb->flags))
+            continue;
+        if (tx_progress <= hb->progress)
+            continue;
+
+        uint32_t buffer_len = 0;
+        const uint8_t *buffer = hb->GetBuffer(det_ctx, f, htp_state, flags,
+                                              tx, idx, &buffer_len);
+        if (buffer == NULL || buffer_len == 0)
+            continue;
+
+        bufs[cnt] = buffer;
+        buflens[cnt] = buffer_len;
+        slots[cnt] = (uint8_t)i;
+        cnt++;
+    }
+
+    if (cnt == 0)
+        return 0;
+
+    return SCHSMultiSearch(sgh->mpm_http_multi_db, &det_ctx->mtcu,
+                           &det_ctx->pmq, bufs, buflens, slots, cnt);
+#else
+    return 0;
+#endif
+}
+
 typedef struct DetectFPAndItsId_ {
     PatIntId id;
     uint16_t content_len;
@@ -55,6 +55,13 @@ void PatternMatchThreadDestroy(MpmThreadCtx *mpm_thread_ctx, uint16_t);
 void PatternMatchThreadPrint(MpmThreadCtx *, uint16_t);
 
 int PatternMatchPrepareGroup(DetectEngineCtx *, SigGroupHead *);
+
+void DetectMpmPrepareHttpMultiBuffer(DetectEngineCtx *de_ctx);
+void DetectMpmPrepareQueued(DetectEngineCtx *de_ctx);
+void DetectMpmHttpMultiBufferFree(SigGroupHead *sgh);
+uint32_t DetectEngineRunHttpMultiBufferMpm(DetectEngineThreadCtx *det_ctx,
+        Flow *f, HtpState *htp_state, uint8_t flags, void *tx, uint64_t idx,
+        int tx_progress);
 void DetectEngineThreadCtxInfo(ThreadVars *, DetectEngineThreadCtx *);
 
 TmEcode DetectEngineThreadCtxInit(ThreadVars *, void *, void **);
@@ -67,9 +74,14 @@ int SignatureHasStreamContent(const Signature *);
 
 void RetrieveFPForSig(Signature *s);
 
+/** upper limit for detect.mpm.build-threads */
+#define MPM_BUILD_THREADS_MAX   64
+
 int MpmStoreInit(DetectEngineCtx *);
 void MpmStoreFree(DetectEngineCtx *);
 void MpmStoreReportStats(const DetectEngineCtx *de_ctx);
+void MpmStoreReuseSetup(DetectEngineCtx *de_ctx, DetectEngineCtx *old_de_ctx);
+void MpmStoreReuseFree(DetectEngineCtx *de_ctx);
 MpmStore *MpmStorePrepareBuffer(DetectEngineCtx *de_ctx, SigGroupHead *sgh, enum MpmBuiltinBuffers buf);
 
 /**
@@ -91,22 +91,39 @@ static inline uint32_t UriPatternSearch(DetectEngineThreadCtx *det_ctx,
  *  \warning Make sure the flow/state is locked
  *  \todo what should we return? Just the fact that we matched?
  */
+/**
+ * \brief Get the http_uri buffer the mpm runs on.
+ *
+ * \retval buffer or NULL if not available, length in buffer_len
+ */
+const uint8_t *DetectUricontentGetMpmBuffer(
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state,
+        uint8_t flags, void *txv, uint64_t idx, uint32_t *buffer_len)
+{
+    htp_tx_t *tx = (htp_tx_t *)txv;
+    HtpTxUserData *tx_ud = htp_tx_get_user_data(tx);
+
+    if (tx_ud == NULL || tx_ud->request_uri_normalized == NULL)
+        return NULL;
+
+    *buffer_len = bstr_len(tx_ud->request_uri_normalized);
+    return (const uint8_t *)bstr_ptr(tx_ud->request_uri_normalized);
+}
+
 uint32_t DetectUricontentInspectMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                     HtpState *htp_state, uint8_t flags,
                                     void *txv, uint64_t idx)
 {
     SCEnter();
 
-    htp_tx_t *tx = (htp_tx_t *)txv;
-    HtpTxUserData *tx_ud = htp_tx_get_user_data(tx);
     uint32_t cnt = 0;
-
-    if (tx_ud == NULL || tx_ud->request_uri_normalized == NULL)
+    uint32_t buffer_len = 0;
+    const uint8_t *buffer = DetectUricontentGetMpmBuffer(det_ctx, f,
+            htp_state, flags, txv, idx, &buffer_len);
+    if (buffer == NULL)
         goto end;
-    cnt = UriPatternSearch(det_ctx, (const uint8_t *)
-                           bstr_ptr(tx_ud->request_uri_normalized),
-                           bstr_len(tx_ud->request_uri_normalized),
-                           flags);
+
+    cnt = UriPatternSearch(det_ctx, buffer, buffer_len, flags);
 
 end:
     SCReturnUInt(cnt);
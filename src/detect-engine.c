@@ -72,6 +72,7 @@
 #include "detect-content.h"
 #include "detect-uricontent.h"
 #include "detect-engine-threshold.h"
+#include "detect-engine-alert.h"
 
 #include "detect-engine-loader.h"
 
@@ -81,8 +82,10 @@
 #include "util-error.h"
 #include "util-hash.h"
 #include "util-byte.h"
+#include "util-cpu.h"
 #include "util-debug.h"
 #include "util-unittest.h"
+#include "util-unittest-helper.h"
 #include "util-action.h"
 #include "util-magic.h"
 #include "util-signal.h"
@@ -942,7 +945,10 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx)
      * to be sure look at them again here.
      */
     SigGroupHeadHashFree(de_ctx);
+    MpmStoreReuseFree(de_ctx);
     MpmStoreFree(de_ctx);
+    if (de_ctx->mpm_prepare_queue != NULL)
+        SCFree(de_ctx->mpm_prepare_queue);
     DetectParseDupSigHashFree(de_ctx);
     SCSigSignatureOrderingModuleCleanup(de_ctx);
     ThresholdContextDestroy(de_ctx);
@@ -1211,6 +1217,30 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
     if (de_ctx->inspection_recursion_limit == 0)
         de_ctx->inspection_recursion_limit = -1;
 
+    int http_multi_buffer = 0;
+    if (ConfGetBool("detect.mpm.http-multi-buffer", &http_multi_buffer) == 1)
+        de_ctx->mpm_http_multi_buffer = http_multi_buffer;
+
+#ifdef __SSSE3__
+    int teddy = 1;
+#else
+    /* without pshufb teddy is slower than AC */
+    int teddy = 0;
+#endif
+    (void)ConfGetBool("detect.mpm.teddy", &teddy);
+    de_ctx->mpm_teddy = teddy;
+
+    /* the mpm ctxs are independent, so they are prepared in parallel */
+    intmax_t build_threads = 0;
+    if (ConfGetInt("detect.mpm.build-threads", &build_threads) != 1 ||
+        build_threads <= 0)
+    {
+        build_threads = UtilCpuGetNumProcessorsOnline();
+    }
+    if (build_threads > MPM_BUILD_THREADS_MAX)
+        build_threads = MPM_BUILD_THREADS_MAX;
+    de_ctx->mpm_build_threads = build_threads > 0 ? (int)build_threads : 1;
+
     SCLogDebug("de_ctx->inspection_recursion_limit: %d",
                de_ctx->inspection_recursion_limit);
 
@@ -1970,10 +2000,12 @@ static int DetectEngineMultiTenantReloadTenant(uint32_t tenant_id, const char *f
     new_de_ctx->tenant_id = tenant_id;
     new_de_ctx->loader_id = old_de_ctx->loader_id;
 
+    MpmStoreReuseSetup(new_de_ctx, old_de_ctx);
     if (SigLoadSignatures(new_de_ctx, NULL, 0) < 0) {
         SCLogError(SC_ERR_NO_RULES_LOADED, "Loading signatures failed.");
         goto error;
     }
+    MpmStoreReuseFree(new_de_ctx);
 
     DetectEngineAddToMaster(new_de_ctx);
 
@@ -2536,7 +2568,37 @@ void DetectEnginePruneFreeList(void)
 
 static int reloads = 0;
 
+static SCMutex reload_stats_lock = SCMUTEX_INITIALIZER;
+static DetectEngineReloadStats reload_stats;
+
+static uint64_t ReloadTimeUsec(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void DetectEngineReloadSetStats(const DetectEngineReloadStats *stats)
+{
+    SCMutexLock(&reload_stats_lock);
+    reload_stats = *stats;
+    SCMutexUnlock(&reload_stats_lock);
+}
+
+/** \brief get the duration breakdown of the last rule reload */
+void DetectEngineReloadGetStats(DetectEngineReloadStats *stats)
+{
+    SCMutexLock(&reload_stats_lock);
+    *stats = reload_stats;
+    SCMutexUnlock(&reload_stats_lock);
+}
+
 /** \brief Reload the detection engine
+ *
+ *  Builds a new detect engine and hands it to the threads. Rule groups
+ *  whose mpm has the same patterns as in the current engine take over
+ *  the prepared mpm ctx instead of building it again, so a reload that
+ *  only changes a few rules mostly costs rule parsing and grouping.
  *
  *  \param filename YAML file to load for the detect config
  *
@@ -2547,6 +2609,12 @@ int DetectEngineReload(SCInstance *suri)
 {
     DetectEngineCtx *new_de_ctx = NULL;
     DetectEngineCtx *old_de_ctx = NULL;
+    DetectEngineReloadStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.last_reload = time(NULL);
+    stats.result = -1;
+    uint64_t start = ReloadTimeUsec();
+    uint64_t ts = start;
 
     char prefix[128];
     memset(prefix, 0, sizeof(prefix));
@@ -2558,41 +2626,50 @@ int DetectEngineReload(SCInstance *suri)
         if (ConfYamlLoadFileWithPrefix(suri->conf_filename, prefix) != 0) {
             SCLogError(SC_ERR_CONF_YAML_ERROR, "failed to load yaml %s",
                     suri->conf_filename);
-            return -1;
+            goto error;
         }
 
         ConfNode *node = ConfGetNode(prefix);
         if (node == NULL) {
             SCLogError(SC_ERR_CONF_YAML_ERROR, "failed to properly setup yaml %s",
                     suri->conf_filename);
-            return -1;
+            goto error;
         }
 #if 0
         ConfDump();
 #endif
     }
+    stats.yaml_usec = ReloadTimeUsec() - ts;
 
     /* get a reference to the current de_ctx */
     old_de_ctx = DetectEngineGetCurrent();
     if (old_de_ctx == NULL)
-        return -1;
+        goto error;
     SCLogDebug("get ref to old_de_ctx %p", old_de_ctx);
 
     /* get new detection engine */
+    ts = ReloadTimeUsec();
     new_de_ctx = DetectEngineCtxInitWithPrefix(prefix);
     if (new_de_ctx == NULL) {
         SCLogError(SC_ERR_INITIALIZATION, "initializing detection engine "
                 "context failed.");
         DetectEngineDeReference(&old_de_ctx);
-        return -1;
+        goto error;
     }
+    /* old_de_ctx is referenced, so it stays around while we build */
+    MpmStoreReuseSetup(new_de_ctx, old_de_ctx);
     if (SigLoadSignatures(new_de_ctx,
                           suri->sig_file, suri->sig_file_exclusive) != 0) {
         DetectEngineCtxFree(new_de_ctx);
         DetectEngineDeReference(&old_de_ctx);
-        return -1;
+        goto error;
     }
+    MpmStoreReuseFree(new_de_ctx);
     SCThresholdConfInitContext(new_de_ctx, NULL);
+    stats.build_usec = new_de_ctx->build_usec;
+    stats.load_usec = ReloadTimeUsec() - ts - stats.build_usec;
+    stats.mpm_reused = new_de_ctx->mpm_reused;
+    stats.mpm_built = new_de_ctx->mpm_built;
     SCLogDebug("set up new_de_ctx %p", new_de_ctx);
 
     /* add to master */
@@ -2604,16 +2681,33 @@ int DetectEngineReload(SCInstance *suri)
 
     SCLogDebug("going to reload the threads to use new_de_ctx %p", new_de_ctx);
     /* update the threads */
+    ts = ReloadTimeUsec();
     DetectEngineReloadThreads(new_de_ctx);
+    stats.swap_usec = ReloadTimeUsec() - ts;
     SCLogDebug("threads now run new_de_ctx %p", new_de_ctx);
 
     /* walk free list, freeing the old_de_ctx */
+    ts = ReloadTimeUsec();
     DetectEnginePruneFreeList();
+    stats.free_usec = ReloadTimeUsec() - ts;
 
     SCLogDebug("old_de_ctx should have been freed");
 
-    SCLogNotice("rule reload complete");
+    stats.result = 0;
+    stats.total_usec = ReloadTimeUsec() - start;
+    DetectEngineReloadSetStats(&stats);
+
+    SCLogNotice("rule reload complete in %"PRIu64" ms: load %"PRIu64" ms, "
+            "build %"PRIu64" ms (mpm: %u reused, %u built), swap %"PRIu64" ms",
+            stats.total_usec / 1000, stats.load_usec / 1000,
+            stats.build_usec / 1000, stats.mpm_reused, stats.mpm_built,
+            stats.swap_usec / 1000);
     return 0;
+
+error:
+    stats.total_usec = ReloadTimeUsec() - start;
+    DetectEngineReloadSetStats(&stats);
+    return -1;
 }
 
 static uint32_t TenantIdHash(HashTable *h, void *data, uint16_t data_len)
@@ -3299,6 +3393,138 @@ static int DetectEngineTest09(void)
     return result;
 }
 
+/** \test reload takes over the unchanged per group mpm ctxs */
+static int DetectEngineTest10(void)
+{
+    char *conf =
+        "%YAML 1.1\n"
+        "---\n"
+        "detect-engine:\n"
+        "  - sgh-mpm-context: full\n";
+    char *sigs[] = {
+        "alert tcp any any -> any 80 (content:\"one\"; sid:1;)",
+        "alert tcp any any -> any 80 (content:\"two\"; sid:2;)",
+        "alert udp any any -> any 53 (content:\"three\"; sid:3;)",
+    };
+    DetectEngineCtx *de_ctx[3] = { NULL, NULL, NULL };
+    int i, s;
+
+    FAIL_IF(DetectEngineInitYamlConf(conf) == -1);
+
+    for (i = 0; i < 3; i++) {
+        de_ctx[i] = DetectEngineCtxInit();
+        FAIL_IF_NULL(de_ctx[i]);
+        de_ctx[i]->flags |= DE_QUIET;
+        if (i > 0)
+            MpmStoreReuseSetup(de_ctx[i], de_ctx[i - 1]);
+
+        for (s = 0; s < 3; s++) {
+            /* 3rd ctx: the 2nd rule changes */
+            char *sig = (i == 2 && s == 1) ?
+                "alert tcp any any -> any 80 (content:\"twee\"; sid:2;)" :
+                sigs[s];
+            FAIL_IF_NULL(DetectEngineAppendSig(de_ctx[i], sig));
+        }
+        FAIL_IF(SigGroupBuild(de_ctx[i]) != 0);
+        MpmStoreReuseFree(de_ctx[i]);
+    }
+
+    FAIL_IF(de_ctx[0]->mpm_built == 0);
+    FAIL_IF(de_ctx[0]->mpm_reused != 0);
+    /* identical rules: nothing is built */
+    FAIL_IF(de_ctx[1]->mpm_built != 0);
+    FAIL_IF(de_ctx[1]->mpm_reused != de_ctx[0]->mpm_built);
+    /* the tcp group is rebuilt, the udp one reused */
+    FAIL_IF(de_ctx[2]->mpm_built == 0);
+    FAIL_IF(de_ctx[2]->mpm_reused == 0);
+
+    /* free in reload order, the shared ctxs outlive the first */
+    for (i = 0; i < 3; i++)
+        DetectEngineCtxFree(de_ctx[i]);
+    DetectEngineDeInitYamlConf();
+    PASS;
+}
+
+/** \test reload takes over the per group mpm ctxs of unchanged rules
+ *        when a new rule renumbers all sigs */
+static int DetectEngineTest11(void)
+{
+    char *conf =
+        "%YAML 1.1\n"
+        "---\n"
+        "detect-engine:\n"
+        "  - sgh-mpm-context: full\n";
+    char *sigs[] = {
+        "alert tcp any any -> any 80 (content:\"one\"; sid:1;)",
+        "alert tcp any any -> any 80 (content:\"two\"; sid:2;)",
+        "alert udp any any -> any 53 (content:\"three\"; sid:3;)",
+        /* sigs are prepended, so this one ends up at the head of the
+         * sig list of the 2nd and 3rd ctx and gets num 0 */
+        "alert tcp any any -> any 8080 (content:\"four\"; sid:4;)",
+    };
+    DetectEngineCtx *de_ctx[3] = { NULL, NULL, NULL };
+    Signature *sig2[3] = { NULL, NULL, NULL };
+    uint8_t payload[] = "xxtwoxx";
+    ThreadVars tv;
+    int i, s;
+
+    memset(&tv, 0, sizeof(tv));
+    FAIL_IF(DetectEngineInitYamlConf(conf) == -1);
+
+    for (i = 0; i < 3; i++) {
+        de_ctx[i] = DetectEngineCtxInit();
+        FAIL_IF_NULL(de_ctx[i]);
+        de_ctx[i]->flags |= DE_QUIET;
+        if (i > 0)
+            MpmStoreReuseSetup(de_ctx[i], de_ctx[i - 1]);
+
+        for (s = 0; s < (i == 0 ? 3 : 4); s++) {
+            Signature *sig = DetectEngineAppendSig(de_ctx[i], sigs[s]);
+            FAIL_IF_NULL(sig);
+            if (s == 1)
+                sig2[i] = sig;
+        }
+        FAIL_IF(SigGroupBuild(de_ctx[i]) != 0);
+        MpmStoreReuseFree(de_ctx[i]);
+    }
+
+    /* the 2nd ctx renumbered the sigs, but took over the ctxs of the
+     * unchanged groups */
+    FAIL_IF(sig2[1]->num == sig2[0]->num);
+    FAIL_IF(de_ctx[1]->mpm_reused == 0);
+    FAIL_IF(de_ctx[1]->mpm_built >= de_ctx[0]->mpm_built);
+    /* the 3rd takes all ctxs over from the 2nd, nums are unchanged */
+    FAIL_IF(sig2[2]->num != sig2[1]->num);
+    FAIL_IF(de_ctx[2]->mpm_built != 0);
+    FAIL_IF(de_ctx[2]->mpm_reused != de_ctx[1]->mpm_reused + de_ctx[1]->mpm_built);
+
+    /* the first ctx is gone, the reused mpm ctxs have to keep matching
+     * with the sig nums of the engine they are used by */
+    DetectEngineCtxFree(de_ctx[0]);
+    de_ctx[0] = NULL;
+
+    for (i = 1; i < 3; i++) {
+        DetectEngineThreadCtx *det_ctx = NULL;
+        Packet *p = UTHBuildPacketReal(payload, sizeof(payload) - 1,
+                IPPROTO_TCP, "1.2.3.4", "5.6.7.8", 41424, 80);
+        FAIL_IF_NULL(p);
+        DetectEngineThreadCtxInit(&tv, (void *)de_ctx[i], (void *)&det_ctx);
+        FAIL_IF_NULL(det_ctx);
+
+        SigMatchSignatures(&tv, de_ctx[i], det_ctx, p);
+        FAIL_IF(PacketAlertCheck(p, 2) != 1);
+        FAIL_IF(PacketAlertCheck(p, 1) != 0);
+
+        DetectEngineThreadCtxDeinit(&tv, (void *)det_ctx);
+        UTHFreePacket(p);
+    }
+
+    for (i = 1; i < 3; i++)
+        DetectEngineCtxFree(de_ctx[i]);
+    DetectEngineDeInitYamlConf();
+    PASS;
+}
+
 #endif
 
 void DetectEngineRegisterTests()
@@ -3314,6 +3540,8 @@ void DetectEngineRegisterTests()
     UtRegisterTest("DetectEngineTest07", DetectEngineTest07);
     UtRegisterTest("DetectEngineTest08", DetectEngineTest08);
     UtRegisterTest("DetectEngineTest09", DetectEngineTest09);
+    UtRegisterTest("DetectEngineTest10", DetectEngineTest10);
+    UtRegisterTest("DetectEngineTest11", DetectEngineTest11);
 #endif
 
     return;
@@ -75,7 +75,22 @@ void DetectEnginePruneFreeList(void);
 int DetectEngineMoveToFreeList(DetectEngineCtx *de_ctx);
 DetectEngineCtx *DetectEngineReference(DetectEngineCtx *);
 void DetectEngineDeReference(DetectEngineCtx **de_ctx);
+/** duration breakdown of the last rule reload */
+typedef struct DetectEngineReloadStats_ {
+    time_t last_reload;     /**< wall clock time of the last reload, 0 if none */
+    int result;             /**< 0 success, -1 failure */
+    uint64_t yaml_usec;     /**< reading the yaml */
+    uint64_t load_usec;     /**< parsing and ordering the rules */
+    uint64_t build_usec;    /**< rule grouping and mpm preparation */
+    uint64_t swap_usec;     /**< handing the new engine to the threads */
+    uint64_t free_usec;     /**< freeing the old engine */
+    uint64_t total_usec;
+    uint32_t mpm_reused;    /**< mpm ctxs taken over from the old engine */
+    uint32_t mpm_built;     /**< mpm ctxs prepared from scratch */
+} DetectEngineReloadStats;
+
 int DetectEngineReload(SCInstance *suri);
+void DetectEngineReloadGetStats(DetectEngineReloadStats *stats);
 int DetectEngineEnabled(void);
 int DetectEngineMTApply(void);
 int DetectEngineMultiTenantEnabled(void);
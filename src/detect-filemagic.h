@@ -42,5 +42,6 @@ typedef struct DetectFilemagicData {
 /* prototypes */
 void DetectFilemagicRegister (void);
 int FilemagicGlobalLookup(File *file);
+int FilemagicThreadLookup(magic_t *, File *);
 
 #endif /* __DETECT_FILEMAGIC_H__ */
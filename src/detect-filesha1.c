@@ -0,0 +1,167 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author Victor Julien <victor@inliniac.net>
+ *
+ * Implements the filesha1 keyword
+ */
+
+#include "suricata-common.h"
+#include "threads.h"
+#include "debug.h"
+#include "decode.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+
+#include "detect-engine.h"
+#include "detect-engine-mpm.h"
+#include "detect-engine-state.h"
+
+#include "flow.h"
+#include "flow-var.h"
+#include "flow-util.h"
+
+#include "util-debug.h"
+#include "util-spm-bm.h"
+#include "util-print.h"
+
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#include "app-layer.h"
+
+#include "stream-tcp.h"
+
+#include "detect-file-hash-common.h"
+#include "detect-filesha1.h"
+
+#include "queue.h"
+#include "util-rohash.h"
+
+#ifndef HAVE_NSS
+
+static int DetectFileSha1SetupNoSupport (DetectEngineCtx *a, Signature *b, char *c)
+{
+    SCLogError(SC_ERR_NO_SHA1_SUPPORT, "no SHA1 calculation support built in, needed for filesha1 keyword");
+    return -1;
+}
+
+/**
+ * \brief Registration function for keyword: filesha1
+ */
+void DetectFileSha1Register(void)
+{
+    sigmatch_table[DETECT_FILESHA1].name = "filesha1";
+    sigmatch_table[DETECT_FILESHA1].FileMatch = NULL;
+    sigmatch_table[DETECT_FILESHA1].Setup = DetectFileSha1SetupNoSupport;
+    sigmatch_table[DETECT_FILESHA1].Free  = NULL;
+    sigmatch_table[DETECT_FILESHA1].RegisterTests = NULL;
+    sigmatch_table[DETECT_FILESHA1].flags = SIGMATCH_NOT_BUILT;
+
+    SCLogDebug("registering filesha1 rule option");
+    return;
+}
+
+#else /* HAVE_NSS */
+
+static int DetectFileSha1Setup (DetectEngineCtx *, Signature *, char *);
+static void DetectFileSha1RegisterTests(void);
+
+/**
+ * \brief Registration function for keyword: filesha1
+ */
+void DetectFileSha1Register(void)
+{
+    sigmatch_table[DETECT_FILESHA1].name = "filesha1";
+    sigmatch_table[DETECT_FILESHA1].desc = "match file SHA1 against list of SHA1 checksums";
+    sigmatch_table[DETECT_FILESHA1].url = "https://redmine.openinfosecfoundation.org/projects/suricata/wiki/File-keywords#filesha1";
+    sigmatch_table[DETECT_FILESHA1].FileMatch = DetectFileHashMatch;
+    sigmatch_table[DETECT_FILESHA1].Setup = DetectFileSha1Setup;
+    sigmatch_table[DETECT_FILESHA1].Free  = DetectFileHashFree;
+    sigmatch_table[DETECT_FILESHA1].RegisterTests = DetectFileSha1RegisterTests;
+
+    SCLogDebug("registering filesha1 rule option");
+    return;
+}
+
+/**
+ * \brief this function is used to parse filesha1 options
+ * \brief into the current signature
+ *
+ * \param de_ctx pointer to the Detection Engine Context
+ * \param s pointer to the Current Signature
+ * \param str pointer to the user provided "filesha1" option
+ *
+ * \retval 0 on Success
+ * \retval -1 on Failure
+ */
+static int DetectFileSha1Setup (DetectEngineCtx *de_ctx, Signature *s, char *str)
+{
+    return DetectFileHashSetup(de_ctx, s, str, DETECT_FILESHA1, FILE_SIG_NEED_SHA1);
+}
+
+#ifdef UNITTESTS
+static int SHA1MatchLookupString(ROHashTable *hash, char *string)
+{
+    uint8_t sha1[20];
+    if (ReadHashString(sha1, string, "file", 88, 40) == 1) {
+        void *ptr = ROHashLookup(hash, &sha1, (uint16_t)sizeof(sha1));
+        if (ptr == NULL)
+            return 0;
+        else
+            return 1;
+    }
+    return 0;
+}
+
+static int SHA1MatchTest01(void)
+{
+    ROHashTable *hash = ROHashInit(4, 20);
+    FAIL_IF_NULL(hash);
+    FAIL_IF(LoadHashTable(hash, "86f7e437faa5a7fce15d1ddcb9eaeaea377667b8", "file", 1, DETECT_FILESHA1) != 1);
+    FAIL_IF(LoadHashTable(hash, "e9d71f5ee7c92d6dc9e92ffdad17b8bd49418f98", "file", 2, DETECT_FILESHA1) != 1);
+    FAIL_IF(LoadHashTable(hash, "84a516841ba77a5b4648de2cd0dfcb30ea46dbb4", "file", 3, DETECT_FILESHA1) != 1);
+    FAIL_IF(LoadHashTable(hash, "3c363836cf4e16666669a25da280a1865c2d2874", "file", 4, DETECT_FILESHA1) != 1);
+
+    FAIL_IF(ROHashInitFinalize(hash) != 1);
+
+    FAIL_IF(SHA1MatchLookupString(hash, "86f7e437faa5a7fce15d1ddcb9eaeaea377667b8") != 1);
+    FAIL_IF(SHA1MatchLookupString(hash, "e9d71f5ee7c92d6dc9e92ffdad17b8bd49418f98") != 1);
+    FAIL_IF(SHA1MatchLookupString(hash, "84a516841ba77a5b4648de2cd0dfcb30ea46dbb4") != 1);
+    FAIL_IF(SHA1MatchLookupString(hash, "3c363836cf4e16666669a25da280a1865c2d2874") != 1);
+    /* shouldnt match */
+    FAIL_IF(SHA1MatchLookupString(hash, "3333333333333333333333333333333333333333") == 1);
+    /* wrong length */
+    FAIL_IF(SHA1MatchLookupString(hash, "33333333333333333333333333333333333333") == 1);
+
+    ROHashFree(hash);
+    PASS;
+}
+#endif
+
+void DetectFileSha1RegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SHA1MatchTest01", SHA1MatchTest01);
+#endif
+}
+
+#endif /* HAVE_NSS */
@@ -0,0 +1,167 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author Victor Julien <victor@inliniac.net>
+ *
+ * Implements the filesha256 keyword
+ */
+
+#include "suricata-common.h"
+#include "threads.h"
+#include "debug.h"
+#include "decode.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+
+#include "detect-engine.h"
+#include "detect-engine-mpm.h"
+#include "detect-engine-state.h"
+
+#include "flow.h"
+#include "flow-var.h"
+#include "flow-util.h"
+
+#include "util-debug.h"
+#include "util-spm-bm.h"
+#include "util-print.h"
+
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#include "app-layer.h"
+
+#include "stream-tcp.h"
+
+#include "detect-file-hash-common.h"
+#include "detect-filesha256.h"
+
+#include "queue.h"
+#include "util-rohash.h"
+
+#ifndef HAVE_NSS
+
+static int DetectFileSha256SetupNoSupport (DetectEngineCtx *a, Signature *b, char *c)
+{
+    SCLogError(SC_ERR_NO_SHA256_SUPPORT, "no SHA256 calculation support built in, needed for filesha256 keyword");
+    return -1;
+}
+
+/**
+ * \brief Registration function for keyword: filesha256
+ */
+void DetectFileSha256Register(void)
+{
+    sigmatch_table[DETECT_FILESHA256].name = "filesha256";
+    sigmatch_table[DETECT_FILESHA256].FileMatch = NULL;
+    sigmatch_table[DETECT_FILESHA256].Setup = DetectFileSha256SetupNoSupport;
+    sigmatch_table[DETECT_FILESHA256].Free  = NULL;
+    sigmatch_table[DETECT_FILESHA256].RegisterTests = NULL;
+    sigmatch_table[DETECT_FILESHA256].flags = SIGMATCH_NOT_BUILT;
+
+    SCLogDebug("registering filesha256 rule option");
+    return;
+}
+
+#else /* HAVE_NSS */
+
+static int DetectFileSha256Setup (DetectEngineCtx *, Signature *, char *);
+static void DetectFileSha256RegisterTests(void);
+
+/**
+ * \brief Registration function for keyword: filesha256
+ */
+void DetectFileSha256Register(void)
+{
+    sigmatch_table[DETECT_FILESHA256].name = "filesha256";
+    sigmatch_table[DETECT_FILESHA256].desc = "match file SHA256 against list of SHA256 checksums";
+    sigmatch_table[DETECT_FILESHA256].url = "https://redmine.openinfosecfoundation.org/projects/suricata/wiki/File-keywords#filesha256";
+    sigmatch_table[DETECT_FILESHA256].FileMatch = DetectFileHashMatch;
+    sigmatch_table[DETECT_FILESHA256].Setup = DetectFileSha256Setup;
+    sigmatch_table[DETECT_FILESHA256].Free  = DetectFileHashFree;
+    sigmatch_table[DETECT_FILESHA256].RegisterTests = DetectFileSha256RegisterTests;
+
+    SCLogDebug("registering filesha256 rule option");
+    return;
+}
+
+/**
+ * \brief this function is used to parse filesha256 options
+ * \brief into the current signature
+ *
+ * \param de_ctx pointer to the Detection Engine Context
+ * \param s pointer to the Current Signature
+ * \param str pointer to the user provided "filesha256" option
+ *
+ * \retval 0 on Success
+ * \retval -1 on Failure
+ */
+static int DetectFileSha256Setup (DetectEngineCtx *de_ctx, Signature *s, char *str)
+{
+    return DetectFileHashSetup(de_ctx, s, str, DETECT_FILESHA256, FILE_SIG_NEED_SHA256);
+}
+
+#ifdef UNITTESTS
+static int SHA256MatchLookupString(ROHashTable *hash, char *string)
+{
+    uint8_t sha256[32];
+    if (ReadHashString(sha256, string, "file", 88, 64) == 1) {
+        void *ptr = ROHashLookup(hash, &sha256, (uint16_t)sizeof(sha256));
+        if (ptr == NULL)
+            return 0;
+        else
+            return 1;
+    }
+    return 0;
+}
+
+static int SHA256MatchTest01(void)
+{
+    ROHashTable *hash = ROHashInit(4, 32);
+    FAIL_IF_NULL(hash);
+    FAIL_IF(LoadHashTable(hash, "ca978112ca1bbdcafac231b39a23dc4da786eff8147c4e72b9807785afee48bb", "file", 1, DETECT_FILESHA256) != 1);
+    FAIL_IF(LoadHashTable(hash, "3e23e8160039594a33894f6564e1b1348bbd7a0088d42c4acb73eeaed59c009d", "file", 2, DETECT_FILESHA256) != 1);
+    FAIL_IF(LoadHashTable(hash, "2e7d2c03a9507ae265ecf5b5356885a53393a2029d241394997265a1a25aefc6", "file", 3, DETECT_FILESHA256) != 1);
+    FAIL_IF(LoadHashTable(hash, "18ac3e7343f016890c510e93f935261169d9e3f565436429830faf0934f4f8e4", "file", 4, DETECT_FILESHA256) != 1);
+
+    FAIL_IF(ROHashInitFinalize(hash) != 1);
+
+    FAIL_IF(SHA256MatchLookupString(hash, "ca978112ca1bbdcafac231b39a23dc4da786eff8147c4e72b9807785afee48bb") != 1);
+    FAIL_IF(SHA256MatchLookupString(hash, "3e23e8160039594a33894f6564e1b1348bbd7a0088d42c4acb73eeaed59c009d") != 1);
+    FAIL_IF(SHA256MatchLookupString(hash, "2e7d2c03a9507ae265ecf5b5356885a53393a2029d241394997265a1a25aefc6") != 1);
+    FAIL_IF(SHA256MatchLookupString(hash, "18ac3e7343f016890c510e93f935261169d9e3f565436429830faf0934f4f8e4") != 1);
+    /* shouldnt match */
+    FAIL_IF(SHA256MatchLookupString(hash, "3333333333333333333333333333333333333333333333333333333333333333") == 1);
+    /* wrong length */
+    FAIL_IF(SHA256MatchLookupString(hash, "33333333333333333333333333333333333333333333333333333333333333") == 1);
+
+    ROHashFree(hash);
+    PASS;
+}
+#endif
+
+void DetectFileSha256RegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SHA256MatchTest01", SHA256MatchTest01);
+#endif
+}
+
+#endif /* HAVE_NSS */
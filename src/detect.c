@@ -106,6 +106,8 @@
 #include "detect-filestore.h"
 #include "detect-filemagic.h"
 #include "detect-filemd5.h"
+#include "detect-filesha1.h"
+#include "detect-filesha256.h"
 #include "detect-filesize.h"
 #include "detect-dsize.h"
 #include "detect-flowvar.h"
@@ -505,8 +507,14 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
     SCSigSignatureOrderingModuleCleanup(de_ctx);
 
     /* Setup the signature group lookup structure and pattern matchers */
+    struct timeval build_start, build_end;
+    gettimeofday(&build_start, NULL);
     if (SigGroupBuild(de_ctx) < 0)
         goto end;
+    gettimeofday(&build_end, NULL);
+    de_ctx->build_usec =
+        (uint64_t)(build_end.tv_sec - build_start.tv_sec) * 1000000 +
+        build_end.tv_usec - build_start.tv_usec;
 
     ret = 0;
 
@@ -895,6 +903,12 @@ static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
                 if (p->flowflags & FLOW_PKT_TOSERVER) {
                     tx_progress = AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, flags);
 
+                    if (det_ctx->sgh->flags & SIG_GROUP_HEAD_MPM_HTTP_MULTI) {
+                        PACKET_PROFILING_DETECT_START(p, PROF_DETECT_MPM_HTTP_MULTI);
+                        DetectEngineRunHttpMultiBufferMpm(det_ctx, p->flow, alstate, flags, tx, idx, tx_progress);
+                        PACKET_PROFILING_DETECT_END(p, PROF_DETECT_MPM_HTTP_MULTI);
+                    }
+
                     if (tx_progress > HTP_REQUEST_LINE) {
                         if (det_ctx->sgh->flags & SIG_GROUP_HEAD_MPM_URI) {
                             PACKET_PROFILING_DETECT_START(p, PROF_DETECT_MPM_URI);
@@ -959,6 +973,12 @@ static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
                 } else { /* implied FLOW_PKT_TOCLIENT */
                     tx_progress = AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, flags);
 
+                    if (det_ctx->sgh->flags & SIG_GROUP_HEAD_MPM_HTTP_MULTI) {
+                        PACKET_PROFILING_DETECT_START(p, PROF_DETECT_MPM_HTTP_MULTI);
+                        DetectEngineRunHttpMultiBufferMpm(det_ctx, p->flow, alstate, flags, tx, idx, tx_progress);
+                        PACKET_PROFILING_DETECT_END(p, PROF_DETECT_MPM_HTTP_MULTI);
+                    }
+
                     if (tx_progress > HTP_RESPONSE_LINE) {
                         if (det_ctx->sgh->flags & SIG_GROUP_HEAD_MPM_HSMD) {
                             PACKET_PROFILING_DETECT_START(p, PROF_DETECT_MPM_HSMD);
@@ -1848,6 +1868,22 @@ end:
                     FileDisableMd5(pflow, STREAM_TOSERVER);
                 }
 
+                /* see if this sgh requires us to consider file sha1 */
+                if (!FileForceSha1() && (pflow->sgh_toserver == NULL ||
+                            !(pflow->sgh_toserver->flags & SIG_GROUP_HEAD_HAVEFILESHA1)))
+                {
+                    SCLogDebug("disabling sha1 for flow");
+                    FileDisableSha1(pflow, STREAM_TOSERVER);
+                }
+
+                /* see if this sgh requires us to consider file sha256 */
+                if (!FileForceSha256() && (pflow->sgh_toserver == NULL ||
+                            !(pflow->sgh_toserver->flags & SIG_GROUP_HEAD_HAVEFILESHA256)))
+                {
+                    SCLogDebug("disabling sha256 for flow");
+                    FileDisableSha256(pflow, STREAM_TOSERVER);
+                }
+
                 /* see if this sgh requires us to consider filesize */
                 if (pflow->sgh_toserver == NULL ||
                             !(pflow->sgh_toserver->flags & SIG_GROUP_HEAD_HAVEFILESIZE))
@@ -1879,6 +1915,22 @@ end:
                     FileDisableMd5(pflow, STREAM_TOCLIENT);
                 }
 
+                /* see if this sgh requires us to consider file sha1 */
+                if (!FileForceSha1() && (pflow->sgh_toclient == NULL ||
+                            !(pflow->sgh_toclient->flags & SIG_GROUP_HEAD_HAVEFILESHA1)))
+                {
+                    SCLogDebug("disabling sha1 for flow");
+                    FileDisableSha1(pflow, STREAM_TOCLIENT);
+                }
+
+                /* see if this sgh requires us to consider file sha256 */
+                if (!FileForceSha256() && (pflow->sgh_toclient == NULL ||
+                            !(pflow->sgh_toclient->flags & SIG_GROUP_HEAD_HAVEFILESHA256)))
+                {
+                    SCLogDebug("disabling sha256 for flow");
+                    FileDisableSha256(pflow, STREAM_TOCLIENT);
+                }
+
                 /* see if this sgh requires us to consider filesize */
                 if (pflow->sgh_toclient == NULL ||
                             !(pflow->sgh_toclient->flags & SIG_GROUP_HEAD_HAVEFILESIZE))
@@ -2142,6 +2194,44 @@ int SignatureIsFileMd5Inspecting(Signature *s)
     return 0;
 }
 
+/**
+ *  \brief Check if a signature contains the filesha1 keyword.
+ *
+ *  \param s signature
+ *
+ *  \retval 0 no
+ *  \retval 1 yes
+ */
+int SignatureIsFileSha1Inspecting(Signature *s)
+{
+    if (s == NULL)
+        return 0;
+
+    if (s->file_flags & FILE_SIG_NEED_SHA1)
+        return 1;
+
+    return 0;
+}
+
+/**
+ *  \brief Check if a signature contains the filesha256 keyword.
+ *
+ *  \param s signature
+ *
+ *  \retval 0 no
+ *  \retval 1 yes
+ */
+int SignatureIsFileSha256Inspecting(Signature *s)
+{
+    if (s == NULL)
+        return 0;
+
+    if (s->file_flags & FILE_SIG_NEED_SHA256)
+        return 1;
+
+    return 0;
+}
+
 /**
  *  \brief Check if a signature contains the filesize keyword.
  *
@@ -3984,6 +4074,8 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
 
         SigGroupHeadSetFilemagicFlag(de_ctx, sgh);
         SigGroupHeadSetFileMd5Flag(de_ctx, sgh);
+        SigGroupHeadSetFileSha1Flag(de_ctx, sgh);
+        SigGroupHeadSetFileSha256Flag(de_ctx, sgh);
         SigGroupHeadSetFilesizeFlag(de_ctx, sgh);
         SigGroupHeadSetFilestoreCount(de_ctx, sgh);
         SCLogDebug("filestore count %u", sgh->filestore_cnt);
@@ -4150,6 +4242,8 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
 
     DetectMpmPrepareBuiltinMpms(de_ctx);
     DetectMpmPrepareAppMpms(de_ctx);
+    DetectMpmPrepareQueued(de_ctx);
+    DetectMpmPrepareHttpMultiBuffer(de_ctx);
 
     if (SigMatchPrepare(de_ctx) != 0) {
         SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
@@ -4365,6 +4459,8 @@ void SigTableSetup(void)
     DetectFilestoreRegister();
     DetectFilemagicRegister();
     DetectFileMd5Register();
+    DetectFileSha1Register();
+    DetectFileSha256Register();
     DetectFilesizeRegister();
     DetectAppLayerEventRegister();
     DetectHttpUARegister();
@@ -308,6 +308,8 @@ typedef struct DetectPort_ {
 #define FILE_SIG_NEED_FILECONTENT   0x10
 #define FILE_SIG_NEED_MD5           0x20
 #define FILE_SIG_NEED_SIZE          0x40
+#define FILE_SIG_NEED_SHA1          0x80
+#define FILE_SIG_NEED_SHA256        0x100
 
 /* Detection Engine flags */
 #define DE_QUIET           0x01     /**< DE is quiet (esp for unittests) */
@@ -367,7 +369,7 @@ typedef struct Signature_ {
 
     /** inline -- action */
     uint8_t action;
-    uint8_t file_flags;
+    uint16_t file_flags;
 
     /** addresses, ports and proto this sig matches on */
     DetectProto proto;
@@ -535,6 +537,12 @@ typedef struct DetectEngineThreadKeywordCtxItem_ {
     const char *name; /* keyword name, for error printing */
 } DetectEngineThreadKeywordCtxItem;
 
+/** mpm ctx waiting to be prepared by DetectMpmPrepareQueued */
+typedef struct MpmPrepareJob_ {
+    MpmCtx *mpm_ctx;
+    uint16_t matcher;
+} MpmPrepareJob;
+
 /** \brief main detection engine ctx */
 typedef struct DetectEngineCtx_ {
     uint8_t flags;
@@ -579,6 +587,19 @@ typedef struct DetectEngineCtx_ {
 
     HashListTable *mpm_hash_table;
 
+    /** on reload: the detect engine that is being replaced and its
+     *  MpmStores by fingerprint, so unchanged mpm ctxs can be reused */
+    struct DetectEngineCtx_ *reload_de_ctx;
+    HashListTable *mpm_reuse_table;
+    /** reload_de_ctx sig num -> our sig num, by gid/sid/rev */
+    SigIntId *mpm_reuse_nums;
+    /** sig num maps of the reused ctxs whose sig nums changed */
+    struct MpmStoreSidMap_ *mpm_reuse_maps;
+    uint32_t mpm_reused;    /**< mpm ctxs taken over from reload_de_ctx */
+    uint32_t mpm_built;     /**< mpm ctxs prepared from scratch */
+    /** time spent in SigGroupBuild, in usec */
+    uint64_t build_usec;
+
     HashListTable *variable_names;
     HashListTable *variable_idxs;
     uint16_t variable_names_idx;
@@ -604,6 +625,19 @@ typedef struct DetectEngineCtx_ {
     /* specify the configuration for mpm context factory */
     uint8_t sgh_mpm_context;
 
+    /** prefilter the http buffers of a sgh in one scan (hs only) */
+    int mpm_http_multi_buffer;
+
+    /** use teddy for rule groups with few patterns (ac only) */
+    int mpm_teddy;
+
+    /** threads preparing (compiling) the mpm ctxs in SigGroupBuild */
+    int mpm_build_threads;
+    /** mpm ctxs queued for preparation */
+    MpmPrepareJob *mpm_prepare_queue;
+    uint32_t mpm_prepare_cnt;
+    uint32_t mpm_prepare_size;
+
     uint32_t max_fp_id;
 
     MpmCtxFactoryContainer *mpm_ctx_factory_container;
@@ -934,6 +968,11 @@ typedef struct SigTableElmt_ {
 #define SIG_GROUP_HEAD_MPM_DNSQUERY     (1 << 23)
 #define SIG_GROUP_HEAD_MPM_TLSSNI       (1 << 24)
 #define SIG_GROUP_HEAD_MPM_FD_SMTP      (1 << 25)
+/** http buffers in mpm_http_multi_flags are prefiltered in one scan. Their
+ *  own SIG_GROUP_HEAD_MPM_* flags are cleared. */
+#define SIG_GROUP_HEAD_MPM_HTTP_MULTI   (1 << 26)
+#define SIG_GROUP_HEAD_HAVEFILESHA1     (1 << 27)
+#define SIG_GROUP_HEAD_HAVEFILESHA256   (1 << 28)
 
 #define APP_MPMS_MAX 19
 
@@ -957,6 +996,10 @@ typedef struct MpmStore_ {
     int sm_list;
     int32_t sgh_mpm_context;
 
+    /** hash of the patterns in the mpm ctx, used to find an identical
+     *  store in the old detect engine on reload */
+    uint32_t fingerprint;
+
     MpmCtx *mpm_ctx;
 
 } MpmStore;
@@ -1026,6 +1069,11 @@ typedef struct SigGroupHead_ {
         };
     };
 
+    /** multi buffer prefilter db for the http buffers above, and the
+     *  SIG_GROUP_HEAD_MPM_* flags of the buffers it covers */
+    void *mpm_http_multi_db;
+    uint32_t mpm_http_multi_flags;
+
     /** Array with sig ptrs... size is sig_cnt * sizeof(Signature *) */
     Signature **match_array;
 
@@ -1207,6 +1255,8 @@ enum {
     DETECT_FILESTORE,
     DETECT_FILEMAGIC,
     DETECT_FILEMD5,
+    DETECT_FILESHA1,
+    DETECT_FILESHA256,
     DETECT_FILESIZE,
 
     DETECT_L3PROTO,
@@ -1264,6 +1314,8 @@ Signature *DetectGetTagSignature(void);
 int SignatureIsFilestoring(Signature *);
 int SignatureIsFilemagicInspecting(Signature *);
 int SignatureIsFileMd5Inspecting(Signature *);
+int SignatureIsFileSha1Inspecting(Signature *);
+int SignatureIsFileSha256Inspecting(Signature *);
 int SignatureIsFilesizeInspecting(Signature *);
 
 int DetectRegisterThreadCtxFuncs(DetectEngineCtx *, const char *name, void *(*InitFunc)(void *), void *data, void (*FreeFunc)(void *), int);
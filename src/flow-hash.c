@@ -36,6 +36,7 @@
 #include "flow-private.h"
 #include "flow-manager.h"
 #include "flow-storage.h"
+#include "flow-wheel.h"
 #include "app-layer-parser.h"
 
 #include "util-time.h"
@@ -44,6 +45,7 @@
 #include "util-hash-lookup3.h"
 
 #include "conf.h"
+#include "runmodes.h"
 #include "output.h"
 #include "output-flow.h"
 
@@ -51,6 +53,7 @@
 
 SC_ATOMIC_EXTERN(unsigned int, flow_prune_idx);
 SC_ATOMIC_EXTERN(unsigned int, flow_flags);
+SC_ATOMIC_EXTERN(uint32_t, flow_shard_cnt);
 
 static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv);
 
@@ -318,6 +321,182 @@ static inline int FlowCompare(Flow *f, const Packet *p)
     }
 }
 
+/** \internal
+ *  \brief add a flow to the front of its bucket's tag array
+ *
+ *  If the flow is already in the array it's moved to the front, otherwise
+ *  the least recently used entry is dropped.
+ *
+ *  \warning bucket must be locked */
+static inline void FlowBucketTagSet(FlowBucket *fb, Flow *f, const uint32_t hash)
+{
+    int i;
+    for (i = 0; i < FLOW_BUCKET_TAGS - 1; i++) {
+        if (fb->tag_flow[i] == f)
+            break;
+    }
+    for ( ; i > 0; i--) {
+        fb->tag[i] = fb->tag[i - 1];
+        fb->tag_flow[i] = fb->tag_flow[i - 1];
+    }
+    fb->tag[0] = FLOW_HASH_TAG(hash);
+    fb->tag_flow[0] = f;
+}
+
+/** \internal
+ *  \brief find the packet's flow in the bucket's tag array
+ *
+ *  \warning bucket must be locked
+ *
+ *  \retval f flow or NULL if not in the tag array */
+static inline Flow *FlowBucketTagLookup(FlowBucket *fb, const uint32_t hash,
+        const Packet *p)
+{
+    const uint16_t tag = FLOW_HASH_TAG(hash);
+    int i;
+
+    for (i = 0; i < FLOW_BUCKET_TAGS; i++) {
+        Flow *f = fb->tag_flow[i];
+        if (f != NULL && fb->tag[i] == tag && FlowCompare(f, p) != 0) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+/** \brief prefetch the hash buckets for a burst of packets
+ *
+ *  Meant to be called by code that has a batch of packets that are about
+ *  to go through FlowGetFlowFromHash() one by one, so the bucket cache
+ *  misses of the whole burst overlap instead of being taken one after
+ *  the other.
+ *
+ *  \param pkts array of packets, only the ones wanting a flow are used
+ *  \param n number of packets in the array
+ */
+void FlowPrefetchBuckets(Packet * const *pkts, uint32_t n)
+{
+    if (unlikely(flow_hash == NULL))
+        return;
+
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        const Packet *p = pkts[i];
+        if (p->flags & PKT_WANTS_FLOW) {
+            const FlowBucket *fb = &flow_hash[p->flow_hash % flow_config.hash_size];
+            __builtin_prefetch(fb, 1, 3);
+            /* tag array lives on the 2nd cache line with mutex buckets */
+            if (sizeof(FlowBucket) > CLS)
+                __builtin_prefetch((const uint8_t *)fb + CLS, 1, 3);
+        }
+    }
+}
+
+/**
+ *  \brief Create the flow hash shard for a worker thread
+ *
+ *  Only used if flow.sharded is enabled and we run in the workers
+ *  runmode, as other runmodes don't keep a flow on a single thread.
+ *
+ *  The range of the shard is set on first use, so that all worker
+ *  threads are known by then.
+ *
+ *  \retval s shard or NULL if sharding is not used
+ */
+FlowShard *FlowShardNew(void)
+{
+    if (flow_config.sharded == 0)
+        return NULL;
+
+    const char *runmode = RunmodeGetActive();
+    if (runmode == NULL || strcmp(runmode, "workers") != 0) {
+        /* warn only once, not for every thread */
+        if (SC_ATOMIC_ADD(flow_shard_cnt, 1) == 1) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "flow.sharded is only "
+                    "supported in the workers runmode, ignoring");
+        }
+        return NULL;
+    }
+
+    FlowShard *s = SCMalloc(sizeof(*s));
+    if (unlikely(s == NULL))
+        return NULL;
+    memset(s, 0x00, sizeof(*s));
+    FlowQueueInit(&s->spare_q);
+
+    s->id = SC_ATOMIC_ADD(flow_shard_cnt, 1) - 1;
+    SCLogDebug("flow hash shard %u created", s->id);
+    return s;
+}
+
+/**
+ *  \brief Free a shard, its spare flows go back to the global spare queue
+ */
+void FlowShardFree(FlowShard *s)
+{
+    if (s == NULL)
+        return;
+
+    Flow *f;
+    while ((f = FlowDequeue(&s->spare_q)) != NULL) {
+        FlowMoveToSpare(f);
+    }
+    FlowQueueDestroy(&s->spare_q);
+    SCFree(s);
+}
+
+/**
+ *  \brief Set the part of the hash used by a shard
+ *
+ *  The hash is split into 'cnt' equal parts, the last shard also gets
+ *  the remainder. If the hash is smaller than the number of shards,
+ *  every shard uses the whole hash.
+ *
+ *  \param cnt total number of shards
+ */
+void FlowShardSetRange(FlowShard *s, uint32_t cnt)
+{
+    if (cnt == 0 || s->id >= cnt || flow_config.hash_size < cnt) {
+        s->min = 0;
+        s->size = flow_config.hash_size;
+    } else {
+        uint32_t part = flow_config.hash_size / cnt;
+        s->min = s->id * part;
+        s->size = part;
+        if (s->id == cnt - 1)
+            s->size = flow_config.hash_size - s->min;
+    }
+    s->prune_idx = 0;
+
+    SCLogDebug("shard %u: buckets %u-%u", s->id, s->min, s->min + s->size - 1);
+}
+
+/** \brief get the bucket for a hash, from the thread's shard if it has one */
+static inline FlowBucket *FlowGetBucket(DecodeThreadVars *dtv, const uint32_t hash)
+{
+    if (dtv != NULL && dtv->flow_shard != NULL) {
+        FlowShard *s = dtv->flow_shard;
+        if (unlikely(s->size == 0))
+            FlowShardSetRange(s, SC_ATOMIC_GET(flow_shard_cnt));
+        return &flow_hash[s->min + (hash % s->size)];
+    }
+    return &flow_hash[hash % flow_config.hash_size];
+}
+
+/** \brief get a spare flow from the shard's queue
+ *
+ *  If the queue is empty, it's refilled from the global spare queue in
+ *  one go, so the global queue lock is taken once per batch. */
+static inline Flow *FlowShardGetSpare(FlowShard *s)
+{
+    if (s->spare_q.len == 0) {
+        if (FlowQueueTransfer(&s->spare_q, &flow_spare_q,
+                    FLOW_SHARD_SPARE_BATCH) == 0)
+            return NULL;
+    }
+    return FlowDequeue(&s->spare_q);
+}
+
 /**
  *  \brief Check if we should create a flow based on a packet
  *
@@ -359,7 +538,10 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
     }
 
     /* get a flow from the spare queue */
-    f = FlowDequeue(&flow_spare_q);
+    if (dtv != NULL && dtv->flow_shard != NULL)
+        f = FlowShardGetSpare(dtv->flow_shard);
+    else
+        f = FlowDequeue(&flow_spare_q);
     if (f == NULL) {
         /* If we reached the max memcap, we get a used flow */
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize()))) {
@@ -413,6 +595,7 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
 {
     /* tag flow as reused so future lookups won't find it */
     old_f->flags |= FLOW_TCP_REUSED;
+    FlowBucketTagRemove(fb, old_f);
     /* get some settings that we move over to the new flow */
     FlowThreadId thread_id = old_f->thread_id;
 
@@ -436,6 +619,9 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
     FlowInit(f, p);
     f->flow_hash = hash;
     f->fb = fb;
+    FlowBucketTagSet(fb, f, hash);
+    COPY_TIMESTAMP(&p->ts,&f->lastts);
+    FlowWheelScheduleFlow(f);
 
     f->thread_id = thread_id;
     return f;
@@ -464,7 +650,7 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
 
     /* get our hash bucket and lock it */
     const uint32_t hash = p->flow_hash;
-    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
+    FlowBucket *fb = FlowGetBucket(dtv, hash);
     FBLOCK_LOCK(fb);
 
     SCLogDebug("fb %p fb->head %p", fb, fb->head);
@@ -485,88 +671,82 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
         FlowInit(f, p);
         f->flow_hash = hash;
         f->fb = fb;
+        FlowBucketTagSet(fb, f, hash);
 
         /* update the last seen timestamp of this flow */
         COPY_TIMESTAMP(&p->ts,&f->lastts);
+        FlowWheelScheduleFlow(f);
         FlowReference(dest, f);
 
         FBLOCK_UNLOCK(fb);
         return f;
     }
 
-    /* ok, we have a flow in the bucket. Let's find out if it is our flow */
-    f = fb->head;
+    /* ok, we have a flow in the bucket. Check the tag array first, so only
+     * flows with a matching tag are touched. */
+    f = FlowBucketTagLookup(fb, hash, p);
+    if (f == NULL) {
+        /* not there, let's find out if the first flow is our flow */
+        f = fb->head;
 
-    /* see if this is the flow we are looking for */
-    if (FlowCompare(f, p) == 0) {
-        Flow *pf = NULL; /* previous flow */
+        /* see if this is the flow we are looking for */
+        if (FlowCompare(f, p) == 0) {
+            Flow *pf = NULL; /* previous flow */
 
-        while (f) {
-            pf = f;
-            f = f->hnext;
+            while (f) {
+                pf = f;
+                f = f->hnext;
 
-            if (f == NULL) {
-                f = pf->hnext = FlowGetNew(tv, dtv, p);
                 if (f == NULL) {
-                    FBLOCK_UNLOCK(fb);
-                    return NULL;
-                }
-                fb->tail = f;
-
-                /* flow is locked */
+                    f = pf->hnext = FlowGetNew(tv, dtv, p);
+                    if (f == NULL) {
+                        FBLOCK_UNLOCK(fb);
+                        return NULL;
+                    }
+                    fb->tail = f;
 
-                f->hprev = pf;
+                    /* flow is locked */
 
-                /* initialize and return */
-                FlowInit(f, p);
-                f->flow_hash = hash;
-                f->fb = fb;
+                    f->hprev = pf;
 
-                /* update the last seen timestamp of this flow */
-                COPY_TIMESTAMP(&p->ts,&f->lastts);
-                FlowReference(dest, f);
+                    /* initialize and return */
+                    FlowInit(f, p);
+                    f->flow_hash = hash;
+                    f->fb = fb;
+                    FlowBucketTagSet(fb, f, hash);
 
-                FBLOCK_UNLOCK(fb);
-                return f;
-            }
+                    /* update the last seen timestamp of this flow */
+                    COPY_TIMESTAMP(&p->ts,&f->lastts);
+                    FlowWheelScheduleFlow(f);
+                    FlowReference(dest, f);
 
-            if (FlowCompare(f, p) != 0) {
-                /* we found our flow, lets put it on top of the
-                 * hash list -- this rewards active flows */
-                if (f->hnext) {
-                    f->hnext->hprev = f->hprev;
-                }
-                if (f->hprev) {
-                    f->hprev->hnext = f->hnext;
-                }
-                if (f == fb->tail) {
-                    fb->tail = f->hprev;
+                    FBLOCK_UNLOCK(fb);
+                    return f;
                 }
 
-                f->hnext = fb->head;
-                f->hprev = NULL;
-                fb->head->hprev = f;
-                fb->head = f;
-
-                /* found our flow, lock & return */
-                FLOWLOCK_WRLOCK(f);
-                if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
-                    f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
-                    if (f == NULL) {
-                        FBLOCK_UNLOCK(fb);
-                        return NULL;
+                if (FlowCompare(f, p) != 0) {
+                    /* we found our flow, lets put it on top of the
+                     * hash list -- this rewards active flows */
+                    if (f->hnext) {
+                        f->hnext->hprev = f->hprev;
+                    }
+                    if (f->hprev) {
+                        f->hprev->hnext = f->hnext;
+                    }
+                    if (f == fb->tail) {
+                        fb->tail = f->hprev;
                     }
-                }
-
-                /* update the last seen timestamp of this flow */
-                COPY_TIMESTAMP(&p->ts,&f->lastts);
-                FlowReference(dest, f);
 
-                FBLOCK_UNLOCK(fb);
-                return f;
+                    f->hnext = fb->head;
+                    f->hprev = NULL;
+                    fb->head->hprev = f;
+                    fb->head = f;
+                    break;
+                }
             }
         }
     }
+    FlowBucketTagSet(fb, f, hash);
 
     /* lock & return */
     FLOWLOCK_WRLOCK(f);
@@ -603,14 +783,26 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
  */
 static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 {
-    uint32_t idx = SC_ATOMIC_GET(flow_prune_idx) % flow_config.hash_size;
-    uint32_t cnt = flow_config.hash_size;
+    /* with a shard, only take flows from our own part of the hash */
+    FlowShard *s = dtv ? dtv->flow_shard : NULL;
+    uint32_t min = 0;
+    uint32_t size = flow_config.hash_size;
+    uint32_t idx;
+    if (s != NULL && s->size != 0) {
+        min = s->min;
+        size = s->size;
+        idx = s->prune_idx % size;
+    } else {
+        s = NULL;
+        idx = SC_ATOMIC_GET(flow_prune_idx) % size;
+    }
+    uint32_t cnt = size;
 
     while (cnt--) {
-        if (++idx >= flow_config.hash_size)
+        if (++idx >= size)
             idx = 0;
 
-        FlowBucket *fb = &flow_hash[idx];
+        FlowBucket *fb = &flow_hash[min + idx];
 
         if (FBLOCK_TRYLOCK(fb) != 0)
             continue;
@@ -635,6 +827,7 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
         }
 
         /* remove from the hash */
+        FlowBucketTagRemove(fb, f);
         if (f->hprev != NULL)
             f->hprev->hnext = f->hnext;
         if (f->hnext != NULL)
@@ -670,7 +863,10 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 
         FLOWLOCK_UNLOCK(f);
 
-        (void) SC_ATOMIC_ADD(flow_prune_idx, (flow_config.hash_size - cnt));
+        if (s != NULL)
+            s->prune_idx = idx;
+        else
+            (void) SC_ATOMIC_ADD(flow_prune_idx, (flow_config.hash_size - cnt));
         return f;
     }
 
@@ -24,6 +24,8 @@
 #ifndef __FLOW_HASH_H__
 #define __FLOW_HASH_H__
 
+#include "flow-queue.h"
+
 /** Spinlocks or Mutex for the flow buckets. */
 //#define FBLOCK_SPIN
 #define FBLOCK_MUTEX
@@ -34,10 +36,22 @@
     #endif
 #endif
 
+/** number of flows per bucket that are tracked in the tag array */
+#define FLOW_BUCKET_TAGS    4
+
+/** tag of a flow: the hash bits that are not used to pick the bucket
+ *  (with the default hash size) */
+#define FLOW_HASH_TAG(hash) (uint16_t)((hash) >> 16)
+
 /* flow hash bucket -- the hash is basically an array of these buckets.
  * Each bucket contains a flow or list of flows. All these flows have
  * the same hashkey (the hash is a chained hash). When doing modifications
- * to the list, the entire bucket is locked. */
+ * to the list, the entire bucket is locked.
+ *
+ * The most recently used flows of the bucket are also kept in a small
+ * tag array. Lookups compare the 16 bit tags first, so they only touch
+ * the Flow's cache lines for likely matches instead of for every hop in
+ * the list. The array is protected by the bucket lock. */
 typedef struct FlowBucket_ {
     Flow *head;
     Flow *tail;
@@ -48,6 +62,12 @@ typedef struct FlowBucket_ {
 #else
     #error Enable FBLOCK_SPIN or FBLOCK_MUTEX
 #endif
+    uint16_t tag[FLOW_BUCKET_TAGS];
+    Flow *tag_flow[FLOW_BUCKET_TAGS];   /**< NULL if slot is unused */
+    /** time the flow manager checks this row next, 0 if not scheduled.
+     *  See flow-wheel.c */
+    SC_ATOMIC_DECLARE(uint32_t, wheel_ts);
+    SC_ATOMIC_DECLARE(uint32_t, wheel_pending);
 } __attribute__((aligned(CLS))) FlowBucket;
 
 #ifdef FBLOCK_SPIN
@@ -66,9 +86,49 @@ typedef struct FlowBucket_ {
     #error Enable FBLOCK_SPIN or FBLOCK_MUTEX
 #endif
 
+/** \brief remove a flow from its bucket's tag array
+ *
+ *  Needs to be called whenever a flow is removed from the bucket's list.
+ *
+ *  \warning bucket must be locked */
+static inline void FlowBucketTagRemove(FlowBucket *fb, const Flow *f)
+{
+    int i;
+    for (i = 0; i < FLOW_BUCKET_TAGS; i++) {
+        if (fb->tag_flow[i] == f) {
+            fb->tag_flow[i] = NULL;
+            return;
+        }
+    }
+}
+
+/** number of flows a shard takes from the global spare queue at once */
+#define FLOW_SHARD_SPARE_BATCH  64
+
+/** \brief part of the flow hash owned by one worker thread
+ *
+ *  With flow.sharded enabled in the workers runmode, each FlowWorker
+ *  thread only uses buckets [min, min + size) of the global hash. This
+ *  relies on the capture method sending all packets of a flow to the
+ *  same thread. The bucket locks stay, as the flow manager still walks
+ *  the whole hash, but they are no longer shared between workers.
+ */
+typedef struct FlowShard_ {
+    uint32_t id;
+    uint32_t min;           /**< first bucket of this shard */
+    uint32_t size;          /**< number of buckets, 0 until first use */
+    uint32_t prune_idx;     /**< next bucket for FlowGetUsedFlow */
+    FlowQueue spare_q;      /**< flows taken from flow_spare_q */
+} FlowShard;
+
 /* prototypes */
 
+FlowShard *FlowShardNew(void);
+void FlowShardFree(FlowShard *);
+void FlowShardSetRange(FlowShard *, uint32_t cnt);
+
 Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *, Flow **);
+void FlowPrefetchBuckets(Packet * const *pkts, uint32_t n);
 
 void FlowDisableTcpReuseHandling(void);
 
@@ -41,6 +41,7 @@
 #include "flow-private.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
+#include "flow-wheel.h"
 
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
@@ -159,50 +160,6 @@ void FlowDisableFlowManagerThread(void)
     return;
 }
 
-/** \internal
- *  \brief get timeout for flow
- *
- *  \param f flow
- *  \param state flow state
- *  \param emergency bool indicating emergency mode 1 yes, 0 no
- *
- *  \retval timeout timeout in seconds
- */
-static inline uint32_t FlowGetFlowTimeout(const Flow *f, int state, int emergency)
-{
-    uint32_t timeout;
-
-    if (emergency) {
-        switch(state) {
-            default:
-            case FLOW_STATE_NEW:
-                timeout = flow_proto[f->protomap].emerg_new_timeout;
-                break;
-            case FLOW_STATE_ESTABLISHED:
-                timeout = flow_proto[f->protomap].emerg_est_timeout;
-                break;
-            case FLOW_STATE_CLOSED:
-                timeout = flow_proto[f->protomap].emerg_closed_timeout;
-                break;
-        }
-    } else { /* implies no emergency */
-        switch(state) {
-            default:
-            case FLOW_STATE_NEW:
-                timeout = flow_proto[f->protomap].new_timeout;
-                break;
-            case FLOW_STATE_ESTABLISHED:
-                timeout = flow_proto[f->protomap].est_timeout;
-                break;
-            case FLOW_STATE_CLOSED:
-                timeout = flow_proto[f->protomap].closed_timeout;
-                break;
-        }
-    }
-
-    return timeout;
-}
-
 /** \internal
  *  \brief check if a flow is timed out
  *
@@ -260,6 +217,14 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
     return 1;
 }
 
+/** \internal
+ *  \brief keep the earliest of the times in 'next_ts' */
+static inline void FlowManagerUpdateNextTs(uint32_t *next_ts, uint32_t t)
+{
+    if (next_ts != NULL && (*next_ts == 0 || t < *next_ts))
+        *next_ts = t;
+}
+
 /**
  *  \internal
  *
@@ -269,11 +234,13 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
  *  \param ts timestamp
  *  \param emergency bool indicating emergency mode
  *  \param counters ptr to FlowTimeoutCounters structure
+ *  \param next_ts if not NULL, set to the earliest time one of the
+ *                 remaining flows can time out (0 if none are left)
  *
  *  \retval cnt timed out flows
  */
 static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
-        int emergency, FlowTimeoutCounters *counters)
+        int emergency, FlowTimeoutCounters *counters, uint32_t *next_ts)
 {
     uint32_t cnt = 0;
 
@@ -287,6 +254,8 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
 
         /* timeout logic goes here */
         if (FlowManagerFlowTimeout(f, state, ts, emergency) == 0) {
+            FlowManagerUpdateNextTs(next_ts, (uint32_t)f->lastts.tv_sec +
+                    FlowGetFlowTimeout(f, state, emergency) + 1);
             f = f->hprev;
             continue;
         }
@@ -303,6 +272,7 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
          * ready to be discarded. */
         if (FlowManagerFlowTimedOut(f, ts) == 1) {
             /* remove from the hash */
+            FlowBucketTagRemove(f->fb, f);
             if (f->hprev != NULL)
                 f->hprev->hnext = f->hnext;
             if (f->hnext != NULL)
@@ -354,6 +324,8 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
             }
         } else {
             FLOWLOCK_UNLOCK(f);
+            /* in use or needs reassembly first, try again soon */
+            FlowManagerUpdateNextTs(next_ts, (uint32_t)ts->tv_sec + 1);
         }
 
         f = next_flow;
@@ -400,7 +372,7 @@ static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
             goto next;
 
         /* we have a flow, or more than one */
-        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters);
+        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters, NULL);
 
 next:
         FBLOCK_UNLOCK(fb);
@@ -412,6 +384,45 @@ next:
     return cnt;
 }
 
+typedef struct FlowManagerWheelData_ {
+    struct timeval *ts;
+    int emergency;
+    FlowTimeoutCounters *counters;
+} FlowManagerWheelData;
+
+/** \internal
+ *  \brief time out flows of a hash row that is due in the timing wheel
+ *
+ *  \retval cnt number of timed out flows
+ */
+static uint32_t FlowManagerWheelRow(FlowBucket *fb, uint32_t due,
+        uint32_t now, void *data)
+{
+    FlowManagerWheelData *wd = data;
+    uint32_t cnt = 0;
+    uint32_t next = 0;
+
+    /* before grabbing the row lock, make sure we have at least
+     * 9 packets in the pool */
+    PacketPoolWaitForN(9);
+
+    if (FBLOCK_TRYLOCK(fb) != 0) {
+        /* busy, check again in a second. That is earlier than any flow
+         * added in the meantime can time out, so it's safe w/o lock. */
+        FlowWheelRowSetNext(fb, due, now + 1);
+        return 0;
+    }
+
+    if (fb->tail != NULL) {
+        cnt = FlowManagerHashRowTimeout(fb->tail, wd->ts, wd->emergency,
+                wd->counters, &next);
+    }
+    FlowWheelRowSetNext(fb, due, next);
+
+    FBLOCK_UNLOCK(fb);
+    return cnt;
+}
+
 /**
  *  \internal
  *
@@ -433,6 +444,7 @@ static uint32_t FlowManagerHashRowCleanup(Flow *f)
         int state = SC_ATOMIC_GET(f->flow_state);
 
         /* remove from the hash */
+        FlowBucketTagRemove(f->fb, f);
         if (f->hprev != NULL)
             f->hprev->hnext = f->hnext;
         if (f->hnext != NULL)
@@ -500,6 +512,9 @@ typedef struct FlowManagerThreadData_ {
     uint32_t min;
     uint32_t max;
 
+    /** timing wheel for our part of the hash, NULL if not used */
+    FlowWheel *wheel;
+
     uint16_t flow_mgr_cnt_clo;
     uint16_t flow_mgr_cnt_new;
     uint16_t flow_mgr_cnt_est;
@@ -507,6 +522,8 @@ typedef struct FlowManagerThreadData_ {
     uint16_t flow_emerg_mode_enter;
     uint16_t flow_emerg_mode_over;
     uint16_t flow_tcp_reuse;
+    uint16_t flow_mgr_wheel_rows;
+    uint16_t flow_mgr_wheel_lag;
 } FlowManagerThreadData;
 
 static TmEcode FlowManagerThreadInit(ThreadVars *t, void *initdata, void **data)
@@ -534,6 +551,9 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, void *initdata, void **data)
 
     SCLogDebug("instance %u hash range %u %u", ftd->instance, ftd->min, ftd->max);
 
+    ftd->wheel = FlowWheelGet(ftd->instance - 1);
+    BUG_ON(ftd->wheel != NULL && ftd->wheel->min != ftd->min);
+
     /* pass thread data back to caller */
     *data = ftd;
 
@@ -544,6 +564,8 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, void *initdata, void **data)
     ftd->flow_emerg_mode_enter = StatsRegisterCounter("flow.emerg_mode_entered", t);
     ftd->flow_emerg_mode_over = StatsRegisterCounter("flow.emerg_mode_over", t);
     ftd->flow_tcp_reuse = StatsRegisterCounter("flow.tcp_reuse", t);
+    ftd->flow_mgr_wheel_rows = StatsRegisterCounter("flow_mgr.wheel_rows", t);
+    ftd->flow_mgr_wheel_lag = StatsRegisterCounter("flow_mgr.wheel_lag", t);
 
     PacketPoolInit();
     return TM_ECODE_OK;
@@ -615,7 +637,23 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
 
         /* try to time out flows */
         FlowTimeoutCounters counters = { 0, 0, 0, 0, };
-        FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters);
+        if (ftd->wheel != NULL) {
+            FlowManagerWheelData wd = { &ts, 0, &counters };
+            uint32_t want = 0;
+            if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY) {
+                wd.emergency = 1;
+                /* enough to get out of emergency mode */
+                want = (flow_config.prealloc * flow_config.emergency_recovery /
+                        100 / flowmgr_number) + 1;
+            }
+            FlowWheelRun(ftd->wheel, (uint32_t)ts.tv_sec, want,
+                    FlowManagerWheelRow, &wd);
+
+            StatsSetUI64(th_v, ftd->flow_mgr_wheel_rows, (uint64_t)ftd->wheel->rows);
+            StatsSetUI64(th_v, ftd->flow_mgr_wheel_lag, (uint64_t)ftd->wheel->lag);
+        } else {
+            FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters);
+        }
 
 
         if (ftd->instance == 1) {
@@ -718,6 +756,10 @@ void FlowManagerThreadSpawn()
     flowmgr_number = (uint32_t)setting;
 
     SCLogConfig("using %u flow manager threads", flowmgr_number);
+    if (FlowWheelsInit(flowmgr_number) != 0) {
+        SCLogWarning(SC_ERR_MEM_ALLOC, "flow timeout wheel setup failed, "
+                "flow managers will walk the whole flow hash");
+    }
     SCCtrlCondInit(&flow_manager_ctrl_cond, NULL);
     SCCtrlMutexInit(&flow_manager_ctrl_mutex, NULL);
 
@@ -1078,7 +1120,6 @@ static int FlowMgrTest02 (void)
     struct timeval ts;
     TcpSegment seg;
     TcpStream client;
-    uint8_t payload[3] = {0x41, 0x41, 0x41};
 
     FlowQueueInit(&flow_spare_q);
 
@@ -1087,14 +1128,13 @@ static int FlowMgrTest02 (void)
     memset(&fb, 0, sizeof(FlowBucket));
     memset(&ts, 0, sizeof(ts));
     memset(&seg, 0, sizeof(TcpSegment));
-    memset(&client, 0, sizeof(TcpSegment));
+    memset(&client, 0, sizeof(TcpStream));
 
     FBLOCK_INIT(&fb);
     FLOW_INITIALIZE(&f);
     f.flags |= FLOW_TIMEOUT_REASSEMBLY_DONE;
 
     TimeGet(&ts);
-    seg.payload = payload;
     seg.payload_len = 3;
     seg.next = NULL;
     seg.prev = NULL;
@@ -1184,7 +1224,6 @@ static int FlowMgrTest04 (void)
     struct timeval ts;
     TcpSegment seg;
     TcpStream client;
-    uint8_t payload[3] = {0x41, 0x41, 0x41};
 
     FlowQueueInit(&flow_spare_q);
 
@@ -1193,14 +1232,13 @@ static int FlowMgrTest04 (void)
     memset(&fb, 0, sizeof(FlowBucket));
     memset(&ts, 0, sizeof(ts));
     memset(&seg, 0, sizeof(TcpSegment));
-    memset(&client, 0, sizeof(TcpSegment));
+    memset(&client, 0, sizeof(TcpStream));
 
     FBLOCK_INIT(&fb);
     FLOW_INITIALIZE(&f);
     f.flags |= FLOW_TIMEOUT_REASSEMBLY_DONE;
 
     TimeGet(&ts);
-    seg.payload = payload;
     seg.payload_len = 3;
     seg.next = NULL;
     seg.prev = NULL;
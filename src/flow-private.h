@@ -87,5 +87,49 @@ FlowConfig flow_config;
 /** flow memuse counter (atomic), for enforcing memcap limit */
 SC_ATOMIC_DECLARE(long long unsigned int, flow_memuse);
 
+/**
+ *  \brief get timeout for flow
+ *
+ *  \param f flow
+ *  \param state flow state
+ *  \param emergency bool indicating emergency mode 1 yes, 0 no
+ *
+ *  \retval timeout timeout in seconds
+ */
+static inline uint32_t FlowGetFlowTimeout(const Flow *f, int state, int emergency)
+{
+    uint32_t timeout;
+
+    if (emergency) {
+        switch(state) {
+            default:
+            case FLOW_STATE_NEW:
+                timeout = flow_proto[f->protomap].emerg_new_timeout;
+                break;
+            case FLOW_STATE_ESTABLISHED:
+                timeout = flow_proto[f->protomap].emerg_est_timeout;
+                break;
+            case FLOW_STATE_CLOSED:
+                timeout = flow_proto[f->protomap].emerg_closed_timeout;
+                break;
+        }
+    } else { /* implies no emergency */
+        switch(state) {
+            default:
+            case FLOW_STATE_NEW:
+                timeout = flow_proto[f->protomap].new_timeout;
+                break;
+            case FLOW_STATE_ESTABLISHED:
+                timeout = flow_proto[f->protomap].est_timeout;
+                break;
+            case FLOW_STATE_CLOSED:
+                timeout = flow_proto[f->protomap].closed_timeout;
+                break;
+        }
+    }
+
+    return timeout;
+}
+
 #endif /* __FLOW_PRIVATE_H__ */
 
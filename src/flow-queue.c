@@ -166,3 +166,69 @@ void FlowMoveToSpare(Flow *f)
     FQLOCK_UNLOCK(&flow_spare_q);
 }
 
+/**
+ *  \brief move up to 'n' flows from one queue to another
+ *
+ *  Flows are taken from the bottom of 'src' and added to the top of 'dst',
+ *  so both queues keep their FIFO order. Each queue is locked only once
+ *  for the whole batch.
+ *
+ *  \param dst destination queue
+ *  \param src source queue
+ *  \param n max number of flows to move
+ *
+ *  \retval cnt number of flows moved
+ */
+uint32_t FlowQueueTransfer(FlowQueue *dst, FlowQueue *src, uint32_t n)
+{
+    uint32_t cnt = 0;
+
+    if (n == 0)
+        return 0;
+
+    FQLOCK_LOCK(src);
+    if (src->bot == NULL) {
+        FQLOCK_UNLOCK(src);
+        return 0;
+    }
+
+    /* detach the bottom 'cnt' flows from src as one list */
+    Flow *bot = src->bot;
+    Flow *top = bot;
+    cnt = 1;
+    while (cnt < n && top->lprev != NULL) {
+        top = top->lprev;
+        cnt++;
+    }
+
+    src->bot = top->lprev;
+    if (src->bot != NULL)
+        src->bot->lnext = NULL;
+    else
+        src->top = NULL;
+    if (src->len >= cnt)
+        src->len -= cnt;
+    else
+        src->len = 0;
+    FQLOCK_UNLOCK(src);
+
+    top->lprev = NULL;
+
+    /* add the list to the top of dst */
+    FQLOCK_LOCK(dst);
+    if (dst->top != NULL) {
+        bot->lnext = dst->top;
+        dst->top->lprev = bot;
+    } else {
+        dst->bot = bot;
+    }
+    dst->top = top;
+    dst->len += cnt;
+#ifdef DBG_PERF
+    if (dst->len > dst->dbg_maxlen)
+        dst->dbg_maxlen = dst->len;
+#endif /* DBG_PERF */
+    FQLOCK_UNLOCK(dst);
+
+    return cnt;
+}
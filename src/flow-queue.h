@@ -80,6 +80,7 @@ void FlowEnqueue (FlowQueue *, Flow *);
 Flow *FlowDequeue (FlowQueue *);
 
 void FlowMoveToSpare(Flow *);
+uint32_t FlowQueueTransfer(FlowQueue *dst, FlowQueue *src, uint32_t n);
 
 #endif /* __FLOW_QUEUE_H__ */
 
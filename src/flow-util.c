@@ -57,7 +57,9 @@ Flow *FlowAlloc(void)
 
     (void) SC_ATOMIC_ADD(flow_memuse, size);
 
-    f = SCMalloc(size);
+    /* aligned so the hot members of the flow share as few
+     * cache lines as possible, see Flow in flow.h */
+    f = SCMallocAligned(size, CLS);
     if (unlikely(f == NULL)) {
         (void)SC_ATOMIC_SUB(flow_memuse, size);
         return NULL;
@@ -77,7 +79,7 @@ Flow *FlowAlloc(void)
 void FlowFree(Flow *f)
 {
     FLOW_DESTROY(f);
-    SCFree(f);
+    SCFreeAligned(f);
 
     size_t size = sizeof(Flow) + FlowStorageSize();
     (void) SC_ATOMIC_SUB(flow_memuse, size);
@@ -0,0 +1,640 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Timing wheel for the flow manager.
+ *
+ * Instead of walking the whole flow hash every run, each flow manager
+ * keeps a 2 level timing wheel of the hash rows it owns. A row sits in
+ * the slot of the earliest time one of its flows can time out. Level 0
+ * has 256 slots of 1 second, level 1 has 256 slots of 256 seconds that
+ * are moved into level 0 when their time comes closer.
+ *
+ * The time a row is due is also stored in the FlowBucket (wheel_ts). The
+ * workers only touch it when a flow is added to a row or a flow's timeout
+ * becomes shorter: if the new time is earlier, they lower wheel_ts and
+ * push the row on the wheel's lock free pending stack. Packets for
+ * existing flows cost nothing: the manager finds out the flow was active
+ * when the row comes due, and schedules the row again.
+ */
+
+#include "suricata-common.h"
+#include "threads.h"
+
+#include "flow.h"
+#include "flow-hash.h"
+#include "flow-private.h"
+#include "flow-wheel.h"
+
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+static FlowWheel *flow_wheels = NULL;
+static uint32_t flow_wheel_cnt = 0;
+static uint32_t flow_wheel_range = 0;
+
+static void FlowWheelFree(FlowWheel *w)
+{
+    SCFree(w->next);
+    SCFree(w->prev);
+    SCFree(w->slot);
+    SCFree(w->pending_next);
+    SC_ATOMIC_DESTROY(w->pending);
+}
+
+static int FlowWheelSetup(FlowWheel *w, uint32_t min, uint32_t size)
+{
+    memset(w, 0x00, sizeof(*w));
+    SC_ATOMIC_INIT(w->pending);
+    w->min = min;
+    w->size = size;
+
+    w->next = SCCalloc(size, sizeof(uint32_t));
+    w->prev = SCCalloc(size, sizeof(uint32_t));
+    w->slot = SCCalloc(size, sizeof(uint16_t));
+    w->pending_next = SCCalloc(size, sizeof(uint32_t));
+    if (w->next == NULL || w->prev == NULL || w->slot == NULL ||
+            w->pending_next == NULL) {
+        FlowWheelFree(w);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *  \brief create the timing wheels
+ *
+ *  The hash is split over the wheels the same way the flow managers
+ *  split it, so wheel 'n' is used by flow manager instance 'n + 1'.
+ *
+ *  \param cnt number of flow managers
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, flow managers need to walk the hash instead
+ */
+int FlowWheelsInit(uint32_t cnt)
+{
+    FlowWheelsFree();
+
+    if (cnt == 0 || flow_hash == NULL || flow_config.hash_size < cnt)
+        return -1;
+
+    FlowWheel *wheels = SCCalloc(cnt, sizeof(FlowWheel));
+    if (wheels == NULL)
+        return -1;
+
+    uint32_t range = flow_config.hash_size / cnt;
+    uint32_t u;
+    for (u = 0; u < cnt; u++) {
+        uint32_t min = u * range;
+        uint32_t size = (u == cnt - 1) ? flow_config.hash_size - min : range;
+        if (FlowWheelSetup(&wheels[u], min, size) != 0) {
+            while (u-- > 0)
+                FlowWheelFree(&wheels[u]);
+            SCFree(wheels);
+            return -1;
+        }
+    }
+
+    /* the hash may already have flows, schedule all rows once */
+    for (u = 0; u < flow_config.hash_size; u++) {
+        FlowBucket *fb = &flow_hash[u];
+        SC_ATOMIC_SET(fb->wheel_ts, 0);
+        SC_ATOMIC_SET(fb->wheel_pending, 0);
+    }
+
+    flow_wheel_range = range;
+    flow_wheel_cnt = cnt;
+    flow_wheels = wheels;
+
+    for (u = 0; u < flow_config.hash_size; u++) {
+        FlowBucket *fb = &flow_hash[u];
+        if (fb->head != NULL)
+            FlowWheelScheduleRow(fb, 1);
+    }
+    return 0;
+}
+
+void FlowWheelsFree(void)
+{
+    FlowWheel *wheels = flow_wheels;
+    if (wheels == NULL)
+        return;
+
+    flow_wheels = NULL;
+
+    uint32_t u;
+    for (u = 0; u < flow_wheel_cnt; u++) {
+        FlowWheelFree(&wheels[u]);
+    }
+    SCFree(wheels);
+    flow_wheel_cnt = 0;
+    flow_wheel_range = 0;
+}
+
+/** \brief get the wheel of flow manager 'id' (0 based)
+ *  \retval w wheel or NULL if wheels are not used */
+FlowWheel *FlowWheelGet(uint32_t id)
+{
+    if (flow_wheels == NULL || id >= flow_wheel_cnt)
+        return NULL;
+    return &flow_wheels[id];
+}
+
+static inline FlowWheel *FlowWheelForRow(uint32_t row)
+{
+    uint32_t id = row / flow_wheel_range;
+    if (id >= flow_wheel_cnt)
+        id = flow_wheel_cnt - 1;
+    return &flow_wheels[id];
+}
+
+/**
+ *  \brief make sure a row is checked by the flow manager at 'ts'
+ *
+ *  Only does work if 'ts' is earlier than the time the row is scheduled
+ *  for already. Safe to call from any thread.
+ *
+ *  \param fb hash row
+ *  \param ts time in seconds
+ */
+void FlowWheelScheduleRow(FlowBucket *fb, uint32_t ts)
+{
+    FlowWheel *wheels = flow_wheels;
+    if (wheels == NULL)
+        return;
+    if (ts == 0)
+        ts = 1;
+
+    uint32_t cur = SC_ATOMIC_GET(fb->wheel_ts);
+    while (cur == 0 || ts < cur) {
+        if (SC_ATOMIC_CAS(&fb->wheel_ts, cur, ts)) {
+            /* tell the manager, unless the row is pending already */
+            if (SC_ATOMIC_CAS(&fb->wheel_pending, 0, 1)) {
+                uint32_t row = (uint32_t)(fb - flow_hash);
+                FlowWheel *w = FlowWheelForRow(row);
+                uint32_t idx = row - w->min;
+                uint32_t head;
+                do {
+                    head = SC_ATOMIC_GET(w->pending);
+                    w->pending_next[idx] = head;
+                } while (SC_ATOMIC_CAS(&w->pending, head, idx + 1) == 0);
+            }
+            return;
+        }
+        cur = SC_ATOMIC_GET(fb->wheel_ts);
+    }
+}
+
+/**
+ *  \brief schedule the row of a flow for the flow's timeout
+ *
+ *  Called when a flow is added to the hash or its state changed. The
+ *  normal (non emergency) timeout is used.
+ */
+void FlowWheelScheduleFlow(const Flow *f)
+{
+    if (flow_wheels == NULL || f->fb == NULL)
+        return;
+
+    uint32_t timeout = FlowGetFlowTimeout(f, SC_ATOMIC_GET(f->flow_state), 0);
+    FlowWheelScheduleRow(f->fb, (uint32_t)f->lastts.tv_sec + timeout + 1);
+}
+
+/**
+ *  \brief set the next time for a row that was due
+ *
+ *  If a worker lowered the time in the meantime, the earliest of the two
+ *  is kept.
+ *
+ *  \param due time the row was due, as passed to the FlowWheelRowFunc
+ *  \param next next time, 0 if the row is empty
+ *
+ *  \warning the row needs to be locked
+ */
+void FlowWheelRowSetNext(FlowBucket *fb, uint32_t due, uint32_t next)
+{
+    uint32_t cur;
+    uint32_t want;
+    do {
+        cur = SC_ATOMIC_GET(fb->wheel_ts);
+        want = next;
+        if (cur != due && cur != 0 && (want == 0 || cur < want))
+            want = cur;
+    } while (SC_ATOMIC_CAS(&fb->wheel_ts, cur, want) == 0);
+}
+
+static void FlowWheelRemove(FlowWheel *w, uint32_t idx)
+{
+    uint16_t slot = w->slot[idx];
+    if (slot == 0)
+        return;
+
+    uint32_t *head = (slot <= FLOW_WHEEL_SLOTS) ?
+        &w->l0[slot - 1] : &w->l1[slot - 1 - FLOW_WHEEL_SLOTS];
+
+    if (w->prev[idx] != 0)
+        w->next[w->prev[idx] - 1] = w->next[idx];
+    else
+        *head = w->next[idx];
+    if (w->next[idx] != 0)
+        w->prev[w->next[idx] - 1] = w->prev[idx];
+
+    w->next[idx] = 0;
+    w->prev[idx] = 0;
+    w->slot[idx] = 0;
+    w->rows--;
+}
+
+static void FlowWheelInsert(FlowWheel *w, uint32_t idx, uint32_t ts)
+{
+    FlowWheelRemove(w, idx);
+
+    if (ts < w->cur)
+        ts = w->cur;
+    else if (ts - w->cur > FLOW_WHEEL_SPAN)
+        ts = w->cur + FLOW_WHEEL_SPAN;
+
+    uint16_t slot;
+    uint32_t *head;
+    if (ts - w->cur < FLOW_WHEEL_SLOTS) {
+        slot = (ts & FLOW_WHEEL_SLOT_MASK);
+        head = &w->l0[slot];
+        slot += 1;
+    } else {
+        slot = ((ts >> FLOW_WHEEL_L1_SHIFT) & FLOW_WHEEL_SLOT_MASK);
+        head = &w->l1[slot];
+        slot += 1 + FLOW_WHEEL_SLOTS;
+    }
+
+    w->prev[idx] = 0;
+    w->next[idx] = *head;
+    if (*head != 0)
+        w->prev[*head - 1] = idx + 1;
+    *head = idx + 1;
+    w->slot[idx] = slot;
+    w->rows++;
+}
+
+/** \internal
+ *  \brief place the rows from the pending stack in the wheel */
+static void FlowWheelTakePending(FlowWheel *w)
+{
+    uint32_t list;
+    do {
+        list = SC_ATOMIC_GET(w->pending);
+    } while (list != 0 && SC_ATOMIC_CAS(&w->pending, list, 0) == 0);
+
+    while (list != 0) {
+        uint32_t idx = list - 1;
+        list = w->pending_next[idx];
+
+        FlowBucket *fb = &flow_hash[w->min + idx];
+        /* clear before reading the time, so a later update is pushed again */
+        SC_ATOMIC_SET(fb->wheel_pending, 0);
+        uint32_t ts = SC_ATOMIC_GET(fb->wheel_ts);
+        if (ts != 0)
+            FlowWheelInsert(w, idx, ts);
+        else
+            FlowWheelRemove(w, idx);
+    }
+}
+
+/** \internal
+ *  \brief take all rows from a slot list and run them
+ *
+ *  \param early also run rows that are not due yet */
+static uint32_t FlowWheelRunList(FlowWheel *w, uint32_t *head, uint32_t now,
+        int early, FlowWheelRowFunc RowFunc, void *data)
+{
+    uint32_t cnt = 0;
+    uint32_t list = *head;
+    *head = 0;
+
+    /* detach first, so rows scheduled again go into a fresh list */
+    uint32_t idx;
+    for (idx = list; idx != 0; idx = w->next[idx - 1]) {
+        w->slot[idx - 1] = 0;
+        w->rows--;
+    }
+
+    while (list != 0) {
+        idx = list - 1;
+        list = w->next[idx];
+        w->next[idx] = 0;
+        w->prev[idx] = 0;
+
+        FlowBucket *fb = &flow_hash[w->min + idx];
+        uint32_t due = SC_ATOMIC_GET(fb->wheel_ts);
+        if (due != 0 && (early || due <= now))
+            cnt += RowFunc(fb, due, now, data);
+
+        uint32_t next = SC_ATOMIC_GET(fb->wheel_ts);
+        if (next != 0)
+            FlowWheelInsert(w, idx, next);
+    }
+    return cnt;
+}
+
+/** \internal
+ *  \brief move all rows into the slot of 'now' and continue from there
+ *
+ *  All slot lists are detached before the first row is inserted again,
+ *  as the slot of 'now' is one of them.
+ *
+ *  \param lower make rows that are due later than 'now' due at 'now', for
+ *         when the time went back and the due times are in the future
+ */
+static void FlowWheelRescheduleAll(FlowWheel *w, uint32_t now, int lower)
+{
+    uint32_t list = 0;
+    uint32_t s;
+
+    for (s = 0; s < 2 * FLOW_WHEEL_SLOTS; s++) {
+        uint32_t *head = (s < FLOW_WHEEL_SLOTS) ?
+            &w->l0[s] : &w->l1[s - FLOW_WHEEL_SLOTS];
+        while (*head != 0) {
+            uint32_t idx = *head - 1;
+            *head = w->next[idx];
+            w->slot[idx] = 0;
+            w->rows--;
+            w->prev[idx] = 0;
+            w->next[idx] = list;
+            list = idx + 1;
+        }
+    }
+
+    w->cur = now;
+    while (list != 0) {
+        uint32_t idx = list - 1;
+        list = w->next[idx];
+        w->next[idx] = 0;
+
+        if (lower) {
+            FlowBucket *fb = &flow_hash[w->min + idx];
+            uint32_t ts;
+            do {
+                ts = SC_ATOMIC_GET(fb->wheel_ts);
+            } while (ts > now && SC_ATOMIC_CAS(&fb->wheel_ts, ts, now) == 0);
+        }
+        FlowWheelInsert(w, idx, now);
+    }
+}
+
+/**
+ *  \brief run the timing wheel up to 'now'
+ *
+ *  Rows in the slots that are due are handed to 'RowFunc'. If 'want' is
+ *  set (emergency mode), rows of later slots are handed over as well,
+ *  soonest first, until 'want' flows have been timed out.
+ *
+ *  \param now current time in seconds
+ *  \param want number of flows to time out in emergency mode, 0 otherwise
+ *
+ *  \retval cnt number of flows timed out
+ */
+uint32_t FlowWheelRun(FlowWheel *w, uint32_t now, uint32_t want,
+        FlowWheelRowFunc RowFunc, void *data)
+{
+    uint32_t cnt = 0;
+
+    if (w->cur == 0)
+        w->cur = now;
+
+    w->lag = 0;
+    FlowWheelTakePending(w);
+
+    if (now < w->cur) {
+        /* time went back, e.g. the next pcap file starts earlier. The
+         * times the rows are due are meaningless now, so check all rows
+         * against the new time. */
+        SCLogDebug("time went back %u seconds, running all rows", w->cur - now);
+        FlowWheelRescheduleAll(w, now, 1);
+    } else if (now - w->cur > FLOW_WHEEL_SPAN) {
+        /* time jumped, e.g. with a pcap file: everything is due. Move all
+         * rows into the current slot. */
+        SCLogDebug("time jumped %u seconds, running all rows", now - w->cur);
+        w->lag = now - w->cur;
+        FlowWheelRescheduleAll(w, now, 0);
+    }
+
+    while (w->cur <= now) {
+        /* start of a level 1 slot: move its rows to level 0 */
+        if ((w->cur & FLOW_WHEEL_SLOT_MASK) == 0) {
+            uint32_t *l1 = &w->l1[(w->cur >> FLOW_WHEEL_L1_SHIFT) & FLOW_WHEEL_SLOT_MASK];
+            while (*l1 != 0) {
+                uint32_t idx = *l1 - 1;
+                FlowWheelInsert(w, idx, SC_ATOMIC_GET(flow_hash[w->min + idx].wheel_ts));
+            }
+        }
+
+        uint32_t *l0 = &w->l0[w->cur & FLOW_WHEEL_SLOT_MASK];
+        if (*l0 != 0) {
+            if (now - w->cur > w->lag)
+                w->lag = now - w->cur;
+            cnt += FlowWheelRunList(w, l0, now, 0, RowFunc, data);
+        }
+        w->cur++;
+    }
+
+    if (want == 0)
+        return cnt;
+
+    /* emergency: rows that are due soonest are the most likely to have
+     * flows that time out with the emergency timeouts */
+    uint32_t s;
+    for (s = 0; s < FLOW_WHEEL_SLOTS && cnt < want; s++) {
+        uint32_t *l0 = &w->l0[(w->cur + s) & FLOW_WHEEL_SLOT_MASK];
+        if (*l0 != 0)
+            cnt += FlowWheelRunList(w, l0, now, 1, RowFunc, data);
+    }
+    for (s = 1; s < FLOW_WHEEL_SLOTS && cnt < want; s++) {
+        uint32_t *l1 = &w->l1[((w->cur >> FLOW_WHEEL_L1_SHIFT) + s) & FLOW_WHEEL_SLOT_MASK];
+        if (*l1 != 0)
+            cnt += FlowWheelRunList(w, l1, now, 1, RowFunc, data);
+    }
+    return cnt;
+}
+
+#ifdef UNITTESTS
+typedef struct FlowWheelTestData_ {
+    uint32_t seen;
+    uint32_t delta;     /**< next time is now + delta, 0 for empty row */
+} FlowWheelTestData;
+
+static uint32_t FlowWheelTestRowFunc(FlowBucket *fb, uint32_t due,
+        uint32_t now, void *data)
+{
+    FlowWheelTestData *td = data;
+    td->seen++;
+    FlowWheelRowSetNext(fb, due, td->delta ? now + td->delta : 0);
+    return 1;
+}
+
+/** \test rows are handed over when they are due, and not before */
+static int FlowWheelTest01(void)
+{
+    FlowWheelTestData td = { 0, 100 };
+
+    FlowInitConfig(FLOW_QUIET);
+    FAIL_IF(FlowWheelsInit(2) != 0);
+
+    FlowWheel *w = FlowWheelGet(1);
+    FAIL_IF_NULL(w);
+    FAIL_IF(w->min != flow_config.hash_size / 2);
+    FAIL_IF(FlowWheelRun(w, 1000, 0, FlowWheelTestRowFunc, &td) != 0);
+
+    FlowBucket *fb = &flow_hash[w->min + 5];
+    FlowWheelScheduleRow(fb, 1010);
+    FAIL_IF(SC_ATOMIC_GET(fb->wheel_ts) != 1010);
+    /* later time is ignored */
+    FlowWheelScheduleRow(fb, 1020);
+    FAIL_IF(SC_ATOMIC_GET(fb->wheel_ts) != 1010);
+
+    FAIL_IF(FlowWheelRun(w, 1009, 0, FlowWheelTestRowFunc, &td) != 0);
+    FAIL_IF(w->rows != 1);
+    FAIL_IF(td.seen != 0);
+
+    FAIL_IF(FlowWheelRun(w, 1012, 0, FlowWheelTestRowFunc, &td) != 1);
+    FAIL_IF(td.seen != 1);
+    FAIL_IF(w->lag != 2);
+    /* scheduled again */
+    FAIL_IF(SC_ATOMIC_GET(fb->wheel_ts) != 1112);
+    FAIL_IF(w->rows != 1);
+
+    /* earlier time moves the row */
+    FlowWheelScheduleRow(fb, 1050);
+    FAIL_IF(FlowWheelRun(w, 1050, 0, FlowWheelTestRowFunc, &td) != 1);
+    FAIL_IF(td.seen != 2);
+    FAIL_IF(w->rows != 1);
+
+    FlowShutdown();
+    PASS;
+}
+
+/** \test level 1 slots and emergency mode */
+static int FlowWheelTest02(void)
+{
+    FlowWheelTestData td = { 0, 0 };
+
+    FlowInitConfig(FLOW_QUIET);
+    FAIL_IF(FlowWheelsInit(1) != 0);
+    FlowWheel *w = FlowWheelGet(0);
+    FAIL_IF_NULL(w);
+    FAIL_IF(FlowWheelRun(w, 1000, 0, FlowWheelTestRowFunc, &td) != 0);
+
+    FlowWheelScheduleRow(&flow_hash[1], 4000);
+    FlowWheelScheduleRow(&flow_hash[2], 1010);
+    FAIL_IF(FlowWheelRun(w, 1001, 0, FlowWheelTestRowFunc, &td) != 0);
+    FAIL_IF(w->slot[1] <= FLOW_WHEEL_SLOTS);
+    FAIL_IF(w->slot[2] == 0 || w->slot[2] > FLOW_WHEEL_SLOTS);
+
+    FAIL_IF(FlowWheelRun(w, 3999, 0, FlowWheelTestRowFunc, &td) != 1);
+    FAIL_IF(SC_ATOMIC_GET(flow_hash[2].wheel_ts) != 0);
+    FAIL_IF(FlowWheelRun(w, 4000, 0, FlowWheelTestRowFunc, &td) != 1);
+    FAIL_IF(td.seen != 2);
+    FAIL_IF(w->rows != 0);
+
+    /* emergency: rows are handed over early, soonest first */
+    FlowWheelScheduleRow(&flow_hash[1], 5000);
+    FlowWheelScheduleRow(&flow_hash[2], 4100);
+    FAIL_IF(FlowWheelRun(w, 4001, 1, FlowWheelTestRowFunc, &td) != 1);
+    FAIL_IF(SC_ATOMIC_GET(flow_hash[2].wheel_ts) != 0);
+    FAIL_IF(SC_ATOMIC_GET(flow_hash[1].wheel_ts) != 5000);
+    FAIL_IF(FlowWheelRun(w, 4001, 1, FlowWheelTestRowFunc, &td) != 1);
+    FAIL_IF(w->rows != 0);
+
+    FlowShutdown();
+    PASS;
+}
+
+/** \test new flows schedule their row */
+static int FlowWheelTest03(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    FAIL_IF(FlowWheelsInit(1) != 0);
+
+    Packet *p = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "1.2.3.4", "5.6.7.8",
+                                   1024, 80);
+    FAIL_IF_NULL(p);
+    p->ts.tv_sec = 2000;
+
+    Flow *f = FlowGetFlowFromHash(NULL, NULL, p, &p->flow);
+    FAIL_IF_NULL(f);
+    FLOWLOCK_UNLOCK(f);
+
+    uint32_t timeout = flow_proto[f->protomap].new_timeout;
+    FAIL_IF(SC_ATOMIC_GET(f->fb->wheel_ts) != 2000 + timeout + 1);
+    FAIL_IF(SC_ATOMIC_GET(f->fb->wheel_pending) != 1);
+
+    FlowDeReference(&p->flow);
+    UTHFreePacket(p);
+    FlowShutdown();
+    PASS;
+}
+
+/** \test time jumps forward into the slot of a scheduled row, and back */
+static int FlowWheelTest04(void)
+{
+    FlowWheelTestData td = { 0, 0 };
+
+    FlowInitConfig(FLOW_QUIET);
+    FAIL_IF(FlowWheelsInit(1) != 0);
+    FlowWheel *w = FlowWheelGet(0);
+    FAIL_IF_NULL(w);
+    FAIL_IF(FlowWheelRun(w, 1000, 0, FlowWheelTestRowFunc, &td) != 0);
+
+    /* the new time maps to the same level 0 slot as the row */
+    uint32_t now = 1010 + 300 * FLOW_WHEEL_SLOTS;
+    FlowWheelScheduleRow(&flow_hash[1], 1010);
+    FlowWheelScheduleRow(&flow_hash[2], 3000);
+    FAIL_IF(FlowWheelRun(w, 1001, 0, FlowWheelTestRowFunc, &td) != 0);
+    FAIL_IF(w->rows != 2);
+
+    td.delta = 10;
+    FAIL_IF(FlowWheelRun(w, now, 0, FlowWheelTestRowFunc, &td) != 2);
+    FAIL_IF(td.seen != 2);
+    FAIL_IF(w->lag != now - 1002);
+    FAIL_IF(w->cur != now + 1);
+    FAIL_IF(w->rows != 2);
+    FAIL_IF(SC_ATOMIC_GET(flow_hash[1].wheel_ts) != now + 10);
+
+    /* time goes back: rows due in the future are run right away */
+    td.delta = 0;
+    FAIL_IF(FlowWheelRun(w, 2000, 0, FlowWheelTestRowFunc, &td) != 2);
+    FAIL_IF(td.seen != 4);
+    FAIL_IF(w->cur != 2001);
+    FAIL_IF(w->rows != 0);
+
+    FlowShutdown();
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void FlowWheelRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowWheelTest01", FlowWheelTest01);
+    UtRegisterTest("FlowWheelTest02", FlowWheelTest02);
+    UtRegisterTest("FlowWheelTest03", FlowWheelTest03);
+    UtRegisterTest("FlowWheelTest04", FlowWheelTest04);
+#endif /* UNITTESTS */
+}
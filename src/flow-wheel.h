@@ -0,0 +1,85 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * See the .c file for a full explanation.
+ */
+
+#ifndef __FLOW_WHEEL_H__
+#define __FLOW_WHEEL_H__
+
+#include "flow-hash.h"
+
+/** number of slots per wheel level */
+#define FLOW_WHEEL_SLOTS        256
+#define FLOW_WHEEL_SLOT_MASK    (FLOW_WHEEL_SLOTS - 1)
+/** level 0 slots are 1 second, level 1 slots are 256 seconds */
+#define FLOW_WHEEL_L1_SHIFT     8
+/** max time ahead a row can be scheduled, later times are clamped */
+#define FLOW_WHEEL_SPAN         ((FLOW_WHEEL_SLOTS - 1) << FLOW_WHEEL_L1_SHIFT)
+
+/** \brief timing wheel of hash rows for one flow manager
+ *
+ *  Row indexes stored in the lists are relative to 'min' and +1, so 0
+ *  means 'none'. Only the pending stack is shared with other threads,
+ *  everything else is owned by the flow manager thread.
+ */
+typedef struct FlowWheel_ {
+    uint32_t min;               /**< first hash row of this wheel */
+    uint32_t size;              /**< number of hash rows */
+
+    uint32_t cur;               /**< next second to process, 0 if unset */
+    uint32_t rows;              /**< rows currently in the wheel */
+    uint32_t lag;               /**< max seconds a slot was late, last run */
+
+    uint32_t l0[FLOW_WHEEL_SLOTS];  /**< 1 second slots, list heads */
+    uint32_t l1[FLOW_WHEEL_SLOTS];  /**< 256 second slots, list heads */
+
+    uint32_t *next;             /**< per row: next row in slot list */
+    uint32_t *prev;             /**< per row: prev row in slot list */
+    uint16_t *slot;             /**< per row: slot + 1, 0 if not in wheel */
+
+    /** rows with a new, earlier, time. Pushed by the workers. */
+    SC_ATOMIC_DECLARE(uint32_t, pending);
+    uint32_t *pending_next;     /**< per row: next row on the pending stack */
+} FlowWheel;
+
+/** \brief process a hash row that is due
+ *
+ *  Needs to set the next time for the row with FlowWheelRowSetNext()
+ *  while still holding the row lock.
+ *
+ *  \retval cnt number of flows timed out */
+typedef uint32_t (*FlowWheelRowFunc)(FlowBucket *fb, uint32_t due,
+        uint32_t now, void *data);
+
+int FlowWheelsInit(uint32_t cnt);
+void FlowWheelsFree(void);
+FlowWheel *FlowWheelGet(uint32_t id);
+
+void FlowWheelScheduleRow(FlowBucket *fb, uint32_t ts);
+void FlowWheelScheduleFlow(const Flow *f);
+void FlowWheelRowSetNext(FlowBucket *fb, uint32_t due, uint32_t next);
+
+uint32_t FlowWheelRun(FlowWheel *w, uint32_t now, uint32_t want,
+        FlowWheelRowFunc RowFunc, void *data);
+
+void FlowWheelRegisterTests(void);
+
+#endif /* __FLOW_WHEEL_H__ */
@@ -35,6 +35,7 @@
 #include "suricata.h"
 
 #include "decode.h"
+#include "flow-hash.h"
 #include "stream-tcp.h"
 #include "app-layer.h"
 #include "detect-engine.h"
@@ -83,6 +84,9 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, void *initdata, void **data)
         return TM_ECODE_FAILED;
     }
 
+    /* private part of the flow hash if flow.sharded is enabled */
+    fw->dtv->flow_shard = FlowShardNew();
+
     /* setup TCP */
     BUG_ON(StreamTcpThreadInit(tv, NULL, &fw->stream_thread_ptr) != TM_ECODE_OK);
 
@@ -110,6 +114,8 @@ static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data)
 {
     FlowWorkerThreadData *fw = data;
 
+    FlowShardFree(fw->dtv->flow_shard);
+    fw->dtv->flow_shard = NULL;
     DecodeThreadVarsFree(tv, fw->dtv);
 
     /* free TCP */
@@ -43,6 +43,7 @@
 #include "flow-timeout.h"
 #include "flow-manager.h"
 #include "flow-storage.h"
+#include "flow-wheel.h"
 
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
@@ -82,6 +83,9 @@ SC_ATOMIC_DECLARE(unsigned int, flow_prune_idx);
 /** atomic flags */
 SC_ATOMIC_DECLARE(unsigned int, flow_flags);
 
+/** number of flow hash shards handed out, see FlowShardNew() */
+SC_ATOMIC_DECLARE(uint32_t, flow_shard_cnt);
+
 void FlowRegisterTests(void);
 void FlowInitFlowProto();
 int FlowSetProtoTimeout(uint8_t , uint32_t ,uint32_t ,uint32_t);
@@ -300,6 +304,7 @@ void FlowInitConfig(char quiet)
     SC_ATOMIC_INIT(flow_flags);
     SC_ATOMIC_INIT(flow_memuse);
     SC_ATOMIC_INIT(flow_prune_idx);
+    SC_ATOMIC_INIT(flow_shard_cnt);
     FlowQueueInit(&flow_spare_q);
     FlowQueueInit(&flow_recycle_q);
 
@@ -355,6 +360,10 @@ void FlowInitConfig(char quiet)
             flow_config.prealloc = configval;
         }
     }
+    int sharded = 0;
+    if (ConfGetBool("flow.sharded", &sharded) == 1 && sharded == 1) {
+        flow_config.sharded = 1;
+    }
     SCLogDebug("Flow config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, flow_config.memcap,
                flow_config.hash_size, flow_config.prealloc);
@@ -445,6 +454,9 @@ void FlowShutdown(void)
         FlowFree(f);
     }
 
+    /* the timing wheels refer to the hash */
+    FlowWheelsFree();
+
     /* clear and free the hash */
     if (flow_hash != NULL) {
         /* clean up flow mutexes */
@@ -1071,6 +1083,146 @@ static int FlowTest09 (void)
     return result;
 }
 
+/**
+ *  \test   Test the bucket tag array with multiple flows in one bucket
+ */
+static int FlowTest10(void)
+{
+    Packet *p[FLOW_BUCKET_TAGS + 1];
+    Flow *f[FLOW_BUCKET_TAGS + 1];
+    int i;
+
+    FlowInitConfig(FLOW_QUIET);
+
+    for (i = 0; i < FLOW_BUCKET_TAGS + 1; i++) {
+        p[i] = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "1.2.3.4", "5.6.7.8",
+                                  1024 + i, 53);
+        FAIL_IF_NULL(p[i]);
+        /* same bucket, different tags */
+        p[i]->flow_hash = 1 + (uint32_t)i * flow_config.hash_size;
+
+        f[i] = FlowGetFlowFromHash(NULL, NULL, p[i], &p[i]->flow);
+        FAIL_IF_NULL(f[i]);
+        FLOWLOCK_UNLOCK(f[i]);
+        FAIL_IF(f[i]->fb != f[0]->fb);
+    }
+
+    /* most recent flows are tagged, the first one dropped out */
+    FlowBucket *fb = f[0]->fb;
+    for (i = 0; i < FLOW_BUCKET_TAGS; i++) {
+        FAIL_IF(fb->tag_flow[i] != f[FLOW_BUCKET_TAGS - i]);
+        FAIL_IF(fb->tag[i] != FLOW_HASH_TAG(p[FLOW_BUCKET_TAGS - i]->flow_hash));
+    }
+
+    /* found through the tag array */
+    Flow *ref = NULL;
+    Flow *x = FlowGetFlowFromHash(NULL, NULL, p[2], &ref);
+    FAIL_IF(x != f[2]);
+    FLOWLOCK_UNLOCK(x);
+    FlowDeReference(&ref);
+    FAIL_IF(fb->tag_flow[0] != f[2]);
+
+    /* found through the list and tagged again */
+    x = FlowGetFlowFromHash(NULL, NULL, p[0], &ref);
+    FAIL_IF(x != f[0]);
+    FLOWLOCK_UNLOCK(x);
+    FlowDeReference(&ref);
+    FAIL_IF(fb->tag_flow[0] != f[0]);
+    FAIL_IF(fb->head != f[0]);
+
+    for (i = 0; i < FLOW_BUCKET_TAGS + 1; i++) {
+        FlowDeReference(&p[i]->flow);
+        UTHFreePacket(p[i]);
+    }
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test flow hash shard: lookups stay in the shard's part of the hash
+ *        and spare flows are taken from the global queue in batches
+ */
+static int FlowTest11(void)
+{
+    Packet *p[8];
+    DecodeThreadVars dtv;
+    int i;
+
+    FlowInitConfig(FLOW_QUIET);
+    uint32_t spare = flow_spare_q.len;
+    FAIL_IF(spare < FLOW_SHARD_SPARE_BATCH);
+
+    FlowShard *s = SCCalloc(1, sizeof(*s));
+    FAIL_IF_NULL(s);
+    FlowQueueInit(&s->spare_q);
+    s->id = 2;
+    FlowShardSetRange(s, 4);
+    FAIL_IF(s->size != flow_config.hash_size / 4);
+    FAIL_IF(s->min != 2 * s->size);
+
+    memset(&dtv, 0x00, sizeof(dtv));
+    dtv.flow_shard = s;
+
+    for (i = 0; i < 8; i++) {
+        p[i] = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "1.2.3.4", "5.6.7.8",
+                                  1024 + i, 80);
+        FAIL_IF_NULL(p[i]);
+        p[i]->flow_hash = (uint32_t)i * 7919;
+
+        Flow *f = FlowGetFlowFromHash(NULL, &dtv, p[i], &p[i]->flow);
+        FAIL_IF_NULL(f);
+        FLOWLOCK_UNLOCK(f);
+
+        const FlowBucket *first = &flow_hash[s->min];
+        FAIL_IF(f->fb < first || f->fb >= first + s->size);
+    }
+
+    /* one batch was moved to the shard */
+    FAIL_IF(flow_spare_q.len != spare - FLOW_SHARD_SPARE_BATCH);
+    FAIL_IF(s->spare_q.len != FLOW_SHARD_SPARE_BATCH - 8);
+
+    /* unused spares go back to the global queue */
+    FlowShardFree(s);
+    FAIL_IF(flow_spare_q.len != spare - 8);
+
+    for (i = 0; i < 8; i++) {
+        FlowDeReference(&p[i]->flow);
+        UTHFreePacket(p[i]);
+    }
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test layout: members used by lookup and per packet handling are on
+ *        the first cache lines of the (aligned) flow
+ */
+static int FlowTest12(void)
+{
+    /* a hash row walk only needs the first line */
+    FAIL_IF(offsetof(Flow, hprev) + sizeof(void *) > CLS);
+    FAIL_IF(offsetof(Flow, flow_hash) + sizeof(uint32_t) > CLS);
+
+    /* lock, lastts, flags and state on the 2nd line. Depends on the size
+     * of the lock, 40 bytes for a mutex on 64 bit Linux. */
+    if (sizeof(SCMutex) <= 40) {
+        FAIL_IF(offsetof(Flow, lastts) < CLS);
+        FAIL_IF(offsetof(Flow, flags) + sizeof(uint32_t) > 2 * CLS);
+    }
+
+    /* cold members come after the hot ones */
+    FAIL_IF(offsetof(Flow, startts) < offsetof(Flow, alstate));
+    FAIL_IF(offsetof(Flow, flowvar) < offsetof(Flow, sgh_toserver));
+
+    FlowInitConfig(FLOW_QUIET);
+    Flow *f = FlowAlloc();
+    FAIL_IF_NULL(f);
+    FAIL_IF(((uintptr_t)f & (CLS - 1)) != 0);
+    FlowFree(f);
+    FlowShutdown();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -1088,8 +1240,12 @@ void FlowRegisterTests (void)
                    FlowTest08);
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap",
                    FlowTest09);
+    UtRegisterTest("FlowTest10 -- Test flow bucket tag array", FlowTest10);
+    UtRegisterTest("FlowTest11 -- Test flow hash shard", FlowTest11);
+    UtRegisterTest("FlowTest12 -- Test flow cache line layout", FlowTest12);
 
     FlowMgrRegisterTests();
+    FlowWheelRegisterTests();
     RegisterFlowStorageTests();
 #endif /* UNITTESTS */
 }
@@ -105,6 +105,16 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 #define FLOW_FILE_NO_SIZE_TS              0x40000000
 #define FLOW_FILE_NO_SIZE_TC              0x80000000
 
+/* per flow file flags, in Flow::file_flags */
+
+/** no sha1 on files in this flow */
+#define FLOWFILE_NO_SHA1_TS               0x01
+#define FLOWFILE_NO_SHA1_TC               0x02
+
+/** no sha256 on files in this flow */
+#define FLOWFILE_NO_SHA256_TS             0x04
+#define FLOWFILE_NO_SHA256_TC             0x08
+
 #define FLOW_IS_IPV4(f) \
     (((f)->flags & FLOW_IPV4) == FLOW_IPV4)
 #define FLOW_IS_IPV6(f) \
@@ -238,6 +248,9 @@ typedef struct FlowCnf_
     uint32_t emerg_timeout_est;
     uint32_t emergency_recovery;
 
+    /** each worker thread uses its own part of the hash (flow.sharded) */
+    int sharded;
+
 } FlowConfig;
 
 /* Hash key for the flow hash */
@@ -295,6 +308,21 @@ typedef uint16_t FlowThreadId;
  *  The flow "header" (addresses, ports, proto, recursion level) are static
  *  after the initialization and remain read-only throughout the entire live
  *  of a flow. This is why we can access those without protection of the lock.
+ *
+ *  Layout
+ *
+ *  The members are grouped by how often they are used, so that the flow
+ *  lookup and per packet handling touch as few cache lines as possible:
+ *
+ *  - line 1: flow "header" and hash list pointers, all a hash lookup needs
+ *  - line 2: lock, last timestamp, flags and the atomic state/refcnt
+ *  - line 3: protocol, app-layer and detection pointers
+ *  - after that: per packet counters, then data that is only used at flow
+ *    setup, app-layer detection, logging or by the queues.
+ *
+ *  The struct is cache line aligned, so the lines above are real cache
+ *  lines. The line sizes assume the default FLOWLOCK_MUTEX on 64 bit
+ *  Linux; FlowTest12 checks the first two.
  */
 
 typedef struct Flow_
@@ -317,12 +345,29 @@ typedef struct Flow_
     /** flow hash - the flow hash before hash table size mod. */
     uint32_t flow_hash;
 
+    /* end of flow "header" */
+
+    /** hash list pointers, protected by fb->s. On the header line, so
+     *  walking a hash row costs one cache line per flow. */
+    struct Flow_ *hnext; /* hash list */
+    struct Flow_ *hprev;
+
+    /* line 2: per packet flow handling */
+
+#ifdef FLOWLOCK_RWLOCK
+    SCRWLock r;
+#elif defined FLOWLOCK_MUTEX
+    SCMutex m;
+#else
+    #error Enable FLOWLOCK_RWLOCK or FLOWLOCK_MUTEX
+#endif
+
     /* time stamp of last update (last packet). Set/updated under the
      * flow and flow hash row locks, safe to read under either the
      * flow lock or flow hash row lock. */
     struct timeval lastts;
 
-    /* end of flow "header" */
+    uint32_t flags;
 
     SC_ATOMIC_DECLARE(FlowStateType, flow_state);
 
@@ -334,84 +379,83 @@ typedef struct Flow_
      */
     SC_ATOMIC_DECLARE(FlowRefCount, use_cnt);
 
-    /** flow tenant id, used to setup flow timeout and stream pseudo
-     *  packets with the correct tenant id set */
-    uint32_t tenant_id;
+    /* line 3: stream, app-layer and detection */
 
-    uint32_t probing_parser_toserver_alproto_masks;
-    uint32_t probing_parser_toclient_alproto_masks;
+    /** protocol specific data pointer, e.g. for TcpSession */
+    void *protoctx;
 
-    uint32_t flags;
+    /** application level storage ptrs.
+     *
+     */
+    AppLayerParserState *alparser;     /**< parser internal state */
+    void *alstate;      /**< application layer state */
 
-#ifdef FLOWLOCK_RWLOCK
-    SCRWLock r;
-#elif defined FLOWLOCK_MUTEX
-    SCMutex m;
-#else
-    #error Enable FLOWLOCK_RWLOCK or FLOWLOCK_MUTEX
-#endif
+    /** detection engine state */
+    struct DetectEngineStateFlow_ *de_state;
 
-    /** protocol specific data pointer, e.g. for TcpSession */
-    void *protoctx;
+    /** toclient sgh for this flow. Only use when FLOW_SGH_TOCLIENT flow flag
+     *  has been set. */
+    struct SigGroupHead_ *sgh_toclient;
+    /** toserver sgh for this flow. Only use when FLOW_SGH_TOSERVER flow flag
+     *  has been set. */
+    struct SigGroupHead_ *sgh_toserver;
+
+    /** hash row of the flow, protected by fb->s */
+    struct FlowBucket_ *fb;
 
     /** mapping to Flow's protocol specific protocols for timeouts
         and state and free functions. */
     uint8_t protomap;
 
-    uint8_t flow_end_flags;
-    /* coccinelle: Flow:flow_end_flags:FLOW_END_FLAG_ */
-
     AppProto alproto; /**< \brief application level protocol */
-    AppProto alproto_ts;
-    AppProto alproto_tc;
 
-    uint32_t data_al_so_far[2];
+    /** Thread ID for the stream/detect portion of this flow */
+    FlowThreadId thread_id;
+
+    /** detect state 'alversion' inspected for both directions */
+    uint8_t detect_alversion[2];
+
+    /* updated for each packet, but not needed for lookup */
+
+    uint32_t todstpktcnt;
+    uint32_t tosrcpktcnt;
+    uint64_t todstbytecnt;
+    uint64_t tosrcbytecnt;
 
     /** detection engine ctx id used to inspect this flow. Set at initial
      *  inspection. If it doesn't match the currently in use de_ctx, the
      *  de_state and stored sgh ptrs are reset. */
     uint32_t de_ctx_id;
 
-    /** Thread ID for the stream/detect portion of this flow */
-    FlowThreadId thread_id;
+    /* cold: flow setup, app-layer detection, logging and queues */
 
-    /** detect state 'alversion' inspected for both directions */
-    uint8_t detect_alversion[2];
+    AppProto alproto_ts;
+    AppProto alproto_tc;
 
-    /** application level storage ptrs.
-     *
-     */
-    AppLayerParserState *alparser;     /**< parser internal state */
-    void *alstate;      /**< application layer state */
+    uint32_t data_al_so_far[2];
 
-    /** detection engine state */
-    struct DetectEngineStateFlow_ *de_state;
+    uint32_t probing_parser_toserver_alproto_masks;
+    uint32_t probing_parser_toclient_alproto_masks;
 
-    /** toclient sgh for this flow. Only use when FLOW_SGH_TOCLIENT flow flag
-     *  has been set. */
-    struct SigGroupHead_ *sgh_toclient;
-    /** toserver sgh for this flow. Only use when FLOW_SGH_TOSERVER flow flag
-     *  has been set. */
-    struct SigGroupHead_ *sgh_toserver;
+    /** flow tenant id, used to setup flow timeout and stream pseudo
+     *  packets with the correct tenant id set */
+    uint32_t tenant_id;
+
+    uint8_t flow_end_flags;
+    /* coccinelle: Flow:flow_end_flags:FLOW_END_FLAG_ */
+
+    /** FLOWFILE_* flags, for the file flags that didn't fit in flags */
+    uint8_t file_flags;
+
+    struct timeval startts;
 
     /* pointer to the var list */
     GenericVar *flowvar;
 
-    /** hash list pointers, protected by fb->s */
-    struct Flow_ *hnext; /* hash list */
-    struct Flow_ *hprev;
-    struct FlowBucket_ *fb;
-
     /** queue list pointers, protected by queue mutex */
     struct Flow_ *lnext; /* list */
     struct Flow_ *lprev;
-    struct timeval startts;
-
-    uint32_t todstpktcnt;
-    uint32_t tosrcpktcnt;
-    uint64_t todstbytecnt;
-    uint64_t tosrcbytecnt;
-} Flow;
+} __attribute__((aligned(CLS))) Flow;
 
 enum {
     FLOW_STATE_NEW = 0,
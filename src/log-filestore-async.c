@@ -0,0 +1,662 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Writer threads for the file-store output.
+ *
+ * The packet threads copy the file data into jobs and queue them to one of
+ * the writer threads, picked by file id so all jobs of a file are handled
+ * in order by the same thread. A writer thread takes all jobs queued to
+ * it at once, keeps the files it writes to open between jobs and hands
+ * consecutive chunks of the same file to a single writev call.
+ *
+ * The memory held by queued jobs is limited by a memcap. A packet thread
+ * that would go over it waits for the writers to catch up.
+ */
+
+#include "suricata-common.h"
+#include "threads.h"
+#include "counters.h"
+
+#include "log-filestore-async.h"
+
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-signal.h"
+#include "util-unittest.h"
+
+#include <sys/uio.h>
+
+/** files a writer thread keeps open */
+#define FILESTORE_ASYNC_MAX_FDS     64
+/** chunks handed to a single writev call */
+#define FILESTORE_ASYNC_MAX_IOV     64
+/** min seconds between open/write failure warnings of a writer thread */
+#define FILESTORE_ASYNC_WARN_INTERVAL 1
+
+typedef struct FilestoreAsyncJob_ {
+    uint32_t file_id;
+    uint32_t len;
+    uint8_t type;
+    struct FilestoreAsyncJob_ *next;
+    uint8_t data[];
+} FilestoreAsyncJob;
+
+typedef struct FilestoreAsyncFd_ {
+    uint32_t file_id;
+    int fd;
+    uint64_t last_use;
+} FilestoreAsyncFd;
+
+typedef struct FilestoreAsyncWorker_ {
+    pthread_t thread;
+    char name[16];
+
+    SCMutex mutex;
+    SCCondT cond;
+    FilestoreAsyncJob *head;
+    FilestoreAsyncJob *tail;
+    int stop;
+
+    /* only used by the writer thread */
+    FilestoreAsyncFd fds[FILESTORE_ASYNC_MAX_FDS];
+    uint64_t use_cnt;
+    time_t warn_ts;
+    uint64_t warn_suppressed;
+} FilestoreAsyncWorker;
+
+static FilestoreAsyncWorker *workers = NULL;
+static uint32_t workers_cnt = 0;
+static char base_dir[PATH_MAX] = "";
+static uint64_t filestore_async_memcap = 0;
+
+/* packet threads waiting for the memuse to drop below the memcap */
+static SCMutex wait_lock = SCMUTEX_INITIALIZER;
+static SCCondT wait_cond = PTHREAD_COND_INITIALIZER;
+
+SC_ATOMIC_DECLARE(uint64_t, filestore_async_memuse);
+SC_ATOMIC_DECLARE(uint64_t, filestore_async_backpressure);
+SC_ATOMIC_DECLARE(uint64_t, filestore_async_writes);
+SC_ATOMIC_DECLARE(uint64_t, filestore_async_chunks);
+static int counters_registered = 0;
+
+static uint64_t FilestoreAsyncMemuseCounter(void)
+{
+    return SC_ATOMIC_GET(filestore_async_memuse);
+}
+
+static uint64_t FilestoreAsyncBackpressureCounter(void)
+{
+    return SC_ATOMIC_GET(filestore_async_backpressure);
+}
+
+static uint64_t FilestoreAsyncWritesCounter(void)
+{
+    return SC_ATOMIC_GET(filestore_async_writes);
+}
+
+static uint64_t FilestoreAsyncChunksCounter(void)
+{
+    return SC_ATOMIC_GET(filestore_async_chunks);
+}
+
+/** \internal
+ *  \brief warn about a failed open or write
+ *
+ *  A full disk fails every write, so only one warning per
+ *  FILESTORE_ASYNC_WARN_INTERVAL is logged and the failures in between
+ *  are counted in the next one.
+ */
+static void FilestoreAsyncWarn(FilestoreAsyncWorker *w, SCError err,
+        const char *what, const char *filename, int errnum)
+{
+    time_t now = time(NULL);
+    if (w->warn_ts != 0 && now < w->warn_ts + FILESTORE_ASYNC_WARN_INTERVAL) {
+        w->warn_suppressed++;
+        return;
+    }
+
+    if (w->warn_suppressed > 0) {
+        SCLogWarning(err, "%s %s failed: %s (%"PRIu64" more failures "
+                "since the last warning)", what, filename, strerror(errnum),
+                w->warn_suppressed);
+    } else {
+        SCLogWarning(err, "%s %s failed: %s", what, filename,
+                strerror(errnum));
+    }
+    w->warn_ts = now;
+    w->warn_suppressed = 0;
+}
+
+static FilestoreAsyncFd *FilestoreAsyncFdGet(FilestoreAsyncWorker *w,
+        uint32_t file_id, int create)
+{
+    FilestoreAsyncFd *lru = &w->fds[0];
+    int i;
+
+    for (i = 0; i < FILESTORE_ASYNC_MAX_FDS; i++) {
+        FilestoreAsyncFd *afd = &w->fds[i];
+        if (afd->fd != -1 && afd->file_id == file_id) {
+            if (create) {
+                /* can't happen unless the file id wrapped */
+                close(afd->fd);
+                afd->fd = -1;
+                lru = afd;
+                break;
+            }
+            afd->last_use = ++w->use_cnt;
+            return afd;
+        }
+        if (lru->fd != -1 && (afd->fd == -1 || afd->last_use < lru->last_use))
+            lru = afd;
+    }
+
+    /* not open, take a free slot or close the least recently used file.
+     * Files that are closed this way are reopened for appending. */
+    if (lru->fd != -1) {
+        close(lru->fd);
+        lru->fd = -1;
+    }
+
+    char filename[PATH_MAX] = "";
+    snprintf(filename, sizeof(filename), "%s/file.%u", base_dir, file_id);
+
+    if (create)
+        lru->fd = open(filename, O_CREAT | O_TRUNC | O_NOFOLLOW | O_WRONLY, 0644);
+    else
+        lru->fd = open(filename, O_APPEND | O_NOFOLLOW | O_WRONLY);
+    if (lru->fd == -1) {
+        FilestoreAsyncWarn(w, SC_ERR_FOPEN, "opening", filename, errno);
+        return NULL;
+    }
+    lru->file_id = file_id;
+    lru->last_use = ++w->use_cnt;
+    return lru;
+}
+
+static void FilestoreAsyncFdClose(FilestoreAsyncWorker *w, uint32_t file_id)
+{
+    int i;
+    for (i = 0; i < FILESTORE_ASYNC_MAX_FDS; i++) {
+        if (w->fds[i].fd != -1 && w->fds[i].file_id == file_id) {
+            close(w->fds[i].fd);
+            w->fds[i].fd = -1;
+            return;
+        }
+    }
+}
+
+/** \internal
+ *  \brief write all of iov, handling short writes
+ *
+ *  \retval 0 ok
+ *  \retval -1 write failed, errno is set
+ */
+static int FilestoreAsyncWritev(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t r = writev(fd, iov, iovcnt);
+        (void)SC_ATOMIC_ADD(filestore_async_writes, 1);
+        if (r == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        size_t done = (size_t)r;
+        while (iovcnt > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return 0;
+}
+
+static void FilestoreAsyncAppendMeta(FilestoreAsyncWorker *w,
+        uint32_t file_id, const uint8_t *meta, uint32_t meta_len)
+{
+    char metafilename[PATH_MAX] = "";
+    snprintf(metafilename, sizeof(metafilename), "%s/file.%u.meta",
+            base_dir, file_id);
+
+    int fd = open(metafilename, O_APPEND | O_NOFOLLOW | O_WRONLY);
+    if (fd == -1) {
+        FilestoreAsyncWarn(w, SC_ERR_FOPEN, "opening", metafilename, errno);
+        return;
+    }
+    struct iovec iov = { (void *)meta, meta_len };
+    if (FilestoreAsyncWritev(fd, &iov, 1) != 0)
+        FilestoreAsyncWarn(w, SC_ERR_FWRITE, "writing", metafilename, errno);
+    close(fd);
+}
+
+/** \internal
+ *  \brief handle a list of jobs taken from a worker's queue
+ *
+ *  \retval size memory that was used by the jobs
+ */
+static uint64_t FilestoreAsyncProcess(FilestoreAsyncWorker *w,
+        FilestoreAsyncJob *job)
+{
+    struct iovec iov[FILESTORE_ASYNC_MAX_IOV];
+    FilestoreAsyncJob *batch[FILESTORE_ASYNC_MAX_IOV];
+    uint64_t size = 0;
+
+    while (job != NULL) {
+        FilestoreAsyncJob *next = job->next;
+        FilestoreAsyncFd *afd;
+        int i, cnt;
+
+        switch (job->type) {
+            case FILESTORE_ASYNC_OPEN:
+                (void)FilestoreAsyncFdGet(w, job->file_id, 1);
+                break;
+
+            case FILESTORE_ASYNC_WRITE:
+                /* collect the chunks of this file that follow */
+                cnt = 0;
+                do {
+                    batch[cnt] = job;
+                    iov[cnt].iov_base = job->data;
+                    iov[cnt].iov_len = job->len;
+                    cnt++;
+                    job = job->next;
+                } while (job != NULL && cnt < FILESTORE_ASYNC_MAX_IOV &&
+                         job->type == FILESTORE_ASYNC_WRITE &&
+                         job->file_id == batch[0]->file_id);
+                next = job;
+
+                afd = FilestoreAsyncFdGet(w, batch[0]->file_id, 0);
+                if (afd != NULL && FilestoreAsyncWritev(afd->fd, iov, cnt) != 0) {
+                    int errnum = errno;
+                    char filename[PATH_MAX] = "";
+                    snprintf(filename, sizeof(filename), "%s/file.%u",
+                            base_dir, afd->file_id);
+                    FilestoreAsyncWarn(w, SC_ERR_FWRITE, "writing", filename,
+                            errnum);
+                }
+                (void)SC_ATOMIC_ADD(filestore_async_chunks, cnt);
+
+                for (i = 0; i < cnt; i++) {
+                    size += sizeof(FilestoreAsyncJob) + batch[i]->len;
+                    SCFree(batch[i]);
+                }
+                job = next;
+                continue;
+
+            case FILESTORE_ASYNC_CLOSE:
+                FilestoreAsyncFdClose(w, job->file_id);
+                if (job->len > 0)
+                    FilestoreAsyncAppendMeta(w, job->file_id, job->data, job->len);
+                break;
+        }
+
+        size += sizeof(FilestoreAsyncJob) + job->len;
+        SCFree(job);
+        job = next;
+    }
+
+    return size;
+}
+
+static void *FilestoreAsyncThread(void *arg)
+{
+    FilestoreAsyncWorker *w = (FilestoreAsyncWorker *)arg;
+
+    /* usr2 is handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+
+    if (SCSetThreadName(w->name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    while (1) {
+        SCMutexLock(&w->mutex);
+        while (w->head == NULL && w->stop == 0)
+            SCCondWait(&w->cond, &w->mutex);
+        FilestoreAsyncJob *jobs = w->head;
+        w->head = w->tail = NULL;
+        int stop = w->stop;
+        SCMutexUnlock(&w->mutex);
+
+        if (jobs == NULL && stop)
+            break;
+
+        uint64_t size = FilestoreAsyncProcess(w, jobs);
+
+        (void)SC_ATOMIC_SUB(filestore_async_memuse, size);
+        SCMutexLock(&wait_lock);
+        SCCondBroadcast(&wait_cond);
+        SCMutexUnlock(&wait_lock);
+    }
+
+    int i;
+    for (i = 0; i < FILESTORE_ASYNC_MAX_FDS; i++) {
+        if (w->fds[i].fd != -1) {
+            close(w->fds[i].fd);
+            w->fds[i].fd = -1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ *  \brief Start the writer threads
+ *
+ *  \param dir directory the files are stored in
+ *  \param threads number of writer threads
+ *  \param memcap max memory held by queued jobs
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, files are written by the packet threads
+ */
+int LogFilestoreAsyncInit(const char *dir, uint32_t threads, uint64_t memcap)
+{
+    if (workers != NULL || threads == 0)
+        return -1;
+
+    strlcpy(base_dir, dir, sizeof(base_dir));
+    filestore_async_memcap = memcap;
+
+    if (!counters_registered) {
+        SC_ATOMIC_INIT(filestore_async_memuse);
+        SC_ATOMIC_INIT(filestore_async_backpressure);
+        SC_ATOMIC_INIT(filestore_async_writes);
+        SC_ATOMIC_INIT(filestore_async_chunks);
+
+        StatsRegisterGlobalCounter("file_store.async.memuse",
+                FilestoreAsyncMemuseCounter);
+        StatsRegisterGlobalCounter("file_store.async.backpressure",
+                FilestoreAsyncBackpressureCounter);
+        StatsRegisterGlobalCounter("file_store.async.writes",
+                FilestoreAsyncWritesCounter);
+        StatsRegisterGlobalCounter("file_store.async.chunks",
+                FilestoreAsyncChunksCounter);
+        counters_registered = 1;
+    }
+
+    workers = SCCalloc(threads, sizeof(FilestoreAsyncWorker));
+    if (unlikely(workers == NULL))
+        return -1;
+
+    uint32_t u;
+    for (u = 0; u < threads; u++) {
+        FilestoreAsyncWorker *w = &workers[u];
+        int i;
+
+        snprintf(w->name, sizeof(w->name), "FileStore#%02u", u + 1);
+        SCMutexInit(&w->mutex, NULL);
+        SCCondInit(&w->cond, NULL);
+        for (i = 0; i < FILESTORE_ASYNC_MAX_FDS; i++)
+            w->fds[i].fd = -1;
+
+        if (pthread_create(&w->thread, NULL, FilestoreAsyncThread, w) != 0) {
+            SCLogError(SC_ERR_THREAD_CREATE, "failed to start file-store "
+                    "writer thread: %s", strerror(errno));
+            SCMutexDestroy(&w->mutex);
+            SCCondDestroy(&w->cond);
+            break;
+        }
+        workers_cnt++;
+    }
+
+    if (workers_cnt == 0) {
+        SCFree(workers);
+        workers = NULL;
+        return -1;
+    }
+
+    SCLogConfig("file-store: %u writer threads, memcap %"PRIu64,
+            workers_cnt, memcap);
+    return 0;
+}
+
+/**
+ *  \brief Write out all queued jobs and stop the writer threads
+ */
+void LogFilestoreAsyncShutdown(void)
+{
+    if (workers == NULL)
+        return;
+
+    uint32_t u;
+    for (u = 0; u < workers_cnt; u++) {
+        FilestoreAsyncWorker *w = &workers[u];
+        SCMutexLock(&w->mutex);
+        w->stop = 1;
+        SCCondSignal(&w->cond);
+        SCMutexUnlock(&w->mutex);
+    }
+    for (u = 0; u < workers_cnt; u++) {
+        FilestoreAsyncWorker *w = &workers[u];
+        pthread_join(w->thread, NULL);
+        SCMutexDestroy(&w->mutex);
+        SCCondDestroy(&w->cond);
+    }
+
+    SCFree(workers);
+    workers = NULL;
+    workers_cnt = 0;
+}
+
+int LogFilestoreAsyncEnabled(void)
+{
+    return (workers != NULL);
+}
+
+/**
+ *  \brief Queue a job for the writer thread of a file
+ *
+ *  Waits if the queued jobs use more than the memcap. A single job larger
+ *  than the memcap is queued once the writers are idle.
+ *
+ *  \param file_id id of the file
+ *  \param type FILESTORE_ASYNC_OPEN, _WRITE or _CLOSE
+ *  \param data file data or for _CLOSE the text to append to the .meta
+ *              file. Copied.
+ *  \param data_len length of data
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int LogFilestoreAsyncQueue(uint32_t file_id, uint8_t type,
+        const uint8_t *data, uint32_t data_len)
+{
+    uint64_t size = sizeof(FilestoreAsyncJob) + data_len;
+
+    if (workers == NULL)
+        return -1;
+
+    if (SC_ATOMIC_GET(filestore_async_memuse) + size > filestore_async_memcap) {
+        (void)SC_ATOMIC_ADD(filestore_async_backpressure, 1);
+
+        SCMutexLock(&wait_lock);
+        while (SC_ATOMIC_GET(filestore_async_memuse) != 0 &&
+               SC_ATOMIC_GET(filestore_async_memuse) + size > filestore_async_memcap)
+        {
+            SCCondWait(&wait_cond, &wait_lock);
+        }
+        SCMutexUnlock(&wait_lock);
+    }
+
+    FilestoreAsyncJob *job = SCMalloc(size);
+    if (unlikely(job == NULL))
+        return -1;
+    job->file_id = file_id;
+    job->type = type;
+    job->len = data_len;
+    job->next = NULL;
+    if (data_len > 0)
+        memcpy(job->data, data, data_len);
+
+    (void)SC_ATOMIC_ADD(filestore_async_memuse, size);
+
+    FilestoreAsyncWorker *w = &workers[file_id % workers_cnt];
+    SCMutexLock(&w->mutex);
+    if (w->tail == NULL) {
+        w->head = job;
+    } else {
+        w->tail->next = job;
+    }
+    w->tail = job;
+    SCCondSignal(&w->cond);
+    SCMutexUnlock(&w->mutex);
+    return 0;
+}
+
+#ifdef UNITTESTS
+static char *FilestoreAsyncTestRead(const char *dir, const char *name,
+        size_t *len)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return NULL;
+    char *buf = SCCalloc(1, 1024 * 1024);
+    if (buf == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    *len = fread(buf, 1, 1024 * 1024 - 1, fp);
+    fclose(fp);
+    unlink(path);
+    return buf;
+}
+
+static void FilestoreAsyncTestMeta(const char *dir, uint32_t file_id)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/file.%u.meta", dir, file_id);
+    FILE *fp = fopen(path, "w");
+    if (fp != NULL) {
+        fprintf(fp, "TIME:              test\n");
+        fclose(fp);
+    }
+}
+
+/** \test chunks of interleaved files end up in the right file in order,
+ *        also when a writer has more files than it keeps open. The close
+ *        job appends to the .meta file. */
+static int FilestoreAsyncTest01(void)
+{
+    char dir[] = "/tmp/suricata-filestore-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+    FAIL_IF(LogFilestoreAsyncInit(dir, 1, 16 * 1024 * 1024) != 0);
+
+    uint32_t f;
+    int i;
+    for (f = 1; f <= FILESTORE_ASYNC_MAX_FDS + 10; f++) {
+        FilestoreAsyncTestMeta(dir, f);
+        FAIL_IF(LogFilestoreAsyncQueue(f, FILESTORE_ASYNC_OPEN, NULL, 0) != 0);
+    }
+    for (i = 0; i < 20; i++) {
+        for (f = 1; f <= FILESTORE_ASYNC_MAX_FDS + 10; f++) {
+            char chunk[16];
+            snprintf(chunk, sizeof(chunk), "%03u:%04d;", f, i);
+            FAIL_IF(LogFilestoreAsyncQueue(f, FILESTORE_ASYNC_WRITE,
+                        (uint8_t *)chunk, (uint32_t)strlen(chunk)) != 0);
+        }
+    }
+    for (f = 1; f <= FILESTORE_ASYNC_MAX_FDS + 10; f++) {
+        const char *meta = "STATE:             CLOSED\n";
+        FAIL_IF(LogFilestoreAsyncQueue(f, FILESTORE_ASYNC_CLOSE,
+                    (const uint8_t *)meta, (uint32_t)strlen(meta)) != 0);
+    }
+    LogFilestoreAsyncShutdown();
+    FAIL_IF(SC_ATOMIC_GET(filestore_async_memuse) != 0);
+
+    for (f = 1; f <= FILESTORE_ASYNC_MAX_FDS + 10; f++) {
+        char name[32];
+        size_t len = 0;
+        snprintf(name, sizeof(name), "file.%u", f);
+        char *data = FilestoreAsyncTestRead(dir, name, &len);
+        FAIL_IF_NULL(data);
+        FAIL_IF(len != 20 * 9);
+        for (i = 0; i < 20; i++) {
+            char chunk[16];
+            snprintf(chunk, sizeof(chunk), "%03u:%04d;", f, i);
+            FAIL_IF(memcmp(data + i * 9, chunk, 9) != 0);
+        }
+        SCFree(data);
+
+        snprintf(name, sizeof(name), "file.%u.meta", f);
+        data = FilestoreAsyncTestRead(dir, name, &len);
+        FAIL_IF_NULL(data);
+        FAIL_IF(strcmp(data, "TIME:              test\n"
+                             "STATE:             CLOSED\n") != 0);
+        SCFree(data);
+    }
+    FAIL_IF(rmdir(dir) != 0);
+    PASS;
+}
+
+/** \test a memcap smaller than the data makes the producer wait, but
+ *        everything is still written */
+static int FilestoreAsyncTest02(void)
+{
+    char dir[] = "/tmp/suricata-filestore-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+    FAIL_IF(LogFilestoreAsyncInit(dir, 1, 4096) != 0);
+    uint64_t waits = SC_ATOMIC_GET(filestore_async_backpressure);
+
+    uint8_t chunk[1000];
+    int i;
+    FilestoreAsyncTestMeta(dir, 1);
+    FAIL_IF(LogFilestoreAsyncQueue(1, FILESTORE_ASYNC_OPEN, NULL, 0) != 0);
+    for (i = 0; i < 200; i++) {
+        memset(chunk, 'a' + i % 26, sizeof(chunk));
+        FAIL_IF(LogFilestoreAsyncQueue(1, FILESTORE_ASYNC_WRITE,
+                    chunk, sizeof(chunk)) != 0);
+        FAIL_IF(SC_ATOMIC_GET(filestore_async_memuse) > 4096 + sizeof(chunk) +
+                sizeof(FilestoreAsyncJob));
+    }
+    FAIL_IF(LogFilestoreAsyncQueue(1, FILESTORE_ASYNC_CLOSE, NULL, 0) != 0);
+    LogFilestoreAsyncShutdown();
+    FAIL_IF(SC_ATOMIC_GET(filestore_async_backpressure) == waits);
+
+    size_t len = 0;
+    char *data = FilestoreAsyncTestRead(dir, "file.1", &len);
+    FAIL_IF_NULL(data);
+    FAIL_IF(len != 200 * sizeof(chunk));
+    for (i = 0; i < 200; i++) {
+        FAIL_IF(data[i * sizeof(chunk)] != 'a' + i % 26);
+    }
+    SCFree(data);
+    data = FilestoreAsyncTestRead(dir, "file.1.meta", &len);
+    FAIL_IF_NULL(data);
+    SCFree(data);
+    FAIL_IF(rmdir(dir) != 0);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void LogFilestoreAsyncRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FilestoreAsyncTest01", FilestoreAsyncTest01);
+    UtRegisterTest("FilestoreAsyncTest02", FilestoreAsyncTest02);
+#endif
+}
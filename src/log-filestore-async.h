@@ -0,0 +1,38 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __LOG_FILESTORE_ASYNC_H__
+#define __LOG_FILESTORE_ASYNC_H__
+
+/** job types */
+#define FILESTORE_ASYNC_OPEN    0   /**< create (truncate) the file */
+#define FILESTORE_ASYNC_WRITE   1   /**< append data to the file */
+#define FILESTORE_ASYNC_CLOSE   2   /**< close the file, append to .meta */
+
+int LogFilestoreAsyncInit(const char *base_dir, uint32_t threads,
+        uint64_t memcap);
+void LogFilestoreAsyncShutdown(void);
+int LogFilestoreAsyncEnabled(void);
+int LogFilestoreAsyncQueue(uint32_t file_id, uint8_t type,
+        const uint8_t *data, uint32_t data_len);
+void LogFilestoreAsyncRegisterTests(void);
+
+#endif /* __LOG_FILESTORE_ASYNC_H__ */
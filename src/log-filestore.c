@@ -40,6 +40,7 @@
 #include "stream.h"
 
 #include "util-print.h"
+#include "util-misc.h"
 #include "util-unittest.h"
 #include "util-privs.h"
 #include "util-debug.h"
@@ -50,6 +51,7 @@
 #include "output.h"
 
 #include "log-file.h"
+#include "log-filestore-async.h"
 #include "util-logopenfile.h"
 
 #include "app-layer-htp.h"
@@ -60,6 +62,13 @@
 
 #define MODULE_NAME "LogFilestoreLog"
 
+/** size of the text added to the .meta file on close, not counting the
+ *  magic string */
+#define FILESTORE_CLOSE_META_SIZE 512
+
+/** default max memory of the data queued for the writer threads */
+#define FILESTORE_ASYNC_DEFAULT_MEMCAP (32 * 1024 * 1024)
+
 static char g_logfile_base_dir[PATH_MAX] = "/tmp";
 
 typedef struct LogFilestoreLogThread_ {
@@ -237,6 +246,75 @@ static void LogFilestoreLogCreateMetaFile(const Packet *p, const File *ff, char
     }
 }
 
+/** \internal
+ *  \brief format the lines added to the .meta file when the file is closed
+ *
+ *  The buffer is sized for the magic string, which has no upper bound.
+ *
+ *  \param len set to the length of the text in the returned buffer
+ *
+ *  \retval buf text to free with SCFree
+ *  \retval NULL out of memory
+ */
+static char *LogFilestoreLogCloseMetaFormat(const File *ff, uint32_t *len)
+{
+    const char *magic = ff->magic ? ff->magic : "<unknown>";
+    uint32_t offset = 0;
+    uint32_t size = FILESTORE_CLOSE_META_SIZE + strlen(magic);
+
+    char *buf = SCMalloc(size);
+    if (unlikely(buf == NULL))
+        return NULL;
+
+    PrintBufferData(buf, &offset, size, "MAGIC:             %s\n", magic);
+
+    switch (ff->state) {
+        case FILE_STATE_CLOSED:
+            PrintBufferData(buf, &offset, size, "STATE:             CLOSED\n");
+#ifdef HAVE_NSS
+            if (ff->flags & FILE_MD5) {
+                PrintBufferData(buf, &offset, size, "MD5:               ");
+                size_t x;
+                for (x = 0; x < sizeof(ff->md5); x++) {
+                    PrintBufferData(buf, &offset, size, "%02x", ff->md5[x]);
+                }
+                PrintBufferData(buf, &offset, size, "\n");
+            }
+            if (ff->flags & FILE_SHA1) {
+                PrintBufferData(buf, &offset, size, "SHA1:              ");
+                size_t x;
+                for (x = 0; x < sizeof(ff->sha1); x++) {
+                    PrintBufferData(buf, &offset, size, "%02x", ff->sha1[x]);
+                }
+                PrintBufferData(buf, &offset, size, "\n");
+            }
+            if (ff->flags & FILE_SHA256) {
+                PrintBufferData(buf, &offset, size, "SHA256:            ");
+                size_t x;
+                for (x = 0; x < sizeof(ff->sha256); x++) {
+                    PrintBufferData(buf, &offset, size, "%02x", ff->sha256[x]);
+                }
+                PrintBufferData(buf, &offset, size, "\n");
+            }
+#endif
+            break;
+        case FILE_STATE_TRUNCATED:
+            PrintBufferData(buf, &offset, size, "STATE:             TRUNCATED\n");
+            break;
+        case FILE_STATE_ERROR:
+            PrintBufferData(buf, &offset, size, "STATE:             ERROR\n");
+            break;
+        default:
+            PrintBufferData(buf, &offset, size, "STATE:             UNKNOWN\n");
+            break;
+    }
+    PrintBufferData(buf, &offset, size, "SIZE:              %"PRIu64"\n",
+            FileSize(ff));
+
+    *len = offset;
+    return buf;
+}
+
 static void LogFilestoreLogCloseMetaFile(const File *ff)
 {
     char filename[PATH_MAX] = "";
@@ -246,41 +324,59 @@ static void LogFilestoreLogCloseMetaFile(const File *ff)
     snprintf(metafilename, sizeof(metafilename), "%s.meta", filename);
     FILE *fp = fopen(metafilename, "a");
     if (fp != NULL) {
-        fprintf(fp, "MAGIC:             %s\n",
-                ff->magic ? ff->magic : "<unknown>");
-
-        switch (ff->state) {
-            case FILE_STATE_CLOSED:
-                fprintf(fp, "STATE:             CLOSED\n");
-#ifdef HAVE_NSS
-                if (ff->flags & FILE_MD5) {
-                    fprintf(fp, "MD5:               ");
-                    size_t x;
-                    for (x = 0; x < sizeof(ff->md5); x++) {
-                        fprintf(fp, "%02x", ff->md5[x]);
-                    }
-                    fprintf(fp, "\n");
-                }
-#endif
-                break;
-            case FILE_STATE_TRUNCATED:
-                fprintf(fp, "STATE:             TRUNCATED\n");
-                break;
-            case FILE_STATE_ERROR:
-                fprintf(fp, "STATE:             ERROR\n");
-                break;
-            default:
-                fprintf(fp, "STATE:             UNKNOWN\n");
-                break;
+        uint32_t len = 0;
+        char *buf = LogFilestoreLogCloseMetaFormat(ff, &len);
+        if (buf != NULL) {
+            if (fwrite(buf, len, 1, fp) != 1) {
+                SCLogDebug("write failed: %s", strerror(errno));
+            }
+            SCFree(buf);
         }
-        fprintf(fp, "SIZE:              %"PRIu64"\n", FileSize(ff));
-
         fclose(fp);
     } else {
         SCLogInfo("opening %s failed: %s", metafilename, strerror(errno));
     }
 }
 
+/** \internal
+ *  \brief hand the file to the writer threads. The .meta file is created
+ *          here as it needs the flow and the tx. */
+static int LogFilestoreLoggerAsync(LogFilestoreLogThread *aft, const Packet *p,
+        const File *ff, const uint8_t *data, uint32_t data_len, uint8_t flags,
+        char *filename, int ipver)
+{
+    if (flags & OUTPUT_FILEDATA_FLAG_OPEN) {
+        aft->file_cnt++;
+
+        /* create a .meta file that contains time, src/dst/sp/dp/proto */
+        LogFilestoreLogCreateMetaFile(p, ff, filename, ipver);
+
+        if (LogFilestoreAsyncQueue(ff->file_id, FILESTORE_ASYNC_OPEN,
+                    NULL, 0) != 0)
+            return -1;
+    }
+
+    if (data != NULL && data_len > 0) {
+        if (LogFilestoreAsyncQueue(ff->file_id, FILESTORE_ASYNC_WRITE,
+                    data, data_len) != 0)
+            return -1;
+    }
+
+    if (flags & OUTPUT_FILEDATA_FLAG_CLOSE) {
+        /* without the meta text the file still has to be closed */
+        uint32_t len = 0;
+        char *buf = LogFilestoreLogCloseMetaFormat(ff, &len);
+        int r = LogFilestoreAsyncQueue(ff->file_id, FILESTORE_ASYNC_CLOSE,
+                (uint8_t *)buf, len);
+        if (buf != NULL)
+            SCFree(buf);
+        if (r != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
 static int LogFilestoreLogger(ThreadVars *tv, void *thread_data, const Packet *p,
         const File *ff, const uint8_t *data, uint32_t data_len, uint8_t flags)
 {
@@ -308,6 +404,11 @@ static int LogFilestoreLogger(ThreadVars *tv, void *thread_data, const Packet *p
     snprintf(filename, sizeof(filename), "%s/file.%u",
             g_logfile_base_dir, ff->file_id);
 
+    if (LogFilestoreAsyncEnabled()) {
+        return LogFilestoreLoggerAsync(aft, p, ff, data, data_len, flags,
+                filename, ipver);
+    }
+
     if (flags & OUTPUT_FILEDATA_FLAG_OPEN) {
         aft->file_cnt++;
 
@@ -416,6 +517,9 @@ static void LogFilestoreLogExitPrintStats(ThreadVars *tv, void *data)
  */
 static void LogFilestoreLogDeInitCtx(OutputCtx *output_ctx)
 {
+    /* write out what is still queued */
+    LogFilestoreAsyncShutdown();
+
     LogFileCtx *logfile_ctx = (LogFileCtx *)output_ctx->data;
     LogFileFreeCtx(logfile_ctx);
     SCFree(output_ctx);
@@ -465,17 +569,35 @@ static OutputCtx *LogFilestoreLogInitCtx(ConfNode *conf)
         SCLogInfo("forcing magic lookup for stored files");
     }
 
-    const char *force_md5 = ConfNodeLookupChildValue(conf, "force-md5");
-    if (force_md5 != NULL && ConfValIsTrue(force_md5)) {
-#ifdef HAVE_NSS
-        FileForceMd5Enable();
-        SCLogInfo("forcing md5 calculation for stored files");
-#else
-        SCLogInfo("md5 calculation requires linking against libnss");
-#endif
-    }
+    FileForceHashParseCfg(conf);
     SCLogInfo("storing files in %s", g_logfile_base_dir);
 
+    ConfNode *async = ConfNodeLookupChild(conf, "async");
+    if (async != NULL) {
+        intmax_t threads = 0;
+        uint64_t memcap = FILESTORE_ASYNC_DEFAULT_MEMCAP;
+
+        if (ConfGetChildValueInt(async, "threads", &threads) == 0 ||
+                threads < 0 || threads > 64) {
+            threads = 0;
+        }
+
+        const char *s_memcap = ConfNodeLookupChildValue(async, "memcap");
+        if (s_memcap != NULL) {
+            if (ParseSizeStringU64(s_memcap, &memcap) < 0 || memcap == 0) {
+                SCLogError(SC_ERR_SIZE_PARSE, "invalid file-store async "
+                        "memcap \"%s\", using the default", s_memcap);
+                memcap = FILESTORE_ASYNC_DEFAULT_MEMCAP;
+            }
+        }
+
+        if (threads > 0 &&
+                LogFilestoreAsyncInit(g_logfile_base_dir, (uint32_t)threads, memcap) != 0) {
+            SCLogWarning(SC_ERR_THREAD_CREATE, "file-store writer threads "
+                    "failed to start, writing from the packet threads");
+        }
+    }
+
     SCReturnPtr(output_ctx, "OutputCtx");
 }
 
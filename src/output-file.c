@@ -30,6 +30,7 @@
 #include "app-layer.h"
 #include "app-layer-parser.h"
 #include "detect-filemagic.h"
+#include "util-magic.h"
 #include "util-profiling.h"
 
 typedef struct OutputLoggerThreadStore_ {
@@ -41,6 +42,9 @@ typedef struct OutputLoggerThreadStore_ {
  *  data for the packet loggers. */
 typedef struct OutputLoggerThreadData_ {
     OutputLoggerThreadStore *store;
+    /** thread's own libmagic ctx for forced magic lookups, so these
+     *  don't serialize on the global magic lock */
+    magic_t magic_ctx;
 } OutputLoggerThreadData;
 
 /* logger instance, a module + a output ctx,
@@ -149,7 +153,10 @@ static TmEcode OutputFileLog(ThreadVars *tv, Packet *p, void *thread_data)
                 int file_logged = 0;
 
                 if (FileForceMagic() && ff->magic == NULL) {
-                    FilemagicGlobalLookup(ff);
+                    if (op_thread_data->magic_ctx != NULL)
+                        FilemagicThreadLookup(&op_thread_data->magic_ctx, ff);
+                    else
+                        FilemagicGlobalLookup(ff);
                 }
 
                 logger = list;
@@ -196,6 +203,10 @@ static TmEcode OutputFileLogThreadInit(ThreadVars *tv, void *initdata, void **da
 
     SCLogDebug("OutputFileLogThreadInit happy (*data %p)", *data);
 
+    if (FileForceMagic()) {
+        td->magic_ctx = MagicInitContext();
+    }
+
     OutputFileLogger *logger = list;
     while (logger) {
         if (logger->ThreadInit) {
@@ -244,6 +255,7 @@ static TmEcode OutputFileLogThreadDeinit(ThreadVars *tv, void *thread_data)
         logger = logger->next;
     }
 
+    MagicDeinitContext(op_thread_data->magic_ctx);
     SCFree(op_thread_data);
     return TM_ECODE_OK;
 }
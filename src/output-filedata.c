@@ -30,6 +30,7 @@
 #include "app-layer.h"
 #include "app-layer-parser.h"
 #include "detect-filemagic.h"
+#include "util-magic.h"
 #include "conf.h"
 #include "util-profiling.h"
 
@@ -42,6 +43,9 @@ typedef struct OutputLoggerThreadStore_ {
  *  data for the packet loggers. */
 typedef struct OutputLoggerThreadData_ {
     OutputLoggerThreadStore *store;
+    /** thread's own libmagic ctx for forced magic lookups, so these
+     *  don't serialize on the global magic lock */
+    magic_t magic_ctx;
 } OutputLoggerThreadData;
 
 /* logger instance, a module + a output ctx,
@@ -166,7 +170,10 @@ static TmEcode OutputFiledataLog(ThreadVars *tv, Packet *p, void *thread_data)
         File *ff;
         for (ff = ffc->head; ff != NULL; ff = ff->next) {
             if (FileForceMagic() && ff->magic == NULL) {
-                FilemagicGlobalLookup(ff);
+                if (op_thread_data->magic_ctx != NULL)
+                    FilemagicThreadLookup(&op_thread_data->magic_ctx, ff);
+                else
+                    FilemagicGlobalLookup(ff);
             }
 
             SCLogDebug("ff %p", ff);
@@ -305,6 +312,10 @@ static TmEcode OutputFiledataLogThreadInit(ThreadVars *tv, void *initdata, void
 
     SCLogDebug("OutputFiledataLogThreadInit happy (*data %p)", *data);
 
+    if (FileForceMagic()) {
+        td->magic_ctx = MagicInitContext();
+    }
+
     OutputFiledataLogger *logger = list;
     while (logger) {
         if (logger->ThreadInit) {
@@ -412,6 +423,7 @@ static TmEcode OutputFiledataLogThreadDeinit(ThreadVars *tv, void *thread_data)
     }
     SCMutexUnlock(&g_waldo_mutex);
 
+    MagicDeinitContext(op_thread_data->magic_ctx);
     SCFree(op_thread_data);
     return TM_ECODE_OK;
 }
@@ -64,6 +64,7 @@
 #include "util-proto-name.h"
 #include "util-optimize.h"
 #include "util-buffer.h"
+#include "util-json-builder.h"
 #include "util-crypt.h"
 
 #define MODULE_NAME "JsonAlertLog"
@@ -106,7 +107,7 @@ static int AlertJsonDumpStreamSegmentCallback(const Packet *p, void *data, uint8
     return 1;
 }
 
-static void AlertJsonTls(const Flow *f, json_t *js)
+static void AlertJsonTls(const Flow *f, JsonBuilder *jb)
 {
     SSLState *ssl_state = (SSLState *)FlowGetAppState(f);
     if (ssl_state) {
@@ -117,13 +118,14 @@ static void AlertJsonTls(const Flow *f, json_t *js)
         JsonTlsLogJSONBasic(tjs, ssl_state);
         JsonTlsLogJSONExtended(tjs, ssl_state);
 
-        json_object_set_new(js, "tls", tjs);
+        JsonBuilderSetJson(jb, "tls", tjs);
+        json_decref(tjs);
     }
 
     return;
 }
 
-static void AlertJsonSsh(const Flow *f, json_t *js)
+static void AlertJsonSsh(const Flow *f, JsonBuilder *jb)
 {
     SshState *ssh_state = (SshState *)FlowGetAppState(f);
     if (ssh_state) {
@@ -133,20 +135,26 @@ static void AlertJsonSsh(const Flow *f, json_t *js)
 
         JsonSshLogJSON(tjs, ssh_state);
 
-        json_object_set_new(js, "ssh", tjs);
+        JsonBuilderSetJson(jb, "ssh", tjs);
+        json_decref(tjs);
     }
 
     return;
 }
 
-void AlertJsonHeader(const Packet *p, const PacketAlert *pa, json_t *js)
+static const char *AlertJsonAction(const PacketAlert *pa)
 {
-    char *action = "allowed";
     if (pa->action & (ACTION_REJECT|ACTION_REJECT_DST|ACTION_REJECT_BOTH)) {
-        action = "blocked";
+        return "blocked";
     } else if ((pa->action & ACTION_DROP) && EngineModeIsIPS()) {
-        action = "blocked";
+        return "blocked";
     }
+    return "allowed";
+}
+
+void AlertJsonHeader(const Packet *p, const PacketAlert *pa, json_t *js)
+{
+    const char *action = AlertJsonAction(pa);
 
     /* Add tx_id to root element for correlation with other events. */
     json_object_del(js, "tx_id");
@@ -176,21 +184,40 @@ void AlertJsonHeader(const Packet *p, const PacketAlert *pa, json_t *js)
     json_object_set_new(js, "alert", ajs);
 }
 
-static void AlertJsonPacket(const Packet *p, json_t *js)
+/** \brief the "alert" object of AlertJsonHeader() for the streaming
+ *         encoder */
+static void AlertJsonBuildAlert(JsonBuilder *jb, const Packet *p,
+                                const PacketAlert *pa)
+{
+    JsonBuilderOpenObject(jb, "alert");
+    JsonBuilderSetString(jb, "action", AlertJsonAction(pa));
+    JsonBuilderSetUint(jb, "gid", pa->s->gid);
+    JsonBuilderSetUint(jb, "signature_id", pa->s->id);
+    JsonBuilderSetUint(jb, "rev", pa->s->rev);
+    JsonBuilderSetString(jb, "signature",
+            (pa->s->msg) ? pa->s->msg : "");
+    JsonBuilderSetString(jb, "category",
+            (pa->s->class_msg) ? pa->s->class_msg : "");
+    JsonBuilderSetInt(jb, "severity", pa->s->prio);
+
+    if (p->tenant_id > 0)
+        JsonBuilderSetUint(jb, "tenant_id", p->tenant_id);
+
+    JsonBuilderClose(jb);
+}
+
+static void AlertJsonPacket(const Packet *p, JsonBuilder *jb)
 {
     unsigned long len = GET_PKT_LEN(p) * 2;
     uint8_t encoded_packet[len];
     Base64Encode((unsigned char*) GET_PKT_DATA(p), GET_PKT_LEN(p),
         encoded_packet, &len);
-    json_object_set_new(js, "packet", json_string((char *)encoded_packet));
+    JsonBuilderSetString(jb, "packet", (char *)encoded_packet);
 
     /* Create packet info. */
-    json_t *packetinfo_js = json_object();
-    if (unlikely(packetinfo_js == NULL)) {
-        return;
-    }
-    json_object_set_new(packetinfo_js, "linktype", json_integer(p->datalink));
-    json_object_set_new(js, "packet_info", packetinfo_js);
+    JsonBuilderOpenObject(jb, "packet_info");
+    JsonBuilderSetInt(jb, "linktype", p->datalink);
+    JsonBuilderClose(jb);
 }
 
 static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
@@ -198,15 +225,15 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
     MemBuffer *payload = aft->payload_buffer;
     AlertJsonOutputCtx *json_output_ctx = aft->json_output_ctx;
     json_t *hjs = NULL;
+    JsonAddrInfo addr;
+    JsonBuilder jb;
 
     int i;
 
     if (p->alerts.cnt == 0 && !(p->flags & PKT_HAS_TAG))
         return TM_ECODE_OK;
 
-    json_t *js = CreateJSONHeader((Packet *)p, 0, "alert");
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
+    JsonAddrInfoInit(p, 0, &addr);
 
     for (i = 0; i < p->alerts.cnt; i++) {
         const PacketAlert *pa = &p->alerts.alerts[i];
@@ -214,21 +241,48 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
             continue;
         }
 
-        MemBufferReset(aft->json_buffer);
+        HttpXFFCfg *xff_cfg = json_output_ctx->xff_cfg;
+        int have_xff_ip = 0;
+        char xff_buffer[XFF_MAXLEN];
+
+        /* xff header, looked up first as it may replace an address
+         * in the header */
+        if ((xff_cfg != NULL) && !(xff_cfg->flags & XFF_DISABLED) && p->flow != NULL) {
+            if (FlowGetAppProtocol(p->flow) == ALPROTO_HTTP) {
+                if (pa->flags & PACKET_ALERT_FLAG_TX) {
+                    have_xff_ip = HttpXFFGetIPFromTx(p, pa->tx_id, xff_cfg, xff_buffer, XFF_MAXLEN);
+                } else {
+                    have_xff_ip = HttpXFFGetIP(p, xff_cfg, xff_buffer, XFF_MAXLEN);
+                }
+            }
+
+            if (have_xff_ip && !(xff_cfg->flags & XFF_EXTRADATA) &&
+                    (xff_cfg->flags & XFF_OVERWRITE)) {
+                if (p->flowflags & FLOW_PKT_TOCLIENT) {
+                    strlcpy(addr.dst_ip, xff_buffer, sizeof(addr.dst_ip));
+                } else {
+                    strlcpy(addr.src_ip, xff_buffer, sizeof(addr.src_ip));
+                }
+            }
+        }
+
+        OutputJsonBuilderStart(&jb, aft->file_ctx, &aft->json_buffer);
+        OutputJsonBuilderHeader(&jb, p, &addr, "alert");
+
+        /* Add tx_id to root element for correlation with other events. */
+        if (pa->flags & PACKET_ALERT_FLAG_TX)
+            JsonBuilderSetUint(&jb, "tx_id", pa->tx_id);
 
         /* alert */
-        AlertJsonHeader(p, pa, js);
+        AlertJsonBuildAlert(&jb, p, pa);
 
         if (json_output_ctx->flags & LOG_JSON_HTTP) {
             if (p->flow != NULL) {
                 uint16_t proto = FlowGetAppProtocol(p->flow);
 
                 /* http alert */
-                if (proto == ALPROTO_HTTP) {
-                    hjs = JsonHttpAddMetadata(p->flow, pa->tx_id);
-                    if (hjs)
-                        json_object_set_new(js, "http", hjs);
-                }
+                if (proto == ALPROTO_HTTP)
+                    JsonHttpBuildMetadata(&jb, "http", p->flow, pa->tx_id);
             }
         }
 
@@ -238,7 +292,7 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
 
                 /* http alert */
                 if (proto == ALPROTO_TLS)
-                    AlertJsonTls(p->flow, js);
+                    AlertJsonTls(p->flow, &jb);
             }
         }
 
@@ -248,7 +302,7 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
 
                 /* http alert */
                 if (proto == ALPROTO_SSH)
-                    AlertJsonSsh(p->flow, js);
+                    AlertJsonSsh(p->flow, &jb);
             }
         }
 
@@ -259,12 +313,16 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                 /* http alert */
                 if (proto == ALPROTO_SMTP) {
                     hjs = JsonSMTPAddMetadata(p->flow, pa->tx_id);
-                    if (hjs)
-                        json_object_set_new(js, "smtp", hjs);
+                    if (hjs) {
+                        JsonBuilderSetJson(&jb, "smtp", hjs);
+                        json_decref(hjs);
+                    }
 
                     hjs = JsonEmailAddMetadata(p->flow, pa->tx_id);
-                    if (hjs)
-                        json_object_set_new(js, "email", hjs);
+                    if (hjs) {
+                        JsonBuilderSetJson(&jb, "email", hjs);
+                        json_decref(hjs);
+                    }
                 }
             }
         }
@@ -295,7 +353,7 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                     unsigned long len = json_output_ctx->payload_buffer_size * 2;
                     uint8_t encoded[len];
                     Base64Encode(payload->buffer, payload->offset, encoded, &len);
-                    json_object_set_new(js, "payload", json_string((char *)encoded));
+                    JsonBuilderSetString(&jb, "payload", (char *)encoded);
                 }
 
                 if (json_output_ctx->flags & LOG_JSON_PAYLOAD) {
@@ -304,8 +362,8 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                     PrintStringsToBuffer(printable_buf, &offset,
                                      sizeof(printable_buf),
                                      payload->buffer, payload->offset);
-                    json_object_set_new(js, "payload_printable",
-                                        json_string((char *)printable_buf));
+                    JsonBuilderSetString(&jb, "payload_printable",
+                                         (char *)printable_buf);
                 }
             } else {
                 /* This is a single packet and not a stream */
@@ -313,7 +371,7 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                     unsigned long len = p->payload_len * 2 + 1;
                     uint8_t encoded[len];
                     Base64Encode(p->payload, p->payload_len, encoded, &len);
-                    json_object_set_new(js, "payload", json_string((char *)encoded));
+                    JsonBuilderSetString(&jb, "payload", (char *)encoded);
                 }
 
                 if (json_output_ctx->flags & LOG_JSON_PAYLOAD) {
@@ -322,62 +380,35 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                     PrintStringsToBuffer(printable_buf, &offset,
                                      p->payload_len + 1,
                                      p->payload, p->payload_len);
-                    json_object_set_new(js, "payload_printable", json_string((char *)printable_buf));
+                    JsonBuilderSetString(&jb, "payload_printable", (char *)printable_buf);
                 }
             }
 
-            json_object_set_new(js, "stream", json_integer(stream));
+            JsonBuilderSetInt(&jb, "stream", stream);
         }
 
         /* base64-encoded full packet */
         if (json_output_ctx->flags & LOG_JSON_PACKET) {
-            AlertJsonPacket(p, js);
+            AlertJsonPacket(p, &jb);
         }
 
-        HttpXFFCfg *xff_cfg = json_output_ctx->xff_cfg;
-
-        /* xff header */
-        if ((xff_cfg != NULL) && !(xff_cfg->flags & XFF_DISABLED) && p->flow != NULL) {
-            int have_xff_ip = 0;
-            char buffer[XFF_MAXLEN];
-
-            if (FlowGetAppProtocol(p->flow) == ALPROTO_HTTP) {
-                if (pa->flags & PACKET_ALERT_FLAG_TX) {
-                    have_xff_ip = HttpXFFGetIPFromTx(p, pa->tx_id, xff_cfg, buffer, XFF_MAXLEN);
-                } else {
-                    have_xff_ip = HttpXFFGetIP(p, xff_cfg, buffer, XFF_MAXLEN);
-                }
-            }
-
-            if (have_xff_ip) {
-                if (xff_cfg->flags & XFF_EXTRADATA) {
-                    json_object_set_new(js, "xff", json_string(buffer));
-                }
-                else if (xff_cfg->flags & XFF_OVERWRITE) {
-                    if (p->flowflags & FLOW_PKT_TOCLIENT) {
-                        json_object_set(js, "dest_ip", json_string(buffer));
-                    } else {
-                        json_object_set(js, "src_ip", json_string(buffer));
-                    }
-                }
-            }
+        if (have_xff_ip && (xff_cfg->flags & XFF_EXTRADATA)) {
+            JsonBuilderSetString(&jb, "xff", xff_buffer);
         }
 
-        OutputJSONBuffer(js, aft->file_ctx, &aft->json_buffer);
-        json_object_del(js, "alert");
+        OutputJsonBuilderWrite(&jb, aft->file_ctx);
+
+        /* the overwrite only applies to this alert */
+        if (have_xff_ip)
+            JsonAddrInfoInit(p, 0, &addr);
     }
-    json_object_clear(js);
-    json_decref(js);
 
     if ((p->flags & PKT_HAS_TAG) && (json_output_ctx->flags &
             LOG_JSON_TAGGED_PACKETS)) {
-        MemBufferReset(aft->json_buffer);
-        json_t *packetjs = CreateJSONHeader((Packet *)p, 0, "packet");
-        if (unlikely(packetjs != NULL)) {
-            AlertJsonPacket(p, packetjs);
-            OutputJSONBuffer(packetjs, aft->file_ctx, &aft->json_buffer);
-            json_decref(packetjs);
-        }
+        OutputJsonBuilderStart(&jb, aft->file_ctx, &aft->json_buffer);
+        OutputJsonBuilderHeader(&jb, p, &addr, "packet");
+        AlertJsonPacket(p, &jb);
+        OutputJsonBuilderWrite(&jb, aft->file_ctx);
     }
 
     return TM_ECODE_OK;
@@ -387,7 +418,7 @@ static int AlertJsonDecoderEvent(ThreadVars *tv, JsonAlertLogThread *aft, const
 {
     int i;
     char timebuf[64];
-    json_t *js;
+    JsonBuilder jb;
 
     if (p->alerts.cnt == 0)
         return TM_ECODE_OK;
@@ -395,61 +426,20 @@ static int AlertJsonDecoderEvent(ThreadVars *tv, JsonAlertLogThread *aft, const
     CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
 
     for (i = 0; i < p->alerts.cnt; i++) {
-        MemBufferReset(aft->json_buffer);
-
         const PacketAlert *pa = &p->alerts.alerts[i];
         if (unlikely(pa->s == NULL)) {
             continue;
         }
 
-        char *action = "allowed";
-        if (pa->action & (ACTION_REJECT|ACTION_REJECT_DST|ACTION_REJECT_BOTH)) {
-            action = "blocked";
-        } else if ((pa->action & ACTION_DROP) && EngineModeIsIPS()) {
-            action = "blocked";
-        }
-
-        char buf[(32 * 3) + 1];
-        PrintRawLineHexBuf(buf, sizeof(buf), GET_PKT_DATA(p), GET_PKT_LEN(p) < 32 ? GET_PKT_LEN(p) : 32);
-
-        js = json_object();
-        if (js == NULL)
-            return TM_ECODE_OK;
-
-        json_t *ajs = json_object();
-        if (ajs == NULL) {
-            json_decref(js);
-            return TM_ECODE_OK;
-        }
+        OutputJsonBuilderStart(&jb, aft->file_ctx, &aft->json_buffer);
 
         /* time & tx */
-        json_object_set_new(js, "timestamp", json_string(timebuf));
-
-        /* tuple */
-        //json_object_set_new(js, "srcip", json_string(srcip));
-        //json_object_set_new(js, "sp", json_integer(p->sp));
-        //json_object_set_new(js, "dstip", json_string(dstip));
-        //json_object_set_new(js, "dp", json_integer(p->dp));
-        //json_object_set_new(js, "proto", json_integer(proto));
-
-        json_object_set_new(ajs, "action", json_string(action));
-        json_object_set_new(ajs, "gid", json_integer(pa->s->gid));
-        json_object_set_new(ajs, "signature_id", json_integer(pa->s->id));
-        json_object_set_new(ajs, "rev", json_integer(pa->s->rev));
-        json_object_set_new(ajs, "signature",
-                            json_string((pa->s->msg) ? pa->s->msg : ""));
-        json_object_set_new(ajs, "category",
-                            json_string((pa->s->class_msg) ? pa->s->class_msg : ""));
-        json_object_set_new(ajs, "severity", json_integer(pa->s->prio));
-
-        if (p->tenant_id > 0)
-            json_object_set_new(ajs, "tenant_id", json_integer(p->tenant_id));
+        JsonBuilderSetString(&jb, "timestamp", timebuf);
 
         /* alert */
-        json_object_set_new(js, "alert", ajs);
-        OutputJSONBuffer(js, aft->file_ctx, &aft->json_buffer);
-        json_object_clear(js);
-        json_decref(js);
+        AlertJsonBuildAlert(&jb, p, pa);
+
+        OutputJsonBuilderWrite(&jb, aft->file_ctx);
     }
 
     return TM_ECODE_OK;
@@ -44,6 +44,7 @@
 #include "app-layer.h"
 #include "util-privs.h"
 #include "util-buffer.h"
+#include "util-json-builder.h"
 #include "util-proto-name.h"
 #include "util-logopenfile.h"
 #include "util-time.h"
@@ -386,10 +387,10 @@ static int DNSRRTypeEnabled(uint16_t type, uint64_t flags)
     }
 }
 
-static void LogQuery(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx,
+static void LogQuery(LogDnsLogThread *aft, JsonBuilder *jb, DNSTransaction *tx,
         uint64_t tx_id, DNSQueryEntry *entry) __attribute__((nonnull));
 
-static void LogQuery(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx,
+static void LogQuery(LogDnsLogThread *aft, JsonBuilder *jb, DNSTransaction *tx,
         uint64_t tx_id, DNSQueryEntry *entry)
 {
     SCLogDebug("got a DNS request and now logging !!");
@@ -398,110 +399,88 @@ static void LogQuery(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx,
         return;
     }
 
-    json_t *djs = json_object();
-    if (djs == NULL) {
-        return;
-    }
-
-    /* reset */
-    MemBufferReset(aft->buffer);
+    JsonBuilderOpenObject(jb, "dns");
 
     /* type */
-    json_object_set_new(djs, "type", json_string("query"));
+    JsonBuilderSetString(jb, "type", "query");
 
     /* id */
-    json_object_set_new(djs, "id", json_integer(tx->tx_id));
+    JsonBuilderSetUint(jb, "id", tx->tx_id);
 
     /* query */
-    char *c;
-    c = BytesToString((uint8_t *)((uint8_t *)entry + sizeof(DNSQueryEntry)), entry->len);
-    if (c != NULL) {
-        json_object_set_new(djs, "rrname", json_string(c));
-        SCFree(c);
-    }
+    JsonBuilderSetBytes(jb, "rrname",
+            (uint8_t *)((uint8_t *)entry + sizeof(DNSQueryEntry)), entry->len);
 
     /* name */
     char record[16] = "";
     DNSCreateTypeString(entry->type, record, sizeof(record));
-    json_object_set_new(djs, "rrtype", json_string(record));
+    JsonBuilderSetString(jb, "rrtype", record);
 
     /* tx id (tx counter) */
-    json_object_set_new(djs, "tx_id", json_integer(tx_id));
+    JsonBuilderSetUint(jb, "tx_id", tx_id);
 
-    /* dns */
-    json_object_set_new(js, "dns", djs);
-    OutputJSONBuffer(js, aft->dnslog_ctx->file_ctx, &aft->buffer);
-    json_object_del(js, "dns");
+    JsonBuilderClose(jb);
+    OutputJsonBuilderWrite(jb, aft->dnslog_ctx->file_ctx);
 }
 
-static void OutputAnswer(LogDnsLogThread *aft, json_t *djs,
+static void OutputAnswer(LogDnsLogThread *aft, JsonBuilder *jb,
         DNSTransaction *tx, DNSAnswerEntry *entry) __attribute__((nonnull));
 
-static void OutputAnswer(LogDnsLogThread *aft, json_t *djs,
+static void OutputAnswer(LogDnsLogThread *aft, JsonBuilder *jb,
         DNSTransaction *tx, DNSAnswerEntry *entry)
 {
     if (!DNSRRTypeEnabled(entry->type, aft->dnslog_ctx->flags)) {
         return;
     }
 
-    json_t *js = json_object();
-    if (js == NULL)
-        return;
+    JsonBuilderOpenObject(jb, "dns");
 
     /* type */
-    json_object_set_new(js, "type", json_string("answer"));
+    JsonBuilderSetString(jb, "type", "answer");
 
     /* id */
-    json_object_set_new(js, "id", json_integer(tx->tx_id));
+    JsonBuilderSetUint(jb, "id", tx->tx_id);
 
     /* rcode */
     char rcode[16] = "";
     DNSCreateRcodeString(tx->rcode, rcode, sizeof(rcode));
-    json_object_set_new(js, "rcode", json_string(rcode));
+    JsonBuilderSetString(jb, "rcode", rcode);
 
     /* query */
     if (entry->fqdn_len > 0) {
-        char *c;
-        c = BytesToString((uint8_t *)((uint8_t *)entry + sizeof(DNSAnswerEntry)),
+        JsonBuilderSetBytes(jb, "rrname",
+                (uint8_t *)((uint8_t *)entry + sizeof(DNSAnswerEntry)),
                 entry->fqdn_len);
-        if (c != NULL) {
-            json_object_set_new(js, "rrname", json_string(c));
-            SCFree(c);
-        }
     }
 
     /* name */
     char record[16] = "";
     DNSCreateTypeString(entry->type, record, sizeof(record));
-    json_object_set_new(js, "rrtype", json_string(record));
+    JsonBuilderSetString(jb, "rrtype", record);
 
     /* ttl */
-    json_object_set_new(js, "ttl", json_integer(entry->ttl));
+    JsonBuilderSetUint(jb, "ttl", entry->ttl);
 
     uint8_t *ptr = (uint8_t *)((uint8_t *)entry + sizeof(DNSAnswerEntry)+ entry->fqdn_len);
     if (entry->type == DNS_RECORD_TYPE_A) {
         char a[16] = "";
         PrintInet(AF_INET, (const void *)ptr, a, sizeof(a));
-        json_object_set_new(js, "rdata", json_string(a));
+        JsonBuilderSetString(jb, "rdata", a);
     } else if (entry->type == DNS_RECORD_TYPE_AAAA) {
         char a[46] = "";
         PrintInet(AF_INET6, (const void *)ptr, a, sizeof(a));
-        json_object_set_new(js, "rdata", json_string(a));
+        JsonBuilderSetString(jb, "rdata", a);
     } else if (entry->data_len == 0) {
-        json_object_set_new(js, "rdata", json_string(""));
+        JsonBuilderSetString(jb, "rdata", "");
     } else if (entry->type == DNS_RECORD_TYPE_TXT || entry->type == DNS_RECORD_TYPE_CNAME ||
             entry->type == DNS_RECORD_TYPE_MX || entry->type == DNS_RECORD_TYPE_PTR ||
             entry->type == DNS_RECORD_TYPE_NS) {
-        if (entry->data_len != 0) {
-            char buffer[256] = "";
-            uint16_t copy_len = entry->data_len < (sizeof(buffer) - 1) ?
-                entry->data_len : sizeof(buffer) - 1;
-            memcpy(buffer, ptr, copy_len);
-            buffer[copy_len] = '\0';
-            json_object_set_new(js, "rdata", json_string(buffer));
-        } else {
-            json_object_set_new(js, "rdata", json_string(""));
-        }
+        /* stops at the first nul, like the c-string copy did */
+        uint16_t copy_len = entry->data_len < 255 ? entry->data_len : 255;
+        uint8_t *nul = memchr(ptr, 0x00, copy_len);
+        if (nul != NULL)
+            copy_len = nul - ptr;
+        JsonBuilderSetStringLen(jb, "rdata", ptr, copy_len);
     } else if (entry->type == DNS_RECORD_TYPE_SSHFP) {
         if (entry->data_len > 2) {
             /* get algo and type */
@@ -525,73 +504,67 @@ static void OutputAnswer(LogDnsLogThread *aft, json_t *djs,
             }
 
             /* wrap the whole thing in it's own structure */
-            json_t *hjs = json_object();
-            if (hjs != NULL) {
-                json_object_set_new(hjs, "fingerprint", json_string(hexstring));
-                json_object_set_new(hjs, "algo", json_integer(algo));
-                json_object_set_new(hjs, "type", json_integer(fptype));
-
-                json_object_set_new(js, "sshfp", hjs);
-            }
+            JsonBuilderOpenObject(jb, "sshfp");
+            JsonBuilderSetString(jb, "fingerprint", hexstring);
+            JsonBuilderSetUint(jb, "algo", algo);
+            JsonBuilderSetUint(jb, "type", fptype);
+            JsonBuilderClose(jb);
         }
     }
 
-    /* reset */
-    MemBufferReset(aft->buffer);
-    json_object_set_new(djs, "dns", js);
-    OutputJSONBuffer(djs, aft->dnslog_ctx->file_ctx, &aft->buffer);
-    json_object_del(djs, "dns");
+    JsonBuilderClose(jb);
+    OutputJsonBuilderWrite(jb, aft->dnslog_ctx->file_ctx);
 
     return;
 }
 
-static void OutputFailure(LogDnsLogThread *aft, json_t *djs,
+static void OutputFailure(LogDnsLogThread *aft, JsonBuilder *jb,
         DNSTransaction *tx, DNSQueryEntry *entry) __attribute__((nonnull));
 
-static void OutputFailure(LogDnsLogThread *aft, json_t *djs,
+static void OutputFailure(LogDnsLogThread *aft, JsonBuilder *jb,
         DNSTransaction *tx, DNSQueryEntry *entry)
 {
     if (!DNSRRTypeEnabled(entry->type, aft->dnslog_ctx->flags)) {
         return;
     }
 
-    json_t *js = json_object();
-    if (js == NULL)
-        return;
+    JsonBuilderOpenObject(jb, "dns");
 
     /* type */
-    json_object_set_new(js, "type", json_string("answer"));
+    JsonBuilderSetString(jb, "type", "answer");
 
     /* id */
-    json_object_set_new(js, "id", json_integer(tx->tx_id));
+    JsonBuilderSetUint(jb, "id", tx->tx_id);
 
     /* rcode */
     char rcode[16] = "";
     DNSCreateRcodeString(tx->rcode, rcode, sizeof(rcode));
-    json_object_set_new(js, "rcode", json_string(rcode));
+    JsonBuilderSetString(jb, "rcode", rcode);
 
     /* no answer RRs, use query for rname */
-    char *c;
-    c = BytesToString((uint8_t *)((uint8_t *)entry + sizeof(DNSQueryEntry)), entry->len);
-    if (c != NULL) {
-        json_object_set_new(js, "rrname", json_string(c));
-        SCFree(c);
-    }
+    JsonBuilderSetBytes(jb, "rrname",
+            (uint8_t *)((uint8_t *)entry + sizeof(DNSQueryEntry)), entry->len);
 
-    /* reset */
-    MemBufferReset(aft->buffer);
-    json_object_set_new(djs, "dns", js);
-    OutputJSONBuffer(djs, aft->dnslog_ctx->file_ctx, &aft->buffer);
-    json_object_del(djs, "dns");
+    JsonBuilderClose(jb);
+    OutputJsonBuilderWrite(jb, aft->dnslog_ctx->file_ctx);
 
     return;
 }
 
-static void LogAnswers(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx, uint64_t tx_id)
+/**
+ *  \brief log the answers of a tx, one record per RR
+ *
+ *  All records share the header already in the builder: each one is
+ *  written and then rewound back to the end of the header.
+ */
+static void LogAnswers(LogDnsLogThread *aft, JsonBuilder *jb, DNSTransaction *tx, uint64_t tx_id)
 {
+    JsonBuilderMark mark;
 
     SCLogDebug("got a DNS response and now logging !!");
 
+    JsonBuilderGetMark(jb, &mark);
+
     /* rcode != noerror */
     if (tx->rcode) {
         /* Most DNS servers do not support multiple queries because
@@ -599,18 +572,21 @@ static void LogAnswers(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx, uin
          * are likely to lead to FORMERR, so log this. */
         DNSQueryEntry *query = NULL;
         TAILQ_FOREACH(query, &tx->query_list, next) {
-            OutputFailure(aft, js, tx, query);
+            OutputFailure(aft, jb, tx, query);
+            JsonBuilderRewind(jb, &mark);
         }
     }
 
     DNSAnswerEntry *entry = NULL;
     TAILQ_FOREACH(entry, &tx->answer_list, next) {
-        OutputAnswer(aft, js, tx, entry);
+        OutputAnswer(aft, jb, tx, entry);
+        JsonBuilderRewind(jb, &mark);
     }
 
     entry = NULL;
     TAILQ_FOREACH(entry, &tx->authority_list, next) {
-        OutputAnswer(aft, js, tx, entry);
+        OutputAnswer(aft, jb, tx, entry);
+        JsonBuilderRewind(jb, &mark);
     }
 
 }
@@ -623,18 +599,20 @@ static int JsonDnsLoggerToServer(ThreadVars *tv, void *thread_data,
     LogDnsLogThread *td = (LogDnsLogThread *)thread_data;
     LogDnsFileCtx *dnslog_ctx = td->dnslog_ctx;
     DNSTransaction *tx = txptr;
-    json_t *js;
+    JsonAddrInfo addr;
+    JsonBuilder jb;
+    JsonBuilderMark mark;
 
     if (likely(dnslog_ctx->flags & LOG_QUERIES) != 0) {
+        JsonAddrInfoInit(p, 1, &addr);
+        OutputJsonBuilderStart(&jb, dnslog_ctx->file_ctx, &td->buffer);
+        OutputJsonBuilderHeader(&jb, p, &addr, "dns");
+        JsonBuilderGetMark(&jb, &mark);
+
         DNSQueryEntry *query = NULL;
         TAILQ_FOREACH(query, &tx->query_list, next) {
-            js = CreateJSONHeader((Packet *)p, 1, "dns");
-            if (unlikely(js == NULL))
-                return TM_ECODE_OK;
-
-            LogQuery(td, js, tx, tx_id, query);
-
-            json_decref(js);
+            LogQuery(td, &jb, tx, tx_id, query);
+            JsonBuilderRewind(&jb, &mark);
         }
     }
 
@@ -649,16 +627,15 @@ static int JsonDnsLoggerToClient(ThreadVars *tv, void *thread_data,
     LogDnsLogThread *td = (LogDnsLogThread *)thread_data;
     LogDnsFileCtx *dnslog_ctx = td->dnslog_ctx;
     DNSTransaction *tx = txptr;
-    json_t *js;
+    JsonAddrInfo addr;
+    JsonBuilder jb;
 
     if (likely(dnslog_ctx->flags & LOG_ANSWERS) != 0) {
-        js = CreateJSONHeader((Packet *)p, 0, "dns");
-        if (unlikely(js == NULL))
-            return TM_ECODE_OK;
-
-        LogAnswers(td, js, tx, tx_id);
+        JsonAddrInfoInit(p, 0, &addr);
+        OutputJsonBuilderStart(&jb, dnslog_ctx->file_ctx, &td->buffer);
+        OutputJsonBuilderHeader(&jb, p, &addr, "dns");
 
-        json_decref(js);
+        LogAnswers(td, &jb, tx, tx_id);
     }
 
     SCReturnInt(TM_ECODE_OK);
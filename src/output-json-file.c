@@ -49,6 +49,7 @@
 #include "util-file.h"
 #include "util-time.h"
 #include "util-buffer.h"
+#include "util-json-builder.h"
 #include "util-byte.h"
 
 #include "log-file.h"
@@ -76,101 +77,101 @@ typedef struct JsonFileLogThread_ {
     MemBuffer *buffer;
 } JsonFileLogThread;
 
+#ifdef HAVE_NSS
+/** \internal
+ *  \brief add a hash as lower case hex */
+static void FileJsonSetHash(JsonBuilder *jb, const char *key,
+        const uint8_t *hash, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    char s[256];
+    size_t x;
+
+    for (x = 0; x < len && x * 2 < sizeof(s) - 1; x++) {
+        s[x * 2] = hex[hash[x] >> 4];
+        s[x * 2 + 1] = hex[hash[x] & 0x0f];
+    }
+    s[x * 2] = '\0';
+    JsonBuilderSetString(jb, key, s);
+}
+#endif
+
+/** \internal
+ *  \brief embed the smtp/email metadata that is still built by jansson */
+static void FileJsonSetJson(JsonBuilder *jb, const char *key, json_t *js)
+{
+    if (js != NULL) {
+        JsonBuilderSetJson(jb, key, js);
+        json_decref(js);
+    }
+}
+
 /**
  *  \internal
  *  \brief Write meta data on a single line json record
  */
 static void FileWriteJsonRecord(JsonFileLogThread *aft, const Packet *p, const File *ff)
 {
-    json_t *js = CreateJSONHeader((Packet *)p, 0, "fileinfo"); //TODO const
-    json_t *hjs = NULL;
-    if (unlikely(js == NULL))
-        return;
+    LogFileCtx *file_ctx = aft->filelog_ctx->file_ctx;
+    JsonAddrInfo addr;
+    JsonBuilder jb;
 
-    /* reset */
-    MemBufferReset(aft->buffer);
+    JsonAddrInfoInit(p, 0, &addr);
+
+    OutputJsonBuilderStart(&jb, file_ctx, &aft->buffer);
+    OutputJsonBuilderHeader(&jb, p, &addr, "fileinfo");
 
     switch (p->flow->alproto) {
         case ALPROTO_HTTP:
-            hjs = JsonHttpAddMetadata(p->flow, ff->txid);
-            if (hjs)
-                json_object_set_new(js, "http", hjs);
+            JsonHttpBuildMetadata(&jb, "http", p->flow, ff->txid);
             break;
         case ALPROTO_SMTP:
-            hjs = JsonSMTPAddMetadata(p->flow, ff->txid);
-            if (hjs)
-                json_object_set_new(js, "smtp", hjs);
-            hjs = JsonEmailAddMetadata(p->flow, ff->txid);
-            if (hjs)
-                json_object_set_new(js, "email", hjs);
+            FileJsonSetJson(&jb, "smtp",
+                    JsonSMTPAddMetadata(p->flow, ff->txid));
+            FileJsonSetJson(&jb, "email",
+                    JsonEmailAddMetadata(p->flow, ff->txid));
             break;
     }
 
-    json_object_set_new(js, "app_proto",
-            json_string(AppProtoToString(p->flow->alproto)));
-
-    json_t *fjs = json_object();
-    if (unlikely(fjs == NULL)) {
-        json_decref(js);
-        return;
-    }
+    JsonBuilderSetString(&jb, "app_proto", AppProtoToString(p->flow->alproto));
 
-    char *s = BytesToString(ff->name, ff->name_len);
-    json_object_set_new(fjs, "filename", json_string(s));
-    if (s != NULL)
-        SCFree(s);
+    /* originally just 'file', but due to bug 1127 naming it fileinfo */
+    JsonBuilderOpenObject(&jb, "fileinfo");
+    JsonBuilderSetBytes(&jb, "filename",
+            ff->name ? ff->name : (const uint8_t *)"", ff->name_len);
     if (ff->magic)
-        json_object_set_new(fjs, "magic", json_string((char *)ff->magic));
+        JsonBuilderSetString(&jb, "magic", (char *)ff->magic);
     switch (ff->state) {
         case FILE_STATE_CLOSED:
-            json_object_set_new(fjs, "state", json_string("CLOSED"));
+            JsonBuilderSetString(&jb, "state", "CLOSED");
 #ifdef HAVE_NSS
-            if (ff->flags & FILE_MD5) {
-                size_t x;
-                int i;
-                char s[256];
-                for (i = 0, x = 0; x < sizeof(ff->md5); x++) {
-                    i += snprintf(&s[i], 255-i, "%02x", ff->md5[x]);
-                }
-                json_object_set_new(fjs, "md5", json_string(s));
-            }
+            if (ff->flags & FILE_MD5)
+                FileJsonSetHash(&jb, "md5", ff->md5, sizeof(ff->md5));
+            if (ff->flags & FILE_SHA1)
+                FileJsonSetHash(&jb, "sha1", ff->sha1, sizeof(ff->sha1));
+            if (ff->flags & FILE_SHA256)
+                FileJsonSetHash(&jb, "sha256", ff->sha256, sizeof(ff->sha256));
 #endif
             break;
         case FILE_STATE_TRUNCATED:
-            json_object_set_new(fjs, "state", json_string("TRUNCATED"));
+            JsonBuilderSetString(&jb, "state", "TRUNCATED");
             break;
         case FILE_STATE_ERROR:
-            json_object_set_new(fjs, "state", json_string("ERROR"));
+            JsonBuilderSetString(&jb, "state", "ERROR");
             break;
         default:
-            json_object_set_new(fjs, "state", json_string("UNKNOWN"));
+            JsonBuilderSetString(&jb, "state", "UNKNOWN");
             break;
     }
-    json_object_set_new(fjs, "stored",
-                        (ff->flags & FILE_STORED) ? json_true() : json_false());
+    JsonBuilderSetBool(&jb, "stored", (ff->flags & FILE_STORED) ? 1 : 0);
     if (ff->flags & FILE_STORED) {
-        json_object_set_new(fjs, "file_id", json_integer(ff->file_id));
+        JsonBuilderSetUint(&jb, "file_id", ff->file_id);
     }
-    json_object_set_new(fjs, "size", json_integer(FileSize(ff)));
-    json_object_set_new(fjs, "tx_id", json_integer(ff->txid));
-
-    /* originally just 'file', but due to bug 1127 naming it fileinfo */
-    json_object_set_new(js, "fileinfo", fjs);
-    OutputJSONBuffer(js, aft->filelog_ctx->file_ctx, &aft->buffer);
-    json_object_del(js, "fileinfo");
+    JsonBuilderSetUint(&jb, "size", FileSize(ff));
+    JsonBuilderSetUint(&jb, "tx_id", ff->txid);
+    JsonBuilderClose(&jb);
 
-    switch (p->flow->alproto) {
-        case ALPROTO_HTTP:
-            json_object_del(js, "http");
-            break;
-        case ALPROTO_SMTP:
-            json_object_del(js, "smtp");
-            json_object_del(js, "email");
-            break;
-    }
-
-    json_object_clear(js);
-    json_decref(js);
+    OutputJsonBuilderWrite(&jb, file_ctx);
 }
 
 static int JsonFileLogger(ThreadVars *tv, void *thread_data, const Packet *p, const File *ff)
@@ -270,15 +271,7 @@ OutputCtx *OutputFileLogInitSub(ConfNode *conf, OutputCtx *parent_ctx)
             SCLogConfig("forcing magic lookup for logged files");
         }
 
-        const char *force_md5 = ConfNodeLookupChildValue(conf, "force-md5");
-        if (force_md5 != NULL && ConfValIsTrue(force_md5)) {
-#ifdef HAVE_NSS
-            FileForceMd5Enable();
-            SCLogConfig("forcing md5 calculation for logged files");
-#else
-            SCLogInfo("md5 calculation requires linking against libnss");
-#endif
-        }
+        FileForceHashParseCfg(conf);
     }
 
     output_ctx->data = output_file_ctx;
@@ -41,6 +41,7 @@
 #include "output.h"
 #include "util-privs.h"
 #include "util-buffer.h"
+#include "util-json-builder.h"
 #include "util-proto-name.h"
 #include "util-logopenfile.h"
 #include "util-time.h"
@@ -68,15 +69,11 @@ typedef struct JsonFlowLogThread_ {
 #define LOG_HTTP_EXTENDED 1
 #define LOG_HTTP_CUSTOM 2
 
-static json_t *CreateJSONHeaderFromFlow(Flow *f, char *event_type)
+static void CreateJSONHeaderFromFlow(JsonBuilder *jb, Flow *f,
+                                     const char *event_type)
 {
     char timebuf[64];
     char srcip[46], dstip[46];
-    Port sp, dp;
-
-    json_t *js = json_object();
-    if (unlikely(js == NULL))
-        return NULL;
 
     struct timeval tv;
     memset(&tv, 0x00, sizeof(tv));
@@ -94,9 +91,6 @@ static json_t *CreateJSONHeaderFromFlow(Flow *f, char *event_type)
         PrintInet(AF_INET6, (const void *)&(f->dst.address), dstip, sizeof(dstip));
     }
 
-    sp = f->sp;
-    dp = f->dp;
-
     char proto[16];
     if (SCProtoNameValid(f->proto) == TRUE) {
         strlcpy(proto, known_proto[f->proto], sizeof(proto));
@@ -105,113 +99,102 @@ static json_t *CreateJSONHeaderFromFlow(Flow *f, char *event_type)
     }
 
     /* time */
-    json_object_set_new(js, "timestamp", json_string(timebuf));
+    JsonBuilderSetString(jb, "timestamp", timebuf);
 
-    CreateJSONFlowId(js, (const Flow *)f);
+    JsonBuilderFlowId(jb, (const Flow *)f);
 
 #if 0 // TODO
     /* sensor id */
     if (sensor_id >= 0)
-        json_object_set_new(js, "sensor_id", json_integer(sensor_id));
-#endif
-    if (event_type) {
-        json_object_set_new(js, "event_type", json_string(event_type));
-    }
-#if 0
-    /* vlan */
-    if (f->vlan_id[0] > 0) {
-        json_t *js_vlan;
-        switch (f->vlan_idx) {
-            case 1:
-                json_object_set_new(js, "vlan",
-                                    json_integer(f->vlan_id[0]));
-                break;
-            case 2:
-                js_vlan = json_array();
-                if (unlikely(js != NULL)) {
-                    json_array_append_new(js_vlan,
-                                    json_integer(VLAN_GET_ID1(p)));
-                    json_array_append_new(js_vlan,
-                                    json_integer(VLAN_GET_ID2(p)));
-                    json_object_set_new(js, "vlan", js_vlan);
-                }
-                break;
-            default:
-                /* shouldn't get here */
-                break;
-        }
-    }
+        JsonBuilderSetInt(jb, "sensor_id", sensor_id);
 #endif
+    JsonBuilderSetString(jb, "event_type", event_type);
+
     /* tuple */
-    json_object_set_new(js, "src_ip", json_string(srcip));
+    JsonBuilderSetString(jb, "src_ip", srcip);
     switch(f->proto) {
-        case IPPROTO_ICMP:
-            break;
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "src_port", json_integer(sp));
+            JsonBuilderSetUint(jb, "src_port", f->sp);
             break;
     }
-    json_object_set_new(js, "dest_ip", json_string(dstip));
+    JsonBuilderSetString(jb, "dest_ip", dstip);
     switch(f->proto) {
-        case IPPROTO_ICMP:
-            break;
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "dest_port", json_integer(dp));
+            JsonBuilderSetUint(jb, "dest_port", f->dp);
             break;
     }
-    json_object_set_new(js, "proto", json_string(proto));
+    JsonBuilderSetString(jb, "proto", proto);
     switch (f->proto) {
         case IPPROTO_ICMP:
         case IPPROTO_ICMPV6:
-            json_object_set_new(js, "icmp_type",
-                    json_integer(f->type));
-            json_object_set_new(js, "icmp_code",
-                    json_integer(f->code));
+            JsonBuilderSetUint(jb, "icmp_type", f->type);
+            JsonBuilderSetUint(jb, "icmp_code", f->code);
             break;
     }
-    return js;
+}
+
+static const char *JsonFlowTcpState(const TcpSession *ssn)
+{
+    switch (ssn->state) {
+        case TCP_NONE:
+            return "none";
+        case TCP_LISTEN:
+            return "listen";
+        case TCP_SYN_SENT:
+            return "syn_sent";
+        case TCP_SYN_RECV:
+            return "syn_recv";
+        case TCP_ESTABLISHED:
+            return "established";
+        case TCP_FIN_WAIT1:
+            return "fin_wait1";
+        case TCP_FIN_WAIT2:
+            return "fin_wait2";
+        case TCP_TIME_WAIT:
+            return "time_wait";
+        case TCP_LAST_ACK:
+            return "last_ack";
+        case TCP_CLOSE_WAIT:
+            return "close_wait";
+        case TCP_CLOSING:
+            return "closing";
+        case TCP_CLOSED:
+            return "closed";
+    }
+    return NULL;
 }
 
 /* JSON format logging */
-static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
+static void JsonFlowLogJSON(JsonFlowLogThread *aft, JsonBuilder *jb, Flow *f)
 {
 #if 0
     LogJsonFileCtx *flow_ctx = aft->flowlog_ctx;
 #endif
-    json_t *hjs = json_object();
-    if (hjs == NULL) {
-        return;
-    }
-
-    json_object_set_new(js, "app_proto", json_string(AppProtoToString(f->alproto)));
+    JsonBuilderSetString(jb, "app_proto", AppProtoToString(f->alproto));
 
-    json_object_set_new(hjs, "pkts_toserver",
-            json_integer(f->todstpktcnt));
-    json_object_set_new(hjs, "pkts_toclient",
-            json_integer(f->tosrcpktcnt));
-    json_object_set_new(hjs, "bytes_toserver",
-            json_integer(f->todstbytecnt));
-    json_object_set_new(hjs, "bytes_toclient",
-            json_integer(f->tosrcbytecnt));
+    JsonBuilderOpenObject(jb, "flow");
+    JsonBuilderSetUint(jb, "pkts_toserver", f->todstpktcnt);
+    JsonBuilderSetUint(jb, "pkts_toclient", f->tosrcpktcnt);
+    JsonBuilderSetUint(jb, "bytes_toserver", f->todstbytecnt);
+    JsonBuilderSetUint(jb, "bytes_toclient", f->tosrcbytecnt);
 
     char timebuf1[64], timebuf2[64];
 
     CreateIsoTimeString(&f->startts, timebuf1, sizeof(timebuf1));
     CreateIsoTimeString(&f->lastts, timebuf2, sizeof(timebuf2));
-
-    json_object_set_new(hjs, "start", json_string(timebuf1));
-    json_object_set_new(hjs, "end", json_string(timebuf2));
+    JsonBuilderSetString(jb, "start", timebuf1);
+    JsonBuilderSetString(jb, "end", timebuf2);
 
     int32_t age = f->lastts.tv_sec - f->startts.tv_sec;
-    json_object_set_new(hjs, "age",
-            json_integer(age));
+    JsonBuilderSetInt(jb, "age", age);
 
     if (f->flow_end_flags & FLOW_END_FLAG_EMERGENCY)
-        json_object_set_new(hjs, "emergency", json_true());
+        JsonBuilderSetBool(jb, "emergency", 1);
+
     const char *state = NULL;
     if (f->flow_end_flags & FLOW_END_FLAG_STATE_NEW)
         state = "new";
@@ -220,8 +203,7 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
     else if (f->flow_end_flags & FLOW_END_FLAG_STATE_CLOSED)
         state = "closed";
 
-    json_object_set_new(hjs, "state",
-            json_string(state));
+    JsonBuilderSetString(jb, "state", state);
 
     const char *reason = NULL;
     if (f->flow_end_flags & FLOW_END_FLAG_TIMEOUT)
@@ -231,80 +213,35 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
     else if (f->flow_end_flags & FLOW_END_FLAG_SHUTDOWN)
         reason = "shutdown";
 
-    json_object_set_new(hjs, "reason",
-            json_string(reason));
-
-    json_object_set_new(js, "flow", hjs);
-
+    JsonBuilderSetString(jb, "reason", reason);
+    JsonBuilderClose(jb);
 
     /* TCP */
     if (f->proto == IPPROTO_TCP) {
-        json_t *tjs = json_object();
-        if (tjs == NULL) {
-            return;
-        }
-
         TcpSession *ssn = f->protoctx;
-
         char hexflags[3];
+
+        JsonBuilderOpenObject(jb, "tcp");
+
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->tcp_packet_flags : 0);
-        json_object_set_new(tjs, "tcp_flags", json_string(hexflags));
+        JsonBuilderSetString(jb, "tcp_flags", hexflags);
 
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->client.tcp_flags : 0);
-        json_object_set_new(tjs, "tcp_flags_ts", json_string(hexflags));
+        JsonBuilderSetString(jb, "tcp_flags_ts", hexflags);
 
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->server.tcp_flags : 0);
-        json_object_set_new(tjs, "tcp_flags_tc", json_string(hexflags));
+        JsonBuilderSetString(jb, "tcp_flags_tc", hexflags);
 
-        JsonTcpFlags(ssn ? ssn->tcp_packet_flags : 0, tjs);
+        JsonBuilderTcpFlags(jb, ssn ? ssn->tcp_packet_flags : 0);
 
         if (ssn) {
-            char *state = NULL;
-            switch (ssn->state) {
-                case TCP_NONE:
-                    state = "none";
-                    break;
-                case TCP_LISTEN:
-                    state = "listen";
-                    break;
-                case TCP_SYN_SENT:
-                    state = "syn_sent";
-                    break;
-                case TCP_SYN_RECV:
-                    state = "syn_recv";
-                    break;
-                case TCP_ESTABLISHED:
-                    state = "established";
-                    break;
-                case TCP_FIN_WAIT1:
-                    state = "fin_wait1";
-                    break;
-                case TCP_FIN_WAIT2:
-                    state = "fin_wait2";
-                    break;
-                case TCP_TIME_WAIT:
-                    state = "time_wait";
-                    break;
-                case TCP_LAST_ACK:
-                    state = "last_ack";
-                    break;
-                case TCP_CLOSE_WAIT:
-                    state = "close_wait";
-                    break;
-                case TCP_CLOSING:
-                    state = "closing";
-                    break;
-                case TCP_CLOSED:
-                    state = "closed";
-                    break;
-            }
-            json_object_set_new(tjs, "state", json_string(state));
+            JsonBuilderSetString(jb, "state", JsonFlowTcpState(ssn));
         }
 
-        json_object_set_new(js, "tcp", tjs);
+        JsonBuilderClose(jb);
     }
 }
 
@@ -312,21 +249,13 @@ static int JsonFlowLogger(ThreadVars *tv, void *thread_data, Flow *f)
 {
     SCEnter();
     JsonFlowLogThread *jhl = (JsonFlowLogThread *)thread_data;
+    LogFileCtx *file_ctx = jhl->flowlog_ctx->file_ctx;
+    JsonBuilder jb;
 
-    /* reset */
-    MemBufferReset(jhl->buffer);
-
-    json_t *js = CreateJSONHeaderFromFlow(f, "flow"); //TODO const
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
-
-    JsonFlowLogJSON(jhl, js, f);
-
-    OutputJSONBuffer(js, jhl->flowlog_ctx->file_ctx, &jhl->buffer);
-    json_object_del(js, "http");
-
-    json_object_clear(js);
-    json_decref(js);
+    OutputJsonBuilderStart(&jb, file_ctx, &jhl->buffer);
+    CreateJSONHeaderFromFlow(&jb, f, "flow");
+    JsonFlowLogJSON(jhl, &jb, f);
+    OutputJsonBuilderWrite(&jb, file_ctx);
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -44,11 +44,15 @@
 #include "app-layer-parser.h"
 #include "util-privs.h"
 #include "util-buffer.h"
+#include "util-json-builder.h"
 #include "util-proto-name.h"
 #include "util-logopenfile.h"
 #include "util-time.h"
 #include "output-json.h"
 
+#include "stream-tcp.h"
+#include "util-unittest-helper.h"
+
 #ifdef HAVE_LIBJANSSON
 
 typedef struct LogHttpFileCtx_ {
@@ -181,28 +185,25 @@ struct {
     { "www_authenticate", "www-authenticate", 0 },
 };
 
-void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
+/** \brief add a bstr, nul bytes are written as "\0" like
+ *         bstr_util_strdup_to_c() does */
+static inline void JsonHttpSetBstr(JsonBuilder *jb, const char *key, bstr *b)
 {
-    char *c;
+    JsonBuilderSetBytes(jb, key, bstr_ptr(b), bstr_len(b));
+}
 
+void JsonHttpLogJSONBasic(JsonBuilder *jb, htp_tx_t *tx)
+{
     /* hostname */
     if (tx->request_hostname != NULL)
     {
-        c = bstr_util_strdup_to_c(tx->request_hostname);
-        if (c != NULL) {
-            json_object_set_new(js, "hostname", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpSetBstr(jb, "hostname", tx->request_hostname);
     }
 
     /* uri */
     if (tx->request_uri != NULL)
     {
-        c = bstr_util_strdup_to_c(tx->request_uri);
-        if (c != NULL) {
-            json_object_set_new(js, "url", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpSetBstr(jb, "url", tx->request_uri);
     }
 
     /* user agent */
@@ -211,11 +212,7 @@ void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
         h_user_agent = htp_table_get_c(tx->request_headers, "user-agent");
     }
     if (h_user_agent != NULL) {
-        c = bstr_util_strdup_to_c(h_user_agent->value);
-        if (c != NULL) {
-            json_object_set_new(js, "http_user_agent", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpSetBstr(jb, "http_user_agent", h_user_agent->value);
     }
 
     /* x-forwarded-for */
@@ -224,11 +221,7 @@ void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
         h_x_forwarded_for = htp_table_get_c(tx->request_headers, "x-forwarded-for");
     }
     if (h_x_forwarded_for != NULL) {
-        c = bstr_util_strdup_to_c(h_x_forwarded_for->value);
-        if (c != NULL) {
-            json_object_set_new(js, "xff", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpSetBstr(jb, "xff", h_x_forwarded_for->value);
     }
 
     /* content-type */
@@ -237,21 +230,17 @@ void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
         h_content_type = htp_table_get_c(tx->response_headers, "content-type");
     }
     if (h_content_type != NULL) {
-        char *p;
-        c = bstr_util_strdup_to_c(h_content_type->value);
-        if (c != NULL) {
-            p = strchr(c, ';');
-            if (p != NULL)
-                *p = '\0';
-            json_object_set_new(js, "http_content_type", json_string(c));
-            SCFree(c);
-        }
+        const uint8_t *ct = bstr_ptr(h_content_type->value);
+        uint32_t ct_len = bstr_len(h_content_type->value);
+        const uint8_t *p = memchr(ct, ';', ct_len);
+        if (p != NULL)
+            ct_len = p - ct;
+        JsonBuilderSetBytes(jb, "http_content_type", ct, ct_len);
     }
 }
 
-static void JsonHttpLogJSONCustom(LogHttpFileCtx *http_ctx, json_t *js, htp_tx_t *tx)
+static void JsonHttpLogJSONCustom(LogHttpFileCtx *http_ctx, JsonBuilder *jb, htp_tx_t *tx)
 {
-    char *c;
     HttpField f;
 
     for (f = HTTP_FIELD_ACCEPT; f < HTTP_FIELD_SIZE; f++)
@@ -278,94 +267,69 @@ static void JsonHttpLogJSONCustom(LogHttpFileCtx *http_ctx, json_t *js, htp_tx_t
                     }
                 }
                 if (h_field != NULL) {
-                    c = bstr_util_strdup_to_c(h_field->value);
-                    if (c != NULL) {
-                        json_object_set_new(js,
-                                http_fields[f].config_field,
-                                json_string(c));
-                        SCFree(c);
-                    }
+                    JsonHttpSetBstr(jb, http_fields[f].config_field,
+                            h_field->value);
                 }
             }
         }
     }
 }
 
-void JsonHttpLogJSONExtended(json_t *js, htp_tx_t *tx)
+void JsonHttpLogJSONExtended(JsonBuilder *jb, htp_tx_t *tx)
 {
-    char *c;
-
     /* referer */
     htp_header_t *h_referer = NULL;
     if (tx->request_headers != NULL) {
         h_referer = htp_table_get_c(tx->request_headers, "referer");
     }
     if (h_referer != NULL) {
-        c = bstr_util_strdup_to_c(h_referer->value);
-        if (c != NULL) {
-            json_object_set_new(js, "http_refer", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpSetBstr(jb, "http_refer", h_referer->value);
     }
 
     /* method */
     if (tx->request_method != NULL) {
-        c = bstr_util_strdup_to_c(tx->request_method);
-        if (c != NULL) {
-            json_object_set_new(js, "http_method", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpSetBstr(jb, "http_method", tx->request_method);
     }
 
     /* protocol */
     if (tx->request_protocol != NULL) {
-        c = bstr_util_strdup_to_c(tx->request_protocol);
-        if (c != NULL) {
-            json_object_set_new(js, "protocol", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpSetBstr(jb, "protocol", tx->request_protocol);
     }
 
     /* response status */
     if (tx->response_status != NULL) {
-        c = bstr_util_strdup_to_c(tx->response_status);
-        if (c != NULL) {
-            unsigned int val = strtoul(c, NULL, 10);
-            json_object_set_new(js, "status", json_integer(val));
-            SCFree(c);
-        }
+        char status[16];
+        size_t len = MIN(bstr_len(tx->response_status), sizeof(status) - 1);
+        memcpy(status, bstr_ptr(tx->response_status), len);
+        status[len] = '\0';
+        unsigned int val = strtoul(status, NULL, 10);
+        JsonBuilderSetUint(jb, "status", val);
 
         htp_header_t *h_location = htp_table_get_c(tx->response_headers, "location");
         if (h_location != NULL) {
-            c = bstr_util_strdup_to_c(h_location->value);
-            if (c != NULL) {
-                json_object_set_new(js, "redirect", json_string(c));
-                SCFree(c);
-            }
+            JsonHttpSetBstr(jb, "redirect", h_location->value);
         }
     }
 
     /* length */
-    json_object_set_new(js, "length", json_integer(tx->response_message_len));
+    JsonBuilderSetInt(jb, "length", tx->response_message_len);
 }
 
 /* JSON format logging */
-static void JsonHttpLogJSON(JsonHttpLogThread *aft, json_t *js, htp_tx_t *tx, uint64_t tx_id)
+static void JsonHttpLogJSON(JsonHttpLogThread *aft, JsonBuilder *jb, htp_tx_t *tx, uint64_t tx_id)
 {
     LogHttpFileCtx *http_ctx = aft->httplog_ctx;
-    json_t *hjs = json_object();
-    if (hjs == NULL) {
-        return;
-    }
 
-    JsonHttpLogJSONBasic(hjs, tx);
+    JsonBuilderOpenObject(jb, "http");
+
+    JsonHttpLogJSONBasic(jb, tx);
     /* log custom fields if configured */
     if (http_ctx->fields != 0)
-        JsonHttpLogJSONCustom(http_ctx, hjs, tx);
+        JsonHttpLogJSONCustom(http_ctx, jb, tx);
     if (http_ctx->flags & LOG_HTTP_EXTENDED)
-        JsonHttpLogJSONExtended(hjs, tx);
+        JsonHttpLogJSONExtended(jb, tx);
 
-    json_object_set_new(js, "http", hjs);
+    JsonBuilderClose(jb);
 }
 
 static int JsonHttpLogger(ThreadVars *tv, void *thread_data, const Packet *p, Flow *f, void *alstate, void *txptr, uint64_t tx_id)
@@ -374,46 +338,47 @@ static int JsonHttpLogger(ThreadVars *tv, void *thread_data, const Packet *p, Fl
 
     htp_tx_t *tx = txptr;
     JsonHttpLogThread *jhl = (JsonHttpLogThread *)thread_data;
-
-    json_t *js = CreateJSONHeaderWithTxId((Packet *)p, 1, "http", tx_id); //TODO const
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
+    LogFileCtx *file_ctx = jhl->httplog_ctx->file_ctx;
+    JsonAddrInfo addr;
+    JsonBuilder jb;
 
     SCLogDebug("got a HTTP request and now logging !!");
 
-    /* reset */
-    MemBufferReset(jhl->buffer);
-
-    JsonHttpLogJSON(jhl, js, tx, tx_id);
+    JsonAddrInfoInit(p, 1, &addr);
+    OutputJsonBuilderStart(&jb, file_ctx, &jhl->buffer);
+    OutputJsonBuilderHeader(&jb, p, &addr, "http");
+    /* tx id for correlation with other events */
+    JsonBuilderSetUint(&jb, "tx_id", tx_id);
 
-    OutputJSONBuffer(js, jhl->httplog_ctx->file_ctx, &jhl->buffer);
-    json_object_del(js, "http");
+    JsonHttpLogJSON(jhl, &jb, tx, tx_id);
 
-    json_object_clear(js);
-    json_decref(js);
+    OutputJsonBuilderWrite(&jb, file_ctx);
 
     SCReturnInt(TM_ECODE_OK);
 }
 
-json_t *JsonHttpAddMetadata(const Flow *f, uint64_t tx_id)
+/**
+ *  \brief add the basic and extended http fields of a tx as object 'key'
+ *
+ *  \retval 1 added, 0 no tx
+ */
+int JsonHttpBuildMetadata(JsonBuilder *jb, const char *key,
+                          const Flow *f, uint64_t tx_id)
 {
     HtpState *htp_state = (HtpState *)FlowGetAppState(f);
     if (htp_state) {
         htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, htp_state, tx_id);
 
         if (tx) {
-            json_t *hjs = json_object();
-            if (unlikely(hjs == NULL))
-                return NULL;
-
-            JsonHttpLogJSONBasic(hjs, tx);
-            JsonHttpLogJSONExtended(hjs, tx);
-
-            return hjs;
+            JsonBuilderOpenObject(jb, key);
+            JsonHttpLogJSONBasic(jb, tx);
+            JsonHttpLogJSONExtended(jb, tx);
+            JsonBuilderClose(jb);
+            return 1;
         }
     }
 
-    return NULL;
+    return 0;
 }
 
 static void OutputHttpLogDeinit(OutputCtx *output_ctx)
@@ -582,6 +547,145 @@ static TmEcode JsonHttpLogThreadDeinit(ThreadVars *t, void *data)
     return TM_ECODE_OK;
 }
 
+#ifdef UNITTESTS
+static void JsonHttpTestSetBstr(json_t *js, const char *key, bstr *b)
+{
+    char *c = bstr_util_strdup_to_c(b);
+    if (c != NULL) {
+        json_object_set_new(js, key, json_string(c));
+        SCFree(c);
+    }
+}
+
+/** \internal
+ *  \brief the basic and extended fields as the jansson logger built them,
+ *         as reference for the streaming encoder */
+static void JsonHttpTestJansson(json_t *js, htp_tx_t *tx)
+{
+    htp_header_t *h;
+
+    if (tx->request_hostname != NULL)
+        JsonHttpTestSetBstr(js, "hostname", tx->request_hostname);
+    if (tx->request_uri != NULL)
+        JsonHttpTestSetBstr(js, "url", tx->request_uri);
+    if ((h = htp_table_get_c(tx->request_headers, "user-agent")) != NULL)
+        JsonHttpTestSetBstr(js, "http_user_agent", h->value);
+    if ((h = htp_table_get_c(tx->request_headers, "x-forwarded-for")) != NULL)
+        JsonHttpTestSetBstr(js, "xff", h->value);
+    if ((h = htp_table_get_c(tx->response_headers, "content-type")) != NULL) {
+        char *c = bstr_util_strdup_to_c(h->value);
+        if (c != NULL) {
+            char *p = strchr(c, ';');
+            if (p != NULL)
+                *p = '\0';
+            json_object_set_new(js, "http_content_type", json_string(c));
+            SCFree(c);
+        }
+    }
+
+    if ((h = htp_table_get_c(tx->request_headers, "referer")) != NULL)
+        JsonHttpTestSetBstr(js, "http_refer", h->value);
+    if (tx->request_method != NULL)
+        JsonHttpTestSetBstr(js, "http_method", tx->request_method);
+    if (tx->request_protocol != NULL)
+        JsonHttpTestSetBstr(js, "protocol", tx->request_protocol);
+    if (tx->response_status != NULL) {
+        char *c = bstr_util_strdup_to_c(tx->response_status);
+        if (c != NULL) {
+            unsigned int val = strtoul(c, NULL, 10);
+            json_object_set_new(js, "status", json_integer(val));
+            SCFree(c);
+        }
+        if ((h = htp_table_get_c(tx->response_headers, "location")) != NULL)
+            JsonHttpTestSetBstr(js, "redirect", h->value);
+    }
+    json_object_set_new(js, "length", json_integer(tx->response_message_len));
+}
+
+/** \test http metadata of a parsed tx is byte for byte what the jansson
+ *        encoder produced, incl escaping and skipping invalid UTF-8 */
+static int JsonHttpTest01(void)
+{
+    uint8_t request[] =
+        "GET /index.html?a=/&b=\xc3\xa9&c=\"q\" HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0 \xe2\x82\xac\t\\\r\n"
+        "X-Forwarded-For: 10.0.0.1\r\n"
+        "Referer: http://www.example.com/\xff\r\n"
+        "\r\n";
+    uint8_t response[] =
+        "HTTP/1.1 302 Found\r\n"
+        "Content-Type: text/html; charset=utf-8\r\n"
+        "Location: /other\x7f\r\n"
+        "Content-Length: 5\r\n"
+        "\r\n"
+        "hello";
+    TcpSession ssn;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&ssn, 0, sizeof(ssn));
+    StreamTcpInitConfig(TRUE);
+
+    Flow *f = UTHBuildFlow(AF_INET, "1.2.3.4", "1.2.3.5", 1024, 80);
+    FAIL_IF_NULL(f);
+    f->protoctx = &ssn;
+    f->proto = IPPROTO_TCP;
+    f->alproto = ALPROTO_HTTP;
+
+    SCMutexLock(&f->m);
+    int r = AppLayerParserParse(alp_tctx, f, ALPROTO_HTTP,
+            STREAM_TOSERVER|STREAM_START, request, sizeof(request) - 1);
+    FAIL_IF(r != 0);
+    r = AppLayerParserParse(alp_tctx, f, ALPROTO_HTTP,
+            STREAM_TOCLIENT|STREAM_START, response, sizeof(response) - 1);
+    FAIL_IF(r != 0);
+    SCMutexUnlock(&f->m);
+
+    htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, f->alstate, 0);
+    FAIL_IF_NULL(tx);
+
+    MemBuffer *buffer = MemBufferCreateNew(1024);
+    FAIL_IF_NULL(buffer);
+    JsonBuilder jb;
+    JsonBuilderInit(&jb, &buffer);
+    FAIL_IF_NOT(JsonHttpBuildMetadata(&jb, "http", f, 0));
+    FAIL_IF(JsonBuilderFinish(&jb) != 0);
+
+    json_t *js = json_object();
+    FAIL_IF_NULL(js);
+    json_t *hjs = json_object();
+    FAIL_IF_NULL(hjs);
+    JsonHttpTestJansson(hjs, tx);
+    json_object_set_new(js, "http", hjs);
+    char *expect = json_dumps(js,
+            JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|
+            JSON_ESCAPE_SLASH);
+    FAIL_IF_NULL(expect);
+
+    /* make sure the tx has the fields the test is about */
+    FAIL_IF_NULL(strstr(expect, "\"status\":302"));
+    FAIL_IF_NULL(strstr(expect, "\"http_user_agent\":\"Mozilla\\/5.0 \\u20AC"));
+    FAIL_IF_NOT_NULL(strstr(expect, "http_refer"));
+
+    FAIL_IF(MEMBUFFER_OFFSET(buffer) != strlen(expect));
+    FAIL_IF(memcmp(MEMBUFFER_BUFFER(buffer), expect, strlen(expect)) != 0);
+
+    free(expect);
+    json_decref(js);
+    MemBufferFree(buffer);
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    UTHFreeFlow(f);
+    PASS;
+}
+
+static void JsonHttpLogRegisterTests(void)
+{
+    UtRegisterTest("JsonHttpTest01", JsonHttpTest01);
+}
+#endif /* UNITTESTS */
+
 void JsonHttpLogRegister (void)
 {
     /* register as separate module */
@@ -593,6 +697,10 @@ void JsonHttpLogRegister (void)
     OutputRegisterTxSubModule(LOGGER_JSON_HTTP, "eve-log", "JsonHttpLog",
         "eve-log.http", OutputHttpLogInitSub, ALPROTO_HTTP, JsonHttpLogger,
         JsonHttpLogThreadInit, JsonHttpLogThreadDeinit, NULL);
+
+#ifdef UNITTESTS
+    JsonHttpLogRegisterTests();
+#endif
 }
 
 #else
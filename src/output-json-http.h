@@ -24,12 +24,14 @@
 #ifndef __OUTPUT_JSON_HTTP_H__
 #define __OUTPUT_JSON_HTTP_H__
 
+#include "util-json-builder.h"
+
 void JsonHttpLogRegister(void);
 
 #ifdef HAVE_LIBJANSSON
-void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx);
-void JsonHttpLogJSONExtended(json_t *js, htp_tx_t *tx);
-json_t *JsonHttpAddMetadata(const Flow *f, uint64_t tx_id);
+void JsonHttpLogJSONBasic(JsonBuilder *jb, htp_tx_t *tx);
+void JsonHttpLogJSONExtended(JsonBuilder *jb, htp_tx_t *tx);
+int JsonHttpBuildMetadata(JsonBuilder *jb, const char *key, const Flow *f, uint64_t tx_id);
 #endif /* HAVE_LIBJANSSON */
 
 #endif /* __OUTPUT_JSON_HTTP_H__ */
@@ -55,7 +55,9 @@
 #include "util-proto-name.h"
 #include "util-optimize.h"
 #include "util-buffer.h"
+#include "util-json-builder.h"
 #include "util-logopenfile.h"
+#include "util-logopenfile-async.h"
 #include "util-device.h"
 
 
@@ -126,61 +128,66 @@ void CreateJSONFlowId(json_t *js, const Flow *f)
     json_object_set_new(js, "flow_id", json_integer(flow_id));
 }
 
-json_t *CreateJSONHeader(const Packet *p, int direction_sensitive,
-                         const char *event_type)
+/**
+ *  \brief fill in the addresses, ports and protocol name for the header
+ *
+ *  \param direction_sensitive if set the source is the client side
+ */
+void JsonAddrInfoInit(const Packet *p, int direction_sensitive,
+                      JsonAddrInfo *addr)
 {
-    char timebuf[64];
-    char srcip[46], dstip[46];
-    Port sp, dp;
-
-    json_t *js = json_object();
-    if (unlikely(js == NULL))
-        return NULL;
-
-    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
-
-    srcip[0] = '\0';
-    dstip[0] = '\0';
-    if (direction_sensitive) {
-        if ((PKT_IS_TOSERVER(p))) {
-            if (PKT_IS_IPV4(p)) {
-                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
-            } else if (PKT_IS_IPV6(p)) {
-                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
-            }
-            sp = p->sp;
-            dp = p->dp;
-        } else {
-            if (PKT_IS_IPV4(p)) {
-                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), dstip, sizeof(dstip));
-            } else if (PKT_IS_IPV6(p)) {
-                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), dstip, sizeof(dstip));
-            }
-            sp = p->dp;
-            dp = p->sp;
+    addr->src_ip[0] = '\0';
+    addr->dst_ip[0] = '\0';
+    if (direction_sensitive && !PKT_IS_TOSERVER(p)) {
+        if (PKT_IS_IPV4(p)) {
+            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
+                      addr->src_ip, sizeof(addr->src_ip));
+            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
+                      addr->dst_ip, sizeof(addr->dst_ip));
+        } else if (PKT_IS_IPV6(p)) {
+            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
+                      addr->src_ip, sizeof(addr->src_ip));
+            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
+                      addr->dst_ip, sizeof(addr->dst_ip));
         }
+        addr->sp = p->dp;
+        addr->dp = p->sp;
     } else {
         if (PKT_IS_IPV4(p)) {
-            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
-            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
+            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
+                      addr->src_ip, sizeof(addr->src_ip));
+            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
+                      addr->dst_ip, sizeof(addr->dst_ip));
         } else if (PKT_IS_IPV6(p)) {
-            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
-            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
+            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
+                      addr->src_ip, sizeof(addr->src_ip));
+            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
+                      addr->dst_ip, sizeof(addr->dst_ip));
         }
-        sp = p->sp;
-        dp = p->dp;
+        addr->sp = p->sp;
+        addr->dp = p->dp;
     }
 
-    char proto[16];
     if (SCProtoNameValid(IP_GET_IPPROTO(p)) == TRUE) {
-        strlcpy(proto, known_proto[IP_GET_IPPROTO(p)], sizeof(proto));
+        strlcpy(addr->proto, known_proto[IP_GET_IPPROTO(p)], sizeof(addr->proto));
     } else {
-        snprintf(proto, sizeof(proto), "%03" PRIu32, IP_GET_IPPROTO(p));
+        snprintf(addr->proto, sizeof(addr->proto), "%03" PRIu32, IP_GET_IPPROTO(p));
     }
+}
+
+json_t *CreateJSONHeader(const Packet *p, int direction_sensitive,
+                         const char *event_type)
+{
+    char timebuf[64];
+    JsonAddrInfo addr;
+
+    json_t *js = json_object();
+    if (unlikely(js == NULL))
+        return NULL;
+
+    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
+
+    JsonAddrInfoInit(p, direction_sensitive, &addr);
 
     /* time & tx */
     json_object_set_new(js, "timestamp", json_string(timebuf));
@@ -230,27 +237,27 @@ json_t *CreateJSONHeader(const Packet *p, int direction_sensitive,
     }
 
     /* tuple */
-    json_object_set_new(js, "src_ip", json_string(srcip));
+    json_object_set_new(js, "src_ip", json_string(addr.src_ip));
     switch(p->proto) {
         case IPPROTO_ICMP:
             break;
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "src_port", json_integer(sp));
+            json_object_set_new(js, "src_port", json_integer(addr.sp));
             break;
     }
-    json_object_set_new(js, "dest_ip", json_string(dstip));
+    json_object_set_new(js, "dest_ip", json_string(addr.dst_ip));
     switch(p->proto) {
         case IPPROTO_ICMP:
             break;
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "dest_port", json_integer(dp));
+            json_object_set_new(js, "dest_port", json_integer(addr.dp));
             break;
     }
-    json_object_set_new(js, "proto", json_string(proto));
+    json_object_set_new(js, "proto", json_string(addr.proto));
     switch (p->proto) {
         case IPPROTO_ICMP:
             if (p->icmpv4h) {
@@ -286,6 +293,117 @@ json_t *CreateJSONHeaderWithTxId(const Packet *p, int direction_sensitive,
     return js;
 }
 
+/** \brief JsonTcpFlags() for the streaming encoder */
+void JsonBuilderTcpFlags(JsonBuilder *jb, uint8_t flags)
+{
+    if (flags & TH_SYN)
+        JsonBuilderSetBool(jb, "syn", 1);
+    if (flags & TH_FIN)
+        JsonBuilderSetBool(jb, "fin", 1);
+    if (flags & TH_RST)
+        JsonBuilderSetBool(jb, "rst", 1);
+    if (flags & TH_PUSH)
+        JsonBuilderSetBool(jb, "psh", 1);
+    if (flags & TH_ACK)
+        JsonBuilderSetBool(jb, "ack", 1);
+    if (flags & TH_URG)
+        JsonBuilderSetBool(jb, "urg", 1);
+    if (flags & TH_ECN)
+        JsonBuilderSetBool(jb, "ecn", 1);
+    if (flags & TH_CWR)
+        JsonBuilderSetBool(jb, "cwr", 1);
+}
+
+/** \brief CreateJSONFlowId() for the streaming encoder */
+void JsonBuilderFlowId(JsonBuilder *jb, const Flow *f)
+{
+    if (f == NULL)
+        return;
+    int64_t flow_id = FlowGetId(f);
+    /* reduce to 51 bits as Javascript and even JSON often seem to
+     * max out there. */
+    flow_id &= 0x7ffffffffffffLL;
+    JsonBuilderSetInt(jb, "flow_id", flow_id);
+}
+
+/**
+ *  \brief CreateJSONHeader() for the streaming encoder
+ *
+ *  \param addr tuple from JsonAddrInfoInit(), possibly modified by the
+ *         caller (e.g. xff overwrite mode)
+ */
+void OutputJsonBuilderHeader(JsonBuilder *jb, const Packet *p,
+                             const JsonAddrInfo *addr, const char *event_type)
+{
+    char timebuf[64];
+
+    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
+    JsonBuilderSetString(jb, "timestamp", timebuf);
+
+    JsonBuilderFlowId(jb, (const Flow *)p->flow);
+
+    if (sensor_id >= 0)
+        JsonBuilderSetInt(jb, "sensor_id", sensor_id);
+
+    if (p->livedev)
+        JsonBuilderSetString(jb, "in_iface", p->livedev->dev);
+
+    if (p->pcap_cnt != 0)
+        JsonBuilderSetUint(jb, "pcap_cnt", p->pcap_cnt);
+
+    if (event_type)
+        JsonBuilderSetString(jb, "event_type", event_type);
+
+    switch (p->vlan_idx) {
+        case 0:
+            break;
+        case 1:
+            JsonBuilderSetUint(jb, "vlan", VLAN_GET_ID1(p));
+            break;
+        case 2:
+            JsonBuilderOpenArray(jb, "vlan");
+            JsonBuilderSetUint(jb, NULL, VLAN_GET_ID1(p));
+            JsonBuilderSetUint(jb, NULL, VLAN_GET_ID2(p));
+            JsonBuilderClose(jb);
+            break;
+        default:
+            /* shouldn't get here */
+            break;
+    }
+
+    JsonBuilderSetString(jb, "src_ip", addr->src_ip);
+    switch (p->proto) {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JsonBuilderSetUint(jb, "src_port", addr->sp);
+            break;
+    }
+    JsonBuilderSetString(jb, "dest_ip", addr->dst_ip);
+    switch (p->proto) {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JsonBuilderSetUint(jb, "dest_port", addr->dp);
+            break;
+    }
+    JsonBuilderSetString(jb, "proto", addr->proto);
+    switch (p->proto) {
+        case IPPROTO_ICMP:
+            if (p->icmpv4h) {
+                JsonBuilderSetUint(jb, "icmp_type", p->icmpv4h->type);
+                JsonBuilderSetUint(jb, "icmp_code", p->icmpv4h->code);
+            }
+            break;
+        case IPPROTO_ICMPV6:
+            if (p->icmpv6h) {
+                JsonBuilderSetUint(jb, "icmp_type", p->icmpv6h->type);
+                JsonBuilderSetUint(jb, "icmp_code", p->icmpv6h->code);
+            }
+            break;
+    }
+}
+
 int OutputJSONMemBufferCallback(const char *str, size_t size, void *data)
 {
     OutputJSONMemBufferWrapper *wrapper = data;
@@ -325,6 +443,41 @@ int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer)
     return 0;
 }
 
+/**
+ *  \brief start a record in the thread's buffer
+ *
+ *  Resets the buffer and writes the configured prefix, the record itself
+ *  is encoded right after it.
+ */
+void OutputJsonBuilderStart(JsonBuilder *jb, LogFileCtx *file_ctx,
+                            MemBuffer **buffer)
+{
+    MemBufferReset(*buffer);
+
+    if (file_ctx->prefix) {
+        MemBufferWriteRaw((*buffer), file_ctx->prefix, file_ctx->prefix_len);
+    }
+
+    JsonBuilderInit(jb, buffer);
+}
+
+/**
+ *  \brief finish a record started by OutputJsonBuilderStart() and write
+ *         it out, the counterpart of OutputJSONBuffer()
+ */
+int OutputJsonBuilderWrite(JsonBuilder *jb, LogFileCtx *file_ctx)
+{
+    if (file_ctx->sensor_name) {
+        JsonBuilderSetString(jb, "host", file_ctx->sensor_name);
+    }
+
+    if (JsonBuilderFinish(jb) != 0)
+        return TM_ECODE_OK;
+
+    LogFileWrite(file_ctx, *jb->buffer);
+    return 0;
+}
+
 /**
  * \brief Create a new LogFileCtx for "fast" output style.
  * \param conf The configuration node for this output.
@@ -430,6 +583,16 @@ OutputCtx *OutputJsonInitCtx(ConfNode *conf)
             json_ctx->json_out == LOGFILE_TYPE_UNIX_DGRAM ||
             json_ctx->json_out == LOGFILE_TYPE_UNIX_STREAM)
         {
+            int threaded = 0;
+            if (ConfGetChildValueBool(conf, "threaded", &threaded) && threaded) {
+                if (LogFileSetThreaded(json_ctx->file_ctx) < 0) {
+                    LogFileFreeCtx(json_ctx->file_ctx);
+                    SCFree(json_ctx);
+                    SCFree(output_ctx);
+                    return NULL;
+                }
+            }
+
             if (SCConfLogOpenGeneric(conf, json_ctx->file_ctx, DEFAULT_LOG_FILENAME, 1) < 0) {
                 LogFileFreeCtx(json_ctx->file_ctx);
                 SCFree(json_ctx);
@@ -438,6 +601,13 @@ OutputCtx *OutputJsonInitCtx(ConfNode *conf)
             }
             OutputRegisterFileRotationFlag(&json_ctx->file_ctx->rotation_flag);
 
+            if (LogFileAsyncSetup(conf, json_ctx->file_ctx) < 0) {
+                LogFileFreeCtx(json_ctx->file_ctx);
+                SCFree(json_ctx);
+                SCFree(output_ctx);
+                return NULL;
+            }
+
             const char *format_s = ConfNodeLookupChildValue(conf, "format");
             if (format_s != NULL) {
                 if (strcmp(format_s, "indent") == 0) {
@@ -26,6 +26,7 @@
 
 #include "suricata-common.h"
 #include "util-buffer.h"
+#include "util-json-builder.h"
 #include "util-logopenfile.h"
 
 void OutputJsonRegister(void);
@@ -44,6 +45,23 @@ void JsonTcpFlags(uint8_t flags, json_t *js);
 json_t *CreateJSONHeader(const Packet *p, int direction_sensative, const char *event_type);
 json_t *CreateJSONHeaderWithTxId(const Packet *p, int direction_sensitive, const char *event_type, uint64_t tx_id);
 int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer);
+
+/** tuple part of the record header */
+typedef struct JsonAddrInfo_ {
+    char src_ip[46];
+    char dst_ip[46];
+    Port sp;
+    Port dp;
+    char proto[16];
+} JsonAddrInfo;
+
+void JsonAddrInfoInit(const Packet *p, int direction_sensitive, JsonAddrInfo *addr);
+void JsonBuilderFlowId(JsonBuilder *jb, const Flow *f);
+void JsonBuilderTcpFlags(JsonBuilder *jb, uint8_t flags);
+void OutputJsonBuilderHeader(JsonBuilder *jb, const Packet *p,
+        const JsonAddrInfo *addr, const char *event_type);
+void OutputJsonBuilderStart(JsonBuilder *jb, LogFileCtx *file_ctx, MemBuffer **buffer);
+int OutputJsonBuilderWrite(JsonBuilder *jb, LogFileCtx *file_ctx);
 OutputCtx *OutputJsonInitCtx(ConfNode *);
 
 enum JsonFormat { COMPACT, INDENT };
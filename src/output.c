@@ -105,6 +105,8 @@ typedef struct OutputFileRolloverFlag_ {
 
 TAILQ_HEAD(, OutputFileRolloverFlag_) output_file_rotation_flags =
     TAILQ_HEAD_INITIALIZER(output_file_rotation_flags);
+/** flags are also registered at runtime by the threaded eve output */
+static SCMutex output_file_rotation_lock = SCMUTEX_INITIALIZER;
 
 void OutputRegisterRootLoggers(void);
 void OutputRegisterLoggers(void);
@@ -879,7 +881,9 @@ void OutputRegisterFileRotationFlag(int *flag)
         return;
     }
     flag_entry->flag = flag;
+    SCMutexLock(&output_file_rotation_lock);
     TAILQ_INSERT_TAIL(&output_file_rotation_flags, flag_entry, entries);
+    SCMutexUnlock(&output_file_rotation_lock);
 }
 
 /**
@@ -895,6 +899,7 @@ void OutputRegisterFileRotationFlag(int *flag)
 void OutputUnregisterFileRotationFlag(int *flag)
 {
     OutputFileRolloverFlag *entry, *next;
+    SCMutexLock(&output_file_rotation_lock);
     for (entry = TAILQ_FIRST(&output_file_rotation_flags); entry != NULL;
          entry = next) {
         next = TAILQ_NEXT(entry, entries);
@@ -904,6 +909,7 @@ void OutputUnregisterFileRotationFlag(int *flag)
             break;
         }
     }
+    SCMutexUnlock(&output_file_rotation_lock);
 }
 
 /**
@@ -911,9 +917,11 @@ void OutputUnregisterFileRotationFlag(int *flag)
  */
 void OutputNotifyFileRotation(void) {
     OutputFileRolloverFlag *flag;
+    SCMutexLock(&output_file_rotation_lock);
     TAILQ_FOREACH(flag, &output_file_rotation_flags, entries) {
         *(flag->flag) = 1;
     }
+    SCMutexUnlock(&output_file_rotation_lock);
 }
 
 TmEcode OutputLoggerLog(ThreadVars *tv, Packet *p, void *thread_data)
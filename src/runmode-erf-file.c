@@ -156,7 +156,7 @@ int RunModeErfFileAutoFp(void)
     ThreadVars *tv =
         TmThreadCreatePacketHandler(thread_name_autofp,
                                     "packetpool", "packetpool",
-                                    queues, "flow",
+                                    queues, RunmodeAutoFpQueueHandler(),
                                     "pktacqloop");
     SCFree(queues);
 
@@ -199,7 +199,7 @@ int RunModeErfFileAutoFp(void)
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, RunmodeAutoFpQueueHandler(),
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -193,7 +193,7 @@ int RunModeFilePcapAutoFp(void)
     ThreadVars *tv_receivepcap =
         TmThreadCreatePacketHandler(tname,
                                     "packetpool", "packetpool",
-                                    queues, "flow",
+                                    queues, RunmodeAutoFpQueueHandler(),
                                     "pktacqloop");
     SCFree(queues);
 
@@ -231,7 +231,7 @@ int RunModeFilePcapAutoFp(void)
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, RunmodeAutoFpQueueHandler(),
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -92,9 +92,15 @@
 #include "util-reference-config.h"
 #include "util-profiling.h"
 #include "util-magic.h"
+#include "log-filestore-async.h"
+#include "util-logopenfile.h"
+#include "util-logopenfile-async.h"
+#include "util-logopenfile-redis.h"
+#include "util-json-builder.h"
 #include "util-memcmp.h"
 #include "util-misc.h"
 #include "util-ringbuffer.h"
+#include "util-spsc-ring.h"
 #include "util-signal.h"
 
 #include "reputation.h"
@@ -111,12 +117,15 @@
 
 #include "util-mpm-ac.h"
 #include "util-mpm-hs.h"
+#include "util-mpm-cache.h"
 
 #include "util-decode-asn1.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
 #include "tmqh-flow.h"
+#include "tmqh-flow-ring.h"
+#include "tmqh-packetpool.h"
 #include "defrag.h"
 #include "detect-engine-siggroup.h"
 
@@ -208,6 +217,7 @@ void RunUnittests(int list_unittests, char *regex_arg)
     PoolRegisterTests();
     ByteRegisterTests();
     MpmRegisterTests();
+    MpmCacheRegisterTests();
     FlowBitRegisterTests();
     HostBitRegisterTests();
     IPPairBitRegisterTests();
@@ -229,6 +239,8 @@ void RunUnittests(int list_unittests, char *regex_arg)
     ConfRegisterTests();
     ConfYamlRegisterTests();
     TmqhFlowRegisterTests();
+    TmqhFlowRingRegisterTests();
+    PacketPoolRegisterTests();
     FlowRegisterTests();
     HostRegisterUnittests();
     IPPairRegisterUnittests();
@@ -256,6 +268,7 @@ void RunUnittests(int list_unittests, char *regex_arg)
 #endif
     DeStateRegisterTests();
     DetectRingBufferRegisterTests();
+    SpscRingRegisterTests();
     MemcmpRegisterTests();
     DetectEngineHttpClientBodyRegisterTests();
     DetectEngineHttpServerBodyRegisterTests();
@@ -274,6 +287,11 @@ void RunUnittests(int list_unittests, char *regex_arg)
     DetectEngineSMTPFiledataRegisterTests();
     SCLogRegisterTests();
     MagicRegisterTests();
+    LogFilestoreAsyncRegisterTests();
+    LogFileRegisterTests();
+    LogFileAsyncRegisterTests();
+    LogFileRedisAsyncRegisterTests();
+    JsonBuilderRegisterTests();
     UtilMiscRegisterTests();
     DetectAddressTests();
     DetectProtoTests();
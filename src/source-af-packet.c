@@ -912,17 +912,17 @@ next_frame:
 }
 
 #ifdef HAVE_TPACKET_V3
+/** max number of packets taken from the packet pool at once */
+#define AFP_V3_PKTS_BURST   64
+
 static inline void AFPFlushBlock(struct tpacket_block_desc *pbd)
 {
     pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
 }
 
-static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd, struct tpacket3_hdr *ppd)
+static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd,
+        struct tpacket3_hdr *ppd, Packet *p)
 {
-    Packet *p = PacketGetFromQueueOrAlloc();
-    if (p == NULL) {
-        SCReturnInt(AFP_FAILURE);
-    }
     PKT_SET_SRC(p, PKT_SRC_WIRE);
 
     ptv->pkts++;
@@ -987,11 +987,24 @@ static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pb
 {
     int num_pkts = pbd->hdr.bh1.num_pkts, i;
     uint8_t *ppd;
+    /* packets are taken from the pool per burst instead of one by one */
+    Packet *pkts[AFP_V3_PKTS_BURST];
+    uint32_t pkts_cnt = 0, pkts_idx = 0;
 
     ppd = (uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt;
     for (i = 0; i < num_pkts; ++i) {
+        if (pkts_idx == pkts_cnt) {
+            pkts_cnt = PacketGetFromQueueOrAllocBatch(
+                    MIN(num_pkts - i, AFP_V3_PKTS_BURST), pkts);
+            pkts_idx = 0;
+            if (unlikely(pkts_cnt == 0)) {
+                SCReturnInt(AFP_READ_FAILURE);
+            }
+        }
         if (unlikely(AFPParsePacketV3(ptv, pbd,
-                             (struct tpacket3_hdr *)ppd) == AFP_FAILURE)) {
+                             (struct tpacket3_hdr *)ppd, pkts[pkts_idx++]) == AFP_FAILURE)) {
+            /* hand back the packets we didn't use */
+            PacketPoolReturnPackets(&pkts[pkts_idx], pkts_cnt - pkts_idx);
             SCReturnInt(AFP_READ_FAILURE);
         }
         ppd = ppd + ((struct tpacket3_hdr *)ppd)->tp_next_offset;
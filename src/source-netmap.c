@@ -133,6 +133,9 @@ TmEcode NoNetmapSupportExit(ThreadVars *tv, void *initdata, void **data)
 
 #define POLL_TIMEOUT 100
 
+/** max number of packets taken from the packet pool at once */
+#define NETMAP_PKTS_BURST 64
+
 #if defined(__linux__)
 #define POLL_EVENTS (POLLHUP|POLLRDHUP|POLLERR|POLLNVAL)
 
@@ -749,6 +752,10 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
     uint32_t avail = nm_ring_space(rx);
     uint32_t cur = rx->cur;
 
+    /* packets are taken from the pool per burst instead of one by one */
+    Packet *pkts[NETMAP_PKTS_BURST];
+    uint32_t pkts_cnt = 0, pkts_idx = 0;
+
     if (!(ntv->flags & NETMAP_FLAG_ZERO_COPY)) {
         PacketPoolWaitForN(avail);
     }
@@ -766,10 +773,14 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
             }
         }
 
-        Packet *p = PacketPoolGetPacket();
-        if (unlikely(p == NULL)) {
-            SCReturnInt(NETMAP_FAILURE);
+        if (pkts_idx == pkts_cnt) {
+            pkts_cnt = PacketPoolGetPackets(MIN(avail + 1, NETMAP_PKTS_BURST), pkts);
+            pkts_idx = 0;
+            if (unlikely(pkts_cnt == 0)) {
+                SCReturnInt(NETMAP_FAILURE);
+            }
         }
+        Packet *p = pkts[pkts_idx++];
 
         PKT_SET_SRC(p, PKT_SRC_WIRE);
         p->livedev = ntv->livedev;
@@ -795,11 +806,13 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
         if (ntv->flags & NETMAP_FLAG_ZERO_COPY) {
             if (PacketSetData(p, slot_data, slot->len) == -1) {
                 TmqhOutputPacketpool(ntv->tv, p);
+                PacketPoolReturnPackets(&pkts[pkts_idx], pkts_cnt - pkts_idx);
                 SCReturnInt(NETMAP_FAILURE);
             }
         } else {
             if (PacketCopyData(p, slot_data, slot->len) == -1) {
                 TmqhOutputPacketpool(ntv->tv, p);
+                PacketPoolReturnPackets(&pkts[pkts_idx], pkts_cnt - pkts_idx);
                 SCReturnInt(NETMAP_FAILURE);
             }
         }
@@ -822,6 +835,7 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
 
         if (TmThreadsSlotProcessPkt(ntv->tv, ntv->slot, p) != TM_ECODE_OK) {
             TmqhOutputPacketpool(ntv->tv, p);
+            PacketPoolReturnPackets(&pkts[pkts_idx], pkts_cnt - pkts_idx);
             SCReturnInt(NETMAP_FAILURE);
         }
 
@@ -829,6 +843,9 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
     }
     rx->head = rx->cur = cur;
 
+    /* slots rejected by bpf leave packets unused */
+    PacketPoolReturnPackets(&pkts[pkts_idx], pkts_cnt - pkts_idx);
+
     SCReturnInt(NETMAP_OK);
 }
 
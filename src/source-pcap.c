@@ -59,6 +59,10 @@
 
 #define PCAP_RECONNECT_TIMEOUT 500000
 
+/** max number of packets read per pcap_dispatch call, taken from the
+ *  packet pool at once */
+#define PCAP_PKTS_BURST 64
+
 /**
  * \brief Structure to hold thread specific variables.
  */
@@ -103,6 +107,11 @@ typedef struct PcapThreadVars_
     char iface[PCAP_IFACE_NAME_LENGTH];
 #endif
     LiveDevice *livedev;
+
+    /* packets taken from the pool for the next pcap_dispatch call */
+    uint32_t pool_pkts_cnt;
+    uint32_t pool_pkts_idx;
+    Packet *pool_pkts[PCAP_PKTS_BURST];
 } PcapThreadVars;
 
 TmEcode ReceivePcapThreadInit(ThreadVars *, void *, void **);
@@ -233,11 +242,17 @@ void PcapCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     SCEnter();
 
     PcapThreadVars *ptv = (PcapThreadVars *)user;
-    Packet *p = PacketGetFromQueueOrAlloc();
+    Packet *p;
     struct timeval current_time;
 
-    if (unlikely(p == NULL)) {
-        SCReturn;
+    if (likely(ptv->pool_pkts_idx < ptv->pool_pkts_cnt)) {
+        p = ptv->pool_pkts[ptv->pool_pkts_idx++];
+        PACKET_PROFILING_START(p);
+    } else {
+        p = PacketGetFromQueueOrAlloc();
+        if (unlikely(p == NULL)) {
+            SCReturn;
+        }
     }
 
     PKT_SET_SRC(p, PKT_SRC_WIRE);
@@ -289,6 +304,15 @@ void PcapCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     SCReturn;
 }
 
+/** \internal
+ *  \brief return the packets we took from the pool but didn't use */
+static void PcapReturnPackets(PcapThreadVars *ptv)
+{
+    PacketPoolReturnPackets(&ptv->pool_pkts[ptv->pool_pkts_idx],
+            ptv->pool_pkts_cnt - ptv->pool_pkts_idx);
+    ptv->pool_pkts_cnt = ptv->pool_pkts_idx = 0;
+}
+
 /**
  *  \brief Main PCAP reading Loop function
  */
@@ -296,7 +320,7 @@ TmEcode ReceivePcapLoop(ThreadVars *tv, void *data, void *slot)
 {
     SCEnter();
 
-    int packet_q_len = 64;
+    int packet_q_len = PCAP_PKTS_BURST;
     PcapThreadVars *ptv = (PcapThreadVars *)data;
     int r;
     TmSlot *s = (TmSlot *)slot;
@@ -306,12 +330,18 @@ TmEcode ReceivePcapLoop(ThreadVars *tv, void *data, void *slot)
 
     while (1) {
         if (suricata_ctl_flags & SURICATA_STOP) {
+            PcapReturnPackets(ptv);
             SCReturnInt(TM_ECODE_OK);
         }
 
-        /* make sure we have at least one packet in the packet pool, to prevent
-         * us from alloc'ing packets at line rate */
-        PacketPoolWait();
+        /* take a burst of packets from the pool at once. Make sure we have
+         * at least one packet, to prevent us from alloc'ing packets at line
+         * rate */
+        if (ptv->pool_pkts_idx == ptv->pool_pkts_cnt) {
+            PacketPoolWait();
+            ptv->pool_pkts_cnt = PacketPoolGetPackets(PCAP_PKTS_BURST, ptv->pool_pkts);
+            ptv->pool_pkts_idx = 0;
+        }
 
         /* Right now we just support reading packets one at a time. */
         r = pcap_dispatch(ptv->pcap_handle, packet_q_len,
@@ -322,6 +352,7 @@ TmEcode ReceivePcapLoop(ThreadVars *tv, void *data, void *slot)
                        r, pcap_geterr(ptv->pcap_handle));
 #ifdef PCAP_ERROR_BREAK
             if (r == PCAP_ERROR_BREAK) {
+                PcapReturnPackets(ptv);
                 SCReturnInt(ptv->cb_result);
             }
 #endif
@@ -338,6 +369,7 @@ TmEcode ReceivePcapLoop(ThreadVars *tv, void *data, void *slot)
             }
         } else if (ptv->cb_result == TM_ECODE_FAILED) {
             SCLogError(SC_ERR_PCAP_DISPATCH, "Pcap callback PcapCallbackLoop failed");
+            PcapReturnPackets(ptv);
             SCReturnInt(TM_ECODE_FAILED);
         } else if (unlikely(r == 0)) {
             TmThreadsCaptureInjectPacket(tv, ptv->slot, NULL);
@@ -346,6 +378,7 @@ TmEcode ReceivePcapLoop(ThreadVars *tv, void *data, void *slot)
         StatsSyncCountersIfSignalled(tv);
     }
 
+    PcapReturnPackets(ptv);
     PcapDumpCounters(ptv);
     StatsSyncCountersIfSignalled(tv);
     SCReturnInt(TM_ECODE_OK);
@@ -25,6 +25,8 @@
 
 #include "suricata-common.h"
 #include "stream-tcp-inline.h"
+#include "stream-tcp-reassemble.h"
+#include "stream-tcp-util.h"
 
 #include "util-memcmp.h"
 #include "util-print.h"
@@ -47,76 +49,65 @@ int StreamTcpInlineMode(void)
 }
 
 /**
- *  \brief Compare the shared data portion of two segments
+ *  \brief Compare the data a packet shares with a segment
  *
  *  If no data is shared, 0 will be returned.
  *
- *  \param seg1 first segment
- *  \param seg2 second segment
+ *  \param stream stream the segment is in
+ *  \param p packet
+ *  \param seg segment
  *
  *  \retval 0 shared data is the same (or no data is shared)
  *  \retval 1 shared data is different
  */
-int StreamTcpInlineSegmentCompare(TcpSegment *seg1, TcpSegment *seg2)
+int StreamTcpInlineSegmentCompare(const TcpStream *stream,
+        const Packet *p, const TcpSegment *seg)
 {
     SCEnter();
 
-    if (seg1 == NULL || seg2 == NULL) {
+    if (p == NULL || seg == NULL) {
         SCReturnInt(0);
     }
 
-    if (SEQ_EQ(seg1->seq, seg2->seq) && seg1->payload_len == seg2->payload_len) {
-        int r = SCMemcmp(seg1->payload, seg2->payload, seg1->payload_len);
-#if 0
-        if (r) {
-            PrintRawDataFp(stdout,seg1->payload,seg1->payload_len);
-            PrintRawDataFp(stdout,seg2->payload,seg2->payload_len);
-        }
-#endif
-        SCReturnInt(r);
-    } else if (SEQ_GT(seg1->seq, (seg2->seq + seg2->payload_len))) {
+    const uint8_t *seg_data;
+    uint32_t seg_datalen;
+    StreamTcpSegmentGetData(stream, seg, &seg_data, &seg_datalen);
+    if (seg_data == NULL || seg_datalen == 0)
+        SCReturnInt(0);
+
+    const uint8_t *pkt_data = p->payload;
+    uint32_t pkt_datalen = p->payload_len;
+    uint32_t pkt_seq = TCP_GET_SEQ(p);
+
+    if (SEQ_GT(seg->seq, (pkt_seq + pkt_datalen))) {
         SCReturnInt(0);
-    } else if (SEQ_GT(seg2->seq, (seg1->seq + seg1->payload_len))) {
+    } else if (SEQ_GT(pkt_seq, (seg->seq + seg_datalen))) {
         SCReturnInt(0);
     } else {
-        SCLogDebug("seg1 %u (%u), seg2 %u (%u)", seg1->seq,
-                seg1->payload_len, seg2->seq, seg2->payload_len);
-
-        uint32_t seg1_end = seg1->seq + seg1->payload_len;
-        uint32_t seg2_end = seg2->seq + seg2->payload_len;
-        SCLogDebug("seg1_end %u, seg2_end %u", seg1_end, seg2_end);
-#if 0
-        SCLogDebug("seg1");
-        PrintRawDataFp(stdout,seg1->payload,seg1->payload_len);
-        SCLogDebug("seg2");
-        PrintRawDataFp(stdout,seg2->payload,seg2->payload_len);
-#endif
+        SCLogDebug("p %u (%u), seg %u (%u)", pkt_seq,
+                pkt_datalen, seg->seq, seg_datalen);
+
+        uint32_t pkt_end = pkt_seq + pkt_datalen;
+        uint32_t seg_end = seg->seq + seg_datalen;
+        SCLogDebug("pkt_end %u, seg_end %u", pkt_end, seg_end);
+
         /* get the minimal seg*_end */
-        uint32_t end = (SEQ_GT(seg1_end, seg2_end)) ? seg2_end : seg1_end;
+        uint32_t end = (SEQ_GT(pkt_end, seg_end)) ? seg_end : pkt_end;
         /* and the max seq */
-        uint32_t seq = (SEQ_LT(seg1->seq, seg2->seq)) ? seg2->seq : seg1->seq;
+        uint32_t seq = (SEQ_LT(pkt_seq, seg->seq)) ? seg->seq : pkt_seq;
 
         SCLogDebug("seq %u, end %u", seq, end);
 
-        uint16_t seg1_off = seq - seg1->seq;
-        uint16_t seg2_off = seq - seg2->seq;
-        SCLogDebug("seg1_off %u, seg2_off %u", seg1_off, seg2_off);
+        uint16_t pkt_off = seq - pkt_seq;
+        uint16_t seg_off = seq - seg->seq;
+        SCLogDebug("pkt_off %u, seg_off %u", pkt_off, seg_off);
 
         uint32_t range = end - seq;
         SCLogDebug("range %u", range);
         BUG_ON(range > 65536);
 
         if (range) {
-            int r = SCMemcmp(seg1->payload+seg1_off, seg2->payload+seg2_off, range);
-#if 0
-            if (r) {
-                PrintRawDataFp(stdout,seg1->payload+seg1_off,range);
-                PrintRawDataFp(stdout,seg2->payload+seg2_off,range);
-
-                PrintRawDataFp(stdout,seg1->payload,seg1->payload_len);
-                PrintRawDataFp(stdout,seg2->payload,seg2->payload_len);
-            }
-#endif
+            int r = SCMemcmp(pkt_data+pkt_off, seg_data+seg_off, range);
             SCReturnInt(r);
         }
         SCReturnInt(0);
@@ -127,35 +118,38 @@ int StreamTcpInlineSegmentCompare(TcpSegment *seg1, TcpSegment *seg2)
  *  \brief Replace (part of) the payload portion of a packet by the data
  *         in a TCP segment
  *
+ *  \param stream stream the segment is in
  *  \param p Packet
  *  \param seg TCP segment
  *
  *  \todo What about reassembled fragments?
  *  \todo What about unwrapped tunnel packets?
  */
-void StreamTcpInlineSegmentReplacePacket(Packet *p, TcpSegment *seg)
+void StreamTcpInlineSegmentReplacePacket(const TcpStream *stream,
+        Packet *p, const TcpSegment *seg)
 {
     SCEnter();
 
     uint32_t pseq = TCP_GET_SEQ(p);
     uint32_t tseq = seg->seq;
 
+    const uint8_t *seg_data;
+    uint32_t seg_datalen;
+    StreamTcpSegmentGetData(stream, seg, &seg_data, &seg_datalen);
+    if (seg_data == NULL || seg_datalen == 0)
+        SCReturn;
+
     /* check if segment is within the packet */
-    if (tseq + seg->payload_len < pseq) {
+    if (tseq + seg_datalen < pseq) {
         SCReturn;
     } else if (pseq + p->payload_len < tseq) {
         SCReturn;
     } else {
         /** \todo review logic */
         uint32_t pend = pseq + p->payload_len;
-        uint32_t tend = tseq + seg->payload_len;
+        uint32_t tend = tseq + seg_datalen;
         SCLogDebug("pend %u, tend %u", pend, tend);
 
-        //SCLogDebug("packet");
-        //PrintRawDataFp(stdout,p->payload,p->payload_len);
-        //SCLogDebug("seg");
-        //PrintRawDataFp(stdout,seg->payload,seg->payload_len);
-
         /* get the minimal seg*_end */
         uint32_t end = (SEQ_GT(pend, tend)) ? tend : pend;
         /* and the max seq */
@@ -174,7 +168,7 @@ void StreamTcpInlineSegmentReplacePacket(Packet *p, TcpSegment *seg)
         if (range) {
             /* update the packets payload. As payload is a ptr to either
              * p->pkt or p->ext_pkt that is updated as well */
-            memcpy(p->payload+poff, seg->payload+toff, range);
+            memcpy(p->payload+poff, seg_data+toff, range);
 
             /* flag as modified so we can reinject / replace after
              * recalculating the checksum */
@@ -194,6 +188,13 @@ static int StreamTcpInlineTest01(void)
     uint8_t payload2[] = "ABC"; /* segment */
     int result = 0;
     TcpSegment *t = NULL;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpStream stream;
+
+    memset(&tv, 0x00, sizeof(tv));
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupStream(&stream, 1);
 
     Packet *p = UTHBuildPacketSrcDstPorts(payload1, sizeof(payload1)-1, IPPROTO_TCP, 1024, 80);
     if (p == NULL || p->tcph == NULL) {
@@ -202,28 +203,25 @@ static int StreamTcpInlineTest01(void)
     }
     p->tcph->th_seq = htonl(10000000UL);
 
-    t = SCMalloc(sizeof(TcpSegment));
-    if (unlikely(t == NULL)) {
-        printf("alloc TcpSegment failed: ");
+    if (StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &stream, 10000000UL,
+                payload2, sizeof(payload2)-1) == -1) {
+        printf("adding segment failed: ");
         goto end;
     }
-    memset(t, 0x00, sizeof(TcpSegment));
-    t->payload = payload2;
-    t->payload_len = sizeof(payload2)-1;
-    t->seq = 10000000UL;
+    t = stream.seg_list;
 
-    StreamTcpInlineSegmentReplacePacket(p, t);
+    StreamTcpInlineSegmentReplacePacket(&stream, p, t);
 
     if (!(p->flags & PKT_STREAM_MODIFIED)) {
         printf("PKT_STREAM_MODIFIED pkt flag not set: ");
         goto end;
     }
 
-    if (memcmp(p->payload, t->payload, p->payload_len) != 0) {
+    if (memcmp(p->payload, payload2, p->payload_len) != 0) {
         printf("Packet:\n");
         PrintRawDataFp(stdout,p->payload,p->payload_len);
         printf("Segment:\n");
-        PrintRawDataFp(stdout,t->payload,t->payload_len);
+        PrintRawDataFp(stdout,payload2,t->payload_len);
         printf("payloads didn't match: ");
         goto end;
     }
@@ -240,9 +238,8 @@ end:
     if (p != NULL) {
         UTHFreePacket(p);
     }
-    if (t != NULL) {
-        SCFree(t);
-    }
+    StreamTcpUTClearStream(&stream);
+    StreamTcpUTDeinit(ra_ctx);
     SCReturnInt(result);
 }
 
@@ -255,6 +252,13 @@ static int StreamTcpInlineTest02(void)
     uint8_t payload2[] = "ABCDE"; /* segment */
     int result = 0;
     TcpSegment *t = NULL;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpStream stream;
+
+    memset(&tv, 0x00, sizeof(tv));
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupStream(&stream, 1);
 
     Packet *p = UTHBuildPacketSrcDstPorts(payload1, sizeof(payload1)-1, IPPROTO_TCP, 1024, 80);
     if (p == NULL || p->tcph == NULL) {
@@ -263,28 +267,25 @@ static int StreamTcpInlineTest02(void)
     }
     p->tcph->th_seq = htonl(10000001UL);
 
-    t = SCMalloc(sizeof(TcpSegment));
-    if (unlikely(t == NULL)) {
-        printf("alloc TcpSegment failed: ");
+    if (StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &stream, 10000000UL,
+                payload2, sizeof(payload2)-1) == -1) {
+        printf("adding segment failed: ");
         goto end;
     }
-    memset(t, 0x00, sizeof(TcpSegment));
-    t->payload = payload2;
-    t->payload_len = sizeof(payload2)-1;
-    t->seq = 10000000UL;
+    t = stream.seg_list;
 
-    StreamTcpInlineSegmentReplacePacket(p, t);
+    StreamTcpInlineSegmentReplacePacket(&stream, p, t);
 
     if (!(p->flags & PKT_STREAM_MODIFIED)) {
         printf("PKT_STREAM_MODIFIED pkt flag not set: ");
         goto end;
     }
 
-    if (memcmp(p->payload, t->payload+1, p->payload_len) != 0) {
+    if (memcmp(p->payload, payload2+1, p->payload_len) != 0) {
         printf("Packet:\n");
         PrintRawDataFp(stdout,p->payload,p->payload_len);
         printf("Segment:\n");
-        PrintRawDataFp(stdout,t->payload,t->payload_len);
+        PrintRawDataFp(stdout,payload2,t->payload_len);
         printf("payloads didn't match: ");
         goto end;
     }
@@ -306,9 +307,8 @@ end:
     if (p != NULL) {
         UTHFreePacket(p);
     }
-    if (t != NULL) {
-        SCFree(t);
-    }
+    StreamTcpUTClearStream(&stream);
+    StreamTcpUTDeinit(ra_ctx);
     SCReturnInt(result);
 }
 
@@ -321,6 +321,13 @@ static int StreamTcpInlineTest03(void)
     uint8_t payload2[] = "ABCDE"; /* segment */
     int result = 0;
     TcpSegment *t = NULL;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpStream stream;
+
+    memset(&tv, 0x00, sizeof(tv));
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupStream(&stream, 1);
 
     Packet *p = UTHBuildPacketSrcDstPorts(payload1, sizeof(payload1)-1, IPPROTO_TCP, 1024, 80);
     if (p == NULL || p->tcph == NULL) {
@@ -329,28 +336,25 @@ static int StreamTcpInlineTest03(void)
     }
     p->tcph->th_seq = htonl(10000000UL);
 
-    t = SCMalloc(sizeof(TcpSegment));
-    if (unlikely(t == NULL)) {
-        printf("alloc TcpSegment failed: ");
+    if (StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &stream, 10000003UL,
+                payload2, sizeof(payload2)-1) == -1) {
+        printf("adding segment failed: ");
         goto end;
     }
-    memset(t, 0x00, sizeof(TcpSegment));
-    t->payload = payload2;
-    t->payload_len = sizeof(payload2)-1;
-    t->seq = 10000003UL;
+    t = stream.seg_list;
 
-    StreamTcpInlineSegmentReplacePacket(p, t);
+    StreamTcpInlineSegmentReplacePacket(&stream, p, t);
 
     if (!(p->flags & PKT_STREAM_MODIFIED)) {
         printf("PKT_STREAM_MODIFIED pkt flag not set: ");
         goto end;
     }
 
-    if (memcmp(p->payload+3, t->payload, t->payload_len) != 0) {
+    if (memcmp(p->payload+3, payload2, t->payload_len) != 0) {
         printf("Packet:\n");
         PrintRawDataFp(stdout,p->payload,p->payload_len);
         printf("Segment:\n");
-        PrintRawDataFp(stdout,t->payload,t->payload_len);
+        PrintRawDataFp(stdout,payload2,t->payload_len);
         printf("payloads didn't match: ");
         goto end;
     }
@@ -372,9 +376,8 @@ end:
     if (p != NULL) {
         UTHFreePacket(p);
     }
-    if (t != NULL) {
-        SCFree(t);
-    }
+    StreamTcpUTClearStream(&stream);
+    StreamTcpUTDeinit(ra_ctx);
     SCReturnInt(result);
 }
 
@@ -387,6 +390,13 @@ static int StreamTcpInlineTest04(void)
     uint8_t payload2[] = "ABCDE"; /* segment */
     int result = 0;
     TcpSegment *t = NULL;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpStream stream;
+
+    memset(&tv, 0x00, sizeof(tv));
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupStream(&stream, 1);
 
     Packet *p = UTHBuildPacketSrcDstPorts(payload1, sizeof(payload1)-1, IPPROTO_TCP, 1024, 80);
     if (p == NULL || p->tcph == NULL) {
@@ -395,28 +405,25 @@ static int StreamTcpInlineTest04(void)
     }
     p->tcph->th_seq = htonl(10000003UL);
 
-    t = SCMalloc(sizeof(TcpSegment));
-    if (unlikely(t == NULL)) {
-        printf("alloc TcpSegment failed: ");
+    if (StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &stream, 10000000UL,
+                payload2, sizeof(payload2)-1) == -1) {
+        printf("adding segment failed: ");
         goto end;
     }
-    memset(t, 0x00, sizeof(TcpSegment));
-    t->payload = payload2;
-    t->payload_len = sizeof(payload2)-1;
-    t->seq = 10000000UL;
+    t = stream.seg_list;
 
-    StreamTcpInlineSegmentReplacePacket(p, t);
+    StreamTcpInlineSegmentReplacePacket(&stream, p, t);
 
     if (!(p->flags & PKT_STREAM_MODIFIED)) {
         printf("PKT_STREAM_MODIFIED pkt flag not set: ");
         goto end;
     }
 
-    if (memcmp(p->payload, t->payload+3, 2) != 0) {
+    if (memcmp(p->payload, payload2+3, 2) != 0) {
         printf("Packet:\n");
         PrintRawDataFp(stdout,p->payload,p->payload_len);
         printf("Segment:\n");
-        PrintRawDataFp(stdout,t->payload,t->payload_len);
+        PrintRawDataFp(stdout,payload2,t->payload_len);
         printf("payloads didn't match: ");
         goto end;
     }
@@ -438,9 +445,8 @@ end:
     if (p != NULL) {
         UTHFreePacket(p);
     }
-    if (t != NULL) {
-        SCFree(t);
-    }
+    StreamTcpUTClearStream(&stream);
+    StreamTcpUTDeinit(ra_ctx);
     SCReturnInt(result);
 }
 /** \test partial overlap */
@@ -452,6 +458,13 @@ static int StreamTcpInlineTest05(void)
     uint8_t payload2[] = "ABCDE"; /* segment */
     int result = 0;
     TcpSegment *t = NULL;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpStream stream;
+
+    memset(&tv, 0x00, sizeof(tv));
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupStream(&stream, 1);
 
     Packet *p = UTHBuildPacketSrcDstPorts(payload1, sizeof(payload1)-1, IPPROTO_TCP, 1024, 80);
     if (p == NULL || p->tcph == NULL) {
@@ -460,28 +473,25 @@ static int StreamTcpInlineTest05(void)
     }
     p->tcph->th_seq = htonl(10000000UL);
 
-    t = SCMalloc(sizeof(TcpSegment));
-    if (unlikely(t == NULL)) {
-        printf("alloc TcpSegment failed: ");
+    if (StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &stream, 10000010UL,
+                payload2, sizeof(payload2)-1) == -1) {
+        printf("adding segment failed: ");
         goto end;
     }
-    memset(t, 0x00, sizeof(TcpSegment));
-    t->payload = payload2;
-    t->payload_len = sizeof(payload2)-1;
-    t->seq = 10000010UL;
+    t = stream.seg_list;
 
-    StreamTcpInlineSegmentReplacePacket(p, t);
+    StreamTcpInlineSegmentReplacePacket(&stream, p, t);
 
     if (!(p->flags & PKT_STREAM_MODIFIED)) {
         printf("PKT_STREAM_MODIFIED pkt flag not set: ");
         goto end;
     }
 
-    if (memcmp(p->payload+10, t->payload, 2) != 0) {
+    if (memcmp(p->payload+10, payload2, 2) != 0) {
         printf("Packet:\n");
         PrintRawDataFp(stdout,p->payload,p->payload_len);
         printf("Segment:\n");
-        PrintRawDataFp(stdout,t->payload,t->payload_len);
+        PrintRawDataFp(stdout,payload2,t->payload_len);
         printf("payloads didn't match: ");
         goto end;
     }
@@ -503,9 +513,8 @@ end:
     if (p != NULL) {
         UTHFreePacket(p);
     }
-    if (t != NULL) {
-        SCFree(t);
-    }
+    StreamTcpUTClearStream(&stream);
+    StreamTcpUTDeinit(ra_ctx);
     SCReturnInt(result);
 }
 
@@ -518,6 +527,13 @@ static int StreamTcpInlineTest06(void)
     uint8_t payload2[] = "ABCDE"; /* segment */
     int result = 0;
     TcpSegment *t = NULL;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpStream stream;
+
+    memset(&tv, 0x00, sizeof(tv));
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupStream(&stream, 1);
 
     Packet *p = UTHBuildPacketSrcDstPorts(payload1, sizeof(payload1)-1, IPPROTO_TCP, 1024, 80);
     if (p == NULL || p->tcph == NULL) {
@@ -526,17 +542,14 @@ static int StreamTcpInlineTest06(void)
     }
     p->tcph->th_seq = htonl(10000020UL);
 
-    t = SCMalloc(sizeof(TcpSegment));
-    if (unlikely(t == NULL)) {
-        printf("alloc TcpSegment failed: ");
+    if (StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &stream, 10000000UL,
+                payload2, sizeof(payload2)-1) == -1) {
+        printf("adding segment failed: ");
         goto end;
     }
-    memset(t, 0x00, sizeof(TcpSegment));
-    t->payload = payload2;
-    t->payload_len = sizeof(payload2)-1;
-    t->seq = 10000000UL;
+    t = stream.seg_list;
 
-    StreamTcpInlineSegmentReplacePacket(p, t);
+    StreamTcpInlineSegmentReplacePacket(&stream, p, t);
 
     if (p->flags & PKT_STREAM_MODIFIED) {
         printf("PKT_STREAM_MODIFIED pkt flag set, but it shouldn't: ");
@@ -569,9 +582,8 @@ end:
     if (p != NULL) {
         UTHFreePacket(p);
     }
-    if (t != NULL) {
-        SCFree(t);
-    }
+    StreamTcpUTClearStream(&stream);
+    StreamTcpUTDeinit(ra_ctx);
     SCReturnInt(result);
 }
 
@@ -584,6 +596,13 @@ static int StreamTcpInlineTest07(void)
     uint8_t payload2[] = "ABCDE"; /* segment */
     int result = 0;
     TcpSegment *t = NULL;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpStream stream;
+
+    memset(&tv, 0x00, sizeof(tv));
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupStream(&stream, 1);
 
     Packet *p = UTHBuildPacketSrcDstPorts(payload1, sizeof(payload1)-1, IPPROTO_TCP, 1024, 80);
     if (p == NULL || p->tcph == NULL) {
@@ -592,17 +611,14 @@ static int StreamTcpInlineTest07(void)
     }
     p->tcph->th_seq = htonl(10000000UL);
 
-    t = SCMalloc(sizeof(TcpSegment));
-    if (unlikely(t == NULL)) {
-        printf("alloc TcpSegment failed: ");
+    if (StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &stream, 10000020UL,
+                payload2, sizeof(payload2)-1) == -1) {
+        printf("adding segment failed: ");
         goto end;
     }
-    memset(t, 0x00, sizeof(TcpSegment));
-    t->payload = payload2;
-    t->payload_len = sizeof(payload2)-1;
-    t->seq = 10000020UL;
+    t = stream.seg_list;
 
-    StreamTcpInlineSegmentReplacePacket(p, t);
+    StreamTcpInlineSegmentReplacePacket(&stream, p, t);
 
     if (p->flags & PKT_STREAM_MODIFIED) {
         printf("PKT_STREAM_MODIFIED pkt flag set, but it shouldn't: ");
@@ -635,9 +651,8 @@ end:
     if (p != NULL) {
         UTHFreePacket(p);
     }
-    if (t != NULL) {
-        SCFree(t);
-    }
+    StreamTcpUTClearStream(&stream);
+    StreamTcpUTDeinit(ra_ctx);
     SCReturnInt(result);
 }
 #endif /* UNITTESTS */
@@ -27,6 +27,8 @@
 #include "decode.h"
 #include "util-pool.h"
 #include "util-pool-thread.h"
+#include "util-streaming-buffer.h"
+#include "tree.h"
 
 #define STREAMTCP_QUEUE_FLAG_TS     0x01
 #define STREAMTCP_QUEUE_FLAG_WS     0x02
@@ -50,17 +52,23 @@ typedef struct StreamTcpSackRecord_ {
     struct StreamTcpSackRecord_ *next;
 } StreamTcpSackRecord;
 
+/** a segment is a seq/len record, its data lives in the stream's
+ *  StreamingBuffer. Use StreamTcpSegmentGetData to get to it. */
 typedef struct TcpSegment_ {
-    uint8_t *payload;
     uint16_t payload_len;       /**< actual size of the payload */
-    uint16_t pool_size;         /**< size of the memory */
     uint32_t seq;
     struct TcpSegment_ *next;
     struct TcpSegment_ *prev;
+    RB_ENTRY(TcpSegment_) rb;   /**< seq ordered tree of the segments */
     /* coccinelle: TcpSegment:flags:SEGMENTTCP_FLAG */
     uint8_t flags;
 } TcpSegment;
 
+/** seq ordered tree of the segments in a stream, used to find the place
+ *  of a new segment w/o walking the list. */
+RB_HEAD(TCPSEG, TcpSegment_);
+RB_PROTOTYPE(TCPSEG, TcpSegment_, rb, TcpSegmentCompare);
+
 typedef struct TcpStream_ {
     uint16_t flags:12;              /**< Flag specific to the stream e.g. Timestamp */
     /* coccinelle: TcpStream:flags:STREAMTCP_STREAM_FLAG_ */
@@ -84,6 +92,10 @@ typedef struct TcpStream_ {
 
     TcpSegment *seg_list;           /**< list of TCP segments that are not yet (fully) used in reassembly */
     TcpSegment *seg_list_tail;      /**< Last segment in the reassembled stream seg list*/
+    struct TCPSEG seg_tree;         /**< tree of the segments in seg_list */
+
+    StreamingBuffer sb;             /**< data of the segments in seg_list */
+    uint32_t sb_base_seq;           /**< seq of the first byte in sb */
 
     StreamTcpSackRecord *sack_head; /**< head of list of SACK records */
     StreamTcpSackRecord *sack_tail; /**< tail of list of SACK records */
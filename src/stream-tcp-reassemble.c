@@ -62,30 +62,26 @@
 #include "detect-engine-state.h"
 
 #include "util-profiling.h"
+#include "util-validate.h"
 
 #define PSEUDO_PACKET_PAYLOAD_SIZE  65416 /* 64 Kb minus max IP and TCP header */
 
-#ifdef DEBUG
-static SCMutex segment_pool_memuse_mutex;
-static uint64_t segment_pool_memuse = 0;
-static uint64_t segment_pool_memcnt = 0;
-#endif
-
-/* We define several pools with prealloced segments with fixed size
- * payloads. We do this to prevent having to do an SCMalloc call for every
- * data segment we receive, which would be a large performance penalty.
- * The cost is in memory of course. The number of pools and the properties
- * of the pools are determined by the yaml. */
-static int segment_pool_num = 0;
-static Pool **segment_pool = NULL;
-static SCMutex *segment_pool_mutex = NULL;
-static uint16_t *segment_pool_pktsizes = NULL;
+/* initial size and grow step of the per stream segment data buffer */
+#define STREAM_SEGMENT_BUFFER_SIZE  2048
+/* max distance between a new segment and the data in the per stream
+ * buffer. The gap has to be allocated, so without a limit a single out
+ * of order segment could make us allocate up to the reassembly depth. */
+#define STREAM_SEGMENT_BUFFER_MAX_GAP   (256 * 1024)
+
+/* Segments only hold seq/len, their data lives in the per stream
+ * StreamingBuffer. We keep a pool of them to prevent having to do an
+ * SCMalloc call for every data segment we receive. */
+static Pool *segment_pool = NULL;
+static SCMutex segment_pool_mutex;
 #ifdef DEBUG
 static SCMutex segment_pool_cnt_mutex;
 static uint64_t segment_pool_cnt = 0;
 #endif
-/* index to the right pool for all packet sizes. */
-static uint16_t segment_pool_idx[65536]; /* O(1) lookups of the pool */
 static int check_overlap_different_data = 0;
 
 /* Memory use counter */
@@ -98,13 +94,13 @@ static int HandleSegmentStartsAtSameListSegment(ThreadVars *, TcpReassemblyThrea
                                     TcpStream *, TcpSegment *, TcpSegment *, Packet *);
 static int HandleSegmentStartsAfterListSegment(ThreadVars *, TcpReassemblyThreadCtx *,
                                     TcpStream *, TcpSegment *, TcpSegment *, Packet *);
-void StreamTcpSegmentDataReplace(TcpSegment *, TcpSegment *, uint32_t, uint16_t);
-void StreamTcpSegmentDataCopy(TcpSegment *, TcpSegment *);
-TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *, uint16_t);
+static int StreamTcpSegmentDataReplace(TcpStream *, TcpSegment *, TcpSegment *,
+                                       Packet *, uint32_t, uint16_t);
 void StreamTcpCreateTestPacket(uint8_t *, uint8_t, uint8_t, uint8_t);
 void StreamTcpReassemblePseudoPacketCreate(TcpStream *, Packet *, PacketQueue *);
-static int StreamTcpSegmentDataCompare(TcpSegment *dst_seg, TcpSegment *src_seg,
-                                 uint32_t start_point, uint16_t len);
+static int StreamTcpSegmentDataCompare(TcpStream *, TcpSegment *, TcpSegment *,
+                                       Packet *, uint32_t, uint16_t);
+static inline uint32_t StreamTcpReassembleGetRaBaseSeq(TcpStream *);
 
 void StreamTcpReassembleConfigEnableOverlapCheck(void)
 {
@@ -172,36 +168,19 @@ void *TcpSegmentPoolAlloc()
     return seg;
 }
 
-int TcpSegmentPoolInit(void *data, void *payload_len)
+int TcpSegmentPoolInit(void *data, void *initdata)
 {
     TcpSegment *seg = (TcpSegment *) data;
-    uint16_t size = *((uint16_t *) payload_len);
 
     /* do this before the can bail, so TcpSegmentPoolCleanup
      * won't have uninitialized memory to consider. */
     memset(seg, 0, sizeof (TcpSegment));
 
-    if (StreamTcpReassembleCheckMemcap((uint32_t)size + (uint32_t)sizeof(TcpSegment)) == 0) {
-        return 0;
-    }
-
-    seg->pool_size = size;
-    seg->payload_len = seg->pool_size;
-
-    seg->payload = SCMalloc(seg->payload_len);
-    if (seg->payload == NULL) {
+    if (StreamTcpReassembleCheckMemcap((uint32_t)sizeof(TcpSegment)) == 0) {
         return 0;
     }
 
-#ifdef DEBUG
-    SCMutexLock(&segment_pool_memuse_mutex);
-    segment_pool_memuse += seg->payload_len;
-    segment_pool_memcnt++;
-    SCLogDebug("segment_pool_memcnt %"PRIu64"", segment_pool_memcnt);
-    SCMutexUnlock(&segment_pool_memuse_mutex);
-#endif
-
-    StreamTcpReassembleIncrMemuse((uint32_t)seg->pool_size + sizeof(TcpSegment));
+    StreamTcpReassembleIncrMemuse((uint32_t)sizeof(TcpSegment));
     return 1;
 }
 
@@ -211,20 +190,56 @@ void TcpSegmentPoolCleanup(void *ptr)
     if (ptr == NULL)
         return;
 
-    TcpSegment *seg = (TcpSegment *) ptr;
+    StreamTcpReassembleDecrMemuse((uint32_t)sizeof(TcpSegment));
+    return;
+}
 
-    StreamTcpReassembleDecrMemuse((uint32_t)seg->pool_size + sizeof(TcpSegment));
+/* memory functions for the per stream StreamingBuffer, so that the
+ * segment data is accounted against the reassembly memcap */
+static void *ReassembleMalloc(size_t size)
+{
+    if (StreamTcpReassembleCheckMemcap((uint32_t)size) == 0)
+        return NULL;
+    void *ptr = SCMalloc(size);
+    if (ptr == NULL)
+        return NULL;
+    StreamTcpReassembleIncrMemuse((uint64_t)size);
+    return ptr;
+}
 
-#ifdef DEBUG
-    SCMutexLock(&segment_pool_memuse_mutex);
-    segment_pool_memuse -= seg->pool_size;
-    segment_pool_memcnt--;
-    SCLogDebug("segment_pool_memcnt %"PRIu64"", segment_pool_memcnt);
-    SCMutexUnlock(&segment_pool_memuse_mutex);
-#endif
+static void *ReassembleCalloc(size_t n, size_t size)
+{
+    if (StreamTcpReassembleCheckMemcap((uint32_t)(n * size)) == 0)
+        return NULL;
+    void *ptr = SCCalloc(n, size);
+    if (ptr == NULL)
+        return NULL;
+    StreamTcpReassembleIncrMemuse((uint64_t)(n * size));
+    return ptr;
+}
 
-    SCFree(seg->payload);
-    return;
+static void *ReassembleRealloc(void *optr, size_t orig_size, size_t size)
+{
+    if (size > orig_size) {
+        if (StreamTcpReassembleCheckMemcap((uint32_t)(size - orig_size)) == 0)
+            return NULL;
+    }
+    void *nptr = SCRealloc(optr, size);
+    if (nptr == NULL)
+        return NULL;
+
+    if (size > orig_size) {
+        StreamTcpReassembleIncrMemuse((uint64_t)(size - orig_size));
+    } else {
+        StreamTcpReassembleDecrMemuse((uint64_t)(orig_size - size));
+    }
+    return nptr;
+}
+
+static void ReassembleFree(void *ptr, size_t size)
+{
+    SCFree(ptr);
+    StreamTcpReassembleDecrMemuse((uint64_t)size);
 }
 
 /**
@@ -240,12 +255,9 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
     seg->next = NULL;
     seg->prev = NULL;
 
-    uint16_t idx = segment_pool_idx[seg->pool_size];
-    SCMutexLock(&segment_pool_mutex[idx]);
-    PoolReturn(segment_pool[idx], (void *) seg);
-    SCLogDebug("segment_pool[%"PRIu16"]->empty_stack_size %"PRIu32"",
-               idx,segment_pool[idx]->empty_stack_size);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+    SCMutexLock(&segment_pool_mutex);
+    PoolReturn(segment_pool, (void *) seg);
+    SCMutexUnlock(&segment_pool_mutex);
 
 #ifdef DEBUG
     SCMutexLock(&segment_pool_cnt_mutex);
@@ -255,7 +267,8 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
 }
 
 /**
- *  \brief return all segments in this stream into the pool(s)
+ *  \brief return all segments in this stream into the pool and
+ *         release the stream's data buffer
  *
  *  \param stream the stream to cleanup
  */
@@ -264,9 +277,6 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
     TcpSegment *seg = stream->seg_list;
     TcpSegment *next_seg;
 
-    if (seg == NULL)
-        return;
-
     while (seg != NULL) {
         next_seg = seg->next;
         StreamTcpSegmentReturntoPool(seg);
@@ -275,6 +285,9 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
 
     stream->seg_list = NULL;
     stream->seg_list_tail = NULL;
+    RB_INIT(&stream->seg_tree);
+
+    StreamingBufferClear(&stream->sb);
 }
 
 /** \param f locked flow */
@@ -299,177 +312,358 @@ int StreamTcpAppLayerIsDisabled(Flow *f)
     return (ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED);
 }
 
-typedef struct SegmentSizes_
+/**
+ *  \brief get the data of a segment
+ *
+ *  \param stream stream the segment is in
+ *  \param seg segment
+ *  \param data set to the data of seg, or NULL if the buffer doesn't
+ *              hold it
+ *  \param data_len set to the data length, 0 if data is NULL
+ */
+void StreamTcpSegmentGetData(const TcpStream *stream, const TcpSegment *seg,
+        const uint8_t **data, uint32_t *data_len)
 {
-    uint16_t pktsize;
-    uint32_t prealloc;
-} SegmentSizes;
+    if (stream->sb.buf != NULL && SEQ_GEQ(seg->seq, stream->sb_base_seq)) {
+        uint32_t offset = seg->seq - stream->sb_base_seq;
+        if (offset + seg->payload_len <= stream->sb.buf_offset) {
+            *data = stream->sb.buf + offset;
+            *data_len = seg->payload_len;
+            return;
+        }
+    }
+    *data = NULL;
+    *data_len = 0;
+}
 
-/* sort small to big */
-static int SortByPktsize(const void *a, const void *b)
+/**
+ *  \internal
+ *  \brief get a pointer to the data at seq
+ *
+ *  The caller makes sure the buffer holds the data from seq onwards.
+ */
+static inline const uint8_t *StreamTcpGetDataAtSeq(const TcpStream *stream,
+        uint32_t seq)
 {
-    const SegmentSizes *s0 = a;
-    const SegmentSizes *s1 = b;
-    return s0->pktsize - s1->pktsize;
+    return stream->sb.buf + (seq - stream->sb_base_seq);
 }
 
-int StreamTcpReassemblyConfig(char quiet)
+/**
+ *  \internal
+ *  \brief get a pointer to the data at seq in the packet
+ *
+ *  Data of a new segment is read from the packet until it's stored
+ *  in the stream's buffer.
+ */
+static inline const uint8_t *PacketDataAtSeq(const Packet *p, uint32_t seq)
 {
-    Pool **my_segment_pool = NULL;
-    SCMutex *my_segment_lock = NULL;
-    uint16_t *my_segment_pktsizes = NULL;
-    SegmentSizes sizes[256];
-    memset(&sizes, 0x00, sizeof(sizes));
-
-    int npools = 0;
-    ConfNode *segs = ConfGetNode("stream.reassembly.segments");
-    if (segs != NULL) {
-        ConfNode *seg;
-        TAILQ_FOREACH(seg, &segs->head, next) {
-            ConfNode *segsize = ConfNodeLookupChild(seg,"size");
-            if (segsize == NULL)
-                continue;
-            ConfNode *segpre = ConfNodeLookupChild(seg,"prealloc");
-            if (segpre == NULL)
-                continue;
-
-            if (npools >= 256) {
-                SCLogError(SC_ERR_INVALID_ARGUMENT, "too many segment packet "
-                                                    "pools defined, max is 256");
-                return -1;
-            }
-
-            SCLogDebug("segsize->val %s", segsize->val);
-            SCLogDebug("segpre->val %s", segpre->val);
+    return p->payload + (seq - TCP_GET_SEQ(p));
+}
 
-            uint16_t pktsize = 0;
-            if (ByteExtractStringUint16(&pktsize, 10, strlen(segsize->val),
-                                        segsize->val) == -1)
-            {
-                SCLogError(SC_ERR_INVALID_ARGUMENT, "segment packet size "
-                                                    "of %s is invalid", segsize->val);
-                return -1;
-            }
-            uint32_t prealloc = 0;
-            if (ByteExtractStringUint32(&prealloc, 10, strlen(segpre->val),
-                                        segpre->val) == -1)
-            {
-                SCLogError(SC_ERR_INVALID_ARGUMENT, "segment prealloc of "
-                                                    "%s is invalid", segpre->val);
-                return -1;
-            }
+/**
+ *  \internal
+ *  \brief make sure the stream buffer can hold the data of seq and len
+ *
+ *  An empty buffer is anchored at the reassembly base, so that the data
+ *  of a hole at the start of the list ends up in the buffer as well. If
+ *  the hole is too big, the buffer is anchored at seq instead. Room for
+ *  data before the start of the buffer is made by moving the buffer
+ *  contents up. To keep the number of moves down, the room made is at
+ *  least the size of the buffered data, up to the max gap.
+ *
+ *  Called before a new segment is merged into the list, so that storing
+ *  its data later on can't fail halfway through the overlap handling.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, memcap reached
+ *  \retval -2 seq is too far from the buffered data
+ */
+static int StreamTcpStreamBufferReserve(TcpStream *stream, uint32_t seq,
+        uint32_t len)
+{
+    if (stream->sb.cfg == NULL)
+        stream->sb.cfg = &stream_config.sbcnf;
+
+    const uint32_t base_seq = StreamTcpReassembleGetRaBaseSeq(stream) + 1;
+
+    if (stream->sb.buf == NULL || stream->sb.buf_offset == 0) {
+        if (SEQ_GT(seq, base_seq) &&
+                seq - base_seq <= STREAM_SEGMENT_BUFFER_MAX_GAP)
+            stream->sb_base_seq = base_seq;
+        else
+            stream->sb_base_seq = seq;
+    } else if (SEQ_LT(seq, stream->sb_base_seq)) {
+        uint32_t shift = stream->sb_base_seq - seq;
+        if (shift > STREAM_SEGMENT_BUFFER_MAX_GAP) {
+            SCLogDebug("seq %u too far before buffer start %u",
+                    seq, stream->sb_base_seq);
+            return -2;
+        }
+        shift += MIN(stream->sb.buf_offset, STREAM_SEGMENT_BUFFER_MAX_GAP);
 
-            sizes[npools].pktsize = pktsize;
-            sizes[npools].prealloc = prealloc;
-            SCLogDebug("pktsize %u, prealloc %u", sizes[npools].pktsize,
-                                                  sizes[npools].prealloc);
-            npools++;
+        SCLogDebug("seq %u before buffer start %u, moving data up %u",
+                seq, stream->sb_base_seq, shift);
+        if (StreamingBufferShiftUp(&stream->sb, shift) < 0)
+            return -1;
+        stream->sb_base_seq -= shift;
+    } else {
+        uint32_t data_end = stream->sb_base_seq + stream->sb.buf_offset;
+        if (SEQ_GT(seq, data_end) &&
+                seq - data_end > STREAM_SEGMENT_BUFFER_MAX_GAP) {
+            SCLogDebug("seq %u too far beyond buffered data end %u",
+                    seq, data_end);
+            return -2;
         }
     }
 
-    SCLogDebug("npools %d", npools);
-    if (npools > 0) {
-        /* sort the array as the index code below relies on it */
-        qsort(&sizes, npools, sizeof(sizes[0]), SortByPktsize);
-        if (sizes[npools - 1].pktsize != 0xffff) {
-            sizes[npools].pktsize = 0xffff;
-            sizes[npools].prealloc = 8;
-            npools++;
-            SCLogConfig("appended a segment pool for pktsize 65536");
-        }
-    } else if (npools == 0) {
-        /* defaults */
-        sizes[0].pktsize = 4;
-        sizes[0].prealloc = 256;
-        sizes[1].pktsize = 16;
-        sizes[1].prealloc = 512;
-        sizes[2].pktsize = 112;
-        sizes[2].prealloc = 512;
-        sizes[3].pktsize = 248;
-        sizes[3].prealloc = 512;
-        sizes[4].pktsize = 512;
-        sizes[4].prealloc = 512;
-        sizes[5].pktsize = 768;
-        sizes[5].prealloc = 1024;
-        sizes[6].pktsize = 1448;
-        sizes[6].prealloc = 1024;
-        sizes[7].pktsize = 0xffff;
-        sizes[7].prealloc = 128;
-        npools = 8;
-    }
-
-    int i = 0;
-    for (i = 0; i < npools; i++) {
-        SCLogDebug("pktsize %u, prealloc %u", sizes[i].pktsize, sizes[i].prealloc);
-    }
-
-    my_segment_pool = SCMalloc(npools * sizeof(Pool *));
-    if (my_segment_pool == NULL) {
-        SCLogError(SC_ERR_MEM_ALLOC, "malloc failed");
-        return -1;
+    uint64_t offset = stream->sb.stream_offset +
+        (uint64_t)(seq - stream->sb_base_seq) + len;
+    return StreamingBufferReserve(&stream->sb, offset);
+}
+
+/**
+ *  \internal
+ *  \brief write data for seq into the stream buffer
+ *
+ *  Space has to be reserved by StreamTcpStreamBufferReserve first.
+ */
+static void StreamTcpStreamBufferWrite(TcpStream *stream, uint32_t seq,
+        const uint8_t *data, uint32_t data_len)
+{
+    if (data_len == 0)
+        return;
+
+    uint64_t offset = stream->sb.stream_offset + (seq - stream->sb_base_seq);
+    int r = StreamingBufferInsertAtNoTrack(&stream->sb, data, data_len, offset);
+    DEBUG_VALIDATE_BUG_ON(r != 0);
+    (void)r;
+}
+
+/**
+ *  \internal
+ *  \brief release the buffer space before the first segment
+ *
+ *  To amortize the memmove the buffer only slides once at least half of
+ *  it is no longer used. An empty list frees the buffer, so idle streams
+ *  don't hold on to reassembly memory. The next segment allocates and
+ *  anchors a new one.
+ */
+static void StreamTcpStreamBufferSlide(TcpStream *stream)
+{
+    if (stream->sb.buf == NULL)
+        return;
+
+    if (stream->seg_list == NULL) {
+        stream->sb.stream_offset += stream->sb.buf_offset;
+        StreamingBufferClear(&stream->sb);
+        return;
     }
-    my_segment_lock = SCMalloc(npools * sizeof(SCMutex));
-    if (my_segment_lock == NULL) {
-        SCLogError(SC_ERR_MEM_ALLOC, "malloc failed");
 
-        SCFree(my_segment_pool);
-        return -1;
+    /* keep the room before the first segment if it's after the reassembly
+     * base, data for it may still come in */
+    uint32_t slide_seq = stream->seg_list->seq;
+    if (SEQ_LT(StreamTcpReassembleGetRaBaseSeq(stream) + 1, slide_seq))
+        slide_seq = StreamTcpReassembleGetRaBaseSeq(stream) + 1;
+
+    if (SEQ_LEQ(slide_seq, stream->sb_base_seq))
+        return;
+
+    uint32_t unused = slide_seq - stream->sb_base_seq;
+    if (unused >= stream->sb.buf_offset / 2) {
+        SCLogDebug("sliding stream buffer %u", unused);
+        StreamingBufferSlideToOffset(&stream->sb,
+                stream->sb.stream_offset + unused);
+        stream->sb_base_seq += unused;
     }
-    my_segment_pktsizes = SCMalloc(npools * sizeof(uint16_t));
-    if (my_segment_pktsizes == NULL) {
-        SCLogError(SC_ERR_MEM_ALLOC, "malloc failed");
+}
 
-        SCFree(my_segment_lock);
-        SCFree(my_segment_pool);
+/** \brief compare function for the segment tree */
+static int TcpSegmentCompare(struct TcpSegment_ *a, struct TcpSegment_ *b)
+{
+    if (SEQ_LT(a->seq, b->seq))
         return -1;
-    }
-    uint32_t my_segment_poolsizes[npools];
-
-    for (i = 0; i < npools; i++) {
-        my_segment_pktsizes[i] = sizes[i].pktsize;
-        my_segment_poolsizes[i] = sizes[i].prealloc;
-        SCMutexInit(&my_segment_lock[i], NULL);
-
-        /* setup the pool */
-        SCMutexLock(&my_segment_lock[i]);
-        my_segment_pool[i] = PoolInit(0, my_segment_poolsizes[i], 0,
-                TcpSegmentPoolAlloc, TcpSegmentPoolInit,
-                (void *) &my_segment_pktsizes[i],
-                TcpSegmentPoolCleanup, NULL);
-        SCMutexUnlock(&my_segment_lock[i]);
-
-        if (my_segment_pool[i] == NULL) {
-            SCLogError(SC_ERR_INITIALIZATION, "couldn't set up segment pool "
-                    "for packet size %u. Memcap too low?", my_segment_pktsizes[i]);
-            exit(EXIT_FAILURE);
+    else if (SEQ_GT(a->seq, b->seq))
+        return 1;
+    return 0;
+}
+
+RB_GENERATE(TCPSEG, TcpSegment_, rb, TcpSegmentCompare);
+
+/**
+ *  \internal
+ *  \brief find the first list segment a new segment at seq can overlap
+ *
+ *  The list segments don't overlap, so only the last segment starting
+ *  at or before seq can reach beyond seq. Segments before it are skipped.
+ *
+ *  \retval list_seg segment to start the insert at, the list head if all
+ *                   segments start after seq
+ */
+static TcpSegment *StreamTcpSegmentLookup(TcpStream *stream, uint32_t seq)
+{
+    TcpSegment *tmp = RB_ROOT(&stream->seg_tree);
+    TcpSegment *res = NULL;
+
+    while (tmp != NULL) {
+        if (SEQ_LEQ(tmp->seq, seq)) {
+            res = tmp;
+            tmp = RB_RIGHT(tmp, rb);
+        } else {
+            tmp = RB_LEFT(tmp, rb);
         }
+    }
+    if (res == NULL)
+        return stream->seg_list;
 
-        SCLogDebug("my_segment_pktsizes[i] %u, my_segment_poolsizes[i] %u",
-                my_segment_pktsizes[i], my_segment_poolsizes[i]);
-        if (!quiet)
-            SCLogConfig("segment pool: pktsize %u, prealloc %u",
-                    my_segment_pktsizes[i], my_segment_poolsizes[i]);
+    /* be safe in case earlier segments reach beyond seq anyway */
+    while (res->prev != NULL &&
+            SEQ_GT(res->prev->seq + res->prev->payload_len, seq))
+    {
+        res = res->prev;
     }
+    return res;
+}
 
-    uint16_t idx = 0;
-    uint16_t u16 = 0;
-    while (1) {
-        if (idx <= my_segment_pktsizes[u16]) {
-            segment_pool_idx[idx] = u16;
-            if (my_segment_pktsizes[u16] == idx)
-                u16++;
-        }
+/**
+ *  \internal
+ *  \brief add seg to the stream before list_seg
+ */
+static void StreamTcpSegmentLinkBefore(TcpStream *stream, TcpSegment *list_seg,
+        TcpSegment *seg)
+{
+    seg->next = list_seg;
+    seg->prev = list_seg->prev;
+    if (list_seg->prev != NULL)
+        list_seg->prev->next = seg;
+    else
+        stream->seg_list = seg;
+    list_seg->prev = seg;
 
-        if (idx == 0xffff)
-            break;
+    TcpSegment *dup = TCPSEG_RB_INSERT(&stream->seg_tree, seg);
+    DEBUG_VALIDATE_BUG_ON(dup != NULL);
+    (void)dup;
+}
+
+/**
+ *  \internal
+ *  \brief add seg to the stream after list_seg
+ *
+ *  \param list_seg segment to add seg after, NULL if the list is empty
+ */
+static void StreamTcpSegmentLinkAfter(TcpStream *stream, TcpSegment *list_seg,
+        TcpSegment *seg)
+{
+    if (list_seg == NULL) {
+        seg->prev = NULL;
+        seg->next = NULL;
+        stream->seg_list = seg;
+        stream->seg_list_tail = seg;
+    } else {
+        seg->prev = list_seg;
+        seg->next = list_seg->next;
+        if (list_seg->next != NULL)
+            list_seg->next->prev = seg;
+        else
+            stream->seg_list_tail = seg;
+        list_seg->next = seg;
+    }
+
+    TcpSegment *dup = TCPSEG_RB_INSERT(&stream->seg_tree, seg);
+    DEBUG_VALIDATE_BUG_ON(dup != NULL);
+    (void)dup;
+}
+
+/**
+ *  \internal
+ *  \brief put new_seg in the place of list_seg
+ *
+ *  list_seg is unlinked, but not returned to the pool.
+ */
+static void StreamTcpSegmentLinkReplace(TcpStream *stream, TcpSegment *list_seg,
+        TcpSegment *new_seg)
+{
+    TCPSEG_RB_REMOVE(&stream->seg_tree, list_seg);
+
+    new_seg->next = list_seg->next;
+    new_seg->prev = list_seg->prev;
+    if (new_seg->prev != NULL)
+        new_seg->prev->next = new_seg;
+    else
+        stream->seg_list = new_seg;
+    if (new_seg->next != NULL)
+        new_seg->next->prev = new_seg;
+    else
+        stream->seg_list_tail = new_seg;
+
+    list_seg->next = NULL;
+    list_seg->prev = NULL;
+
+    TcpSegment *dup = TCPSEG_RB_INSERT(&stream->seg_tree, new_seg);
+    DEBUG_VALIDATE_BUG_ON(dup != NULL);
+    (void)dup;
+}
 
-        idx++;
+int StreamTcpReassemblyConfig(char quiet)
+{
+    uint32_t segment_prealloc = 2048;
+    ConfNode *segprealloc = ConfGetNode("stream.reassembly.segment-prealloc");
+    if (segprealloc != NULL) {
+        if (ByteExtractStringUint32(&segment_prealloc, 10,
+                    strlen(segprealloc->val), segprealloc->val) == -1)
+        {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "segment-prealloc of "
+                    "%s is invalid", segprealloc->val);
+            return -1;
+        }
+    } else {
+        /* the segment data no longer comes from per size pools, so of
+         * the old style config we only use the prealloc settings */
+        ConfNode *segs = ConfGetNode("stream.reassembly.segments");
+        if (segs != NULL && !TAILQ_EMPTY(&segs->head)) {
+            uint32_t total = 0;
+            ConfNode *seg;
+            TAILQ_FOREACH(seg, &segs->head, next) {
+                ConfNode *segpre = ConfNodeLookupChild(seg,"prealloc");
+                if (segpre == NULL)
+                    continue;
+
+                uint32_t prealloc = 0;
+                if (ByteExtractStringUint32(&prealloc, 10, strlen(segpre->val),
+                                            segpre->val) == -1)
+                {
+                    SCLogError(SC_ERR_INVALID_ARGUMENT, "segment prealloc of "
+                                                        "%s is invalid", segpre->val);
+                    return -1;
+                }
+                total += prealloc;
+            }
+            segment_prealloc = total;
+            SCLogWarning(SC_WARN_OPTION_OBSOLETE, "stream.reassembly.segments "
+                    "is obsolete, use stream.reassembly.segment-prealloc. "
+                    "Using the sum of the prealloc values: %u", segment_prealloc);
+        }
     }
-    /* set the globals */
-    segment_pool = my_segment_pool;
-    segment_pool_mutex = my_segment_lock;
-    segment_pool_pktsizes = my_segment_pktsizes;
-    segment_pool_num = npools;
+
+    SCMutexInit(&segment_pool_mutex, NULL);
+    SCMutexLock(&segment_pool_mutex);
+    segment_pool = PoolInit(0, segment_prealloc, 0,
+            TcpSegmentPoolAlloc, TcpSegmentPoolInit, NULL,
+            TcpSegmentPoolCleanup, NULL);
+    SCMutexUnlock(&segment_pool_mutex);
+    if (segment_pool == NULL) {
+        SCLogError(SC_ERR_INITIALIZATION, "couldn't set up segment pool "
+                "of %u segments. Memcap too low?", segment_prealloc);
+        exit(EXIT_FAILURE);
+    }
+    if (!quiet)
+        SCLogConfig("stream.reassembly \"segment-prealloc\": %u", segment_prealloc);
+
+    stream_config.sbcnf.flags = STREAMING_BUFFER_NOFLAGS;
+    stream_config.sbcnf.buf_size = STREAM_SEGMENT_BUFFER_SIZE;
+    stream_config.sbcnf.Malloc = ReassembleMalloc;
+    stream_config.sbcnf.Calloc = ReassembleCalloc;
+    stream_config.sbcnf.Realloc = ReassembleRealloc;
+    stream_config.sbcnf.Free = ReassembleFree;
 
     uint32_t stream_chunk_prealloc = 250;
     ConfNode *chunk = ConfGetNode("stream.reassembly.chunk-prealloc");
@@ -487,17 +681,10 @@ int StreamTcpReassemblyConfig(char quiet)
         SCLogConfig("stream.reassembly \"chunk-prealloc\": %u", stream_chunk_prealloc);
     StreamMsgQueuesInit(stream_chunk_prealloc);
 
-    intmax_t zero_copy_size = 128;
-    if (ConfGetInt("stream.reassembly.zero-copy-size", &zero_copy_size) == 1) {
-        if (zero_copy_size < 0 || zero_copy_size > 0xffff) {
-            SCLogError(SC_ERR_INVALID_ARGUMENT, "stream.reassembly.zero-copy-size of "
-                    "%"PRIiMAX" is invalid: valid values are 0 to 65535", zero_copy_size);
-            return -1;
-        }
+    if (ConfGetNode("stream.reassembly.zero-copy-size") != NULL) {
+        SCLogWarning(SC_WARN_OPTION_OBSOLETE, "stream.reassembly.zero-copy-size "
+                "is obsolete, app layer data is always passed in place");
     }
-    stream_config.zero_copy_size = (uint16_t)zero_copy_size;
-    if (!quiet)
-        SCLogConfig("stream.reassembly \"zero-copy-size\": %u", stream_config.zero_copy_size);
 
     return 0;
 }
@@ -510,7 +697,6 @@ int StreamTcpReassembleInit(char quiet)
     if (StreamTcpReassemblyConfig(quiet) < 0)
         return -1;
 #ifdef DEBUG
-    SCMutexInit(&segment_pool_memuse_mutex, NULL);
     SCMutexInit(&segment_pool_cnt_mutex, NULL);
 #endif
 
@@ -526,43 +712,26 @@ static uint32_t dbg_app_layer_gap_candidate;
 
 void StreamTcpReassembleFree(char quiet)
 {
-    uint16_t u16 = 0;
-    for (u16 = 0; u16 < segment_pool_num; u16++) {
-        SCMutexLock(&segment_pool_mutex[u16]);
-
+    SCMutexLock(&segment_pool_mutex);
+    if (segment_pool != NULL) {
         if (quiet == FALSE) {
-            PoolPrintSaturation(segment_pool[u16]);
-            SCLogDebug("segment_pool[u16]->empty_stack_size %"PRIu32", "
-                       "segment_pool[u16]->alloc_stack_size %"PRIu32", alloced "
-                       "%"PRIu32"", segment_pool[u16]->empty_stack_size,
-                       segment_pool[u16]->alloc_stack_size,
-                       segment_pool[u16]->allocated);
-
-            if (segment_pool[u16]->max_outstanding > segment_pool[u16]->allocated) {
-                SCLogPerf("TCP segment pool of size %u had a peak use of %u segments, "
-                        "more than the prealloc setting of %u", segment_pool_pktsizes[u16],
-                        segment_pool[u16]->max_outstanding, segment_pool[u16]->allocated);
+            PoolPrintSaturation(segment_pool);
+            if (segment_pool->max_outstanding > segment_pool->allocated) {
+                SCLogPerf("TCP segment pool had a peak use of %u segments, "
+                        "more than the prealloc setting of %u",
+                        segment_pool->max_outstanding, segment_pool->allocated);
             }
         }
-        PoolFree(segment_pool[u16]);
-
-        SCMutexUnlock(&segment_pool_mutex[u16]);
-        SCMutexDestroy(&segment_pool_mutex[u16]);
+        PoolFree(segment_pool);
+        segment_pool = NULL;
     }
-    SCFree(segment_pool);
-    SCFree(segment_pool_mutex);
-    SCFree(segment_pool_pktsizes);
-    segment_pool = NULL;
-    segment_pool_mutex = NULL;
-    segment_pool_pktsizes = NULL;
+    SCMutexUnlock(&segment_pool_mutex);
+    SCMutexDestroy(&segment_pool_mutex);
 
     StreamMsgQueuesDeinit(quiet);
 
 #ifdef DEBUG
     SCLogDebug("segment_pool_cnt %"PRIu64"", segment_pool_cnt);
-    SCLogDebug("segment_pool_memuse %"PRIu64"", segment_pool_memuse);
-    SCLogDebug("segment_pool_memcnt %"PRIu64"", segment_pool_memcnt);
-    SCMutexDestroy(&segment_pool_memuse_mutex);
     SCMutexDestroy(&segment_pool_cnt_mutex);
     SCLogPerf("dbg_app_layer_gap %u", dbg_app_layer_gap);
     SCLogPerf("dbg_app_layer_gap_candidate %u", dbg_app_layer_gap_candidate);
@@ -587,10 +756,6 @@ void StreamTcpReassembleFreeThreadCtx(TcpReassemblyThreadCtx *ra_ctx)
 {
     SCEnter();
     AppLayerDestroyCtxThread(ra_ctx->app_tctx);
-#ifdef DEBUG
-    SCLogDebug("reassembly fast path stats: fp1 %"PRIu64" fp2 %"PRIu64" sp %"PRIu64,
-            ra_ctx->fp1, ra_ctx->fp2, ra_ctx->sp);
-#endif
     SCFree(ra_ctx);
     SCReturn;
 }
@@ -763,13 +928,33 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
         goto end;
     }
 
+    /* make sure the stream buffer can take the data, so that we don't
+     * run out of memory halfway through the overlap handling */
+    int r = StreamTcpStreamBufferReserve(stream, seg->seq, seg->payload_len);
+    if (r == -2) {
+        /* too far out of order to buffer. If the data in between shows
+         * up and gets ACK'd, this segment's data will be a seq gap. */
+        SCLogDebug("segment too far from the stream buffer data");
+        StreamTcpSetEvent(p, STREAM_REASSEMBLY_SEGMENT_GAP_TOO_BIG);
+        return_seg = TRUE;
+        ret_value = -1;
+        goto end;
+    } else if (r < 0) {
+        SCLogDebug("stream buffer can't hold the segment data");
+        StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
+        StatsIncr(tv, ra_ctx->counter_tcp_segment_memcap);
+        return_seg = TRUE;
+        ret_value = -1;
+        goto end;
+    }
+
     /* fast track */
     if (list_seg == NULL) {
         SCLogDebug("empty list, inserting seg %p seq %" PRIu32 ", "
                    "len %" PRIu32 "", seg, seg->seq, seg->payload_len);
-        stream->seg_list = seg;
-        seg->prev = NULL;
-        stream->seg_list_tail = seg;
+        StreamTcpStreamBufferWrite(stream, seg->seq,
+                PacketDataAtSeq(p, seg->seq), seg->payload_len);
+        StreamTcpSegmentLinkAfter(stream, NULL, seg);
         goto end;
     }
 
@@ -778,9 +963,9 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
     if (SEQ_GEQ(seg->seq, (stream->seg_list_tail->seq +
             stream->seg_list_tail->payload_len)))
     {
-        stream->seg_list_tail->next = seg;
-        seg->prev = stream->seg_list_tail;
-        stream->seg_list_tail = seg;
+        StreamTcpStreamBufferWrite(stream, seg->seq,
+                PacketDataAtSeq(p, seg->seq), seg->payload_len);
+        StreamTcpSegmentLinkAfter(stream, stream->seg_list_tail, seg);
 
         goto end;
     }
@@ -790,6 +975,9 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
         StreamTcpSetOSPolicy(stream, p);
     }
 
+    /* skip the segments that are entirely before seg */
+    list_seg = StreamTcpSegmentLookup(stream, seg->seq);
+
     for (; list_seg != NULL; list_seg = next_list_seg) {
         next_list_seg = list_seg->next;
 
@@ -807,15 +995,9 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
                            " %" PRIu32 ", list_seg->payload_len %" PRIu32 ", "
                            "list_seg->prev %p", seg->seq, list_seg->seq,
                            list_seg->payload_len, list_seg->prev);
-                seg->next = list_seg;
-                if (list_seg->prev == NULL) {
-                    stream->seg_list = seg;
-                }
-                if (list_seg->prev != NULL) {
-                    list_seg->prev->next = seg;
-                    seg->prev = list_seg->prev;
-                }
-                list_seg->prev = seg;
+                StreamTcpStreamBufferWrite(stream, seg->seq,
+                        PacketDataAtSeq(p, seg->seq), seg->payload_len);
+                StreamTcpSegmentLinkBefore(stream, list_seg, seg);
 
                 goto end;
 
@@ -861,9 +1043,9 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
                            list_seg->seq + list_seg->payload_len);
 
                 if (list_seg->next == NULL) {
-                    list_seg->next = seg;
-                    seg->prev = list_seg;
-                    stream->seg_list_tail = seg;
+                    StreamTcpStreamBufferWrite(stream, seg->seq,
+                            PacketDataAtSeq(p, seg->seq), seg->payload_len);
+                    StreamTcpSegmentLinkAfter(stream, list_seg, seg);
                     goto end;
                 }
             } else {
@@ -990,9 +1172,9 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                 packet_length = seg->payload_len;
             }
 
-            TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx, packet_length);
+            TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx);
             if (new_seg == NULL) {
-                SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[packet_length]);
+                SCLogDebug("segment_pool is empty");
 
                 StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
                 SCReturnInt(-1);
@@ -1004,13 +1186,11 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
             SCLogDebug("new_seg->seq %"PRIu32" and new->payload_len "
                     "%" PRIu16"", new_seg->seq, new_seg->payload_len);
 
-            new_seg->next = list_seg;
-            new_seg->prev = list_seg->prev;
-            list_seg->prev->next = new_seg;
-            list_seg->prev = new_seg;
+            StreamTcpSegmentLinkBefore(stream, list_seg, new_seg);
 
-            /* create a new seg, copy the list_seg data over */
-            StreamTcpSegmentDataCopy(new_seg, seg);
+            /* fill the gap with the data of the new segment */
+            StreamTcpSegmentDataReplace(stream, new_seg, seg, p, new_seg->seq,
+                    new_seg->payload_len);
 
 #ifdef DEBUG
             PrintList(stream->seg_list);
@@ -1033,24 +1213,21 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                        " %" PRIu32 ", list->payload_len %" PRIu32 "",
                        packet_length, seg->payload_len, list_seg->payload_len);
 
-            TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx, packet_length);
+            TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx);
             if (new_seg == NULL) {
-                SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[packet_length]);
+                SCLogDebug("segment_pool is empty");
 
                 StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
                 SCReturnInt(-1);
             }
             new_seg->payload_len = packet_length;
             new_seg->seq = seg->seq;
-            new_seg->next = list_seg->next;
-            new_seg->prev = list_seg->prev;
-
-            StreamTcpSegmentDataCopy(new_seg, list_seg);
 
-            /* first the data before the list_seg->seq */
+            /* the list_seg data is already in place in the stream buffer,
+             * first the data before the list_seg->seq */
             uint16_t replace = (uint16_t) (list_seg->seq - seg->seq);
             SCLogDebug("copying %"PRIu16" bytes to new_seg", replace);
-            StreamTcpSegmentDataReplace(new_seg, seg, seg->seq, replace);
+            StreamTcpSegmentDataReplace(stream, new_seg, seg, p, seg->seq, replace);
 
             /* if any, data after list_seg->seq + list_seg->payload_len */
             if (SEQ_GT((seg->seq + seg->payload_len), (list_seg->seq +
@@ -1060,24 +1237,13 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                                              (list_seg->seq +
                                               list_seg->payload_len)));
                 SCLogDebug("replacing %"PRIu16"", replace);
-                StreamTcpSegmentDataReplace(new_seg, seg, (list_seg->seq +
+                StreamTcpSegmentDataReplace(stream, new_seg, seg, p, (list_seg->seq +
                                              list_seg->payload_len), replace);
             }
 
-            /* update the stream last_seg in case of removal of list_seg */
-            if (stream->seg_list_tail == list_seg)
-                stream->seg_list_tail = new_seg;
-
+            StreamTcpSegmentLinkReplace(stream, list_seg, new_seg);
             StreamTcpSegmentReturntoPool(list_seg);
             list_seg = new_seg;
-            if (new_seg->prev != NULL) {
-                new_seg->prev->next = new_seg;
-            }
-            if (new_seg->next != NULL) {
-                new_seg->next->prev = new_seg;
-            }
-
-            stream->seg_list = new_seg;
             SCLogDebug("list_seg now %p, stream->seg_list now %p", list_seg,
                         stream->seg_list);
 
@@ -1098,9 +1264,9 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                            (list_seg->prev->seq + list_seg->prev->payload_len));
                 }
 
-                TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx, packet_length);
+                TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx);
                 if (new_seg == NULL) {
-                    SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[packet_length]);
+                    SCLogDebug("segment_pool is empty");
 
                     StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
                     SCReturnInt(-1);
@@ -1117,28 +1283,15 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                 }
                 SCLogDebug("new_seg->seq %"PRIu32" and new->payload_len "
                            "%" PRIu16"", new_seg->seq, new_seg->payload_len);
-                new_seg->next = list_seg->next;
-                new_seg->prev = list_seg->prev;
-
-                StreamTcpSegmentDataCopy(new_seg, list_seg);
 
                 uint16_t copy_len = (uint16_t) (list_seg->seq - seg->seq);
                 SCLogDebug("copy_len %" PRIu32 " (%" PRIu32 " - %" PRIu32 ")",
                             copy_len, list_seg->seq, seg->seq);
-                StreamTcpSegmentDataReplace(new_seg, seg, seg->seq, copy_len);
-
-                /*update the stream last_seg in case of removal of list_seg*/
-                if (stream->seg_list_tail == list_seg)
-                    stream->seg_list_tail = new_seg;
+                StreamTcpSegmentDataReplace(stream, new_seg, seg, p, seg->seq, copy_len);
 
+                StreamTcpSegmentLinkReplace(stream, list_seg, new_seg);
                 StreamTcpSegmentReturntoPool(list_seg);
                 list_seg = new_seg;
-                if (new_seg->prev != NULL) {
-                    new_seg->prev->next = new_seg;
-                }
-                if (new_seg->next != NULL) {
-                    new_seg->next->prev = new_seg;
-                }
             }
         } else if (end_after == TRUE) {
             if (list_seg->next != NULL) {
@@ -1158,9 +1311,9 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                     packet_length += (seg->seq + seg->payload_len) -
                                         (list_seg->seq + list_seg->payload_len);
 
-                    TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx, packet_length);
+                    TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx);
                     if (new_seg == NULL) {
-                        SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[packet_length]);
+                        SCLogDebug("segment_pool is empty");
 
                         StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
                         SCReturnInt(-1);
@@ -1176,33 +1329,19 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                     }
                     SCLogDebug("new_seg->seq %"PRIu32" and new->payload_len "
                            "%" PRIu16"", new_seg->seq, new_seg->payload_len);
-                    new_seg->next = list_seg->next;
-                    new_seg->prev = list_seg->prev;
-
-                    /* create a new seg, copy the list_seg data over */
-                    StreamTcpSegmentDataCopy(new_seg, list_seg);
 
                     /* copy the part before list_seg */
                     uint16_t copy_len = list_seg->seq - new_seg->seq;
-                    StreamTcpSegmentDataReplace(new_seg, seg, new_seg->seq,
+                    StreamTcpSegmentDataReplace(stream, new_seg, seg, p, new_seg->seq,
                                                 copy_len);
 
                     /* copy the part after list_seg */
                     copy_len = (seg->seq + seg->payload_len) -
                                     (list_seg->seq + list_seg->payload_len);
-                    StreamTcpSegmentDataReplace(new_seg, seg, (list_seg->seq +
+                    StreamTcpSegmentDataReplace(stream, new_seg, seg, p, (list_seg->seq +
                                               list_seg->payload_len), copy_len);
 
-                    if (new_seg->prev != NULL) {
-                        new_seg->prev->next = new_seg;
-                    }
-                    if (new_seg->next != NULL) {
-                        new_seg->next->prev = new_seg;
-                    }
-                    /*update the stream last_seg in case of removal of list_seg*/
-                    if (stream->seg_list_tail == list_seg)
-                        stream->seg_list_tail = new_seg;
-
+                    StreamTcpSegmentLinkReplace(stream, list_seg, new_seg);
                     StreamTcpSegmentReturntoPool(list_seg);
                     list_seg = new_seg;
                     return_after = TRUE;
@@ -1226,10 +1365,9 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                 packet_length += (seg->seq + seg->payload_len) -
                     (list_seg->seq + list_seg->payload_len);
 
-                TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx, packet_length);
+                TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx);
                 if (new_seg == NULL) {
-                    SCLogDebug("segment_pool[%"PRIu16"] is empty",
-                            segment_pool_idx[packet_length]);
+                    SCLogDebug("segment_pool is empty");
 
                     StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
                     SCReturnInt(-1);
@@ -1246,31 +1384,19 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                 }
                 SCLogDebug("new_seg->seq %"PRIu32" and new->payload_len "
                         "%" PRIu16"", new_seg->seq, new_seg->payload_len);
-                new_seg->next = list_seg->next;
-                new_seg->prev = list_seg->prev;
-
-                /* create a new seg, copy the list_seg data over */
-                StreamTcpSegmentDataCopy(new_seg, list_seg);
 
                 /* copy the part before list_seg */
                 uint16_t copy_len = list_seg->seq - new_seg->seq;
-                StreamTcpSegmentDataReplace(new_seg, seg, new_seg->seq,
+                StreamTcpSegmentDataReplace(stream, new_seg, seg, p, new_seg->seq,
                         copy_len);
 
                 /* copy the part after list_seg */
                 copy_len = (seg->seq + seg->payload_len) -
                     (list_seg->seq + list_seg->payload_len);
-                StreamTcpSegmentDataReplace(new_seg, seg, (list_seg->seq +
+                StreamTcpSegmentDataReplace(stream, new_seg, seg, p, (list_seg->seq +
                             list_seg->payload_len), copy_len);
 
-                if (new_seg->prev != NULL) {
-                    new_seg->prev->next = new_seg;
-                }
-
-                /*update the stream last_seg in case of removal of list_seg*/
-                if (stream->seg_list_tail == list_seg)
-                    stream->seg_list_tail = new_seg;
-
+                StreamTcpSegmentLinkReplace(stream, list_seg, new_seg);
                 StreamTcpSegmentReturntoPool(list_seg);
                 list_seg = new_seg;
                 return_after = TRUE;
@@ -1278,21 +1404,21 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
         }
 
         if (check_overlap_different_data &&
-                !StreamTcpSegmentDataCompare(seg, list_seg, list_seg->seq, overlap)) {
+                !StreamTcpSegmentDataCompare(stream, list_seg, seg, p, list_seg->seq, overlap)) {
             /* interesting, overlap with different data */
             StreamTcpSetEvent(p, STREAM_REASSEMBLY_OVERLAP_DIFFERENT_DATA);
         }
 
         if (StreamTcpInlineMode()) {
-            if (StreamTcpInlineSegmentCompare(seg, list_seg) != 0) {
-                StreamTcpInlineSegmentReplacePacket(p, list_seg);
+            if (StreamTcpInlineSegmentCompare(stream, p, list_seg) != 0) {
+                StreamTcpInlineSegmentReplacePacket(stream, p, list_seg);
             }
         } else {
             switch (os_policy) {
                 case OS_POLICY_SOLARIS:
                 case OS_POLICY_HPUX11:
                     if (end_after == TRUE || end_same == TRUE) {
-                        StreamTcpSegmentDataReplace(list_seg, seg, overlap_point,
+                        StreamTcpSegmentDataReplace(stream, list_seg, seg, p, overlap_point,
                                 overlap);
                     } else {
                         SCLogDebug("using old data in starts before list case, "
@@ -1322,7 +1448,7 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                             "list_seg->seq %" PRIu32 " policy %" PRIu32 " "
                             "overlap %" PRIu32 "", list_seg->seq, os_policy,
                             overlap);
-                    StreamTcpSegmentDataReplace(list_seg, seg, overlap_point,
+                    StreamTcpSegmentDataReplace(stream, list_seg, seg, p, overlap_point,
                             overlap);
                     break;
             }
@@ -1449,41 +1575,33 @@ static int HandleSegmentStartsAtSameListSegment(ThreadVars *tv, TcpReassemblyThr
 
                 SCLogDebug("packet_length %"PRIu16"", packet_length);
 
-                TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx, packet_length);
+                TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx);
                 if (new_seg == NULL) {
-                    SCLogDebug("egment_pool[%"PRIu16"] is empty", segment_pool_idx[packet_length]);
+                    SCLogDebug("segment_pool is empty");
 
                     StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
                     return -1;
                 }
                 new_seg->payload_len = packet_length;
                 new_seg->seq = list_seg->seq + list_seg->payload_len;
-                new_seg->next = list_seg->next;
-                if (new_seg->next != NULL)
-                    new_seg->next->prev = new_seg;
-                new_seg->prev = list_seg;
-                list_seg->next = new_seg;
+                StreamTcpSegmentLinkAfter(stream, list_seg, new_seg);
                 SCLogDebug("new_seg %p, new_seg->next %p, new_seg->prev %p, "
                            "list_seg->next %p", new_seg, new_seg->next,
                            new_seg->prev, list_seg->next);
-                StreamTcpSegmentDataReplace(new_seg, seg, new_seg->seq,
+                StreamTcpSegmentDataReplace(stream, new_seg, seg, p, new_seg->seq,
                                             new_seg->payload_len);
-
-                /*update the stream last_seg in case of removal of list_seg*/
-                if (stream->seg_list_tail == list_seg)
-                    stream->seg_list_tail = new_seg;
             }
         }
 
         if (check_overlap_different_data &&
-                !StreamTcpSegmentDataCompare(list_seg, seg, seg->seq, overlap)) {
+                !StreamTcpSegmentDataCompare(stream, list_seg, seg, p, seg->seq, overlap)) {
             /* interesting, overlap with different data */
             StreamTcpSetEvent(p, STREAM_REASSEMBLY_OVERLAP_DIFFERENT_DATA);
         }
 
         if (StreamTcpInlineMode()) {
-            if (StreamTcpInlineSegmentCompare(list_seg, seg) != 0) {
-                StreamTcpInlineSegmentReplacePacket(p, list_seg);
+            if (StreamTcpInlineSegmentCompare(stream, p, list_seg) != 0) {
+                StreamTcpInlineSegmentReplacePacket(stream, p, list_seg);
             }
         } else {
             switch (os_policy) {
@@ -1491,7 +1609,7 @@ static int HandleSegmentStartsAtSameListSegment(ThreadVars *tv, TcpReassemblyThr
                 case OS_POLICY_SOLARIS:
                 case OS_POLICY_HPUX11:
                     if (end_after == TRUE || end_same == TRUE) {
-                        StreamTcpSegmentDataReplace(list_seg, seg, seg->seq, overlap);
+                        StreamTcpSegmentDataReplace(stream, list_seg, seg, p, seg->seq, overlap);
                     } else {
                         SCLogDebug("using old data in starts at list case, "
                                 "list_seg->seq %" PRIu32 " policy %" PRIu32 " "
@@ -1500,11 +1618,11 @@ static int HandleSegmentStartsAtSameListSegment(ThreadVars *tv, TcpReassemblyThr
                     }
                     break;
                 case OS_POLICY_LAST:
-                    StreamTcpSegmentDataReplace(list_seg, seg, seg->seq, overlap);
+                    StreamTcpSegmentDataReplace(stream, list_seg, seg, p, seg->seq, overlap);
                     break;
                 case OS_POLICY_LINUX:
                     if (end_after == TRUE) {
-                        StreamTcpSegmentDataReplace(list_seg, seg, seg->seq, overlap);
+                        StreamTcpSegmentDataReplace(stream, list_seg, seg, p, seg->seq, overlap);
                     } else {
                         SCLogDebug("using old data in starts at list case, "
                                 "list_seg->seq %" PRIu32 " policy %" PRIu32 " "
@@ -1653,51 +1771,43 @@ static int HandleSegmentStartsAfterListSegment(ThreadVars *tv, TcpReassemblyThre
                 }
                 SCLogDebug("packet_length %"PRIu16"", packet_length);
 
-                TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx, packet_length);
+                TcpSegment *new_seg = StreamTcpGetSegment(tv, ra_ctx);
                 if (new_seg == NULL) {
-                    SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[packet_length]);
+                    SCLogDebug("segment_pool is empty");
 
                     StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
                     SCReturnInt(-1);
                 }
                 new_seg->payload_len = packet_length;
                 new_seg->seq = list_seg->seq + list_seg->payload_len;
-                new_seg->next = list_seg->next;
-                if (new_seg->next != NULL)
-                    new_seg->next->prev = new_seg;
-                new_seg->prev = list_seg;
-                list_seg->next = new_seg;
+                StreamTcpSegmentLinkAfter(stream, list_seg, new_seg);
 
                 SCLogDebug("new_seg %p, new_seg->next %p, new_seg->prev %p, "
                            "list_seg->next %p new_seg->seq %"PRIu32"", new_seg,
                             new_seg->next, new_seg->prev, list_seg->next,
                             new_seg->seq);
 
-                StreamTcpSegmentDataReplace(new_seg, seg, new_seg->seq,
+                StreamTcpSegmentDataReplace(stream, new_seg, seg, p, new_seg->seq,
                                             new_seg->payload_len);
-
-                /* update the stream last_seg in case of removal of list_seg */
-                if (stream->seg_list_tail == list_seg)
-                    stream->seg_list_tail = new_seg;
             }
         }
 
         if (check_overlap_different_data &&
-                !StreamTcpSegmentDataCompare(list_seg, seg, seg->seq, overlap)) {
+                !StreamTcpSegmentDataCompare(stream, list_seg, seg, p, seg->seq, overlap)) {
             /* interesting, overlap with different data */
             StreamTcpSetEvent(p, STREAM_REASSEMBLY_OVERLAP_DIFFERENT_DATA);
         }
 
         if (StreamTcpInlineMode()) {
-            if (StreamTcpInlineSegmentCompare(list_seg, seg) != 0) {
-                StreamTcpInlineSegmentReplacePacket(p, list_seg);
+            if (StreamTcpInlineSegmentCompare(stream, p, list_seg) != 0) {
+                StreamTcpInlineSegmentReplacePacket(stream, p, list_seg);
             }
         } else {
             switch (os_policy) {
                 case OS_POLICY_SOLARIS:
                 case OS_POLICY_HPUX11:
                     if (end_after == TRUE) {
-                        StreamTcpSegmentDataReplace(list_seg, seg, seg->seq, overlap);
+                        StreamTcpSegmentDataReplace(stream, list_seg, seg, p, seg->seq, overlap);
                     } else {
                         SCLogDebug("using old data in starts beyond list case, "
                                 "list_seg->seq %" PRIu32 " policy %" PRIu32 " "
@@ -1706,7 +1816,7 @@ static int HandleSegmentStartsAfterListSegment(ThreadVars *tv, TcpReassemblyThre
                     }
                     break;
                 case OS_POLICY_LAST:
-                    StreamTcpSegmentDataReplace(list_seg, seg, seg->seq, overlap);
+                    StreamTcpSegmentDataReplace(stream, list_seg, seg, p, seg->seq, overlap);
                     break;
                 case OS_POLICY_BSD:
                 case OS_POLICY_HPUX10:
@@ -1924,15 +2034,16 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
         size = p->payload_len;
 #endif
 
-    TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx, size);
+    TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx);
     if (seg == NULL) {
-        SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[size]);
+        SCLogDebug("segment_pool is empty");
 
         StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
         SCReturnInt(-1);
     }
 
-    memcpy(seg->payload, p->payload, size);
+    /* the data is copied from the packet into the stream buffer
+     * when the segment is inserted */
     seg->payload_len = size;
     seg->seq = TCP_GET_SEQ(p);
 
@@ -2129,6 +2240,8 @@ static inline int StreamTcpReturnSegmentCheck(const Flow *f, TcpSession *ssn, Tc
 
 static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg)
 {
+    TCPSEG_RB_REMOVE(&stream->seg_tree, seg);
+
     if (seg->prev == NULL) {
         stream->seg_list = seg->next;
         if (stream->seg_list != NULL)
@@ -2141,6 +2254,8 @@ static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg)
 
     if (stream->seg_list_tail == seg)
         stream->seg_list_tail = seg->prev;
+
+    StreamTcpStreamBufferSlide(stream);
 }
 
 /**
@@ -2322,7 +2437,8 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
                 BUG_ON(copy_size > smsg->data_size);
             }
             SCLogDebug("copy_size is %"PRIu16"", copy_size);
-            memcpy(smsg->data + smsg_offset, seg->payload + payload_offset,
+            memcpy(smsg->data + smsg_offset,
+                    StreamTcpGetDataAtSeq(stream, seg->seq + payload_offset),
                     copy_size);
             smsg_offset += copy_size;
 
@@ -2387,8 +2503,9 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
                     SCLogDebug("copy payload_offset %" PRIu32 ", smsg_offset "
                                 "%" PRIu32 ", copy_size %" PRIu32 "",
                                 payload_offset, smsg_offset, copy_size);
-                    memcpy(smsg->data + smsg_offset, seg->payload +
-                            payload_offset, copy_size);
+                    memcpy(smsg->data + smsg_offset,
+                            StreamTcpGetDataAtSeq(stream, seg->seq + payload_offset),
+                            copy_size);
                     smsg_offset += copy_size;
                     if (gap == 0 && SEQ_GT((seg->seq + payload_offset + copy_size),ra_base_seq+1)) {
                         ra_base_seq += copy_size;
@@ -2542,14 +2659,37 @@ static void GetSessionSize(TcpSession *ssn, Packet *p)
 }
 #endif
 
+/** max data passed to the app layer in one call while the protocol is
+ *  not yet detected */
+#define REASSEMBLE_PROTO_DETECT_CHUNK   4096
+
 typedef struct ReassembleData_ {
     uint32_t ra_base_seq;
-    uint32_t data_len;
-    uint8_t data[4096];
+    uint32_t data_seq;  /* seq of the first byte of the pending data */
+    uint32_t data_len;  /* pending data, contiguous in the stream buffer */
     int partial;        /* last segment was processed only partially */
     uint32_t data_sent; /* data passed on this run */
 } ReassembleData;
 
+/** \internal
+ *  \brief pass the pending data to the app layer
+ *
+ *  The data is passed directly from the stream buffer.
+ */
+static void DoFlushAppLayer(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
+        TcpSession *ssn, TcpStream *stream, ReassembleData *rd, Packet *p)
+{
+    if (rd->data_len == 0)
+        return;
+
+    AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
+            (uint8_t *)StreamTcpGetDataAtSeq(stream, rd->data_seq), rd->data_len,
+            StreamGetAppLayerFlags(ssn, stream, p));
+    AppLayerProfilingStore(ra_ctx->app_tctx, p);
+    rd->data_sent += rd->data_len;
+    rd->data_len = 0;
+}
+
 /** \internal
  *  \brief test if segment follows a gap. If so, handle the gap
  *
@@ -2577,12 +2717,7 @@ int DoHandleGap(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
             SCLogDebug("pre GAP data");
 
             /* process what we have so far */
-            AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
-                    rd->data, rd->data_len,
-                    StreamGetAppLayerFlags(ssn, stream, p));
-            AppLayerProfilingStore(ra_ctx->app_tctx, p);
-            rd->data_sent += rd->data_len;
-            rd->data_len = 0;
+            DoFlushAppLayer(tv, ra_ctx, ssn, stream, rd, p);
         }
 
 #ifdef DEBUG
@@ -2620,62 +2755,6 @@ static inline int DoReassemble(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
                  TcpSession *ssn, TcpStream *stream, TcpSegment *seg, ReassembleData *rd,
                  Packet *p)
 {
-    /* fast paths: send data directly into the app layer, w/o first doing
-     * a copy step. However, don't use the fast path until protocol detection
-     * has been completed
-     * TODO if initial data is big enough for proto detect, we could do the
-     *      fast path anyway. */
-    if (stream->flags & STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_COMPLETED) {
-        /* fast path 1: segment is exactly what we need */
-        if (likely(rd->data_len == 0 &&
-                    SEQ_EQ(seg->seq, rd->ra_base_seq+1) &&
-                    SEQ_EQ(stream->last_ack, (seg->seq + seg->payload_len))))
-        {
-            /* process single segment directly */
-            AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
-                    seg->payload, seg->payload_len,
-                    StreamGetAppLayerFlags(ssn, stream, p));
-            AppLayerProfilingStore(ra_ctx->app_tctx, p);
-            rd->data_sent += seg->payload_len;
-            rd->ra_base_seq += seg->payload_len;
-#ifdef DEBUG
-            ra_ctx->fp1++;
-#endif
-            /* if after the first data chunk we have no alproto yet,
-             * there is no point in continueing here. */
-            if (!StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream)) {
-                SCLogDebug("no alproto after first data chunk");
-                return 0;
-            }
-            return 1;
-            /* fast path 2: segment acked completely, meets minimal size req for 0copy processing */
-        } else if (rd->data_len == 0 &&
-                SEQ_EQ(seg->seq, rd->ra_base_seq+1) &&
-                SEQ_GT(stream->last_ack, (seg->seq + seg->payload_len)) &&
-                seg->payload_len >= stream_config.zero_copy_size)
-        {
-            /* process single segment directly */
-            AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
-                    seg->payload, seg->payload_len,
-                    StreamGetAppLayerFlags(ssn, stream, p));
-            AppLayerProfilingStore(ra_ctx->app_tctx, p);
-            rd->data_sent += seg->payload_len;
-            rd->ra_base_seq += seg->payload_len;
-#ifdef DEBUG
-            ra_ctx->fp2++;
-#endif
-            /* if after the first data chunk we have no alproto yet,
-             * there is no point in continueing here. */
-            if (!StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream)) {
-                SCLogDebug("no alproto after first data chunk");
-                return 0;
-            }
-            return 1;
-        }
-    }
-#ifdef DEBUG
-    ra_ctx->sp++;
-#endif
     uint16_t payload_offset = 0;
     uint16_t payload_len = 0;
 
@@ -2749,115 +2828,45 @@ static inline int DoReassemble(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
             return 0;
         }
 
-        /* copy the data into the buffer */
-        uint16_t copy_size = sizeof(rd->data) - rd->data_len;
-        if (copy_size + payload_offset > seg->payload_len) {
-            copy_size = seg->payload_len - payload_offset;
-        }
-        if (copy_size > payload_len) {
-            copy_size = payload_len;
-        }
-        if (SCLogDebugEnabled()) {
-            BUG_ON(copy_size > sizeof(rd->data));
-            BUG_ON(copy_size+payload_offset > seg->payload_len);
-            BUG_ON(copy_size+payload_offset > seg->pool_size);
-        }
-
-        SCLogDebug("copy_size is %"PRIu16"", copy_size);
-        memcpy(rd->data + rd->data_len, seg->payload + payload_offset, copy_size);
-        rd->data_len += copy_size;
-        rd->ra_base_seq += copy_size;
-        SCLogDebug("ra_base_seq %"PRIu32", data_len %"PRIu32, rd->ra_base_seq, rd->data_len);
-
-        /* queue the smsg if it's full */
-        if (rd->data_len == sizeof(rd->data)) {
-            /* process what we have so far */
-            AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
-                    rd->data, rd->data_len,
-                    StreamGetAppLayerFlags(ssn, stream, p));
-            AppLayerProfilingStore(ra_ctx->app_tctx, p);
-            rd->data_sent += rd->data_len;
-            rd->data_len = 0;
+        uint32_t seq = seg->seq + payload_offset;
 
-            /* if after the first data chunk we have no alproto yet,
-             * there is no point in continueing here. */
-            if (!StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream)) {
-                SCLogDebug("no alproto after first data chunk");
-                return 0;
-            }
+        /* the data is only passed on in place if it directly follows
+         * the pending data */
+        if (rd->data_len > 0 && !(SEQ_EQ(seq, rd->data_seq + rd->data_len))) {
+            DoFlushAppLayer(tv, ra_ctx, ssn, stream, rd, p);
         }
 
-        /* if the payload len is bigger than what we copied, we handle the
-         * rest of the payload next... */
-        if (copy_size < payload_len) {
-            SCLogDebug("copy_size %" PRIu32 " < %" PRIu32 "", copy_size,
-                    payload_len);
+        /* until the protocol is detected the data is passed on in chunks,
+         * after that the pending data can grow until the end of the run */
+        while (payload_len > 0) {
+            if (rd->data_len == 0)
+                rd->data_seq = seq;
 
-            payload_offset += copy_size;
-            payload_len -= copy_size;
-            SCLogDebug("payload_offset is %"PRIu16", seg->payload_len is "
-                    "%"PRIu16" and stream->last_ack is %"PRIu32"",
-                    payload_offset, seg->payload_len, stream->last_ack);
-            if (SCLogDebugEnabled()) {
-                BUG_ON(payload_offset > seg->payload_len);
+            uint32_t add_size = payload_len;
+            if (!StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream) &&
+                    rd->data_len + add_size > REASSEMBLE_PROTO_DETECT_CHUNK)
+            {
+                add_size = REASSEMBLE_PROTO_DETECT_CHUNK - rd->data_len;
             }
 
-            /* we need a while loop here as the packets theoretically can be
-             * 64k */
-            char segment_done = FALSE;
-            while (segment_done == FALSE) {
-                SCLogDebug("new msg at offset %" PRIu32 ", payload_len "
-                        "%" PRIu32 "", payload_offset, payload_len);
-                rd->data_len = 0;
-
-                copy_size = sizeof(rd->data) - rd->data_len;
-                if (copy_size > (seg->payload_len - payload_offset)) {
-                    copy_size = (seg->payload_len - payload_offset);
-                }
-                if (SCLogDebugEnabled()) {
-                    BUG_ON(copy_size > sizeof(rd->data));
-                }
-
-                SCLogDebug("copy payload_offset %" PRIu32 ", data_len "
-                        "%" PRIu32 ", copy_size %" PRIu32 "",
-                        payload_offset, rd->data_len, copy_size);
-                memcpy(rd->data + rd->data_len, seg->payload +
-                        payload_offset, copy_size);
-                rd->data_len += copy_size;
-                rd->ra_base_seq += copy_size;
-                SCLogDebug("ra_base_seq %"PRIu32, rd->ra_base_seq);
-                SCLogDebug("copied payload_offset %" PRIu32 ", "
-                        "data_len %" PRIu32 ", copy_size %" PRIu32 "",
-                        payload_offset, rd->data_len, copy_size);
-
-                if (rd->data_len == sizeof(rd->data)) {
-                    /* process what we have so far */
-                    AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
-                            rd->data, rd->data_len,
-                            StreamGetAppLayerFlags(ssn, stream, p));
-                    AppLayerProfilingStore(ra_ctx->app_tctx, p);
-                    rd->data_sent += rd->data_len;
-                    rd->data_len = 0;
-
-                    /* if after the first data chunk we have no alproto yet,
-                     * there is no point in continueing here. */
-                    if (!StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream)) {
-                        SCLogDebug("no alproto after first data chunk");
-                        return 0;
-                    }
-                }
-
-                /* see if we have segment payload left to process */
-                if ((copy_size + payload_offset) < seg->payload_len) {
-                    payload_offset += copy_size;
-                    payload_len -= copy_size;
+            SCLogDebug("add_size is %"PRIu32"", add_size);
+            rd->data_len += add_size;
+            rd->ra_base_seq += add_size;
+            seq += add_size;
+            payload_len -= add_size;
+            SCLogDebug("ra_base_seq %"PRIu32", data_len %"PRIu32, rd->ra_base_seq, rd->data_len);
 
-                    if (SCLogDebugEnabled()) {
-                        BUG_ON(payload_offset > seg->payload_len);
-                    }
-                } else {
-                    payload_offset = 0;
-                    segment_done = TRUE;
+            if (!StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream) &&
+                    rd->data_len == REASSEMBLE_PROTO_DETECT_CHUNK)
+            {
+                /* process what we have so far */
+                DoFlushAppLayer(tv, ra_ctx, ssn, stream, rd, p);
+
+                /* if after the first data chunk we have no alproto yet,
+                 * there is no point in continueing here. */
+                if (!StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream)) {
+                    SCLogDebug("no alproto after first data chunk");
+                    return 0;
                 }
             }
         }
@@ -2978,6 +2987,7 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
      * detected. */
     ReassembleData rd;
     rd.ra_base_seq = stream->ra_app_base_seq;
+    rd.data_seq = 0;
     rd.data_len = 0;
     rd.data_sent = 0;
     rd.partial = FALSE;
@@ -3049,11 +3059,7 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     if (rd.data_len > 0) {
         SCLogDebug("data_len > 0, %u", rd.data_len);
         /* process what we have so far */
-        BUG_ON(rd.data_len > sizeof(rd.data));
-        AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
-                              rd.data, rd.data_len,
-                              StreamGetAppLayerFlags(ssn, stream, p));
-        AppLayerProfilingStore(ra_ctx->app_tctx, p);
+        DoFlushAppLayer(tv, ra_ctx, ssn, stream, &rd, p);
     }
 
     /* if no data was sent to the applayer, we send it a empty 'nudge'
@@ -3204,7 +3210,8 @@ static int DoRawReassemble(TcpSession *ssn, TcpStream *stream, TcpSegment *seg,
             BUG_ON(copy_size > rd->smsg->data_size);
         }
         SCLogDebug("copy_size is %"PRIu16"", copy_size);
-        memcpy(rd->smsg->data + rd->smsg_offset, seg->payload + payload_offset,
+        memcpy(rd->smsg->data + rd->smsg_offset,
+                StreamTcpGetDataAtSeq(stream, seg->seq + payload_offset),
                 copy_size);
         rd->smsg_offset += copy_size;
         rd->ra_base_seq += copy_size;
@@ -3264,8 +3271,9 @@ static int DoRawReassemble(TcpSession *ssn, TcpStream *stream, TcpSegment *seg,
                 SCLogDebug("copy payload_offset %" PRIu32 ", smsg_offset "
                         "%" PRIu32 ", copy_size %" PRIu32 "",
                         payload_offset, rd->smsg_offset, copy_size);
-                memcpy(rd->smsg->data + rd->smsg_offset, seg->payload +
-                        payload_offset, copy_size);
+                memcpy(rd->smsg->data + rd->smsg_offset,
+                        StreamTcpGetDataAtSeq(stream, seg->seq + payload_offset),
+                        copy_size);
                 rd->smsg_offset += copy_size;
                 rd->ra_base_seq += copy_size;
                 SCLogDebug("ra_base_seq %"PRIu32, rd->ra_base_seq);
@@ -3465,177 +3473,117 @@ int StreamTcpReassembleHandleSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
     SCReturnInt(0);
 }
 
+/**
+ *  \internal
+ *  \brief get the part of [start_point, start_point + len) that is
+ *         covered by both dst_seg and src_seg
+ *
+ *  \retval len length of the intersection, 0 if there is none
+ */
+static uint16_t StreamTcpSegmentDataRange(const TcpSegment *dst_seg,
+        const TcpSegment *src_seg, uint32_t start_point, uint16_t len,
+        uint32_t *seq)
+{
+    uint32_t left = start_point;
+    uint32_t right = start_point + len;
+
+    if (SEQ_LT(left, dst_seg->seq))
+        left = dst_seg->seq;
+    if (SEQ_LT(left, src_seg->seq))
+        left = src_seg->seq;
+    if (SEQ_GT(right, dst_seg->seq + dst_seg->payload_len))
+        right = dst_seg->seq + dst_seg->payload_len;
+    if (SEQ_GT(right, src_seg->seq + src_seg->payload_len))
+        right = src_seg->seq + src_seg->payload_len;
+
+    if (SEQ_LEQ(right, left))
+        return 0;
+
+    *seq = left;
+    return (uint16_t)(right - left);
+}
+
 /**
  *  \brief  Function to replace the data from a specific point up to given length.
  *
+ *  The data of src_seg is still in the packet, the data of dst_seg is in
+ *  the stream buffer.
+ *
+ *  \param  stream      stream the segments belong to
  *  \param  dst_seg     Destination segment to replace the data
  *  \param  src_seg     Source segment of which data is to be written to destination
+ *  \param  p           packet holding the data of src_seg
  *  \param  start_point Starting point to replace the data onwards
  *  \param  len         Length up to which data is need to be replaced
  *
- *  \todo VJ We can remove the abort()s later.
- *  \todo VJ Why not memcpy?
+ *  \retval 0 always
  */
-void StreamTcpSegmentDataReplace(TcpSegment *dst_seg, TcpSegment *src_seg,
-                                 uint32_t start_point, uint16_t len)
+static int StreamTcpSegmentDataReplace(TcpStream *stream, TcpSegment *dst_seg,
+        TcpSegment *src_seg, Packet *p, uint32_t start_point, uint16_t len)
 {
-    uint32_t seq;
-    uint16_t src_pos = 0;
-    uint16_t dst_pos = 0;
-
-    SCLogDebug("start_point %u", start_point);
-
-    if (SEQ_GT(start_point, dst_seg->seq)) {
-        dst_pos = start_point - dst_seg->seq;
-    } else if (SEQ_LT(start_point, dst_seg->seq)) {
-        dst_pos = dst_seg->seq - start_point;
-    }
-
-    if (SCLogDebugEnabled()) {
-        BUG_ON(((len + dst_pos) - 1) > dst_seg->payload_len);
-    } else {
-        if (((len + dst_pos) - 1) > dst_seg->payload_len)
-            return;
-    }
-
-    src_pos = (uint16_t)(start_point - src_seg->seq);
+    uint32_t seq = 0;
+    uint16_t replace_len = StreamTcpSegmentDataRange(dst_seg, src_seg,
+            start_point, len, &seq);
 
-    SCLogDebug("Replacing data from dst_pos %"PRIu16"", dst_pos);
+    SCLogDebug("start_point %u len %u: replacing %u bytes from seq %u",
+            start_point, len, replace_len, seq);
 
-    for (seq = start_point; SEQ_LT(seq, (start_point + len)) &&
-            src_pos < src_seg->payload_len && dst_pos < dst_seg->payload_len;
-            seq++, dst_pos++, src_pos++)
-    {
-        dst_seg->payload[dst_pos] = src_seg->payload[src_pos];
-    }
-
-    SCLogDebug("Replaced data of size %"PRIu16" up to src_pos %"PRIu16
-            " dst_pos %"PRIu16, len, src_pos, dst_pos);
+    StreamTcpStreamBufferWrite(stream, seq, PacketDataAtSeq(p, seq), replace_len);
+    return 0;
 }
 
 /**
  *  \brief  Function to compare the data from a specific point up to given length.
  *
+ *  \param  stream      stream the segments belong to
  *  \param  dst_seg     Destination segment to compare the data
  *  \param  src_seg     Source segment of which data is to be compared to destination
+ *  \param  p           packet holding the data of src_seg
  *  \param  start_point Starting point to compare the data onwards
  *  \param  len         Length up to which data is need to be compared
  *
  *  \retval 1 same
  *  \retval 0 different
  */
-static int StreamTcpSegmentDataCompare(TcpSegment *dst_seg, TcpSegment *src_seg,
-                                 uint32_t start_point, uint16_t len)
+static int StreamTcpSegmentDataCompare(TcpStream *stream, TcpSegment *dst_seg,
+        TcpSegment *src_seg, Packet *p, uint32_t start_point, uint16_t len)
 {
-    uint32_t seq;
-    uint16_t src_pos = 0;
-    uint16_t dst_pos = 0;
-
-    SCLogDebug("start_point %u dst_seg %u src_seg %u", start_point, dst_seg->seq, src_seg->seq);
+    uint32_t seq = 0;
+    uint16_t cmp_len = StreamTcpSegmentDataRange(dst_seg, src_seg,
+            start_point, len, &seq);
 
-    if (SEQ_GT(start_point, dst_seg->seq)) {
-        SCLogDebug("start_point %u > dst %u", start_point, dst_seg->seq);
-        dst_pos = start_point - dst_seg->seq;
-    } else if (SEQ_LT(start_point, dst_seg->seq)) {
-        SCLogDebug("start_point %u < dst %u", start_point, dst_seg->seq);
-        dst_pos = dst_seg->seq - start_point;
-    }
+    SCLogDebug("start_point %u dst_seg %u src_seg %u: comparing %u bytes "
+            "from seq %u", start_point, dst_seg->seq, src_seg->seq,
+            cmp_len, seq);
 
-    if (SCLogDebugEnabled()) {
-        BUG_ON(((len + dst_pos) - 1) > dst_seg->payload_len);
-    } else {
-        if (((len + dst_pos) - 1) > dst_seg->payload_len)
-            return 1;
-    }
-
-    src_pos = (uint16_t)(start_point - src_seg->seq);
-
-    SCLogDebug("Comparing data from dst_pos %"PRIu16", src_pos %u", dst_pos, src_pos);
+    if (cmp_len == 0)
+        return 1;
 
-    for (seq = start_point; SEQ_LT(seq, (start_point + len)) &&
-            src_pos < src_seg->payload_len && dst_pos < dst_seg->payload_len;
-            seq++, dst_pos++, src_pos++)
-    {
-        if (dst_seg->payload[dst_pos] != src_seg->payload[src_pos]) {
-            SCLogDebug("data is different %02x != %02x, dst_pos %u, src_pos %u", dst_seg->payload[dst_pos], src_seg->payload[src_pos], dst_pos, src_pos);
-            return 0;
-        }
+    if (memcmp(StreamTcpGetDataAtSeq(stream, seq),
+                PacketDataAtSeq(p, seq), cmp_len) != 0) {
+        SCLogDebug("data is different");
+        return 0;
     }
-
-    SCLogDebug("Compared data of size %"PRIu16" up to src_pos %"PRIu16
-            " dst_pos %"PRIu16, len, src_pos, dst_pos);
     return 1;
 }
 
 /**
- *  \brief  Function to copy the data from src_seg to dst_seg.
- *
- *  \param  dst_seg     Destination segment for copying the contents
- *  \param  src_seg     Source segment to copy its contents
- *
- *  \todo VJ wouldn't a memcpy be more appropriate here?
- *
- *  \warning Both segments need to be properly initialized.
- */
-
-void StreamTcpSegmentDataCopy(TcpSegment *dst_seg, TcpSegment *src_seg)
-{
-    uint32_t u;
-    uint16_t dst_pos = 0;
-    uint16_t src_pos = 0;
-    uint32_t seq;
-
-    if (SEQ_GT(dst_seg->seq, src_seg->seq)) {
-        src_pos = dst_seg->seq - src_seg->seq;
-        seq = dst_seg->seq;
-    } else {
-        dst_pos = src_seg->seq - dst_seg->seq;
-        seq = src_seg->seq;
-    }
-
-    SCLogDebug("Copying data from seq %"PRIu32"", seq);
-    for (u = seq;
-            (SEQ_LT(u, (src_seg->seq + src_seg->payload_len)) &&
-             SEQ_LT(u, (dst_seg->seq + dst_seg->payload_len))); u++)
-    {
-        //SCLogDebug("u %"PRIu32, u);
-
-        dst_seg->payload[dst_pos] = src_seg->payload[src_pos];
-
-        dst_pos++;
-        src_pos++;
-    }
-    SCLogDebug("Copyied data of size %"PRIu16" up to dst_pos %"PRIu16"",
-                src_pos, dst_pos);
-}
-
-/**
- *  \brief   Function to get the segment of required length from the pool.
- *
- *  \param   len    Length which tells the required size of needed segment.
+ *  \brief   Function to get a segment from the pool.
  *
  *  \retval seg Segment from the pool or NULL
  */
-TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx, uint16_t len)
+TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx)
 {
-    uint16_t idx = segment_pool_idx[len];
-    SCLogDebug("segment_pool_idx %" PRIu32 " for payload_len %" PRIu32 "",
-                idx, len);
-
-    SCMutexLock(&segment_pool_mutex[idx]);
-    TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool[idx]);
+    SCMutexLock(&segment_pool_mutex);
+    TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool);
 
-    SCLogDebug("segment_pool[%u]->empty_stack_size %u, segment_pool[%u]->alloc_"
-               "list_size %u, alloc %u", idx, segment_pool[idx]->empty_stack_size,
-               idx, segment_pool[idx]->alloc_stack_size,
-               segment_pool[idx]->allocated);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+    SCLogDebug("segment_pool->empty_stack_size %u, segment_pool->alloc_"
+               "list_size %u, alloc %u", segment_pool->empty_stack_size,
+               segment_pool->alloc_stack_size, segment_pool->allocated);
+    SCMutexUnlock(&segment_pool_mutex);
 
     SCLogDebug("seg we return is %p", seg);
     if (seg == NULL) {
-        SCLogDebug("segment_pool[%u]->empty_stack_size %u, "
-                   "alloc %u", idx, segment_pool[idx]->empty_stack_size,
-                   segment_pool[idx]->allocated);
         /* Increment the counter to show that we are not able to serve the
            segment request due to memcap limit */
         StatsIncr(tv, ra_ctx->counter_tcp_segment_memcap);
@@ -3978,20 +3926,31 @@ int StreamTcpCheckStreamContents(uint8_t *stream_policy, uint16_t sp_size, TcpSt
 #ifdef DEBUG
     if (SCLogDebugEnabled()) {
         TcpSegment *temp1;
-        for (temp1 = stream->seg_list; temp1 != NULL; temp1 = temp1->next)
-            PrintRawDataFp(stdout, temp1->payload, temp1->payload_len);
+        for (temp1 = stream->seg_list; temp1 != NULL; temp1 = temp1->next) {
+            const uint8_t *seg_data;
+            uint32_t seg_datalen;
+            StreamTcpSegmentGetData(stream, temp1, &seg_data, &seg_datalen);
+            if (seg_data != NULL)
+                PrintRawDataFp(stdout, seg_data, seg_datalen);
+        }
 
         PrintRawDataFp(stdout, stream_policy, sp_size);
     }
 #endif
 
     for (temp = stream->seg_list; temp != NULL; temp = temp->next) {
+        const uint8_t *seg_data;
+        uint32_t seg_datalen;
+        StreamTcpSegmentGetData(stream, temp, &seg_data, &seg_datalen);
+        if (seg_data == NULL)
+            return 0;
+
         j = 0;
-        for (; j < temp->payload_len; j++) {
+        for (; j < seg_datalen; j++) {
             SCLogDebug("i %"PRIu16", len %"PRIu32", stream %"PRIx32" and temp is %"PRIx8"",
-                i, temp->payload_len, stream_policy[i], temp->payload[j]);
+                i, seg_datalen, stream_policy[i], seg_data[j]);
 
-            if (stream_policy[i] == temp->payload[j]) {
+            if (stream_policy[i] == seg_data[j]) {
                 i++;
                 continue;
             } else
@@ -8688,6 +8647,263 @@ end:
     return ret;
 }
 
+#define INSERT_TEST04_SEGS      512
+#define INSERT_TEST04_SEGSIZE   16
+
+/** \test insert segments in random order, with retransmissions that
+ *        partly overlap their neighbours. The list and the tree need to
+ *        be sorted and match, and the data needs to be complete. */
+static int StreamTcpReassembleInsertTest04(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    uint8_t data[INSERT_TEST04_SEGS * INSERT_TEST04_SEGSIZE];
+    uint32_t order[INSERT_TEST04_SEGS * 2];
+    uint32_t i;
+
+    memset(&tv, 0x00, sizeof(tv));
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)((i * 7) ^ (i >> 8));
+
+    /* each segment once, plus a retransmission starting halfway */
+    uint32_t norder = 0;
+    for (i = 0; i < INSERT_TEST04_SEGS; i++) {
+        order[norder++] = i * INSERT_TEST04_SEGSIZE;
+        if (i + 1 < INSERT_TEST04_SEGS)
+            order[norder++] = i * INSERT_TEST04_SEGSIZE + INSERT_TEST04_SEGSIZE / 2;
+    }
+    /* fixed seed so failures can be reproduced */
+    uint32_t rnd = 12345;
+    for (i = norder - 1; i > 0; i--) {
+        rnd = rnd * 1103515245 + 12345;
+        uint32_t j = (rnd >> 8) % (i + 1);
+        uint32_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+
+    for (i = 0; i < norder; i++) {
+        FAIL_IF(StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &ssn.client,
+                    2 + order[i], data + order[i], INSERT_TEST04_SEGSIZE) == -1);
+    }
+
+    uint32_t next_seq = 2;
+    TcpSegment *seg = ssn.client.seg_list;
+    TcpSegment *tseg = RB_MIN(TCPSEG, &ssn.client.seg_tree);
+    for ( ; seg != NULL; seg = seg->next, tseg = TCPSEG_RB_NEXT(tseg)) {
+        FAIL_IF(tseg != seg);
+        /* sorted, no overlap and no holes */
+        FAIL_IF(seg->seq != next_seq);
+
+        const uint8_t *seg_data;
+        uint32_t seg_datalen;
+        StreamTcpSegmentGetData(&ssn.client, seg, &seg_data, &seg_datalen);
+        FAIL_IF(seg_data == NULL);
+        FAIL_IF(memcmp(seg_data, data + (seg->seq - 2), seg_datalen) != 0);
+
+        next_seq = seg->seq + seg->payload_len;
+    }
+    FAIL_IF(tseg != NULL);
+    FAIL_IF(next_seq != 2 + sizeof(data));
+
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
+/** \test a segment far beyond the buffered data doesn't make the stream
+ *        buffer allocate the gap */
+static int StreamTcpReassembleInsertTest05(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    /* default stream.reassembly.depth from the yaml */
+    const uint32_t depth = 1024 * 1024;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,
+                2, 'A', 10) == -1);
+    uint64_t memuse = SC_ATOMIC_GET(ra_memuse);
+
+    /* single segment at ISN + depth - 1 */
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,
+                1 + depth - 1, 'B', 10) != -1);
+    FAIL_IF(SC_ATOMIC_GET(ra_memuse) > memuse + STREAM_SEGMENT_BUFFER_SIZE);
+    FAIL_IF(ssn.client.sb.buf_size > STREAM_SEGMENT_BUFFER_MAX_GAP);
+    FAIL_IF(ssn.client.seg_list != ssn.client.seg_list_tail);
+
+    /* out of order within the limit is still buffered */
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,
+                2 + 10 + 1000, 'C', 10) == -1);
+    FAIL_IF(ssn.client.seg_list_tail->seq != 2 + 10 + 1000);
+
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
+#define INSERT_TEST06_SEGS      64
+#define INSERT_TEST06_SEGSIZE   100
+
+/** \test segments in reverse order don't move the buffered data: the
+ *        buffer is anchored at the reassembly base */
+static int StreamTcpReassembleInsertTest06(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    uint8_t data[INSERT_TEST06_SEGS * INSERT_TEST06_SEGSIZE];
+    uint32_t i;
+
+    memset(&tv, 0x00, sizeof(tv));
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)((i * 7) ^ (i >> 8));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+
+    for (i = INSERT_TEST06_SEGS; i > 0; i--) {
+        uint32_t offset = (i - 1) * INSERT_TEST06_SEGSIZE;
+        FAIL_IF(StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &ssn.client,
+                    2 + offset, data + offset, INSERT_TEST06_SEGSIZE) == -1);
+        FAIL_IF(ssn.client.sb_base_seq != 2);
+    }
+
+    const uint8_t *seg_data;
+    uint32_t seg_datalen;
+    TcpSegment *seg = ssn.client.seg_list;
+    for (i = 0; seg != NULL; seg = seg->next, i++) {
+        FAIL_IF(seg->seq != 2 + i * INSERT_TEST06_SEGSIZE);
+        StreamTcpSegmentGetData(&ssn.client, seg, &seg_data, &seg_datalen);
+        FAIL_IF(seg_data == NULL);
+        FAIL_IF(memcmp(seg_data, data + (seg->seq - 2), seg_datalen) != 0);
+    }
+    FAIL_IF(i != INSERT_TEST06_SEGS);
+
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
+#define INSERT_TEST07_SEGS      2000
+#define INSERT_TEST07_SEGSIZE   100
+
+/** \test a hole at the start that is too big to anchor the buffer at the
+ *        base: filling it in reverse order only moves the buffered data a
+ *        few times */
+static int StreamTcpReassembleInsertTest07(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    uint32_t i;
+    uint32_t moves = 0;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+
+    const uint32_t top = 2 + STREAM_SEGMENT_BUFFER_MAX_GAP +
+        INSERT_TEST07_SEGS * INSERT_TEST07_SEGSIZE;
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,
+                top, 'A', INSERT_TEST07_SEGSIZE) == -1);
+    FAIL_IF(ssn.client.sb_base_seq != top);
+
+    uint32_t base_seq = ssn.client.sb_base_seq;
+    for (i = 1; i <= INSERT_TEST07_SEGS; i++) {
+        FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,
+                    top - i * INSERT_TEST07_SEGSIZE, 'B',
+                    INSERT_TEST07_SEGSIZE) == -1);
+        if (ssn.client.sb_base_seq != base_seq) {
+            base_seq = ssn.client.sb_base_seq;
+            moves++;
+        }
+    }
+    FAIL_IF(moves > 16);
+
+    const uint8_t *seg_data;
+    uint32_t seg_datalen;
+    TcpSegment *seg = ssn.client.seg_list;
+    for (i = 0; seg != NULL; seg = seg->next, i++) {
+        StreamTcpSegmentGetData(&ssn.client, seg, &seg_data, &seg_datalen);
+        FAIL_IF(seg_data == NULL);
+        FAIL_IF(seg_datalen != INSERT_TEST07_SEGSIZE);
+        FAIL_IF(seg_data[0] != (seg->next != NULL ? 'B' : 'A'));
+    }
+    FAIL_IF(i != INSERT_TEST07_SEGS + 1);
+
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
+/** \test the stream buffer is freed when the last segment is removed, and
+ *        the next segment gets a new one */
+static int StreamTcpReassembleInsertTest08(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+
+    /* out of order, so the buffer covers a gap */
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,
+                2 + 100000, 'B', 100) == -1);
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,
+                2, 'A', 100) == -1);
+    FAIL_IF_NULL(ssn.client.sb.buf);
+    const uint32_t buf_size = ssn.client.sb.buf_size;
+    FAIL_IF(buf_size < 100000);
+    const uint64_t memuse = SC_ATOMIC_GET(ra_memuse);
+
+    TcpSegment *seg = ssn.client.seg_list;
+    StreamTcpRemoveSegmentFromStream(&ssn.client, seg);
+    StreamTcpSegmentReturntoPool(seg);
+    FAIL_IF_NULL(ssn.client.sb.buf);
+
+    seg = ssn.client.seg_list;
+    StreamTcpRemoveSegmentFromStream(&ssn.client, seg);
+    StreamTcpSegmentReturntoPool(seg);
+    FAIL_IF_NOT_NULL(ssn.client.sb.buf);
+    FAIL_IF(ssn.client.sb.buf_size != 0);
+    FAIL_IF(SC_ATOMIC_GET(ra_memuse) + buf_size > memuse);
+
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,
+                2, 'C', 100) == -1);
+    FAIL_IF_NULL(ssn.client.sb.buf);
+    FAIL_IF(ssn.client.sb.buf_size > STREAM_SEGMENT_BUFFER_SIZE);
+
+    const uint8_t *seg_data;
+    uint32_t seg_datalen;
+    StreamTcpSegmentGetData(&ssn.client, ssn.client.seg_list,
+            &seg_data, &seg_datalen);
+    FAIL_IF(seg_data == NULL || seg_datalen != 100);
+    FAIL_IF(seg_data[0] != 'C' || seg_data[99] != 'C');
+
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /** \brief  The Function Register the Unit tests to test the reassembly engine
@@ -8816,6 +9032,16 @@ void StreamTcpReassembleRegisterTests(void)
                    StreamTcpReassembleInsertTest02);
     UtRegisterTest("StreamTcpReassembleInsertTest03 -- insert with overlap",
                    StreamTcpReassembleInsertTest03);
+    UtRegisterTest("StreamTcpReassembleInsertTest04 -- insert in random order",
+                   StreamTcpReassembleInsertTest04);
+    UtRegisterTest("StreamTcpReassembleInsertTest05 -- insert far out of order",
+                   StreamTcpReassembleInsertTest05);
+    UtRegisterTest("StreamTcpReassembleInsertTest06 -- insert in reverse order",
+                   StreamTcpReassembleInsertTest06);
+    UtRegisterTest("StreamTcpReassembleInsertTest07 -- insert in reverse order "
+                   "after a big hole", StreamTcpReassembleInsertTest07);
+    UtRegisterTest("StreamTcpReassembleInsertTest08 -- free the buffer "
+                   "when the list empties", StreamTcpReassembleInsertTest08);
 
     StreamTcpInlineRegisterTests();
     StreamTcpUtilRegisterTests();
@@ -35,6 +35,7 @@
 
 #include "flow.h"
 #include "flow-util.h"
+#include "flow-wheel.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
@@ -668,6 +669,8 @@ static void StreamTcpPacketSetState(Packet *p, TcpSession *ssn,
         case TCP_TIME_WAIT:
         case TCP_CLOSED:
             SC_ATOMIC_SET(p->flow->flow_state, FLOW_STATE_CLOSED);
+            /* closed timeout is usually much shorter */
+            FlowWheelScheduleFlow(p->flow);
             break;
     }
 }
@@ -5755,7 +5758,15 @@ int StreamTcpSegmentForEach(const Packet *p, uint8_t flag, StreamSegmentCallback
     for (; seg != NULL &&
             (stream_inline || SEQ_LT(seg->seq, stream->last_ack));)
     {
-        ret = CallbackFunc(p, data, seg->payload, seg->payload_len);
+        const uint8_t *seg_data;
+        uint32_t seg_datalen;
+        StreamTcpSegmentGetData(stream, seg, &seg_data, &seg_datalen);
+        if (seg_data == NULL) {
+            seg = seg->next;
+            continue;
+        }
+
+        ret = CallbackFunc(p, data, (uint8_t *)seg_data, seg_datalen);
         if (ret != 1) {
             SCLogDebug("Callback function has failed");
             return -1;
@@ -8958,7 +8969,12 @@ static int StreamTcpTest30(void)
 
     if (StreamTcpCheckStreamContents(expected_content, 9, &ssn.client) != 1) {
         printf("the contents are not as expected(GET /EVIL), contents are: ");
-        PrintRawDataFp(stdout, ssn.client.seg_list->payload, 9);
+        const uint8_t *seg_data;
+        uint32_t seg_datalen;
+        StreamTcpSegmentGetData(&ssn.client, ssn.client.seg_list,
+                &seg_data, &seg_datalen);
+        if (seg_data != NULL)
+            PrintRawDataFp(stdout, seg_data, seg_datalen);
         result &= 0;
         goto end;
     }
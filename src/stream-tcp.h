@@ -51,8 +51,8 @@ typedef struct TcpStreamCnf_ {
     uint32_t ssn_init_flags; /**< new ssn flags will be initialized to this */
     uint8_t segment_init_flags; /**< new seg flags will be initialized to this */
 
-    uint16_t zero_copy_size;    /**< use zero copy for app layer above segments
-                                 *   of this size */
+    StreamingBufferConfig sbcnf; /**< config for the per stream segment
+                                  *   data buffer */
 
     uint32_t prealloc_sessions; /**< ssns to prealloc per stream thread */
     int midstream;
@@ -326,6 +326,7 @@ typedef enum PacketProfileDetectId_ {
     PROF_DETECT_MPM_HUAD,
     PROF_DETECT_MPM_HHHD,
     PROF_DETECT_MPM_HRHHD,
+    PROF_DETECT_MPM_HTTP_MULTI,
     PROF_DETECT_MPM_DNSQUERY,
     PROF_DETECT_MPM_TLSSNI,
     PROF_DETECT_IPONLY,
@@ -82,6 +82,7 @@
 #define SCCondT uint8_t
 #define SCCondInit(x,y) ({ 0; })
 #define SCCondSignal(x) ({ 0; })
+#define SCCondBroadcast(x) ({ 0; })
 #define SCCondDestroy(x) ({ 0; })
 
 static inline void cycle_sleep(int cycles)
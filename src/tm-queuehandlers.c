@@ -34,6 +34,7 @@
 #include "tmqh-nfq.h"
 #include "tmqh-packetpool.h"
 #include "tmqh-flow.h"
+#include "tmqh-flow-ring.h"
 #include "tmqh-ringbuffer.h"
 
 void TmqhSetup (void)
@@ -44,6 +45,7 @@ void TmqhSetup (void)
     TmqhNfqRegister();
     TmqhPacketpoolRegister();
     TmqhFlowRegister();
+    TmqhFlowRingRegister();
     TmqhRingBufferRegister();
 }
 
@@ -51,6 +53,8 @@ void TmqhSetup (void)
 void TmqhCleanup(void)
 {
     TmqhRingBufferDestroy();
+    TmqhFlowRingDestroy();
+    TmqhFlowCleanup();
 }
 
 Tmqh* TmqhGetQueueHandlerByName(char *name)
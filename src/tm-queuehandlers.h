@@ -29,6 +29,7 @@ enum {
     TMQH_NFQ,
     TMQH_PACKETPOOL,
     TMQH_FLOW,
+    TMQH_FLOW_RING,
     TMQH_RINGBUFFER_MRSW,
     TMQH_RINGBUFFER_SRSW,
     TMQH_RINGBUFFER_SRMW,
@@ -40,6 +41,8 @@ typedef struct Tmqh_ {
     char *name;
     Packet *(*InHandler)(ThreadVars *);
     void (*InShutdownHandler)(ThreadVars *);
+    void (*InRegisterCounters)(ThreadVars *);   /**< optional, register
+                                                 *   counters in the reader */
     void (*OutHandler)(ThreadVars *, Packet *);
     void *(*OutHandlerCtxSetup)(char *);
     void (*OutHandlerCtxFree)(void *);
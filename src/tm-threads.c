@@ -34,6 +34,7 @@
 #include "tm-queuehandlers.h"
 #include "tm-threads.h"
 #include "tmqh-packetpool.h"
+#include "tmqh-flow-ring.h"
 #include "threads.h"
 #include "util-debug.h"
 #include "util-privs.h"
@@ -1187,6 +1188,8 @@ ThreadVars *TmThreadCreate(const char *name, char *inq_name, char *inqh_name,
 
         tv->tmqh_in = tmqh->InHandler;
         tv->InShutdownHandler = tmqh->InShutdownHandler;
+        if (tmqh->InRegisterCounters != NULL && tv->inq != NULL)
+            tmqh->InRegisterCounters(tv);
         SCLogDebug("tv->tmqh_in %p", tv->tmqh_in);
     }
 
@@ -1463,7 +1466,7 @@ void TmThreadKillThread(ThreadVars *tv)
         if (!(strlen(tv->inq->name) == strlen("packetpool") &&
               strcasecmp(tv->inq->name, "packetpool") == 0)) {
             PacketQueue *q = &trans_q[tv->inq->id];
-            while (q->len != 0) {
+            while (q->len != 0 || !TmqhFlowRingQueueIsEmpty(tv->inq->id)) {
                 usleep(1000);
             }
         }
@@ -1574,7 +1577,7 @@ again:
                 if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                       strcasecmp(tv->inq->name, "packetpool") == 0)) {
                     PacketQueue *q = &trans_q[tv->inq->id];
-                    if (q->len != 0) {
+                    if (q->len != 0 || !TmqhFlowRingQueueIsEmpty(tv->inq->id)) {
                         SCMutexUnlock(&tv_root_lock);
                         /* don't sleep while holding a lock */
                         usleep(1000);
@@ -1653,7 +1656,7 @@ again:
             if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                         strcasecmp(tv->inq->name, "packetpool") == 0)) {
                 PacketQueue *q = &trans_q[tv->inq->id];
-                if (q->len != 0) {
+                if (q->len != 0 || !TmqhFlowRingQueueIsEmpty(tv->inq->id)) {
                     SCMutexUnlock(&tv_root_lock);
                     /* don't sleep while holding a lock */
                     usleep(1000);
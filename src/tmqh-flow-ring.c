@@ -0,0 +1,540 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Lock free variant of the 'flow' queue handler.
+ *
+ * Output queues are picked the same way as the 'flow' handler does, but
+ * packets are handed over through lock free rings instead of the mutex
+ * protected trans_q packet queues. Every writer thread gets its own single
+ * producer/single consumer ring per output queue, so a queue with N
+ * capture threads feeding it is read through N rings. The reader drains
+ * the rings in batches into a small local stash.
+ *
+ * The reader spins for a while when all rings are empty. The spin time
+ * adapts: it grows when spinning finds packets and shrinks when it ends
+ * up sleeping anyway. Sleeping is done on the trans_q condition, and a
+ * writer only takes the trans_q mutex to signal it if the reader has
+ * announced it's going to sleep.
+ *
+ * The trans_q packet queue itself is still checked by the reader, as
+ * the flow manager and the detect engine reload inject pseudo packets
+ * into it directly.
+ */
+
+#include "suricata.h"
+#include "packet-queue.h"
+#include "decode.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "flow.h"
+#include "flow-hash.h"
+
+#include "tm-queuehandlers.h"
+#include "tm-queues.h"
+#include "tmqh-flow.h"
+#include "tmqh-flow-ring.h"
+
+#include "util-spsc-ring.h"
+#include "util-atomic.h"
+#include "util-optimize.h"
+#include "util-unittest.h"
+
+/** max number of threads writing into a single queue */
+#define TMQH_FLOW_RING_MAX_WRITERS  64
+/** max packets the reader takes out of the rings in one go */
+#define TMQH_FLOW_RING_BATCH        32
+/** limits for the adaptive spin before the reader goes to sleep */
+#define TMQH_FLOW_RING_SPIN_MIN     64
+#define TMQH_FLOW_RING_SPIN_MAX     8192
+
+#if defined(__i386__) || defined(__x86_64__)
+#define TMQH_FLOW_RING_PAUSE() __asm__ __volatile__("pause" : : : "memory")
+#else
+#define TMQH_FLOW_RING_PAUSE() cc_barrier()
+#endif
+
+/** \brief reader side state of a queue */
+typedef struct TmqhFlowRingQueue_ {
+    uint16_t id;                    /**< trans_q id */
+
+    /** number of writer rings in 'rings'. Updated after the ring is
+     *  stored, so the reader only sees fully set up rings. */
+    SC_ATOMIC_DECLARE(uint32_t, rings_cnt);
+    SpscRing *rings[TMQH_FLOW_RING_MAX_WRITERS];
+
+    /** set by the reader when it's about to wait on the queue cond */
+    SC_ATOMIC_DECLARE(int, sleeping);
+
+    /* reader only */
+    uint32_t next_ring;             /**< ring to start the next refill at */
+    uint32_t spin_limit;            /**< current adaptive spin count */
+    uint32_t stash_idx;
+    uint32_t stash_cnt;
+    Packet *stash[TMQH_FLOW_RING_BATCH];
+} __attribute__((aligned(CLS))) TmqhFlowRingQueue;
+
+/** \brief writer side ctx, one per writer thread */
+typedef struct TmqhFlowRingCtx_ {
+    TmqhFlowCtx *fctx;              /**< queue list and scheduler state */
+    TmqhFlowRingQueue **rqs;        /**< reader state per output queue */
+    SpscRing **rings;               /**< our ring per output queue */
+} TmqhFlowRingCtx;
+
+static TmqhFlowRingQueue *ring_queues[256];
+static SCMutex ring_queues_lock = SCMUTEX_INITIALIZER;
+
+extern intmax_t max_pending_packets;
+
+Packet *TmqhInputFlowRing(ThreadVars *tv);
+void TmqhInputFlowRingShutdownHandler(ThreadVars *tv);
+void TmqhOutputFlowRing(ThreadVars *tv, Packet *p);
+void *TmqhOutputFlowRingSetupCtx(char *queue_str);
+void TmqhOutputFlowRingFreeCtx(void *ctx);
+
+void TmqhFlowRingRegister(void)
+{
+    tmqh_table[TMQH_FLOW_RING].name = "flow-ring";
+    tmqh_table[TMQH_FLOW_RING].InHandler = TmqhInputFlowRing;
+    tmqh_table[TMQH_FLOW_RING].InShutdownHandler = TmqhInputFlowRingShutdownHandler;
+    tmqh_table[TMQH_FLOW_RING].InRegisterCounters = TmqhInputFlowRegisterCounters;
+    tmqh_table[TMQH_FLOW_RING].OutHandler = TmqhOutputFlowRing;
+    tmqh_table[TMQH_FLOW_RING].OutHandlerCtxSetup = TmqhOutputFlowRingSetupCtx;
+    tmqh_table[TMQH_FLOW_RING].OutHandlerCtxFree = TmqhOutputFlowRingFreeCtx;
+    tmqh_table[TMQH_FLOW_RING].RegisterTests = TmqhFlowRingRegisterTests;
+
+    memset(ring_queues, 0x00, sizeof(ring_queues));
+}
+
+/** \brief free the rings
+ *
+ *  Rings are shared between a writer and a reader thread, so they are
+ *  only freed here after all threads are gone. */
+void TmqhFlowRingDestroy(void)
+{
+    int i;
+    for (i = 0; i < 256; i++) {
+        TmqhFlowRingQueue *rq = ring_queues[i];
+        if (rq == NULL)
+            continue;
+
+        uint32_t u;
+        for (u = 0; u < SC_ATOMIC_GET(rq->rings_cnt); u++) {
+            SpscRingFree(rq->rings[u]);
+        }
+        SC_ATOMIC_DESTROY(rq->rings_cnt);
+        SC_ATOMIC_DESTROY(rq->sleeping);
+        SCFreeAligned(rq);
+        ring_queues[i] = NULL;
+    }
+}
+
+static TmqhFlowRingQueue *TmqhFlowRingQueueGet(uint16_t id)
+{
+    TmqhFlowRingQueue *rq = ring_queues[id];
+    if (rq != NULL)
+        return rq;
+
+    rq = SCMallocAligned(sizeof(TmqhFlowRingQueue), CLS);
+    if (unlikely(rq == NULL))
+        return NULL;
+    memset(rq, 0x00, sizeof(TmqhFlowRingQueue));
+    rq->id = id;
+    rq->spin_limit = TMQH_FLOW_RING_SPIN_MIN;
+    SC_ATOMIC_INIT(rq->rings_cnt);
+    SC_ATOMIC_INIT(rq->sleeping);
+
+    ring_queues[id] = rq;
+    return rq;
+}
+
+/** \brief check if a queue has no packets left in its rings
+ *
+ *  Used by the thread shutdown code to wait for queues to drain.
+ *
+ *  \retval 1 empty or queue not handled by us
+ *  \retval 0 not empty */
+int TmqhFlowRingQueueIsEmpty(uint16_t qid)
+{
+    TmqhFlowRingQueue *rq = ring_queues[qid];
+    if (rq == NULL)
+        return 1;
+
+    cc_barrier();
+    if (rq->stash_idx < rq->stash_cnt)
+        return 0;
+
+    uint32_t u;
+    for (u = 0; u < SC_ATOMIC_GET(rq->rings_cnt); u++) {
+        if (SpscRingCount(rq->rings[u]) > 0)
+            return 0;
+    }
+    return 1;
+}
+
+/** \brief get the number of packets waiting in a queue's rings
+ *
+ *  Used by the autofp schedulers to estimate a queue's load. Lockless,
+ *  so the result is only a snapshot.
+ *
+ *  \retval cnt packets in rings and stash, 0 if not handled by us */
+uint32_t TmqhFlowRingQueueLen(uint16_t qid)
+{
+    TmqhFlowRingQueue *rq = ring_queues[qid];
+    if (rq == NULL)
+        return 0;
+
+    cc_barrier();
+    uint32_t cnt = 0;
+    if (rq->stash_idx < rq->stash_cnt)
+        cnt = rq->stash_cnt - rq->stash_idx;
+
+    uint32_t u;
+    for (u = 0; u < SC_ATOMIC_GET(rq->rings_cnt); u++) {
+        cnt += SpscRingCount(rq->rings[u]);
+    }
+    return cnt;
+}
+
+/** \internal
+ *  \brief fill the reader's stash from the writer rings
+ *
+ *  Rings are visited round robin, starting at a different ring every
+ *  time so a busy writer can't starve the others.
+ *
+ *  \retval cnt number of packets in the stash */
+static uint32_t TmqhFlowRingRefill(TmqhFlowRingQueue *rq)
+{
+    const uint32_t rings_cnt = SC_ATOMIC_GET(rq->rings_cnt);
+    uint32_t cnt = 0;
+    uint32_t u;
+
+    cc_barrier();
+    for (u = 0; u < rings_cnt && cnt < TMQH_FLOW_RING_BATCH; u++) {
+        uint32_t r = (rq->next_ring + u) % rings_cnt;
+        cnt += SpscRingGetBatch(rq->rings[r], (void **)&rq->stash[cnt],
+                TMQH_FLOW_RING_BATCH - cnt);
+    }
+    if (rings_cnt > 0)
+        rq->next_ring = (rq->next_ring + 1) % rings_cnt;
+
+    /* the worker will look up the flows of these packets one by one,
+     * get the hash buckets of the whole batch in flight now */
+    FlowPrefetchBuckets(rq->stash, cnt);
+
+    rq->stash_idx = 0;
+    rq->stash_cnt = cnt;
+    return cnt;
+}
+
+/** \internal
+ *  \brief get a packet that was injected directly into the trans_q */
+static inline Packet *TmqhFlowRingGetInjected(PacketQueue *q)
+{
+    Packet *p = NULL;
+
+    if (q->len > 0) {
+        SCMutexLock(&q->mutex_q);
+        p = PacketDequeue(q);
+        SCMutexUnlock(&q->mutex_q);
+    }
+    return p;
+}
+
+Packet *TmqhInputFlowRing(ThreadVars *tv)
+{
+    TmqhFlowRingQueue *rq = ring_queues[tv->inq->id];
+    PacketQueue *q = &trans_q[tv->inq->id];
+    Packet *p;
+
+    TmqhFlowUpdateCounters(tv);
+    StatsSyncCountersIfSignalled(tv);
+
+    if (unlikely(rq == NULL)) {
+        /* we're running before any of our writers was set up */
+        SCMutexLock(&ring_queues_lock);
+        rq = TmqhFlowRingQueueGet(tv->inq->id);
+        SCMutexUnlock(&ring_queues_lock);
+        if (rq == NULL)
+            return NULL;
+    }
+
+    if (rq->stash_idx < rq->stash_cnt)
+        return rq->stash[rq->stash_idx++];
+
+    uint32_t spins;
+    for (spins = 0; spins < rq->spin_limit; spins++) {
+        if ((p = TmqhFlowRingGetInjected(q)) != NULL)
+            return p;
+        if (TmqhFlowRingRefill(rq) > 0) {
+            /* spinning paid off, allow for longer spins */
+            if (spins > 0 && rq->spin_limit < TMQH_FLOW_RING_SPIN_MAX)
+                rq->spin_limit <<= 1;
+            return rq->stash[rq->stash_idx++];
+        }
+        TMQH_FLOW_RING_PAUSE();
+    }
+
+    /* nothing after spinning, so go to sleep. The sleeping flag is set
+     * before the last check for packets, so a writer either sees the
+     * flag or we see its packet. */
+    if (rq->spin_limit > TMQH_FLOW_RING_SPIN_MIN)
+        rq->spin_limit >>= 1;
+
+    SCMutexLock(&q->mutex_q);
+    (void)SC_ATOMIC_SET(rq->sleeping, 1);
+    if (q->len == 0 && TmqhFlowRingRefill(rq) == 0) {
+        SCCondWait(&q->cond_q, &q->mutex_q);
+    }
+    (void)SC_ATOMIC_SET(rq->sleeping, 0);
+    SCMutexUnlock(&q->mutex_q);
+
+    if ((p = TmqhFlowRingGetInjected(q)) != NULL)
+        return p;
+    if (rq->stash_idx < rq->stash_cnt || TmqhFlowRingRefill(rq) > 0)
+        return rq->stash[rq->stash_idx++];
+
+    /* return NULL if we have no pkt. Should only happen on signals. */
+    return NULL;
+}
+
+void TmqhInputFlowRingShutdownHandler(ThreadVars *tv)
+{
+    if (tv == NULL || tv->inq == NULL) {
+        return;
+    }
+
+    PacketQueue *q = &trans_q[tv->inq->id];
+    SCMutexLock(&q->mutex_q);
+    SCCondSignal(&q->cond_q);
+    SCMutexUnlock(&q->mutex_q);
+}
+
+static inline void TmqhFlowRingWakeup(TmqhFlowRingQueue *rq)
+{
+    PacketQueue *q = &trans_q[rq->id];
+    SCMutexLock(&q->mutex_q);
+    SCCondSignal(&q->cond_q);
+    SCMutexUnlock(&q->mutex_q);
+}
+
+void TmqhOutputFlowRing(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowRingCtx *ctx = (TmqhFlowRingCtx *)tv->outctx;
+    uint16_t qid = TmqhFlowGetQueueId(ctx->fctx, p);
+    TmqhFlowRingQueue *rq = ctx->rqs[qid];
+
+    /* the ring is sized to hold all our packets, so it should only be
+     * full if packets are also coming from somewhere else */
+    while (SpscRingPut(ctx->rings[qid], p) == 0) {
+        TmqhFlowRingWakeup(rq);
+        usleep(1);
+    }
+
+    /* put is a full barrier, so this read can't move before it */
+    if (SC_ATOMIC_GET(rq->sleeping)) {
+        TmqhFlowRingWakeup(rq);
+    }
+}
+
+/**
+ * \brief setup the queue handlers ctx
+ *
+ * Sets up the same ctx as the 'flow' handler, then creates a ring for
+ * each of the output queues and registers it with the reader side.
+ *
+ * \param queue_str comma separated string with output queue names
+ *
+ * \retval ctx queues handlers ctx or NULL in error
+ */
+void *TmqhOutputFlowRingSetupCtx(char *queue_str)
+{
+    TmqhFlowRingCtx *ctx = SCMalloc(sizeof(TmqhFlowRingCtx));
+    if (unlikely(ctx == NULL))
+        return NULL;
+    memset(ctx, 0x00, sizeof(TmqhFlowRingCtx));
+
+    ctx->fctx = TmqhOutputFlowSetupCtx(queue_str);
+    if (ctx->fctx == NULL)
+        goto error;
+
+    ctx->rqs = SCCalloc(ctx->fctx->size, sizeof(TmqhFlowRingQueue *));
+    ctx->rings = SCCalloc(ctx->fctx->size, sizeof(SpscRing *));
+    if (ctx->rqs == NULL || ctx->rings == NULL)
+        goto error;
+
+    /* a writer can't have more packets in flight than its packet pool
+     * holds, so a ring of that size never fills up */
+    uint32_t ring_size = (uint32_t)max_pending_packets;
+    if (ring_size < TMQH_FLOW_RING_BATCH)
+        ring_size = TMQH_FLOW_RING_BATCH;
+
+    SCMutexLock(&ring_queues_lock);
+    uint16_t i;
+    for (i = 0; i < ctx->fctx->size; i++) {
+        uint16_t id = (uint16_t)(ctx->fctx->queues[i].q - trans_q);
+
+        TmqhFlowRingQueue *rq = TmqhFlowRingQueueGet(id);
+        if (rq == NULL) {
+            SCMutexUnlock(&ring_queues_lock);
+            goto error;
+        }
+
+        uint32_t cnt = SC_ATOMIC_GET(rq->rings_cnt);
+        if (cnt == TMQH_FLOW_RING_MAX_WRITERS) {
+            SCLogError(SC_ERR_INVALID_ARGUMENTS, "too many writers for "
+                    "queue %u, max is %d", id, TMQH_FLOW_RING_MAX_WRITERS);
+            SCMutexUnlock(&ring_queues_lock);
+            goto error;
+        }
+
+        SpscRing *ring = SpscRingInit(ring_size);
+        if (ring == NULL) {
+            SCMutexUnlock(&ring_queues_lock);
+            goto error;
+        }
+        rq->rings[cnt] = ring;
+        /* publish: atomic add is a full barrier */
+        (void)SC_ATOMIC_ADD(rq->rings_cnt, 1);
+
+        ctx->rqs[i] = rq;
+        ctx->rings[i] = ring;
+    }
+    SCMutexUnlock(&ring_queues_lock);
+
+    return (void *)ctx;
+
+error:
+    /* rings that were registered are owned by the queues now */
+    if (ctx->fctx != NULL)
+        TmqhOutputFlowFreeCtx(ctx->fctx);
+    if (ctx->rqs != NULL)
+        SCFree(ctx->rqs);
+    if (ctx->rings != NULL)
+        SCFree(ctx->rings);
+    SCFree(ctx);
+    return NULL;
+}
+
+void TmqhOutputFlowRingFreeCtx(void *ctx)
+{
+    TmqhFlowRingCtx *rctx = (TmqhFlowRingCtx *)ctx;
+
+    TmqhOutputFlowFreeCtx(rctx->fctx);
+    SCFree(rctx->rqs);
+    SCFree(rctx->rings);
+    SCFree(rctx);
+}
+
+#ifdef UNITTESTS
+
+/** \test two writers feeding two queues */
+static int TmqhFlowRingTest01(void)
+{
+    TmqResetQueues();
+    TmqhFlowRingDestroy();
+
+    FAIL_IF_NULL(TmqCreateQueue("queue1"));
+    FAIL_IF_NULL(TmqCreateQueue("queue2"));
+
+    TmqhFlowRingCtx *ctx1 = TmqhOutputFlowRingSetupCtx("queue1,queue2");
+    FAIL_IF_NULL(ctx1);
+    TmqhFlowRingCtx *ctx2 = TmqhOutputFlowRingSetupCtx("queue1,queue2");
+    FAIL_IF_NULL(ctx2);
+
+    FAIL_IF(ctx1->fctx->size != 2);
+    FAIL_IF(ctx1->rqs[0] != ring_queues[0]);
+    FAIL_IF(ctx1->rqs[1] != ring_queues[1]);
+    FAIL_IF(ctx2->rqs[0] != ring_queues[0]);
+    FAIL_IF(SC_ATOMIC_GET(ring_queues[0]->rings_cnt) != 2);
+    FAIL_IF(SC_ATOMIC_GET(ring_queues[1]->rings_cnt) != 2);
+    FAIL_IF(ring_queues[0]->rings[0] != ctx1->rings[0]);
+    FAIL_IF(ring_queues[0]->rings[1] != ctx2->rings[0]);
+
+    FAIL_IF(!TmqhFlowRingQueueIsEmpty(0));
+
+    TmqhOutputFlowRingFreeCtx(ctx1);
+    TmqhOutputFlowRingFreeCtx(ctx2);
+    TmqhFlowRingDestroy();
+    TmqResetQueues();
+    PASS;
+}
+
+/** \test packets from multiple writers come out of a single queue */
+static int TmqhFlowRingTest02(void)
+{
+    ThreadVars w1, w2, r;
+    Tmq *tmq;
+    Packet *p1 = PacketGetFromAlloc();
+    Packet *p2 = PacketGetFromAlloc();
+    Packet *p3 = PacketGetFromAlloc();
+    FAIL_IF(p1 == NULL || p2 == NULL || p3 == NULL);
+
+    TmqResetQueues();
+    TmqhFlowRingDestroy();
+
+    memset(&w1, 0x00, sizeof(w1));
+    memset(&w2, 0x00, sizeof(w2));
+    memset(&r, 0x00, sizeof(r));
+
+    tmq = TmqCreateQueue("queue1");
+    FAIL_IF_NULL(tmq);
+    r.inq = tmq;
+
+    w1.outctx = TmqhOutputFlowRingSetupCtx("queue1");
+    FAIL_IF_NULL(w1.outctx);
+    w2.outctx = TmqhOutputFlowRingSetupCtx("queue1");
+    FAIL_IF_NULL(w2.outctx);
+
+    TmqhOutputFlowRing(&w1, p1);
+    TmqhOutputFlowRing(&w2, p2);
+    TmqhOutputFlowRing(&w1, p3);
+    FAIL_IF(TmqhFlowRingQueueIsEmpty(tmq->id));
+
+    /* one refill takes all packets from both rings */
+    Packet *a = TmqhInputFlowRing(&r);
+    FAIL_IF(a == NULL);
+    FAIL_IF(ring_queues[tmq->id]->stash_cnt != 3);
+    Packet *b = TmqhInputFlowRing(&r);
+    Packet *c = TmqhInputFlowRing(&r);
+    FAIL_IF(b == NULL || c == NULL);
+    FAIL_IF(a == b || b == c || a == c);
+    /* order of the packets of a single writer is kept */
+    FAIL_IF(c == p1 || a == p3);
+    FAIL_IF(!TmqhFlowRingQueueIsEmpty(tmq->id));
+
+    TmqhOutputFlowRingFreeCtx(w1.outctx);
+    TmqhOutputFlowRingFreeCtx(w2.outctx);
+    TmqhFlowRingDestroy();
+    TmqResetQueues();
+    PacketFree(p1);
+    PacketFree(p2);
+    PacketFree(p3);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void TmqhFlowRingRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("TmqhFlowRingTest01", TmqhFlowRingTest01);
+    UtRegisterTest("TmqhFlowRingTest02", TmqhFlowRingTest02);
+#endif /* UNITTESTS */
+}
@@ -33,39 +33,78 @@
 #include "threads.h"
 #include "threadvars.h"
 #include "tmqh-flow.h"
+#include "tmqh-flow-ring.h"
 
 #include "tm-queuehandlers.h"
 
 #include "conf.h"
+#include "util-atomic.h"
 #include "util-unittest.h"
 
+/** size of the flow pinning table, must be a power of 2 */
+#define TMQH_FLOW_PIN_TABLE_SIZE    262144
+/** a pinned flow that was idle for this many seconds may be moved */
+#define TMQH_FLOW_PIN_TIMEOUT       60
+
+typedef uint16_t (*TmqhFlowSchedulerFunc)(TmqhFlowCtx *, const Packet *);
+
+/** \brief per queue load stats, updated by the writers and exported by
+ *         the reader through its counters */
+typedef struct TmqhFlowQueueStats_ {
+    SC_ATOMIC_DECLARE(uint64_t, new_flows);
+
+    /* reader's counter ids */
+    uint16_t counter_new_flows;
+    uint16_t counter_backlog;
+    uint16_t counter_imbalance;
+} TmqhFlowQueueStats;
+
+/** flow pinning table. Maps the flow hash to the queue a flow was placed
+ *  on by the load aware schedulers. The flow itself is only looked up by
+ *  the worker, so the assignment can't be stored in the Flow here.
+ *
+ *  Each entry holds the ctx queue index + 1 in the low 16 bits and the
+ *  timestamp (seconds) of the last packet in the upper 32 bits. */
+static uint64_t *flow_pin_table = NULL;
+
+static TmqhFlowQueueStats flow_queue_stats[256];
+
+static TmqhFlowSchedulerFunc TmqhFlowScheduler = NULL;
+
 Packet *TmqhInputFlow(ThreadVars *t);
-void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
-void TmqhOutputFlowIPPair(ThreadVars *t, Packet *p);
-void *TmqhOutputFlowSetupCtx(char *queue_str);
-void TmqhOutputFlowFreeCtx(void *ctx);
+void TmqhOutputFlow(ThreadVars *t, Packet *p);
+void TmqhInputFlowRegisterCounters(ThreadVars *tv);
+static uint16_t TmqhFlowSchedulerHash(TmqhFlowCtx *ctx, const Packet *p);
+static uint16_t TmqhFlowSchedulerIPPair(TmqhFlowCtx *ctx, const Packet *p);
+static uint16_t TmqhFlowSchedulerRoundRobin(TmqhFlowCtx *ctx, const Packet *p);
+static uint16_t TmqhFlowSchedulerActivePackets(TmqhFlowCtx *ctx, const Packet *p);
 void TmqhFlowRegisterTests(void);
 
 void TmqhFlowRegister(void)
 {
     tmqh_table[TMQH_FLOW].name = "flow";
     tmqh_table[TMQH_FLOW].InHandler = TmqhInputFlow;
+    tmqh_table[TMQH_FLOW].InRegisterCounters = TmqhInputFlowRegisterCounters;
+    tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlow;
     tmqh_table[TMQH_FLOW].OutHandlerCtxSetup = TmqhOutputFlowSetupCtx;
     tmqh_table[TMQH_FLOW].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
     tmqh_table[TMQH_FLOW].RegisterTests = TmqhFlowRegisterTests;
 
+    int i;
+    for (i = 0; i < 256; i++) {
+        SC_ATOMIC_INIT(flow_queue_stats[i].new_flows);
+    }
+
     char *scheduler = NULL;
     if (ConfGet("autofp-scheduler", &scheduler) == 1) {
         if (strcasecmp(scheduler, "round-robin") == 0) {
-            SCLogNotice("using flow hash instead of round robin");
-            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
+            TmqhFlowScheduler = TmqhFlowSchedulerRoundRobin;
         } else if (strcasecmp(scheduler, "active-packets") == 0) {
-            SCLogNotice("using flow hash instead of active packets");
-            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
+            TmqhFlowScheduler = TmqhFlowSchedulerActivePackets;
         } else if (strcasecmp(scheduler, "hash") == 0) {
-            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
+            TmqhFlowScheduler = TmqhFlowSchedulerHash;
         } else if (strcasecmp(scheduler, "ippair") == 0) {
-            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowIPPair;
+            TmqhFlowScheduler = TmqhFlowSchedulerIPPair;
         } else {
             SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
                        "for autofp-scheduler in conf.  Killing engine.",
@@ -73,29 +112,103 @@ void TmqhFlowRegister(void)
             exit(EXIT_FAILURE);
         }
     } else {
-        tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
+        TmqhFlowScheduler = TmqhFlowSchedulerHash;
+    }
+
+    if (TmqhFlowScheduler == TmqhFlowSchedulerRoundRobin ||
+        TmqhFlowScheduler == TmqhFlowSchedulerActivePackets)
+    {
+        flow_pin_table = SCCalloc(TMQH_FLOW_PIN_TABLE_SIZE, sizeof(uint64_t));
+        if (unlikely(flow_pin_table == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc autofp flow "
+                       "pinning table. Killing engine.");
+            exit(EXIT_FAILURE);
+        }
     }
 
     return;
 }
 
+/** \brief free the flow pinning table */
+void TmqhFlowCleanup(void)
+{
+    if (flow_pin_table != NULL) {
+        SCFree(flow_pin_table);
+        flow_pin_table = NULL;
+    }
+}
+
 void TmqhFlowPrintAutofpHandler(void)
 {
 #define PRINT_IF_FUNC(f, msg)                       \
-    if (tmqh_table[TMQH_FLOW].OutHandler == (f))    \
+    if (TmqhFlowScheduler == (f))                   \
         SCLogConfig("AutoFP mode using \"%s\" flow load balancer", (msg))
 
-    PRINT_IF_FUNC(TmqhOutputFlowHash, "Hash");
-    PRINT_IF_FUNC(TmqhOutputFlowIPPair, "IPPair");
+    PRINT_IF_FUNC(TmqhFlowSchedulerHash, "Hash");
+    PRINT_IF_FUNC(TmqhFlowSchedulerIPPair, "IPPair");
+    PRINT_IF_FUNC(TmqhFlowSchedulerRoundRobin, "Round Robin");
+    PRINT_IF_FUNC(TmqhFlowSchedulerActivePackets, "Active Packets");
 
 #undef PRINT_IF_FUNC
 }
 
+/** \brief get the number of packets waiting in a queue
+ *
+ *  Read without locks, so only an estimate. */
+static inline uint32_t TmqhFlowQueueBacklog(uint16_t id)
+{
+    return trans_q[id].len + TmqhFlowRingQueueLen(id);
+}
+
+/** \brief register the counters of the reader of an autofp queue
+ *
+ *  Called at thread creation, as the counters live in the queue's
+ *  reader thread. */
+void TmqhInputFlowRegisterCounters(ThreadVars *tv)
+{
+    TmqhFlowQueueStats *qs = &flow_queue_stats[tv->inq->id];
+
+    qs->counter_new_flows = StatsRegisterCounter("autofp.new_flows", tv);
+    qs->counter_backlog = StatsRegisterCounter("autofp.backlog", tv);
+    qs->counter_imbalance = StatsRegisterCounter("autofp.imbalance", tv);
+}
+
+/** \brief update the reader's autofp counters
+ *
+ *  Only does work if the stats thread asked for a sync. The imbalance is
+ *  how many packets this queue is behind the least loaded autofp queue.
+ */
+void TmqhFlowUpdateCounters(ThreadVars *tv)
+{
+    if (tv->perf_public_ctx.perf_flag != 1)
+        return;
+
+    TmqhFlowQueueStats *qs = &flow_queue_stats[tv->inq->id];
+    if (qs->counter_new_flows == 0)
+        return;
+
+    uint32_t backlog = TmqhFlowQueueBacklog(tv->inq->id);
+    uint32_t min_backlog = backlog;
+    int i;
+    for (i = 0; i < 256; i++) {
+        if (flow_queue_stats[i].counter_new_flows == 0)
+            continue;
+        uint32_t b = TmqhFlowQueueBacklog((uint16_t)i);
+        if (b < min_backlog)
+            min_backlog = b;
+    }
+
+    StatsSetUI64(tv, qs->counter_new_flows, SC_ATOMIC_GET(qs->new_flows));
+    StatsSetUI64(tv, qs->counter_backlog, backlog);
+    StatsSetUI64(tv, qs->counter_imbalance, backlog - min_backlog);
+}
+
 /* same as 'simple' */
 Packet *TmqhInputFlow(ThreadVars *tv)
 {
     PacketQueue *q = &trans_q[tv->inq->id];
 
+    TmqhFlowUpdateCounters(tv);
     StatsSyncCountersIfSignalled(tv);
 
     SCMutexLock(&q->mutex_q);
@@ -220,11 +333,13 @@ void TmqhOutputFlowFreeCtx(void *ctx)
     return;
 }
 
-void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
+/** \internal
+ *  \brief get the output queue for a packet based on its flow hash
+ *
+ *  Packets without a flow are spread round robin. */
+static uint16_t TmqhFlowSchedulerHash(TmqhFlowCtx *ctx, const Packet *p)
 {
-    int16_t qid = 0;
-
-    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    uint16_t qid;
 
     if (p->flags & PKT_WANTS_FLOW) {
         uint32_t hash = p->flow_hash;
@@ -235,30 +350,18 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
         if (ctx->last == ctx->size)
             ctx->last = 0;
     }
-
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
-
-    return;
+    return qid;
 }
 
 /**
+ * \internal
  * \brief select the queue to output based on IP address pair.
- *
- * \param tv thread vars.
- * \param p packet.
  */
-void TmqhOutputFlowIPPair(ThreadVars *tv, Packet *p)
+static uint16_t TmqhFlowSchedulerIPPair(TmqhFlowCtx *ctx, const Packet *p)
 {
-    int16_t qid = 0;
     uint32_t addr_hash = 0;
     int i;
 
-    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
-
     if (p->src.family == AF_INET6) {
         for (i = 0; i < 4; i++) {
             addr_hash += p->src.addr_data32[i] + p->dst.addr_data32[i];
@@ -269,7 +372,113 @@ void TmqhOutputFlowIPPair(ThreadVars *tv, Packet *p)
 
     /* we don't have to worry about possible overflow, since
      * ctx->size will be lesser than 2 ** 31 for sure */
-    qid = addr_hash % ctx->size;
+    return addr_hash % ctx->size;
+}
+
+/** \internal
+ *  \brief pick the next queue round robin */
+static uint16_t TmqhFlowPickRoundRobin(TmqhFlowCtx *ctx)
+{
+    uint16_t qid = ctx->last++;
+
+    if (ctx->last == ctx->size)
+        ctx->last = 0;
+    return qid;
+}
+
+/** \internal
+ *  \brief pick the queue with the lowest number of waiting packets
+ *
+ *  The scan starts after the last picked queue, so idle queues with an
+ *  equal backlog get new flows in turn. */
+static uint16_t TmqhFlowPickLeastLoaded(TmqhFlowCtx *ctx)
+{
+    uint16_t qid = ctx->last;
+    uint32_t min_backlog = UINT32_MAX;
+    uint16_t i;
+
+    for (i = 0; i < ctx->size; i++) {
+        uint16_t q = (ctx->last + i) % ctx->size;
+        uint32_t backlog = TmqhFlowQueueBacklog(ctx->queues[q].q - trans_q);
+        if (backlog < min_backlog) {
+            min_backlog = backlog;
+            qid = q;
+            if (backlog == 0)
+                break;
+        }
+    }
+
+    ctx->last = (qid + 1) % ctx->size;
+    return qid;
+}
+
+/** \internal
+ *  \brief get the queue a flow is pinned to, or pin it to a new one
+ *
+ *  A flow stays on its queue as long as it sees packets, so packet order
+ *  within a flow is kept. Only after it was idle for
+ *  TMQH_FLOW_PIN_TIMEOUT seconds it can be placed again.
+ *
+ *  Multiple writers can race for the same entry. The entry is updated
+ *  with CAS and the loser uses the winner's queue.
+ */
+static uint16_t TmqhFlowPinGetQueueId(TmqhFlowCtx *ctx, const Packet *p,
+        uint16_t (*Pick)(TmqhFlowCtx *))
+{
+    if (!(p->flags & PKT_WANTS_FLOW))
+        return TmqhFlowPickRoundRobin(ctx);
+
+    uint64_t *e = &flow_pin_table[p->flow_hash & (TMQH_FLOW_PIN_TABLE_SIZE - 1)];
+    const uint32_t now = (uint32_t)p->ts.tv_sec;
+    uint64_t old = *(volatile uint64_t *)e;
+    uint16_t qid1 = (uint16_t)(old & 0xffff);
+    uint32_t last = (uint32_t)(old >> 32);
+
+    if (qid1 != 0 && qid1 <= ctx->size &&
+            (now <= last || now - last < TMQH_FLOW_PIN_TIMEOUT))
+    {
+        /* refresh once a second at most, losing the race is fine */
+        if (now > last) {
+            (void)SCAtomicCompareAndSwap(e, old, ((uint64_t)now << 32) | qid1);
+        }
+        return qid1 - 1;
+    }
+
+    uint16_t qid = Pick(ctx);
+    if (!(SCAtomicCompareAndSwap(e, old, ((uint64_t)now << 32) | (qid + 1)))) {
+        old = *(volatile uint64_t *)e;
+        qid1 = (uint16_t)(old & 0xffff);
+        if (qid1 != 0 && qid1 <= ctx->size)
+            return qid1 - 1;
+    }
+
+    (void)SC_ATOMIC_ADD(flow_queue_stats[ctx->queues[qid].q - trans_q].new_flows, 1);
+    return qid;
+}
+
+static uint16_t TmqhFlowSchedulerRoundRobin(TmqhFlowCtx *ctx, const Packet *p)
+{
+    return TmqhFlowPinGetQueueId(ctx, p, TmqhFlowPickRoundRobin);
+}
+
+static uint16_t TmqhFlowSchedulerActivePackets(TmqhFlowCtx *ctx, const Packet *p)
+{
+    return TmqhFlowPinGetQueueId(ctx, p, TmqhFlowPickLeastLoaded);
+}
+
+/** \brief get the output queue for a packet using the configured
+ *         autofp scheduler
+ *
+ *  \retval qid index into ctx->queues */
+uint16_t TmqhFlowGetQueueId(TmqhFlowCtx *ctx, const Packet *p)
+{
+    return TmqhFlowScheduler(ctx, p);
+}
+
+void TmqhOutputFlow(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    uint16_t qid = TmqhFlowGetQueueId(ctx, p);
 
     PacketQueue *q = ctx->queues[qid].q;
     SCMutexLock(&q->mutex_q);
@@ -418,6 +627,89 @@ end:
     return retval;
 }
 
+/** \test active-packets: new flows go to the least loaded queue and stay
+ *        on their queue while it's busy */
+static int TmqhFlowSchedulerTest01(void)
+{
+    uint64_t *orig_table = flow_pin_table;
+    Packet p1, p2;
+
+    TmqResetQueues();
+    flow_pin_table = SCCalloc(TMQH_FLOW_PIN_TABLE_SIZE, sizeof(uint64_t));
+    FAIL_IF_NULL(flow_pin_table);
+
+    TmqhFlowCtx *fctx = TmqhOutputFlowSetupCtx("q1,q2,q3");
+    FAIL_IF_NULL(fctx);
+
+    /* queue 0 and 2 are busy */
+    trans_q[0].len = 10;
+    trans_q[2].len = 5;
+
+    memset(&p1, 0x00, sizeof(p1));
+    p1.flags = PKT_WANTS_FLOW;
+    p1.flow_hash = 1234;
+    p1.ts.tv_sec = 1000;
+    FAIL_IF(TmqhFlowSchedulerActivePackets(fctx, &p1) != 1);
+
+    /* now queue 1 is the busiest, but p1's flow stays */
+    trans_q[1].len = 20;
+    p1.ts.tv_sec = 1001;
+    FAIL_IF(TmqhFlowSchedulerActivePackets(fctx, &p1) != 1);
+
+    /* new flow goes to queue 2 */
+    memset(&p2, 0x00, sizeof(p2));
+    p2.flags = PKT_WANTS_FLOW;
+    p2.flow_hash = 5678;
+    p2.ts.tv_sec = 1001;
+    FAIL_IF(TmqhFlowSchedulerActivePackets(fctx, &p2) != 2);
+
+    /* after the idle timeout p1's flow can move */
+    p1.ts.tv_sec = 1001 + TMQH_FLOW_PIN_TIMEOUT;
+    FAIL_IF(TmqhFlowSchedulerActivePackets(fctx, &p1) != 2);
+
+    trans_q[0].len = trans_q[1].len = trans_q[2].len = 0;
+    TmqhOutputFlowFreeCtx(fctx);
+    SCFree(flow_pin_table);
+    flow_pin_table = orig_table;
+    TmqResetQueues();
+    PASS;
+}
+
+/** \test round-robin: new flows are spread, packets of a flow are pinned */
+static int TmqhFlowSchedulerTest02(void)
+{
+    uint64_t *orig_table = flow_pin_table;
+    Packet p;
+    uint16_t qids[4];
+    int i;
+
+    TmqResetQueues();
+    flow_pin_table = SCCalloc(TMQH_FLOW_PIN_TABLE_SIZE, sizeof(uint64_t));
+    FAIL_IF_NULL(flow_pin_table);
+
+    TmqhFlowCtx *fctx = TmqhOutputFlowSetupCtx("q1,q2,q3,q4");
+    FAIL_IF_NULL(fctx);
+
+    memset(&p, 0x00, sizeof(p));
+    p.flags = PKT_WANTS_FLOW;
+    p.ts.tv_sec = 1;
+    for (i = 0; i < 4; i++) {
+        p.flow_hash = i + 1;
+        qids[i] = TmqhFlowSchedulerRoundRobin(fctx, &p);
+        FAIL_IF(qids[i] != i);
+    }
+    for (i = 0; i < 4; i++) {
+        p.flow_hash = i + 1;
+        FAIL_IF(TmqhFlowSchedulerRoundRobin(fctx, &p) != qids[i]);
+    }
+
+    TmqhOutputFlowFreeCtx(fctx);
+    SCFree(flow_pin_table);
+    flow_pin_table = orig_table;
+    TmqResetQueues();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void TmqhFlowRegisterTests(void)
@@ -429,6 +721,8 @@ void TmqhFlowRegisterTests(void)
                    TmqhOutputFlowSetupCtxTest02);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest03",
                    TmqhOutputFlowSetupCtxTest03);
+    UtRegisterTest("TmqhFlowSchedulerTest01", TmqhFlowSchedulerTest01);
+    UtRegisterTest("TmqhFlowSchedulerTest02", TmqhFlowSchedulerTest02);
 #endif
 
     return;
@@ -39,8 +39,16 @@ typedef struct TmqhFlowCtx_ {
 } TmqhFlowCtx;
 
 void TmqhFlowRegister (void);
+void TmqhFlowCleanup(void);
 void TmqhFlowRegisterTests(void);
 
+uint16_t TmqhFlowGetQueueId(TmqhFlowCtx *ctx, const Packet *p);
+void TmqhInputFlowRegisterCounters(ThreadVars *tv);
+void TmqhFlowUpdateCounters(ThreadVars *tv);
+
+void *TmqhOutputFlowSetupCtx(char *queue_str);
+void TmqhOutputFlowFreeCtx(void *ctx);
+
 void TmqhFlowPrintAutofpHandler(void);
 
 #endif /* __TMQH_FLOW_H__ */
@@ -49,6 +49,7 @@
 #include "util-error.h"
 #include "util-profiling.h"
 #include "util-device.h"
+#include "util-unittest.h"
 
 /* Number of freed packet to save for one pool before freeing them. */
 #define MAX_PENDING_RETURN_PACKETS 32
@@ -139,21 +140,34 @@ void TmqhPacketpoolRegister (void)
 static int PacketPoolIsEmpty(PktPool *pool)
 {
     /* Check local stack first. */
-    if (pool->head || pool->return_stack.head)
+    if (pool->head || SC_ATOMIC_GET(pool->return_stack.head))
         return 0;
 
     return 1;
 }
 
+/** \internal
+ *  \brief sleep until another thread returned packets to our pool
+ *
+ *  Setting sync_now and the push to the return stack are both full
+ *  barriers, so either the returning thread sees sync_now and signals
+ *  us or we see its packets in the recheck.
+ */
+static void PacketPoolWaitForReturn(PktPool *my_pool)
+{
+    SCMutexLock(&my_pool->return_stack.mutex);
+    SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
+    if (SC_ATOMIC_GET(my_pool->return_stack.head) == NULL)
+        SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
+    SCMutexUnlock(&my_pool->return_stack.mutex);
+}
+
 void PacketPoolWait(void)
 {
     PktPool *my_pool = GetThreadPacketPool();
 
     if (PacketPoolIsEmpty(my_pool)) {
-        SCMutexLock(&my_pool->return_stack.mutex);
-        SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
-        SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
-        SCMutexUnlock(&my_pool->return_stack.mutex);
+        PacketPoolWaitForReturn(my_pool);
     }
 
     while(PacketPoolIsEmpty(my_pool))
@@ -188,25 +202,20 @@ void PacketPoolWaitForN(int n)
             p = p->next;
         }
 
-        /* continue counting in the return stack */
-        if (my_pool->return_stack.head != NULL) {
-            SCMutexLock(&my_pool->return_stack.mutex);
-            p = my_pool->return_stack.head;
+        /* continue counting in the return stack. Other threads only add
+         * to the head of the list, so we can walk it without locking. */
+        p = SC_ATOMIC_GET(my_pool->return_stack.head);
+        if (p != NULL) {
             while (p != NULL) {
                 if (++i == n) {
-                    SCMutexUnlock(&my_pool->return_stack.mutex);
                     return;
                 }
                 p = p->next;
             }
-            SCMutexUnlock(&my_pool->return_stack.mutex);
 
         /* or signal that we need packets and wait */
         } else {
-            SCMutexLock(&my_pool->return_stack.mutex);
-            SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
-            SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
-            SCMutexUnlock(&my_pool->return_stack.mutex);
+            PacketPoolWaitForReturn(my_pool);
         }
     }
 }
@@ -227,11 +236,17 @@ static void PacketPoolStorePacket(Packet *p)
 
 static void PacketPoolGetReturnedPackets(PktPool *pool)
 {
-    SCMutexLock(&pool->return_stack.mutex);
-    /* Move all the packets from the locked return stack to the local stack. */
-    pool->head = pool->return_stack.head;
-    pool->return_stack.head = NULL;
-    SCMutexUnlock(&pool->return_stack.mutex);
+    Packet *head;
+
+    /* Move all the packets from the return stack to the local stack. We're
+     * the only thread taking packets off the stack, so no ABA issue. */
+    do {
+        head = SC_ATOMIC_GET(pool->return_stack.head);
+        if (head == NULL)
+            break;
+    } while (SC_ATOMIC_CAS(&pool->return_stack.head, head, NULL) == 0);
+
+    pool->head = head;
 }
 
 /** \brief Get a new packet from the packet pool
@@ -257,8 +272,7 @@ Packet *PacketPoolGetPacket(void)
         return p;
     }
 
-    /* Local Stack is empty, so check the return stack, which requires
-     * locking. */
+    /* Local Stack is empty, so check the return stack. */
     PacketPoolGetReturnedPackets(pool);
 
     /* Try to allocate again. Need to check for not empty again, since the
@@ -278,6 +292,123 @@ Packet *PacketPoolGetPacket(void)
     return NULL;
 }
 
+/** \brief Get up to 'n' packets from the packet pool
+ *
+ *  Like PacketPoolGetPacket, but for capture methods that handle packets
+ *  in bursts. The return stack is checked at most once, and the call does
+ *  not wait for packets.
+ *
+ *  \param n max number of packets to get
+ *  \param out array of at least 'n' packet pointers
+ *
+ *  \retval cnt number of packets stored in 'out', can be less than 'n'
+ */
+uint32_t PacketPoolGetPackets(uint32_t n, Packet **out)
+{
+    PktPool *pool = GetThreadPacketPool();
+#ifdef DEBUG_VALIDATION
+    BUG_ON(pool->initialized == 0);
+    BUG_ON(pool->destroyed == 1);
+#endif /* DEBUG_VALIDATION */
+    int refilled = 0;
+    uint32_t cnt = 0;
+
+    while (cnt < n) {
+        Packet *p = pool->head;
+        if (p == NULL) {
+            if (refilled)
+                break;
+            PacketPoolGetReturnedPackets(pool);
+            refilled = 1;
+            continue;
+        }
+
+        pool->head = p->next;
+        p->pool = pool;
+        PACKET_REINIT(p);
+        out[cnt++] = p;
+    }
+
+    return cnt;
+}
+
+/** \internal
+ *  \brief push a list of packets onto the return stack of their pool
+ *
+ *  Wakes up the owner of the pool if it's waiting for packets.
+ */
+static void PacketPoolPushReturnStack(PktPool *pool, Packet *head, Packet *tail)
+{
+    Packet *old;
+
+    do {
+        old = SC_ATOMIC_GET(pool->return_stack.head);
+        tail->next = old;
+    } while (SC_ATOMIC_CAS(&pool->return_stack.head, old, head) == 0);
+
+    if (SC_ATOMIC_GET(pool->return_stack.sync_now)) {
+        SCMutexLock(&pool->return_stack.mutex);
+        SC_ATOMIC_RESET(pool->return_stack.sync_now);
+        SCCondSignal(&pool->return_stack.cond);
+        SCMutexUnlock(&pool->return_stack.mutex);
+    }
+}
+
+/** \internal
+ *  \brief return the pending list to its pool */
+static void PacketPoolFlushPending(PktPool *my_pool)
+{
+    PacketPoolPushReturnStack(my_pool->pending_pool,
+            my_pool->pending_head, my_pool->pending_tail);
+
+    /* Clear the list of pending packets to return. */
+    my_pool->pending_pool = NULL;
+    my_pool->pending_head = NULL;
+    my_pool->pending_tail = NULL;
+    my_pool->pending_count = 0;
+}
+
+/** \internal
+ *  \brief add a packet of another thread's pool to our pending list
+ *
+ *  \retval 1 packet added
+ *  \retval 0 pending list is in use for another pool
+ */
+static inline int PacketPoolAddPending(PktPool *my_pool, PktPool *pool, Packet *p)
+{
+    PktPool *pending_pool = my_pool->pending_pool;
+    if (pending_pool == NULL) {
+        /* No pending packet, so store the current packet. */
+        p->next = NULL;
+        my_pool->pending_pool = pool;
+        my_pool->pending_head = p;
+        my_pool->pending_tail = p;
+        my_pool->pending_count = 1;
+        return 1;
+    } else if (pending_pool == pool) {
+        /* Another packet for the pending pool list. */
+        p->next = my_pool->pending_head;
+        my_pool->pending_head = p;
+        my_pool->pending_count++;
+        return 1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief return the pending list if it is full or its owner needs
+ *         packets */
+static inline void PacketPoolCheckPending(PktPool *my_pool)
+{
+    PktPool *pool = my_pool->pending_pool;
+    if (pool != NULL &&
+        (SC_ATOMIC_GET(pool->return_stack.sync_now) ||
+         my_pool->pending_count > max_pending_return_packets))
+    {
+        PacketPoolFlushPending(my_pool);
+    }
+}
+
 /** \brief Return packet to Packet pool
  *
  */
@@ -303,44 +434,56 @@ void PacketPoolReturnPacket(Packet *p)
         /* Push back onto this thread's own stack, so no locking. */
         p->next = my_pool->head;
         my_pool->head = p;
+    } else if (PacketPoolAddPending(my_pool, pool, p)) {
+        if (my_pool->pending_count > 1)
+            PacketPoolCheckPending(my_pool);
     } else {
-        PktPool *pending_pool = my_pool->pending_pool;
-        if (pending_pool == NULL) {
-            /* No pending packet, so store the current packet. */
-            p->next = NULL;
-            my_pool->pending_pool = pool;
-            my_pool->pending_head = p;
-            my_pool->pending_tail = p;
-            my_pool->pending_count = 1;
-        } else if (pending_pool == pool) {
-            /* Another packet for the pending pool list. */
-            p->next = my_pool->pending_head;
-            my_pool->pending_head = p;
-            my_pool->pending_count++;
-            if (SC_ATOMIC_GET(pool->return_stack.sync_now) || my_pool->pending_count > max_pending_return_packets) {
-                /* Return the entire list of pending packets. */
-                SCMutexLock(&pool->return_stack.mutex);
-                my_pool->pending_tail->next = pool->return_stack.head;
-                pool->return_stack.head = my_pool->pending_head;
-                SC_ATOMIC_RESET(pool->return_stack.sync_now);
-                SCMutexUnlock(&pool->return_stack.mutex);
-                SCCondSignal(&pool->return_stack.cond);
-                /* Clear the list of pending packets to return. */
-                my_pool->pending_pool = NULL;
-                my_pool->pending_head = NULL;
-                my_pool->pending_tail = NULL;
-                my_pool->pending_count = 0;
-            }
-        } else {
-            /* Push onto return stack for this pool */
-            SCMutexLock(&pool->return_stack.mutex);
-            p->next = pool->return_stack.head;
-            pool->return_stack.head = p;
-            SC_ATOMIC_RESET(pool->return_stack.sync_now);
-            SCMutexUnlock(&pool->return_stack.mutex);
-            SCCondSignal(&pool->return_stack.cond);
+        /* Push onto return stack for this pool */
+        PacketPoolPushReturnStack(pool, p, p);
+    }
+}
+
+/** \brief Return a burst of packets to their Packet pools
+ *
+ *  Packets of other threads' pools are collected in the pending list,
+ *  so a burst going back to one pool costs a single push onto its
+ *  return stack.
+ *
+ *  \param pkts array of packets
+ *  \param n number of packets in the array
+ */
+void PacketPoolReturnPackets(Packet **pkts, uint32_t n)
+{
+    PktPool *my_pool = GetThreadPacketPool();
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        Packet *p = pkts[i];
+
+        PACKET_RELEASE_REFS(p);
+
+        PktPool *pool = p->pool;
+        if (pool == NULL) {
+            PacketFree(p);
+            continue;
+        }
+#ifdef DEBUG_VALIDATION
+        BUG_ON(pool->initialized == 0);
+        BUG_ON(pool->destroyed == 1);
+#endif /* DEBUG_VALIDATION */
+
+        if (pool == my_pool) {
+            p->next = my_pool->head;
+            my_pool->head = p;
+        } else if (PacketPoolAddPending(my_pool, pool, p) == 0) {
+            /* pending list holds another pool's packets, hand those
+             * back first */
+            PacketPoolFlushPending(my_pool);
+            (void)PacketPoolAddPending(my_pool, pool, p);
         }
     }
+
+    PacketPoolCheckPending(my_pool);
 }
 
 void PacketPoolInitEmpty(void)
@@ -360,6 +503,7 @@ void PacketPoolInitEmpty(void)
     SCMutexInit(&my_pool->return_stack.mutex, NULL);
     SCCondInit(&my_pool->return_stack.cond, NULL);
     SC_ATOMIC_INIT(my_pool->return_stack.sync_now);
+    SC_ATOMIC_INIT(my_pool->return_stack.head);
 }
 
 void PacketPoolInit(void)
@@ -381,6 +525,7 @@ void PacketPoolInit(void)
     SCMutexInit(&my_pool->return_stack.mutex, NULL);
     SCCondInit(&my_pool->return_stack.cond, NULL);
     SC_ATOMIC_INIT(my_pool->return_stack.sync_now);
+    SC_ATOMIC_INIT(my_pool->return_stack.head);
 
     /* pre allocate packets */
     SCLogDebug("preallocating packets... packet size %" PRIuMAX "",
@@ -429,6 +574,7 @@ void PacketPoolDestroy(void)
     }
 
     SC_ATOMIC_DESTROY(my_pool->return_stack.sync_now);
+    SC_ATOMIC_DESTROY(my_pool->return_stack.head);
 
 #ifdef DEBUG_VALIDATION
     my_pool->initialized = 0;
@@ -589,3 +735,87 @@ void PacketPoolPostRunmodes(void)
     SCLogDebug("detect threads %u, max packets %u, max_pending_return_packets %u",
             threads, (uint)threads, max_pending_return_packets);
 }
+
+#ifdef UNITTESTS
+/** \test get and return a burst of packets from our own pool */
+static int PacketPoolTest01(void)
+{
+    Packet *pkts[8];
+    PktPool *my_pool = GetThreadPacketPool();
+
+    uint32_t cnt = PacketPoolGetPackets(8, pkts);
+    FAIL_IF(cnt != 8);
+
+    uint32_t i;
+    for (i = 0; i < cnt; i++) {
+        FAIL_IF_NULL(pkts[i]);
+        FAIL_IF(pkts[i]->pool != my_pool);
+        FAIL_IF(i > 0 && pkts[i] == pkts[i - 1]);
+    }
+
+    PacketPoolReturnPackets(pkts, cnt);
+
+    /* returned to our local stack */
+    Packet *p = my_pool->head;
+    for (i = 0; i < cnt; i++) {
+        FAIL_IF_NULL(p);
+        FAIL_IF(p != pkts[cnt - 1 - i]);
+        p = p->next;
+    }
+    PASS;
+}
+
+/** \test burst returned to another pool ends up on its return stack as
+ *        one list */
+static int PacketPoolTest02(void)
+{
+    Packet *pkts[4];
+    PktPool *my_pool = GetThreadPacketPool();
+    PktPool other;
+
+    memset(&other, 0x00, sizeof(other));
+    SCMutexInit(&other.return_stack.mutex, NULL);
+    SCCondInit(&other.return_stack.cond, NULL);
+    SC_ATOMIC_INIT(other.return_stack.sync_now);
+    SC_ATOMIC_INIT(other.return_stack.head);
+#ifdef DEBUG_VALIDATION
+    other.initialized = 1;
+#endif
+
+    uint32_t cnt = PacketPoolGetPackets(4, pkts);
+    FAIL_IF(cnt != 4);
+    uint32_t i;
+    for (i = 0; i < cnt; i++) {
+        pkts[i]->pool = &other;
+    }
+
+    /* the other pool's owner is waiting, so the list is pushed at once */
+    SC_ATOMIC_SET(other.return_stack.sync_now, 1);
+    PacketPoolReturnPackets(pkts, cnt);
+    FAIL_IF(my_pool->pending_pool != NULL);
+    FAIL_IF(SC_ATOMIC_GET(other.return_stack.sync_now) != 0);
+
+    Packet *p = SC_ATOMIC_GET(other.return_stack.head);
+    i = 0;
+    while (p != NULL) {
+        Packet *next = p->next;
+        p->pool = my_pool;
+        PacketPoolReturnPacket(p);
+        p = next;
+        i++;
+    }
+    FAIL_IF(i != 4);
+
+    SCMutexDestroy(&other.return_stack.mutex);
+    SCCondDestroy(&other.return_stack.cond);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PacketPoolRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PacketPoolTest01", PacketPoolTest01);
+    UtRegisterTest("PacketPoolTest02", PacketPoolTest02);
+#endif /* UNITTESTS */
+}
@@ -30,11 +30,14 @@
 
     /* Return stack, onto which other threads free packets. */
 typedef struct PktPoolLockedStack_{
-    /* linked list of free packets. */
+    /* mutex and cond are only used to wake up the owner waiting for
+     * packets, the stack itself is lock free. */
     SCMutex mutex;
     SCCondT cond;
     SC_ATOMIC_DECLARE(int, sync_now);
-    Packet *head;
+    /* linked list of free packets. Other threads push lists with CAS,
+     * only the owner takes packets off, always the whole list. */
+    SC_ATOMIC_DECLARE(Packet *, head);
 } __attribute__((aligned(CLS))) PktPoolLockedStack;
 
 typedef struct PktPool_ {
@@ -72,12 +75,15 @@ void TmqhOutputPacketpool(ThreadVars *, Packet *);
 void TmqhReleasePacketsToPacketPool(PacketQueue *);
 void TmqhPacketpoolRegister(void);
 Packet *PacketPoolGetPacket(void);
+uint32_t PacketPoolGetPackets(uint32_t n, Packet **out);
 void PacketPoolWait(void);
 void PacketPoolWaitForN(int n);
 void PacketPoolReturnPacket(Packet *p);
+void PacketPoolReturnPackets(Packet **pkts, uint32_t n);
 void PacketPoolInit(void);
 void PacketPoolInitEmpty(void);
 void PacketPoolDestroy(void);
 void PacketPoolPostRunmodes(void);
+void PacketPoolRegisterTests(void);
 
 #endif /* __TMQH_PACKETPOOL_H__ */
@@ -712,6 +712,41 @@ TmEcode UnixManagerReloadRules(json_t *cmd, json_t *server_msg, void *data)
     SCReturnInt(TM_ECODE_OK);
 }
 
+TmEcode UnixManagerReloadTimeCommand(json_t *cmd,
+                                     json_t *server_msg, void *data)
+{
+    SCEnter();
+    DetectEngineReloadStats stats;
+    DetectEngineReloadGetStats(&stats);
+
+    if (stats.last_reload == 0) {
+        json_object_set_new(server_msg, "message", json_string("no reload done"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    json_t *jdata = json_object();
+    if (jdata == NULL) {
+        json_object_set_new(server_msg, "message",
+                            json_string("internal error at json object creation"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    json_object_set_new(jdata, "last_reload", json_integer(stats.last_reload));
+    json_object_set_new(jdata, "result",
+                        json_string(stats.result == 0 ? "ok" : "failed"));
+    json_object_set_new(jdata, "yaml_ms", json_integer(stats.yaml_usec / 1000));
+    json_object_set_new(jdata, "load_ms", json_integer(stats.load_usec / 1000));
+    json_object_set_new(jdata, "build_ms", json_integer(stats.build_usec / 1000));
+    json_object_set_new(jdata, "swap_ms", json_integer(stats.swap_usec / 1000));
+    json_object_set_new(jdata, "free_ms", json_integer(stats.free_usec / 1000));
+    json_object_set_new(jdata, "total_ms", json_integer(stats.total_usec / 1000));
+    json_object_set_new(jdata, "mpm_reused", json_integer(stats.mpm_reused));
+    json_object_set_new(jdata, "mpm_built", json_integer(stats.mpm_built));
+
+    json_object_set_new(server_msg, "message", jdata);
+    SCReturnInt(TM_ECODE_OK);
+}
+
 TmEcode UnixManagerConfGetCommand(json_t *cmd,
                                   json_t *server_msg, void *data)
 {
@@ -930,6 +965,7 @@ static TmEcode UnixManagerThreadInit(ThreadVars *t, void *initdata, void **data)
     UnixManagerRegisterCommand("conf-get", UnixManagerConfGetCommand, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("dump-counters", StatsOutputCounterSocket, NULL, 0);
     UnixManagerRegisterCommand("reload-rules", UnixManagerReloadRules, NULL, 0);
+    UnixManagerRegisterCommand("ruleset-reload-time", UnixManagerReloadTimeCommand, NULL, 0);
     UnixManagerRegisterCommand("register-tenant-handler", UnixSocketRegisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("unregister-tenant-handler", UnixSocketUnregisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("register-tenant", UnixSocketRegisterTenant, &command, UNIX_CMD_TAKE_ARGS);
@@ -35,6 +35,8 @@
 #include "util-print.h"
 #include "app-layer-parser.h"
 #include "util-validate.h"
+#include "util-cpu.h"
+#include "counters.h"
 
 /** \brief switch to force filestore on all files
  *         regardless of the rules.
@@ -51,11 +53,37 @@ static int g_file_force_magic = 0;
  */
 static int g_file_force_md5 = 0;
 
+/** \brief switch to force sha1 calculation on all files
+ *         regardless of the rules.
+ */
+static int g_file_force_sha1 = 0;
+
+/** \brief switch to force sha256 calculation on all files
+ *         regardless of the rules.
+ */
+static int g_file_force_sha256 = 0;
+
 /** \brief switch to force tracking off all files
  *         regardless of the rules.
  */
 static int g_file_force_tracking = 0;
 
+/** max bytes fed to one hash before moving on to the next, so the data
+ *  is still in the cache for the other hashes */
+#define FILE_HASH_BLOCK_SIZE 16384
+
+#ifdef HAVE_NSS
+/** bytes hashed and ticks spent hashing, per algorithm */
+typedef struct FileHashStats_ {
+    SC_ATOMIC_DECLARE(uint64_t, bytes);
+    SC_ATOMIC_DECLARE(uint64_t, ticks);
+} FileHashStats;
+
+static FileHashStats file_hash_md5_stats;
+static FileHashStats file_hash_sha1_stats;
+static FileHashStats file_hash_sha256_stats;
+#endif
+
 /* prototypes */
 static void FileFree(File *);
 
@@ -89,6 +117,135 @@ int FileForceMd5(void)
     return g_file_force_md5;
 }
 
+void FileForceSha1Enable(void)
+{
+    g_file_force_sha1 = 1;
+}
+
+int FileForceSha1(void)
+{
+    return g_file_force_sha1;
+}
+
+void FileForceSha256Enable(void)
+{
+    g_file_force_sha256 = 1;
+}
+
+int FileForceSha256(void)
+{
+    return g_file_force_sha256;
+}
+
+/**
+ *  \brief Set the forced hashes from an output's config
+ *
+ *  Handles the 'force-hash' list (md5, sha1, sha256) and the older
+ *  'force-md5' option.
+ *
+ *  \param conf the output's config node
+ */
+void FileForceHashParseCfg(ConfNode *conf)
+{
+    if (conf == NULL)
+        return;
+
+    ConfNode *forcehash_node = ConfNodeLookupChild(conf, "force-hash");
+    const char *force_md5 = ConfNodeLookupChildValue(conf, "force-md5");
+    int md5 = (force_md5 != NULL && ConfValIsTrue(force_md5));
+    int sha1 = 0, sha256 = 0;
+
+    if (forcehash_node != NULL) {
+        ConfNode *field;
+        TAILQ_FOREACH(field, &forcehash_node->head, next) {
+            if (strcasecmp("md5", field->val) == 0) {
+                md5 = 1;
+            } else if (strcasecmp("sha1", field->val) == 0) {
+                sha1 = 1;
+            } else if (strcasecmp("sha256", field->val) == 0) {
+                sha256 = 1;
+            } else {
+                SCLogWarning(SC_ERR_INVALID_ARGUMENT,
+                        "unknown hash '%s' in force-hash", field->val);
+            }
+        }
+    }
+
+#ifdef HAVE_NSS
+    if (md5) {
+        FileForceMd5Enable();
+        SCLogConfig("forcing md5 calculation for logged or stored files");
+    }
+    if (sha1) {
+        FileForceSha1Enable();
+        SCLogConfig("forcing sha1 calculation for logged or stored files");
+    }
+    if (sha256) {
+        FileForceSha256Enable();
+        SCLogConfig("forcing sha256 calculation for logged or stored files");
+    }
+#else
+    if (md5 || sha1 || sha256) {
+        SCLogInfo("hash calculation requires linking against libnss");
+    }
+#endif
+}
+
+#ifdef HAVE_NSS
+static uint64_t FileHashMd5BytesCounter(void)
+{
+    return SC_ATOMIC_GET(file_hash_md5_stats.bytes);
+}
+
+static uint64_t FileHashMd5TicksCounter(void)
+{
+    return SC_ATOMIC_GET(file_hash_md5_stats.ticks);
+}
+
+static uint64_t FileHashSha1BytesCounter(void)
+{
+    return SC_ATOMIC_GET(file_hash_sha1_stats.bytes);
+}
+
+static uint64_t FileHashSha1TicksCounter(void)
+{
+    return SC_ATOMIC_GET(file_hash_sha1_stats.ticks);
+}
+
+static uint64_t FileHashSha256BytesCounter(void)
+{
+    return SC_ATOMIC_GET(file_hash_sha256_stats.bytes);
+}
+
+static uint64_t FileHashSha256TicksCounter(void)
+{
+    return SC_ATOMIC_GET(file_hash_sha256_stats.ticks);
+}
+#endif
+
+/**
+ *  \brief Register the per hash bytes and cpu ticks counters. Dividing
+ *         the first by the second gives the hash throughput.
+ */
+void FileHashRegisterCounters(void)
+{
+#ifdef HAVE_NSS
+    SC_ATOMIC_INIT(file_hash_md5_stats.bytes);
+    SC_ATOMIC_INIT(file_hash_md5_stats.ticks);
+    SC_ATOMIC_INIT(file_hash_sha1_stats.bytes);
+    SC_ATOMIC_INIT(file_hash_sha1_stats.ticks);
+    SC_ATOMIC_INIT(file_hash_sha256_stats.bytes);
+    SC_ATOMIC_INIT(file_hash_sha256_stats.ticks);
+
+    StatsRegisterGlobalCounter("file.hash.md5_bytes", FileHashMd5BytesCounter);
+    StatsRegisterGlobalCounter("file.hash.md5_ticks", FileHashMd5TicksCounter);
+    StatsRegisterGlobalCounter("file.hash.sha1_bytes", FileHashSha1BytesCounter);
+    StatsRegisterGlobalCounter("file.hash.sha1_ticks", FileHashSha1TicksCounter);
+    StatsRegisterGlobalCounter("file.hash.sha256_bytes", FileHashSha256BytesCounter);
+    StatsRegisterGlobalCounter("file.hash.sha256_ticks", FileHashSha256TicksCounter);
+#endif
+}
+
 void FileForceTrackingEnable(void)
 {
     g_file_force_tracking = 1;
@@ -289,6 +446,10 @@ static void FileFree(File *ff)
 #ifdef HAVE_NSS
     if (ff->md5_ctx)
         HASH_Destroy(ff->md5_ctx);
+    if (ff->sha1_ctx)
+        HASH_Destroy(ff->sha1_ctx);
+    if (ff->sha256_ctx)
+        HASH_Destroy(ff->sha256_ctx);
 #endif
     SCFree(ff);
 }
@@ -355,15 +516,60 @@ static int FileStoreNoStoreCheck(File *ff)
     SCReturnInt(0);
 }
 
-static int AppendData(File *file, const uint8_t *data, uint32_t data_len)
+#ifdef HAVE_NSS
+static inline void FileHashBlock(HASHContext *ctx, FileHashStats *stats,
+        const uint8_t *data, uint32_t data_len)
 {
-    StreamingBufferAppendNoTrack(file->sb, data, data_len);
+    uint64_t ticks = UtilCpuGetTicks();
+    HASH_Update(ctx, data, data_len);
+    (void)SC_ATOMIC_ADD(stats->ticks, UtilCpuGetTicks() - ticks);
+    (void)SC_ATOMIC_ADD(stats->bytes, data_len);
+}
+#endif
 
+/**
+ *  \brief check if any hash is calculated for this file
+ */
+static int FileHashing(const File *file)
+{
+#ifdef HAVE_NSS
+    return (file->md5_ctx != NULL || file->sha1_ctx != NULL ||
+            file->sha256_ctx != NULL);
+#else
+    return 0;
+#endif
+}
+
+/**
+ *  \brief Update all hashes of a file with a chunk of data
+ *
+ *  Large chunks are handed to the hashes a block at a time, so each block
+ *  is read from memory once for all of them.
+ */
+static void FileHashUpdate(File *file, const uint8_t *data, uint32_t data_len)
+{
 #ifdef HAVE_NSS
-    if (file->md5_ctx) {
-        HASH_Update(file->md5_ctx, data, data_len);
+    uint32_t offset = 0;
+    while (offset < data_len) {
+        uint32_t len = MIN(data_len - offset, FILE_HASH_BLOCK_SIZE);
+
+        if (file->md5_ctx)
+            FileHashBlock(file->md5_ctx, &file_hash_md5_stats, data + offset, len);
+        if (file->sha1_ctx)
+            FileHashBlock(file->sha1_ctx, &file_hash_sha1_stats, data + offset, len);
+        if (file->sha256_ctx)
+            FileHashBlock(file->sha256_ctx, &file_hash_sha256_stats, data + offset, len);
+
+        offset += len;
     }
 #endif
+}
+
+static int AppendData(File *file, const uint8_t *data, uint32_t data_len)
+{
+    StreamingBufferAppendNoTrack(file->sb, data, data_len);
+
+    FileHashUpdate(file, data, data_len);
     SCReturnInt(0);
 }
 
@@ -395,15 +601,11 @@ int FileAppendData(FileContainer *ffc, const uint8_t *data, uint32_t data_len)
     }
 
     if (FileStoreNoStoreCheck(ffc->tail) == 1) {
-#ifdef HAVE_NSS
-        /* no storage but forced md5 */
-        if (ffc->tail->md5_ctx) {
-            if (ffc->tail->md5_ctx)
-                HASH_Update(ffc->tail->md5_ctx, data, data_len);
-
+        /* no storage but forced hashing */
+        if (FileHashing(ffc->tail)) {
+            FileHashUpdate(ffc->tail, data, data_len);
             SCReturnInt(0);
         }
-#endif
         if (g_file_force_tracking || (!(ffc->tail->flags & FILE_NOTRACK)))
             SCReturnInt(0);
 
@@ -471,6 +673,14 @@ File *FileOpenFile(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
         SCLogDebug("not doing md5 for this file");
         ff->flags |= FILE_NOMD5;
     }
+    if (flags & FILE_NOSHA1) {
+        SCLogDebug("not doing sha1 for this file");
+        ff->flags |= FILE_NOSHA1;
+    }
+    if (flags & FILE_NOSHA256) {
+        SCLogDebug("not doing sha256 for this file");
+        ff->flags |= FILE_NOSHA256;
+    }
     if (flags & FILE_USE_DETECT) {
         SCLogDebug("considering content_inspect tracker when pruning");
         ff->flags |= FILE_USE_DETECT;
@@ -483,6 +693,18 @@ File *FileOpenFile(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
             HASH_Begin(ff->md5_ctx);
         }
     }
+    if (!(ff->flags & FILE_NOSHA1) || g_file_force_sha1) {
+        ff->sha1_ctx = HASH_Create(HASH_AlgSHA1);
+        if (ff->sha1_ctx != NULL) {
+            HASH_Begin(ff->sha1_ctx);
+        }
+    }
+    if (!(ff->flags & FILE_NOSHA256) || g_file_force_sha256) {
+        ff->sha256_ctx = HASH_Create(HASH_AlgSHA256);
+        if (ff->sha256_ctx != NULL) {
+            HASH_Begin(ff->sha256_ctx);
+        }
+    }
 #endif
 
     ff->state = FILE_STATE_OPENED;
@@ -516,11 +738,8 @@ static int FileCloseFilePtr(File *ff, const uint8_t *data,
 
     if (data != NULL) {
         if (ff->flags & FILE_NOSTORE) {
-#ifdef HAVE_NSS
-            /* no storage but md5 */
-            if (ff->md5_ctx)
-                HASH_Update(ff->md5_ctx, data, data_len);
-#endif
+            /* no storage but hashing */
+            FileHashUpdate(ff, data, data_len);
         } else {
             if (AppendData(ff, data, data_len) != 0) {
                 ff->state = FILE_STATE_ERROR;
@@ -547,6 +766,16 @@ static int FileCloseFilePtr(File *ff, const uint8_t *data,
             HASH_End(ff->md5_ctx, ff->md5, &len, sizeof(ff->md5));
             ff->flags |= FILE_MD5;
         }
+        if (ff->sha1_ctx) {
+            unsigned int len = 0;
+            HASH_End(ff->sha1_ctx, ff->sha1, &len, sizeof(ff->sha1));
+            ff->flags |= FILE_SHA1;
+        }
+        if (ff->sha256_ctx) {
+            unsigned int len = 0;
+            HASH_End(ff->sha256_ctx, ff->sha256, &len, sizeof(ff->sha256));
+            ff->flags |= FILE_SHA256;
+        }
 #endif
     }
 
@@ -682,6 +911,84 @@ void FileDisableMd5(Flow *f, uint8_t direction)
     SCReturn;
 }
 
+/**
+ *  \brief disable file sha1 calc for this flow
+ *
+ *  \param f *LOCKED* flow
+ *  \param direction flow direction
+ */
+void FileDisableSha1(Flow *f, uint8_t direction)
+{
+    File *ptr = NULL;
+
+    SCEnter();
+
+    DEBUG_ASSERT_FLOW_LOCKED(f);
+
+    if (direction == STREAM_TOSERVER)
+        f->file_flags |= FLOWFILE_NO_SHA1_TS;
+    else
+        f->file_flags |= FLOWFILE_NO_SHA1_TC;
+
+    FileContainer *ffc = AppLayerParserGetFiles(f->proto, f->alproto, f->alstate, direction);
+    if (ffc != NULL) {
+        for (ptr = ffc->head; ptr != NULL; ptr = ptr->next) {
+            SCLogDebug("disabling sha1 for file %p from direction %s",
+                    ptr, direction == STREAM_TOSERVER ? "toserver":"toclient");
+            ptr->flags |= FILE_NOSHA1;
+
+#ifdef HAVE_NSS
+            /* destroy any ctx we may have so far */
+            if (ptr->sha1_ctx != NULL) {
+                HASH_Destroy(ptr->sha1_ctx);
+                ptr->sha1_ctx = NULL;
+            }
+#endif
+        }
+    }
+
+    SCReturn;
+}
+
+/**
+ *  \brief disable file sha256 calc for this flow
+ *
+ *  \param f *LOCKED* flow
+ *  \param direction flow direction
+ */
+void FileDisableSha256(Flow *f, uint8_t direction)
+{
+    File *ptr = NULL;
+
+    SCEnter();
+
+    DEBUG_ASSERT_FLOW_LOCKED(f);
+
+    if (direction == STREAM_TOSERVER)
+        f->file_flags |= FLOWFILE_NO_SHA256_TS;
+    else
+        f->file_flags |= FLOWFILE_NO_SHA256_TC;
+
+    FileContainer *ffc = AppLayerParserGetFiles(f->proto, f->alproto, f->alstate, direction);
+    if (ffc != NULL) {
+        for (ptr = ffc->head; ptr != NULL; ptr = ptr->next) {
+            SCLogDebug("disabling sha256 for file %p from direction %s",
+                    ptr, direction == STREAM_TOSERVER ? "toserver":"toclient");
+            ptr->flags |= FILE_NOSHA256;
+
+#ifdef HAVE_NSS
+            /* destroy any ctx we may have so far */
+            if (ptr->sha256_ctx != NULL) {
+                HASH_Destroy(ptr->sha256_ctx);
+                ptr->sha256_ctx = NULL;
+            }
+#endif
+        }
+    }
+
+    SCReturn;
+}
+
 /**
  *  \brief disable file size tracking for this flow
  *
@@ -731,7 +1038,8 @@ void FileDisableStoringForFile(File *ff)
     ff->flags |= FILE_NOSTORE;
 
     if (ff->state == FILE_STATE_OPENED && FileSize(ff) >= (uint64_t)FileMagicSize()) {
-        if (g_file_force_md5 == 0 && g_file_force_tracking == 0) {
+        if (g_file_force_md5 == 0 && g_file_force_sha1 == 0 &&
+                g_file_force_sha256 == 0 && g_file_force_tracking == 0) {
             (void)FileCloseFilePtr(ff, NULL, 0,
                     (FILE_TRUNCATED|FILE_NOSTORE));
         }
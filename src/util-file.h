@@ -29,6 +29,7 @@
 #include <sechash.h>
 #endif
 
+#include "conf.h"
 #include "util-streaming-buffer.h"
 
 #define FILE_TRUNCATED  0x0001
@@ -41,6 +42,10 @@
 #define FILE_STORED     0x0080
 #define FILE_NOTRACK    0x0100 /**< track size of file */
 #define FILE_USE_DETECT 0x0200 /**< use content_inspected tracker */
+#define FILE_NOSHA1     0x0400
+#define FILE_SHA1       0x0800
+#define FILE_NOSHA256   0x1000
+#define FILE_SHA256     0x2000
 
 typedef enum FileState_ {
     FILE_STATE_NONE = 0,    /**< no state */
@@ -66,6 +71,10 @@ typedef struct File_ {
 #ifdef HAVE_NSS
     HASHContext *md5_ctx;
     uint8_t md5[MD5_LENGTH];
+    HASHContext *sha1_ctx;
+    uint8_t sha1[SHA1_LENGTH];
+    HASHContext *sha256_ctx;
+    uint8_t sha256[SHA256_LENGTH];
 #endif
     uint64_t content_inspected;     /**< used in pruning if FILE_USE_DETECT
                                      *   flag is set */
@@ -181,6 +190,17 @@ void FileDisableMd5(Flow *f, uint8_t);
 void FileForceMd5Enable(void);
 int FileForceMd5(void);
 
+void FileDisableSha1(Flow *f, uint8_t);
+void FileForceSha1Enable(void);
+int FileForceSha1(void);
+
+void FileDisableSha256(Flow *f, uint8_t);
+void FileForceSha256Enable(void);
+int FileForceSha256(void);
+
+void FileForceHashParseCfg(ConfNode *);
+void FileHashRegisterCounters(void);
+
 void FileForceTrackingEnable(void);
 
 void FileStoreAllFiles(FileContainer *);
@@ -0,0 +1,654 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming JSON encoder. Keys and values are escaped straight into the
+ * thread's output MemBuffer, so building a record doesn't allocate: no
+ * json_t tree, no per value strdup and no dump pass afterwards.
+ *
+ * The output matches what json_dump() produces for the loggers' trees
+ * (JSON_COMPACT|JSON_ENSURE_ASCII|JSON_ESCAPE_SLASH, insertion order),
+ * including jansson's behaviour for strings that are not valid UTF-8:
+ * json_string() fails on those and the member is left out, so we rewind
+ * the buffer to before the key.
+ */
+
+#include "suricata-common.h"
+#include "util-debug.h"
+#include "util-buffer.h"
+#include "util-json-builder.h"
+#include "util-unittest.h"
+
+/** 1 for bytes that can't be copied to the output as is */
+static const uint8_t json_escape[256] = {
+    /* 0x00 - 0x1f: control chars */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /* 0x20 - 0x7f: '"', '/' and '\' */
+    0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 0x80 - 0xff: UTF-8 sequences, written as \uXXXX */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+};
+
+static const char json_hex[] = "0123456789ABCDEF";
+
+/**
+ *  \brief make sure 'len' more bytes fit
+ *
+ *  Room for a trailing newline and the terminating nul is kept as well,
+ *  LogFileWrite() appends those.
+ */
+static inline int JsonBuilderReserve(JsonBuilder *jb, uint32_t len)
+{
+    MemBuffer *b = *jb->buffer;
+
+    if (likely(b->size - b->offset > len + 2))
+        return 0;
+
+    uint32_t expand_by = len + 3 > JSON_BUILDER_EXPAND_BY ?
+        len + 3 : JSON_BUILDER_EXPAND_BY;
+    if (MemBufferExpand(jb->buffer, expand_by) < 0) {
+        jb->error = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void JsonBuilderPutRaw(JsonBuilder *jb, const char *s,
+        uint32_t len)
+{
+    if (JsonBuilderReserve(jb, len) < 0)
+        return;
+
+    MemBuffer *b = *jb->buffer;
+    memcpy(b->buffer + b->offset, s, len);
+    b->offset += len;
+}
+
+static inline void JsonBuilderPutChar(JsonBuilder *jb, char c)
+{
+    if (JsonBuilderReserve(jb, 1) < 0)
+        return;
+
+    MemBuffer *b = *jb->buffer;
+    b->buffer[b->offset++] = c;
+}
+
+/**
+ *  \brief decode one UTF-8 sequence, same rules as jansson's utf.c
+ *
+ *  \retval n length of the sequence, -1 if invalid
+ */
+static int JsonUtf8Decode(const uint8_t *s, uint32_t len, uint32_t *cp)
+{
+    uint32_t n, i, v;
+    uint8_t c = s[0];
+
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    } else if (c <= 0xC1) {
+        /* continuation byte or overlong 2 byte sequence */
+        return -1;
+    } else if (c <= 0xDF) {
+        n = 2;
+        v = c & 0x1F;
+    } else if (c <= 0xEF) {
+        n = 3;
+        v = c & 0x0F;
+    } else if (c <= 0xF4) {
+        n = 4;
+        v = c & 0x07;
+    } else {
+        return -1;
+    }
+
+    if (n > len)
+        return -1;
+
+    for (i = 1; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80)
+            return -1;
+        v = (v << 6) | (s[i] & 0x3F);
+    }
+
+    if (v > 0x10FFFF)
+        return -1;
+    /* UTF-16 surrogates */
+    if (v >= 0xD800 && v <= 0xDFFF)
+        return -1;
+    /* overlong */
+    if ((n == 3 && v < 0x800) || (n == 4 && v < 0x10000))
+        return -1;
+
+    *cp = v;
+    return (int)n;
+}
+
+static inline uint32_t JsonPutU16(char *out, uint32_t v)
+{
+    out[0] = '\\';
+    out[1] = 'u';
+    out[2] = json_hex[(v >> 12) & 0xF];
+    out[3] = json_hex[(v >> 8) & 0xF];
+    out[4] = json_hex[(v >> 4) & 0xF];
+    out[5] = json_hex[v & 0xF];
+    return 6;
+}
+
+/**
+ *  \brief write 'len' bytes of 's' as a quoted, escaped JSON string
+ *
+ *  \param nul_as_text write nul bytes as the two chars '\' '0', which is
+ *         what the byte to string helpers used by the jansson loggers do
+ *
+ *  \retval 0 ok, -1 invalid UTF-8 or out of memory
+ */
+static int JsonBuilderPutString(JsonBuilder *jb, const uint8_t *s,
+        uint32_t len, int nul_as_text)
+{
+    uint32_t i = 0;
+
+    JsonBuilderPutChar(jb, '"');
+
+    while (i < len) {
+        uint32_t start = i;
+        while (i < len && json_escape[s[i]] == 0)
+            i++;
+        if (i > start)
+            JsonBuilderPutRaw(jb, (const char *)s + start, i - start);
+        if (i == len)
+            break;
+
+        char esc[12];
+        uint32_t esc_len = 2;
+        uint8_t c = s[i];
+
+        esc[0] = '\\';
+        if (c < 0x80) {
+            switch (c) {
+                case '"':  esc[1] = '"'; break;
+                case '\\': esc[1] = '\\'; break;
+                case '/':  esc[1] = '/'; break;
+                case '\b': esc[1] = 'b'; break;
+                case '\f': esc[1] = 'f'; break;
+                case '\n': esc[1] = 'n'; break;
+                case '\r': esc[1] = 'r'; break;
+                case '\t': esc[1] = 't'; break;
+                case '\0':
+                    if (nul_as_text) {
+                        /* '\' '0' escaped as JSON */
+                        esc[1] = '\\';
+                        esc[2] = '0';
+                        esc_len = 3;
+                        break;
+                    }
+                    /* fall through */
+                default:
+                    esc_len = JsonPutU16(esc, c);
+                    break;
+            }
+            i++;
+        } else {
+            uint32_t cp;
+            int n = JsonUtf8Decode(s + i, len - i, &cp);
+            if (n < 0)
+                return -1;
+            i += n;
+
+            if (cp < 0x10000) {
+                esc_len = JsonPutU16(esc, cp);
+            } else {
+                cp -= 0x10000;
+                esc_len = JsonPutU16(esc, 0xD800 | (cp >> 10));
+                esc_len += JsonPutU16(esc + esc_len, 0xDC00 | (cp & 0x3FF));
+            }
+        }
+        JsonBuilderPutRaw(jb, esc, esc_len);
+    }
+
+    JsonBuilderPutChar(jb, '"');
+    return jb->error ? -1 : 0;
+}
+
+/**
+ *  \brief write the separator and key for the next member
+ *
+ *  \param key member name, ignored inside arrays
+ */
+static int JsonBuilderKey(JsonBuilder *jb, const char *key)
+{
+    if (unlikely(jb->error || jb->depth == 0)) {
+        jb->error = 1;
+        return -1;
+    }
+
+    uint32_t bit = 1U << jb->depth;
+    if (jb->first & bit)
+        jb->first &= ~bit;
+    else
+        JsonBuilderPutChar(jb, ',');
+
+    if (!(jb->array & bit)) {
+        if (JsonBuilderPutString(jb, (const uint8_t *)key,
+                    strlen(key), 0) < 0) {
+            jb->error = 1;
+            return -1;
+        }
+        JsonBuilderPutChar(jb, ':');
+    }
+    return jb->error ? -1 : 0;
+}
+
+static void JsonBuilderOpen(JsonBuilder *jb, const char *key, char c,
+        int array)
+{
+    if (JsonBuilderKey(jb, key) < 0)
+        return;
+
+    if (unlikely(jb->depth == JSON_BUILDER_MAX_DEPTH)) {
+        jb->error = 1;
+        return;
+    }
+
+    JsonBuilderPutChar(jb, c);
+    jb->depth++;
+
+    uint32_t bit = 1U << jb->depth;
+    jb->first |= bit;
+    if (array)
+        jb->array |= bit;
+    else
+        jb->array &= ~bit;
+}
+
+/**
+ *  \brief start a record at the current offset of the buffer
+ *
+ *  Anything already in the buffer (e.g. a prefix) is kept.
+ */
+void JsonBuilderInit(JsonBuilder *jb, MemBuffer **buffer)
+{
+    memset(jb, 0, sizeof(*jb));
+    jb->buffer = buffer;
+
+    JsonBuilderPutChar(jb, '{');
+    jb->depth = 1;
+    jb->first = 1U << 1;
+}
+
+/**
+ *  \brief close all open objects and arrays and nul terminate
+ *
+ *  \retval 0 ok, -1 the record is incomplete and must not be written
+ */
+int JsonBuilderFinish(JsonBuilder *jb)
+{
+    while (jb->depth > 0)
+        JsonBuilderClose(jb);
+
+    if (jb->error)
+        return -1;
+
+    MemBuffer *b = *jb->buffer;
+    b->buffer[b->offset] = '\0';
+    return 0;
+}
+
+void JsonBuilderGetMark(const JsonBuilder *jb, JsonBuilderMark *mark)
+{
+    mark->offset = (*jb->buffer)->offset;
+    mark->depth = jb->depth;
+    mark->first = jb->first;
+    mark->array = jb->array;
+    mark->error = jb->error;
+}
+
+/** \brief drop everything written since the mark was taken */
+void JsonBuilderRewind(JsonBuilder *jb, const JsonBuilderMark *mark)
+{
+    (*jb->buffer)->offset = mark->offset;
+    jb->depth = mark->depth;
+    jb->first = mark->first;
+    jb->array = mark->array;
+    jb->error = mark->error;
+}
+
+void JsonBuilderOpenObject(JsonBuilder *jb, const char *key)
+{
+    JsonBuilderOpen(jb, key, '{', 0);
+}
+
+void JsonBuilderOpenArray(JsonBuilder *jb, const char *key)
+{
+    JsonBuilderOpen(jb, key, '[', 1);
+}
+
+void JsonBuilderClose(JsonBuilder *jb)
+{
+    if (unlikely(jb->depth == 0)) {
+        jb->error = 1;
+        return;
+    }
+
+    uint32_t bit = 1U << jb->depth;
+    JsonBuilderPutChar(jb, (jb->array & bit) ? ']' : '}');
+    jb->depth--;
+}
+
+/**
+ *  \brief add a string member, or leave it out like jansson does when
+ *         the string is not valid UTF-8
+ */
+static void JsonBuilderSetStringInternal(JsonBuilder *jb, const char *key,
+        const uint8_t *val, uint32_t len, int nul_as_text)
+{
+    if (unlikely(jb->error))
+        return;
+
+    MemBuffer *b = *jb->buffer;
+    uint32_t offset = b->offset;
+    uint32_t first = jb->first;
+
+    if (JsonBuilderKey(jb, key) < 0)
+        return;
+
+    if (JsonBuilderPutString(jb, val, len, nul_as_text) < 0) {
+        if (jb->error)
+            return;
+        (*jb->buffer)->offset = offset;
+        jb->first = first;
+    }
+}
+
+/** \brief add a nul terminated string, NULL values are skipped */
+void JsonBuilderSetString(JsonBuilder *jb, const char *key, const char *val)
+{
+    if (val == NULL)
+        return;
+    JsonBuilderSetStringInternal(jb, key, (const uint8_t *)val,
+            strlen(val), 0);
+}
+
+/** \brief add a string of 'len' bytes, nul bytes become \\u0000 */
+void JsonBuilderSetStringLen(JsonBuilder *jb, const char *key,
+        const uint8_t *val, uint32_t len)
+{
+    if (val == NULL)
+        return;
+    JsonBuilderSetStringInternal(jb, key, val, len, 0);
+}
+
+/**
+ *  \brief add raw protocol bytes
+ *
+ *  Nul bytes are written as "\0", which is what the BytesToString()
+ *  and bstr_util_strdup_to_c() conversions of the jansson loggers do.
+ */
+void JsonBuilderSetBytes(JsonBuilder *jb, const char *key,
+        const uint8_t *val, uint32_t len)
+{
+    if (val == NULL)
+        return;
+    JsonBuilderSetStringInternal(jb, key, val, len, 1);
+}
+
+void JsonBuilderSetUint(JsonBuilder *jb, const char *key, uint64_t val)
+{
+    char tmp[24];
+    uint32_t i = sizeof(tmp);
+
+    if (JsonBuilderKey(jb, key) < 0)
+        return;
+
+    do {
+        tmp[--i] = '0' + (val % 10);
+        val /= 10;
+    } while (val != 0);
+
+    JsonBuilderPutRaw(jb, tmp + i, sizeof(tmp) - i);
+}
+
+void JsonBuilderSetInt(JsonBuilder *jb, const char *key, int64_t val)
+{
+    if (val >= 0) {
+        JsonBuilderSetUint(jb, key, (uint64_t)val);
+        return;
+    }
+
+    char tmp[24];
+    uint32_t i = sizeof(tmp);
+    uint64_t v = (uint64_t)0 - (uint64_t)val;
+
+    if (JsonBuilderKey(jb, key) < 0)
+        return;
+
+    do {
+        tmp[--i] = '0' + (v % 10);
+        v /= 10;
+    } while (v != 0);
+    tmp[--i] = '-';
+
+    JsonBuilderPutRaw(jb, tmp + i, sizeof(tmp) - i);
+}
+
+void JsonBuilderSetBool(JsonBuilder *jb, const char *key, int val)
+{
+    if (JsonBuilderKey(jb, key) < 0)
+        return;
+
+    if (val)
+        JsonBuilderPutRaw(jb, "true", 4);
+    else
+        JsonBuilderPutRaw(jb, "false", 5);
+}
+
+#ifdef HAVE_LIBJANSSON
+static int JsonBuilderDumpCallback(const char *str, size_t size, void *data)
+{
+    JsonBuilder *jb = data;
+
+    JsonBuilderPutRaw(jb, str, (uint32_t)size);
+    return jb->error ? -1 : 0;
+}
+
+/**
+ *  \brief embed a jansson object or array
+ *
+ *  For the app layer metadata that is still built as a json_t tree.
+ */
+void JsonBuilderSetJson(JsonBuilder *jb, const char *key, const json_t *val)
+{
+    if (val == NULL || unlikely(jb->error))
+        return;
+
+    uint32_t offset = (*jb->buffer)->offset;
+    uint32_t first = jb->first;
+
+    if (JsonBuilderKey(jb, key) < 0)
+        return;
+
+    if (json_dump_callback(val, JsonBuilderDumpCallback, jb,
+                JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|
+                JSON_ESCAPE_SLASH) != 0) {
+        if (jb->error)
+            return;
+        (*jb->buffer)->offset = offset;
+        jb->first = first;
+    }
+}
+#endif /* HAVE_LIBJANSSON */
+
+#ifdef UNITTESTS
+
+static int JsonBuilderCheck(JsonBuilder *jb, const char *expect)
+{
+    if (JsonBuilderFinish(jb) != 0)
+        return 0;
+
+    MemBuffer *b = *jb->buffer;
+    if (b->offset != strlen(expect) ||
+        memcmp(b->buffer, expect, b->offset) != 0) {
+        printf("got \"%s\", expected \"%s\": ", (char *)b->buffer, expect);
+        return 0;
+    }
+    return 1;
+}
+
+/** \test nesting, arrays and scalars */
+static int JsonBuilderTest01(void)
+{
+    MemBuffer *buffer = MemBufferCreateNew(256);
+    FAIL_IF_NULL(buffer);
+    JsonBuilder jb;
+
+    JsonBuilderInit(&jb, &buffer);
+    JsonBuilderSetString(&jb, "a", "x");
+    JsonBuilderSetString(&jb, "skipped", NULL);
+    JsonBuilderSetUint(&jb, "u", 18446744073709551615ULL);
+    JsonBuilderSetInt(&jb, "i", -9223372036854775807LL - 1);
+    JsonBuilderSetInt(&jb, "z", 0);
+    JsonBuilderOpenObject(&jb, "o");
+    JsonBuilderSetBool(&jb, "t", 1);
+    JsonBuilderOpenArray(&jb, "arr");
+    JsonBuilderSetUint(&jb, NULL, 1);
+    JsonBuilderSetString(&jb, NULL, "two");
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    JsonBuilderSetBool(&jb, "f", 0);
+    JsonBuilderClose(&jb);
+    JsonBuilderOpenArray(&jb, "empty");
+    FAIL_IF_NOT(JsonBuilderCheck(&jb, "{\"a\":\"x\","
+                "\"u\":18446744073709551615,"
+                "\"i\":-9223372036854775808,\"z\":0,"
+                "\"o\":{\"t\":true,\"arr\":[1,\"two\",{}],\"f\":false},"
+                "\"empty\":[]}"));
+
+    /* nothing can be added after finishing */
+    JsonBuilderSetUint(&jb, "late", 1);
+    FAIL_IF_NOT(jb.error);
+
+    MemBufferFree(buffer);
+    PASS;
+}
+
+/** \test escaping is the same as json_dump with JSON_ENSURE_ASCII and
+ *        JSON_ESCAPE_SLASH */
+static int JsonBuilderTest02(void)
+{
+    MemBuffer *buffer = MemBufferCreateNew(256);
+    FAIL_IF_NULL(buffer);
+    JsonBuilder jb;
+    const uint8_t nul[] = { 'a', 0x00, 'b' };
+
+    JsonBuilderInit(&jb, &buffer);
+    JsonBuilderSetString(&jb, "s", "\"q\" \\ /p\b\f\n\r\t\x01\x1f\x7f");
+    JsonBuilderSetString(&jb, "u", "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+    JsonBuilderSetStringLen(&jb, "n", nul, sizeof(nul));
+    JsonBuilderSetBytes(&jb, "b", nul, sizeof(nul));
+    FAIL_IF_NOT(JsonBuilderCheck(&jb, "{"
+                "\"s\":\"\\\"q\\\" \\\\ \\/p\\b\\f\\n\\r\\t\\u0001\\u001F\x7f\","
+                "\"u\":\"\\u00E9\\u20AC\\uD83D\\uDE00\","
+                "\"n\":\"a\\u0000b\","
+                "\"b\":\"a\\\\0b\"}"));
+
+    MemBufferFree(buffer);
+    PASS;
+}
+
+/** \test members with invalid UTF-8 are left out entirely */
+static int JsonBuilderTest03(void)
+{
+    MemBuffer *buffer = MemBufferCreateNew(256);
+    FAIL_IF_NULL(buffer);
+    JsonBuilder jb;
+
+    JsonBuilderInit(&jb, &buffer);
+    JsonBuilderSetString(&jb, "bad1", "\xff");
+    JsonBuilderSetString(&jb, "a", "1");
+    JsonBuilderSetString(&jb, "bad2", "\xc0\xaf");          /* overlong */
+    JsonBuilderSetString(&jb, "bad3", "\xed\xa0\x80");      /* surrogate */
+    JsonBuilderSetString(&jb, "bad4", "\xe2\x82");          /* truncated */
+    JsonBuilderSetString(&jb, "bad5", "\xf4\x90\x80\x80");  /* > U+10FFFF */
+    JsonBuilderOpenArray(&jb, "arr");
+    JsonBuilderSetString(&jb, NULL, "\x80");
+    JsonBuilderSetString(&jb, NULL, "b");
+    JsonBuilderClose(&jb);
+    FAIL_IF_NOT(JsonBuilderCheck(&jb, "{\"a\":\"1\",\"arr\":[\"b\"]}"));
+
+    MemBufferFree(buffer);
+    PASS;
+}
+
+/** \test buffer grows as needed, prefix and marks are kept */
+static int JsonBuilderTest04(void)
+{
+    MemBuffer *buffer = MemBufferCreateNew(8);
+    FAIL_IF_NULL(buffer);
+    JsonBuilder jb;
+    JsonBuilderMark mark;
+    uint8_t big[1000];
+    uint32_t i;
+
+    memset(big, 0x01, sizeof(big));
+
+    MemBufferWriteRaw(buffer, "@", 1);
+    JsonBuilderInit(&jb, &buffer);
+    JsonBuilderSetUint(&jb, "x", 1);
+    JsonBuilderGetMark(&jb, &mark);
+    JsonBuilderSetBytes(&jb, "big", big, sizeof(big));
+    FAIL_IF(JsonBuilderFinish(&jb) != 0);
+    FAIL_IF(buffer->offset != 1 + 7 + 7 + 6 * sizeof(big) + 2);
+    FAIL_IF(buffer->size - buffer->offset < 3);
+    for (i = 0; i < sizeof(big); i++) {
+        FAIL_IF(memcmp(buffer->buffer + 15 + i * 6, "\\u0001", 6) != 0);
+    }
+
+    JsonBuilderRewind(&jb, &mark);
+    JsonBuilderSetUint(&jb, "y", 2);
+    FAIL_IF_NOT(JsonBuilderCheck(&jb, "@{\"x\":1,\"y\":2}"));
+
+    MemBufferFree(buffer);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void JsonBuilderRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("JsonBuilderTest01", JsonBuilderTest01);
+    UtRegisterTest("JsonBuilderTest02", JsonBuilderTest02);
+    UtRegisterTest("JsonBuilderTest03", JsonBuilderTest03);
+    UtRegisterTest("JsonBuilderTest04", JsonBuilderTest04);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,82 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming JSON encoder writing straight into a MemBuffer.
+ */
+
+#ifndef __UTIL_JSON_BUILDER_H__
+#define __UTIL_JSON_BUILDER_H__
+
+#include "util-buffer.h"
+
+/** nesting limit, one bit per level in the state masks */
+#define JSON_BUILDER_MAX_DEPTH  31
+
+/** grow the buffer by at least this much when it runs out of room */
+#define JSON_BUILDER_EXPAND_BY  65536
+
+/**
+ *  \brief encoder state, lives on the stack of the logger
+ *
+ *  The output is the same as json_dump() with JSON_PRESERVE_ORDER,
+ *  JSON_COMPACT, JSON_ENSURE_ASCII and JSON_ESCAPE_SLASH would produce
+ *  for the equivalent json_t tree.
+ */
+typedef struct JsonBuilder_ {
+    MemBuffer **buffer;
+    uint32_t depth;
+    uint32_t first;     /**< bit per level: no member written yet */
+    uint32_t array;     /**< bit per level: level is an array */
+    int error;          /**< sticky, set on overflow or misuse */
+} JsonBuilder;
+
+/** position to rewind to, e.g. to emit several records sharing a header */
+typedef struct JsonBuilderMark_ {
+    uint32_t offset;
+    uint32_t depth;
+    uint32_t first;
+    uint32_t array;
+    int error;
+} JsonBuilderMark;
+
+void JsonBuilderInit(JsonBuilder *jb, MemBuffer **buffer);
+int JsonBuilderFinish(JsonBuilder *jb);
+void JsonBuilderGetMark(const JsonBuilder *jb, JsonBuilderMark *mark);
+void JsonBuilderRewind(JsonBuilder *jb, const JsonBuilderMark *mark);
+
+void JsonBuilderOpenObject(JsonBuilder *jb, const char *key);
+void JsonBuilderOpenArray(JsonBuilder *jb, const char *key);
+void JsonBuilderClose(JsonBuilder *jb);
+
+void JsonBuilderSetString(JsonBuilder *jb, const char *key, const char *val);
+void JsonBuilderSetStringLen(JsonBuilder *jb, const char *key,
+        const uint8_t *val, uint32_t len);
+void JsonBuilderSetBytes(JsonBuilder *jb, const char *key,
+        const uint8_t *val, uint32_t len);
+void JsonBuilderSetUint(JsonBuilder *jb, const char *key, uint64_t val);
+void JsonBuilderSetInt(JsonBuilder *jb, const char *key, int64_t val);
+void JsonBuilderSetBool(JsonBuilder *jb, const char *key, int val);
+#ifdef HAVE_LIBJANSSON
+void JsonBuilderSetJson(JsonBuilder *jb, const char *key, const json_t *val);
+#endif
+
+void JsonBuilderRegisterTests(void);
+
+#endif /* __UTIL_JSON_BUILDER_H__ */
@@ -0,0 +1,757 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Async output mode for regular log files.
+ *
+ * Instead of taking the fp_mutex and calling fwrite + fflush for every
+ * record, the logging threads append their records to a buffer of one of
+ * a fixed number of shards, picked by thread. Full buffers are queued to
+ * a writer thread that hands them to writev in batches. Partially filled
+ * buffers are picked up by the writer every flush interval.
+ *
+ * Records of a thread stay in order. Records of different threads may be
+ * reordered by up to a flush interval.
+ *
+ * The memory used by the buffers is limited by a memcap. Records that
+ * don't fit are dropped and counted.
+ */
+
+#include "suricata-common.h"
+#include "threads.h"
+#include "counters.h"
+#include "conf.h"
+
+#include "util-logopenfile.h"
+#include "util-logopenfile-async.h"
+
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-misc.h"
+#include "util-signal.h"
+#include "util-unittest.h"
+
+#include <sys/uio.h>
+
+/** number of shards, the shard of a thread is picked by hashing its id */
+#define LOGFILE_ASYNC_SHARDS        16
+/** buffers handed to a single writev call */
+#define LOGFILE_ASYNC_MAX_IOV       64
+/** buffers kept for reuse */
+#define LOGFILE_ASYNC_MAX_SPARE     (2 * LOGFILE_ASYNC_SHARDS)
+
+typedef struct LogFileAsyncBuf_ {
+    struct LogFileAsyncBuf_ *next;
+    uint32_t size;
+    uint32_t offset;
+    uint8_t data[];
+} LogFileAsyncBuf;
+
+typedef struct LogFileAsyncShard_ {
+    SCMutex mutex;
+    LogFileAsyncBuf *buf;   /**< buffer being filled */
+} __attribute__((aligned(CLS))) LogFileAsyncShard;
+
+typedef struct LogFileAsync_ {
+    LogFileAsyncShard shards[LOGFILE_ASYNC_SHARDS];
+
+    LogFileCtx *log_ctx;
+    uint32_t buffer_size;
+    uint32_t flush_interval;    /**< msec */
+    uint64_t memcap;
+
+    /* protects the members below */
+    SCCtrlMutex mutex;
+    SCCtrlCondT cond;
+    LogFileAsyncBuf *full_head;
+    LogFileAsyncBuf *full_tail;
+    LogFileAsyncBuf *spare;
+    uint32_t spare_cnt;
+    uint64_t memuse;
+    int stop;
+
+    pthread_t thread;
+} LogFileAsync;
+
+SC_ATOMIC_DECLARE(uint64_t, logfile_async_memuse);
+SC_ATOMIC_DECLARE(uint64_t, logfile_async_drops);
+SC_ATOMIC_DECLARE(uint64_t, logfile_async_writes);
+static int counters_registered = 0;
+
+static uint64_t LogFileAsyncMemuseCounter(void)
+{
+    return SC_ATOMIC_GET(logfile_async_memuse);
+}
+
+static uint64_t LogFileAsyncDropsCounter(void)
+{
+    return SC_ATOMIC_GET(logfile_async_drops);
+}
+
+static uint64_t LogFileAsyncWritesCounter(void)
+{
+    return SC_ATOMIC_GET(logfile_async_writes);
+}
+
+/** \internal
+ *  \brief pick the shard of the calling thread
+ *
+ *  pthread_self() is a plain load, unlike SCGetThreadIdLong() which is a
+ *  syscall on Linux. */
+static inline LogFileAsyncShard *LogFileAsyncGetShard(LogFileAsync *a)
+{
+    uint64_t id = (uint64_t)(uintptr_t)pthread_self();
+    return &a->shards[(id * 0x9E3779B97F4A7C15ULL) >> 60];
+}
+
+/** \internal
+ *  \brief return a buffer to the spare list or free it
+ *
+ *  \note a->mutex must be held
+ */
+static void LogFileAsyncBufRelease(LogFileAsync *a, LogFileAsyncBuf *b)
+{
+    if (b->size == a->buffer_size && a->spare_cnt < LOGFILE_ASYNC_MAX_SPARE) {
+        b->offset = 0;
+        b->next = a->spare;
+        a->spare = b;
+        a->spare_cnt++;
+        return;
+    }
+
+    uint64_t size = sizeof(LogFileAsyncBuf) + b->size;
+    a->memuse -= size;
+    (void)SC_ATOMIC_SUB(logfile_async_memuse, size);
+    SCFree(b);
+}
+
+/** \internal
+ *  \brief queue a buffer to the writer thread
+ *
+ *  \note a->mutex must be held
+ */
+static void LogFileAsyncBufQueue(LogFileAsync *a, LogFileAsyncBuf *b)
+{
+    b->next = NULL;
+    if (a->full_tail == NULL) {
+        a->full_head = b;
+    } else {
+        a->full_tail->next = b;
+    }
+    a->full_tail = b;
+}
+
+/** \internal
+ *  \brief queue the current buffer of a shard and get a new one
+ *
+ *  \param old current buffer of the shard, may be NULL
+ *  \param len length of the record that has to fit
+ *
+ *  \retval b buffer with at least len bytes of space
+ *  \retval NULL memcap reached or allocation failed
+ */
+static LogFileAsyncBuf *LogFileAsyncBufGet(LogFileAsync *a,
+        LogFileAsyncBuf *old, uint32_t len)
+{
+    uint32_t size = MAX(a->buffer_size, len);
+    uint64_t alloc = sizeof(LogFileAsyncBuf) + size;
+    LogFileAsyncBuf *b = NULL;
+
+    SCCtrlMutexLock(&a->mutex);
+    if (old != NULL) {
+        if (old->offset > 0) {
+            LogFileAsyncBufQueue(a, old);
+            SCCtrlCondSignal(&a->cond);
+        } else {
+            LogFileAsyncBufRelease(a, old);
+        }
+    }
+    if (size == a->buffer_size && a->spare != NULL) {
+        b = a->spare;
+        a->spare = b->next;
+        a->spare_cnt--;
+        SCCtrlMutexUnlock(&a->mutex);
+        return b;
+    }
+    if (a->memuse + alloc > a->memcap) {
+        SCCtrlMutexUnlock(&a->mutex);
+        return NULL;
+    }
+    a->memuse += alloc;
+    SCCtrlMutexUnlock(&a->mutex);
+
+    b = SCMalloc(alloc);
+    if (unlikely(b == NULL)) {
+        SCCtrlMutexLock(&a->mutex);
+        a->memuse -= alloc;
+        SCCtrlMutexUnlock(&a->mutex);
+        return NULL;
+    }
+    (void)SC_ATOMIC_ADD(logfile_async_memuse, alloc);
+    b->next = NULL;
+    b->size = size;
+    b->offset = 0;
+    return b;
+}
+
+/**
+ *  \brief Write function of a LogFileCtx in async mode
+ *
+ *  Copies the record into the buffer of the calling thread's shard. The
+ *  fp_mutex is not needed.
+ *
+ *  \retval 1 record queued
+ *  \retval 0 record dropped
+ */
+int LogFileAsyncWrite(const char *buffer, int buffer_len, LogFileCtx *log_ctx)
+{
+    LogFileAsync *a = log_ctx->async;
+    LogFileAsyncShard *s = LogFileAsyncGetShard(a);
+    uint32_t len = (uint32_t)buffer_len;
+
+    if (buffer_len <= 0)
+        return 0;
+
+    SCMutexLock(&s->mutex);
+    LogFileAsyncBuf *b = s->buf;
+    if (b == NULL || b->size - b->offset < len) {
+        b = s->buf = LogFileAsyncBufGet(a, b, len);
+        if (b == NULL) {
+            SCMutexUnlock(&s->mutex);
+            (void)SC_ATOMIC_ADD(logfile_async_drops, 1);
+            return 0;
+        }
+    }
+    memcpy(b->data + b->offset, buffer, len);
+    b->offset += len;
+    SCMutexUnlock(&s->mutex);
+    return 1;
+}
+
+/** \internal
+ *  \brief queue the partially filled buffers of all shards
+ *
+ *  The shard lock is held while queueing so that the buffers of a shard
+ *  are queued in the order they were filled.
+ */
+static void LogFileAsyncFlushShards(LogFileAsync *a)
+{
+    int i;
+    for (i = 0; i < LOGFILE_ASYNC_SHARDS; i++) {
+        LogFileAsyncShard *s = &a->shards[i];
+        SCMutexLock(&s->mutex);
+        if (s->buf != NULL && s->buf->offset > 0) {
+            SCCtrlMutexLock(&a->mutex);
+            LogFileAsyncBufQueue(a, s->buf);
+            SCCtrlMutexUnlock(&a->mutex);
+            s->buf = NULL;
+        }
+        SCMutexUnlock(&s->mutex);
+    }
+}
+
+/** \internal
+ *  \brief write a list of buffers to the file and release them */
+static void LogFileAsyncWriteList(LogFileAsync *a, LogFileAsyncBuf *list)
+{
+    LogFileCtx *log_ctx = a->log_ctx;
+    struct iovec iov[LOGFILE_ASYNC_MAX_IOV];
+
+    /* Check for rotation. Only this thread touches the fp. */
+    if (log_ctx->rotation_flag) {
+        log_ctx->rotation_flag = 0;
+        SCConfLogReopen(log_ctx);
+    }
+    int fd = log_ctx->fp ? fileno(log_ctx->fp) : -1;
+
+    LogFileAsyncBuf *b = list;
+    while (b != NULL) {
+        int cnt = 0;
+        LogFileAsyncBuf *n = b;
+        while (n != NULL && cnt < LOGFILE_ASYNC_MAX_IOV) {
+            iov[cnt].iov_base = n->data;
+            iov[cnt].iov_len = n->offset;
+            cnt++;
+            n = n->next;
+        }
+
+        struct iovec *v = iov;
+        while (fd != -1 && cnt > 0) {
+            ssize_t r = writev(fd, v, cnt);
+            (void)SC_ATOMIC_ADD(logfile_async_writes, 1);
+            if (r == -1) {
+                if (errno == EINTR)
+                    continue;
+                SCLogDebug("write to %s failed: %s", log_ctx->filename,
+                        strerror(errno));
+                break;
+            }
+
+            size_t done = (size_t)r;
+            while (cnt > 0 && done >= v->iov_len) {
+                done -= v->iov_len;
+                v++;
+                cnt--;
+            }
+            if (cnt > 0) {
+                v->iov_base = (uint8_t *)v->iov_base + done;
+                v->iov_len -= done;
+            }
+        }
+
+        SCCtrlMutexLock(&a->mutex);
+        while (b != n) {
+            LogFileAsyncBuf *next = b->next;
+            LogFileAsyncBufRelease(a, b);
+            b = next;
+        }
+        SCCtrlMutexUnlock(&a->mutex);
+    }
+}
+
+static void *LogFileAsyncThread(void *arg)
+{
+    LogFileAsync *a = (LogFileAsync *)arg;
+    struct timeval tv;
+    struct timespec deadline;
+
+    /* usr2 is handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+
+    if (SCSetThreadName("LogWriter") < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    gettimeofday(&tv, NULL);
+    deadline.tv_sec = tv.tv_sec + a->flush_interval / 1000;
+    deadline.tv_nsec = tv.tv_usec * 1000 + (a->flush_interval % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while (1) {
+        SCCtrlMutexLock(&a->mutex);
+        while (a->full_head == NULL && a->stop == 0) {
+            if (SCCtrlCondTimedwait(&a->cond, &a->mutex, &deadline) == ETIMEDOUT)
+                break;
+        }
+        int stop = a->stop;
+        SCCtrlMutexUnlock(&a->mutex);
+
+        /* the deadline is checked also when the writer is kept busy by
+         * full buffers, so slow shards don't wait forever */
+        gettimeofday(&tv, NULL);
+        if (stop || tv.tv_sec > deadline.tv_sec ||
+            (tv.tv_sec == deadline.tv_sec &&
+             tv.tv_usec * 1000 >= deadline.tv_nsec))
+        {
+            LogFileAsyncFlushShards(a);
+
+            deadline.tv_sec = tv.tv_sec + a->flush_interval / 1000;
+            deadline.tv_nsec = tv.tv_usec * 1000 +
+                (a->flush_interval % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+        }
+
+        SCCtrlMutexLock(&a->mutex);
+        LogFileAsyncBuf *list = a->full_head;
+        a->full_head = a->full_tail = NULL;
+        SCCtrlMutexUnlock(&a->mutex);
+
+        if (list != NULL)
+            LogFileAsyncWriteList(a, list);
+
+        if (stop)
+            break;
+    }
+    return NULL;
+}
+
+/**
+ *  \brief Switch a LogFileCtx to async output
+ *
+ *  \param log_ctx ctx of an opened regular file
+ *  \param buffer_size size of the per shard buffers
+ *  \param flush_interval max time in msec records wait in a buffer
+ *  \param memcap max memory used by the buffers
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, log_ctx is unchanged
+ */
+int LogFileAsyncInit(LogFileCtx *log_ctx, uint32_t buffer_size,
+        uint32_t flush_interval, uint64_t memcap)
+{
+    if (log_ctx->async != NULL || !log_ctx->is_regular || log_ctx->fp == NULL)
+        return -1;
+    if (buffer_size == 0 || flush_interval == 0 || memcap < buffer_size)
+        return -1;
+
+    if (!counters_registered) {
+        SC_ATOMIC_INIT(logfile_async_memuse);
+        SC_ATOMIC_INIT(logfile_async_drops);
+        SC_ATOMIC_INIT(logfile_async_writes);
+
+        StatsRegisterGlobalCounter("logging.async.memuse",
+                LogFileAsyncMemuseCounter);
+        StatsRegisterGlobalCounter("logging.async.drops",
+                LogFileAsyncDropsCounter);
+        StatsRegisterGlobalCounter("logging.async.writes",
+                LogFileAsyncWritesCounter);
+        counters_registered = 1;
+    }
+
+    LogFileAsync *a = SCMallocAligned(sizeof(LogFileAsync), CLS);
+    if (unlikely(a == NULL))
+        return -1;
+    memset(a, 0, sizeof(*a));
+
+    int i;
+    for (i = 0; i < LOGFILE_ASYNC_SHARDS; i++)
+        SCMutexInit(&a->shards[i].mutex, NULL);
+    SCCtrlMutexInit(&a->mutex, NULL);
+    SCCtrlCondInit(&a->cond, NULL);
+    a->log_ctx = log_ctx;
+    a->buffer_size = buffer_size;
+    a->flush_interval = flush_interval;
+    a->memcap = memcap;
+
+    /* from here on the file is written with writev only */
+    fflush(log_ctx->fp);
+
+    if (pthread_create(&a->thread, NULL, LogFileAsyncThread, a) != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "failed to start log writer "
+                "thread: %s", strerror(errno));
+        for (i = 0; i < LOGFILE_ASYNC_SHARDS; i++)
+            SCMutexDestroy(&a->shards[i].mutex);
+        SCCtrlMutexDestroy(&a->mutex);
+        SCCtrlCondDestroy(&a->cond);
+        SCFreeAligned(a);
+        return -1;
+    }
+
+    log_ctx->async = a;
+    log_ctx->Write = LogFileAsyncWrite;
+    return 0;
+}
+
+/**
+ *  \brief Write out all buffered records and stop the writer thread
+ *
+ *  Must be called before the file is closed, when no more records are
+ *  written to log_ctx.
+ */
+void LogFileAsyncFree(LogFileCtx *log_ctx)
+{
+    LogFileAsync *a = log_ctx->async;
+    if (a == NULL)
+        return;
+
+    SCCtrlMutexLock(&a->mutex);
+    a->stop = 1;
+    SCCtrlCondSignal(&a->cond);
+    SCCtrlMutexUnlock(&a->mutex);
+    pthread_join(a->thread, NULL);
+
+    int i;
+    for (i = 0; i < LOGFILE_ASYNC_SHARDS; i++) {
+        /* only empty buffers are left */
+        if (a->shards[i].buf != NULL)
+            LogFileAsyncBufRelease(a, a->shards[i].buf);
+        SCMutexDestroy(&a->shards[i].mutex);
+    }
+    while (a->spare != NULL) {
+        LogFileAsyncBuf *b = a->spare;
+        a->spare = b->next;
+        a->memuse -= sizeof(LogFileAsyncBuf) + b->size;
+        (void)SC_ATOMIC_SUB(logfile_async_memuse, sizeof(LogFileAsyncBuf) + b->size);
+        SCFree(b);
+    }
+    SCCtrlMutexDestroy(&a->mutex);
+    SCCtrlCondDestroy(&a->cond);
+
+    log_ctx->async = NULL;
+    SCFreeAligned(a);
+}
+
+/**
+ *  \brief Enable async output for a log file if configured
+ *
+ *  \param conf output node, the settings are read from its "async" child
+ *  \param log_ctx ctx opened by SCConfLogOpenGeneric
+ *
+ *  \retval 0 ok, also if async output is not enabled
+ *  \retval -1 error
+ */
+int LogFileAsyncSetup(ConfNode *conf, LogFileCtx *log_ctx)
+{
+    ConfNode *node = ConfNodeLookupChild(conf, "async");
+    int enabled = 0;
+
+    if (node == NULL || !ConfGetChildValueBool(node, "enabled", &enabled) ||
+        !enabled)
+        return 0;
+
+    if (log_ctx->threads != NULL) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.async is not used "
+                "in threaded mode, ignoring", conf->name);
+        return 0;
+    }
+    if (!log_ctx->is_regular) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.async is only "
+                "supported for regular files, ignoring", conf->name);
+        return 0;
+    }
+
+    uint32_t buffer_size = LOGFILE_ASYNC_DEFAULT_BUFFER_SIZE;
+    uint64_t memcap = LOGFILE_ASYNC_DEFAULT_MEMCAP;
+    intmax_t flush_interval = LOGFILE_ASYNC_DEFAULT_FLUSH_INTERVAL;
+
+    const char *val = ConfNodeLookupChildValue(node, "buffer-size");
+    if (val != NULL && (ParseSizeStringU32(val, &buffer_size) < 0 ||
+                        buffer_size == 0)) {
+        SCLogError(SC_ERR_SIZE_PARSE, "Error parsing %s.async.buffer-size "
+                "from conf file - %s", conf->name, val);
+        return -1;
+    }
+    val = ConfNodeLookupChildValue(node, "memcap");
+    if (val != NULL && ParseSizeStringU64(val, &memcap) < 0) {
+        SCLogError(SC_ERR_SIZE_PARSE, "Error parsing %s.async.memcap "
+                "from conf file - %s", conf->name, val);
+        return -1;
+    }
+    if (ConfNodeLookupChild(node, "flush-interval") != NULL &&
+        (!ConfGetChildValueInt(node, "flush-interval", &flush_interval) ||
+         flush_interval <= 0 || flush_interval > UINT32_MAX)) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid value for "
+                "%s.async.flush-interval, expected msec > 0", conf->name);
+        return -1;
+    }
+    if (memcap < buffer_size) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.async.memcap "
+                "%"PRIu64" is smaller than buffer-size %u", conf->name,
+                memcap, buffer_size);
+        return -1;
+    }
+
+    if (LogFileAsyncInit(log_ctx, buffer_size, (uint32_t)flush_interval,
+                memcap) != 0)
+        return -1;
+
+    SCLogConfig("%s: async output, buffer-size %u, flush-interval %u ms, "
+            "memcap %"PRIu64, conf->name, buffer_size,
+            (uint32_t)flush_interval, memcap);
+    return 0;
+}
+
+#ifdef UNITTESTS
+#define LOGFILE_ASYNC_TEST_THREADS  4
+#define LOGFILE_ASYNC_TEST_RECORDS  5000
+
+static LogFileCtx *LogFileAsyncTestCtx(char *path)
+{
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return NULL;
+    close(fd);
+
+    LogFileCtx *log_ctx = LogFileNewCtx();
+    if (log_ctx == NULL)
+        return NULL;
+    log_ctx->fp = fopen(path, "w");
+    log_ctx->filename = SCStrdup(path);
+    log_ctx->is_regular = 1;
+    log_ctx->type = LOGFILE_TYPE_FILE;
+    if (log_ctx->fp == NULL || log_ctx->filename == NULL) {
+        LogFileFreeCtx(log_ctx);
+        return NULL;
+    }
+    return log_ctx;
+}
+
+static char *LogFileAsyncTestRead(const char *path, size_t *len)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return NULL;
+    char *buf = SCCalloc(1, 1024 * 1024);
+    if (buf == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    *len = fread(buf, 1, 1024 * 1024 - 1, fp);
+    fclose(fp);
+    unlink(path);
+    return buf;
+}
+
+static void *LogFileAsyncTestThread(void *arg)
+{
+    LogFileCtx *log_ctx = arg;
+    char rec[32];
+    int i;
+
+    for (i = 0; i < LOGFILE_ASYNC_TEST_RECORDS; i++) {
+        snprintf(rec, sizeof(rec), "%p:%05d\n", (void *)pthread_self(), i);
+        log_ctx->Write(rec, (int)strlen(rec), log_ctx);
+    }
+    return NULL;
+}
+
+/** \test records of concurrent threads are all written, complete and in
+ *        order per thread */
+static int LogFileAsyncTest01(void)
+{
+    char path[] = "/tmp/suricata-logfile-XXXXXX";
+    LogFileCtx *log_ctx = LogFileAsyncTestCtx(path);
+    FAIL_IF_NULL(log_ctx);
+    FAIL_IF(LogFileAsyncInit(log_ctx, 256, 5, 1024 * 1024) != 0);
+    FAIL_IF(log_ctx->Write != LogFileAsyncWrite);
+
+    pthread_t threads[LOGFILE_ASYNC_TEST_THREADS];
+    int i;
+    for (i = 0; i < LOGFILE_ASYNC_TEST_THREADS; i++)
+        FAIL_IF(pthread_create(&threads[i], NULL, LogFileAsyncTestThread,
+                    log_ctx) != 0);
+    for (i = 0; i < LOGFILE_ASYNC_TEST_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    LogFileFreeCtx(log_ctx);
+
+    size_t len = 0;
+    char *data = LogFileAsyncTestRead(path, &len);
+    FAIL_IF_NULL(data);
+
+    /* per thread the next expected record */
+    void *ids[LOGFILE_ASYNC_TEST_THREADS] = { NULL };
+    int next[LOGFILE_ASYNC_TEST_THREADS] = { 0 };
+    int lines = 0;
+    char *line = data;
+    char *nl;
+    while ((nl = strchr(line, '\n')) != NULL) {
+        *nl = '\0';
+        void *id = NULL;
+        int seq = -1;
+        FAIL_IF(sscanf(line, "%p:%d", &id, &seq) != 2);
+        for (i = 0; i < LOGFILE_ASYNC_TEST_THREADS; i++) {
+            if (ids[i] == NULL)
+                ids[i] = id;
+            if (ids[i] == id)
+                break;
+        }
+        FAIL_IF(i == LOGFILE_ASYNC_TEST_THREADS);
+        FAIL_IF(seq != next[i]);
+        next[i]++;
+        lines++;
+        line = nl + 1;
+    }
+    FAIL_IF(*line != '\0');
+    FAIL_IF(lines != LOGFILE_ASYNC_TEST_THREADS * LOGFILE_ASYNC_TEST_RECORDS);
+    SCFree(data);
+    PASS;
+}
+
+/** \test a record larger than the buffer size is written in one piece, a
+ *        record larger than the memcap is dropped */
+static int LogFileAsyncTest02(void)
+{
+    char path[] = "/tmp/suricata-logfile-XXXXXX";
+    LogFileCtx *log_ctx = LogFileAsyncTestCtx(path);
+    FAIL_IF_NULL(log_ctx);
+    FAIL_IF(LogFileAsyncInit(log_ctx, 64, 1000, 8192) != 0);
+    uint64_t drops = SC_ATOMIC_GET(logfile_async_drops);
+
+    char big[4000];
+    memset(big, 'x', sizeof(big));
+    big[sizeof(big) - 1] = '\n';
+    char huge[10000];
+    memset(huge, 'y', sizeof(huge));
+
+    FAIL_IF(log_ctx->Write("first\n", 6, log_ctx) != 1);
+    FAIL_IF(log_ctx->Write(big, sizeof(big), log_ctx) != 1);
+    FAIL_IF(log_ctx->Write(huge, sizeof(huge), log_ctx) != 0);
+    FAIL_IF(log_ctx->Write("last\n", 5, log_ctx) != 1);
+    FAIL_IF(SC_ATOMIC_GET(logfile_async_drops) != drops + 1);
+
+    LogFileFreeCtx(log_ctx);
+
+    size_t len = 0;
+    char *data = LogFileAsyncTestRead(path, &len);
+    FAIL_IF_NULL(data);
+    FAIL_IF(len != 6 + sizeof(big) + 5);
+    FAIL_IF(memcmp(data, "first\n", 6) != 0);
+    FAIL_IF(memcmp(data + 6, big, sizeof(big)) != 0);
+    FAIL_IF(memcmp(data + 6 + sizeof(big), "last\n", 5) != 0);
+    SCFree(data);
+    PASS;
+}
+
+/** \test on rotation the records written after the file was moved go to
+ *        the reopened file */
+static int LogFileAsyncTest03(void)
+{
+    char path[] = "/tmp/suricata-logfile-XXXXXX";
+    LogFileCtx *log_ctx = LogFileAsyncTestCtx(path);
+    FAIL_IF_NULL(log_ctx);
+    FAIL_IF(LogFileAsyncInit(log_ctx, 1024, 1, 1024 * 1024) != 0);
+
+    FAIL_IF(log_ctx->Write("before\n", 7, log_ctx) != 1);
+    /* wait for the writer to flush the record */
+    struct stat st;
+    int i;
+    for (i = 0; i < 1000; i++) {
+        FAIL_IF(stat(path, &st) != 0);
+        if (st.st_size == 7)
+            break;
+        usleep(1000);
+    }
+    FAIL_IF(st.st_size != 7);
+
+    char rotated[PATH_MAX];
+    snprintf(rotated, sizeof(rotated), "%s.1", path);
+    FAIL_IF(rename(path, rotated) != 0);
+    log_ctx->rotation_flag = 1;
+    FAIL_IF(log_ctx->Write("after\n", 6, log_ctx) != 1);
+
+    LogFileFreeCtx(log_ctx);
+
+    size_t len = 0;
+    char *data = LogFileAsyncTestRead(rotated, &len);
+    FAIL_IF_NULL(data);
+    FAIL_IF(strcmp(data, "before\n") != 0);
+    SCFree(data);
+    data = LogFileAsyncTestRead(path, &len);
+    FAIL_IF_NULL(data);
+    FAIL_IF(strcmp(data, "after\n") != 0);
+    SCFree(data);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void LogFileAsyncRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LogFileAsyncTest01", LogFileAsyncTest01);
+    UtRegisterTest("LogFileAsyncTest02", LogFileAsyncTest02);
+    UtRegisterTest("LogFileAsyncTest03", LogFileAsyncTest03);
+#endif
+}
@@ -0,0 +1,38 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __UTIL_LOGOPENFILE_ASYNC_H__
+#define __UTIL_LOGOPENFILE_ASYNC_H__
+
+#include "util-logopenfile.h"
+
+#define LOGFILE_ASYNC_DEFAULT_BUFFER_SIZE       (64 * 1024)
+#define LOGFILE_ASYNC_DEFAULT_FLUSH_INTERVAL    100     /**< msec */
+#define LOGFILE_ASYNC_DEFAULT_MEMCAP            (32 * 1024 * 1024)
+
+int LogFileAsyncSetup(ConfNode *conf, LogFileCtx *log_ctx);
+int LogFileAsyncInit(LogFileCtx *log_ctx, uint32_t buffer_size,
+        uint32_t flush_interval, uint64_t memcap);
+void LogFileAsyncFree(LogFileCtx *log_ctx);
+int LogFileAsyncWrite(const char *buffer, int buffer_len, LogFileCtx *log_ctx);
+void LogFileAsyncRegisterTests(void);
+
+#endif /* __UTIL_LOGOPENFILE_ASYNC_H__ */
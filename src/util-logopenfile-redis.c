@@ -0,0 +1,948 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Async output mode for redis.
+ *
+ * The logging threads copy their records into a bounded queue and return
+ * without touching the network. A dedicated I/O thread owns the redis
+ * connection: it sends up to batch-size commands back to back, then
+ * reads their replies, so a round trip is paid per batch instead of per
+ * record.
+ *
+ * A record is released only once its reply was read. If the connection
+ * is lost the unacknowledged records are sent again after reconnecting,
+ * so a record may reach the server twice but is not lost. Reconnects are
+ * retried with an exponential backoff.
+ *
+ * When the queue is full the record is dropped and counted, or with the
+ * block policy the logging thread waits until the I/O thread made room.
+ */
+
+#include "suricata-common.h"
+#include "threads.h"
+#include "counters.h"
+#include "conf.h"
+
+#include "util-logopenfile.h"
+#include "util-logopenfile-redis.h"
+
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-misc.h"
+#include "util-signal.h"
+#include "util-unittest.h"
+
+#ifdef HAVE_LIBHIREDIS
+
+/** size of the queue chunks, larger records get a chunk of their own */
+#define LOGFILE_REDIS_CHUNK_SIZE    (64 * 1024)
+/** chunks kept for reuse */
+#define LOGFILE_REDIS_MAX_SPARE     4
+/** reconnect backoff, msec */
+#define LOGFILE_REDIS_BACKOFF_MIN   100
+#define LOGFILE_REDIS_BACKOFF_MAX   10000
+/** connect and reply timeout, sec */
+#define LOGFILE_REDIS_TIMEOUT       5
+
+/** queue chunk, holds records as a 32 bit length followed by the data */
+typedef struct LogFileRedisChunk_ {
+    struct LogFileRedisChunk_ *next;
+    uint32_t size;
+    uint32_t offset;
+    uint8_t data[];
+} LogFileRedisChunk;
+
+typedef struct LogFileRedisAsync_ {
+    LogFileCtx *log_ctx;
+    uint64_t queue_size;
+    enum LogFileRedisPolicy policy;
+    int batch_size;
+
+    /* protects the members below */
+    SCCtrlMutex mutex;
+    SCCtrlCondT cond;           /**< wakes the I/O thread */
+    SCCtrlCondT space_cond;     /**< wakes threads waiting for room */
+    LogFileRedisChunk *head;
+    LogFileRedisChunk *tail;
+    LogFileRedisChunk *spare;
+    uint32_t spare_cnt;
+    uint64_t memuse;
+    int waiting;                /**< I/O thread sleeps on cond */
+    int stop;
+
+    /* only used by the I/O thread */
+    redisContext *c;
+    uint32_t backoff;           /**< msec */
+    int connected;              /**< was connected before */
+    int failed;                 /**< connect failure was logged */
+    int reply_error;            /**< error reply was logged */
+
+    pthread_t thread;
+} LogFileRedisAsync;
+
+SC_ATOMIC_DECLARE(uint64_t, logfile_redis_memuse);
+SC_ATOMIC_DECLARE(uint64_t, logfile_redis_drops);
+SC_ATOMIC_DECLARE(uint64_t, logfile_redis_reconnects);
+static int counters_registered = 0;
+
+static uint64_t LogFileRedisMemuseCounter(void)
+{
+    return SC_ATOMIC_GET(logfile_redis_memuse);
+}
+
+static uint64_t LogFileRedisDropsCounter(void)
+{
+    return SC_ATOMIC_GET(logfile_redis_drops);
+}
+
+static uint64_t LogFileRedisReconnectsCounter(void)
+{
+    return SC_ATOMIC_GET(logfile_redis_reconnects);
+}
+
+/** \internal
+ *  \brief return a chunk to the spare list or free it
+ *
+ *  \note a->mutex must be held
+ */
+static void LogFileRedisChunkRelease(LogFileRedisAsync *a, LogFileRedisChunk *c)
+{
+    if (c->size == LOGFILE_REDIS_CHUNK_SIZE &&
+        a->spare_cnt < LOGFILE_REDIS_MAX_SPARE) {
+        c->offset = 0;
+        c->next = a->spare;
+        a->spare = c;
+        a->spare_cnt++;
+        return;
+    }
+
+    uint64_t size = sizeof(LogFileRedisChunk) + c->size;
+    a->memuse -= size;
+    (void)SC_ATOMIC_SUB(logfile_redis_memuse, size);
+    SCFree(c);
+}
+
+/** \internal
+ *  \brief append a new chunk with room for len bytes to the queue
+ *
+ *  \note a->mutex must be held
+ *
+ *  \retval c the new tail of the queue
+ *  \retval NULL queue is full or allocation failed
+ */
+static LogFileRedisChunk *LogFileRedisChunkGet(LogFileRedisAsync *a,
+        uint32_t len)
+{
+    uint32_t size = MAX(LOGFILE_REDIS_CHUNK_SIZE, len);
+    LogFileRedisChunk *c = NULL;
+
+    if (size == LOGFILE_REDIS_CHUNK_SIZE && a->spare != NULL) {
+        c = a->spare;
+        a->spare = c->next;
+        a->spare_cnt--;
+    } else {
+        uint64_t alloc = sizeof(LogFileRedisChunk) + size;
+        /* spare chunks must not keep a large record out forever */
+        while (a->memuse + alloc > a->queue_size && a->spare != NULL) {
+            LogFileRedisChunk *s = a->spare;
+            a->spare = s->next;
+            a->spare_cnt--;
+            a->memuse -= sizeof(LogFileRedisChunk) + s->size;
+            (void)SC_ATOMIC_SUB(logfile_redis_memuse,
+                    sizeof(LogFileRedisChunk) + s->size);
+            SCFree(s);
+        }
+        if (a->memuse + alloc > a->queue_size)
+            return NULL;
+        c = SCMalloc(alloc);
+        if (unlikely(c == NULL))
+            return NULL;
+        a->memuse += alloc;
+        (void)SC_ATOMIC_ADD(logfile_redis_memuse, alloc);
+        c->size = size;
+    }
+
+    c->next = NULL;
+    c->offset = 0;
+    if (a->tail == NULL) {
+        a->head = c;
+    } else {
+        a->tail->next = c;
+    }
+    a->tail = c;
+    return c;
+}
+
+/**
+ *  \brief Queue a record for the redis I/O thread
+ *
+ *  The fp_mutex is not needed.
+ *
+ *  \retval 1 record queued
+ *  \retval 0 record dropped
+ */
+int LogFileRedisAsyncWrite(LogFileCtx *log_ctx, const char *buffer,
+        size_t buffer_len)
+{
+    LogFileRedisAsync *a = log_ctx->redis_setup.async;
+
+    if (buffer_len == 0)
+        return 0;
+    /* can never fit, don't let a blocking writer wait for it */
+    if (buffer_len > UINT32_MAX - sizeof(uint32_t) ||
+        buffer_len > a->queue_size - sizeof(LogFileRedisChunk) -
+                     sizeof(uint32_t)) {
+        (void)SC_ATOMIC_ADD(logfile_redis_drops, 1);
+        return 0;
+    }
+    uint32_t len = (uint32_t)buffer_len;
+    uint32_t need = sizeof(len) + len;
+
+    SCCtrlMutexLock(&a->mutex);
+    LogFileRedisChunk *c = a->tail;
+    while (c == NULL || c->size - c->offset < need) {
+        c = LogFileRedisChunkGet(a, need);
+        if (c != NULL)
+            break;
+        if (a->policy != LOGFILE_REDIS_POLICY_BLOCK || a->stop) {
+            SCCtrlMutexUnlock(&a->mutex);
+            (void)SC_ATOMIC_ADD(logfile_redis_drops, 1);
+            return 0;
+        }
+        SCCtrlCondWait(&a->space_cond, &a->mutex);
+        c = a->tail;
+    }
+    memcpy(c->data + c->offset, &len, sizeof(len));
+    memcpy(c->data + c->offset + sizeof(len), buffer, len);
+    c->offset += need;
+    if (a->waiting) {
+        a->waiting = 0;
+        SCCtrlCondSignal(&a->cond);
+    }
+    SCCtrlMutexUnlock(&a->mutex);
+    return 1;
+}
+
+static int LogFileRedisAsyncStopping(LogFileRedisAsync *a)
+{
+    SCCtrlMutexLock(&a->mutex);
+    int stop = a->stop;
+    SCCtrlMutexUnlock(&a->mutex);
+    return stop;
+}
+
+/** \internal
+ *  \brief release a list of chunks and wake up blocked writers */
+static void LogFileRedisAsyncReleaseList(LogFileRedisAsync *a,
+        LogFileRedisChunk *c, LogFileRedisChunk *end)
+{
+    SCCtrlMutexLock(&a->mutex);
+    while (c != end) {
+        LogFileRedisChunk *next = c->next;
+        LogFileRedisChunkRelease(a, c);
+        c = next;
+    }
+    pthread_cond_broadcast(&a->space_cond);
+    SCCtrlMutexUnlock(&a->mutex);
+}
+
+static int LogFileRedisAsyncConnect(LogFileRedisAsync *a)
+{
+    RedisSetup *setup = &a->log_ctx->redis_setup;
+    struct timeval timeout = { LOGFILE_REDIS_TIMEOUT, 0 };
+
+    redisContext *c = redisConnectWithTimeout(setup->server, setup->port,
+            timeout);
+    if (c == NULL || c->err) {
+        if (!a->failed) {
+            SCLogError(SC_ERR_SOCKET, "Error connecting to redis server "
+                    "%s:%d: %s, retrying", setup->server, setup->port,
+                    c != NULL ? c->errstr : "out of memory");
+            a->failed = 1;
+        }
+        if (c != NULL)
+            redisFree(c);
+        return -1;
+    }
+    redisSetTimeout(c, timeout);
+
+    if (a->connected) {
+        (void)SC_ATOMIC_ADD(logfile_redis_reconnects, 1);
+        SCLogInfo("Reconnected to redis server %s:%d", setup->server,
+                setup->port);
+    }
+    a->connected = 1;
+    a->failed = 0;
+    a->backoff = LOGFILE_REDIS_BACKOFF_MIN;
+    a->c = c;
+    return 0;
+}
+
+/** \internal
+ *  \brief sleep before the next connect attempt, returns early on stop */
+static void LogFileRedisAsyncBackoff(LogFileRedisAsync *a)
+{
+    struct timeval tv;
+    struct timespec deadline;
+
+    gettimeofday(&tv, NULL);
+    deadline.tv_sec = tv.tv_sec + a->backoff / 1000;
+    deadline.tv_nsec = tv.tv_usec * 1000 + (a->backoff % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    SCCtrlMutexLock(&a->mutex);
+    while (a->stop == 0) {
+        if (SCCtrlCondTimedwait(&a->cond, &a->mutex, &deadline) == ETIMEDOUT)
+            break;
+    }
+    SCCtrlMutexUnlock(&a->mutex);
+
+    a->backoff = MIN(a->backoff * 2, LOGFILE_REDIS_BACKOFF_MAX);
+}
+
+/** \internal
+ *  \brief send the records of a list of chunks and release them
+ *
+ *  Returns when all records are acknowledged, or when stopping without
+ *  a connection. In the latter case the remaining records are dropped.
+ */
+static void LogFileRedisAsyncSend(LogFileRedisAsync *a, LogFileRedisChunk *list)
+{
+    RedisSetup *setup = &a->log_ctx->redis_setup;
+    /* first record not acknowledged yet */
+    LogFileRedisChunk *c = list;
+    uint32_t pos = 0;
+
+    while (c != NULL) {
+        if (a->c == NULL && LogFileRedisAsyncConnect(a) != 0) {
+            if (!LogFileRedisAsyncStopping(a)) {
+                LogFileRedisAsyncBackoff(a);
+                continue;
+            }
+
+            uint64_t dropped = 0;
+            LogFileRedisChunk *n;
+            for (n = c; n != NULL; n = n->next) {
+                for ( ; pos < n->offset; dropped++) {
+                    uint32_t len;
+                    memcpy(&len, n->data + pos, sizeof(len));
+                    pos += sizeof(len) + len;
+                }
+                pos = 0;
+            }
+            (void)SC_ATOMIC_ADD(logfile_redis_drops, dropped);
+            SCLogWarning(SC_ERR_SOCKET, "redis server %s:%d unreachable, "
+                    "dropped %"PRIu64" records on shutdown", setup->server,
+                    setup->port, dropped);
+            break;
+        }
+
+        /* send a batch without waiting for the replies */
+        LogFileRedisChunk *n = c;
+        uint32_t npos = pos;
+        int cnt = 0;
+        while (n != NULL && cnt < a->batch_size) {
+            if (npos >= n->offset) {
+                n = n->next;
+                npos = 0;
+                continue;
+            }
+            uint32_t len;
+            memcpy(&len, n->data + npos, sizeof(len));
+            redisAppendCommand(a->c, "%s %s %b", setup->command, setup->key,
+                    n->data + npos + sizeof(len), (size_t)len);
+            npos += sizeof(len) + len;
+            cnt++;
+        }
+
+        /* the replies come in order, each one acknowledges a record */
+        LogFileRedisChunk *done = c;
+        int i;
+        for (i = 0; i < cnt; i++) {
+            redisReply *reply = NULL;
+            if (redisGetReply(a->c, (void **)&reply) != REDIS_OK) {
+                SCLogWarning(SC_ERR_SOCKET, "Error when fetching reply from "
+                        "redis server: %s (%d), reconnecting", a->c->errstr,
+                        a->c->err);
+                redisFree(a->c);
+                a->c = NULL;
+                break;
+            }
+            if (reply->type == REDIS_REPLY_ERROR) {
+                if (!a->reply_error) {
+                    SCLogWarning(SC_ERR_SOCKET, "Redis error: %s", reply->str);
+                    a->reply_error = 1;
+                }
+            } else {
+                a->reply_error = 0;
+            }
+            freeReplyObject(reply);
+
+            uint32_t len;
+            memcpy(&len, c->data + pos, sizeof(len));
+            pos += sizeof(len) + len;
+            if (pos >= c->offset) {
+                c = c->next;
+                pos = 0;
+            }
+        }
+        if (done != c)
+            LogFileRedisAsyncReleaseList(a, done, c);
+    }
+
+    if (c != NULL)
+        LogFileRedisAsyncReleaseList(a, c, NULL);
+}
+
+static void *LogFileRedisAsyncThread(void *arg)
+{
+    LogFileRedisAsync *a = (LogFileRedisAsync *)arg;
+
+    /* usr2 is handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+
+    if (SCSetThreadName("LogRedis") < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    while (1) {
+        SCCtrlMutexLock(&a->mutex);
+        while (a->head == NULL && a->stop == 0) {
+            a->waiting = 1;
+            SCCtrlCondWait(&a->cond, &a->mutex);
+        }
+        a->waiting = 0;
+        LogFileRedisChunk *list = a->head;
+        a->head = a->tail = NULL;
+        SCCtrlMutexUnlock(&a->mutex);
+
+        /* on stop the loop runs until the queue is drained */
+        if (list == NULL)
+            break;
+        LogFileRedisAsyncSend(a, list);
+    }
+
+    if (a->c != NULL) {
+        redisFree(a->c);
+        a->c = NULL;
+    }
+    return NULL;
+}
+
+/**
+ *  \brief Switch a redis LogFileCtx to async output
+ *
+ *  The server, port, command, key and batch_size of the redis_setup
+ *  must be set. The connection is made by the I/O thread.
+ *
+ *  \param log_ctx ctx of a redis output that is not connected
+ *  \param queue_size max memory used by the queued records
+ *  \param policy what to do with a record when the queue is full
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, log_ctx is unchanged
+ */
+int LogFileRedisAsyncInit(LogFileCtx *log_ctx, uint64_t queue_size,
+        enum LogFileRedisPolicy policy)
+{
+    RedisSetup *setup = &log_ctx->redis_setup;
+
+    if (setup->async != NULL || log_ctx->redis != NULL)
+        return -1;
+    if (setup->server == NULL || setup->key == NULL || setup->command == NULL)
+        return -1;
+    if (queue_size < sizeof(LogFileRedisChunk) + LOGFILE_REDIS_CHUNK_SIZE)
+        return -1;
+
+    if (!counters_registered) {
+        SC_ATOMIC_INIT(logfile_redis_memuse);
+        SC_ATOMIC_INIT(logfile_redis_drops);
+        SC_ATOMIC_INIT(logfile_redis_reconnects);
+
+        StatsRegisterGlobalCounter("logging.redis.memuse",
+                LogFileRedisMemuseCounter);
+        StatsRegisterGlobalCounter("logging.redis.drops",
+                LogFileRedisDropsCounter);
+        StatsRegisterGlobalCounter("logging.redis.reconnects",
+                LogFileRedisReconnectsCounter);
+        counters_registered = 1;
+    }
+
+    LogFileRedisAsync *a = SCMalloc(sizeof(LogFileRedisAsync));
+    if (unlikely(a == NULL))
+        return -1;
+    memset(a, 0, sizeof(*a));
+
+    SCCtrlMutexInit(&a->mutex, NULL);
+    SCCtrlCondInit(&a->cond, NULL);
+    SCCtrlCondInit(&a->space_cond, NULL);
+    a->log_ctx = log_ctx;
+    a->queue_size = queue_size;
+    a->policy = policy;
+    a->batch_size = setup->batch_size > 0 ? setup->batch_size :
+        LOGFILE_REDIS_DEFAULT_BATCH_SIZE;
+    a->backoff = LOGFILE_REDIS_BACKOFF_MIN;
+
+    if (pthread_create(&a->thread, NULL, LogFileRedisAsyncThread, a) != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "failed to start redis output "
+                "thread: %s", strerror(errno));
+        SCCtrlMutexDestroy(&a->mutex);
+        SCCtrlCondDestroy(&a->cond);
+        SCCtrlCondDestroy(&a->space_cond);
+        SCFree(a);
+        return -1;
+    }
+
+    setup->async = a;
+    return 0;
+}
+
+/**
+ *  \brief Send out the queued records and stop the I/O thread
+ *
+ *  Must be called when no more records are written to log_ctx. If the
+ *  server can't be reached the queued records are dropped.
+ */
+void LogFileRedisAsyncFree(LogFileCtx *log_ctx)
+{
+    LogFileRedisAsync *a = log_ctx->redis_setup.async;
+    if (a == NULL)
+        return;
+
+    SCCtrlMutexLock(&a->mutex);
+    a->stop = 1;
+    SCCtrlCondSignal(&a->cond);
+    pthread_cond_broadcast(&a->space_cond);
+    SCCtrlMutexUnlock(&a->mutex);
+    pthread_join(a->thread, NULL);
+
+    while (a->spare != NULL) {
+        LogFileRedisChunk *c = a->spare;
+        a->spare = c->next;
+        a->memuse -= sizeof(LogFileRedisChunk) + c->size;
+        (void)SC_ATOMIC_SUB(logfile_redis_memuse,
+                sizeof(LogFileRedisChunk) + c->size);
+        SCFree(c);
+    }
+    SCCtrlMutexDestroy(&a->mutex);
+    SCCtrlCondDestroy(&a->cond);
+    SCCtrlCondDestroy(&a->space_cond);
+
+    log_ctx->redis_setup.async = NULL;
+    SCFree(a);
+}
+
+/**
+ *  \brief Enable async output for redis if configured
+ *
+ *  \param redis_node redis node, the settings are read from its "async"
+ *                    child
+ *  \param log_ctx ctx with the redis_setup filled in, not connected
+ *
+ *  \retval 1 async output enabled
+ *  \retval 0 async output not enabled
+ *  \retval -1 error
+ */
+int LogFileRedisAsyncSetup(ConfNode *redis_node, LogFileCtx *log_ctx)
+{
+    ConfNode *node = ConfNodeLookupChild(redis_node, "async");
+    int enabled = 0;
+
+    if (node == NULL || !ConfGetChildValueBool(node, "enabled", &enabled) ||
+        !enabled)
+        return 0;
+
+    uint64_t queue_size = LOGFILE_REDIS_DEFAULT_QUEUE_SIZE;
+    enum LogFileRedisPolicy policy = LOGFILE_REDIS_POLICY_DROP;
+
+    const char *val = ConfNodeLookupChildValue(node, "queue-size");
+    if (val != NULL && ParseSizeStringU64(val, &queue_size) < 0) {
+        SCLogError(SC_ERR_SIZE_PARSE, "Error parsing redis.async.queue-size "
+                "from conf file - %s", val);
+        return -1;
+    }
+    if (queue_size < sizeof(LogFileRedisChunk) + LOGFILE_REDIS_CHUNK_SIZE) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "redis.async.queue-size "
+                "%"PRIu64" is too small, minimum is %u", queue_size,
+                (uint32_t)(sizeof(LogFileRedisChunk) + LOGFILE_REDIS_CHUNK_SIZE));
+        return -1;
+    }
+    val = ConfNodeLookupChildValue(node, "policy");
+    if (val != NULL) {
+        if (strcmp(val, "drop") == 0) {
+            policy = LOGFILE_REDIS_POLICY_DROP;
+        } else if (strcmp(val, "block") == 0) {
+            policy = LOGFILE_REDIS_POLICY_BLOCK;
+        } else {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid value for "
+                    "redis.async.policy: %s, expected drop or block", val);
+            return -1;
+        }
+    }
+
+    if (LogFileRedisAsyncInit(log_ctx, queue_size, policy) != 0)
+        return -1;
+
+    SCLogConfig("redis: async output, queue-size %"PRIu64", policy %s, "
+            "batch-size %d", queue_size,
+            policy == LOGFILE_REDIS_POLICY_BLOCK ? "block" : "drop",
+            log_ctx->redis_setup.async->batch_size);
+    return 1;
+}
+
+#ifdef UNITTESTS
+#include <poll.h>
+
+#define LOGFILE_REDIS_TEST_THREADS  3
+#define LOGFILE_REDIS_TEST_RECORDS  2000
+
+/** minimal RESP server, stores the last argument of every command it
+ *  replied to */
+typedef struct LogFileRedisTestServer_ {
+    int fd;
+    int port;
+    /** close the connection after this many replies, 0 never */
+    uint32_t close_after;
+    SC_ATOMIC_DECLARE(int, stop);
+    char **records;
+    uint32_t cnt;
+    pthread_t thread;
+} LogFileRedisTestServer;
+
+/** \internal
+ *  \brief parse a RESP array of bulk strings
+ *
+ *  \retval consumed bytes of a complete command, 0 if incomplete,
+ *          -1 on a protocol error
+ */
+static int LogFileRedisTestParse(const char *buf, int len, char **last)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+    char *eol;
+    int argc, i;
+
+    if (len == 0 || *p != '*')
+        return len == 0 ? 0 : -1;
+    if ((eol = memchr(p, '\n', end - p)) == NULL)
+        return 0;
+    argc = atoi(p + 1);
+    p = eol + 1;
+    for (i = 0; i < argc; i++) {
+        if (p >= end)
+            return 0;
+        if (*p != '$')
+            return -1;
+        if ((eol = memchr(p, '\n', end - p)) == NULL)
+            return 0;
+        int arg_len = atoi(p + 1);
+        p = eol + 1;
+        if (end - p < arg_len + 2)
+            return 0;
+        if (i == argc - 1 && (*last = SCMalloc(arg_len + 1)) != NULL) {
+            memcpy(*last, p, arg_len);
+            (*last)[arg_len] = '\0';
+        }
+        p += arg_len + 2;
+    }
+    return (int)(p - buf);
+}
+
+static int LogFileRedisTestReply(int conn, int cnt)
+{
+    char replies[4 * 256];
+
+    while (cnt > 0) {
+        int n = MIN(cnt, 256);
+        int i;
+        for (i = 0; i < n; i++)
+            memcpy(replies + i * 4, ":1\r\n", 4);
+        if (send(conn, replies, n * 4, MSG_NOSIGNAL) != n * 4)
+            return -1;
+        cnt -= n;
+    }
+    return 0;
+}
+
+static void *LogFileRedisTestServerThread(void *arg)
+{
+    LogFileRedisTestServer *s = arg;
+    struct pollfd pfd;
+    static char buf[256 * 1024];
+
+    while (!SC_ATOMIC_GET(s->stop)) {
+        pfd.fd = s->fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 10) <= 0)
+            continue;
+        int conn = accept(s->fd, NULL, NULL);
+        if (conn == -1)
+            continue;
+
+        int len = 0;
+        while (!SC_ATOMIC_GET(s->stop)) {
+            pfd.fd = conn;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, 10) <= 0)
+                continue;
+            ssize_t r = recv(conn, buf + len, sizeof(buf) - len, 0);
+            if (r <= 0)
+                break;
+            len += r;
+
+            /* reply once per read like a real server does, one send per
+             * reply runs into nagle and delayed acks */
+            int off = 0, used, replies = 0;
+            char *last = NULL;
+            while ((used = LogFileRedisTestParse(buf + off, len - off,
+                            &last)) > 0) {
+                if (s->close_after && s->cnt == s->close_after) {
+                    /* drop the connection with unanswered commands. The
+                     * replies sent so far must reach the client, so wait
+                     * for it to close instead of resetting. */
+                    SCFree(last);
+                    s->close_after = 0;
+                    LogFileRedisTestReply(conn, replies);
+                    shutdown(conn, SHUT_WR);
+                    while (!SC_ATOMIC_GET(s->stop) && recv(conn, buf, sizeof(buf), 0) > 0)
+                        ;
+                    goto close;
+                }
+                s->records[s->cnt++] = last;
+                last = NULL;
+                replies++;
+                off += used;
+            }
+            if (used < 0 || LogFileRedisTestReply(conn, replies) != 0)
+                break;
+            memmove(buf, buf + off, len - off);
+            len -= off;
+        }
+close:
+        close(conn);
+    }
+    return NULL;
+}
+
+static int LogFileRedisTestServerStart(LogFileRedisTestServer *s,
+        uint32_t max_records)
+{
+    struct sockaddr_in sin;
+    socklen_t sin_len = sizeof(sin);
+
+    memset(s, 0, sizeof(*s));
+    SC_ATOMIC_INIT(s->stop);
+    s->records = SCCalloc(max_records, sizeof(char *));
+    if (s->records == NULL)
+        return -1;
+    s->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (s->fd == -1)
+        return -1;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s->fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 ||
+        listen(s->fd, 4) != 0 ||
+        getsockname(s->fd, (struct sockaddr *)&sin, &sin_len) != 0) {
+        close(s->fd);
+        return -1;
+    }
+    s->port = ntohs(sin.sin_port);
+    if (pthread_create(&s->thread, NULL, LogFileRedisTestServerThread, s) != 0) {
+        close(s->fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void LogFileRedisTestServerStop(LogFileRedisTestServer *s)
+{
+    SC_ATOMIC_SET(s->stop, 1);
+    pthread_join(s->thread, NULL);
+    close(s->fd);
+}
+
+static void LogFileRedisTestServerFree(LogFileRedisTestServer *s)
+{
+    uint32_t i;
+
+    for (i = 0; i < s->cnt; i++)
+        SCFree(s->records[i]);
+    SCFree(s->records);
+}
+
+static LogFileCtx *LogFileRedisTestCtx(int port, int batch_size)
+{
+    LogFileCtx *log_ctx = LogFileNewCtx();
+    if (log_ctx == NULL)
+        return NULL;
+    log_ctx->type = LOGFILE_TYPE_REDIS;
+    log_ctx->redis_setup.server = SCStrdup("127.0.0.1");
+    log_ctx->redis_setup.key = SCStrdup("suricata");
+    log_ctx->redis_setup.command = "LPUSH";
+    log_ctx->redis_setup.port = port;
+    log_ctx->redis_setup.batch_size = batch_size;
+    if (log_ctx->redis_setup.server == NULL || log_ctx->redis_setup.key == NULL) {
+        LogFileFreeCtx(log_ctx);
+        return NULL;
+    }
+    return log_ctx;
+}
+
+static void *LogFileRedisTestThread(void *arg)
+{
+    LogFileCtx *log_ctx = arg;
+    MemBuffer *buffer = MemBufferCreateNew(64);
+    char rec[32];
+    int i;
+
+    if (buffer == NULL)
+        return NULL;
+    for (i = 0; i < LOGFILE_REDIS_TEST_RECORDS; i++) {
+        MemBufferReset(buffer);
+        snprintf(rec, sizeof(rec), "%p %05d", (void *)pthread_self(), i);
+        MemBufferWriteString(buffer, "%s", rec);
+        LogFileWrite(log_ctx, buffer);
+    }
+    MemBufferFree(buffer);
+    return NULL;
+}
+
+/** \internal
+ *  \brief check all records of the test threads arrived once, in order per
+ *         thread */
+static int LogFileRedisTestCheck(LogFileRedisTestServer *s)
+{
+    void *ids[LOGFILE_REDIS_TEST_THREADS] = { NULL };
+    int next[LOGFILE_REDIS_TEST_THREADS] = { 0 };
+    uint32_t r;
+    int i;
+
+    if (s->cnt != LOGFILE_REDIS_TEST_THREADS * LOGFILE_REDIS_TEST_RECORDS)
+        return 0;
+    for (r = 0; r < s->cnt; r++) {
+        void *id = NULL;
+        int seq = -1;
+        if (sscanf(s->records[r], "%p %d", &id, &seq) != 2)
+            return 0;
+        for (i = 0; i < LOGFILE_REDIS_TEST_THREADS; i++) {
+            if (ids[i] == NULL)
+                ids[i] = id;
+            if (ids[i] == id)
+                break;
+        }
+        if (i == LOGFILE_REDIS_TEST_THREADS || seq != next[i])
+            return 0;
+        next[i]++;
+    }
+    return 1;
+}
+
+static int LogFileRedisTestRun(uint32_t close_after)
+{
+    LogFileRedisTestServer s;
+    FAIL_IF(LogFileRedisTestServerStart(&s,
+                LOGFILE_REDIS_TEST_THREADS * LOGFILE_REDIS_TEST_RECORDS) != 0);
+    s.close_after = close_after;
+    uint64_t reconnects = SC_ATOMIC_GET(logfile_redis_reconnects);
+
+    LogFileCtx *log_ctx = LogFileRedisTestCtx(s.port, 50);
+    FAIL_IF_NULL(log_ctx);
+    FAIL_IF(LogFileRedisAsyncInit(log_ctx, 1024 * 1024,
+                LOGFILE_REDIS_POLICY_BLOCK) != 0);
+
+    pthread_t threads[LOGFILE_REDIS_TEST_THREADS];
+    int i;
+    for (i = 0; i < LOGFILE_REDIS_TEST_THREADS; i++)
+        FAIL_IF(pthread_create(&threads[i], NULL, LogFileRedisTestThread,
+                    log_ctx) != 0);
+    for (i = 0; i < LOGFILE_REDIS_TEST_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    LogFileFreeCtx(log_ctx);
+    LogFileRedisTestServerStop(&s);
+
+    FAIL_IF_NOT(LogFileRedisTestCheck(&s));
+    LogFileRedisTestServerFree(&s);
+    if (close_after)
+        FAIL_IF(SC_ATOMIC_GET(logfile_redis_reconnects) == reconnects);
+    PASS;
+}
+
+/** \test records of concurrent threads all reach the server, in order per
+ *        thread */
+static int LogFileRedisAsyncTest01(void)
+{
+    return LogFileRedisTestRun(0);
+}
+
+/** \test after the connection is lost the unacknowledged records are sent
+ *        again, none are lost or duplicated */
+static int LogFileRedisAsyncTest02(void)
+{
+    return LogFileRedisTestRun(LOGFILE_REDIS_TEST_RECORDS + 17);
+}
+
+/** \test with the drop policy writers don't block on an unreachable
+ *        server, the queued records are dropped on shutdown */
+static int LogFileRedisAsyncTest03(void)
+{
+    /* get a port nobody listens on */
+    LogFileRedisTestServer s;
+    FAIL_IF(LogFileRedisTestServerStart(&s, 1) != 0);
+    int port = s.port;
+    LogFileRedisTestServerStop(&s);
+    LogFileRedisTestServerFree(&s);
+
+    LogFileCtx *log_ctx = LogFileRedisTestCtx(port, 0);
+    FAIL_IF_NULL(log_ctx);
+    uint64_t queue_size = sizeof(LogFileRedisChunk) + LOGFILE_REDIS_CHUNK_SIZE;
+    FAIL_IF(LogFileRedisAsyncInit(log_ctx, queue_size,
+                LOGFILE_REDIS_POLICY_DROP) != 0);
+    uint64_t drops = SC_ATOMIC_GET(logfile_redis_drops);
+
+    char rec[1000];
+    memset(rec, 'x', sizeof(rec));
+    int i, queued = 0;
+    for (i = 0; i < 100; i++)
+        queued += LogFileRedisAsyncWrite(log_ctx, rec, sizeof(rec));
+    FAIL_IF(queued == 0 || queued == 100);
+    FAIL_IF(SC_ATOMIC_GET(logfile_redis_drops) != drops + (100 - queued));
+
+    LogFileFreeCtx(log_ctx);
+    FAIL_IF(SC_ATOMIC_GET(logfile_redis_drops) != drops + 100);
+    FAIL_IF(SC_ATOMIC_GET(logfile_redis_memuse) != 0);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+#endif /* HAVE_LIBHIREDIS */
+
+void LogFileRedisAsyncRegisterTests(void)
+{
+#if defined(UNITTESTS) && defined(HAVE_LIBHIREDIS)
+    UtRegisterTest("LogFileRedisAsyncTest01", LogFileRedisAsyncTest01);
+    UtRegisterTest("LogFileRedisAsyncTest02", LogFileRedisAsyncTest02);
+    UtRegisterTest("LogFileRedisAsyncTest03", LogFileRedisAsyncTest03);
+#endif
+}
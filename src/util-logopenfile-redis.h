@@ -0,0 +1,47 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __UTIL_LOGOPENFILE_REDIS_H__
+#define __UTIL_LOGOPENFILE_REDIS_H__
+
+#include "util-logopenfile.h"
+
+#define LOGFILE_REDIS_DEFAULT_QUEUE_SIZE    (16 * 1024 * 1024)
+#define LOGFILE_REDIS_DEFAULT_BATCH_SIZE    100
+
+/** what a logging thread does when the queue is full */
+enum LogFileRedisPolicy {
+    LOGFILE_REDIS_POLICY_DROP,  /**< drop the record */
+    LOGFILE_REDIS_POLICY_BLOCK, /**< wait for room in the queue */
+};
+
+#ifdef HAVE_LIBHIREDIS
+int LogFileRedisAsyncSetup(ConfNode *redis_node, LogFileCtx *log_ctx);
+int LogFileRedisAsyncInit(LogFileCtx *log_ctx, uint64_t queue_size,
+        enum LogFileRedisPolicy policy);
+void LogFileRedisAsyncFree(LogFileCtx *log_ctx);
+int LogFileRedisAsyncWrite(LogFileCtx *log_ctx, const char *buffer,
+        size_t buffer_len);
+#endif /* HAVE_LIBHIREDIS */
+
+void LogFileRedisAsyncRegisterTests(void);
+
+#endif /* __UTIL_LOGOPENFILE_REDIS_H__ */
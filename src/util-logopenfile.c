@@ -33,6 +33,8 @@
 #include "output.h"          /* DEFAULT_LOG_* */
 #include "util-logopenfile.h"
 #include "util-logopenfile-tile.h"
+#include "util-logopenfile-async.h"
+#include "util-logopenfile-redis.h"
 
 const char * redis_push_cmd = "LPUSH";
 const char * redis_publish_cmd = "PUBLISH";
@@ -202,6 +204,169 @@ static PcieFile *SCLogOpenPcieFp(LogFileCtx *log_ctx, const char *path,
 #endif
 }
 
+#ifdef TLS
+#define LOGFILE_THREAD_CACHE_SIZE   8
+
+/** per thread cache of the ctxs a thread writes to in threaded mode,
+ *  so the slots don't have to be looked up under the lock */
+typedef struct LogFileThreadCache_ {
+    const LogFileCtx *parent;
+    uint32_t id;
+    LogFileCtx *ctx;
+} LogFileThreadCache;
+
+static __thread LogFileThreadCache log_thread_cache[LOGFILE_THREAD_CACHE_SIZE];
+static __thread uint32_t log_thread_cache_next;
+#endif
+
+/** source of LogThreadedFileCtx::id, so a new ctx allocated at the address
+ *  of a freed one doesn't match stale cache entries */
+static uint32_t log_threaded_id = 0;
+
+static void LogThreadedFileCtxFree(LogThreadedFileCtx *threads)
+{
+    uint32_t i;
+    for (i = 0; i < threads->slot_cnt; i++) {
+        if (threads->slots[i] != NULL)
+            LogFileFreeCtx(threads->slots[i]);
+    }
+    if (threads->slots != NULL)
+        SCFree(threads->slots);
+    if (threads->owners != NULL)
+        SCFree(threads->owners);
+    if (threads->append != NULL)
+        SCFree(threads->append);
+    SCMutexDestroy(&threads->mutex);
+    SCFree(threads);
+}
+
+/**
+ * \brief Put a LogFileCtx in threaded mode
+ *
+ * Must be called before SCConfLogOpenGeneric. Instead of opening the file,
+ * every thread that writes to the ctx gets a file of its own, named after
+ * the configured one with the thread's slot number inserted before the
+ * extension: eve.json becomes eve.1.json, eve.2.json, ...
+ *
+ * \retval 0 on success
+ * \retval -1 on error
+ */
+int LogFileSetThreaded(LogFileCtx *log_ctx)
+{
+    if (log_ctx->threads != NULL)
+        return 0;
+
+    LogThreadedFileCtx *threads = SCCalloc(1, sizeof(*threads));
+    if (unlikely(threads == NULL))
+        return -1;
+    SCMutexInit(&threads->mutex, NULL);
+    threads->id = SCAtomicFetchAndAdd(&log_threaded_id, 1) + 1;
+
+    log_ctx->threads = threads;
+    return 0;
+}
+
+/** \brief open the file of a new slot of a threaded ctx
+ *  \note threads->mutex must be held */
+static LogFileCtx *LogFileNewThreadCtx(const LogFileCtx *parent, uint32_t slot)
+{
+    const LogThreadedFileCtx *threads = parent->threads;
+    char path[PATH_MAX];
+
+    const char *ext = strrchr(parent->filename, '.');
+    const char *dir = strrchr(parent->filename, '/');
+    if (ext != NULL && (dir == NULL || ext > dir + 1)) {
+        snprintf(path, sizeof(path), "%.*s.%u%s",
+                (int)(ext - parent->filename), parent->filename, slot + 1, ext);
+    } else {
+        snprintf(path, sizeof(path), "%s.%u", parent->filename, slot + 1);
+    }
+
+    LogFileCtx *ctx = LogFileNewCtx();
+    if (unlikely(ctx == NULL))
+        return NULL;
+    ctx->filename = SCStrdup(path);
+    if (unlikely(ctx->filename == NULL)) {
+        LogFileFreeCtx(ctx);
+        return NULL;
+    }
+    ctx->fp = SCLogOpenFileFp(path, threads->append);
+    if (ctx->fp == NULL) {
+        LogFileFreeCtx(ctx);
+        return NULL;
+    }
+    ctx->type = LOGFILE_TYPE_FILE;
+    ctx->is_regular = 1;
+    if (threads->rotate) {
+        OutputRegisterFileRotationFlag(&ctx->rotation_flag);
+    }
+
+    SCLogInfo("threaded output file %s opened", path);
+    return ctx;
+}
+
+/** \brief get the ctx of the calling thread for a threaded ctx
+ *
+ *  The first write of a thread opens its file. If that fails the thread's
+ *  records are dropped, the open is not retried.
+ *
+ *  \retval ctx the thread's ctx
+ *  \retval NULL the file could not be opened
+ */
+static LogFileCtx *LogFileGetThreadCtx(LogFileCtx *parent)
+{
+    LogThreadedFileCtx *threads = parent->threads;
+    uint32_t i;
+
+#ifdef TLS
+    for (i = 0; i < LOGFILE_THREAD_CACHE_SIZE; i++) {
+        if (log_thread_cache[i].parent == parent &&
+            log_thread_cache[i].id == threads->id)
+            return log_thread_cache[i].ctx;
+    }
+#endif
+
+    pthread_t self = pthread_self();
+    LogFileCtx *ctx = NULL;
+
+    SCMutexLock(&threads->mutex);
+    for (i = 0; i < threads->slot_cnt; i++) {
+        if (pthread_equal(threads->owners[i], self))
+            break;
+    }
+    if (i < threads->slot_cnt) {
+        ctx = threads->slots[i];
+    } else {
+        LogFileCtx **slots = SCRealloc(threads->slots,
+                (threads->slot_cnt + 1) * sizeof(LogFileCtx *));
+        if (slots != NULL)
+            threads->slots = slots;
+        pthread_t *owners = SCRealloc(threads->owners,
+                (threads->slot_cnt + 1) * sizeof(pthread_t));
+        if (owners != NULL)
+            threads->owners = owners;
+        if (slots == NULL || owners == NULL) {
+            SCMutexUnlock(&threads->mutex);
+            return NULL;
+        }
+
+        ctx = LogFileNewThreadCtx(parent, threads->slot_cnt);
+        /* a failed open is recorded too */
+        threads->slots[threads->slot_cnt] = ctx;
+        threads->owners[threads->slot_cnt] = self;
+        threads->slot_cnt++;
+    }
+    SCMutexUnlock(&threads->mutex);
+
+#ifdef TLS
+    i = log_thread_cache_next++ % LOGFILE_THREAD_CACHE_SIZE;
+    log_thread_cache[i].parent = parent;
+    log_thread_cache[i].id = threads->id;
+    log_thread_cache[i].ctx = ctx;
+#endif
+    return ctx;
+}
+
 /** \brief open a generic output "log file", which may be a regular file or a socket
  *  \param conf ConfNode structure for the output section in question
  *  \param log_ctx Log file context allocated by caller
@@ -256,6 +421,15 @@ SCConfLogOpenGeneric(ConfNode *conf,
     if (append == NULL)
         append = DEFAULT_LOG_MODE_APPEND;
 
+    if (log_ctx->threads != NULL &&
+        strcasecmp(filetype, DEFAULT_LOG_FILETYPE) != 0 &&
+        strcasecmp(filetype, "file") != 0) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.threaded is only "
+                "supported for regular files, ignoring", conf->name);
+        LogThreadedFileCtxFree(log_ctx->threads);
+        log_ctx->threads = NULL;
+    }
+
     // Now, what have we been asked to open?
     if (strcasecmp(filetype, "unix_stream") == 0) {
         /* Don't bail. May be able to connect later. */
@@ -269,12 +443,21 @@ SCConfLogOpenGeneric(ConfNode *conf,
         log_ctx->fp = SCLogOpenUnixSocketFp(log_path, SOCK_DGRAM, 1);
     } else if (strcasecmp(filetype, DEFAULT_LOG_FILETYPE) == 0 ||
                strcasecmp(filetype, "file") == 0) {
-        log_ctx->fp = SCLogOpenFileFp(log_path, append);
-        if (log_ctx->fp == NULL)
-            return -1; // Error already logged by Open...Fp routine
-        log_ctx->is_regular = 1;
-        if (rotate) {
-            OutputRegisterFileRotationFlag(&log_ctx->rotation_flag);
+        if (log_ctx->threads != NULL) {
+            /* the per thread files are opened on the threads' first write */
+            log_ctx->threads->append = SCStrdup(append);
+            if (unlikely(log_ctx->threads->append == NULL))
+                return -1;
+            log_ctx->threads->rotate = rotate;
+            log_ctx->is_regular = 1;
+        } else {
+            log_ctx->fp = SCLogOpenFileFp(log_path, append);
+            if (log_ctx->fp == NULL)
+                return -1; // Error already logged by Open...Fp routine
+            log_ctx->is_regular = 1;
+            if (rotate) {
+                OutputRegisterFileRotationFlag(&log_ctx->rotation_flag);
+            }
         }
     } else if (strcasecmp(filetype, "pcie") == 0) {
         log_ctx->pcie_fp = SCLogOpenPcieFp(log_ctx, log_path, append);
@@ -414,11 +597,6 @@ int SCConfLogOpenRedis(ConfNode *redis_node, LogFileCtx *log_ctx)
             exit(EXIT_FAILURE);
         }
     }
-    redisContext *c = redisConnect(redis_server, atoi(redis_port));
-    if (c != NULL && c->err) {
-        SCLogError(SC_ERR_SOCKET, "Error connecting to redis server: %s", c->errstr);
-        exit(EXIT_FAILURE);
-    }
 
     /* store server params for reconnection */
     log_ctx->redis_setup.server = SCStrdup(redis_server);
@@ -429,7 +607,19 @@ int SCConfLogOpenRedis(ConfNode *redis_node, LogFileCtx *log_ctx)
     log_ctx->redis_setup.port = atoi(redis_port);
     log_ctx->redis_setup.tried = 0;
 
-    log_ctx->redis = c;
+    /* in async mode the I/O thread connects, so an unreachable server
+     * doesn't keep us from starting */
+    int async = LogFileRedisAsyncSetup(redis_node, log_ctx);
+    if (async < 0) {
+        exit(EXIT_FAILURE);
+    } else if (async == 0) {
+        redisContext *c = redisConnect(redis_server, atoi(redis_port));
+        if (c != NULL && c->err) {
+            SCLogError(SC_ERR_SOCKET, "Error connecting to redis server: %s", c->errstr);
+            exit(EXIT_FAILURE);
+        }
+        log_ctx->redis = c;
+    }
 
     log_ctx->Close = SCLogFileCloseRedis;
 
@@ -500,6 +690,18 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
         SCReturnInt(0);
     }
 
+    /* write out the buffered records before the file is closed */
+    LogFileAsyncFree(lf_ctx);
+#ifdef HAVE_LIBHIREDIS
+    if (lf_ctx->type == LOGFILE_TYPE_REDIS)
+        LogFileRedisAsyncFree(lf_ctx);
+#endif
+
+    if (lf_ctx->threads != NULL) {
+        LogThreadedFileCtxFree(lf_ctx->threads);
+        lf_ctx->threads = NULL;
+    }
+
     if (lf_ctx->fp != NULL) {
         SCMutexLock(&lf_ctx->fp_mutex);
         lf_ctx->Close(lf_ctx);
@@ -548,7 +750,6 @@ static int  LogFileWriteRedis(LogFileCtx *file_ctx, const char *string, size_t s
             SCLogInfo("Reconnected to redis server");
         }
     }
-    /* TODO go async here ? */
     if (file_ctx->redis_setup.batch_size) {
         redisAppendCommand(file_ctx->redis, "%s %s %s",
                 file_ctx->redis_setup.command,
@@ -619,6 +820,18 @@ static int  LogFileWriteRedis(LogFileCtx *file_ctx, const char *string, size_t s
 
 int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer)
 {
+    if (file_ctx->threads != NULL) {
+        LogFileCtx *thread_ctx = LogFileGetThreadCtx(file_ctx);
+        if (thread_ctx == NULL)
+            return -1;
+
+        MemBufferWriteString(buffer, "\n");
+        /* no other thread writes to this file, so no locking */
+        thread_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
+                          MEMBUFFER_OFFSET(buffer), thread_ctx);
+        return 0;
+    }
+
     if (file_ctx->type == LOGFILE_TYPE_SYSLOG) {
         syslog(file_ctx->syslog_setup.alert_syslog_level, "%s",
                 (const char *)MEMBUFFER_BUFFER(buffer));
@@ -628,19 +841,129 @@ int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer)
     {
         /* append \n for files only */
         MemBufferWriteString(buffer, "\n");
-        SCMutexLock(&file_ctx->fp_mutex);
-        file_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
-                        MEMBUFFER_OFFSET(buffer), file_ctx);
-        SCMutexUnlock(&file_ctx->fp_mutex);
+        if (file_ctx->async != NULL) {
+            /* no lock needed, the record is handed to the writer thread */
+            file_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
+                            MEMBUFFER_OFFSET(buffer), file_ctx);
+        } else {
+            SCMutexLock(&file_ctx->fp_mutex);
+            file_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
+                            MEMBUFFER_OFFSET(buffer), file_ctx);
+            SCMutexUnlock(&file_ctx->fp_mutex);
+        }
     }
 #ifdef HAVE_LIBHIREDIS
     else if (file_ctx->type == LOGFILE_TYPE_REDIS) {
-        SCMutexLock(&file_ctx->fp_mutex);
-        LogFileWriteRedis(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
-                MEMBUFFER_OFFSET(buffer));
-        SCMutexUnlock(&file_ctx->fp_mutex);
+        if (file_ctx->redis_setup.async != NULL) {
+            /* no lock needed, the record is queued to the I/O thread */
+            LogFileRedisAsyncWrite(file_ctx,
+                    (const char *)MEMBUFFER_BUFFER(buffer),
+                    MEMBUFFER_OFFSET(buffer));
+        } else {
+            SCMutexLock(&file_ctx->fp_mutex);
+            LogFileWriteRedis(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
+                    MEMBUFFER_OFFSET(buffer));
+            SCMutexUnlock(&file_ctx->fp_mutex);
+        }
     }
 #endif
 
     return 0;
 }
+
+#ifdef UNITTESTS
+#include "conf-yaml-loader.h"
+#include "util-unittest.h"
+
+#define LOGFILE_TEST_THREADS    3
+#define LOGFILE_TEST_RECORDS    100
+
+static void *LogFileThreadedTestThread(void *arg)
+{
+    LogFileCtx *log_ctx = arg;
+    MemBuffer *buffer = MemBufferCreateNew(64);
+    int i;
+
+    if (buffer == NULL)
+        return NULL;
+    for (i = 0; i < LOGFILE_TEST_RECORDS; i++) {
+        MemBufferReset(buffer);
+        char rec[32];
+        snprintf(rec, sizeof(rec), "%p:%d", (void *)pthread_self(), i);
+        MemBufferWriteString(buffer, "%s", rec);
+        LogFileWrite(log_ctx, buffer);
+    }
+    MemBufferFree(buffer);
+    return NULL;
+}
+
+/** \test in threaded mode every thread writes its records in order to a
+ *        file of its own */
+static int LogFileThreadedTest01(void)
+{
+    char dir[] = "/tmp/suricata-logfile-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+
+    char config[512];
+    snprintf(config, sizeof(config), "%%YAML 1.1\n---\n"
+            "eve-log:\n"
+            "  filename: %s/eve.json\n", dir);
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfYamlLoadString(config, strlen(config));
+    ConfNode *conf = ConfGetNode("eve-log");
+    FAIL_IF_NULL(conf);
+
+    LogFileCtx *log_ctx = LogFileNewCtx();
+    FAIL_IF_NULL(log_ctx);
+    FAIL_IF(LogFileSetThreaded(log_ctx) != 0);
+    FAIL_IF(SCConfLogOpenGeneric(conf, log_ctx, "eve.json", 0) != 0);
+    log_ctx->type = LOGFILE_TYPE_FILE;
+    FAIL_IF_NOT_NULL(log_ctx->fp);
+    ConfDeInit();
+    ConfRestoreContextBackup();
+
+    pthread_t threads[LOGFILE_TEST_THREADS];
+    int t;
+    for (t = 0; t < LOGFILE_TEST_THREADS; t++)
+        FAIL_IF(pthread_create(&threads[t], NULL, LogFileThreadedTestThread,
+                    log_ctx) != 0);
+    for (t = 0; t < LOGFILE_TEST_THREADS; t++)
+        pthread_join(threads[t], NULL);
+    FAIL_IF(log_ctx->threads->slot_cnt != LOGFILE_TEST_THREADS);
+    LogFileFreeCtx(log_ctx);
+
+    for (t = 0; t < LOGFILE_TEST_THREADS; t++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/eve.%d.json", dir, t + 1);
+        FILE *fp = fopen(path, "r");
+        FAIL_IF_NULL(fp);
+
+        char line[64];
+        void *owner = NULL;
+        int n = 0;
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            void *id = NULL;
+            int seq = -1;
+            FAIL_IF(sscanf(line, "%p:%d", &id, &seq) != 2);
+            if (n == 0)
+                owner = id;
+            FAIL_IF(id != owner);
+            FAIL_IF(seq != n);
+            n++;
+        }
+        fclose(fp);
+        FAIL_IF(n != LOGFILE_TEST_RECORDS);
+        unlink(path);
+    }
+    FAIL_IF(rmdir(dir) != 0);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void LogFileRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LogFileThreadedTest01", LogFileThreadedTest01);
+#endif
+}
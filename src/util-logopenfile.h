@@ -58,9 +58,25 @@ typedef struct RedisSetup_ {
     char *server;
     int  port;
     time_t tried;
+    /** async output state, see util-logopenfile-redis.c. If set the
+     *  records are sent by an I/O thread and redis is not used. */
+    struct LogFileRedisAsync_ *async;
 } RedisSetup;
 #endif
 
+/** per thread files of a LogFileCtx in threaded mode (eve-log.threaded) */
+typedef struct LogThreadedFileCtx_ {
+    /** protects the slots, only taken on a thread's first write */
+    SCMutex mutex;
+    struct LogFileCtx_ **slots;
+    pthread_t *owners;
+    uint32_t slot_cnt;
+
+    uint32_t id;            /**< identifies the ctx in the thread caches */
+    char *append;           /**< append setting the files are opened with */
+    int rotate;             /**< register the files for rotation in HUP */
+} LogThreadedFileCtx;
+
 /** Global structure for Output Context */
 typedef struct LogFileCtx_ {
     union {
@@ -120,6 +136,15 @@ typedef struct LogFileCtx_ {
 
     /* Flag set when file rotation notification is received. */
     int rotation_flag;
+
+    /** async output state, see util-logopenfile-async.c. If set the
+     *  records are written by a writer thread and the fp_mutex is not
+     *  used. */
+    struct LogFileAsync_ *async;
+
+    /** threaded mode. If set this ctx only holds the settings, every
+     *  thread writes to a ctx and file of its own without locking. */
+    LogThreadedFileCtx *threads;
 } LogFileCtx;
 
 /* Min time (msecs) before trying to reconnect a Unix domain socket */
@@ -132,9 +157,12 @@ typedef struct LogFileCtx_ {
 LogFileCtx *LogFileNewCtx(void);
 int LogFileFreeCtx(LogFileCtx *);
 int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer);
+int LogFileSetThreaded(LogFileCtx *log_ctx);
 
 int SCConfLogOpenGeneric(ConfNode *conf, LogFileCtx *, const char *, int);
 int SCConfLogOpenRedis(ConfNode *conf, LogFileCtx *log_ctx);
 int SCConfLogReopen(LogFileCtx *);
 
+void LogFileRegisterTests(void);
+
 #endif /* __UTIL_LOGOPENFILE_H__ */
@@ -99,6 +99,57 @@ error:
     SCReturnInt(-1);
 }
 
+/**
+ *  \brief Create a "magic" context for use by a single thread, so it
+ *         can do lookups with MagicThreadLookup without taking the
+ *         global lock.
+ *
+ *  \retval ctx the context or NULL on error
+ */
+magic_t MagicInitContext(void)
+{
+    char *filename = NULL;
+    FILE *fd = NULL;
+
+    magic_t ctx = magic_open(0);
+    if (ctx == NULL) {
+        SCLogError(SC_ERR_MAGIC_OPEN, "magic_open failed: %s", magic_error(ctx));
+        return NULL;
+    }
+
+    (void)ConfGet("magic-file", &filename);
+    if (filename != NULL) {
+        if (strlen(filename) == 0) {
+            /* set filename to NULL on *nix systems so magic_load uses
+             * system default path (see man libmagic) */
+            filename = NULL;
+        } else {
+            if ((fd = fopen(filename, "r")) == NULL) {
+                SCLogWarning(SC_ERR_FOPEN, "Error opening file: \"%s\": %s",
+                        filename, strerror(errno));
+                goto error;
+            }
+            fclose(fd);
+        }
+    }
+
+    if (magic_load(ctx, filename) != 0) {
+        SCLogError(SC_ERR_MAGIC_LOAD, "magic_load failed: %s", magic_error(ctx));
+        goto error;
+    }
+    return ctx;
+
+error:
+    magic_close(ctx);
+    return NULL;
+}
+
+void MagicDeinitContext(magic_t ctx)
+{
+    if (ctx != NULL)
+        magic_close(ctx);
+}
+
 /**
  *  \brief Find the magic value for a buffer.
  *
@@ -28,6 +28,8 @@
 
 int MagicInit(void);
 void MagicDeinit(void);
+magic_t MagicInitContext(void);
+void MagicDeinitContext(magic_t);
 char *MagicGlobalLookup(const uint8_t *, uint32_t);
 char *MagicThreadLookup(magic_t *, const uint8_t *, uint32_t);
 void MagicRegisterTests(void);
@@ -1153,6 +1153,7 @@ uint32_t SCACBSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     const SCACBSCtx *ctx = (SCACBSCtx *)mpm_ctx->ctx;
     int i = 0;
     int matches = 0;
+    const uint32_t sids_start = pmq->rule_id_array_cnt;
     uint8_t buf_local;
 
     /* \todo tried loop unrolling with register var, with no perf increase.  Need
@@ -1328,6 +1329,7 @@ uint32_t SCACBSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
         } /* for (i = 0; i < buflen; i++) */
     }
 
+    MpmCtxMapSids(mpm_ctx, pmq, sids_start);
     return matches;
 }
 
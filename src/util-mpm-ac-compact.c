@@ -0,0 +1,1116 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Aho-Corasick with a compressed state table.
+ *
+ * The delta table of util-mpm-ac.c has 256 entries of 2 or 4 bytes for
+ * every state, which adds up to hundreds of MB for large rule groups.
+ * This variant builds the same DFA but stores it differently:
+ *
+ * - alphabet compression: input bytes are translated to classes first.
+ *   Upper and lower case share a class and all bytes that don't appear
+ *   in any pattern share class 0. Rows are alpha_size wide, not 256.
+ * - banded rows: the root and the depth 1 states have full rows. Any
+ *   deeper state goes where the first of those on its failure chain
+ *   goes, except for its own children and those of the deeper states on
+ *   its failure chain. Only the band of classes from the first to the
+ *   last class that differs from that full row is stored, everything
+ *   outside of the band is looked up in the full row.
+ * - the "has output" flag is kept in a separate bitmap instead of in the
+ *   top bits of the state, so states are plain 16 or 32 bit indexes.
+ *
+ * The trie is built with sibling lists instead of a 256 wide goto table,
+ * and the delta rows are computed breadth first from the already
+ * compressed rows of the failure states, so the full table is never
+ * allocated, not even during setup.
+ *
+ * The memory of the final tables is accounted in MpmCtx::memory_size.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-engine.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-memcmp.h"
+#include "util-mpm-ac-compact.h"
+
+void SCACCompactInitCtx(MpmCtx *);
+void SCACCompactInitThreadCtx(MpmCtx *, MpmThreadCtx *);
+void SCACCompactDestroyCtx(MpmCtx *);
+void SCACCompactDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCACCompactAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                            uint32_t, SigIntId, uint8_t);
+int SCACCompactAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                            uint32_t, SigIntId, uint8_t);
+int SCACCompactPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCACCompactSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                           PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen);
+void SCACCompactPrintInfo(MpmCtx *mpm_ctx);
+void SCACCompactPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCACCompactRegisterTests(void);
+
+/**
+ * \brief Helper structure used during state table creation. The trie is
+ *        stored as child/sibling lists, the root is state 0 so 0 means
+ *        'none' in the child and sibling arrays.
+ */
+typedef struct ACCompactBuild_ {
+    uint32_t state_count;
+    uint32_t allocated_state_count;
+
+    uint32_t *child;
+    uint32_t *sibling;
+    uint8_t *label;         /**< class of the transition into the state */
+    uint32_t *fail;
+    uint32_t *dflt;         /**< offset of the full row to use */
+
+    /* pattern ids ending in a state */
+    uint32_t **pids;
+    uint32_t *pids_cnt;
+
+    uint32_t allocated_trans_cnt;
+} ACCompactBuild;
+
+static void *ACCompactRealloc(void *ptr, size_t size)
+{
+    void *ptmp = SCRealloc(ptr, size);
+    if (ptmp == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    return ptmp;
+}
+
+static uint32_t ACCompactNewState(ACCompactBuild *b)
+{
+    /* Exponentially increase the allocated space when needed. */
+    if (b->allocated_state_count < b->state_count + 1) {
+        uint32_t cnt = b->allocated_state_count ? b->allocated_state_count * 2 : 256;
+
+        b->child = ACCompactRealloc(b->child, cnt * sizeof(uint32_t));
+        b->sibling = ACCompactRealloc(b->sibling, cnt * sizeof(uint32_t));
+        b->label = ACCompactRealloc(b->label, cnt * sizeof(uint8_t));
+        b->fail = ACCompactRealloc(b->fail, cnt * sizeof(uint32_t));
+        b->dflt = ACCompactRealloc(b->dflt, cnt * sizeof(uint32_t));
+        b->pids = ACCompactRealloc(b->pids, cnt * sizeof(uint32_t *));
+        b->pids_cnt = ACCompactRealloc(b->pids_cnt, cnt * sizeof(uint32_t));
+        b->allocated_state_count = cnt;
+    }
+
+    uint32_t s = b->state_count++;
+    b->child[s] = 0;
+    b->sibling[s] = 0;
+    b->label[s] = 0;
+    b->fail[s] = 0;
+    b->dflt[s] = 0;
+    b->pids[s] = NULL;
+    b->pids_cnt[s] = 0;
+    return s;
+}
+
+static void ACCompactBuildFree(ACCompactBuild *b)
+{
+    uint32_t s;
+    for (s = 0; s < b->state_count; s++) {
+        if (b->pids[s] != NULL)
+            SCFree(b->pids[s]);
+    }
+    SCFree(b->child);
+    SCFree(b->sibling);
+    SCFree(b->label);
+    SCFree(b->fail);
+    SCFree(b->dflt);
+    SCFree(b->pids);
+    SCFree(b->pids_cnt);
+}
+
+static inline uint32_t ACCompactGetChild(const ACCompactBuild *b, uint32_t s,
+                                         uint8_t c)
+{
+    uint32_t child;
+    for (child = b->child[s]; child != 0; child = b->sibling[child]) {
+        if (b->label[child] == c)
+            return child;
+    }
+    return 0;
+}
+
+static void ACCompactAddOutput(ACCompactBuild *b, uint32_t s, uint32_t pid)
+{
+    uint32_t i;
+    for (i = 0; i < b->pids_cnt[s]; i++) {
+        if (b->pids[s][i] == pid)
+            return;
+    }
+    b->pids[s] = ACCompactRealloc(b->pids[s], (b->pids_cnt[s] + 1) * sizeof(uint32_t));
+    b->pids[s][b->pids_cnt[s]++] = pid;
+}
+
+/**
+ * \internal
+ * \brief Add a pattern to the trie.
+ */
+static void ACCompactEnter(const SCACCompactCtx *ctx, ACCompactBuild *b,
+                           const MpmPattern *p)
+{
+    uint32_t state = 0;
+    uint16_t i;
+
+    for (i = 0; i < p->len; i++) {
+        uint8_t c = ctx->xlate[p->ci[i]];
+        uint32_t next = ACCompactGetChild(b, state, c);
+        if (next == 0) {
+            next = ACCompactNewState(b);
+            b->label[next] = c;
+            b->sibling[next] = b->child[state];
+            b->child[state] = next;
+        }
+        state = next;
+    }
+
+    ACCompactAddOutput(b, state, p->id);
+}
+
+/**
+ * \internal
+ * \brief Transition from a state whose row is already compressed. Only
+ *        used during setup, when the rows are still 32 bit.
+ */
+static inline uint32_t ACCompactDelta(const SCACCompactCtx *ctx, uint32_t s,
+                                      uint8_t c)
+{
+    const SCACCompactRow *r = &ctx->rows[s];
+    uint32_t d = (uint32_t)c - r->first;
+    if (d < r->width)
+        return ctx->trans_u32[r->base + d];
+    return ctx->dense_u32[r->dflt + c];
+}
+
+/**
+ * \internal
+ * \brief Set up the alphabet classes from the patterns.
+ */
+static void ACCompactSetupAlphabet(SCACCompactCtx *ctx, MpmPattern **parray,
+                                   uint32_t pattern_cnt)
+{
+    uint8_t used[256];
+    uint32_t i, u;
+
+    memset(used, 0, sizeof(used));
+    for (i = 0; i < pattern_cnt; i++) {
+        for (u = 0; u < parray[i]->len; u++)
+            used[parray[i]->ci[u]] = 1;
+    }
+
+    /* class 0 is for bytes not in any pattern. The ci patterns are
+     * lowercase, so uppercase letters are never used and get the class
+     * of their lowercase version below. */
+    ctx->alpha_size = 1;
+    memset(ctx->xlate, 0, sizeof(ctx->xlate));
+    for (u = 0; u < 256; u++) {
+        if (used[u])
+            ctx->xlate[u] = (uint8_t)ctx->alpha_size++;
+    }
+    for (u = 0; u < 256; u++) {
+        ctx->xlate[u] = ctx->xlate[u8_tolower(u)];
+    }
+}
+
+/**
+ * \internal
+ * \brief Compute the delta rows breadth first and store them compressed.
+ *
+ * The failure state of a state is always less deep, so its row is done
+ * by the time we need it.
+ */
+static void ACCompactCreateRows(MpmCtx *mpm_ctx, ACCompactBuild *b)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    const uint16_t alpha_size = ctx->alpha_size;
+    uint32_t row[alpha_size];
+    uint32_t child;
+    uint32_t c;
+
+    /* full rows for the root and its children */
+    uint32_t dense_rows = 1;
+    for (child = b->child[0]; child != 0; child = b->sibling[child])
+        dense_rows++;
+    ctx->dense_cnt = dense_rows * alpha_size;
+
+    ctx->rows = SCMalloc(ctx->state_count * sizeof(SCACCompactRow));
+    ctx->dense_u32 = SCMalloc(ctx->dense_cnt * sizeof(uint32_t));
+    uint32_t *queue = SCMalloc(ctx->state_count * sizeof(uint32_t));
+    if (ctx->rows == NULL || ctx->dense_u32 == NULL || queue == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->rows, 0, ctx->state_count * sizeof(SCACCompactRow));
+    memset(ctx->dense_u32, 0, ctx->dense_cnt * sizeof(uint32_t));
+    uint32_t top = 0, bot = 0;
+
+    /* root row, the root children fail to root */
+    uint32_t dense_off = alpha_size;
+    for (child = b->child[0]; child != 0; child = b->sibling[child]) {
+        ctx->dense_u32[b->label[child]] = child;
+        b->fail[child] = 0;
+        b->dflt[child] = dense_off;
+        dense_off += alpha_size;
+        queue[top++] = child;
+    }
+
+    while (bot < top) {
+        uint32_t r = queue[bot++];
+
+        for (c = 0; c < alpha_size; c++)
+            row[c] = ACCompactDelta(ctx, b->fail[r], c);
+        for (child = b->child[r]; child != 0; child = b->sibling[child])
+            row[b->label[child]] = child;
+
+        ctx->rows[r].dflt = (uint16_t)b->dflt[r];
+
+        if (b->dflt[r] != b->dflt[b->fail[r]]) {
+            /* depth 1: this is a full row */
+            memcpy(ctx->dense_u32 + b->dflt[r], row, alpha_size * sizeof(uint32_t));
+            goto children;
+        }
+
+        /* store the band that differs from the full row */
+        uint32_t first = alpha_size, last = 0;
+        const uint32_t *dense = ctx->dense_u32 + b->dflt[r];
+        for (c = 0; c < alpha_size; c++) {
+            if (row[c] != dense[c]) {
+                if (first == alpha_size)
+                    first = c;
+                last = c;
+            }
+        }
+        if (first < alpha_size) {
+            uint32_t width = last - first + 1;
+            if (b->allocated_trans_cnt < ctx->trans_cnt + width) {
+                uint32_t cnt = b->allocated_trans_cnt ? b->allocated_trans_cnt : 1024;
+                while (cnt < ctx->trans_cnt + width)
+                    cnt *= 2;
+                ctx->trans_u32 = ACCompactRealloc(ctx->trans_u32, cnt * sizeof(uint32_t));
+                b->allocated_trans_cnt = cnt;
+            }
+            memcpy(ctx->trans_u32 + ctx->trans_cnt, row + first,
+                   width * sizeof(uint32_t));
+            ctx->rows[r].base = ctx->trans_cnt;
+            ctx->rows[r].first = (uint8_t)first;
+            ctx->rows[r].width = (uint8_t)width;
+            ctx->trans_cnt += width;
+        }
+
+children:
+        for (child = b->child[r]; child != 0; child = b->sibling[child]) {
+            uint32_t f = ACCompactDelta(ctx, b->fail[r], b->label[child]);
+            b->fail[child] = f;
+            /* the full row of the first depth 0 or 1 state on the
+             * failure chain */
+            b->dflt[child] = b->dflt[f];
+
+            /* a state outputs what its failure state outputs */
+            uint32_t i;
+            for (i = 0; i < b->pids_cnt[f]; i++)
+                ACCompactAddOutput(b, child, b->pids[f][i]);
+
+            queue[top++] = child;
+        }
+    }
+    SCFree(queue);
+
+    if (ctx->trans_cnt > 0) {
+        ctx->trans_u32 = ACCompactRealloc(ctx->trans_u32,
+                                          ctx->trans_cnt * sizeof(uint32_t));
+    }
+
+    mpm_ctx->memory_cnt += 2;
+    mpm_ctx->memory_size += ctx->state_count * sizeof(SCACCompactRow) +
+                            ctx->dense_cnt * sizeof(uint32_t);
+    if (ctx->trans_u32 != NULL) {
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size += ctx->trans_cnt * sizeof(uint32_t);
+    }
+}
+
+/**
+ * \internal
+ * \brief Flatten the output lists and set up the match bitmap.
+ */
+static void ACCompactCreateOutputs(MpmCtx *mpm_ctx, ACCompactBuild *b)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint32_t s;
+
+    ctx->out_cnt = 0;
+    for (s = 0; s < ctx->state_count; s++)
+        ctx->out_cnt += b->pids_cnt[s];
+
+    uint32_t bitmap_size = ctx->state_count / 8 + 1;
+    ctx->match_bitmap = SCMalloc(bitmap_size);
+    ctx->out_offset = SCMalloc((ctx->state_count + 1) * sizeof(uint32_t));
+    ctx->out_pids = SCMalloc(ctx->out_cnt * sizeof(uint32_t));
+    if (ctx->match_bitmap == NULL || ctx->out_offset == NULL ||
+        ctx->out_pids == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->match_bitmap, 0, bitmap_size);
+
+    uint32_t o = 0;
+    for (s = 0; s < ctx->state_count; s++) {
+        ctx->out_offset[s] = o;
+        if (b->pids_cnt[s] == 0)
+            continue;
+        ctx->match_bitmap[s / 8] |= (1 << (s % 8));
+        memcpy(ctx->out_pids + o, b->pids[s], b->pids_cnt[s] * sizeof(uint32_t));
+        o += b->pids_cnt[s];
+    }
+    ctx->out_offset[ctx->state_count] = o;
+
+    mpm_ctx->memory_cnt += 3;
+    mpm_ctx->memory_size += bitmap_size +
+                            (ctx->state_count + 1) * sizeof(uint32_t) +
+                            ctx->out_cnt * sizeof(uint32_t);
+}
+
+/**
+ * \internal
+ * \brief Switch to 16 bit states if they fit.
+ */
+static void ACCompactShrinkStates(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint32_t i;
+
+    if (ctx->state_count > 65536)
+        return;
+
+    ctx->dense_u16 = SCMalloc(ctx->dense_cnt * sizeof(uint16_t));
+    if (ctx->dense_u16 == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < ctx->dense_cnt; i++)
+        ctx->dense_u16[i] = (uint16_t)ctx->dense_u32[i];
+    SCFree(ctx->dense_u32);
+    ctx->dense_u32 = NULL;
+    mpm_ctx->memory_size -= ctx->dense_cnt * sizeof(uint16_t);
+
+    if (ctx->trans_u32 != NULL) {
+        ctx->trans_u16 = SCMalloc(ctx->trans_cnt * sizeof(uint16_t));
+        if (ctx->trans_u16 == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < ctx->trans_cnt; i++)
+            ctx->trans_u16[i] = (uint16_t)ctx->trans_u32[i];
+        SCFree(ctx->trans_u32);
+        ctx->trans_u32 = NULL;
+        mpm_ctx->memory_size -= ctx->trans_cnt * sizeof(uint16_t);
+    }
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the internal tables.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+int SCACCompactPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+
+    if (mpm_ctx->pattern_cnt == 0 || mpm_ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    MpmPattern **parray = SCMalloc(mpm_ctx->pattern_cnt * sizeof(MpmPattern *));
+    if (parray == NULL)
+        goto error;
+
+    /* populate it with the patterns in the hash */
+    uint32_t i = 0, p = 0;
+    for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+        MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+        while (node != NULL) {
+            nnode = node->next;
+            node->next = NULL;
+            parray[p++] = node;
+            node = nnode;
+        }
+    }
+
+    /* we no longer need the hash, so free it's memory */
+    SCFree(mpm_ctx->init_hash);
+    mpm_ctx->init_hash = NULL;
+
+    ctx->pid_pat_list = SCMalloc((mpm_ctx->max_pat_id + 1) * sizeof(SCACCompactPattern));
+    if (ctx->pid_pat_list == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->pid_pat_list, 0, (mpm_ctx->max_pat_id + 1) * sizeof(SCACCompactPattern));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (mpm_ctx->max_pat_id + 1) * sizeof(SCACCompactPattern);
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        SCACCompactPattern *pat = &ctx->pid_pat_list[parray[i]->id];
+        if (!(parray[i]->flags & MPM_PATTERN_FLAG_NOCASE)) {
+            pat->cs = SCMalloc(parray[i]->len);
+            if (pat->cs == NULL) {
+                SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(pat->cs, parray[i]->original_pat, parray[i]->len);
+            mpm_ctx->memory_cnt++;
+            mpm_ctx->memory_size += parray[i]->len;
+        }
+        pat->patlen = parray[i]->len;
+
+        /* SCACCompactPattern now owns this memory */
+        pat->sids_size = parray[i]->sids_size;
+        pat->sids = parray[i]->sids;
+        parray[i]->sids_size = 0;
+        parray[i]->sids = NULL;
+    }
+
+    ACCompactSetupAlphabet(ctx, parray, mpm_ctx->pattern_cnt);
+
+    ACCompactBuild b;
+    memset(&b, 0, sizeof(b));
+    ACCompactNewState(&b);
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        ACCompactEnter(ctx, &b, parray[i]);
+    }
+    ctx->state_count = b.state_count;
+
+    ACCompactCreateRows(mpm_ctx, &b);
+    ACCompactCreateOutputs(mpm_ctx, &b);
+    ACCompactShrinkStates(mpm_ctx);
+    ACCompactBuildFree(&b);
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        MpmFreePattern(mpm_ctx, parray[i]);
+    }
+    SCFree(parray);
+
+    ctx->pattern_id_bitarray_size = (mpm_ctx->max_pat_id / 8) + 1;
+
+    SCLogDebug("%u patterns, %u states, %u classes, %u transitions, %u bytes",
+               mpm_ctx->pattern_cnt, ctx->state_count, ctx->alpha_size,
+               ctx->trans_cnt, mpm_ctx->memory_size);
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * \brief Init the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCACCompactInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+}
+
+/**
+ * \brief Initialize the AC context.
+ *
+ * \param mpm_ctx       Mpm context.
+ */
+void SCACCompactInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCACCompactCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCACCompactCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCACCompactCtx);
+
+    /* initialize the hash we use to speed up pattern insertions */
+    mpm_ctx->init_hash = SCMalloc(sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+    if (mpm_ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->init_hash, 0, sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCACCompactDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    return;
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCACCompactDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    if (ctx == NULL)
+        return;
+
+    if (mpm_ctx->init_hash != NULL) {
+        uint32_t i;
+        for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+            MpmPattern *node = mpm_ctx->init_hash[i];
+            while (node != NULL) {
+                MpmPattern *next = node->next;
+                if (node->sids != NULL)
+                    SCFree(node->sids);
+                MpmFreePattern(mpm_ctx, node);
+                node = next;
+            }
+        }
+        SCFree(mpm_ctx->init_hash);
+        mpm_ctx->init_hash = NULL;
+    }
+
+    if (ctx->rows != NULL) {
+        SCFree(ctx->rows);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->state_count * sizeof(SCACCompactRow);
+    }
+    if (ctx->dense_u16 != NULL) {
+        SCFree(ctx->dense_u16);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->dense_cnt * sizeof(uint16_t);
+    }
+    if (ctx->dense_u32 != NULL) {
+        SCFree(ctx->dense_u32);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->dense_cnt * sizeof(uint32_t);
+    }
+    if (ctx->trans_u16 != NULL) {
+        SCFree(ctx->trans_u16);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->trans_cnt * sizeof(uint16_t);
+    }
+    if (ctx->trans_u32 != NULL) {
+        SCFree(ctx->trans_u32);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->trans_cnt * sizeof(uint32_t);
+    }
+    if (ctx->match_bitmap != NULL) {
+        SCFree(ctx->match_bitmap);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->state_count / 8 + 1;
+    }
+    if (ctx->out_offset != NULL) {
+        SCFree(ctx->out_offset);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (ctx->state_count + 1) * sizeof(uint32_t);
+    }
+    if (ctx->out_pids != NULL) {
+        SCFree(ctx->out_pids);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->out_cnt * sizeof(uint32_t);
+    }
+
+    if (ctx->pid_pat_list != NULL) {
+        uint32_t i;
+        for (i = 0; i < (mpm_ctx->max_pat_id + 1); i++) {
+            if (ctx->pid_pat_list[i].cs != NULL) {
+                SCFree(ctx->pid_pat_list[i].cs);
+                mpm_ctx->memory_cnt--;
+                mpm_ctx->memory_size -= ctx->pid_pat_list[i].patlen;
+            }
+            if (ctx->pid_pat_list[i].sids != NULL)
+                SCFree(ctx->pid_pat_list[i].sids);
+        }
+        SCFree(ctx->pid_pat_list);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (mpm_ctx->max_pat_id + 1) * sizeof(SCACCompactPattern);
+    }
+
+    SCFree(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCACCompactCtx);
+}
+
+/** \internal
+ *  \brief handle the patterns ending at buf[i] in 'state' */
+static inline uint32_t ACCompactMatches(const SCACCompactCtx *ctx,
+        PatternMatcherQueue *pmq, const uint8_t *buf, uint32_t i,
+        uint32_t state, uint8_t *bitarray)
+{
+    uint32_t matches = 0;
+    uint32_t k;
+
+    for (k = ctx->out_offset[state]; k < ctx->out_offset[state + 1]; k++) {
+        const uint32_t pid = ctx->out_pids[k];
+        const SCACCompactPattern *pat = &ctx->pid_pat_list[pid];
+
+        if (pat->cs != NULL &&
+            SCMemcmp(pat->cs, buf + i - pat->patlen + 1, pat->patlen) != 0)
+            continue;
+
+        if (!(bitarray[pid / 8] & (1 << (pid % 8)))) {
+            bitarray[pid / 8] |= (1 << (pid % 8));
+            MpmAddSids(pmq, pat->sids, pat->sids_size);
+        }
+        matches++;
+    }
+    return matches;
+}
+
+/**
+ * \brief The aho corasick search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Not used.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACCompactSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                           PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen)
+{
+    const SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    const SCACCompactRow *rows = ctx->rows;
+    const uint8_t *xlate = ctx->xlate;
+    const uint8_t *match_bitmap = ctx->match_bitmap;
+    uint32_t matches = 0;
+    const uint32_t sids_start = pmq->rule_id_array_cnt;
+    uint32_t i;
+
+    if (rows == NULL)
+        return 0;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+    if (ctx->dense_u16 != NULL) {
+        const uint16_t *dense = ctx->dense_u16;
+        const uint16_t *trans = ctx->trans_u16;
+        uint32_t state = 0;
+        for (i = 0; i < buflen; i++) {
+            const uint8_t c = xlate[buf[i]];
+            const SCACCompactRow *r = &rows[state];
+            const uint32_t d = (uint32_t)c - r->first;
+            state = (d < r->width) ? trans[r->base + d] : dense[r->dflt + c];
+            if (match_bitmap[state / 8] & (1 << (state % 8))) {
+                matches += ACCompactMatches(ctx, pmq, buf, i, state, bitarray);
+            }
+        }
+    } else {
+        const uint32_t *dense = ctx->dense_u32;
+        const uint32_t *trans = ctx->trans_u32;
+        uint32_t state = 0;
+        for (i = 0; i < buflen; i++) {
+            const uint8_t c = xlate[buf[i]];
+            const SCACCompactRow *r = &rows[state];
+            const uint32_t d = (uint32_t)c - r->first;
+            state = (d < r->width) ? trans[r->base + d] : dense[r->dflt + c];
+            if (match_bitmap[state / 8] & (1 << (state % 8))) {
+                matches += ACCompactMatches(ctx, pmq, buf, i, state, bitarray);
+            }
+        }
+    }
+
+    MpmCtxMapSids(mpm_ctx, pmq, sids_start);
+    return matches;
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     The signature _internal_ id.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCACCompactAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                            uint16_t offset, uint16_t depth, uint32_t pid,
+                            SigIntId sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     The signature _internal_ id.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCACCompactAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                            uint16_t offset, uint16_t depth, uint32_t pid,
+                            SigIntId sid, uint8_t flags)
+{
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+void SCACCompactPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+    return;
+}
+
+void SCACCompactPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+
+    printf("MPM AC Compact Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCACCompactCtx:  %" PRIuMAX "\n", (uintmax_t)sizeof(SCACCompactCtx));
+    printf("  SCACCompactRow:  %" PRIuMAX "\n", (uintmax_t)sizeof(SCACCompactRow));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Total states in the state table:    %" PRIu32 "\n", ctx->state_count);
+    printf("Alphabet classes:                   %" PRIu32 "\n", ctx->alpha_size);
+    printf("Stored transitions:                 %" PRIu32 "\n", ctx->trans_cnt);
+    printf("\n");
+}
+
+/**
+ * \brief Register the compressed aho-corasick mpm.
+ */
+void MpmACCompactRegister(void)
+{
+    mpm_table[MPM_AC_COMPACT].name = "ac-compact";
+    mpm_table[MPM_AC_COMPACT].InitCtx = SCACCompactInitCtx;
+    mpm_table[MPM_AC_COMPACT].InitThreadCtx = SCACCompactInitThreadCtx;
+    mpm_table[MPM_AC_COMPACT].DestroyCtx = SCACCompactDestroyCtx;
+    mpm_table[MPM_AC_COMPACT].DestroyThreadCtx = SCACCompactDestroyThreadCtx;
+    mpm_table[MPM_AC_COMPACT].AddPattern = SCACCompactAddPatternCS;
+    mpm_table[MPM_AC_COMPACT].AddPatternNocase = SCACCompactAddPatternCI;
+    mpm_table[MPM_AC_COMPACT].Prepare = SCACCompactPreparePatterns;
+    mpm_table[MPM_AC_COMPACT].Search = SCACCompactSearch;
+    mpm_table[MPM_AC_COMPACT].Cleanup = NULL;
+    mpm_table[MPM_AC_COMPACT].PrintCtx = SCACCompactPrintInfo;
+    mpm_table[MPM_AC_COMPACT].PrintThreadCtx = SCACCompactPrintSearchStats;
+    mpm_table[MPM_AC_COMPACT].RegisterUnittests = SCACCompactRegisterTests;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static int SCACCompactTest01(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    SCACCompactInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    /* 1 match */
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCACCompactPreparePatterns(&mpm_ctx) != 0);
+
+    const char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                     (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 1);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test overlapping patterns, the classic he/she/his/hers */
+static int SCACCompactTest02(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    SCACCompactInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"he", 2, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"she", 3, 0, 0, 1, 1, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"his", 3, 0, 0, 2, 2, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"hers", 4, 0, 0, 3, 3, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCACCompactPreparePatterns(&mpm_ctx) != 0);
+
+    const char *buf = "ushers";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                     (uint8_t *)buf, strlen(buf));
+    /* she, he and hers */
+    FAIL_IF(cnt != 3);
+    FAIL_IF(pmq.rule_id_array_cnt != 3);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test nocase and case sensitive patterns, bytes not in any pattern */
+static int SCACCompactTest03(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    SCACCompactInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"Ab\x00\xff", 4, 0, 0, 1, 1, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCACCompactPreparePatterns(&mpm_ctx) != 0);
+
+    const uint8_t buf[] = "abcd\x01" "ABCD\x80" "aBcD" "ab\x00\xff" "Ab\x00\xff";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                     buf, sizeof(buf) - 1);
+    FAIL_IF(cnt != 4);
+    FAIL_IF(pmq.rule_id_array_cnt != 2);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test every pattern id is only added once, but counted per match */
+static int SCACCompactTest04(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    SCACCompactInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"aa", 2, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"a", 1, 0, 0, 1, 1, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCACCompactPreparePatterns(&mpm_ctx) != 0);
+
+    const char *buf = "aaaa";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                     (uint8_t *)buf, strlen(buf));
+    /* 3x aa, 4x a */
+    FAIL_IF(cnt != 7);
+    FAIL_IF(pmq.rule_id_array_cnt != 2);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test same results as AC, and much less memory */
+static int SCACCompactTest05(void)
+{
+    MpmCtx compact_ctx, ac_ctx;
+    MpmThreadCtx compact_tctx, ac_tctx;
+    PatternMatcherQueue pmq;
+    uint32_t seed = 4321;
+
+    memset(&compact_ctx, 0, sizeof(MpmCtx));
+    memset(&ac_ctx, 0, sizeof(MpmCtx));
+    memset(&compact_tctx, 0, sizeof(MpmThreadCtx));
+    memset(&ac_tctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&compact_ctx, MPM_AC_COMPACT);
+    MpmInitCtx(&ac_ctx, MPM_AC);
+    mpm_table[MPM_AC_COMPACT].InitThreadCtx(&compact_ctx, &compact_tctx);
+    mpm_table[MPM_AC].InitThreadCtx(&ac_ctx, &ac_tctx);
+    PmqSetup(&pmq);
+
+    uint32_t i, j;
+    for (i = 0; i < 1000; i++) {
+        uint8_t pat[16];
+        uint16_t len = 1 + i % 12;
+        for (j = 0; j < len; j++) {
+            seed = seed * 1103515245 + 12345;
+            pat[j] = "abcdeABCDE/.:\x00\xff"[(seed >> 16) % 15];
+        }
+        if (i % 3 == 0) {
+            MpmAddPatternCI(&compact_ctx, pat, len, 0, 0, i, i, 0);
+            MpmAddPatternCI(&ac_ctx, pat, len, 0, 0, i, i, 0);
+        } else {
+            MpmAddPatternCS(&compact_ctx, pat, len, 0, 0, i, i, 0);
+            MpmAddPatternCS(&ac_ctx, pat, len, 0, 0, i, i, 0);
+        }
+    }
+    FAIL_IF(mpm_table[MPM_AC_COMPACT].Prepare(&compact_ctx) != 0);
+    FAIL_IF(mpm_table[MPM_AC].Prepare(&ac_ctx) != 0);
+    FAIL_IF(compact_ctx.memory_size * 4 > ac_ctx.memory_size);
+
+    uint8_t buf[1500];
+    for (i = 0; i < 50; i++) {
+        uint16_t len = (uint16_t)(i * 31 % sizeof(buf));
+        for (j = 0; j < len; j++) {
+            seed = seed * 1103515245 + 12345;
+            buf[j] = "abcdeABCDE/.:\x00\xffxyz"[(seed >> 16) % 18];
+        }
+
+        PmqReset(&pmq);
+        uint32_t ac_cnt = mpm_table[MPM_AC].Search(&ac_ctx, &ac_tctx,
+                                                   &pmq, buf, len);
+        uint32_t ac_sids = pmq.rule_id_array_cnt;
+
+        PmqReset(&pmq);
+        uint32_t compact_cnt = mpm_table[MPM_AC_COMPACT].Search(&compact_ctx,
+                &compact_tctx, &pmq, buf, len);
+        FAIL_IF(compact_cnt != ac_cnt);
+        FAIL_IF(pmq.rule_id_array_cnt != ac_sids);
+    }
+
+    mpm_table[MPM_AC_COMPACT].DestroyCtx(&compact_ctx);
+    mpm_table[MPM_AC].DestroyCtx(&ac_ctx);
+    mpm_table[MPM_AC_COMPACT].DestroyThreadCtx(&compact_ctx, &compact_tctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(&ac_ctx, &ac_tctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test more than 64k states, so 32 bit states */
+static int SCACCompactTest06(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint32_t seed = 1;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+    SCACCompactInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqSetup(&pmq);
+
+    uint32_t i, j;
+    for (i = 0; i < 5000; i++) {
+        uint8_t pat[20];
+        for (j = 0; j < sizeof(pat); j++) {
+            seed = seed * 1103515245 + 12345;
+            pat[j] = 'a' + (seed >> 16) % 26;
+        }
+        MpmAddPatternCI(&mpm_ctx, pat, sizeof(pat), 0, 0, i, i, 0);
+    }
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"Needle", 6, 0, 0, i, i, 0);
+
+    FAIL_IF(SCACCompactPreparePatterns(&mpm_ctx) != 0);
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx.ctx;
+    FAIL_IF(ctx->state_count <= 65536);
+    FAIL_IF_NULL(ctx->dense_u32);
+
+    const char *buf = "a haystack with a needle, a Needle and a NEEDLE";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                     (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 1);
+    FAIL_IF(pmq.rule_id_array_cnt != 1);
+    FAIL_IF(pmq.rule_id_array[0] != 5000);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    FAIL_IF(mpm_ctx.memory_size != 0);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test memory accounting goes back to 0 */
+static int SCACCompactTest07(void)
+{
+    MpmCtx mpm_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 1, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"fghJikl", 7, 0, 0, 2, 2, 0);
+
+    FAIL_IF(SCACCompactPreparePatterns(&mpm_ctx) != 0);
+    FAIL_IF(mpm_ctx.memory_size == 0);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    FAIL_IF(mpm_ctx.memory_size != 0);
+    FAIL_IF(mpm_ctx.memory_cnt != 0);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void SCACCompactRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCACCompactTest01", SCACCompactTest01);
+    UtRegisterTest("SCACCompactTest02", SCACCompactTest02);
+    UtRegisterTest("SCACCompactTest03", SCACCompactTest03);
+    UtRegisterTest("SCACCompactTest04", SCACCompactTest04);
+    UtRegisterTest("SCACCompactTest05", SCACCompactTest05);
+    UtRegisterTest("SCACCompactTest06", SCACCompactTest06);
+    UtRegisterTest("SCACCompactTest07", SCACCompactTest07);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,86 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Aho-Corasick with a compressed state table.
+ */
+
+#ifndef __UTIL_MPM_AC_COMPACT__H__
+#define __UTIL_MPM_AC_COMPACT__H__
+
+typedef struct SCACCompactPattern_ {
+    /* case sensitive pattern, NULL if the pattern is nocase */
+    uint8_t *cs;
+    uint16_t patlen;
+
+    /* sid(s) for this pattern */
+    uint32_t sids_size;
+    SigIntId *sids;
+} SCACCompactPattern;
+
+/** \brief transitions of a state
+ *
+ *  Classes first up to first + width - 1 are looked up in the transition
+ *  pool at base, all others in the dense row at offset dflt. */
+typedef struct SCACCompactRow_ {
+    uint32_t base;
+    uint8_t first;
+    uint8_t width;
+    uint16_t dflt;
+} SCACCompactRow;
+
+typedef struct SCACCompactCtx_ {
+    /* input byte to alphabet class. Upper and lower case share a class,
+     * bytes that are not in any pattern are class 0. */
+    uint8_t xlate[256];
+    /* number of classes */
+    uint16_t alpha_size;
+
+    /* no of states used by ac */
+    uint32_t state_count;
+
+    SCACCompactRow *rows;
+
+    /* full rows of the root and the depth 1 states (alpha_size entries
+     * each) and the transition pool. 16 bit states if we have less than
+     * 64k states, 32 bit otherwise. */
+    uint16_t *dense_u16;
+    uint16_t *trans_u16;
+    uint32_t *dense_u32;
+    uint32_t *trans_u32;
+    uint32_t dense_cnt;
+    uint32_t trans_cnt;
+
+    /* one bit per state, set if patterns end in that state */
+    uint8_t *match_bitmap;
+
+    /* pattern ids ending in state s are
+     * out_pids[out_offset[s]] up to out_pids[out_offset[s + 1]] */
+    uint32_t *out_offset;
+    uint32_t *out_pids;
+    uint32_t out_cnt;
+
+    /* patterns by pattern id */
+    SCACCompactPattern *pid_pat_list;
+    uint32_t pattern_id_bitarray_size;
+} SCACCompactCtx;
+
+void MpmACCompactRegister(void);
+
+#endif /* __UTIL_MPM_AC_COMPACT__H__ */
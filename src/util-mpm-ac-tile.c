@@ -1242,8 +1242,13 @@ uint32_t SCACTileSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     if (buflen == 0)
         return 0;
 
+    const uint32_t sids_start = pmq->rule_id_array_cnt;
+
     /* Context specific matching function. */
-    return search_ctx->search(search_ctx, mpm_thread_ctx, pmq, buf, buflen);
+    uint32_t matches = search_ctx->search(search_ctx, mpm_thread_ctx, pmq,
+                                          buf, buflen);
+    MpmCtxMapSids(mpm_ctx, pmq, sids_start);
+    return matches;
 }
 
 /* This function handles (ctx->state_count >= 32767) */
@@ -707,6 +707,47 @@ static void SCACPrintDeltaTable(MpmCtx *mpm_ctx)
 }
 #endif
 
+/** \internal
+ *  \brief free the state and output tables */
+static void SCACFreeTables(MpmCtx *mpm_ctx)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+
+    /* a state table loaded from the mpm cache lives in the mapping */
+    if (ctx->state_table_u16 != NULL) {
+        if (ctx->cache.map == NULL)
+            SCFree(ctx->state_table_u16);
+        ctx->state_table_u16 = NULL;
+
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size -= (ctx->state_count *
+                                 sizeof(SC_AC_STATE_TYPE_U16) * 256);
+    }
+    if (ctx->state_table_u32 != NULL) {
+        if (ctx->cache.map == NULL)
+            SCFree(ctx->state_table_u32);
+        ctx->state_table_u32 = NULL;
+
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size -= (ctx->state_count *
+                                 sizeof(SC_AC_STATE_TYPE_U32) * 256);
+    }
+    MpmCacheRelease(&ctx->cache);
+
+    if (ctx->output_table != NULL) {
+        uint32_t state_count;
+        for (state_count = 0; state_count < ctx->state_count; state_count++) {
+            if (ctx->output_table[state_count].pids != NULL) {
+                SCFree(ctx->output_table[state_count].pids);
+            }
+        }
+        SCFree(ctx->output_table);
+        ctx->output_table = NULL;
+    }
+    ctx->state_count = 0;
+    ctx->allocated_state_count = 0;
+}
+
 /**
  * \brief Process the patterns and prepare the state table.
  *
@@ -749,6 +790,231 @@ static void SCACPrepareStateTable(MpmCtx *mpm_ctx)
     return;
 }
 
+/** layout of the prepared tables in the mpm cache: this header, padded
+ *  to 64 bytes, the state table, the number of output entries for each
+ *  state and then all output pids */
+typedef struct SCACCacheHeader_ {
+    uint32_t state_count;
+    uint32_t state_size;
+    uint32_t pids_cnt;
+} SCACCacheHeader;
+
+#define SC_AC_CACHE_TABLE_OFFSET 64
+
+static int SCACCachePatternCmp(const void *a, const void *b)
+{
+    const MpmPattern *pa = *(const MpmPattern **)a;
+    const MpmPattern *pb = *(const MpmPattern **)b;
+    if (pa->id < pb->id)
+        return -1;
+    return pa->id > pb->id;
+}
+
+/** \internal
+ *  \brief get the cache key for the patterns of the ctx
+ *
+ *  Sorts the pattern array by id, so the key and the tables built
+ *  from it don't depend on the order the patterns were added in.
+ */
+static MpmCacheKey *SCACCacheKey(MpmCtx *mpm_ctx)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+
+    qsort(ctx->parray, mpm_ctx->pattern_cnt, sizeof(MpmPattern *),
+            SCACCachePatternCmp);
+
+    MpmCacheKey *key = MpmCacheKeyNew("ac");
+    if (key == NULL)
+        return NULL;
+    if (MpmCacheKeyAdd(key, &mpm_ctx->pattern_cnt, sizeof(uint32_t)) != 0)
+        goto error;
+
+    uint32_t i;
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        const MpmPattern *p = ctx->parray[i];
+        if (MpmCacheKeyAdd(key, &p->id, sizeof(p->id)) != 0 ||
+            MpmCacheKeyAdd(key, &p->flags, sizeof(p->flags)) != 0 ||
+            MpmCacheKeyAdd(key, &p->len, sizeof(p->len)) != 0 ||
+            MpmCacheKeyAdd(key, p->original_pat, p->len) != 0)
+            goto error;
+    }
+    return key;
+
+error:
+    MpmCacheKeyFree(key);
+    return NULL;
+}
+
+/** \internal
+ *  \brief check that a cache entry holds usable tables for the ctx
+ *
+ *  The entry is a file anyone with access to the cache dir can write, so
+ *  all offsets the search follows are checked: the output pids against
+ *  the pattern ids and every transition against the state count.
+ *
+ *  \retval 0 ok, -1 entry unusable
+ */
+static int SCACCacheCheck(const MpmCtx *mpm_ctx, const MpmCacheEntry *entry)
+{
+    if (entry->data_len < SC_AC_CACHE_TABLE_OFFSET)
+        return -1;
+    const SCACCacheHeader *hdr = (const SCACCacheHeader *)entry->data;
+    const uint32_t state_size = (hdr->state_count < 32767) ?
+        sizeof(SC_AC_STATE_TYPE_U16) : sizeof(SC_AC_STATE_TYPE_U32);
+    const uint64_t table_size = (uint64_t)hdr->state_count * state_size * 256;
+    if (hdr->state_count == 0 || hdr->state_size != state_size ||
+        entry->data_len != SC_AC_CACHE_TABLE_OFFSET + table_size +
+            (uint64_t)hdr->state_count * sizeof(uint32_t) +
+            (uint64_t)hdr->pids_cnt * sizeof(uint32_t))
+        return -1;
+
+    const uint8_t *table = entry->data + SC_AC_CACHE_TABLE_OFFSET;
+    const uint32_t *entries = (const uint32_t *)(table + table_size);
+    const uint32_t *pids = entries + hdr->state_count;
+    const uint64_t transitions = (uint64_t)hdr->state_count * 256;
+    uint64_t t;
+
+    if (state_size == sizeof(SC_AC_STATE_TYPE_U16)) {
+        const SC_AC_STATE_TYPE_U16 *trans = (const SC_AC_STATE_TYPE_U16 *)table;
+        for (t = 0; t < transitions; t++) {
+            if ((uint32_t)(trans[t] & 0x7FFF) >= hdr->state_count)
+                return -1;
+        }
+    } else {
+        const SC_AC_STATE_TYPE_U32 *trans = (const SC_AC_STATE_TYPE_U32 *)table;
+        for (t = 0; t < transitions; t++) {
+            if ((trans[t] & 0x00FFFFFF) >= hdr->state_count)
+                return -1;
+        }
+    }
+
+    uint32_t state, k, p = 0;
+    for (state = 0; state < hdr->state_count; state++) {
+        const uint32_t cnt = entries[state];
+        if (cnt > hdr->pids_cnt - p)
+            return -1;
+        for (k = 0; k < cnt; k++) {
+            if ((pids[p + k] & AC_PID_MASK) > mpm_ctx->max_pat_id)
+                return -1;
+        }
+        p += cnt;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief set up the state and output tables from a cache entry that
+ *         passed SCACCacheCheck
+ *
+ *  The state table is used in place in the mapping, the output table
+ *  is copied. On failure the ctx is left without tables.
+ *
+ *  \retval 0 ok, -1 out of memory
+ */
+static int SCACCacheLoad(MpmCtx *mpm_ctx, MpmCacheEntry *entry)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+
+    const SCACCacheHeader *hdr = (const SCACCacheHeader *)entry->data;
+    const uint64_t table_size = (uint64_t)hdr->state_count * hdr->state_size * 256;
+    const uint8_t *table = entry->data + SC_AC_CACHE_TABLE_OFFSET;
+    const uint32_t *entries = (const uint32_t *)(table + table_size);
+    const uint32_t *pids = entries + hdr->state_count;
+
+    SCACOutputTable *output_table = SCCalloc(hdr->state_count,
+                                             sizeof(SCACOutputTable));
+    if (output_table == NULL)
+        return -1;
+
+    uint32_t state, p = 0;
+    for (state = 0; state < hdr->state_count; state++) {
+        const uint32_t cnt = entries[state];
+        if (cnt == 0)
+            continue;
+        output_table[state].pids = SCMalloc(cnt * sizeof(uint32_t));
+        if (output_table[state].pids == NULL)
+            goto error;
+        memcpy(output_table[state].pids, pids + p, cnt * sizeof(uint32_t));
+        output_table[state].no_of_entries = cnt;
+        p += cnt;
+    }
+
+    ctx->output_table = output_table;
+    ctx->state_count = hdr->state_count;
+    if (hdr->state_size == sizeof(SC_AC_STATE_TYPE_U16))
+        ctx->state_table_u16 = (void *)table;
+    else
+        ctx->state_table_u32 = (void *)table;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += table_size;
+
+    ctx->cache = *entry;
+    return 0;
+
+error:
+    for (state = 0; state < hdr->state_count; state++)
+        SCFree(output_table[state].pids);
+    SCFree(output_table);
+    return -1;
+}
+
+/** \internal
+ *  \brief store the prepared state and output tables in the cache */
+static void SCACCacheStore(MpmCtx *mpm_ctx, const MpmCacheKey *key)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+
+    uint8_t head[SC_AC_CACHE_TABLE_OFFSET];
+    SCACCacheHeader hdr;
+    memset(&head, 0, sizeof(head));
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.state_count = ctx->state_count;
+
+    struct iovec iov[4];
+    iov[0].iov_base = head;
+    iov[0].iov_len = SC_AC_CACHE_TABLE_OFFSET;
+    if (ctx->state_table_u16 != NULL) {
+        hdr.state_size = sizeof(SC_AC_STATE_TYPE_U16);
+        iov[1].iov_base = ctx->state_table_u16;
+    } else {
+        hdr.state_size = sizeof(SC_AC_STATE_TYPE_U32);
+        iov[1].iov_base = ctx->state_table_u32;
+    }
+    iov[1].iov_len = (size_t)ctx->state_count * hdr.state_size * 256;
+
+    uint32_t *entries = SCMalloc(ctx->state_count * sizeof(uint32_t));
+    if (entries == NULL)
+        return;
+    uint32_t state;
+    for (state = 0; state < ctx->state_count; state++) {
+        entries[state] = ctx->output_table[state].no_of_entries;
+        hdr.pids_cnt += entries[state];
+    }
+    uint32_t *pids = SCMalloc(hdr.pids_cnt * sizeof(uint32_t) + 1);
+    if (pids == NULL) {
+        SCFree(entries);
+        return;
+    }
+    uint32_t p = 0;
+    for (state = 0; state < ctx->state_count; state++) {
+        if (entries[state] == 0)
+            continue;
+        memcpy(pids + p, ctx->output_table[state].pids,
+                entries[state] * sizeof(uint32_t));
+        p += entries[state];
+    }
+    iov[2].iov_base = entries;
+    iov[2].iov_len = ctx->state_count * sizeof(uint32_t);
+    iov[3].iov_base = pids;
+    iov[3].iov_len = hdr.pids_cnt * sizeof(uint32_t);
+    memcpy(head, &hdr, sizeof(hdr));
+
+    (void)MpmCacheStore(key, iov, 4);
+
+    SCFree(entries);
+    SCFree(pids);
+}
+
 /**
  * \brief Process the patterns added to the mpm, and create the internal tables.
  *
@@ -820,8 +1086,51 @@ int SCACPreparePatterns(MpmCtx *mpm_ctx)
         ctx->parray[i]->sids = NULL;
     }
 
-    /* prepare the state table required by AC */
-    SCACPrepareStateTable(mpm_ctx);
+    /* the tables are in the mpm cache if these patterns were prepared
+     * before. Only a single state table is cached. */
+    MpmCacheKey *cache_key = NULL;
+    if (mpm_ctx->mpm_type == MPM_AC && !construct_both_16_and_32_state_tables &&
+        MpmCacheEnabled())
+    {
+        cache_key = SCACCacheKey(mpm_ctx);
+    }
+    MpmCacheEntry entry;
+    int cached = 0;
+    if (cache_key != NULL && MpmCacheLoad(cache_key, &entry) == 1) {
+        if (SCACCacheCheck(mpm_ctx, &entry) != 0) {
+            SCLogWarning(SC_ERR_AHO_CORASICK, "corrupt mpm cache entry, "
+                    "rebuilding state table");
+            MpmCacheRelease(&entry);
+        } else if (SCACCacheLoad(mpm_ctx, &entry) != 0) {
+            MpmCacheRelease(&entry);
+        } else {
+            cached = 1;
+        }
+    }
+    if (!cached) {
+        /* prepare the state table required by AC */
+        SCACPrepareStateTable(mpm_ctx);
+        if (cache_key != NULL)
+            SCACCacheStore(mpm_ctx, cache_key);
+
+        /* when shared, switch to the stored tables so that other processes
+         * loading them share the pages with us. The file may have been
+         * replaced since we wrote it, so it's checked like any other. */
+        if (cache_key != NULL && MpmCacheShared() &&
+            MpmCacheLoad(cache_key, &entry) == 1)
+        {
+            if (SCACCacheCheck(mpm_ctx, &entry) != 0) {
+                MpmCacheRelease(&entry);
+            } else {
+                SCACFreeTables(mpm_ctx);
+                if (SCACCacheLoad(mpm_ctx, &entry) != 0) {
+                    MpmCacheRelease(&entry);
+                    SCACPrepareStateTable(mpm_ctx);
+                }
+            }
+        }
+    }
+    MpmCacheKeyFree(cache_key);
 
 #ifdef __SC_CUDA_SUPPORT__
     if (mpm_ctx->mpm_type == MPM_AC_CUDA) {
@@ -969,32 +1278,7 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
         mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(MpmPattern *));
     }
 
-    if (ctx->state_table_u16 != NULL) {
-        SCFree(ctx->state_table_u16);
-        ctx->state_table_u16 = NULL;
-
-        mpm_ctx->memory_cnt++;
-        mpm_ctx->memory_size -= (ctx->state_count *
-                                 sizeof(SC_AC_STATE_TYPE_U16) * 256);
-    }
-    if (ctx->state_table_u32 != NULL) {
-        SCFree(ctx->state_table_u32);
-        ctx->state_table_u32 = NULL;
-
-        mpm_ctx->memory_cnt++;
-        mpm_ctx->memory_size -= (ctx->state_count *
-                                 sizeof(SC_AC_STATE_TYPE_U32) * 256);
-    }
-
-    if (ctx->output_table != NULL) {
-        uint32_t state_count;
-        for (state_count = 0; state_count < ctx->state_count; state_count++) {
-            if (ctx->output_table[state_count].pids != NULL) {
-                SCFree(ctx->output_table[state_count].pids);
-            }
-        }
-        SCFree(ctx->output_table);
-    }
+    SCACFreeTables(mpm_ctx);
 
     if (ctx->pid_pat_list != NULL) {
         uint32_t i;
@@ -1032,6 +1316,7 @@ uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     const SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
     int i = 0;
     int matches = 0;
+    const uint32_t sids_start = pmq->rule_id_array_cnt;
 
     /* \todo tried loop unrolling with register var, with no perf increase.  Need
      * to dig deeper */
@@ -1122,6 +1407,7 @@ uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
         } /* for (i = 0; i < buflen; i++) */
     }
 
+    MpmCtxMapSids(mpm_ctx, pmq, sids_start);
     return matches;
 }
 
@@ -1568,6 +1854,7 @@ uint32_t SCACCudaPacketResultsProcessing(Packet *p, const MpmCtx *mpm_ctx,
         return 0;
 
     uint32_t matches = 0;
+    const uint32_t sids_start = pmq->rule_id_array_cnt;
     uint32_t *results = p->cuda_pkt_vars.cuda_results + 1;
     uint8_t *buf = p->payload;
     SCACCtx *ctx = mpm_ctx->ctx;
@@ -1618,6 +1905,7 @@ uint32_t SCACCudaPacketResultsProcessing(Packet *p, const MpmCtx *mpm_ctx,
         }
     }
 
+    MpmCtxMapSids(mpm_ctx, pmq, sids_start);
     return matches;
 }
 
@@ -2827,6 +3115,208 @@ end:
     return result;
 }
 
+#include <dirent.h>
+
+static int SCACTestCacheDirRemove(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return -1;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        unlink(path);
+    }
+    closedir(d);
+    return rmdir(dir);
+}
+
+/** \test state table from the mpm cache matches like a built one */
+static int SCACTest30(void)
+{
+    char dir[] = "/tmp/suricata-ac-cache-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+    FAIL_IF(MpmCacheSetDir(dir) != 0);
+    MpmCacheSetShared(0);
+
+    uint64_t hits = 0, misses = 0;
+    MpmCacheGetStats(&hits, &misses);
+
+    int pass;
+    for (pass = 0; pass < 2; pass++) {
+        MpmCtx mpm_ctx;
+        MpmThreadCtx mpm_thread_ctx;
+        PatternMatcherQueue pmq;
+
+        memset(&mpm_ctx, 0, sizeof(MpmCtx));
+        memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+        MpmInitCtx(&mpm_ctx, MPM_AC);
+        SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+        /* add in a different order each pass */
+        if (pass == 0) {
+            MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+            MpmAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+            MpmAddPatternCS(&mpm_ctx, (uint8_t *)"fghJ", 4, 0, 0, 2, 0, 0);
+        } else {
+            MpmAddPatternCS(&mpm_ctx, (uint8_t *)"fghJ", 4, 0, 0, 2, 0, 0);
+            MpmAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+            MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+        }
+        PmqSetup(&pmq);
+
+        FAIL_IF(SCACPreparePatterns(&mpm_ctx) != 0);
+        SCACCtx *ctx = (SCACCtx *)mpm_ctx.ctx;
+        FAIL_IF((ctx->cache.map != NULL) != (pass == 1));
+
+        char *buf = "abcdefghjiklmnopqrstuvwxyz";
+        uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                  (uint8_t *)buf, strlen(buf));
+        FAIL_IF(cnt != 2);
+
+        SCACDestroyCtx(&mpm_ctx);
+        SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+        PmqFree(&pmq);
+    }
+
+    uint64_t hits2 = 0, misses2 = 0;
+    MpmCacheGetStats(&hits2, &misses2);
+    FAIL_IF(hits2 != hits + 1);
+    FAIL_IF(misses2 != misses + 1);
+
+    FAIL_IF(SCACTestCacheDirRemove(dir) != 0);
+    MpmCacheSetDir(NULL);
+    PASS;
+}
+
+/** \test with a shared cache the built table is used from the cache
+ *        right away */
+static int SCACTest31(void)
+{
+    char dir[] = "/tmp/suricata-ac-cache-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+    FAIL_IF(MpmCacheSetDir(dir) != 0);
+    MpmCacheSetShared(1);
+
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"fghJ", 4, 0, 0, 2, 0, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCACPreparePatterns(&mpm_ctx) != 0);
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx.ctx;
+    FAIL_IF_NULL(ctx->cache.map);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 2);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+
+    FAIL_IF(SCACTestCacheDirRemove(dir) != 0);
+    MpmCacheSetShared(0);
+    MpmCacheSetDir(NULL);
+    PASS;
+}
+
+/** \test a cache entry with a transition out of the state table is
+ *        not used, the table is rebuilt */
+static int SCACTest32(void)
+{
+    char dir[] = "/tmp/suricata-ac-cache-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+    FAIL_IF(MpmCacheSetDir(dir) != 0);
+    MpmCacheSetShared(0);
+
+    int pass;
+    for (pass = 0; pass < 2; pass++) {
+        MpmCtx mpm_ctx;
+        MpmThreadCtx mpm_thread_ctx;
+        PatternMatcherQueue pmq;
+
+        memset(&mpm_ctx, 0, sizeof(MpmCtx));
+        memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+        MpmInitCtx(&mpm_ctx, MPM_AC);
+        SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+        MpmAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)"fghJ", 4, 0, 0, 2, 0, 0);
+        PmqSetup(&pmq);
+
+        FAIL_IF(SCACPreparePatterns(&mpm_ctx) != 0);
+        SCACCtx *ctx = (SCACCtx *)mpm_ctx.ctx;
+        /* 2nd pass: the entry is there, but it's not used */
+        FAIL_IF_NOT_NULL(ctx->cache.map);
+        FAIL_IF_NULL(ctx->state_table_u16);
+
+        char *buf = "abcdefghjiklmnopqrstuvwxyz";
+        uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                  (uint8_t *)buf, strlen(buf));
+        FAIL_IF(cnt != 2);
+
+        if (pass == 0) {
+            /* point the transition of state 0 on 'a' past the table. The
+             * entry's data is at the end of the file. */
+            uint64_t data_len = SC_AC_CACHE_TABLE_OFFSET +
+                (uint64_t)ctx->state_count * sizeof(SC_AC_STATE_TYPE_U16) * 256 +
+                (uint64_t)ctx->state_count * sizeof(uint32_t);
+            uint32_t state;
+            for (state = 0; state < ctx->state_count; state++)
+                data_len += ctx->output_table[state].no_of_entries * sizeof(uint32_t);
+
+            DIR *d = opendir(dir);
+            FAIL_IF_NULL(d);
+            struct dirent *de;
+            int flipped = 0;
+            while ((de = readdir(d)) != NULL) {
+                if (de->d_name[0] == '.')
+                    continue;
+                char path[PATH_MAX];
+                snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+                struct stat st;
+                int fd = open(path, O_WRONLY);
+                if (fd < 0)
+                    continue;
+                if (fstat(fd, &st) == 0 && (uint64_t)st.st_size > data_len) {
+                    const off_t off = st.st_size - data_len +
+                        SC_AC_CACHE_TABLE_OFFSET +
+                        'a' * sizeof(SC_AC_STATE_TYPE_U16);
+                    SC_AC_STATE_TYPE_U16 bad = 0x7FFE;
+                    if (pwrite(fd, &bad, sizeof(bad), off) == sizeof(bad))
+                        flipped++;
+                }
+                close(fd);
+            }
+            closedir(d);
+            FAIL_IF(flipped != 1);
+        }
+
+        SCACDestroyCtx(&mpm_ctx);
+        SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+        PmqFree(&pmq);
+    }
+
+    FAIL_IF(SCACTestCacheDirRemove(dir) != 0);
+    MpmCacheSetDir(NULL);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCACRegisterTests(void)
@@ -2862,6 +3352,9 @@ void SCACRegisterTests(void)
     UtRegisterTest("SCACTest27", SCACTest27);
     UtRegisterTest("SCACTest28", SCACTest28);
     UtRegisterTest("SCACTest29", SCACTest29);
+    UtRegisterTest("SCACTest30", SCACTest30);
+    UtRegisterTest("SCACTest31", SCACTest31);
+    UtRegisterTest("SCACTest32", SCACTest32);
 #endif
 
     return;
@@ -25,6 +25,8 @@
 #ifndef __UTIL_MPM_AC__H__
 #define __UTIL_MPM_AC__H__
 
+#include "util-mpm-cache.h"
+
 #define SC_AC_STATE_TYPE_U16 uint16_t
 #define SC_AC_STATE_TYPE_U32 uint32_t
 
@@ -80,6 +82,9 @@ typedef struct SCACCtx_ {
 
     uint32_t allocated_state_count;
 
+    /* mpm cache entry the state table was loaded from, if any */
+    MpmCacheEntry cache;
+
 #ifdef __SC_CUDA_SUPPORT__
     CUdeviceptr state_table_u16_cuda;
     CUdeviceptr state_table_u32_cuda;
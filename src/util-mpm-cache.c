@@ -0,0 +1,450 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * On disk cache of prepared mpm ctxs.
+ *
+ * Preparing a mpm ctx (AC state tables, Hyperscan compile) is the bulk of
+ * the startup and reload time, while the ruleset mostly didn't change.
+ * Each prepared ctx is stored in detect.mpm.cache-dir in a file named by
+ * a hash of its key. The key is everything the prepared ctx depends on:
+ * engine version, matcher and the patterns. It is stored in the file as
+ * well and compared in full on load, so a hash collision or a stale file
+ * is a miss, never a wrong ctx.
+ *
+ * Entries are mmap'd, so a matcher that can use its data in place (the
+ * AC state table) shares the pages with the page cache. With
+ * detect.mpm.cache-share the matchers use their entries in place wherever
+ * they can, also right after building them, so that processes running
+ * the same ruleset share one copy of the tables.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "threads.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-mpm-cache.h"
+
+#include <sys/mman.h>
+
+#define MPM_CACHE_MAGIC         "SCMPMC\0\1"
+#define MPM_CACHE_BYTE_ORDER    0x01020304
+#define MPM_CACHE_ALIGN         64
+
+typedef struct MpmCacheHeader_ {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t key_len;
+    uint64_t data_offset;
+    uint64_t data_len;
+} MpmCacheHeader;
+
+static SCMutex cache_lock = SCMUTEX_INITIALIZER;
+static int cache_init = 0;
+static int cache_share = 0;
+static char cache_dir[PATH_MAX] = "";
+static uint64_t cache_hits = 0;
+static uint64_t cache_misses = 0;
+
+/** \internal
+ *  \brief set the cache dir, creating it if needed. Needs cache_lock. */
+static int MpmCacheSetDirLocked(const char *dir)
+{
+    cache_dir[0] = '\0';
+    if (dir == NULL || dir[0] == '\0')
+        return 0;
+
+    struct stat st;
+    if (stat(dir, &st) != 0) {
+        if (mkdir(dir, S_IRWXU|S_IRGRP|S_IXGRP) != 0 && errno != EEXIST) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "failed to create mpm cache "
+                    "dir %s: %s", dir, strerror(errno));
+            return -1;
+        }
+    } else if (!S_ISDIR(st.st_mode)) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "mpm cache dir %s is not a "
+                "directory", dir);
+        return -1;
+    }
+
+    strlcpy(cache_dir, dir, sizeof(cache_dir));
+    return 0;
+}
+
+/**
+ *  \brief set or clear (NULL) the cache dir, overriding
+ *         detect.mpm.cache-dir
+ *
+ *  \retval 0 ok
+ *  \retval -1 dir unusable, cache disabled
+ */
+int MpmCacheSetDir(const char *dir)
+{
+    SCMutexLock(&cache_lock);
+    cache_init = 1;
+    int r = MpmCacheSetDirLocked(dir);
+    SCMutexUnlock(&cache_lock);
+    return r;
+}
+
+/** \retval 1 if detect.mpm.cache-dir is set and usable */
+int MpmCacheEnabled(void)
+{
+    SCMutexLock(&cache_lock);
+    if (!cache_init) {
+        char *dir = NULL;
+        if (ConfGet("detect.mpm.cache-dir", &dir) == 1 && dir != NULL) {
+            if (MpmCacheSetDirLocked(dir) == 0) {
+                (void)ConfGetBool("detect.mpm.cache-share", &cache_share);
+                SCLogConfig("mpm cache dir %s%s", cache_dir,
+                        cache_share ? ", shared" : "");
+            }
+        }
+        cache_init = 1;
+    }
+    int r = (cache_dir[0] != '\0');
+    SCMutexUnlock(&cache_lock);
+    return r;
+}
+
+/** \retval 1 if the cache is enabled and the matchers should use their
+ *          cache entries in place, so that they're shared between
+ *          processes */
+int MpmCacheShared(void)
+{
+    if (!MpmCacheEnabled())
+        return 0;
+    SCMutexLock(&cache_lock);
+    int r = cache_share;
+    SCMutexUnlock(&cache_lock);
+    return r;
+}
+
+/** \brief override detect.mpm.cache-share */
+void MpmCacheSetShared(int share)
+{
+    SCMutexLock(&cache_lock);
+    cache_share = share;
+    SCMutexUnlock(&cache_lock);
+}
+
+/**
+ *  \brief start a cache key
+ *
+ *  \param matcher name, and where the prepared data depends on it,
+ *         version of the matcher
+ */
+MpmCacheKey *MpmCacheKeyNew(const char *matcher)
+{
+    MpmCacheKey *key = SCCalloc(1, sizeof(*key));
+    if (unlikely(key == NULL))
+        return NULL;
+
+    static const char engine[] = "suricata " PROG_VER;
+    uint32_t sigintid_size = sizeof(SigIntId);
+    if (MpmCacheKeyAdd(key, engine, sizeof(engine)) != 0 ||
+        MpmCacheKeyAdd(key, matcher, strlen(matcher) + 1) != 0 ||
+        MpmCacheKeyAdd(key, &sigintid_size, sizeof(sigintid_size)) != 0)
+    {
+        MpmCacheKeyFree(key);
+        return NULL;
+    }
+    return key;
+}
+
+/** \retval 0 ok, -1 out of memory */
+int MpmCacheKeyAdd(MpmCacheKey *key, const void *data, uint32_t len)
+{
+    if (key->len + len > key->size) {
+        uint32_t size = key->size ? key->size : 4096;
+        while (size < key->len + len)
+            size *= 2;
+        void *ptmp = SCRealloc(key->buf, size);
+        if (unlikely(ptmp == NULL))
+            return -1;
+        key->buf = ptmp;
+        key->size = size;
+    }
+    memcpy(key->buf + key->len, data, len);
+    key->len += len;
+    return 0;
+}
+
+void MpmCacheKeyFree(MpmCacheKey *key)
+{
+    if (key != NULL) {
+        if (key->buf != NULL)
+            SCFree(key->buf);
+        SCFree(key);
+    }
+}
+
+static void MpmCachePath(const MpmCacheKey *key, char *path, size_t size)
+{
+    /* FNV-1a, only used to pick the file */
+    uint64_t hash = 14695981039346656037ULL;
+    uint32_t u;
+    for (u = 0; u < key->len; u++) {
+        hash ^= key->buf[u];
+        hash *= 1099511628211ULL;
+    }
+    snprintf(path, size, "%s/%016"PRIx64".mpm", cache_dir, hash);
+}
+
+static void MpmCacheCount(int hit)
+{
+    SCMutexLock(&cache_lock);
+    if (hit)
+        cache_hits++;
+    else
+        cache_misses++;
+    SCMutexUnlock(&cache_lock);
+}
+
+/**
+ *  \brief look up and map the cache entry for key
+ *
+ *  \retval 1 hit, entry is set up and needs MpmCacheRelease
+ *  \retval 0 miss
+ */
+int MpmCacheLoad(const MpmCacheKey *key, MpmCacheEntry *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+    if (!MpmCacheEnabled())
+        return 0;
+
+    char path[PATH_MAX];
+    MpmCachePath(key, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        SCLogDebug("no cache file %s", path);
+        MpmCacheCount(0);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MpmCacheHeader)) {
+        close(fd);
+        goto miss;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        goto miss;
+
+    const MpmCacheHeader *hdr = map;
+    const uint64_t size = (uint64_t)st.st_size;
+    if (memcmp(hdr->magic, MPM_CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->byte_order != MPM_CACHE_BYTE_ORDER ||
+        hdr->key_len != key->len ||
+        sizeof(MpmCacheHeader) + (uint64_t)hdr->key_len > size ||
+        hdr->data_offset % MPM_CACHE_ALIGN != 0 ||
+        hdr->data_offset > size || hdr->data_len > size - hdr->data_offset ||
+        memcmp((uint8_t *)map + sizeof(MpmCacheHeader), key->buf, key->len) != 0)
+    {
+        SCLogDebug("cache file %s doesn't match", path);
+        munmap(map, st.st_size);
+        goto miss;
+    }
+
+    entry->map = map;
+    entry->map_len = st.st_size;
+    entry->data = (uint8_t *)map + hdr->data_offset;
+    entry->data_len = hdr->data_len;
+    SCLogDebug("cache hit %s, %"PRIu64" bytes", path, entry->data_len);
+    MpmCacheCount(1);
+    return 1;
+
+miss:
+    MpmCacheCount(0);
+    return 0;
+}
+
+/** \brief unmap a cache entry */
+void MpmCacheRelease(MpmCacheEntry *entry)
+{
+    if (entry->map != NULL) {
+        munmap(entry->map, entry->map_len);
+    }
+    memset(entry, 0, sizeof(*entry));
+}
+
+static int MpmCacheWrite(int fd, const void *data, size_t len)
+{
+    const uint8_t *ptr = data;
+    while (len > 0) {
+        ssize_t r = write(fd, ptr, len);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        ptr += r;
+        len -= r;
+    }
+    return 0;
+}
+
+/**
+ *  \brief store the prepared data for key
+ *
+ *  The file is written under a temporary name and renamed, so loaders
+ *  never see a partial entry. Errors only cost the next start a miss.
+ *
+ *  \retval 0 stored, -1 error
+ */
+int MpmCacheStore(const MpmCacheKey *key, const struct iovec *iov, int iovcnt)
+{
+    if (!MpmCacheEnabled())
+        return -1;
+
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    MpmCachePath(key, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d.%lu.tmp", path, (int)getpid(),
+            (unsigned long)SCGetThreadIdLong());
+
+    int fd = open(tmp, O_WRONLY|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR|S_IRGRP);
+    if (fd < 0) {
+        SCLogDebug("failed to create %s: %s", tmp, strerror(errno));
+        return -1;
+    }
+
+    MpmCacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MPM_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.byte_order = MPM_CACHE_BYTE_ORDER;
+    hdr.key_len = key->len;
+    hdr.data_offset = sizeof(hdr) + key->len;
+    hdr.data_offset += (MPM_CACHE_ALIGN - hdr.data_offset % MPM_CACHE_ALIGN) %
+        MPM_CACHE_ALIGN;
+    int i;
+    for (i = 0; i < iovcnt; i++)
+        hdr.data_len += iov[i].iov_len;
+
+    static const uint8_t pad[MPM_CACHE_ALIGN] = { 0 };
+    if (MpmCacheWrite(fd, &hdr, sizeof(hdr)) != 0 ||
+        MpmCacheWrite(fd, key->buf, key->len) != 0 ||
+        MpmCacheWrite(fd, pad, hdr.data_offset - sizeof(hdr) - key->len) != 0)
+        goto error;
+    for (i = 0; i < iovcnt; i++) {
+        if (MpmCacheWrite(fd, iov[i].iov_base, iov[i].iov_len) != 0)
+            goto error;
+    }
+    if (close(fd) != 0) {
+        fd = -1;
+        goto error;
+    }
+    fd = -1;
+
+    if (rename(tmp, path) != 0)
+        goto error;
+
+    SCLogDebug("stored %s, %"PRIu64" bytes", path, hdr.data_len);
+    return 0;
+
+error:
+    SCLogWarning(SC_ERR_FWRITE, "failed to write mpm cache file %s: %s",
+            path, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    unlink(tmp);
+    return -1;
+}
+
+/** \brief get the number of cache hits and misses so far */
+void MpmCacheGetStats(uint64_t *hits, uint64_t *misses)
+{
+    SCMutexLock(&cache_lock);
+    *hits = cache_hits;
+    *misses = cache_misses;
+    SCMutexUnlock(&cache_lock);
+}
+
+#ifdef UNITTESTS
+
+static int MpmCacheTest01(void)
+{
+    char dir[] = "/tmp/suricata-mpm-cache-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+    FAIL_IF(MpmCacheSetDir(dir) != 0);
+    FAIL_IF_NOT(MpmCacheEnabled());
+
+    MpmCacheKey *key = MpmCacheKeyNew("test");
+    FAIL_IF_NULL(key);
+    FAIL_IF(MpmCacheKeyAdd(key, "pattern", 7) != 0);
+
+    MpmCacheEntry entry;
+    FAIL_IF(MpmCacheLoad(key, &entry) != 0);
+
+    uint32_t table[1000];
+    uint32_t u;
+    for (u = 0; u < 1000; u++)
+        table[u] = u * 7;
+    struct iovec iov[2] = {
+        { (void *)"head", 4 },
+        { table, sizeof(table) },
+    };
+    FAIL_IF(MpmCacheStore(key, iov, 2) != 0);
+
+    FAIL_IF(MpmCacheLoad(key, &entry) != 1);
+    FAIL_IF(entry.data_len != 4 + sizeof(table));
+    FAIL_IF(((uintptr_t)entry.data % MPM_CACHE_ALIGN) != 0);
+    FAIL_IF(memcmp(entry.data, "head", 4) != 0);
+    FAIL_IF(memcmp(entry.data + 4, table, sizeof(table)) != 0);
+    MpmCacheRelease(&entry);
+
+    char path[PATH_MAX];
+    MpmCachePath(key, path, sizeof(path));
+
+    /* file of another key under our name (hash collision): miss */
+    MpmCacheKey *key2 = MpmCacheKeyNew("test");
+    FAIL_IF_NULL(key2);
+    FAIL_IF(MpmCacheKeyAdd(key2, "patterX", 7) != 0);
+    char path2[PATH_MAX];
+    MpmCachePath(key2, path2, sizeof(path2));
+    FAIL_IF(rename(path, path2) != 0);
+    FAIL_IF(MpmCacheLoad(key2, &entry) != 0);
+
+    /* truncated: miss */
+    FAIL_IF(rename(path2, path) != 0);
+    FAIL_IF(truncate(path, sizeof(MpmCacheHeader) + 10) != 0);
+    FAIL_IF(MpmCacheLoad(key, &entry) != 0);
+
+    FAIL_IF(unlink(path) != 0);
+    FAIL_IF(rmdir(dir) != 0);
+    MpmCacheKeyFree(key);
+    MpmCacheKeyFree(key2);
+    MpmCacheSetDir(NULL);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void MpmCacheRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MpmCacheTest01", MpmCacheTest01);
+#endif
+}
@@ -0,0 +1,61 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * On disk cache of prepared mpm ctxs, shared by the mpm implementations.
+ */
+
+#ifndef __UTIL_MPM_CACHE_H__
+#define __UTIL_MPM_CACHE_H__
+
+#include <sys/uio.h>
+
+/** key of a cache entry: everything the prepared ctx depends on, usually
+ *  the matcher name and version followed by the patterns */
+typedef struct MpmCacheKey_ {
+    uint8_t *buf;
+    uint32_t len;
+    uint32_t size;
+} MpmCacheKey;
+
+/** a cache entry mapped into memory */
+typedef struct MpmCacheEntry_ {
+    void *map;
+    size_t map_len;
+    const uint8_t *data;    /**< 64 byte aligned */
+    uint64_t data_len;
+} MpmCacheEntry;
+
+int MpmCacheEnabled(void);
+int MpmCacheSetDir(const char *dir);
+int MpmCacheShared(void);
+void MpmCacheSetShared(int share);
+
+MpmCacheKey *MpmCacheKeyNew(const char *matcher);
+int MpmCacheKeyAdd(MpmCacheKey *key, const void *data, uint32_t len);
+void MpmCacheKeyFree(MpmCacheKey *key);
+
+int MpmCacheLoad(const MpmCacheKey *key, MpmCacheEntry *entry);
+void MpmCacheRelease(MpmCacheEntry *entry);
+int MpmCacheStore(const MpmCacheKey *key, const struct iovec *iov, int iovcnt);
+void MpmCacheGetStats(uint64_t *hits, uint64_t *misses);
+
+void MpmCacheRegisterTests(void);
+
+#endif /* __UTIL_MPM_CACHE_H__ */
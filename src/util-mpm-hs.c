@@ -37,6 +37,7 @@
 #include "util-unittest-helper.h"
 #include "util-memcmp.h"
 #include "util-mpm-hs.h"
+#include "util-mpm-cache.h"
 #include "util-memcpy.h"
 #include "util-hash.h"
 #include "util-hash-lookup3.h"
@@ -78,6 +79,14 @@ static SCMutex g_scratch_proto_mutex = SCMUTEX_INITIALIZER;
 static HashTable *g_db_table = NULL;
 static SCMutex g_db_table_mutex = SCMUTEX_INITIALIZER;
 
+/* Global hash table of multi buffer databases, used for de-duplication.
+ * Access is serialised via g_db_table_mutex as well. */
+static HashTable *g_multi_db_table = NULL;
+
+/* Pattern count of the largest multi buffer database, used to size the per
+ * thread seen array. Access is serialised via g_scratch_proto_mutex. */
+static uint32_t g_multi_max_patterns = 0;
+
 /**
  * \internal
  * \brief Wraps SCMalloc (which is a macro) so that it can be passed to
@@ -442,6 +451,9 @@ typedef struct PatternDatabase_ {
     hs_database_t *hs_db;
     uint32_t pattern_cnt;
 
+    /* mpm cache entry hs_db points into when it's used in place */
+    MpmCacheEntry image;
+
     /* Reference count: number of MPM contexts using this pattern database. */
     uint32_t ref_cnt;
 } PatternDatabase;
@@ -531,11 +543,27 @@ static void PatternDatabaseFree(PatternDatabase *pd)
         SCFree(pd->parray);
     }
 
-    hs_free_database(pd->hs_db);
+    if (pd->image.map != NULL) {
+        MpmCacheRelease(&pd->image);
+    } else {
+        hs_free_database(pd->hs_db);
+    }
 
     SCFree(pd);
 }
 
+/* Drop a reference to a pattern database, and delete it entirely if the
+ * count has dropped to zero. Needs g_db_table_mutex to be held. */
+static void PatternDatabaseRelease(PatternDatabase *pd)
+{
+    BUG_ON(pd->ref_cnt == 0);
+    pd->ref_cnt--;
+    if (pd->ref_cnt == 0) {
+        HashTableRemove(g_db_table, pd, 1);
+        PatternDatabaseFree(pd);
+    }
+}
+
 static void PatternDatabaseTableFree(void *data)
 {
     /* Stub function handed to hash table; actual freeing of PatternDatabase
@@ -565,6 +593,263 @@ static PatternDatabase *PatternDatabaseAlloc(uint32_t pattern_cnt)
     return pd;
 }
 
+/* Use the cached database identical to pd for ctx, if there is one. Needs
+ * g_db_table_mutex to be held.
+ * \retval 1 cached database used, pd can be freed
+ * \retval 0 not in the cache */
+static int PatternDatabaseUseCached(SCHSCtx *ctx, PatternDatabase *pd)
+{
+    PatternDatabase *pd_cached = HashTableLookup(g_db_table, pd, 1);
+    if (pd_cached == NULL)
+        return 0;
+
+    SCLogDebug("Reusing cached database %p with %" PRIu32
+               " patterns (ref_cnt=%" PRIu32 ")",
+               pd_cached->hs_db, pd_cached->pattern_cnt,
+               pd_cached->ref_cnt);
+    pd_cached->ref_cnt++;
+    ctx->pattern_db = pd_cached;
+    return 1;
+}
+
+/** \internal
+ *  \brief compile the patterns of pd into pd->hs_db
+ *  \retval 0 ok, -1 error */
+static int SCHSCompilePatternDatabase(PatternDatabase *pd, SCHSCompileData *cd)
+{
+    hs_error_t err;
+    hs_compile_error_t *compile_err = NULL;
+
+    for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
+        const SCHSPattern *p = pd->parray[i];
+
+        cd->ids[i] = i;
+        cd->flags[i] = HS_FLAG_SINGLEMATCH;
+        if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+            cd->flags[i] |= HS_FLAG_CASELESS;
+        }
+
+        cd->expressions[i] = HSRenderPattern(p->original_pat, p->len);
+
+        if (p->flags & (MPM_PATTERN_FLAG_OFFSET | MPM_PATTERN_FLAG_DEPTH)) {
+            cd->ext[i] = SCMalloc(sizeof(hs_expr_ext_t));
+            if (cd->ext[i] == NULL) {
+                return -1;
+            }
+            memset(cd->ext[i], 0, sizeof(hs_expr_ext_t));
+
+            if (p->flags & MPM_PATTERN_FLAG_OFFSET) {
+                cd->ext[i]->flags |= HS_EXT_FLAG_MIN_OFFSET;
+                cd->ext[i]->min_offset = p->offset + p->len;
+            }
+            if (p->flags & MPM_PATTERN_FLAG_DEPTH) {
+                cd->ext[i]->flags |= HS_EXT_FLAG_MAX_OFFSET;
+                cd->ext[i]->max_offset = p->offset + p->depth;
+            }
+        }
+    }
+
+    err = hs_compile_ext_multi((const char *const *)cd->expressions, cd->flags,
+                               cd->ids, (const hs_expr_ext_t *const *)cd->ext,
+                               cd->pattern_cnt, HS_MODE_BLOCK, NULL, &pd->hs_db,
+                               &compile_err);
+
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "failed to compile hyperscan database");
+        if (compile_err) {
+            SCLogError(SC_ERR_FATAL, "compile error: %s", compile_err->message);
+        }
+        hs_free_compile_error(compile_err);
+        return -1;
+    }
+
+    return 0;
+}
+
+/** \internal
+ *  \brief get the mpm cache key for the patterns of pd
+ *
+ *  Pattern ids in the database are indexes into parray, so the key keeps
+ *  the parray order. Sids don't end up in the database and are left out.
+ *
+ *  \param image key for the in place usable database image rather than
+ *               the serialized database
+ */
+static MpmCacheKey *SCHSCacheKey(const PatternDatabase *pd, int image)
+{
+    MpmCacheKey *key = MpmCacheKeyNew(image ? "hs-image" : "hs");
+    if (key == NULL)
+        return NULL;
+
+    const char *version = hs_version();
+    if (MpmCacheKeyAdd(key, version, strlen(version) + 1) != 0 ||
+        MpmCacheKeyAdd(key, &pd->pattern_cnt, sizeof(pd->pattern_cnt)) != 0)
+        goto error;
+
+    for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
+        const SCHSPattern *p = pd->parray[i];
+        if (MpmCacheKeyAdd(key, &p->flags, sizeof(p->flags)) != 0 ||
+            MpmCacheKeyAdd(key, &p->len, sizeof(p->len)) != 0 ||
+            MpmCacheKeyAdd(key, &p->offset, sizeof(p->offset)) != 0 ||
+            MpmCacheKeyAdd(key, &p->depth, sizeof(p->depth)) != 0 ||
+            MpmCacheKeyAdd(key, p->original_pat, p->len) != 0)
+            goto error;
+    }
+    return key;
+
+error:
+    MpmCacheKeyFree(key);
+    return NULL;
+}
+
+/** start of a cache entry holding a database image. The image follows
+ *  it, then the serialized database the image was made from. */
+typedef struct SCHSCacheImageHeader_ {
+    uint64_t image_len;
+    uint64_t serialized_len;
+    uint8_t pad[48];            /**< keep the image 64 byte aligned */
+} SCHSCacheImageHeader;
+
+/** \internal
+ *  \brief lay out a serialized database as an image at a 64 byte aligned
+ *         address
+ *
+ *  The memory is zeroed first, so the same serialized database always
+ *  gives the same bytes.
+ *
+ *  \retval db image to free with SCFreeAligned, NULL on error */
+static hs_database_t *SCHSImageAlloc(const char *bytes, size_t length,
+                                     size_t db_size)
+{
+    hs_database_t *db = SCMallocAligned(db_size, 64);
+    if (unlikely(db == NULL))
+        return NULL;
+    memset(db, 0, db_size);
+    if (hs_deserialize_database_at(bytes, length, db) != HS_SUCCESS) {
+        SCFreeAligned(db);
+        return NULL;
+    }
+    return db;
+}
+
+/** \internal
+ *  \brief check a database image from the cache before it's scanned
+ *
+ *  Cache files are not trusted, and an image is used as is. So it has to
+ *  be exactly what hs_deserialize_database_at makes of the serialized
+ *  database stored with it, which gets the checks a load with
+ *  hs_deserialize_database would do.
+ *
+ *  \retval db the image in the entry, NULL if it's invalid */
+static hs_database_t *SCHSCacheImageCheck(const MpmCacheEntry *entry)
+{
+    const SCHSCacheImageHeader *hdr = (const SCHSCacheImageHeader *)entry->data;
+    if (entry->data_len < sizeof(*hdr))
+        return NULL;
+
+    const uint64_t avail = entry->data_len - sizeof(*hdr);
+    if (hdr->image_len == 0 || hdr->image_len > avail ||
+        hdr->serialized_len != avail - hdr->image_len)
+        return NULL;
+
+    const uint8_t *img = entry->data + sizeof(*hdr);
+    const char *bytes = (const char *)img + hdr->image_len;
+    size_t db_size = 0;
+    if (hs_serialized_database_size(bytes, hdr->serialized_len,
+                                    &db_size) != HS_SUCCESS ||
+        db_size != hdr->image_len)
+        return NULL;
+
+    hs_database_t *db = SCHSImageAlloc(bytes, hdr->serialized_len, db_size);
+    if (db == NULL)
+        return NULL;
+    int same = (memcmp(db, img, db_size) == 0);
+    SCFreeAligned(db);
+
+    return same ? (hs_database_t *)img : NULL;
+}
+
+/** \internal
+ *  \brief load pd->hs_db from the mpm cache
+ *
+ *  An image is a database as laid out by hs_deserialize_database_at at a
+ *  64 byte aligned address. Hyperscan databases don't contain pointers,
+ *  and the image in a cache entry is 64 byte aligned, so it's used in
+ *  place in the read only mapping, shared by all processes that map it.
+ *
+ *  \retval 0 loaded, -1 not in the cache */
+static int SCHSCacheLoad(const MpmCacheKey *key, PatternDatabase *pd,
+                         int image)
+{
+    MpmCacheEntry entry;
+    if (MpmCacheLoad(key, &entry) != 1)
+        return -1;
+
+    if (image) {
+        hs_database_t *db = SCHSCacheImageCheck(&entry);
+        if (db == NULL) {
+            SCLogWarning(SC_ERR_FATAL, "invalid cached hyperscan database "
+                         "image, compiling");
+            MpmCacheRelease(&entry);
+            return -1;
+        }
+        pd->hs_db = db;
+        pd->image = entry;
+        return 0;
+    }
+
+    hs_error_t err = hs_deserialize_database((const char *)entry.data,
+                                             entry.data_len, &pd->hs_db);
+    MpmCacheRelease(&entry);
+    if (err != HS_SUCCESS) {
+        SCLogWarning(SC_ERR_FATAL, "failed to deserialize cached hyperscan "
+                     "database, compiling");
+        pd->hs_db = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief store pd->hs_db in the mpm cache
+ *  \retval 0 stored, -1 error */
+static int SCHSCacheStore(const MpmCacheKey *key, const PatternDatabase *pd,
+                          int image)
+{
+    char *bytes = NULL;
+    size_t length = 0;
+    if (hs_serialize_database(pd->hs_db, &bytes, &length) != HS_SUCCESS) {
+        SCLogDebug("failed to serialize hyperscan database");
+        return -1;
+    }
+
+    int r = -1;
+    if (image) {
+        size_t db_size = 0;
+        if (hs_serialized_database_size(bytes, length, &db_size) == HS_SUCCESS) {
+            hs_database_t *db = SCHSImageAlloc(bytes, length, db_size);
+            if (db != NULL) {
+                SCHSCacheImageHeader hdr;
+                memset(&hdr, 0, sizeof(hdr));
+                hdr.image_len = db_size;
+                hdr.serialized_len = length;
+                struct iovec iov[3] = {
+                    { &hdr, sizeof(hdr) },
+                    { db, db_size },
+                    { bytes, length },
+                };
+                r = MpmCacheStore(key, iov, 3);
+                SCFreeAligned(db);
+            }
+        }
+    } else {
+        struct iovec iov = { bytes, length };
+        r = MpmCacheStore(key, &iov, 1);
+    }
+    SCFree(bytes);
+    return r;
+}
+
 /**
  * \brief Process the patterns added to the mpm, and create the internal tables.
  *
@@ -580,9 +865,9 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     }
 
     hs_error_t err;
-    hs_compile_error_t *compile_err = NULL;
     SCHSCompileData *cd = NULL;
     PatternDatabase *pd = NULL;
+    MpmCacheKey *cache_key = NULL;
 
     cd = SCHSAllocCompileData(mpm_ctx->pattern_cnt);
     if (cd == NULL) {
@@ -609,8 +894,10 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     SCFree(ctx->init_hash);
     ctx->init_hash = NULL;
 
-    /* Serialise whole database compilation as a relatively easy way to ensure
-     * dedupe is safe. */
+    /* Check global hash table to see if we've seen this pattern database
+     * before, and reuse the Hyperscan database if so. The compile itself
+     * is done without holding the lock, so that the mpm ctxs of a detect
+     * engine can be prepared in parallel. */
     SCMutexLock(&g_db_table_mutex);
 
     /* Init global pattern database hash if necessary. */
@@ -624,71 +911,39 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         }
     }
 
-    /* Check global hash table to see if we've seen this pattern database
-     * before, and reuse the Hyperscan database if so. */
-    PatternDatabase *pd_cached = HashTableLookup(g_db_table, pd, 1);
-
-    if (pd_cached != NULL) {
-        SCLogDebug("Reusing cached database %p with %" PRIu32
-                   " patterns (ref_cnt=%" PRIu32 ")",
-                   pd_cached->hs_db, pd_cached->pattern_cnt,
-                   pd_cached->ref_cnt);
-        pd_cached->ref_cnt++;
-        ctx->pattern_db = pd_cached;
+    if (PatternDatabaseUseCached(ctx, pd) == 1) {
         SCMutexUnlock(&g_db_table_mutex);
         PatternDatabaseFree(pd);
         SCHSFreeCompileData(cd);
         return 0;
     }
+    SCMutexUnlock(&g_db_table_mutex);
 
     BUG_ON(ctx->pattern_db != NULL); /* already built? */
-
-    for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
-        const SCHSPattern *p = pd->parray[i];
-
-        cd->ids[i] = i;
-        cd->flags[i] = HS_FLAG_SINGLEMATCH;
-        if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
-            cd->flags[i] |= HS_FLAG_CASELESS;
-        }
-
-        cd->expressions[i] = HSRenderPattern(p->original_pat, p->len);
-
-        if (p->flags & (MPM_PATTERN_FLAG_OFFSET | MPM_PATTERN_FLAG_DEPTH)) {
-            cd->ext[i] = SCMalloc(sizeof(hs_expr_ext_t));
-            if (cd->ext[i] == NULL) {
-                goto error;
-            }
-            memset(cd->ext[i], 0, sizeof(hs_expr_ext_t));
-
-            if (p->flags & MPM_PATTERN_FLAG_OFFSET) {
-                cd->ext[i]->flags |= HS_EXT_FLAG_MIN_OFFSET;
-                cd->ext[i]->min_offset = p->offset + p->len;
-            }
-            if (p->flags & MPM_PATTERN_FLAG_DEPTH) {
-                cd->ext[i]->flags |= HS_EXT_FLAG_MAX_OFFSET;
-                cd->ext[i]->max_offset = p->offset + p->depth;
-            }
-        }
-    }
-
     BUG_ON(mpm_ctx->pattern_cnt == 0);
 
-    err = hs_compile_ext_multi((const char *const *)cd->expressions, cd->flags,
-                               cd->ids, (const hs_expr_ext_t *const *)cd->ext,
-                               cd->pattern_cnt, HS_MODE_BLOCK, NULL, &pd->hs_db,
-                               &compile_err);
-
-    if (err != HS_SUCCESS) {
-        SCLogError(SC_ERR_FATAL, "failed to compile hyperscan database");
-        if (compile_err) {
-            SCLogError(SC_ERR_FATAL, "compile error: %s", compile_err->message);
+    /* not built by this process yet, but maybe by an earlier one */
+    const int image = MpmCacheShared();
+    if (MpmCacheEnabled())
+        cache_key = SCHSCacheKey(pd, image);
+    if (cache_key == NULL || SCHSCacheLoad(cache_key, pd, image) != 0) {
+        if (SCHSCompilePatternDatabase(pd, cd) != 0)
+            goto error;
+        if (cache_key != NULL && SCHSCacheStore(cache_key, pd, image) == 0 &&
+            image) {
+            /* switch to the stored image, so that other processes loading
+             * it share the pages with us */
+            hs_database_t *built = pd->hs_db;
+            pd->hs_db = NULL;
+            if (SCHSCacheLoad(cache_key, pd, image) == 0) {
+                hs_free_database(built);
+            } else {
+                pd->hs_db = built;
+            }
         }
-        hs_free_compile_error(compile_err);
-        goto error;
     }
-
-    ctx->pattern_db = pd;
+    MpmCacheKeyFree(cache_key);
+    cache_key = NULL;
 
     SCMutexLock(&g_scratch_proto_mutex);
     err = hs_alloc_scratch(pd->hs_db, &g_scratch_proto);
@@ -698,12 +953,24 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         goto error;
     }
 
-    err = hs_database_size(pd->hs_db, &ctx->hs_db_size);
+    size_t hs_db_size = 0;
+    err = hs_database_size(pd->hs_db, &hs_db_size);
     if (err != HS_SUCCESS) {
         SCLogError(SC_ERR_FATAL, "failed to query database size");
         goto error;
     }
 
+    SCMutexLock(&g_db_table_mutex);
+    /* another thread may have built the same database meanwhile */
+    if (PatternDatabaseUseCached(ctx, pd) == 1) {
+        SCMutexUnlock(&g_db_table_mutex);
+        PatternDatabaseFree(pd);
+        SCHSFreeCompileData(cd);
+        return 0;
+    }
+
+    ctx->pattern_db = pd;
+    ctx->hs_db_size = hs_db_size;
     mpm_ctx->memory_cnt++;
     mpm_ctx->memory_size += ctx->hs_db_size;
 
@@ -719,7 +986,7 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     return 0;
 
 error:
-    SCMutexUnlock(&g_db_table_mutex);
+    MpmCacheKeyFree(cache_key);
     if (pd) {
         PatternDatabaseFree(pd);
     }
@@ -764,6 +1031,7 @@ void SCHSInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
 
     hs_error_t err = hs_clone_scratch(g_scratch_proto,
                                       (hs_scratch_t **)&ctx->scratch);
+    uint32_t multi_patterns = g_multi_max_patterns;
 
     SCMutexUnlock(&g_scratch_proto_mutex);
 
@@ -780,6 +1048,18 @@ void SCHSInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
 
     mpm_thread_ctx->memory_cnt++;
     mpm_thread_ctx->memory_size += ctx->scratch_size;
+
+    if (multi_patterns > 0) {
+        ctx->multi_seen = SCMalloc(multi_patterns * sizeof(uint32_t));
+        if (ctx->multi_seen == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        memset(ctx->multi_seen, 0, multi_patterns * sizeof(uint32_t));
+        ctx->multi_seen_size = multi_patterns;
+
+        mpm_thread_ctx->memory_cnt++;
+        mpm_thread_ctx->memory_size += multi_patterns * sizeof(uint32_t);
+    }
 }
 
 /**
@@ -829,6 +1109,13 @@ void SCHSDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
             mpm_thread_ctx->memory_size -= thr_ctx->scratch_size;
         }
 
+        if (thr_ctx->multi_seen != NULL) {
+            SCFree(thr_ctx->multi_seen);
+            mpm_thread_ctx->memory_cnt--;
+            mpm_thread_ctx->memory_size -=
+                thr_ctx->multi_seen_size * sizeof(uint32_t);
+        }
+
         SCFree(mpm_thread_ctx->ctx);
         mpm_thread_ctx->ctx = NULL;
         mpm_thread_ctx->memory_cnt--;
@@ -859,12 +1146,7 @@ void SCHSDestroyCtx(MpmCtx *mpm_ctx)
     SCMutexLock(&g_db_table_mutex);
     PatternDatabase *pd = ctx->pattern_db;
     if (pd) {
-        BUG_ON(pd->ref_cnt == 0);
-        pd->ref_cnt--;
-        if (pd->ref_cnt == 0) {
-            HashTableRemove(g_db_table, pd, 1);
-            PatternDatabaseFree(pd);
-        }
+        PatternDatabaseRelease(pd);
     }
     SCMutexUnlock(&g_db_table_mutex);
 
@@ -924,6 +1206,7 @@ uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     }
 
     SCHSCallbackCtx cctx = {.ctx = ctx, .pmq = pmq, .match_count = 0};
+    const uint32_t sids_start = pmq->rule_id_array_cnt;
 
     /* scratch should have been cloned from g_scratch_proto at thread init. */
     hs_scratch_t *scratch = hs_thread_ctx->scratch;
@@ -942,9 +1225,394 @@ uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
         ret = cctx.match_count;
     }
 
+    MpmCtxMapSids(mpm_ctx, pmq, sids_start);
     return ret;
 }
 
+/************************** Multi Buffer Search ***************************/
+
+/*
+ * A multi buffer database combines the pattern databases of a set of mpm
+ * contexts, each for a different buffer "slot", so that all buffers can be
+ * scanned with a single hs_scan_vector() call.
+ *
+ * In vectored mode Hyperscan treats the buffers as one contiguous block, so
+ * a pattern can match in the wrong buffer or across a buffer boundary, and
+ * offset/depth would be relative to the start of the first buffer. So the
+ * patterns are compiled without HS_FLAG_SINGLEMATCH and without offset
+ * limits, and the match handler checks the buffer, the boundary and the
+ * offset/depth of each match itself. A per thread 'seen' array makes sure
+ * a pattern's sids are added only once per scan.
+ */
+
+typedef struct SCHSMultiDatabase_ {
+    /* pattern database per slot, NULL if the slot is unused. Each holds a
+     * reference so that parray stays valid. */
+    PatternDatabase *pds[SCHS_MULTI_MAX_SLOTS];
+
+    hs_database_t *hs_db;
+    uint32_t pattern_cnt;
+
+    /* combined pattern id to pattern and the slot it was added for */
+    const SCHSPattern **parray;
+    uint8_t *slots;
+
+    /* Reference count: number of users of this multi buffer database. */
+    uint32_t ref_cnt;
+} SCHSMultiDatabase;
+
+static uint32_t MultiDatabaseHash(HashTable *ht, void *data, uint16_t len)
+{
+    const SCHSMultiDatabase *md = data;
+    uint32_t hash = hashlittle_safe(md->pds, sizeof(md->pds), 0);
+    return hash % ht->array_size;
+}
+
+static char MultiDatabaseCompare(void *data1, uint16_t len1, void *data2,
+                                 uint16_t len2)
+{
+    const SCHSMultiDatabase *md1 = data1;
+    const SCHSMultiDatabase *md2 = data2;
+
+    return (memcmp(md1->pds, md2->pds, sizeof(md1->pds)) == 0);
+}
+
+static void MultiDatabaseTableFree(void *data)
+{
+    /* Stub function handed to hash table; like the pattern databases the
+     * multi buffer databases are freed when the ref_cnt drops to zero. */
+}
+
+/* Needs g_db_table_mutex to be held. */
+static void MultiDatabaseFree(SCHSMultiDatabase *md)
+{
+    for (uint32_t i = 0; i < SCHS_MULTI_MAX_SLOTS; i++) {
+        if (md->pds[i] != NULL) {
+            PatternDatabaseRelease(md->pds[i]);
+        }
+    }
+    if (md->hs_db != NULL) {
+        hs_free_database(md->hs_db);
+    }
+    SCFree(md->parray);
+    SCFree(md->slots);
+    SCFree(md);
+}
+
+/**
+ * \brief Build a database that prefilters multiple buffers in one scan.
+ *
+ * \param mpm_ctxs  Prepared mpm contexts, one per slot. Slots can be NULL.
+ * \param slot_cnt  Number of slots, at most SCHS_MULTI_MAX_SLOTS.
+ *
+ * \retval multi_db database to pass to SCHSMultiSearch, or NULL if it
+ *         couldn't be built or less than two slots have patterns.
+ */
+void *SCHSMultiBuild(const MpmCtx **mpm_ctxs, uint32_t slot_cnt)
+{
+    if (slot_cnt > SCHS_MULTI_MAX_SLOTS) {
+        return NULL;
+    }
+
+    SCHSMultiDatabase lookup;
+    memset(&lookup, 0, sizeof(lookup));
+
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < slot_cnt; i++) {
+        const MpmCtx *mpm_ctx = mpm_ctxs[i];
+        if (mpm_ctx == NULL || mpm_ctx->mpm_type != MPM_HS ||
+            mpm_ctx->ctx == NULL) {
+            continue;
+        }
+        /* the match handler adds the pattern db's sids as is, so a ctx
+         * that maps them to our sig nums is scanned on its own */
+        if (mpm_ctx->sid_map != NULL) {
+            return NULL;
+        }
+        PatternDatabase *pd = ((SCHSCtx *)mpm_ctx->ctx)->pattern_db;
+        if (pd == NULL) {
+            continue;
+        }
+        lookup.pds[i] = pd;
+        lookup.pattern_cnt += pd->pattern_cnt;
+        used++;
+    }
+
+    /* a single buffer is scanned just as well by its own database */
+    if (used < 2) {
+        return NULL;
+    }
+
+    hs_error_t err;
+    hs_compile_error_t *compile_err = NULL;
+    SCHSCompileData *cd = NULL;
+    SCHSMultiDatabase *md = NULL;
+
+    SCMutexLock(&g_db_table_mutex);
+
+    if (g_multi_db_table == NULL) {
+        g_multi_db_table = HashTableInit(INIT_DB_HASH_SIZE, MultiDatabaseHash,
+                                         MultiDatabaseCompare,
+                                         MultiDatabaseTableFree);
+        if (g_multi_db_table == NULL) {
+            goto error;
+        }
+    }
+
+    SCHSMultiDatabase *md_cached = HashTableLookup(g_multi_db_table,
+                                                   &lookup, 1);
+    if (md_cached != NULL) {
+        md_cached->ref_cnt++;
+        SCMutexUnlock(&g_db_table_mutex);
+        return md_cached;
+    }
+
+    md = SCMalloc(sizeof(SCHSMultiDatabase));
+    if (md == NULL) {
+        goto error;
+    }
+    memset(md, 0, sizeof(SCHSMultiDatabase));
+    md->pattern_cnt = lookup.pattern_cnt;
+
+    /* take a reference on the per slot databases first, so that the error
+     * path can release them */
+    for (uint32_t i = 0; i < SCHS_MULTI_MAX_SLOTS; i++) {
+        if (lookup.pds[i] != NULL) {
+            md->pds[i] = lookup.pds[i];
+            md->pds[i]->ref_cnt++;
+        }
+    }
+
+    md->parray = SCMalloc(md->pattern_cnt * sizeof(SCHSPattern *));
+    md->slots = SCMalloc(md->pattern_cnt * sizeof(uint8_t));
+    cd = SCHSAllocCompileData(md->pattern_cnt);
+    if (md->parray == NULL || md->slots == NULL || cd == NULL) {
+        goto error;
+    }
+
+    uint32_t id = 0;
+    for (uint32_t i = 0; i < SCHS_MULTI_MAX_SLOTS; i++) {
+        const PatternDatabase *pd = md->pds[i];
+        if (pd == NULL) {
+            continue;
+        }
+        for (uint32_t j = 0; j < pd->pattern_cnt; j++, id++) {
+            const SCHSPattern *p = pd->parray[j];
+
+            md->parray[id] = p;
+            md->slots[id] = (uint8_t)i;
+
+            cd->ids[id] = id;
+            cd->flags[id] = 0;
+            if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+                cd->flags[id] |= HS_FLAG_CASELESS;
+            }
+            cd->expressions[id] = HSRenderPattern(p->original_pat, p->len);
+        }
+    }
+    BUG_ON(id != md->pattern_cnt);
+
+    err = hs_compile_multi((const char *const *)cd->expressions, cd->flags,
+                           cd->ids, cd->pattern_cnt, HS_MODE_VECTORED, NULL,
+                           &md->hs_db, &compile_err);
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "failed to compile hyperscan multi buffer "
+                   "database");
+        if (compile_err) {
+            SCLogError(SC_ERR_FATAL, "compile error: %s", compile_err->message);
+        }
+        hs_free_compile_error(compile_err);
+        goto error;
+    }
+
+    SCMutexLock(&g_scratch_proto_mutex);
+    err = hs_alloc_scratch(md->hs_db, &g_scratch_proto);
+    if (err == HS_SUCCESS && md->pattern_cnt > g_multi_max_patterns) {
+        g_multi_max_patterns = md->pattern_cnt;
+    }
+    SCMutexUnlock(&g_scratch_proto_mutex);
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "failed to allocate scratch");
+        goto error;
+    }
+
+    SCLogDebug("Built %" PRIu32 " patterns from %" PRIu32 " buffers into a "
+               "multi buffer database", md->pattern_cnt, used);
+
+    md->ref_cnt = 1;
+    HashTableAdd(g_multi_db_table, md, 1);
+    SCMutexUnlock(&g_db_table_mutex);
+
+    SCHSFreeCompileData(cd);
+    return md;
+
+error:
+    if (md != NULL) {
+        MultiDatabaseFree(md);
+    }
+    SCMutexUnlock(&g_db_table_mutex);
+    if (cd != NULL) {
+        SCHSFreeCompileData(cd);
+    }
+    return NULL;
+}
+
+/**
+ * \brief Release a multi buffer database returned by SCHSMultiBuild.
+ */
+void SCHSMultiFree(void *multi_db)
+{
+    SCHSMultiDatabase *md = multi_db;
+    if (md == NULL)
+        return;
+
+    SCMutexLock(&g_db_table_mutex);
+    BUG_ON(md->ref_cnt == 0);
+    md->ref_cnt--;
+    if (md->ref_cnt == 0) {
+        HashTableRemove(g_multi_db_table, md, 1);
+        MultiDatabaseFree(md);
+    }
+    SCMutexUnlock(&g_db_table_mutex);
+}
+
+typedef struct SCHSMultiCallbackCtx_ {
+    const SCHSMultiDatabase *md;
+    PatternMatcherQueue *pmq;
+
+    /* slot and end offset in the vector of each scanned buffer */
+    const uint8_t *slots;
+    const uint32_t *ends;
+    const uint32_t *buflens;
+    uint32_t buf_cnt;
+
+    uint32_t *seen;
+    uint32_t scan;
+
+    uint32_t match_count;
+} SCHSMultiCallbackCtx;
+
+/* Hyperscan multi buffer match event handler */
+static int SCHSMultiMatchEvent(unsigned int id, unsigned long long from,
+                               unsigned long long to, unsigned int flags,
+                               void *ctx)
+{
+    SCHSMultiCallbackCtx *cctx = ctx;
+    const SCHSMultiDatabase *md = cctx->md;
+
+    if (cctx->seen != NULL && cctx->seen[id] == cctx->scan) {
+        return 0;
+    }
+
+    /* find the buffer the match ends in, there are only a few */
+    uint32_t b = 0;
+    while (b < cctx->buf_cnt && to > cctx->ends[b]) {
+        b++;
+    }
+    if (b == cctx->buf_cnt || cctx->slots[b] != md->slots[id]) {
+        return 0;
+    }
+
+    const SCHSPattern *pat = md->parray[id];
+    const unsigned long long buf_start = cctx->ends[b] - cctx->buflens[b];
+    if (to < buf_start + pat->len) {
+        /* match started in the previous buffer */
+        return 0;
+    }
+
+    /* same limits as the min/max offset used for the single buffer db */
+    const unsigned long long end = to - buf_start;
+    if ((pat->flags & MPM_PATTERN_FLAG_OFFSET) &&
+        end < (unsigned long long)pat->offset + pat->len) {
+        return 0;
+    }
+    if ((pat->flags & MPM_PATTERN_FLAG_DEPTH) &&
+        end > (unsigned long long)pat->offset + pat->depth) {
+        return 0;
+    }
+
+    SCLogDebug("Hyperscan Multi Match %" PRIu32 ": id=%" PRIu32 " slot=%u "
+               "@ %" PRIuMAX, cctx->match_count, (uint32_t)id,
+               md->slots[id], (uintmax_t)end);
+
+    if (cctx->seen != NULL) {
+        cctx->seen[id] = cctx->scan;
+    }
+    MpmAddSids(cctx->pmq, pat->sids, pat->sids_size);
+
+    cctx->match_count++;
+    return 0;
+}
+
+/**
+ * \brief Scan multiple buffers with a multi buffer database.
+ *
+ * \param multi_db       Database from SCHSMultiBuild.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param bufs           Buffers to be searched.
+ * \param buflens        Buffer lengths.
+ * \param slots          Slot of each buffer, as passed to SCHSMultiBuild.
+ * \param buf_cnt        Number of buffers, at most SCHS_MULTI_MAX_SLOTS.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCHSMultiSearch(const void *multi_db, MpmThreadCtx *mpm_thread_ctx,
+                         PatternMatcherQueue *pmq, const uint8_t **bufs,
+                         const uint32_t *buflens, const uint8_t *slots,
+                         uint32_t buf_cnt)
+{
+    const SCHSMultiDatabase *md = multi_db;
+    SCHSThreadCtx *hs_thread_ctx = (SCHSThreadCtx *)(mpm_thread_ctx->ctx);
+
+    if (unlikely(buf_cnt == 0)) {
+        return 0;
+    }
+    BUG_ON(buf_cnt > SCHS_MULTI_MAX_SLOTS);
+
+    unsigned int lens[SCHS_MULTI_MAX_SLOTS];
+    uint32_t ends[SCHS_MULTI_MAX_SLOTS];
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < buf_cnt; i++) {
+        lens[i] = buflens[i];
+        total += buflens[i];
+        ends[i] = total;
+    }
+
+    SCHSMultiCallbackCtx cctx = {
+        .md = md, .pmq = pmq, .slots = slots, .ends = ends,
+        .buflens = buflens, .buf_cnt = buf_cnt, .seen = NULL, .scan = 0,
+        .match_count = 0 };
+
+    /* seen array is sized at thread init, but be safe if a database was
+     * compiled after that */
+    if (hs_thread_ctx->multi_seen_size >= md->pattern_cnt) {
+        if (++hs_thread_ctx->multi_scan == 0) {
+            memset(hs_thread_ctx->multi_seen, 0,
+                   hs_thread_ctx->multi_seen_size * sizeof(uint32_t));
+            hs_thread_ctx->multi_scan = 1;
+        }
+        cctx.seen = hs_thread_ctx->multi_seen;
+        cctx.scan = hs_thread_ctx->multi_scan;
+    }
+
+    hs_scratch_t *scratch = hs_thread_ctx->scratch;
+    BUG_ON(md->hs_db == NULL);
+    BUG_ON(scratch == NULL);
+
+    hs_error_t err = hs_scan_vector(md->hs_db, (const char *const *)bufs,
+                                    lens, buf_cnt, 0, scratch,
+                                    SCHSMultiMatchEvent, &cctx);
+    if (err != HS_SUCCESS) {
+        /* See SCHSSearch: not something we can recover from. */
+        SCLogError(SC_ERR_FATAL, "Hyperscan returned error %d", err);
+        exit(EXIT_FAILURE);
+    }
+
+    return cctx.match_count;
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -1067,9 +1735,14 @@ void MpmHSGlobalCleanup(void)
         hs_free_scratch(g_scratch_proto);
         g_scratch_proto = NULL;
     }
+    g_multi_max_patterns = 0;
     SCMutexUnlock(&g_scratch_proto_mutex);
 
     SCMutexLock(&g_db_table_mutex);
+    if (g_multi_db_table != NULL) {
+        HashTableFree(g_multi_db_table);
+        g_multi_db_table = NULL;
+    }
     if (g_db_table != NULL) {
         SCLogPerf("Clearing Hyperscan database cache");
         HashTableFree(g_db_table);
@@ -2130,6 +2803,215 @@ end:
     return result;
 }
 
+static int SCHSTestMultiSearch(void *md, MpmThreadCtx *mpm_thread_ctx,
+                               PatternMatcherQueue *pmq, const char *buf1,
+                               uint8_t slot1, const char *buf2, uint8_t slot2)
+{
+    const uint8_t *bufs[2] = { (const uint8_t *)buf1, (const uint8_t *)buf2 };
+    const uint32_t lens[2] = { strlen(buf1), strlen(buf2) };
+    const uint8_t slots[2] = { slot1, slot2 };
+
+    PmqReset(pmq);
+    return SCHSMultiSearch(md, mpm_thread_ctx, pmq, bufs, lens, slots, 2);
+}
+
+/** \test multi buffer db: matches only count in the buffer of their slot */
+static int SCHSTest30(void)
+{
+    MpmCtx mpm_ctx1, mpm_ctx2;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx1, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx2, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx1, MPM_HS);
+    MpmInitCtx(&mpm_ctx2, MPM_HS);
+
+    MpmAddPatternCS(&mpm_ctx1, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx2, (uint8_t *)"efgh", 4, 0, 0, 1, 1, 0);
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx1) != 0);
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx2) != 0);
+
+    /* a single slot with patterns is not worth a multi buffer db */
+    const MpmCtx *single[2] = { &mpm_ctx1, NULL };
+    FAIL_IF_NOT_NULL(SCHSMultiBuild(single, 2));
+
+    const MpmCtx *ctxs[3] = { &mpm_ctx1, NULL, &mpm_ctx2 };
+    void *md = SCHSMultiBuild(ctxs, 3);
+    FAIL_IF_NULL(md);
+    /* same slots, same db */
+    void *md2 = SCHSMultiBuild(ctxs, 3);
+    FAIL_IF(md2 != md);
+    SCHSMultiFree(md2);
+
+    PmqSetup(&pmq);
+    SCHSInitThreadCtx(&mpm_ctx1, &mpm_thread_ctx);
+
+    /* each pattern in its own buffer */
+    FAIL_IF(SCHSTestMultiSearch(md, &mpm_thread_ctx, &pmq,
+                "xxabcdxx", 0, "efgh", 2) != 2);
+    /* patterns in each other's buffer */
+    FAIL_IF(SCHSTestMultiSearch(md, &mpm_thread_ctx, &pmq,
+                "xxabcdxx", 2, "efgh", 0) != 0);
+    /* 'abcd' across the boundary, 'efgh' twice but reported once */
+    FAIL_IF(SCHSTestMultiSearch(md, &mpm_thread_ctx, &pmq,
+                "xxab", 0, "cdefghefgh", 2) != 1);
+    FAIL_IF(pmq.rule_id_array_cnt != 1 || pmq.rule_id_array[0] != 1);
+
+    SCHSMultiFree(md);
+    SCHSDestroyThreadCtx(&mpm_ctx1, &mpm_thread_ctx);
+    SCHSDestroyCtx(&mpm_ctx1);
+    SCHSDestroyCtx(&mpm_ctx2);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test multi buffer db: offset and depth are relative to each buffer */
+static int SCHSTest31(void)
+{
+    MpmCtx mpm_ctx1, mpm_ctx2;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx1, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx2, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx1, MPM_HS);
+    MpmInitCtx(&mpm_ctx2, MPM_HS);
+
+    /* 'abcd' within the first 6 bytes, 'efgh' from offset 2 on */
+    MpmAddPatternCS(&mpm_ctx1, (uint8_t *)"abcd", 4, 0, 6, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx2, (uint8_t *)"efgh", 4, 2, 0, 1, 1, 0);
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx1) != 0);
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx2) != 0);
+
+    const MpmCtx *ctxs[2] = { &mpm_ctx1, &mpm_ctx2 };
+    void *md = SCHSMultiBuild(ctxs, 2);
+    FAIL_IF_NULL(md);
+
+    PmqSetup(&pmq);
+    SCHSInitThreadCtx(&mpm_ctx1, &mpm_thread_ctx);
+
+    FAIL_IF(SCHSTestMultiSearch(md, &mpm_thread_ctx, &pmq,
+                "xxabcd", 0, "xxefgh", 1) != 2);
+    FAIL_IF(SCHSTestMultiSearch(md, &mpm_thread_ctx, &pmq,
+                "xxxabcd", 0, "efghxx", 1) != 0);
+    /* second buffer starts past the first one's depth */
+    FAIL_IF(SCHSTestMultiSearch(md, &mpm_thread_ctx, &pmq,
+                "xxxxxxxx", 1, "abcd", 0) != 1);
+
+    SCHSMultiFree(md);
+    SCHSDestroyThreadCtx(&mpm_ctx1, &mpm_thread_ctx);
+    SCHSDestroyCtx(&mpm_ctx1);
+    SCHSDestroyCtx(&mpm_ctx2);
+    PmqFree(&pmq);
+    PASS;
+}
+
+#include <dirent.h>
+
+static int SCHSTestCacheDirRemove(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return -1;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        unlink(path);
+    }
+    closedir(d);
+    return rmdir(dir);
+}
+
+/** \test a modified database image in a shared cache is not used, but
+ *        compiled and stored again */
+static int SCHSTest32(void)
+{
+    char dir[] = "/tmp/suricata-hs-cache-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+    FAIL_IF(MpmCacheSetDir(dir) != 0);
+    MpmCacheSetShared(1);
+
+    off_t off = 0;
+    uint8_t orig = 0;
+    int pass;
+    for (pass = 0; pass < 2; pass++) {
+        MpmCtx mpm_ctx;
+        MpmThreadCtx mpm_thread_ctx;
+        PatternMatcherQueue pmq;
+
+        memset(&mpm_ctx, 0, sizeof(MpmCtx));
+        memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+        MpmInitCtx(&mpm_ctx, MPM_HS);
+
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+        MpmAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)"fghJ", 4, 0, 0, 2, 0, 0);
+        PmqSetup(&pmq);
+
+        FAIL_IF(SCHSPreparePatterns(&mpm_ctx) != 0);
+        SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+        /* the image is used from the cache, in the 2nd pass only after
+         * it was stored again */
+        const PatternDatabase *pd = ((SCHSCtx *)mpm_ctx.ctx)->pattern_db;
+        FAIL_IF_NULL(pd->image.map);
+        const SCHSCacheImageHeader *hdr =
+            (const SCHSCacheImageHeader *)pd->image.data;
+        const uint8_t *img = pd->image.data + sizeof(*hdr);
+
+        char *buf = "abcdefghjiklmnopqrstuvwxyz";
+        uint32_t cnt = SCHSSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                  (uint8_t *)buf, strlen(buf));
+        FAIL_IF(cnt != 2);
+
+        if (pass == 0) {
+            /* change a byte in the middle of the image */
+            off = (pd->image.data - (const uint8_t *)pd->image.map) +
+                sizeof(*hdr) + hdr->image_len / 2;
+            orig = img[hdr->image_len / 2];
+
+            DIR *d = opendir(dir);
+            FAIL_IF_NULL(d);
+            struct dirent *de;
+            int changed = 0;
+            while ((de = readdir(d)) != NULL) {
+                if (de->d_name[0] == '.')
+                    continue;
+                char path[PATH_MAX];
+                snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+                int fd = open(path, O_WRONLY);
+                if (fd < 0)
+                    continue;
+                uint8_t bad = orig ^ 0xff;
+                if (pwrite(fd, &bad, sizeof(bad), off) == sizeof(bad))
+                    changed++;
+                close(fd);
+            }
+            closedir(d);
+            FAIL_IF(changed != 1);
+        } else {
+            /* it's the image that was stored again */
+            const uint8_t *map = pd->image.map;
+            FAIL_IF(map[off] != orig);
+        }
+
+        SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+        SCHSDestroyCtx(&mpm_ctx);
+        PmqFree(&pmq);
+    }
+
+    FAIL_IF(SCHSTestCacheDirRemove(dir) != 0);
+    MpmCacheSetDir(NULL);
+    MpmCacheSetShared(0);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCHSRegisterTests(void)
@@ -2164,6 +3046,9 @@ void SCHSRegisterTests(void)
     UtRegisterTest("SCHSTest27", SCHSTest27);
     UtRegisterTest("SCHSTest28", SCHSTest28);
     UtRegisterTest("SCHSTest29", SCHSTest29);
+    UtRegisterTest("SCHSTest30", SCHSTest30);
+    UtRegisterTest("SCHSTest31", SCHSTest31);
+    UtRegisterTest("SCHSTest32", SCHSTest32);
 #endif
 
     return;
@@ -67,10 +67,27 @@ typedef struct SCHSThreadCtx_ {
 
     /* size of scratch space, for accounting. */
     size_t scratch_size;
+
+    /* per pattern scan number of the last multi buffer match, so that each
+     * pattern is reported only once per scan. Sized for the largest multi
+     * buffer database that has been compiled. */
+    uint32_t *multi_seen;
+    uint32_t multi_seen_size;
+    uint32_t multi_scan;
 } SCHSThreadCtx;
 
+/* max number of buffer slots in a multi buffer database */
+#define SCHS_MULTI_MAX_SLOTS 16
+
 void MpmHSRegister(void);
 
 void MpmHSGlobalCleanup(void);
 
+void *SCHSMultiBuild(const MpmCtx **mpm_ctxs, uint32_t slot_cnt);
+void SCHSMultiFree(void *multi_db);
+uint32_t SCHSMultiSearch(const void *multi_db, MpmThreadCtx *mpm_thread_ctx,
+                         PatternMatcherQueue *pmq, const uint8_t **bufs,
+                         const uint32_t *buflens, const uint8_t *slots,
+                         uint32_t buf_cnt);
+
 #endif /* __UTIL_MPM_HS__H__ */
@@ -0,0 +1,783 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy MPM for small pattern sets, after the literal matcher of the
+ * same name in Hyperscan.
+ *
+ * The patterns are sorted and spread over 8 buckets. For each of the
+ * first 1 to 3 pattern bytes there is a pair of 16 byte tables indexed
+ * by the low and the high nibble of the input byte. A table entry has
+ * the bit of a bucket set if a pattern of that bucket has that nibble
+ * at that position. With SSSE3 (or AVX2) a pshufb per table looks up
+ * 16 (or 32) input bytes at once, and-ing the results of all tables
+ * leaves the buckets that may have a pattern starting at each byte.
+ * Those candidates are then verified against the patterns of the bucket.
+ *
+ * Without SSSE3 the same tables are used a byte at a time, which is
+ * slower than AC.
+ *
+ * The AC state table walk costs the same for 5 or 5000 patterns, this
+ * is much faster when the rule group only has a few dozen patterns.
+ * MpmStoreSetup() uses it automatically for those when AC is the
+ * configured matcher and we have SSSE3, see TEDDY_MAX_PATTERNS.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-engine.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-memcmp.h"
+#include "util-mpm-teddy.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+void SCTeddyInitCtx(MpmCtx *);
+void SCTeddyInitThreadCtx(MpmCtx *, MpmThreadCtx *);
+void SCTeddyDestroyCtx(MpmCtx *);
+void SCTeddyDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCTeddyAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, SigIntId, uint8_t);
+int SCTeddyAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, SigIntId, uint8_t);
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCTeddySearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen);
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx);
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCTeddyRegisterTests(void);
+
+/**
+ * \brief Initialize the Teddy context.
+ *
+ * \param mpm_ctx       Mpm context.
+ */
+void SCTeddyInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCTeddyCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCTeddyCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyCtx);
+
+    /* initialize the hash we use to speed up pattern insertions */
+    mpm_ctx->init_hash = SCMalloc(sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+    if (mpm_ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->init_hash, 0, sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+}
+
+/**
+ * \brief Init the mpm thread context.
+ *
+ * Teddy keeps no per thread state. The thread ctx of a rule group is
+ * set up for the configured matcher, which doesn't have to be teddy,
+ * so the search must not use it either.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCTeddyInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCTeddyDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    return;
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCTeddyDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    if (ctx == NULL)
+        return;
+
+    if (mpm_ctx->init_hash != NULL) {
+        uint32_t i;
+        for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+            MpmPattern *node = mpm_ctx->init_hash[i];
+            while (node != NULL) {
+                MpmPattern *next = node->next;
+                if (node->sids != NULL)
+                    SCFree(node->sids);
+                MpmFreePattern(mpm_ctx, node);
+                node = next;
+            }
+        }
+        SCFree(mpm_ctx->init_hash);
+        mpm_ctx->init_hash = NULL;
+    }
+
+    if (ctx->patterns != NULL) {
+        uint32_t i;
+        for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+            SCTeddyPattern *p = &ctx->patterns[i];
+            if (p->pat != NULL) {
+                SCFree(p->pat);
+                mpm_ctx->memory_cnt--;
+                mpm_ctx->memory_size -= p->len;
+            }
+            if (p->sids != NULL)
+                SCFree(p->sids);
+        }
+        SCFree(ctx->patterns);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern));
+    }
+
+    SCFree(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCTeddyCtx);
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     The signature _internal_ id.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        SigIntId sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     The signature _internal_ id.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        SigIntId sid, uint8_t flags)
+{
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/** \internal
+ *  \brief sort on the lowercase pattern start, so that patterns sharing
+ *         their first bytes end up in the same bucket and the masks of
+ *         the other buckets stay sparse. */
+static int TeddyPatternCompare(const void *a, const void *b)
+{
+    const MpmPattern *p1 = *(const MpmPattern **)a;
+    const MpmPattern *p2 = *(const MpmPattern **)b;
+    uint16_t len = MIN(MIN(p1->len, p2->len), TEDDY_MAX_MASK_LEN);
+
+    int r = memcmp(p1->ci, p2->ci, len);
+    if (r != 0)
+        return r;
+    if (p1->len != p2->len)
+        return p1->len < p2->len ? -1 : 1;
+    /* keep the order stable between runs */
+    return p1->id < p2->id ? -1 : (p1->id > p2->id);
+}
+
+static void TeddySetMasks(SCTeddyCtx *ctx, uint8_t bucket, const SCTeddyPattern *p)
+{
+    uint16_t k;
+    for (k = 0; k < ctx->mask_len; k++) {
+        uint8_t c = p->pat[k];
+        ctx->lo[k][c & 0x0f] |= (1 << bucket);
+        ctx->hi[k][c >> 4] |= (1 << bucket);
+
+        if (p->nocase && isalpha(c)) {
+            c = (uint8_t)toupper(c);
+            ctx->lo[k][c & 0x0f] |= (1 << bucket);
+            ctx->hi[k][c >> 4] |= (1 << bucket);
+        }
+    }
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the bucket
+ *        masks.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    if (mpm_ctx->pattern_cnt == 0 || mpm_ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    MpmPattern **parray = SCMalloc(mpm_ctx->pattern_cnt * sizeof(MpmPattern *));
+    if (parray == NULL)
+        goto error;
+
+    uint32_t i = 0, p = 0;
+    for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+        MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+        while (node != NULL) {
+            nnode = node->next;
+            node->next = NULL;
+            parray[p++] = node;
+            node = nnode;
+        }
+    }
+
+    /* we no longer need the hash, so free it's memory */
+    SCFree(mpm_ctx->init_hash);
+    mpm_ctx->init_hash = NULL;
+
+    qsort(parray, mpm_ctx->pattern_cnt, sizeof(MpmPattern *),
+          TeddyPatternCompare);
+
+    ctx->patterns = SCMalloc(mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern));
+    if (ctx->patterns == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->patterns, 0, mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern));
+
+    ctx->mask_len = MIN(mpm_ctx->minlen, TEDDY_MAX_MASK_LEN);
+
+    /* contiguous runs of the sorted patterns make up the buckets. With
+     * less than 8 patterns some buckets stay empty. */
+    uint8_t b;
+    for (b = 0; b < TEDDY_BUCKETS; b++) {
+        ctx->bucket_start[b] = (b * mpm_ctx->pattern_cnt) / TEDDY_BUCKETS;
+    }
+    ctx->bucket_start[TEDDY_BUCKETS] = mpm_ctx->pattern_cnt;
+
+    for (b = 0; b < TEDDY_BUCKETS; b++) {
+        for (i = ctx->bucket_start[b]; i < ctx->bucket_start[b + 1]; i++) {
+            MpmPattern *mp = parray[i];
+            SCTeddyPattern *tp = &ctx->patterns[i];
+
+            tp->len = mp->len;
+            tp->id = mp->id;
+            tp->nocase = (mp->flags & MPM_PATTERN_FLAG_NOCASE) ? 1 : 0;
+
+            tp->pat = SCMalloc(mp->len);
+            if (tp->pat == NULL) {
+                SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(tp->pat, tp->nocase ? mp->ci : mp->cs, mp->len);
+            mpm_ctx->memory_cnt++;
+            mpm_ctx->memory_size += mp->len;
+
+            /* SCTeddyPattern now owns this memory */
+            tp->sids_size = mp->sids_size;
+            tp->sids = mp->sids;
+            mp->sids_size = 0;
+            mp->sids = NULL;
+
+            TeddySetMasks(ctx, b, tp);
+        }
+    }
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        MpmFreePattern(mpm_ctx, parray[i]);
+    }
+    SCFree(parray);
+
+    ctx->pattern_id_bitarray_size = (mpm_ctx->max_pat_id / 8) + 1;
+    SCLogDebug("%u patterns, mask len %u", mpm_ctx->pattern_cnt, ctx->mask_len);
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/** \internal
+ *  \brief check the patterns of the candidate buckets at 'pos'
+ *
+ *  \retval matches number of patterns matching at 'pos'
+ */
+static inline uint32_t TeddyVerify(const SCTeddyCtx *ctx, PatternMatcherQueue *pmq,
+        const uint8_t *buf, uint32_t buflen, uint32_t pos, uint32_t buckets,
+        uint8_t *bitarray)
+{
+    uint32_t matches = 0;
+
+    while (buckets != 0) {
+        int b = __builtin_ctz(buckets);
+        buckets &= buckets - 1;
+
+        uint32_t x;
+        for (x = ctx->bucket_start[b]; x < ctx->bucket_start[b + 1]; x++) {
+            const SCTeddyPattern *p = &ctx->patterns[x];
+            if (p->len > buflen - pos)
+                continue;
+
+            if (p->nocase) {
+                if (SCMemcmpLowercase(p->pat, buf + pos, p->len) != 0)
+                    continue;
+            } else {
+                if (SCMemcmp(p->pat, buf + pos, p->len) != 0)
+                    continue;
+            }
+
+            if (!(bitarray[p->id / 8] & (1 << (p->id % 8)))) {
+                bitarray[p->id / 8] |= (1 << (p->id % 8));
+                MpmAddSids(pmq, p->sids, p->sids_size);
+            }
+            matches++;
+        }
+    }
+    return matches;
+}
+
+#if defined(__AVX2__)
+static inline __m256i TeddyMask256(const __m256i lo, const __m256i hi,
+                                   const uint8_t *data)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i d = _mm256_loadu_si256((const __m256i *)data);
+    __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(d, nibble));
+    __m256i h = _mm256_shuffle_epi8(hi,
+            _mm256_and_si256(_mm256_srli_epi16(d, 4), nibble));
+    return _mm256_and_si256(l, h);
+}
+#elif defined(__SSSE3__)
+static inline __m128i TeddyMask128(const __m128i lo, const __m128i hi,
+                                   const uint8_t *data)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i d = _mm_loadu_si128((const __m128i *)data);
+    __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(d, nibble));
+    __m128i h = _mm_shuffle_epi8(hi,
+            _mm_and_si128(_mm_srli_epi16(d, 4), nibble));
+    return _mm_and_si128(l, h);
+}
+#endif
+
+/**
+ * \brief The teddy search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Not used.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCTeddySearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen)
+{
+    const SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    const uint32_t mask_len = ctx->mask_len;
+    uint32_t matches = 0;
+    const uint32_t sids_start = pmq->rule_id_array_cnt;
+    uint32_t i = 0;
+
+    if (ctx->patterns == NULL || buflen < mask_len)
+        return 0;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+#if defined(__AVX2__)
+    {
+        /* pshufb works per 128 bit lane, so use the tables in both */
+        __m256i lo[TEDDY_MAX_MASK_LEN], hi[TEDDY_MAX_MASK_LEN];
+        uint32_t k;
+        for (k = 0; k < mask_len; k++) {
+            lo[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)ctx->lo[k]));
+            hi[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)ctx->hi[k]));
+        }
+        const __m256i zero = _mm256_setzero_si256();
+
+        /* the last mask reads mask_len - 1 bytes past the block */
+        for ( ; i + 32 + mask_len - 1 <= buflen; i += 32) {
+            __m256i r = TeddyMask256(lo[0], hi[0], buf + i);
+            for (k = 1; k < mask_len; k++)
+                r = _mm256_and_si256(r, TeddyMask256(lo[k], hi[k], buf + i + k));
+
+            uint32_t cand = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(r, zero));
+            if (cand == 0)
+                continue;
+
+            uint8_t res[32];
+            _mm256_storeu_si256((__m256i *)res, r);
+            while (cand != 0) {
+                uint32_t j = __builtin_ctz(cand);
+                cand &= cand - 1;
+                matches += TeddyVerify(ctx, pmq, buf, buflen, i + j, res[j], bitarray);
+            }
+        }
+    }
+#elif defined(__SSSE3__)
+    {
+        __m128i lo[TEDDY_MAX_MASK_LEN], hi[TEDDY_MAX_MASK_LEN];
+        uint32_t k;
+        for (k = 0; k < mask_len; k++) {
+            lo[k] = _mm_loadu_si128((const __m128i *)ctx->lo[k]);
+            hi[k] = _mm_loadu_si128((const __m128i *)ctx->hi[k]);
+        }
+        const __m128i zero = _mm_setzero_si128();
+
+        /* the last mask reads mask_len - 1 bytes past the block */
+        for ( ; i + 16 + mask_len - 1 <= buflen; i += 16) {
+            __m128i r = TeddyMask128(lo[0], hi[0], buf + i);
+            for (k = 1; k < mask_len; k++)
+                r = _mm_and_si128(r, TeddyMask128(lo[k], hi[k], buf + i + k));
+
+            uint32_t cand = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(r, zero)) & 0xffff;
+            if (cand == 0)
+                continue;
+
+            uint8_t res[16];
+            _mm_storeu_si128((__m128i *)res, r);
+            while (cand != 0) {
+                uint32_t j = __builtin_ctz(cand);
+                cand &= cand - 1;
+                matches += TeddyVerify(ctx, pmq, buf, buflen, i + j, res[j], bitarray);
+            }
+        }
+    }
+#endif
+
+    /* tail, or everything if we have no SSSE3: same tables, byte by byte */
+    for ( ; i + mask_len <= buflen; i++) {
+        uint8_t r = 0xff;
+        uint32_t k;
+        for (k = 0; k < mask_len; k++) {
+            uint8_t c = buf[i + k];
+            r &= ctx->lo[k][c & 0x0f] & ctx->hi[k][c >> 4];
+        }
+        if (r != 0)
+            matches += TeddyVerify(ctx, pmq, buf, buflen, i, r, bitarray);
+    }
+
+    MpmCtxMapSids(mpm_ctx, pmq, sids_start);
+    return matches;
+}
+
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+    return;
+}
+
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    printf("MPM Teddy Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCTeddyCtx:    %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyCtx));
+    printf("  SCTeddyPattern %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyPattern));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Mask length:     %" PRIu32 "\n", ctx->mask_len);
+    printf("\n");
+}
+
+/**
+ * \brief Register the teddy mpm.
+ */
+void MpmTeddyRegister(void)
+{
+    mpm_table[MPM_TEDDY].name = "teddy";
+    mpm_table[MPM_TEDDY].InitCtx = SCTeddyInitCtx;
+    mpm_table[MPM_TEDDY].InitThreadCtx = SCTeddyInitThreadCtx;
+    mpm_table[MPM_TEDDY].DestroyCtx = SCTeddyDestroyCtx;
+    mpm_table[MPM_TEDDY].DestroyThreadCtx = SCTeddyDestroyThreadCtx;
+    mpm_table[MPM_TEDDY].AddPattern = SCTeddyAddPatternCS;
+    mpm_table[MPM_TEDDY].AddPatternNocase = SCTeddyAddPatternCI;
+    mpm_table[MPM_TEDDY].Prepare = SCTeddyPreparePatterns;
+    mpm_table[MPM_TEDDY].Search = SCTeddySearch;
+    mpm_table[MPM_TEDDY].Cleanup = NULL;
+    mpm_table[MPM_TEDDY].PrintCtx = SCTeddyPrintInfo;
+    mpm_table[MPM_TEDDY].PrintThreadCtx = SCTeddyPrintSearchStats;
+    mpm_table[MPM_TEDDY].RegisterUnittests = SCTeddyRegisterTests;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static int SCTeddyTest01(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    /* 1 match */
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCTeddyPreparePatterns(&mpm_ctx) != 0);
+
+    const char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 1);
+    FAIL_IF(pmq.rule_id_array_cnt != 1);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test nocase and case sensitive patterns */
+static int SCTeddyTest02(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"XYZ", 3, 0, 0, 1, 1, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCTeddyPreparePatterns(&mpm_ctx) != 0);
+
+    /* ci matches 3 times, cs not at all */
+    const char *buf = "abcdABCDaBcDxyzxYz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 3);
+    FAIL_IF(pmq.rule_id_array_cnt != 1);
+    FAIL_IF(pmq.rule_id_array[0] != 0);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test matches at the start, the end and across the SIMD blocks,
+ *        patterns that don't fit at the end of the buffer */
+static int SCTeddyTest03(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"start", 5, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"cross16", 7, 0, 0, 1, 1, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"cross32", 7, 0, 0, 2, 2, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"end", 3, 0, 0, 3, 3, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"endless", 7, 0, 0, 4, 4, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCTeddyPreparePatterns(&mpm_ctx) != 0);
+
+    uint8_t buf[64];
+    memset(buf, '.', sizeof(buf));
+    memcpy(buf, "start", 5);
+    memcpy(buf + 12, "cross16", 7);
+    memcpy(buf + 29, "cross32", 7);
+    memcpy(buf + 61, "end", 3);
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 buf, sizeof(buf));
+    FAIL_IF(cnt != 4);
+    FAIL_IF(pmq.rule_id_array_cnt != 4);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test one byte patterns and buffers shorter than the masks */
+static int SCTeddyTest04(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"A", 1, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"bc", 2, 0, 0, 1, 1, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCTeddyPreparePatterns(&mpm_ctx) != 0);
+
+    const char *buf = "aAAbBCaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabc";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 4);
+    FAIL_IF(pmq.rule_id_array_cnt != 2);
+
+    PmqReset(&pmq);
+    cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)"B", 1);
+    FAIL_IF(cnt != 0);
+    cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)"", 0);
+    FAIL_IF(cnt != 0);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test same results as AC for a full set of patterns on random data */
+static int SCTeddyTest05(void)
+{
+    MpmCtx teddy_ctx, ac_ctx;
+    MpmThreadCtx teddy_tctx, ac_tctx;
+    PatternMatcherQueue pmq;
+    uint32_t seed = 1234;
+
+    memset(&teddy_ctx, 0, sizeof(MpmCtx));
+    memset(&ac_ctx, 0, sizeof(MpmCtx));
+    memset(&teddy_tctx, 0, sizeof(MpmThreadCtx));
+    memset(&ac_tctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&teddy_ctx, MPM_TEDDY);
+    MpmInitCtx(&ac_ctx, MPM_AC);
+    mpm_table[MPM_TEDDY].InitThreadCtx(&teddy_ctx, &teddy_tctx);
+    mpm_table[MPM_AC].InitThreadCtx(&ac_ctx, &ac_tctx);
+    PmqSetup(&pmq);
+
+    /* small alphabet so that there are plenty of matches */
+    uint32_t i, j;
+    for (i = 0; i < 64; i++) {
+        uint8_t pat[8];
+        uint16_t len = 2 + i % 6;
+        for (j = 0; j < len; j++) {
+            seed = seed * 1103515245 + 12345;
+            pat[j] = "abcdABCD"[(seed >> 16) % 8];
+        }
+        if (i % 3 == 0) {
+            MpmAddPatternCI(&teddy_ctx, pat, len, 0, 0, i, i, 0);
+            MpmAddPatternCI(&ac_ctx, pat, len, 0, 0, i, i, 0);
+        } else {
+            MpmAddPatternCS(&teddy_ctx, pat, len, 0, 0, i, i, 0);
+            MpmAddPatternCS(&ac_ctx, pat, len, 0, 0, i, i, 0);
+        }
+    }
+    FAIL_IF(mpm_table[MPM_TEDDY].Prepare(&teddy_ctx) != 0);
+    FAIL_IF(mpm_table[MPM_AC].Prepare(&ac_ctx) != 0);
+
+    uint8_t buf[1000];
+    for (i = 0; i < 50; i++) {
+        uint16_t len = (uint16_t)(i * 19 % sizeof(buf));
+        for (j = 0; j < len; j++) {
+            seed = seed * 1103515245 + 12345;
+            buf[j] = "abcdABCDxy"[(seed >> 16) % 10];
+        }
+
+        PmqReset(&pmq);
+        uint32_t ac_cnt = mpm_table[MPM_AC].Search(&ac_ctx, &ac_tctx,
+                                                   &pmq, buf, len);
+        uint32_t ac_sids = pmq.rule_id_array_cnt;
+
+        PmqReset(&pmq);
+        uint32_t teddy_cnt = mpm_table[MPM_TEDDY].Search(&teddy_ctx, &teddy_tctx,
+                                                         &pmq, buf, len);
+        FAIL_IF(teddy_cnt != ac_cnt);
+        FAIL_IF(pmq.rule_id_array_cnt != ac_sids);
+    }
+
+    mpm_table[MPM_TEDDY].DestroyCtx(&teddy_ctx);
+    mpm_table[MPM_AC].DestroyCtx(&ac_ctx);
+    mpm_table[MPM_TEDDY].DestroyThreadCtx(&teddy_ctx, &teddy_tctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(&ac_ctx, &ac_tctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void SCTeddyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCTeddyTest01", SCTeddyTest01);
+    UtRegisterTest("SCTeddyTest02", SCTeddyTest02);
+    UtRegisterTest("SCTeddyTest03", SCTeddyTest03);
+    UtRegisterTest("SCTeddyTest04", SCTeddyTest04);
+    UtRegisterTest("SCTeddyTest05", SCTeddyTest05);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,72 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy: SIMD nibble mask MPM for small pattern sets.
+ */
+
+#ifndef __UTIL_MPM_TEDDY__H__
+#define __UTIL_MPM_TEDDY__H__
+
+/** number of buckets, one bit each in the masks */
+#define TEDDY_BUCKETS           8
+/** max number of pattern bytes used by the masks */
+#define TEDDY_MAX_MASK_LEN      3
+
+/** pattern sets up to this size are handed to teddy instead of AC. With
+ *  more patterns the buckets fill up and verification dominates, see
+ *  benches/teddy.c */
+#define TEDDY_MAX_PATTERNS      32
+/** min pattern length for teddy. With 1 byte patterns the masks
+ *  don't filter anything so AC is at least as fast. */
+#define TEDDY_MIN_PATTERN_LEN   2
+
+typedef struct SCTeddyPattern_ {
+    /* pattern to compare: original if case sensitive, lowercase if not */
+    uint8_t *pat;
+    uint16_t len;
+    uint8_t nocase;
+    /* pattern id */
+    uint32_t id;
+
+    /* sid(s) for this pattern */
+    uint32_t sids_size;
+    SigIntId *sids;
+} SCTeddyPattern;
+
+typedef struct SCTeddyCtx_ {
+    /* low and high nibble masks per pattern byte. A set bit means a
+     * pattern of that bucket can have the nibble at that position. */
+    uint8_t lo[TEDDY_MAX_MASK_LEN][16];
+    uint8_t hi[TEDDY_MAX_MASK_LEN][16];
+
+    /* number of pattern bytes used by the masks */
+    uint16_t mask_len;
+
+    uint32_t pattern_id_bitarray_size;
+
+    /* patterns sorted by bucket, bucket b is
+     * patterns[bucket_start[b]] up to patterns[bucket_start[b+1]] */
+    SCTeddyPattern *patterns;
+    uint32_t bucket_start[TEDDY_BUCKETS + 1];
+} SCTeddyCtx;
+
+void MpmTeddyRegister(void);
+
+#endif /* __UTIL_MPM_TEDDY__H__ */
@@ -31,7 +31,9 @@
 #include "util-mpm-ac.h"
 #include "util-mpm-ac-bs.h"
 #include "util-mpm-ac-tile.h"
+#include "util-mpm-ac-compact.h"
 #include "util-mpm-hs.h"
+#include "util-mpm-teddy.h"
 #include "util-hashlist.h"
 
 #include "detect-engine.h"
@@ -515,6 +517,8 @@ void MpmTableSetup(void)
     MpmACRegister();
     MpmACBSRegister();
     MpmACTileRegister();
+    MpmACCompactRegister();
+    MpmTeddyRegister();
 #ifdef BUILD_HYPERSCAN
     MpmHSRegister();
 #endif /* BUILD_HYPERSCAN */
@@ -38,7 +38,10 @@ enum {
 #endif
     MPM_AC_BS,
     MPM_AC_TILE,
+    MPM_AC_COMPACT,
     MPM_HS,
+    /* teddy, for small pattern sets */
+    MPM_TEDDY,
     /* table size */
     MPM_TABLE_SIZE,
 };
@@ -123,6 +126,16 @@ typedef struct MpmCtx_ {
 
     uint32_t max_pat_id;
 
+    /* number of MpmStores using this ctx. A prepared unique ctx can be
+     * shared by the stores of the old and new detect engine on reload */
+    uint32_t refcnt;
+
+    /* set if this ctx shares the prepared ctx 'owner' of an older detect
+     * engine in which the sigs have other nums. The matchers translate
+     * the owner's sig nums through sid_map. */
+    struct MpmCtx_ *owner;
+    const SigIntId *sid_map;
+
     /* hash used during ctx initialization */
     MpmPattern **init_hash;
 } MpmCtx;
@@ -292,4 +305,20 @@ MpmAddSids(PatternMatcherQueue *pmq, SigIntId *sids, uint32_t sids_size)
     } while (ptr != end);
     pmq->rule_id_array_cnt += sids_size;
 }
+
+/** \brief Translate the Signature IDs a search of mpm_ctx added to the
+ *         rule ID array from index start on, if the ctx shares the
+ *         prepared ctx of another detect engine. See MpmCtx::sid_map.
+ */
+static inline void
+MpmCtxMapSids(const MpmCtx *mpm_ctx, PatternMatcherQueue *pmq, uint32_t start)
+{
+    if (mpm_ctx->sid_map == NULL)
+        return;
+
+    uint32_t u;
+    for (u = start; u < pmq->rule_id_array_cnt; u++) {
+        pmq->rule_id_array[u] = mpm_ctx->sid_map[pmq->rule_id_array[u]];
+    }
+}
 #endif /* __UTIL_MPM_H__ */
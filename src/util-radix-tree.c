@@ -473,6 +473,42 @@ void SCRadixReleaseRadixTree(SCRadixTree *tree)
     return;
 }
 
+/**
+ * \brief Internal helper function used by SCRadixForEachUserData to walk a
+ *        subtree
+ */
+static void SCRadixForEachUserDataSubtree(SCRadixNode *node,
+        void (*Func)(void *, void *), void *data)
+{
+    if (node != NULL) {
+        SCRadixForEachUserDataSubtree(node->left, Func, data);
+        SCRadixForEachUserDataSubtree(node->right, Func, data);
+
+        if (node->prefix != NULL) {
+            SCRadixUserData *ud = node->prefix->user_data;
+            for ( ; ud != NULL; ud = ud->next)
+                Func(ud->user, data);
+        }
+    }
+}
+
+/**
+ * \brief Calls a function for the user data of every key and netblock in
+ *        the Radix tree
+ *
+ * \param tree Pointer to the Radix tree
+ * \param Func Function called with the user data and data as arguments
+ * \param data Pointer passed on to Func
+ */
+void SCRadixForEachUserData(SCRadixTree *tree, void (*Func)(void *, void *),
+                            void *data)
+{
+    if (tree == NULL)
+        return;
+
+    SCRadixForEachUserDataSubtree(tree->head, Func, data);
+}
+
 /**
  * \brief Adds a key to the Radix tree.  Used internally by the API.
  *
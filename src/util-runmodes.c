@@ -83,6 +83,27 @@ char *RunmodeAutoFpCreatePickupQueuesString(int n)
     return queues;
 }
 
+/** \brief get the queue handler autofp uses to pass packets from the
+ *         capture threads to the workers.
+ *
+ *  Set through "autofp-queue": "locked" (default) or "ring".
+ */
+char *RunmodeAutoFpQueueHandler(void)
+{
+    char *queue = NULL;
+
+    if (ConfGet("autofp-queue", &queue) == 1) {
+        if (strcasecmp(queue, "ring") == 0) {
+            return "flow-ring";
+        } else if (strcasecmp(queue, "locked") != 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
+                       "for autofp-queue in conf.  Killing engine.", queue);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return "flow";
+}
+
 /**
  */
 int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
@@ -135,7 +156,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
             ThreadVars *tv_receive =
                 TmThreadCreatePacketHandler(tname,
                         "packetpool", "packetpool",
-                        queues, "flow", "pktacqloop");
+                        queues, RunmodeAutoFpQueueHandler(), "pktacqloop");
             if (tv_receive == NULL) {
                 SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                 exit(EXIT_FAILURE);
@@ -195,7 +216,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
                 ThreadVars *tv_receive =
                     TmThreadCreatePacketHandler(tname,
                             "packetpool", "packetpool",
-                            queues, "flow", "pktacqloop");
+                            queues, RunmodeAutoFpQueueHandler(), "pktacqloop");
                 if (tv_receive == NULL) {
                     SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                     exit(EXIT_FAILURE);
@@ -232,7 +253,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, RunmodeAutoFpQueueHandler(),
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -462,7 +483,7 @@ int RunModeSetIPSAutoFp(ConfigIPSParserFunc ConfigParser,
         ThreadVars *tv_receive =
             TmThreadCreatePacketHandler(tname,
                     "packetpool", "packetpool",
-                    queues, "flow", "pktacqloop");
+                    queues, RunmodeAutoFpQueueHandler(), "pktacqloop");
         if (tv_receive == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
@@ -497,7 +518,7 @@ int RunModeSetIPSAutoFp(ConfigIPSParserFunc ConfigParser,
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, RunmodeAutoFpQueueHandler(),
                                         "verdict-queue", "simple",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -65,5 +65,6 @@ int RunModeSetIPSWorker(ConfigIPSParserFunc ConfigParser,
                         const char *decode_mod_name);
 
 char *RunmodeAutoFpCreatePickupQueuesString(int n);
+char *RunmodeAutoFpQueueHandler(void);
 
 #endif /* __UTIL_RUNMODES_H__ */
@@ -0,0 +1,221 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Lock free single producer, single consumer ring of pointers.
+ *
+ * Head and tail are free running 32 bit counters, the slot is found by
+ * masking with (size - 1). Both the put and get side work on batches:
+ * a batch of N items costs one index update and so one memory barrier,
+ * instead of one per item.
+ *
+ * Multi producer setups are handled by the users of this api by giving
+ * each producer its own ring, see tmqh-flow-ring.c.
+ */
+
+#include "suricata-common.h"
+#include "util-spsc-ring.h"
+#include "util-atomic.h"
+#include "util-unittest.h"
+
+/** \brief create a new ring
+ *  \param size number of slots, rounded up to the next power of 2
+ *  \retval r ring or NULL on error */
+SpscRing *SpscRingInit(uint32_t size)
+{
+    if (size < 2 || size > (1U << 31))
+        return NULL;
+
+    uint32_t rsize = 2;
+    while (rsize < size)
+        rsize <<= 1;
+
+    SpscRing *r = SCMallocAligned(sizeof(SpscRing), CLS);
+    if (unlikely(r == NULL))
+        return NULL;
+    memset(r, 0x00, sizeof(SpscRing));
+
+    r->array = SCCalloc(rsize, sizeof(void *));
+    if (unlikely(r->array == NULL)) {
+        SCFreeAligned(r);
+        return NULL;
+    }
+    r->size = rsize;
+    r->mask = rsize - 1;
+
+    SC_ATOMIC_INIT(r->prod.head);
+    SC_ATOMIC_INIT(r->cons.tail);
+    return r;
+}
+
+void SpscRingFree(SpscRing *r)
+{
+    if (r == NULL)
+        return;
+
+    SC_ATOMIC_DESTROY(r->prod.head);
+    SC_ATOMIC_DESTROY(r->cons.tail);
+    SCFree(r->array);
+    SCFreeAligned(r);
+}
+
+/** \brief put up to 'n' items into the ring
+ *
+ *  Producer side only.
+ *
+ *  \retval cnt number of items stored, can be less than 'n' if the
+ *              ring is (almost) full */
+uint32_t SpscRingPutBatch(SpscRing *r, void **items, uint32_t n)
+{
+    const uint32_t head = SC_ATOMIC_GET(r->prod.head);
+    uint32_t space = r->size - (head - r->prod.tail_cache);
+
+    if (space < n) {
+        cc_barrier();
+        r->prod.tail_cache = SC_ATOMIC_GET(r->cons.tail);
+        space = r->size - (head - r->prod.tail_cache);
+        if (space == 0)
+            return 0;
+        if (n > space)
+            n = space;
+    }
+
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        r->array[(head + i) & r->mask] = items[i];
+    }
+
+    /* atomic add is a full barrier, so the slots are visible before
+     * the consumer can see the new head */
+    (void)SC_ATOMIC_ADD(r->prod.head, n);
+    return n;
+}
+
+/** \brief get up to 'n' items from the ring
+ *
+ *  Consumer side only.
+ *
+ *  \retval cnt number of items stored in 'items' */
+uint32_t SpscRingGetBatch(SpscRing *r, void **items, uint32_t n)
+{
+    const uint32_t tail = SC_ATOMIC_GET(r->cons.tail);
+    uint32_t avail = r->cons.head_cache - tail;
+
+    if (avail < n) {
+        cc_barrier();
+        r->cons.head_cache = SC_ATOMIC_GET(r->prod.head);
+        /* don't let slot reads move before the head read */
+        hw_barrier();
+        avail = r->cons.head_cache - tail;
+        if (avail == 0)
+            return 0;
+        if (n > avail)
+            n = avail;
+    }
+
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        items[i] = r->array[(tail + i) & r->mask];
+    }
+
+    /* full barrier: slots are read before the producer may reuse them */
+    (void)SC_ATOMIC_ADD(r->cons.tail, n);
+    return n;
+}
+
+/** \brief get number of items in the ring
+ *
+ *  Safe to call from any thread, but the result is only a snapshot. */
+uint32_t SpscRingCount(SpscRing *r)
+{
+    cc_barrier();
+    return SC_ATOMIC_GET(r->prod.head) - SC_ATOMIC_GET(r->cons.tail);
+}
+
+#ifdef UNITTESTS
+static int SpscRingTest01(void)
+{
+    SpscRing *r = SpscRingInit(5);
+    FAIL_IF_NULL(r);
+    FAIL_IF(r->size != 8);
+    FAIL_IF(SpscRingCount(r) != 0);
+
+    uintptr_t i;
+    for (i = 1; i <= 8; i++) {
+        FAIL_IF(SpscRingPut(r, (void *)i) != 1);
+    }
+    /* full */
+    FAIL_IF(SpscRingPut(r, (void *)9) != 0);
+    FAIL_IF(SpscRingCount(r) != 8);
+
+    void *out[8];
+    FAIL_IF(SpscRingGetBatch(r, out, 3) != 3);
+    FAIL_IF(out[0] != (void *)1 || out[2] != (void *)3);
+    FAIL_IF(SpscRingCount(r) != 5);
+
+    SpscRingFree(r);
+    PASS;
+}
+
+/** \test batches wrapping around the end of the array */
+static int SpscRingTest02(void)
+{
+    SpscRing *r = SpscRingInit(8);
+    FAIL_IF_NULL(r);
+
+    void *in[6] = { (void *)1, (void *)2, (void *)3, (void *)4, (void *)5, (void *)6 };
+    void *out[8];
+    int round;
+    uintptr_t expect = 1;
+    for (round = 0; round < 10; round++) {
+        FAIL_IF(SpscRingPutBatch(r, in, 6) != 6);
+        /* only 2 slots left */
+        FAIL_IF(SpscRingPutBatch(r, in, 6) != 2);
+
+        uint32_t cnt = SpscRingGetBatch(r, out, 8);
+        FAIL_IF(cnt != 8);
+        uint32_t u;
+        for (u = 0; u < 6; u++) {
+            FAIL_IF(out[u] != (void *)(expect + u));
+        }
+        FAIL_IF(out[6] != (void *)1 || out[7] != (void *)2);
+        FAIL_IF(SpscRingGetBatch(r, out, 8) != 0);
+    }
+
+    SpscRingFree(r);
+    PASS;
+}
+
+/** \test invalid sizes */
+static int SpscRingTest03(void)
+{
+    FAIL_IF_NOT_NULL(SpscRingInit(0));
+    FAIL_IF_NOT_NULL(SpscRingInit(1));
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void SpscRingRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SpscRingTest01", SpscRingTest01);
+    UtRegisterTest("SpscRingTest02", SpscRingTest02);
+    UtRegisterTest("SpscRingTest03", SpscRingTest03);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,72 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * See the .c file for a full explanation.
+ */
+
+#ifndef __UTIL_SPSC_RING_H__
+#define __UTIL_SPSC_RING_H__
+
+#include "util-atomic.h"
+
+/** \brief lock free single producer, single consumer ring
+ *
+ *  The producer owns 'head', the consumer owns 'tail'. Each lives on its
+ *  own cache line so the two sides don't bounce a line between cores on
+ *  every operation. Both sides keep a cached copy of the other side's
+ *  index and only reload it when the ring looks full/empty.
+ */
+typedef struct SpscRing_ {
+    /* producer cache line */
+    struct {
+        SC_ATOMIC_DECLARE(uint32_t, head);  /**< next slot to write */
+        uint32_t tail_cache;                /**< producer's view of tail */
+    } __attribute__((aligned(CLS))) prod;
+
+    /* consumer cache line */
+    struct {
+        SC_ATOMIC_DECLARE(uint32_t, tail);  /**< next slot to read */
+        uint32_t head_cache;                /**< consumer's view of head */
+    } __attribute__((aligned(CLS))) cons;
+
+    /* read only after init */
+    uint32_t size;      /**< number of slots, power of 2 */
+    uint32_t mask;      /**< size - 1 */
+    void **array;
+} __attribute__((aligned(CLS))) SpscRing;
+
+SpscRing *SpscRingInit(uint32_t size);
+void SpscRingFree(SpscRing *);
+
+uint32_t SpscRingPutBatch(SpscRing *, void **items, uint32_t n);
+uint32_t SpscRingGetBatch(SpscRing *, void **items, uint32_t n);
+uint32_t SpscRingCount(SpscRing *);
+
+/** \brief put a single item into the ring
+ *  \retval 1 item stored
+ *  \retval 0 ring full */
+static inline int SpscRingPut(SpscRing *r, void *item)
+{
+    return (int)SpscRingPutBatch(r, &item, 1);
+}
+
+void SpscRingRegisterTests(void);
+
+#endif /* __UTIL_SPSC_RING_H__ */
@@ -77,6 +77,8 @@ void StreamingBufferClear(StreamingBuffer *sb)
         if (sb->buf != NULL) {
             FREE(sb->cfg, sb->buf, sb->buf_size);
             sb->buf = NULL;
+            sb->buf_size = 0;
+            sb->buf_offset = 0;
         }
     }
 }
@@ -280,20 +282,23 @@ void StreamingBufferAppendNoTrack(StreamingBuffer *sb,
     ((offset) + (len) <= (sb)->buf_size)
 
 /**
+ *  \brief add data at offset w/o tracking a segment
+ *
  *  \param offset offset relative to StreamingBuffer::stream_offset
+ *
+ *  \retval 0 ok
+ *  \retval -1 offset is before the buffer or the buffer couldn't grow
  */
-void StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
-                             const uint8_t *data, uint32_t data_len,
-                             uint64_t offset)
+int StreamingBufferInsertAtNoTrack(StreamingBuffer *sb,
+                                   const uint8_t *data, uint32_t data_len,
+                                   uint64_t offset)
 {
-    BUG_ON(seg == NULL);
-
     if (offset < sb->stream_offset)
-        return;
+        return -1;
 
     if (sb->buf == NULL) {
         if (InitBuffer(sb) == -1)
-            return;
+            return -1;
     }
 
     uint32_t rel_offset = offset - sb->stream_offset;
@@ -306,15 +311,88 @@ void StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
             GrowToSize(sb, (rel_offset + data_len));
         }
     }
-    BUG_ON(!DATA_FITS_AT_OFFSET(sb, data_len, rel_offset));
+    if (!DATA_FITS_AT_OFFSET(sb, data_len, rel_offset)) {
+        return -1;
+    }
 
     memcpy(sb->buf + rel_offset, data, data_len);
-    seg->stream_offset = offset;
-    seg->segment_len = data_len;
     if (rel_offset + data_len > sb->buf_offset)
         sb->buf_offset = rel_offset + data_len;
+    return 0;
+}
+
+/**
+ *  \param offset offset relative to StreamingBuffer::stream_offset
+ *
+ *  \retval 0 ok
+ *  \retval -1 offset is before the buffer or the buffer couldn't grow
+ */
+int StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
+                            const uint8_t *data, uint32_t data_len,
+                            uint64_t offset)
+{
+    BUG_ON(seg == NULL);
+
+    if (StreamingBufferInsertAtNoTrack(sb, data, data_len, offset) < 0)
+        return -1;
+
+    seg->stream_offset = offset;
+    seg->segment_len = data_len;
+    return 0;
+}
+
+/**
+ *  \brief make sure the buffer can hold data up to 'offset'
+ *
+ *  \param offset offset relative to StreamingBuffer::stream_offset
+ *
+ *  \retval 0 ok
+ *  \retval -1 offset is before the buffer or the buffer couldn't grow
+ */
+int StreamingBufferReserve(StreamingBuffer *sb, uint64_t offset)
+{
+    if (offset < sb->stream_offset)
+        return -1;
+
+    if (sb->buf == NULL) {
+        if (InitBuffer(sb) == -1)
+            return -1;
+    }
+
+    uint32_t rel_offset = offset - sb->stream_offset;
+    if (rel_offset > sb->buf_size) {
+        GrowToSize(sb, rel_offset);
+        if (rel_offset > sb->buf_size)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ *  \brief make room for 'len' bytes in front of the data
+ *
+ *  The data is moved up by 'len' bytes and the room in front of it
+ *  is zeroed. stream_offset is not updated, so the caller has to
+ *  account for the shift in the offsets it tracks itself.
+ *
+ *  \retval 0 ok
+ *  \retval -1 the buffer couldn't grow
+ */
+int StreamingBufferShiftUp(StreamingBuffer *sb, uint32_t len)
+{
+    if (sb->buf == NULL)
+        return 0;
 
+    if (!DATA_FITS(sb, len)) {
+        GrowToSize(sb, sb->buf_offset + len);
+        if (!DATA_FITS(sb, len))
+            return -1;
+    }
 
+    memmove(sb->buf + len, sb->buf, sb->buf_offset);
+    memset(sb->buf, 0, len);
+    sb->buf_offset += len;
+    return 0;
 }
 
 int StreamingBufferSegmentIsBeforeWindow(const StreamingBuffer *sb,
@@ -711,6 +789,39 @@ static int StreamingBufferTest05(void)
     StreamingBufferClear(&sb);
     PASS;
 }
+
+/** \test reserve, insert w/o tracking and shift up */
+static int StreamingBufferTest06(void)
+{
+    StreamingBufferConfig cfg = { 0, 8, 16, NULL, NULL, NULL, NULL };
+    StreamingBuffer sb = STREAMING_BUFFER_INITIALIZER(&cfg);
+
+    FAIL_IF(StreamingBufferReserve(&sb, 20) != 0);
+    FAIL_IF(sb.buf == NULL);
+    FAIL_IF(sb.buf_size < 20);
+    FAIL_IF(sb.buf_offset != 0);
+
+    FAIL_IF(StreamingBufferInsertAtNoTrack(&sb, (const uint8_t *)"BBBB", 4, 4) != 0);
+    FAIL_IF(sb.buf_offset != 8);
+    FAIL_IF(StreamingBufferInsertAtNoTrack(&sb, (const uint8_t *)"AAAA", 4, 0) != 0);
+    FAIL_IF(sb.buf_offset != 8);
+    FAIL_IF(memcmp(sb.buf, "AAAABBBB", 8) != 0);
+
+    FAIL_IF(StreamingBufferShiftUp(&sb, 4) != 0);
+    FAIL_IF(sb.buf_offset != 12);
+    FAIL_IF(sb.stream_offset != 0);
+    FAIL_IF(StreamingBufferInsertAtNoTrack(&sb, (const uint8_t *)"CCCC", 4, 0) != 0);
+    FAIL_IF(memcmp(sb.buf, "CCCCAAAABBBB", 12) != 0);
+
+    StreamingBufferSlideToOffset(&sb, 4);
+    FAIL_IF(sb.stream_offset != 4);
+    FAIL_IF(StreamingBufferInsertAtNoTrack(&sb, (const uint8_t *)"DDDD", 4, 0) == 0);
+
+    StreamingBufferClear(&sb);
+    FAIL_IF(sb.buf != NULL);
+    FAIL_IF(sb.buf_offset != 0);
+    PASS;
+}
 #endif
 
 void StreamingBufferRegisterTests(void)
@@ -721,5 +832,6 @@ void StreamingBufferRegisterTests(void)
     UtRegisterTest("StreamingBufferTest03", StreamingBufferTest03);
     UtRegisterTest("StreamingBufferTest04", StreamingBufferTest04);
     UtRegisterTest("StreamingBufferTest05", StreamingBufferTest05);
+    UtRegisterTest("StreamingBufferTest06", StreamingBufferTest06);
 #endif
 }
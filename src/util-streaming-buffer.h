@@ -110,9 +110,14 @@ void StreamingBufferAppend(StreamingBuffer *sb, StreamingBufferSegment *seg,
         const uint8_t *data, uint32_t data_len);
 void StreamingBufferAppendNoTrack(StreamingBuffer *sb,
         const uint8_t *data, uint32_t data_len);
-void StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
-                             const uint8_t *data, uint32_t data_len,
-                             uint64_t offset);
+int StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
+                            const uint8_t *data, uint32_t data_len,
+                            uint64_t offset);
+int StreamingBufferInsertAtNoTrack(StreamingBuffer *sb,
+                                   const uint8_t *data, uint32_t data_len,
+                                   uint64_t offset);
+int StreamingBufferReserve(StreamingBuffer *sb, uint64_t offset);
+int StreamingBufferShiftUp(StreamingBuffer *sb, uint32_t len);
 
 void StreamingBufferSegmentGetData(const StreamingBuffer *sb,
                                    const StreamingBufferSegment *seg,